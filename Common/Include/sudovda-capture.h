@@ -0,0 +1,91 @@
+#pragma once
+
+// On-disk layout of frame captures written by the driver (IOCTL_START_FRAME_CAPTURE) and by the capture harnesses.
+//
+// Like sudovda-frame.h this header is platform-neutral, do not include any Windows headers here.
+//
+// Two formats are supported:
+//  * Raw + index: the data file holds every frame exactly as it was published to the frame ring, each one starting
+//    at a multiple of SUVDA_CAPTURE_DATA_ALIGNMENT and zero padded up to the next one. A separate index file holds a
+//    SUVDA_CAPTURE_INDEX_HEADER followed by one SUVDA_CAPTURE_INDEX_ENTRY per frame. Any frame format and geometry
+//    changes are recorded.
+//  * Y4M: a YUV4MPEG2 stream of I420 frames converted from BGRA8 (BT.709 limited range, centre sited chroma). The
+//    geometry of the first frame is used for the stream, frames with a different geometry or format are skipped.
+//    The stream carries no timestamps, only the nominal frame rate.
+
+#include <stdint.h>
+
+#include "sudovda-frame.h"
+
+namespace SUDOVDA
+{
+
+#define SUVDA_CAPTURE_INDEX_MAGIC 0x49435653 // 'SVCI'
+#define SUVDA_CAPTURE_VERSION 1
+#define SUVDA_CAPTURE_DATA_ALIGNMENT 4096
+// Appended to the data file's name to name the index file
+#define SUVDA_CAPTURE_INDEX_SUFFIX ".idx"
+// Directory under %ProgramData% captures and traces are written to, created by the driver. Only the system and the
+// driver's service account can write to it, administrators and interactive users can read.
+#define SUVDA_CAPTURE_DIRECTORY "SudoVDA\\Captures"
+
+typedef enum _SUVDA_CAPTURE_FORMAT : uint32_t {
+	SUVDA_CAPTURE_FORMAT_RAW = 1,
+	SUVDA_CAPTURE_FORMAT_Y4M = 2,
+} SUVDA_CAPTURE_FORMAT;
+
+// What happens to a frame published while every capture buffer is still queued for the disk
+typedef enum _SUVDA_CAPTURE_QUEUE_POLICY : uint32_t {
+	SUVDA_CAPTURE_QUEUE_DROP_NEWEST = 0, // Skip the new frame, the capture never delays the display
+	SUVDA_CAPTURE_QUEUE_DROP_OLDEST = 1, // Replace the oldest queued frame, the capture keeps the most recent frames
+	SUVDA_CAPTURE_QUEUE_BLOCK = 2,       // Wait for the disk up to a timeout, which delays the display's frames too
+} SUVDA_CAPTURE_QUEUE_POLICY;
+
+typedef struct _SUVDA_CAPTURE_INDEX_HEADER {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t HeaderSize;
+	uint32_t EntrySize;
+	uint64_t QpcFrequency;            // Ticks per second of the entries' PresentQpc
+} SUVDA_CAPTURE_INDEX_HEADER, * PSUVDA_CAPTURE_INDEX_HEADER;
+
+typedef struct _SUVDA_CAPTURE_INDEX_ENTRY {
+	uint64_t FrameNumber;             // Frame ring publish counter, gaps are frames the capture dropped
+	uint64_t PresentQpc;
+	uint64_t DataOffset;              // Offset of the pixel data in the data file
+	uint64_t DataSize;
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Pitch;
+	uint32_t Format;                  // SUVDA_FRAME_FORMAT
+	uint32_t Flags;                   // SUVDA_FRAME_FLAG_*
+	uint32_t Reserved;
+} SUVDA_CAPTURE_INDEX_ENTRY, * PSUVDA_CAPTURE_INDEX_ENTRY;
+
+static inline uint64_t CaptureAlignUp(uint64_t Value)
+{
+	return (Value + SUVDA_CAPTURE_DATA_ALIGNMENT - 1) / SUVDA_CAPTURE_DATA_ALIGNMENT * SUVDA_CAPTURE_DATA_ALIGNMENT;
+}
+
+// Clients name a file in SUVDA_CAPTURE_DIRECTORY, never a path. Names that could reach outside it or an alternate
+// stream are refused: path separators, colons, "..", and control characters. The driver also refuses to write to
+// anything but a disk file, which covers device names like NUL.
+static inline bool IsCaptureFileName(const wchar_t* pName)
+{
+	if (!pName[0])
+	{
+		return false;
+	}
+
+	for (const wchar_t* p = pName; *p; p++)
+	{
+		if (*p < 32 || *p == L'\\' || *p == L'/' || *p == L':' || (p[0] == L'.' && p[1] == L'.'))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace SUDOVDA
@@ -0,0 +1,298 @@
+#pragma once
+
+// Hardware cursor plane exported by the driver, and the decoding of its shapes.
+//
+// Like sudovda-frame.h this header is platform-neutral, do not include any Windows headers here.
+//
+// The OS draws no cursor into the frames of a monitor with a hardware cursor. The driver passes the position and the
+// raw shape through instead, so streamers can draw the cursor on the client, and can optionally blend it into the
+// exported frames itself (the cursorCompositing setting).
+//
+// Every monitor has a cursor plane in shared memory (IOCTL_GET_CURSOR_PLANE), a single SUVDA_CURSOR_PLANE guarded by a
+// sequence lock:
+//  * The driver makes Sequence odd, writes the state, and makes it even again. The shape bytes are only rewritten
+//    when the shape id changes, a moving cursor costs a few dozen bytes per update.
+//  * Readers copy what they need between two reads of Sequence and retry if it was odd or changed, so any number of
+//    them can poll the cursor without locks or system calls, and never hold up the driver.
+//  * Bursts of moves are coalesced by the driver to about one update per refresh period. The event named by the IOCTL
+//    is signaled after every update for readers that would rather wait than poll.
+// IOCTL_GET_CURSOR returns the same state for clients that can't map the plane.
+//
+// Raw shapes come in the two formats of IDDCX_CURSOR_SHAPE_TYPE, both 32 bits per pixel in B, G, R, A byte order:
+//  * Alpha: straight (not premultiplied) alpha.
+//  * Masked color: the fourth byte is a mask. 0x00 replaces the screen pixel with the color, 0xFF XORs the color into
+//    the screen pixel, so a black XOR pixel is transparent and a white one inverts the screen.
+// DecodeCursorShape() turns either one into a SUVDA_CURSOR_IMAGE, which applies as a single operation per channel:
+//
+//   Screen = (Screen * (255 - Color.A) / 255 + Color) ^ Xor
+//
+// with Color premultiplied and the division rounded to nearest. The screen's own alpha byte is left alone.
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+namespace SUDOVDA
+{
+
+#define SUVDA_CURSOR_PLANE_MAGIC 0x43435653 // 'SVCC'
+#define SUVDA_CURSOR_PLANE_VERSION 1
+
+// Largest cursor width and height the driver asks the OS for, SUVDA_CURSOR_SHAPE_BUFFER_SIZE in sudovda-ioctl.h
+// follows it
+#define SUVDA_CURSOR_MAX_SIZE 64
+
+// The values match IDDCX_CURSOR_SHAPE_TYPE
+typedef enum _SUVDA_CURSOR_SHAPE_TYPE : uint32_t {
+	SUVDA_CURSOR_SHAPE_NONE = 0,         // No shape was ever set
+	SUVDA_CURSOR_SHAPE_MASKED_COLOR = 1,
+	SUVDA_CURSOR_SHAPE_ALPHA = 2,
+} SUVDA_CURSOR_SHAPE_TYPE;
+
+typedef struct _SUVDA_CURSOR_IMAGE {
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t HasXor;                                                // Xor is all zero otherwise
+	uint8_t Color[SUVDA_CURSOR_MAX_SIZE * SUVDA_CURSOR_MAX_SIZE * 4]; // BGRA, premultiplied, A is the coverage
+	uint8_t Xor[SUVDA_CURSOR_MAX_SIZE * SUVDA_CURSOR_MAX_SIZE * 4];   // BGRX, rows of Width pixels like Color
+} SUVDA_CURSOR_IMAGE;
+
+typedef struct _SUVDA_CURSOR_STATE {
+	uint64_t UpdateCount;             // Updates published so far
+	uint64_t UpdateQpc;               // QPC time the driver queried the cursor
+	uint32_t Visible;
+	int32_t X;                        // Top left of the shape in monitor coordinates, may be negative
+	int32_t Y;
+	uint32_t ShapeId;                 // Changes with every new shape, 0 while the OS hasn't set one
+	uint32_t ShapeType;               // SUVDA_CURSOR_SHAPE_TYPE
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Pitch;
+	uint32_t HotX;                    // Hot spot relative to the top left of the shape
+	uint32_t HotY;
+	uint32_t ShapeSize;               // Valid bytes of the raw shape
+	uint32_t Reserved;
+} SUVDA_CURSOR_STATE, * PSUVDA_CURSOR_STATE;
+
+typedef struct _SUVDA_CURSOR_PLANE {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t HeaderSize;
+	uint32_t Reserved;
+	std::atomic<uint64_t> Sequence;   // Odd while the driver writes, advances by two with every update
+	SUVDA_CURSOR_STATE State;
+	uint8_t Shape[SUVDA_CURSOR_MAX_SIZE * SUVDA_CURSOR_MAX_SIZE * 4]; // Raw shape, see DecodeCursorShape()
+} SUVDA_CURSOR_PLANE, * PSUVDA_CURSOR_PLANE;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Cursor plane requires lock-free 64-bit atomics");
+
+/// <summary>
+/// Driver side of the cursor plane. Only one writer may be attached to a plane at a time.
+/// </summary>
+class CursorPlaneWriter
+{
+public:
+	bool Initialize(void* pBase, uint64_t MappingSize)
+	{
+		if (!pBase || MappingSize < sizeof(SUVDA_CURSOR_PLANE))
+		{
+			return false;
+		}
+
+		m_pPlane = static_cast<SUVDA_CURSOR_PLANE*>(pBase);
+
+		memset(pBase, 0, sizeof(SUVDA_CURSOR_PLANE));
+		m_pPlane->Version = SUVDA_CURSOR_PLANE_VERSION;
+		m_pPlane->HeaderSize = sizeof(SUVDA_CURSOR_PLANE);
+		m_pPlane->Sequence.store(0, std::memory_order_relaxed);
+
+		// Magic goes last so a reader never sees a half initialized plane as valid
+		std::atomic_thread_fence(std::memory_order_release);
+		m_pPlane->Magic = SUVDA_CURSOR_PLANE_MAGIC;
+
+		return true;
+	}
+
+	bool IsInitialized() const
+	{
+		return m_pPlane != nullptr;
+	}
+
+	// Publishes State, its UpdateCount is filled in. pShape holds State.ShapeSize bytes of a new shape, pass nullptr
+	// while the shape id stays the same to keep the shape already in the plane.
+	void Publish(const SUVDA_CURSOR_STATE& State, const uint8_t* pShape)
+	{
+		if (!m_pPlane)
+		{
+			return;
+		}
+
+		uint64_t Sequence = m_pPlane->Sequence.load(std::memory_order_relaxed);
+		m_pPlane->Sequence.store(Sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		uint64_t UpdateCount = m_pPlane->State.UpdateCount + 1;
+		uint32_t ShapeSize = pShape ? State.ShapeSize : m_pPlane->State.ShapeSize;
+		m_pPlane->State = State;
+		m_pPlane->State.UpdateCount = UpdateCount;
+		m_pPlane->State.ShapeSize = ShapeSize < sizeof(m_pPlane->Shape) ? ShapeSize : (uint32_t)sizeof(m_pPlane->Shape);
+		if (pShape)
+		{
+			memcpy(m_pPlane->Shape, pShape, m_pPlane->State.ShapeSize);
+		}
+
+		m_pPlane->Sequence.store(Sequence + 2, std::memory_order_release);
+	}
+
+private:
+	SUVDA_CURSOR_PLANE* m_pPlane = nullptr;
+};
+
+/// <summary>
+/// Reader side of the cursor plane. Readers never write to the mapping, every thread should use its own reader.
+/// </summary>
+class CursorPlaneReader
+{
+public:
+	bool Attach(const void* pBase, uint64_t MappingSize)
+	{
+		auto* pPlane = static_cast<const SUVDA_CURSOR_PLANE*>(pBase);
+		if (!pPlane || MappingSize < sizeof(SUVDA_CURSOR_PLANE) || pPlane->Magic != SUVDA_CURSOR_PLANE_MAGIC)
+		{
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (pPlane->Version != SUVDA_CURSOR_PLANE_VERSION || pPlane->HeaderSize < sizeof(SUVDA_CURSOR_PLANE))
+		{
+			return false;
+		}
+
+		m_pPlane = pPlane;
+		m_LastSequence = 0;
+		m_Retries = 0;
+
+		return true;
+	}
+
+	// Whether the driver published anything since the last successful Read()
+	bool HasUpdate() const
+	{
+		return m_pPlane->Sequence.load(std::memory_order_acquire) != m_LastSequence;
+	}
+
+	// Copies a consistent snapshot of the state. The shape is only copied to pShape, which has room for
+	// sizeof(SUVDA_CURSOR_PLANE::Shape) bytes, when its id differs from LastShapeId. ShapeCopied tells whether it
+	// was. Fails if the driver was writing during all of MaxAttempts tries.
+	bool Read(uint32_t LastShapeId, SUVDA_CURSOR_STATE& State, uint8_t* pShape, bool& ShapeCopied, uint32_t MaxAttempts = 1000)
+	{
+		for (uint32_t Attempt = 0; Attempt < MaxAttempts; Attempt++)
+		{
+			uint64_t Sequence = m_pPlane->Sequence.load(std::memory_order_acquire);
+			if (Sequence & 1)
+			{
+				m_Retries++;
+				continue;
+			}
+
+			State = m_pPlane->State;
+			ShapeCopied = pShape && State.ShapeId != LastShapeId && State.ShapeSize <= sizeof(m_pPlane->Shape);
+			if (ShapeCopied)
+			{
+				memcpy(pShape, m_pPlane->Shape, State.ShapeSize);
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_pPlane->Sequence.load(std::memory_order_relaxed) == Sequence)
+			{
+				m_LastSequence = Sequence;
+				return true;
+			}
+
+			m_Retries++;
+		}
+
+		ShapeCopied = false;
+		return false;
+	}
+
+	// Snapshots discarded because the driver wrote at the same time
+	uint64_t Retries() const
+	{
+		return m_Retries;
+	}
+
+private:
+	const SUVDA_CURSOR_PLANE* m_pPlane = nullptr;
+	uint64_t m_LastSequence = 0;
+	uint64_t m_Retries = 0;
+};
+
+// Value / 255 rounded to nearest, exact for every product of two bytes
+static inline uint8_t CursorDiv255(uint32_t Value)
+{
+	Value += 128;
+	return (uint8_t)((Value + (Value >> 8)) >> 8);
+}
+
+// Applies one decoded pixel to a BGRA screen pixel, the reference for every compositing path
+static inline void CursorBlendPixel(uint8_t* pScreen, const uint8_t* pColor, const uint8_t* pXor)
+{
+	uint32_t Keep = 255u - pColor[3];
+	for (uint32_t c = 0; c < 3; c++)
+	{
+		uint32_t Value = CursorDiv255(pScreen[c] * Keep) + pColor[c];
+		pScreen[c] = (uint8_t)((Value > 255 ? 255 : Value) ^ pXor[c]);
+	}
+}
+
+// Decodes a raw shape of Width x Height pixels with rows Pitch bytes apart. Fails for unknown types and shapes larger
+// than SUVDA_CURSOR_MAX_SIZE.
+static inline bool DecodeCursorShape(
+	uint32_t Type, const uint8_t* pShape, uint32_t Pitch, uint32_t Width, uint32_t Height, SUVDA_CURSOR_IMAGE& Image)
+{
+	if ((Type != SUVDA_CURSOR_SHAPE_ALPHA && Type != SUVDA_CURSOR_SHAPE_MASKED_COLOR) ||
+		!Width || !Height || Width > SUVDA_CURSOR_MAX_SIZE || Height > SUVDA_CURSOR_MAX_SIZE || Pitch < Width * 4)
+	{
+		return false;
+	}
+
+	Image.Width = Width;
+	Image.Height = Height;
+	Image.HasXor = 0;
+
+	for (uint32_t y = 0; y < Height; y++)
+	{
+		const uint8_t* pIn = pShape + (size_t)y * Pitch;
+		uint8_t* pColor = Image.Color + y * Width * 4;
+		uint8_t* pXor = Image.Xor + y * Width * 4;
+
+		for (uint32_t x = 0; x < Width * 4; x += 4)
+		{
+			uint8_t A = pIn[x + 3];
+			bool Xor = Type == SUVDA_CURSOR_SHAPE_MASKED_COLOR && A == 0xFF;
+
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				if (Type == SUVDA_CURSOR_SHAPE_ALPHA)
+				{
+					pColor[x + c] = CursorDiv255(pIn[x + c] * (uint32_t)A);
+					pXor[x + c] = 0;
+				}
+				else
+				{
+					pColor[x + c] = Xor ? 0 : pIn[x + c];
+					pXor[x + c] = Xor ? pIn[x + c] : 0;
+				}
+			}
+
+			pColor[x + 3] = Type == SUVDA_CURSOR_SHAPE_ALPHA ? A : (Xor ? 0 : 0xFF);
+			pXor[x + 3] = 0;
+			Image.HasXor |= Xor && (pIn[x] | pIn[x + 1] | pIn[x + 2]);
+		}
+	}
+
+	return true;
+}
+
+} // namespace SUDOVDA
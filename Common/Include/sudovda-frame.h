@@ -0,0 +1,435 @@
+#pragma once
+
+// Shared-memory frame ring exported by the driver for every virtual monitor.
+//
+// This header is platform-neutral on purpose: the driver, consumers and the test/benchmark harnesses all use the
+// same layout and the same publish/acquire protocol. Do not include any Windows headers here.
+//
+// Protocol overview:
+//  * The producer (the swap-chain processing thread) owns the mapping read-write, consumers map it read-only.
+//  * Frame N is always written to slot (N % SlotCount). Every slot is guarded by its own sequence counter that is
+//    odd while the producer is writing and equals (2 * N + 2) once frame N is published.
+//  * WriteIndex is the number of published frames, i.e. the producer index. Each consumer keeps its own read index
+//    locally, so any number of consumers can attach without the producer knowing about them.
+//  * Overrun policy: the producer never waits for consumers. A consumer that falls more than SlotCount frames
+//    behind loses the overwritten frames, and a consumer that is still reading a slot while it is being rewritten
+//    detects this on Release() and must discard what it read.
+//  * Every slot carries the rectangles that changed since the previous frame. A consumer that skipped frames, or sees
+//    SUVDA_FRAME_FLAG_FULL_DAMAGE, must treat the whole frame as changed.
+//  * While the display is idle the producer may publish the last frame again with SUVDA_FRAME_FLAG_REFINEMENT set and
+//    no damage rects. Its pixels equal the previous frame's.
+//  * Every slot carries the QPC times the frame was presented, acquired by the driver and published. A consumer can
+//    take its own QPC time on acquire to measure its pickup latency, see sudovda-trace.h.
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+namespace SUDOVDA
+{
+
+#define SUVDA_FRAME_RING_MAGIC 0x52465653 // 'SVFR'
+#define SUVDA_FRAME_RING_VERSION 3
+#define SUVDA_FRAME_RING_MAX_SLOTS 16
+#define SUVDA_FRAME_RING_DATA_ALIGNMENT 4096
+#define SUVDA_FRAME_MAX_DAMAGE_RECTS 32
+
+// Ring state
+#define SUVDA_FRAME_RING_STATE_ACTIVE 0
+// The producer replaced this ring (e.g. the mode grew beyond the slot size), consumers should query the new one
+#define SUVDA_FRAME_RING_STATE_ABANDONED 1
+
+typedef enum _SUVDA_FRAME_FORMAT : uint32_t {
+	SUVDA_FRAME_FORMAT_UNKNOWN = 0,
+	SUVDA_FRAME_FORMAT_BGRA8 = 1,     // DXGI_FORMAT_B8G8R8A8_UNORM
+	SUVDA_FRAME_FORMAT_RGBA16F = 2,   // DXGI_FORMAT_R16G16B16A16_FLOAT, scRGB
+	SUVDA_FRAME_FORMAT_RGB10A2 = 3,   // DXGI_FORMAT_R10G10B10A2_UNORM
+} SUVDA_FRAME_FORMAT;
+
+// Slot flags
+// The frame's damage didn't fit in DamageRects, treat the whole frame as changed
+#define SUVDA_FRAME_FLAG_FULL_DAMAGE 0x1
+// The frame is byte-identical to the previous one, consumers may skip encoding it. Tiles are compared by a 64-bit hash
+// and confirmed byte for byte against the previous frame. Tone mapped or gamma corrected frames can't be compared
+// that way and rely on the hash alone, a collision (about 2^-64 per tile) would then keep a stale tile.
+#define SUVDA_FRAME_FLAG_UNCHANGED 0x2
+// The previous frame published again after the display went idle, encoders may spend it on a high quality keyframe
+#define SUVDA_FRAME_FLAG_REFINEMENT 0x4
+// The driver composited the hardware cursor into the frame (cursorCompositing setting), don't draw it again
+#define SUVDA_FRAME_FLAG_CURSOR 0x8
+// Only the composited cursor moved or changed shape since the previous frame, the damage rects cover it
+#define SUVDA_FRAME_FLAG_CURSOR_ONLY 0x10
+// The driver tone mapped an HDR frame to SDR (hdrToneMapping setting), Format is BGRA8 with sRGB encoding
+#define SUVDA_FRAME_FLAG_TONE_MAPPED 0x20
+
+typedef struct _SUVDA_FRAME_RECT {
+	int32_t Left;
+	int32_t Top;
+	int32_t Right;
+	int32_t Bottom;
+} SUVDA_FRAME_RECT, * PSUVDA_FRAME_RECT;
+
+typedef struct _SUVDA_FRAME_SLOT {
+	std::atomic<uint64_t> Sequence;   // Odd while being written, (2 * FrameNumber + 2) once published
+	uint64_t FrameNumber;             // Zero based publish counter
+	uint64_t PresentQpc;              // QPC time the OS presented the frame, 0 if unknown
+	uint64_t AcquireQpc;              // QPC time the driver acquired the buffer, 0 for refinement passes
+	uint64_t PublishQpc;              // QPC time the frame was published to the ring
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Pitch;                   // Bytes per row of the pixel data
+	uint32_t Format;                  // SUVDA_FRAME_FORMAT
+	uint32_t Flags;
+	uint32_t Reserved;
+	uint64_t DataOffset;              // Offset of the pixel data from the start of the mapping
+	uint64_t DataSize;                // Valid bytes at DataOffset
+	uint32_t DamageRectCount;         // Regions that changed since the previous frame, see SUVDA_FRAME_FLAG_FULL_DAMAGE
+	uint32_t Reserved2;
+	SUVDA_FRAME_RECT DamageRects[SUVDA_FRAME_MAX_DAMAGE_RECTS];
+} SUVDA_FRAME_SLOT, * PSUVDA_FRAME_SLOT;
+
+typedef struct _SUVDA_FRAME_RING_HEADER {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t HeaderSize;
+	uint32_t SlotCount;
+	uint64_t SlotDataSize;            // Capacity in bytes of every slot's pixel data
+	uint64_t MappingSize;
+	std::atomic<uint32_t> State;      // SUVDA_FRAME_RING_STATE_*
+	uint32_t Reserved;
+	std::atomic<uint64_t> WriteIndex; // Number of published frames
+	SUVDA_FRAME_SLOT Slots[SUVDA_FRAME_RING_MAX_SLOTS];
+} SUVDA_FRAME_RING_HEADER, * PSUVDA_FRAME_RING_HEADER;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Frame ring requires lock-free 64-bit atomics");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Frame ring atomics must match the plain layout");
+
+static inline uint32_t FrameFormatBytesPerPixel(uint32_t Format)
+{
+	switch (Format)
+	{
+	case SUVDA_FRAME_FORMAT_BGRA8:
+	case SUVDA_FRAME_FORMAT_RGB10A2:
+		return 4;
+	case SUVDA_FRAME_FORMAT_RGBA16F:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+static inline uint64_t FrameRingAlignUp(uint64_t Value, uint64_t Alignment)
+{
+	return (Value + Alignment - 1) / Alignment * Alignment;
+}
+
+static inline uint64_t FrameRingDataStart()
+{
+	return FrameRingAlignUp(sizeof(SUVDA_FRAME_RING_HEADER), SUVDA_FRAME_RING_DATA_ALIGNMENT);
+}
+
+// Total bytes needed to hold a ring with the given geometry
+static inline uint64_t FrameRingRequiredSize(uint32_t SlotCount, uint64_t SlotDataSize)
+{
+	return FrameRingDataStart() + (uint64_t)SlotCount * FrameRingAlignUp(SlotDataSize, SUVDA_FRAME_RING_DATA_ALIGNMENT);
+}
+
+/// <summary>
+/// Producer side of the frame ring. Only one writer may be attached to a mapping at a time.
+/// </summary>
+class FrameRingWriter
+{
+public:
+	bool Initialize(void* pBase, uint64_t MappingSize, uint32_t SlotCount, uint64_t SlotDataSize)
+	{
+		if (!pBase || SlotCount < 2 || SlotCount > SUVDA_FRAME_RING_MAX_SLOTS ||
+			MappingSize < FrameRingRequiredSize(SlotCount, SlotDataSize))
+		{
+			return false;
+		}
+
+		m_pBase = static_cast<uint8_t*>(pBase);
+		m_pHeader = static_cast<SUVDA_FRAME_RING_HEADER*>(pBase);
+		m_pCurrent = nullptr;
+
+		memset(pBase, 0, sizeof(SUVDA_FRAME_RING_HEADER));
+		m_pHeader->HeaderSize = sizeof(SUVDA_FRAME_RING_HEADER);
+		m_pHeader->Version = SUVDA_FRAME_RING_VERSION;
+		m_pHeader->SlotCount = SlotCount;
+		m_pHeader->SlotDataSize = SlotDataSize;
+		m_pHeader->MappingSize = MappingSize;
+
+		uint64_t Stride = FrameRingAlignUp(SlotDataSize, SUVDA_FRAME_RING_DATA_ALIGNMENT);
+		for (uint32_t i = 0; i < SlotCount; i++)
+		{
+			m_pHeader->Slots[i].DataOffset = FrameRingDataStart() + i * Stride;
+		}
+
+		m_pHeader->State.store(SUVDA_FRAME_RING_STATE_ACTIVE, std::memory_order_relaxed);
+		m_pHeader->WriteIndex.store(0, std::memory_order_relaxed);
+
+		// Magic goes last so a consumer never sees a half initialized header as valid
+		std::atomic_thread_fence(std::memory_order_release);
+		m_pHeader->Magic = SUVDA_FRAME_RING_MAGIC;
+
+		return true;
+	}
+
+	bool IsInitialized() const
+	{
+		return m_pHeader != nullptr;
+	}
+
+	uint64_t SlotDataSize() const
+	{
+		return m_pHeader ? m_pHeader->SlotDataSize : 0;
+	}
+
+	uint64_t FramesPublished() const
+	{
+		return m_pHeader ? m_pHeader->WriteIndex.load(std::memory_order_relaxed) : 0;
+	}
+
+	// Claims the slot for the next frame and returns its pixel buffer. The caller fills in the descriptor fields and
+	// the pixel data, then calls PublishFrame(). Returns nullptr if the ring isn't initialized.
+	uint8_t* BeginFrame(SUVDA_FRAME_SLOT*& pSlot)
+	{
+		if (!m_pHeader)
+		{
+			pSlot = nullptr;
+			return nullptr;
+		}
+
+		uint64_t FrameNumber = m_pHeader->WriteIndex.load(std::memory_order_relaxed);
+		pSlot = &m_pHeader->Slots[FrameNumber % m_pHeader->SlotCount];
+
+		pSlot->Sequence.store(2 * FrameNumber + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		pSlot->FrameNumber = FrameNumber;
+		pSlot->Flags = 0;
+		m_pCurrent = pSlot;
+
+		return m_pBase + pSlot->DataOffset;
+	}
+
+	// Makes the frame claimed by BeginFrame() visible to consumers
+	void PublishFrame()
+	{
+		if (!m_pCurrent)
+		{
+			return;
+		}
+
+		uint64_t FrameNumber = m_pCurrent->FrameNumber;
+		m_pCurrent->Sequence.store(2 * FrameNumber + 2, std::memory_order_release);
+		m_pHeader->WriteIndex.store(FrameNumber + 1, std::memory_order_release);
+		m_pCurrent = nullptr;
+	}
+
+	// Index of the slot the next BeginFrame() will claim
+	uint32_t NextSlotIndex() const
+	{
+		return (uint32_t)(FramesPublished() % m_pHeader->SlotCount);
+	}
+
+	// Returns the last published slot, or nullptr if nothing has been published yet
+	const SUVDA_FRAME_SLOT* LastPublished() const
+	{
+		uint64_t Published = FramesPublished();
+		if (!Published)
+		{
+			return nullptr;
+		}
+
+		return &m_pHeader->Slots[(Published - 1) % m_pHeader->SlotCount];
+	}
+
+	const uint8_t* SlotData(const SUVDA_FRAME_SLOT* pSlot) const
+	{
+		return m_pBase + pSlot->DataOffset;
+	}
+
+	// Tells consumers to drop this ring and look up its replacement
+	void Abandon()
+	{
+		if (m_pHeader)
+		{
+			m_pHeader->State.store(SUVDA_FRAME_RING_STATE_ABANDONED, std::memory_order_release);
+		}
+	}
+
+private:
+	uint8_t* m_pBase = nullptr;
+	SUVDA_FRAME_RING_HEADER* m_pHeader = nullptr;
+	SUVDA_FRAME_SLOT* m_pCurrent = nullptr;
+};
+
+/// <summary>
+/// Consumer side of the frame ring. Every consumer owns its own reader, readers never write to the mapping.
+/// </summary>
+class FrameRingReader
+{
+public:
+	typedef enum _ACQUIRE_RESULT {
+		ACQUIRE_OK,
+		ACQUIRE_NO_FRAME,       // Nothing new since the last acquired frame
+		ACQUIRE_ABANDONED,      // The producer replaced this ring
+	} ACQUIRE_RESULT;
+
+	bool Attach(const void* pBase, uint64_t MappingSize)
+	{
+		auto* pHeader = static_cast<const SUVDA_FRAME_RING_HEADER*>(pBase);
+		if (!pHeader || MappingSize < sizeof(SUVDA_FRAME_RING_HEADER) || pHeader->Magic != SUVDA_FRAME_RING_MAGIC)
+		{
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (pHeader->Version != SUVDA_FRAME_RING_VERSION || pHeader->SlotCount < 2 ||
+			pHeader->SlotCount > SUVDA_FRAME_RING_MAX_SLOTS || pHeader->MappingSize > MappingSize)
+		{
+			return false;
+		}
+
+		m_pBase = static_cast<const uint8_t*>(pBase);
+		m_pHeader = pHeader;
+		m_ReadIndex = pHeader->WriteIndex.load(std::memory_order_acquire);
+		m_pAcquired = nullptr;
+		m_Dropped = 0;
+		m_Torn = 0;
+
+		return true;
+	}
+
+	// Acquires the newest published frame, skipping anything older
+	ACQUIRE_RESULT AcquireLatest(SUVDA_FRAME_SLOT& Desc, const uint8_t*& pData)
+	{
+		return Acquire(true, Desc, pData);
+	}
+
+	// Acquires the oldest frame the consumer hasn't seen yet that is still in the ring
+	ACQUIRE_RESULT AcquireNext(SUVDA_FRAME_SLOT& Desc, const uint8_t*& pData)
+	{
+		return Acquire(false, Desc, pData);
+	}
+
+	// Ends reading the acquired frame. Returns false if the producer overwrote the slot in the meantime, in which
+	// case everything read from it must be discarded.
+	bool Release()
+	{
+		if (!m_pAcquired)
+		{
+			return false;
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		bool Intact = m_pAcquired->Sequence.load(std::memory_order_relaxed) == m_AcquiredSequence;
+		m_pAcquired = nullptr;
+
+		if (!Intact)
+		{
+			m_Torn++;
+		}
+
+		return Intact;
+	}
+
+	// Producer index, useful for waiting on the frame event without acquiring
+	uint64_t WriteIndex() const
+	{
+		return m_pHeader->WriteIndex.load(std::memory_order_acquire);
+	}
+
+	uint64_t ReadIndex() const
+	{
+		return m_ReadIndex;
+	}
+
+	// Frames this consumer never saw because the producer lapped it
+	uint64_t DroppedFrames() const
+	{
+		return m_Dropped;
+	}
+
+	// Frames that were overwritten while being read
+	uint64_t TornFrames() const
+	{
+		return m_Torn;
+	}
+
+private:
+	ACQUIRE_RESULT Acquire(bool Latest, SUVDA_FRAME_SLOT& Desc, const uint8_t*& pData)
+	{
+		if (m_pHeader->State.load(std::memory_order_acquire) == SUVDA_FRAME_RING_STATE_ABANDONED)
+		{
+			return ACQUIRE_ABANDONED;
+		}
+
+		for (;;)
+		{
+			uint64_t Published = m_pHeader->WriteIndex.load(std::memory_order_acquire);
+			if (Published <= m_ReadIndex)
+			{
+				return ACQUIRE_NO_FRAME;
+			}
+
+			// Anything older than SlotCount frames has already been overwritten
+			uint64_t Oldest = Published > m_pHeader->SlotCount ? Published - m_pHeader->SlotCount : 0;
+			uint64_t FrameNumber = Latest ? Published - 1 : (m_ReadIndex < Oldest ? Oldest : m_ReadIndex);
+
+			m_Dropped += FrameNumber - m_ReadIndex;
+			m_ReadIndex = FrameNumber + 1;
+
+			const SUVDA_FRAME_SLOT* pSlot = &m_pHeader->Slots[FrameNumber % m_pHeader->SlotCount];
+			uint64_t Sequence = pSlot->Sequence.load(std::memory_order_acquire);
+			if (Sequence != 2 * FrameNumber + 2)
+			{
+				// The producer already lapped us on this slot, try again with a fresh producer index
+				m_Dropped++;
+				continue;
+			}
+
+			Desc.FrameNumber = pSlot->FrameNumber;
+			Desc.PresentQpc = pSlot->PresentQpc;
+			Desc.AcquireQpc = pSlot->AcquireQpc;
+			Desc.PublishQpc = pSlot->PublishQpc;
+			Desc.Width = pSlot->Width;
+			Desc.Height = pSlot->Height;
+			Desc.Pitch = pSlot->Pitch;
+			Desc.Format = pSlot->Format;
+			Desc.Flags = pSlot->Flags;
+			Desc.DataOffset = pSlot->DataOffset;
+			Desc.DataSize = pSlot->DataSize;
+			Desc.DamageRectCount = pSlot->DamageRectCount;
+			if (Desc.DamageRectCount > SUVDA_FRAME_MAX_DAMAGE_RECTS)
+			{
+				Desc.DamageRectCount = SUVDA_FRAME_MAX_DAMAGE_RECTS;
+			}
+			memcpy(Desc.DamageRects, pSlot->DamageRects, Desc.DamageRectCount * sizeof(SUVDA_FRAME_RECT));
+			Desc.Sequence.store(Sequence, std::memory_order_relaxed);
+
+			if (Desc.DataOffset + Desc.DataSize > m_pHeader->MappingSize)
+			{
+				m_Dropped++;
+				continue;
+			}
+
+			m_pAcquired = pSlot;
+			m_AcquiredSequence = Sequence;
+			pData = m_pBase + Desc.DataOffset;
+
+			return ACQUIRE_OK;
+		}
+	}
+
+	const uint8_t* m_pBase = nullptr;
+	const SUVDA_FRAME_RING_HEADER* m_pHeader = nullptr;
+	const SUVDA_FRAME_SLOT* m_pAcquired = nullptr;
+	uint64_t m_AcquiredSequence = 0;
+	uint64_t m_ReadIndex = 0;
+	uint64_t m_Dropped = 0;
+	uint64_t m_Torn = 0;
+};
+
+} // namespace SUDOVDA
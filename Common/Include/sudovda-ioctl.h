@@ -11,6 +11,19 @@ namespace SUDOVDA
 #define IOCTL_REMOVE_VIRTUAL_DISPLAY CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_SET_RENDER_ADAPTER CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_GET_WATCHDOG CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_FRAME_RING CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_FRAME_STATS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_START_FRAME_CAPTURE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_STOP_FRAME_CAPTURE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_START_FRAME_TRACE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_STOP_FRAME_TRACE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SET_CONSUMER_FRAME_RATE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80A, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_PREVIEW_RING CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80B, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_CURSOR CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80C, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_CURSOR_PLANE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80D, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_HDR_METADATA CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_ASSIGN_STATS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80F, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_MODE_LIST CTL_CODE(FILE_DEVICE_UNKNOWN, 0x810, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DRIVER_PING CTL_CODE(FILE_DEVICE_UNKNOWN, 0x888, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_GET_PROTOCOL_VERSION CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8FF, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
@@ -22,7 +35,7 @@ typedef struct _SUVDA_PROTOCAL_VERSION {
 } SUVDA_PROTOCAL_VERSION, * PSUVDA_PROTOCAL_VERSION;
 
 // Please update the version after ioctl changed
-static const SUVDA_PROTOCAL_VERSION VDAProtocolVersion = { 0, 2, 1, true };
+static const SUVDA_PROTOCAL_VERSION VDAProtocolVersion = { 0, 3, 17, true };
 
 static const char* SUVDA_HARDWARE_ID = "root\\sudomaker\\sudovda";
 
@@ -33,12 +46,13 @@ static const GUID SUVDA_CLASS_GUID = { 0x4d36e968, 0xe325, 0x11ce, { 0xbf, 0xc1,
 static const GUID SUVDA_INTERFACE_GUID = { 0xe5bcc234, 0x1e0c, 0x418a, { 0xa0, 0xd4, 0xef, 0x8b, 0x75, 0x01, 0x41, 0x4d } };
 
 typedef struct _VIRTUAL_DISPLAY_ADD_PARAMS {
-	UINT Width;
+	UINT Width;                       // Up to 16384, like Height
 	UINT Height;
-	UINT RefreshRate;
+	UINT RefreshRate;                 // mHz, or Hz below 1000, up to 1000 Hz. Within 1 mHz of N/1.001 Hz it's exactly N*1000/1001 Hz.
 	GUID MonitorGuid;
 	CHAR DeviceName[14];
 	CHAR SerialNumber[14];
+	UINT RefreshRateDenominator;      // When not 0, the rate is exactly RefreshRate/RefreshRateDenominator Hz, e.g. 60000/1001. Clients of protocol 0.3.13 and older leave it out.
 } VIRTUAL_DISPLAY_ADD_PARAMS, * PVIRTUAL_DISPLAY_ADD_PARAMS;
 
 typedef struct _VIRTUAL_DISPLAY_REMOVE_PARAMS {
@@ -59,6 +73,227 @@ typedef struct _VIRTUAL_DISPLAY_GET_WATCHDOG_OUT {
 	UINT Countdown;
 } VIRTUAL_DISPLAY_GET_WATCHDOG_OUT, * PVIRTUAL_DISPLAY_GET_WATCHDOG_OUT;
 
+#define SUVDA_FRAME_RING_NAME_LENGTH 96
+
+// Also used by IOCTL_GET_PREVIEW_RING, whose ring holds BGRA8 previews downscaled by the framePreviewScale setting, and
+// by IOCTL_GET_CURSOR_PLANE, whose mapping holds a SUVDA_CURSOR_PLANE (see sudovda-cursor.h) and never changes
+// generation
+typedef struct _VIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS {
+	GUID MonitorGuid;
+} VIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS, * PVIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_GET_FRAME_RING_OUT {
+	// Names of the file mapping holding the SUVDA_FRAME_RING_HEADER (see sudovda-frame.h) and of the auto-reset
+	// event signaled after every published frame. Both can be opened read-only.
+	WCHAR MappingName[SUVDA_FRAME_RING_NAME_LENGTH];
+	WCHAR EventName[SUVDA_FRAME_RING_NAME_LENGTH];
+	UINT64 MappingSize;
+	UINT Generation;
+} VIRTUAL_DISPLAY_GET_FRAME_RING_OUT, * PVIRTUAL_DISPLAY_GET_FRAME_RING_OUT;
+
+typedef enum _SUVDA_FRAME_STAGE {
+	SUVDA_FRAME_STAGE_ACQUIRE = 0,    // OS present to buffer acquired by the driver
+	SUVDA_FRAME_STAGE_PROCESS,        // Buffer acquired to driver processing done
+	SUVDA_FRAME_STAGE_FINISH,         // Buffer acquired to IddCxSwapChainFinishedProcessingFrame returned
+	SUVDA_FRAME_STAGE_HANDOFF,        // Buffer acquired to frame published to consumers
+	SUVDA_FRAME_STAGE_COUNT
+} SUVDA_FRAME_STAGE;
+
+typedef struct _SUVDA_STAGE_LATENCY {
+	UINT64 Count;
+	UINT64 MeanNs;
+	UINT64 P50Ns;
+	UINT64 P90Ns;
+	UINT64 P99Ns;
+	UINT64 P999Ns;
+	UINT64 MaxNs;
+} SUVDA_STAGE_LATENCY, * PSUVDA_STAGE_LATENCY;
+
+typedef struct _VIRTUAL_DISPLAY_GET_FRAME_STATS_PARAMS {
+	GUID MonitorGuid;
+} VIRTUAL_DISPLAY_GET_FRAME_STATS_PARAMS, * PVIRTUAL_DISPLAY_GET_FRAME_STATS_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_GET_FRAME_STATS_OUT {
+	UINT64 FramesAcquired;
+	UINT64 FramesDropped;             // Frames the OS presented that the driver never acquired
+	UINT64 FramesExported;
+	UINT64 ExportFailures;
+	UINT64 FramesUnchanged;           // Exported frames identical to the previous one
+	UINT64 FramesRefined;             // Idle refinement passes published, see SUVDA_FRAME_FLAG_REFINEMENT
+	UINT64 FramesDecimated;           // Acquired frames no consumer wanted at its rate, never copied
+	UINT PendingDepth;                // Frames acquired but not yet handed off to consumers
+	UINT Reserved;
+	SUVDA_STAGE_LATENCY Stages[SUVDA_FRAME_STAGE_COUNT];
+} VIRTUAL_DISPLAY_GET_FRAME_STATS_OUT, * PVIRTUAL_DISPLAY_GET_FRAME_STATS_OUT;
+
+#define SUVDA_CAPTURE_PATH_LENGTH 260
+
+typedef struct _VIRTUAL_DISPLAY_START_FRAME_CAPTURE_PARAMS {
+	GUID MonitorGuid;
+	UINT Format;                      // SUVDA_CAPTURE_FORMAT, see sudovda-capture.h
+	// Frames queued for the disk before new ones are dropped, 0 for the default. The queued frames take at most
+	// 1 GiB, large frames queue fewer.
+	UINT BufferCount;
+	// Name of the data file in %ProgramData%\SUVDA_CAPTURE_DIRECTORY, not a path, see IsCaptureFileName(). Raw
+	// captures write their index next to it with SUVDA_CAPTURE_INDEX_SUFFIX appended. An existing file is replaced.
+	WCHAR FileName[SUVDA_CAPTURE_PATH_LENGTH];
+	UINT QueuePolicy;                 // SUVDA_CAPTURE_QUEUE_POLICY once BufferCount frames are queued
+	UINT QueueTimeoutMs;              // SUVDA_CAPTURE_QUEUE_BLOCK only, 0 for the default, at most 1000
+} VIRTUAL_DISPLAY_START_FRAME_CAPTURE_PARAMS, * PVIRTUAL_DISPLAY_START_FRAME_CAPTURE_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_PARAMS {
+	GUID MonitorGuid;
+} VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_PARAMS, * PVIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_OUT {
+	UINT64 FramesWritten;
+	UINT64 FramesDropped;             // The disk fell behind and every capture buffer was queued
+	UINT64 FramesSkipped;             // Format or geometry the capture format can't hold
+	UINT64 BytesWritten;
+	UINT64 WriteErrors;
+	// How FramesDropped came about, by queue policy
+	UINT64 DroppedNewest;
+	UINT64 DroppedOldest;
+	UINT64 TimedOut;
+	UINT64 FramesBlocked;             // Frames the swap-chain waited for the disk to queue, including timed out ones
+} VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_OUT, * PVIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_OUT;
+
+typedef struct _VIRTUAL_DISPLAY_START_FRAME_TRACE_PARAMS {
+	GUID MonitorGuid;
+	// Name of the trace file in the capture directory like capture files, see sudovda-trace.h
+	WCHAR FileName[SUVDA_CAPTURE_PATH_LENGTH];
+} VIRTUAL_DISPLAY_START_FRAME_TRACE_PARAMS, * PVIRTUAL_DISPLAY_START_FRAME_TRACE_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_STOP_FRAME_TRACE_PARAMS {
+	GUID MonitorGuid;
+} VIRTUAL_DISPLAY_STOP_FRAME_TRACE_PARAMS, * PVIRTUAL_DISPLAY_STOP_FRAME_TRACE_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_STOP_FRAME_TRACE_OUT {
+	UINT64 RecordsWritten;
+	UINT64 RecordsDropped;            // The disk fell behind and the record buffer was full
+	UINT64 WriteErrors;
+} VIRTUAL_DISPLAY_STOP_FRAME_TRACE_OUT, * PVIRTUAL_DISPLAY_STOP_FRAME_TRACE_OUT;
+
+#define SUVDA_MAX_RATE_CONSUMERS 8
+// Highest rate a consumer can register, in Hz
+#define SUVDA_MAX_CONSUMER_FRAME_RATE 1000
+
+// Limits the frames exported to the frame ring to what the registered consumers want. While any rate is set, a frame
+// is only copied if some consumer's rate needs it, so a consumer that needs every frame has to register the monitor's
+// refresh rate or higher. Consumers pick a free ConsumerIndex, and clear it with a zero rate when done.
+typedef struct _VIRTUAL_DISPLAY_SET_CONSUMER_FRAME_RATE_PARAMS {
+	GUID MonitorGuid;
+	UINT ConsumerIndex;               // Below SUVDA_MAX_RATE_CONSUMERS
+	// Target rate in Hz as a fraction, e.g. 30000/1001, at most SUVDA_MAX_CONSUMER_FRAME_RATE. 0 clears the consumer.
+	UINT RateNumerator;
+	UINT RateDenominator;
+} VIRTUAL_DISPLAY_SET_CONSUMER_FRAME_RATE_PARAMS, * PVIRTUAL_DISPLAY_SET_CONSUMER_FRAME_RATE_PARAMS;
+
+// Largest raw cursor shape in bytes, SUVDA_CURSOR_MAX_SIZE squared 32-bit pixels (see sudovda-cursor.h)
+#define SUVDA_CURSOR_SHAPE_BUFFER_SIZE (64 * 64 * 4)
+
+typedef struct _VIRTUAL_DISPLAY_GET_CURSOR_PARAMS {
+	GUID MonitorGuid;
+	UINT LastShapeId;                 // Shape the caller already holds, its bytes are not copied again. 0 for none.
+} VIRTUAL_DISPLAY_GET_CURSOR_PARAMS, * PVIRTUAL_DISPLAY_GET_CURSOR_PARAMS;
+
+// The hardware cursor of a monitor as last reported by the OS. Decode Shape with DecodeCursorShape().
+typedef struct _VIRTUAL_DISPLAY_GET_CURSOR_OUT {
+	UINT Visible;
+	INT X;                            // Top left of the shape in monitor coordinates, may be negative
+	INT Y;
+	UINT ShapeId;                     // Changes with every new shape, 0 while the OS hasn't set one
+	UINT ShapeType;                   // SUVDA_CURSOR_SHAPE_TYPE
+	UINT Width;
+	UINT Height;
+	UINT Pitch;
+	UINT HotX;                        // Hot spot relative to the top left of the shape
+	UINT HotY;
+	UINT ShapeSize;                   // Bytes valid in Shape, 0 when ShapeId equals LastShapeId
+	BYTE Shape[SUVDA_CURSOR_SHAPE_BUFFER_SIZE];
+} VIRTUAL_DISPLAY_GET_CURSOR_OUT, * PVIRTUAL_DISPLAY_GET_CURSOR_OUT;
+
+// HDR10 static metadata, laid out like DXGI_HDR_METADATA_HDR10
+typedef struct _SUVDA_HDR10_METADATA {
+	UINT16 RedPrimary[2];             // Chromaticity in units of 0.00002
+	UINT16 GreenPrimary[2];
+	UINT16 BluePrimary[2];
+	UINT16 WhitePoint[2];
+	UINT MaxMasteringLuminance;       // Nits
+	UINT MinMasteringLuminance;       // Units of 0.0001 nits
+	UINT16 MaxContentLightLevel;      // MaxCLL in nits, 0 if unknown
+	UINT16 MaxFrameAverageLightLevel; // MaxFALL in nits, 0 if unknown
+} SUVDA_HDR10_METADATA, * PSUVDA_HDR10_METADATA;
+
+#define SUVDA_HDR_METADATA_NONE 0
+#define SUVDA_HDR_METADATA_HDR10 1
+
+typedef struct _VIRTUAL_DISPLAY_GET_HDR_METADATA_PARAMS {
+	GUID MonitorGuid;
+} VIRTUAL_DISPLAY_GET_HDR_METADATA_PARAMS, * PVIRTUAL_DISPLAY_GET_HDR_METADATA_PARAMS;
+
+// The HDR metadata the OS last set for a monitor. While ToneMapWhiteNits is set (hdrToneMapping setting), HDR frames
+// reach the frame ring as BGRA8 tone mapped from ToneMapPeakNits down to that white, see SUVDA_FRAME_FLAG_TONE_MAPPED.
+typedef struct _VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT {
+	UINT Type;                        // SUVDA_HDR_METADATA_NONE or SUVDA_HDR_METADATA_HDR10
+	UINT Generation;                  // Changes whenever the OS sets metadata, 0 while it never has
+	SUVDA_HDR10_METADATA Hdr10;       // Zero unless Type is SUVDA_HDR_METADATA_HDR10
+	UINT ToneMapWhiteNits;            // 0 while tone mapping is off
+	UINT ToneMapPeakNits;
+} VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT, * PVIRTUAL_DISPLAY_GET_HDR_METADATA_OUT;
+
+// Phases of a swap-chain assignment, each timed from the moment the OS assigned the swap-chain
+typedef enum _SUVDA_ASSIGN_PHASE {
+	SUVDA_ASSIGN_PHASE_RELEASE = 0,   // Previous swap-chain let go of
+	SUVDA_ASSIGN_PHASE_DEVICE,        // Render device ready
+	SUVDA_ASSIGN_PHASE_THREAD,        // Processing thread picked up the swap-chain
+	SUVDA_ASSIGN_PHASE_SET_DEVICE,    // IddCxSwapChainSetDevice returned
+	SUVDA_ASSIGN_PHASE_FIRST_FRAME,   // First buffer acquired
+	SUVDA_ASSIGN_PHASE_COUNT
+} SUVDA_ASSIGN_PHASE;
+
+typedef struct _VIRTUAL_DISPLAY_GET_ASSIGN_STATS_PARAMS {
+	GUID MonitorGuid;
+} VIRTUAL_DISPLAY_GET_ASSIGN_STATS_PARAMS, * PVIRTUAL_DISPLAY_GET_ASSIGN_STATS_PARAMS;
+
+typedef struct _VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT {
+	UINT64 Assignments;               // Swap-chains the OS assigned to the monitor
+	UINT64 Rearms;                    // Assignments that reused the parked processing thread
+	UINT64 Failures;                  // Assignments replaced before their first frame
+	UINT64 LastPhaseNs[SUVDA_ASSIGN_PHASE_COUNT]; // Latest assignment, 0 for phases it didn't reach
+	UINT LastRearmed;
+	UINT Reserved;
+	SUVDA_STAGE_LATENCY Phases[SUVDA_ASSIGN_PHASE_COUNT];
+} VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT, * PVIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT;
+
+#define SUVDA_MODE_LIST_MAX_ISSUES 64
+
+typedef enum _SUVDA_MODE_ISSUE_REASON {
+	SUVDA_MODE_ISSUE_SYNTAX = 0,      // Not "width, height, refresh"
+	SUVDA_MODE_ISSUE_SIZE,            // Width or height out of 320 to 16384
+	SUVDA_MODE_ISSUE_ASPECT,          // Wider or taller than 4 to 1
+	SUVDA_MODE_ISSUE_REFRESH,         // Refresh rate out of 1 to 1000 Hz
+	SUVDA_MODE_ISSUE_DUPLICATE,       // Same mode as an earlier line, ignored
+} SUVDA_MODE_ISSUE_REASON;
+
+typedef struct _SUVDA_MODE_ISSUE {
+	UINT Line;                        // 1-based
+	UINT Reason;                      // SUVDA_MODE_ISSUE_REASON
+	UINT Width;                       // As written, all 0 on syntax errors
+	UINT Height;
+	UINT RefreshRate;
+} SUVDA_MODE_ISSUE, * PSUVDA_MODE_ISSUE;
+
+typedef struct _VIRTUAL_DISPLAY_GET_MODE_LIST_OUT {
+	LONG Status;                      // HRESULT of loading modeListFile, S_FALSE when it isn't set
+	UINT Entries;                     // Lines with a mode, valid or not
+	UINT Modes;                       // Default modes in use, the built-in ones unless the file had a valid line
+	UINT Duplicates;
+	UINT Rejected;
+	UINT IssueCount;
+	SUVDA_MODE_ISSUE Issues[SUVDA_MODE_LIST_MAX_ISSUES]; // The first IssueCount problems, in file order
+} VIRTUAL_DISPLAY_GET_MODE_LIST_OUT, * PVIRTUAL_DISPLAY_GET_MODE_LIST_OUT;
+
 typedef struct _VIRTUAL_DISPLAY_GET_PROTOCOL_VERSION_OUT {
 	SUVDA_PROTOCAL_VERSION Version;
 } VIRTUAL_DISPLAY_GET_PROTOCOL_VERSION_OUT, * PVIRTUAL_DISPLAY_GET_PROTOCOL_VERSION_OUT;
@@ -0,0 +1,74 @@
+#pragma once
+
+// Per-frame latency trace records written by the driver (IOCTL_START_FRAME_TRACE) and by consumers.
+//
+// Like sudovda-frame.h this header is platform-neutral, do not include any Windows headers here.
+//
+// A trace file is a SUVDA_TRACE_HEADER followed by fixed-size SUVDA_TRACE_RECORDs. All timestamps are QPC ticks at
+// the header's QpcFrequency, 0 when unknown. The driver writes one record per published frame with every stage up to
+// PublishQpc. A consumer that wants its pickup latency in the breakdown writes its own trace with
+// SUVDA_TRACE_SOURCE_CONSUMER records, which the analysis tool (Tools/FrameTraceAnalyze) joins to the driver's
+// records by FrameNumber.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sudovda-frame.h"
+
+namespace SUDOVDA
+{
+
+#define SUVDA_TRACE_MAGIC 0x52545653 // 'SVTR'
+#define SUVDA_TRACE_VERSION 1
+
+typedef enum _SUVDA_TRACE_SOURCE : uint32_t {
+	SUVDA_TRACE_SOURCE_DRIVER = 0,
+	SUVDA_TRACE_SOURCE_CONSUMER = 1,
+} SUVDA_TRACE_SOURCE;
+
+typedef struct _SUVDA_TRACE_HEADER {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t HeaderSize;
+	uint32_t RecordSize;
+	uint64_t QpcFrequency;            // Ticks per second of every timestamp in the file
+} SUVDA_TRACE_HEADER, * PSUVDA_TRACE_HEADER;
+
+typedef struct _SUVDA_TRACE_RECORD {
+	uint64_t FrameNumber;             // Frame ring publish counter
+	uint32_t Source;                  // SUVDA_TRACE_SOURCE
+	uint32_t PresentationFrameNumber; // OS frame number, gaps are frames the driver never acquired
+	uint64_t PresentQpc;              // OS present, from the acquire metadata
+	uint64_t AcquireQpc;              // Buffer acquired by the driver
+	uint64_t ProcessQpc;              // Driver processing done, frame queued for readback
+	uint64_t FinishQpc;               // IddCxSwapChainFinishedProcessingFrame returned
+	uint64_t PublishQpc;              // Frame visible to consumers in the frame ring
+	uint64_t PickupQpc;               // Consumer acquired the frame, consumer records only
+	uint32_t Flags;                   // SUVDA_FRAME_FLAG_*
+	uint32_t Reserved;
+} SUVDA_TRACE_RECORD, * PSUVDA_TRACE_RECORD;
+
+static inline void FillTraceHeader(SUVDA_TRACE_HEADER& Header, uint64_t QpcFrequency)
+{
+	memset(&Header, 0, sizeof(Header));
+	Header.Magic = SUVDA_TRACE_MAGIC;
+	Header.Version = SUVDA_TRACE_VERSION;
+	Header.HeaderSize = sizeof(SUVDA_TRACE_HEADER);
+	Header.RecordSize = sizeof(SUVDA_TRACE_RECORD);
+	Header.QpcFrequency = QpcFrequency;
+}
+
+// Consumer side: records the pickup of a frame acquired with FrameRingReader
+static inline void FillConsumerTraceRecord(SUVDA_TRACE_RECORD& Record, const SUVDA_FRAME_SLOT& Desc, uint64_t PickupQpc)
+{
+	memset(&Record, 0, sizeof(Record));
+	Record.FrameNumber = Desc.FrameNumber;
+	Record.Source = SUVDA_TRACE_SOURCE_CONSUMER;
+	Record.PresentQpc = Desc.PresentQpc;
+	Record.AcquireQpc = Desc.AcquireQpc;
+	Record.PublishQpc = Desc.PublishQpc;
+	Record.PickupQpc = PickupQpc;
+	Record.Flags = Desc.Flags;
+}
+
+} // namespace SUDOVDA
@@ -0,0 +1,248 @@
+#include "CursorComposite.h"
+#include "PixelConvert.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CURSOR_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define CURSOR_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// MSVC allows any intrinsic in any function, GCC and Clang need the target spelled out per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CURSOR_TARGET_SSE41
+#define CURSOR_TARGET_AVX2
+#else
+#define CURSOR_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CURSOR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace SUDOVDA;
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			// Blends Pixels cursor pixels into a frame row. pXor is null when the shape has no XOR pixels.
+			typedef void (*BLEND_ROW)(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pXor, uint32_t Pixels);
+
+			const uint8_t NoXor[4] = {};
+
+#pragma region Scalar
+
+			void BlendRowFrom(uint32_t Start, uint8_t* pDst, const uint8_t* pColor, const uint8_t* pXor, uint32_t Pixels)
+			{
+				for (uint32_t x = Start; x < Pixels; x++)
+				{
+					CursorBlendPixel(pDst + x * 4, pColor + x * 4, pXor ? pXor + x * 4 : NoXor);
+				}
+			}
+
+			void BlendRowScalar(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pXor, uint32_t Pixels)
+			{
+				BlendRowFrom(0, pDst, pColor, pXor, Pixels);
+			}
+
+#pragma endregion
+
+#if CURSOR_X64
+
+#pragma region SSE41
+
+			// Dst * Keep / 255 rounded to nearest for 16-bit lanes, the same sum as CursorDiv255()
+			CURSOR_TARGET_SSE41 inline __m128i ScaleSse41(__m128i Dst, __m128i Keep)
+			{
+				__m128i Product = _mm_add_epi16(_mm_mullo_epi16(Dst, Keep), _mm_set1_epi16(128));
+				return _mm_srli_epi16(_mm_add_epi16(Product, _mm_srli_epi16(Product, 8)), 8);
+			}
+
+			// Four pixels at a time
+			CURSOR_TARGET_SSE41 void BlendRowSse41(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pXor, uint32_t Pixels)
+			{
+				const __m128i Zero = _mm_setzero_si128();
+				const __m128i Ones = _mm_set1_epi32(-1);
+				const __m128i AlphaMask = _mm_set1_epi32((int)0xFF000000);
+				// 255 - A of every pixel spread over its four 16-bit lanes
+				const __m128i KeepLo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+				const __m128i KeepHi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+
+				uint32_t x = 0;
+				for (; x + 4 <= Pixels; x += 4)
+				{
+					__m128i Dst = _mm_loadu_si128((const __m128i*)(pDst + x * 4));
+					__m128i Color = _mm_loadu_si128((const __m128i*)(pColor + x * 4));
+					__m128i Inverse = _mm_xor_si128(Color, Ones);
+
+					__m128i Lo = ScaleSse41(_mm_unpacklo_epi8(Dst, Zero), _mm_shuffle_epi8(Inverse, KeepLo));
+					__m128i Hi = ScaleSse41(_mm_unpackhi_epi8(Dst, Zero), _mm_shuffle_epi8(Inverse, KeepHi));
+					__m128i Out = _mm_adds_epu8(_mm_packus_epi16(Lo, Hi), Color);
+					if (pXor)
+					{
+						Out = _mm_xor_si128(Out, _mm_loadu_si128((const __m128i*)(pXor + x * 4)));
+					}
+
+					_mm_storeu_si128((__m128i*)(pDst + x * 4), _mm_blendv_epi8(Out, Dst, AlphaMask));
+				}
+
+				BlendRowFrom(x, pDst, pColor, pXor, Pixels);
+			}
+
+#pragma endregion
+
+#pragma region AVX2
+
+			CURSOR_TARGET_AVX2 inline __m256i ScaleAvx2(__m256i Dst, __m256i Keep)
+			{
+				__m256i Product = _mm256_add_epi16(_mm256_mullo_epi16(Dst, Keep), _mm256_set1_epi16(128));
+				return _mm256_srli_epi16(_mm256_add_epi16(Product, _mm256_srli_epi16(Product, 8)), 8);
+			}
+
+			// Eight pixels at a time. Unpacking, shuffling and packing all stay within 128-bit lanes, so the pixel
+			// order is kept without any cross-lane permutes.
+			CURSOR_TARGET_AVX2 void BlendRowAvx2(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pXor, uint32_t Pixels)
+			{
+				const __m256i Zero = _mm256_setzero_si256();
+				const __m256i Ones = _mm256_set1_epi32(-1);
+				const __m256i AlphaMask = _mm256_set1_epi32((int)0xFF000000);
+				const __m256i KeepLo = _mm256_setr_epi8(
+					3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+					3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+				const __m256i KeepHi = _mm256_setr_epi8(
+					11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1,
+					11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+
+				uint32_t x = 0;
+				for (; x + 8 <= Pixels; x += 8)
+				{
+					__m256i Dst = _mm256_loadu_si256((const __m256i*)(pDst + x * 4));
+					__m256i Color = _mm256_loadu_si256((const __m256i*)(pColor + x * 4));
+					__m256i Inverse = _mm256_xor_si256(Color, Ones);
+
+					__m256i Lo = ScaleAvx2(_mm256_unpacklo_epi8(Dst, Zero), _mm256_shuffle_epi8(Inverse, KeepLo));
+					__m256i Hi = ScaleAvx2(_mm256_unpackhi_epi8(Dst, Zero), _mm256_shuffle_epi8(Inverse, KeepHi));
+					__m256i Out = _mm256_adds_epu8(_mm256_packus_epi16(Lo, Hi), Color);
+					if (pXor)
+					{
+						Out = _mm256_xor_si256(Out, _mm256_loadu_si256((const __m256i*)(pXor + x * 4)));
+					}
+
+					_mm256_storeu_si256((__m256i*)(pDst + x * 4), _mm256_blendv_epi8(Out, Dst, AlphaMask));
+				}
+
+				// Cursor rows are at most 64 pixels, the remainder is not worth another SIMD width
+				BlendRowSse41(pDst + x * 4, pColor + x * 4, pXor ? pXor + x * 4 : nullptr, Pixels - x);
+			}
+
+#pragma endregion
+
+#endif // CURSOR_X64
+
+#if CURSOR_ARM64
+
+#pragma region NEON
+
+			// Eight pixels at a time, deinterleaved into channel planes
+			void BlendRowNeon(uint8_t* pDst, const uint8_t* pColor, const uint8_t* pXor, uint32_t Pixels)
+			{
+				uint32_t x = 0;
+				for (; x + 8 <= Pixels; x += 8)
+				{
+					uint8x8x4_t Dst = vld4_u8(pDst + x * 4);
+					uint8x8x4_t Color = vld4_u8(pColor + x * 4);
+					uint8x8_t Keep = vmvn_u8(Color.val[3]);
+
+					for (int c = 0; c < 3; c++)
+					{
+						// (t + ((t + 128) >> 8) + 128) >> 8, the same sum as CursorDiv255()
+						uint16x8_t Product = vmull_u8(Dst.val[c], Keep);
+						Dst.val[c] = vqadd_u8(vraddhn_u16(Product, vrshrq_n_u16(Product, 8)), Color.val[c]);
+					}
+
+					if (pXor)
+					{
+						uint8x8x4_t Xor = vld4_u8(pXor + x * 4);
+						for (int c = 0; c < 3; c++)
+						{
+							Dst.val[c] = veor_u8(Dst.val[c], Xor.val[c]);
+						}
+					}
+
+					vst4_u8(pDst + x * 4, Dst);
+				}
+
+				BlendRowFrom(x, pDst, pColor, pXor, Pixels);
+			}
+
+#pragma endregion
+
+#endif // CURSOR_ARM64
+
+			BLEND_ROW BlendRow()
+			{
+				switch (PixelConvertGetIsa())
+				{
+#if CURSOR_X64
+				case PIXEL_CONVERT_ISA_SSE41:
+					return BlendRowSse41;
+				case PIXEL_CONVERT_ISA_AVX2:
+					return BlendRowAvx2;
+#endif
+#if CURSOR_ARM64
+				case PIXEL_CONVERT_ISA_NEON:
+					return BlendRowNeon;
+#endif
+				default:
+					return BlendRowScalar;
+				}
+			}
+		}
+
+		bool CursorCoverage(uint32_t Width, uint32_t Height, const SUVDA_CURSOR_IMAGE& Image, int32_t X, int32_t Y, SUVDA_FRAME_RECT& Rect)
+		{
+			int64_t Left = X < 0 ? 0 : X;
+			int64_t Top = Y < 0 ? 0 : Y;
+			int64_t Right = (int64_t)X + Image.Width;
+			int64_t Bottom = (int64_t)Y + Image.Height;
+			Right = Right < Width ? Right : Width;
+			Bottom = Bottom < Height ? Bottom : Height;
+
+			if (Left >= Right || Top >= Bottom)
+			{
+				return false;
+			}
+
+			Rect = { (int32_t)Left, (int32_t)Top, (int32_t)Right, (int32_t)Bottom };
+			return true;
+		}
+
+		void CompositeCursor(uint8_t* pFrame, size_t Pitch, uint32_t Width, uint32_t Height, const SUVDA_CURSOR_IMAGE& Image, int32_t X, int32_t Y)
+		{
+			SUVDA_FRAME_RECT Rect;
+			if (!CursorCoverage(Width, Height, Image, X, Y, Rect))
+			{
+				return;
+			}
+
+			BLEND_ROW Blend = BlendRow();
+			uint32_t Column = (uint32_t)(Rect.Left - X);
+			uint32_t Pixels = (uint32_t)(Rect.Right - Rect.Left);
+
+			for (int32_t y = Rect.Top; y < Rect.Bottom; y++)
+			{
+				size_t Offset = ((size_t)(y - Y) * Image.Width + Column) * 4;
+				Blend(
+					pFrame + (size_t)y * Pitch + (size_t)Rect.Left * 4,
+					Image.Color + Offset,
+					Image.HasXor ? Image.Xor + Offset : nullptr,
+					Pixels);
+			}
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Compositing of the hardware cursor into exported BGRA8 frames, for consumers that can't draw it themselves.
+//
+// The cursor is applied as decoded by DecodeCursorShape() (see sudovda-cursor.h): the premultiplied color is blended
+// over the frame and the XOR plane is applied on top, which covers alpha, masked color and XOR shapes with a single
+// operation. The frame's alpha bytes are left alone.
+//
+// The instruction set follows PixelConvertGetIsa(), all paths are bit-exact with CursorBlendPixel().
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sudovda-frame.h>
+#include <sudovda-cursor.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		// Part of a Width x Height frame covered by Image with its top left at (X, Y). False if none is.
+		bool CursorCoverage(uint32_t Width, uint32_t Height, const SUDOVDA::SUVDA_CURSOR_IMAGE& Image, int32_t X, int32_t Y, SUDOVDA::SUVDA_FRAME_RECT& Rect);
+
+		// Blends Image into the frame with its top left at (X, Y), clipped to the frame. Pitch is in bytes.
+		void CompositeCursor(uint8_t* pFrame, size_t Pitch, uint32_t Width, uint32_t Height, const SUDOVDA::SUVDA_CURSOR_IMAGE& Image, int32_t X, int32_t Y);
+	}
+}
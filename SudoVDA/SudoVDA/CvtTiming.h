@@ -0,0 +1,101 @@
+#pragma once
+
+// VESA Coordinated Video Timings, reduced blanking version 2 (CVT 1.2).
+//
+// Virtual monitors don't scan anything out, but capture tools and encoders size their buffers and bitrates from the
+// totals and pixel rate the OS reports, which only make sense with the blanking a real monitor of that mode would
+// have. Reduced blanking v2 gives every mode:
+//
+//  * a horizontal blank of 80 pixels: 8 front porch, 32 sync and 40 back porch,
+//  * a vertical blank of at least 460 us, and at least 15 lines: a front porch of at least 1 line, 8 lines of sync
+//    and 6 of back porch,
+//  * a pixel clock in steps of 1 kHz, rounded down.
+//
+// A rate of N/1.001 Hz is CVT's "video optimized" variant of N Hz: the blank is that of N Hz and the pixel clock is
+// scaled by 1000/1001. Rates are taken as fractions and everything is computed on integers, so results are exact, the
+// standard's INT() being a floor, and the tables built from them can be generated at compile time.
+//
+// Only the standard library is used, so the engine runs unchanged in the driver and in tests.
+
+#include <stdint.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		constexpr uint32_t CvtRbHFrontPorch = 8;
+		constexpr uint32_t CvtRbHSync = 32;
+		constexpr uint32_t CvtRbHBackPorch = 40;
+		constexpr uint32_t CvtRbMinVBlankUs = 460;
+		constexpr uint32_t CvtRbMinVFrontPorch = 1;
+		constexpr uint32_t CvtRbVSync = 8;
+		constexpr uint32_t CvtRbVBackPorch = 6;
+		constexpr uint32_t CvtRbClockStepKhz = 1;
+
+		typedef struct _CVT_TIMING {
+			uint32_t HTotal;
+			uint32_t HFrontPorch;
+			uint32_t HSync;
+			uint32_t HBackPorch;
+			uint32_t VTotal;
+			uint32_t VFrontPorch;
+			uint32_t VSync;
+			uint32_t VBackPorch;
+			uint64_t PixelClockKhz;
+			bool VideoOptimized;             // N/1.001 Hz, timed as N Hz with the clock scaled by 1000/1001
+		} CVT_TIMING;
+
+		// Timing of a Width x Height mode at RateNumerator/RateDenominator Hz. Rates above some 2000 Hz leave no
+		// time to scan the lines, they get the minimum blank.
+		constexpr CVT_TIMING MakeCvtRbV2Timing(uint32_t Width, uint32_t Height, uint64_t RateNumerator, uint64_t RateDenominator)
+		{
+			CVT_TIMING Timing = {};
+			Timing.HFrontPorch = CvtRbHFrontPorch;
+			Timing.HSync = CvtRbHSync;
+			Timing.HBackPorch = CvtRbHBackPorch;
+			Timing.VSync = CvtRbVSync;
+			Timing.VBackPorch = CvtRbVBackPorch;
+			Timing.HTotal = Width + CvtRbHFrontPorch + CvtRbHSync + CvtRbHBackPorch;
+
+			if (!RateNumerator || !RateDenominator)
+			{
+				Timing.VFrontPorch = CvtRbMinVFrontPorch;
+				Timing.VTotal = Height + CvtRbMinVFrontPorch + CvtRbVSync + CvtRbVBackPorch;
+				return Timing;
+			}
+
+			// N/1.001 Hz, and not a whole rate itself
+			uint64_t ClockNumerator = 1;
+			uint64_t ClockDenominator = 1;
+			if (RateNumerator % RateDenominator && RateNumerator * 1001 % (RateDenominator * 1000) == 0)
+			{
+				RateNumerator = RateNumerator * 1001 / (RateDenominator * 1000);
+				RateDenominator = 1;
+				ClockNumerator = 1000;
+				ClockDenominator = 1001;
+				Timing.VideoOptimized = true;
+			}
+
+			// Lines in the minimum blank, INT(RB_MIN_V_BLANK / H_PERIOD_EST) + 1 with the estimated line period
+			// (1000000 / rate - RB_MIN_V_BLANK) / Height us, which makes 460 * rate * Height / (1000000 - 460 * rate)
+			uint64_t VBlankLines = CvtRbMinVFrontPorch + CvtRbVSync + CvtRbVBackPorch;
+			uint64_t ScanTime = RateDenominator * 1000000;
+			uint64_t BlankTime = RateNumerator * CvtRbMinVBlankUs;
+			if (ScanTime > BlankTime && (!Height || BlankTime <= UINT64_MAX / Height))
+			{
+				uint64_t Lines = BlankTime * Height / (ScanTime - BlankTime) + 1;
+				if (Lines > VBlankLines)
+				{
+					VBlankLines = Lines;
+				}
+			}
+
+			Timing.VFrontPorch = (uint32_t)VBlankLines - CvtRbVSync - CvtRbVBackPorch;
+			Timing.VTotal = Height + (uint32_t)VBlankLines;
+
+			uint64_t Pixels = (uint64_t)Timing.HTotal * Timing.VTotal;
+			Timing.PixelClockKhz = Pixels * RateNumerator * ClockNumerator / (RateDenominator * ClockDenominator * 1000 * CvtRbClockStepKhz) * CvtRbClockStepKhz;
+			return Timing;
+		}
+	}
+}
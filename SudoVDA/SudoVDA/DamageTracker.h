@@ -0,0 +1,260 @@
+#pragma once
+
+// Tile based damage tracking for partial frame copies.
+//
+// Dirty rectangles reported by the OS are snapped to a fixed tile grid and accumulated in a bitmap. A copy plan is
+// then produced by merging horizontal runs of damaged tiles and stacking identical runs of consecutive tile rows, so a
+// damaged window turns into a single rectangle no matter how many overlapping rects the compositor reported.
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include <sudovda-frame.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		class TileDamageMap
+		{
+		public:
+			static const uint32_t DefaultTileSize = 64;
+
+			void Resize(uint32_t Width, uint32_t Height, uint32_t TileSize = DefaultTileSize)
+			{
+				m_Width = Width;
+				m_Height = Height;
+				m_TileSize = TileSize;
+				m_TilesX = (Width + TileSize - 1) / TileSize;
+				m_TilesY = (Height + TileSize - 1) / TileSize;
+				m_WordsPerRow = (m_TilesX + 63) / 64;
+				m_Bits.assign((size_t)m_WordsPerRow * m_TilesY, 0);
+			}
+
+			uint32_t Width() const
+			{
+				return m_Width;
+			}
+
+			uint32_t Height() const
+			{
+				return m_Height;
+			}
+
+			uint32_t TileSize() const
+			{
+				return m_TileSize;
+			}
+
+			uint32_t TilesX() const
+			{
+				return m_TilesX;
+			}
+
+			uint32_t TilesY() const
+			{
+				return m_TilesY;
+			}
+
+			bool IsTileDamaged(uint32_t tx, uint32_t ty) const
+			{
+				return TestTile(ty, tx);
+			}
+
+			void ClearTile(uint32_t tx, uint32_t ty)
+			{
+				m_Bits[(size_t)ty * m_WordsPerRow + tx / 64] &= ~(1ULL << (tx % 64));
+			}
+
+			void Clear()
+			{
+				std::fill(m_Bits.begin(), m_Bits.end(), 0);
+			}
+
+			void MarkAll()
+			{
+				for (uint32_t ty = 0; ty < m_TilesY; ty++)
+				{
+					SetRun(ty, 0, m_TilesX);
+				}
+			}
+
+			// Marks every tile touched by the rectangle, which is clipped to the frame
+			void AddRect(int32_t Left, int32_t Top, int32_t Right, int32_t Bottom)
+			{
+				if (Left < 0) Left = 0;
+				if (Top < 0) Top = 0;
+				if (Right > (int32_t)m_Width) Right = (int32_t)m_Width;
+				if (Bottom > (int32_t)m_Height) Bottom = (int32_t)m_Height;
+
+				if (Left >= Right || Top >= Bottom)
+				{
+					return;
+				}
+
+				uint32_t tx0 = (uint32_t)Left / m_TileSize;
+				uint32_t tx1 = ((uint32_t)Right + m_TileSize - 1) / m_TileSize;
+				uint32_t ty0 = (uint32_t)Top / m_TileSize;
+				uint32_t ty1 = ((uint32_t)Bottom + m_TileSize - 1) / m_TileSize;
+
+				for (uint32_t ty = ty0; ty < ty1; ty++)
+				{
+					SetRun(ty, tx0, tx1);
+				}
+			}
+
+			// Accumulates another map of the same geometry into this one
+			void Merge(const TileDamageMap& Other)
+			{
+				for (size_t i = 0; i < m_Bits.size() && i < Other.m_Bits.size(); i++)
+				{
+					m_Bits[i] |= Other.m_Bits[i];
+				}
+			}
+
+			bool IsEmpty() const
+			{
+				for (auto Word : m_Bits)
+				{
+					if (Word)
+					{
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			uint32_t DamagedTileCount() const
+			{
+				uint32_t Count = 0;
+				for (auto Word : m_Bits)
+				{
+					for (; Word; Word &= Word - 1)
+					{
+						Count++;
+					}
+				}
+
+				return Count;
+			}
+
+			// Produces the pixel rectangles covering all damaged tiles. Returns false, leaving a partial plan, when more
+			// than MaxRects rectangles would be needed, in which case the caller should fall back to a full copy.
+			bool BuildPlan(std::vector<SUDOVDA::SUVDA_FRAME_RECT>& Plan, size_t MaxRects) const
+			{
+				Plan.clear();
+
+				// Rectangles still open at the previous tile row, as indices into Plan in x order
+				std::vector<size_t> Open, NextOpen;
+
+				for (uint32_t ty = 0; ty < m_TilesY; ty++)
+				{
+					NextOpen.clear();
+					size_t Candidate = 0;
+
+					uint32_t tx = 0;
+					while (NextRun(ty, tx))
+					{
+						uint32_t RunStart = tx;
+						while (tx < m_TilesX && TestTile(ty, tx))
+						{
+							tx++;
+						}
+
+						int32_t Left = (int32_t)(RunStart * m_TileSize);
+						int32_t Right = (int32_t)Clamp(tx * m_TileSize, m_Width);
+						int32_t Top = (int32_t)(ty * m_TileSize);
+						int32_t Bottom = (int32_t)Clamp((ty + 1) * m_TileSize, m_Height);
+
+						// Extend the rectangle above if it spans exactly the same columns
+						while (Candidate < Open.size() && Plan[Open[Candidate]].Left < Left)
+						{
+							Candidate++;
+						}
+
+						if (Candidate < Open.size() && Plan[Open[Candidate]].Left == Left && Plan[Open[Candidate]].Right == Right)
+						{
+							Plan[Open[Candidate]].Bottom = Bottom;
+							NextOpen.push_back(Open[Candidate]);
+							Candidate++;
+						}
+						else
+						{
+							if (Plan.size() >= MaxRects)
+							{
+								return false;
+							}
+
+							Plan.push_back(SUDOVDA::SUVDA_FRAME_RECT{Left, Top, Right, Bottom});
+							NextOpen.push_back(Plan.size() - 1);
+						}
+					}
+
+					Open.swap(NextOpen);
+				}
+
+				return true;
+			}
+
+		private:
+			static uint32_t Clamp(uint32_t Value, uint32_t Limit)
+			{
+				return Value < Limit ? Value : Limit;
+			}
+
+			bool TestTile(uint32_t ty, uint32_t tx) const
+			{
+				return (m_Bits[(size_t)ty * m_WordsPerRow + tx / 64] >> (tx % 64)) & 1;
+			}
+
+			// Advances tx to the next damaged tile in the row, returns false at the end of the row
+			bool NextRun(uint32_t ty, uint32_t& tx) const
+			{
+				const uint64_t* pRow = &m_Bits[(size_t)ty * m_WordsPerRow];
+
+				while (tx < m_TilesX)
+				{
+					uint64_t Word = pRow[tx / 64] >> (tx % 64);
+					if (Word)
+					{
+						while (!(Word & 1))
+						{
+							Word >>= 1;
+							tx++;
+						}
+						return tx < m_TilesX;
+					}
+
+					tx = (tx / 64 + 1) * 64;
+				}
+
+				return false;
+			}
+
+			void SetRun(uint32_t ty, uint32_t tx0, uint32_t tx1)
+			{
+				uint64_t* pRow = &m_Bits[(size_t)ty * m_WordsPerRow];
+
+				while (tx0 < tx1)
+				{
+					uint32_t Bit = tx0 % 64;
+					uint32_t Count = (tx1 - tx0) < (64 - Bit) ? (tx1 - tx0) : (64 - Bit);
+					uint64_t Mask = Count == 64 ? ~0ULL : (((1ULL << Count) - 1) << Bit);
+
+					pRow[tx0 / 64] |= Mask;
+					tx0 += Count;
+				}
+			}
+
+			uint32_t m_Width = 0;
+			uint32_t m_Height = 0;
+			uint32_t m_TileSize = DefaultTileSize;
+			uint32_t m_TilesX = 0;
+			uint32_t m_TilesY = 0;
+			uint32_t m_WordsPerRow = 0;
+			std::vector<uint64_t> m_Bits;
+		};
+	}
+}
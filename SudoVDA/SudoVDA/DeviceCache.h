@@ -0,0 +1,143 @@
+#pragma once
+
+// Render devices shared by every monitor on the same adapter.
+//
+// Each swap-chain assignment used to create a DXGI factory and a D3D11 device of its own, which costs tens of
+// milliseconds per mode change and one device per monitor. The DeviceCache hands out one device per render adapter
+// instead, keyed by the adapter's LUID:
+//
+//  * The cache only holds weak references. Monitors own their device through the shared_ptr they were given, so the
+//    device is released with the last swap-chain that renders on it, and a later assignment creates it again.
+//  * The factory is asked whether it is still current (IDXGIFactory::IsCurrent) before every lookup, and refreshed
+//    when adapters were added or removed, so new devices never come from an adapter enumeration that is out of date.
+//    Devices of adapters that are still there stay shared.
+//  * Devices that stopped working (adapter removed, driver reset) are never handed out again, a new one is created
+//    in their place. Monitors still holding the old one find out from their own D3D calls.
+//
+// Creation is serialized by the cache's lock, so monitors assigned to the same adapter at once still end up with a
+// single device. The platform work lives behind IDeviceFactory, D3D11DeviceFactory in the driver and a counting fake
+// elsewhere.
+
+#include <stdint.h>
+
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		/// <summary>
+		/// Creates the devices a DeviceCache shares.
+		/// </summary>
+		template <typename TDevice>
+		class IDeviceFactory
+		{
+		public:
+			virtual ~IDeviceFactory() = default;
+
+			// Whether the adapters the factory enumerates are still the ones on the system
+			virtual bool IsCurrent() = 0;
+			// Drops the adapter enumeration so the next Create() sees the adapters as they are now
+			virtual void Refresh() = 0;
+			// Null on failure
+			virtual std::shared_ptr<TDevice> Create(uint64_t AdapterKey) = 0;
+			// False once the device stopped working and has to be replaced
+			virtual bool IsUsable(TDevice& Device) = 0;
+		};
+
+		typedef struct _DEVICE_CACHE_STATS {
+			uint64_t Created;
+			uint64_t Reused;
+			uint64_t Failed;
+			uint64_t Refreshes;     // Adapter enumerations dropped because they were out of date
+			uint64_t Replaced;      // Cached devices that stopped working
+		} DEVICE_CACHE_STATS;
+
+		template <typename TDevice>
+		class DeviceCache
+		{
+		public:
+			explicit DeviceCache(IDeviceFactory<TDevice>& Factory) :
+				m_Factory(Factory)
+			{
+			}
+
+			DeviceCache(const DeviceCache&) = delete;
+			DeviceCache& operator=(const DeviceCache&) = delete;
+
+			// The device of the adapter, shared with everybody else holding it. Null if it can't be created.
+			std::shared_ptr<TDevice> Acquire(uint64_t AdapterKey)
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+
+				if (!m_Factory.IsCurrent())
+				{
+					m_Factory.Refresh();
+					m_Stats.Refreshes++;
+				}
+
+				auto It = m_Devices.find(AdapterKey);
+				if (It != m_Devices.end())
+				{
+					auto Device = It->second.lock();
+					if (Device && m_Factory.IsUsable(*Device))
+					{
+						m_Stats.Reused++;
+						return Device;
+					}
+
+					if (Device)
+					{
+						m_Stats.Replaced++;
+					}
+					m_Devices.erase(It);
+				}
+
+				auto Device = m_Factory.Create(AdapterKey);
+				if (!Device)
+				{
+					m_Stats.Failed++;
+					return nullptr;
+				}
+
+				// Adapters come and go rarely, expired entries are only pruned when a device is created
+				for (auto Entry = m_Devices.begin(); Entry != m_Devices.end();)
+				{
+					Entry = Entry->second.expired() ? m_Devices.erase(Entry) : std::next(Entry);
+				}
+
+				m_Devices.emplace(AdapterKey, Device);
+				m_Stats.Created++;
+				return Device;
+			}
+
+			// Devices currently alive in the cache
+			size_t LiveDevices() const
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+
+				size_t Count = 0;
+				for (auto& Entry : m_Devices)
+				{
+					Count += !Entry.second.expired();
+				}
+				return Count;
+			}
+
+			DEVICE_CACHE_STATS Stats() const
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				return m_Stats;
+			}
+
+		private:
+			IDeviceFactory<TDevice>& m_Factory;
+			mutable std::mutex m_Lock;
+			std::unordered_map<uint64_t, std::weak_ptr<TDevice>> m_Devices;
+			DEVICE_CACHE_STATS m_Stats = {};
+		};
+	}
+}
@@ -0,0 +1,317 @@
+#include "Downscale.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DOWNSCALE_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define DOWNSCALE_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// MSVC allows any intrinsic in any function, GCC and Clang need the target spelled out per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define DOWNSCALE_TARGET_SSE41
+#define DOWNSCALE_TARGET_AVX2
+#else
+#define DOWNSCALE_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define DOWNSCALE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			// Adds Bytes source bytes to as many 16-bit accumulators, or overwrites them for the first row of a strip
+			typedef void (*ACCUMULATE_ROW)(const uint8_t* pRow, uint32_t Bytes, uint16_t* pAcc, bool First);
+			// Sums Factor accumulated pixels per destination pixel and divides by 2^Shift
+			typedef void (*REDUCE_ROW)(const uint16_t* pAcc, uint32_t Pixels, uint32_t Factor, uint32_t Shift, uint8_t* pDst);
+
+			typedef struct _DOWNSCALE_KERNELS {
+				ACCUMULATE_ROW Accumulate;
+				REDUCE_ROW Reduce;
+			} DOWNSCALE_KERNELS;
+
+			// Source pixels summed per chunk, a multiple of every factor. The accumulator takes 2 KB of stack.
+			const uint32_t ChunkPixels = 256;
+
+#pragma region Scalar
+
+			void AccumulateRowFrom(uint32_t Start, const uint8_t* pRow, uint32_t Bytes, uint16_t* pAcc, bool First)
+			{
+				for (uint32_t i = Start; i < Bytes; i++)
+				{
+					pAcc[i] = First ? pRow[i] : (uint16_t)(pAcc[i] + pRow[i]);
+				}
+			}
+
+			void ReduceRowFrom(uint32_t Start, const uint16_t* pAcc, uint32_t Pixels, uint32_t Factor, uint32_t Shift, uint8_t* pDst)
+			{
+				uint32_t Round = 1u << (Shift - 1);
+				for (uint32_t x = Start; x < Pixels; x++)
+				{
+					const uint16_t* pBlock = pAcc + (size_t)x * Factor * 4;
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						uint32_t Sum = 0;
+						for (uint32_t k = 0; k < Factor; k++)
+						{
+							Sum += pBlock[k * 4 + c];
+						}
+						pDst[x * 4 + c] = (uint8_t)((Sum + Round) >> Shift);
+					}
+				}
+			}
+
+			void AccumulateRowScalar(const uint8_t* pRow, uint32_t Bytes, uint16_t* pAcc, bool First)
+			{
+				AccumulateRowFrom(0, pRow, Bytes, pAcc, First);
+			}
+
+			void ReduceRowScalar(const uint16_t* pAcc, uint32_t Pixels, uint32_t Factor, uint32_t Shift, uint8_t* pDst)
+			{
+				ReduceRowFrom(0, pAcc, Pixels, Factor, Shift, pDst);
+			}
+
+			const DOWNSCALE_KERNELS ScalarKernels = { AccumulateRowScalar, ReduceRowScalar };
+
+#pragma endregion
+
+#if DOWNSCALE_X64
+
+#pragma region SSE41
+
+			DOWNSCALE_TARGET_SSE41 void AccumulateRowSse41(const uint8_t* pRow, uint32_t Bytes, uint16_t* pAcc, bool First)
+			{
+				const __m128i Zero = _mm_setzero_si128();
+
+				uint32_t i = 0;
+				for (; i + 16 <= Bytes; i += 16)
+				{
+					__m128i Bytes16 = _mm_loadu_si128((const __m128i*)(pRow + i));
+					__m128i Lo = _mm_cvtepu8_epi16(Bytes16);
+					__m128i Hi = _mm_unpackhi_epi8(Bytes16, Zero);
+					if (!First)
+					{
+						Lo = _mm_add_epi16(Lo, _mm_loadu_si128((const __m128i*)(pAcc + i)));
+						Hi = _mm_add_epi16(Hi, _mm_loadu_si128((const __m128i*)(pAcc + i + 8)));
+					}
+					_mm_storeu_si128((__m128i*)(pAcc + i), Lo);
+					_mm_storeu_si128((__m128i*)(pAcc + i + 8), Hi);
+				}
+
+				AccumulateRowFrom(i, pRow, Bytes, pAcc, First);
+			}
+
+			// Two destination pixels at a time, each load picks up two source pixels of the same block
+			DOWNSCALE_TARGET_SSE41 void ReduceRowSse41(const uint16_t* pAcc, uint32_t Pixels, uint32_t Factor, uint32_t Shift, uint8_t* pDst)
+			{
+				const __m128i Round = _mm_set1_epi16((int16_t)(1 << (Shift - 1)));
+				const __m128i ShiftCount = _mm_cvtsi32_si128((int)Shift);
+
+				uint32_t x = 0;
+				for (; x + 2 <= Pixels; x += 2)
+				{
+					const uint16_t* p0 = pAcc + (size_t)x * Factor * 4;
+					const uint16_t* p1 = p0 + Factor * 4;
+
+					__m128i Sum0 = _mm_setzero_si128();
+					__m128i Sum1 = _mm_setzero_si128();
+					for (uint32_t k = 0; k < Factor; k += 2)
+					{
+						Sum0 = _mm_add_epi16(Sum0, _mm_loadu_si128((const __m128i*)(p0 + k * 4)));
+						Sum1 = _mm_add_epi16(Sum1, _mm_loadu_si128((const __m128i*)(p1 + k * 4)));
+					}
+
+					// Fold the even and odd source pixels of every block together
+					__m128i Sum = _mm_add_epi16(_mm_unpacklo_epi64(Sum0, Sum1), _mm_unpackhi_epi64(Sum0, Sum1));
+					Sum = _mm_srl_epi16(_mm_add_epi16(Sum, Round), ShiftCount);
+					_mm_storel_epi64((__m128i*)(pDst + x * 4), _mm_packus_epi16(Sum, Sum));
+				}
+
+				ReduceRowFrom(x, pAcc, Pixels, Factor, Shift, pDst);
+			}
+
+			const DOWNSCALE_KERNELS Sse41Kernels = { AccumulateRowSse41, ReduceRowSse41 };
+
+#pragma endregion
+
+#pragma region AVX2
+
+			DOWNSCALE_TARGET_AVX2 void AccumulateRowAvx2(const uint8_t* pRow, uint32_t Bytes, uint16_t* pAcc, bool First)
+			{
+				uint32_t i = 0;
+				for (; i + 32 <= Bytes; i += 32)
+				{
+					__m256i Bytes32 = _mm256_loadu_si256((const __m256i*)(pRow + i));
+					__m256i Lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(Bytes32));
+					__m256i Hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(Bytes32, 1));
+					if (!First)
+					{
+						Lo = _mm256_add_epi16(Lo, _mm256_loadu_si256((const __m256i*)(pAcc + i)));
+						Hi = _mm256_add_epi16(Hi, _mm256_loadu_si256((const __m256i*)(pAcc + i + 16)));
+					}
+					_mm256_storeu_si256((__m256i*)(pAcc + i), Lo);
+					_mm256_storeu_si256((__m256i*)(pAcc + i + 16), Hi);
+				}
+
+				AccumulateRowFrom(i, pRow, Bytes, pAcc, First);
+			}
+
+			// The horizontal pass only sees 1/Factor of the data, the SSE4.1 version is just as fast there
+			const DOWNSCALE_KERNELS Avx2Kernels = { AccumulateRowAvx2, ReduceRowSse41 };
+
+#pragma endregion
+
+#endif // DOWNSCALE_X64
+
+#if DOWNSCALE_ARM64
+
+#pragma region NEON
+
+			void AccumulateRowNeon(const uint8_t* pRow, uint32_t Bytes, uint16_t* pAcc, bool First)
+			{
+				uint32_t i = 0;
+				for (; i + 16 <= Bytes; i += 16)
+				{
+					uint8x16_t Bytes16 = vld1q_u8(pRow + i);
+					uint16x8_t Lo, Hi;
+					if (First)
+					{
+						Lo = vmovl_u8(vget_low_u8(Bytes16));
+						Hi = vmovl_u8(vget_high_u8(Bytes16));
+					}
+					else
+					{
+						Lo = vaddw_u8(vld1q_u16(pAcc + i), vget_low_u8(Bytes16));
+						Hi = vaddw_u8(vld1q_u16(pAcc + i + 8), vget_high_u8(Bytes16));
+					}
+					vst1q_u16(pAcc + i, Lo);
+					vst1q_u16(pAcc + i + 8, Hi);
+				}
+
+				AccumulateRowFrom(i, pRow, Bytes, pAcc, First);
+			}
+
+			void ReduceRowNeon(const uint16_t* pAcc, uint32_t Pixels, uint32_t Factor, uint32_t Shift, uint8_t* pDst)
+			{
+				// Rounding shift right, the same (Sum + Round) >> Shift as the scalar path
+				const int16x8_t ShiftCount = vdupq_n_s16(-(int16_t)Shift);
+
+				uint32_t x = 0;
+				for (; x + 2 <= Pixels; x += 2)
+				{
+					const uint16_t* p0 = pAcc + (size_t)x * Factor * 4;
+					const uint16_t* p1 = p0 + Factor * 4;
+
+					uint16x8_t Sum0 = vdupq_n_u16(0);
+					uint16x8_t Sum1 = vdupq_n_u16(0);
+					for (uint32_t k = 0; k < Factor; k += 2)
+					{
+						Sum0 = vaddq_u16(Sum0, vld1q_u16(p0 + k * 4));
+						Sum1 = vaddq_u16(Sum1, vld1q_u16(p1 + k * 4));
+					}
+
+					uint16x8_t Sum = vaddq_u16(
+						vcombine_u16(vget_low_u16(Sum0), vget_low_u16(Sum1)),
+						vcombine_u16(vget_high_u16(Sum0), vget_high_u16(Sum1)));
+					vst1_u8(pDst + x * 4, vqmovn_u16(vrshlq_u16(Sum, ShiftCount)));
+				}
+
+				ReduceRowFrom(x, pAcc, Pixels, Factor, Shift, pDst);
+			}
+
+			const DOWNSCALE_KERNELS NeonKernels = { AccumulateRowNeon, ReduceRowNeon };
+
+#pragma endregion
+
+#endif // DOWNSCALE_ARM64
+
+			const DOWNSCALE_KERNELS* Kernels()
+			{
+				switch (PixelConvertGetIsa())
+				{
+#if DOWNSCALE_X64
+				case PIXEL_CONVERT_ISA_SSE41:
+					return &Sse41Kernels;
+				case PIXEL_CONVERT_ISA_AVX2:
+					return &Avx2Kernels;
+#endif
+#if DOWNSCALE_ARM64
+				case PIXEL_CONVERT_ISA_NEON:
+					return &NeonKernels;
+#endif
+				default:
+					return &ScalarKernels;
+				}
+			}
+		}
+
+		bool DownscaleIsSupportedFactor(uint32_t Factor)
+		{
+			return Factor >= 2 && Factor <= DownscaleMaxFactor && (Factor & (Factor - 1)) == 0;
+		}
+
+		void DownscaleBgraBox(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height, uint32_t Factor,
+			uint8_t* pDst, size_t DstPitch,
+			uint32_t Left, uint32_t Top, uint32_t Right, uint32_t Bottom)
+		{
+			if (!DownscaleIsSupportedFactor(Factor) || !Width || !Height)
+			{
+				return;
+			}
+
+			uint32_t DstWidth = DownscaledSize(Width, Factor);
+			uint32_t DstHeight = DownscaledSize(Height, Factor);
+			Right = Right < DstWidth ? Right : DstWidth;
+			Bottom = Bottom < DstHeight ? Bottom : DstHeight;
+
+			uint32_t Shift = 0;
+			while ((1u << Shift) < Factor)
+			{
+				Shift++;
+			}
+			Shift *= 2;
+
+			const DOWNSCALE_KERNELS* pKernels = Kernels();
+			const uint32_t ChunkOutputs = ChunkPixels / Factor;
+			uint16_t Acc[ChunkPixels * 4];
+
+			for (uint32_t y = Top; y < Bottom; y++)
+			{
+				uint8_t* pOut = pDst + y * DstPitch;
+
+				for (uint32_t x = Left; x < Right; x += ChunkOutputs)
+				{
+					uint32_t Outputs = Right - x < ChunkOutputs ? Right - x : ChunkOutputs;
+					uint32_t Column = x * Factor;
+					uint32_t Columns = (x + Outputs) * Factor < Width ? Outputs * Factor : Width - Column;
+
+					for (uint32_t k = 0; k < Factor; k++)
+					{
+						// Rows past the bottom edge repeat the last one
+						uint32_t Row = y * Factor + k < Height ? y * Factor + k : Height - 1;
+						pKernels->Accumulate(pSrc + Row * SrcPitch + (size_t)Column * 4, Columns * 4, Acc, k == 0);
+					}
+
+					// As do columns past the right edge
+					for (uint32_t c = Columns; c < Outputs * Factor; c++)
+					{
+						memcpy(Acc + c * 4, Acc + (Columns - 1) * 4, 4 * sizeof(uint16_t));
+					}
+
+					pKernels->Reduce(Acc, Outputs, Factor, Shift, pOut + (size_t)x * 4);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Box downscaling of BGRA8 frames, used for the low resolution monitor previews.
+//
+// Every Factor x Factor block of source pixels is averaged into one destination pixel, all four channels including
+// alpha, rounded to nearest. Factors are powers of two up to 16, so the sums of a block fit 16-bit lanes and the
+// average is a shift.
+//
+// The source is walked in strips of Factor rows and chunks of 256 columns: the rows of a chunk are summed into a small
+// accumulator on the stack, which is then reduced horizontally into the destination. There is no intermediate image
+// at any resolution, and only the source pixels under the requested destination rectangle are read, so a preview can
+// be kept up to date by downscaling just the damaged tiles.
+//
+// Blocks on the right and bottom edge replicate the last column and row. The instruction set follows
+// PixelConvertGetIsa(), all paths are bit-exact with the scalar one.
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		const uint32_t DownscaleMaxFactor = 16;
+
+		// 2, 4, 8 or 16
+		bool DownscaleIsSupportedFactor(uint32_t Factor);
+
+		inline uint32_t DownscaledSize(uint32_t Size, uint32_t Factor)
+		{
+			return (Size + Factor - 1) / Factor;
+		}
+
+		// Writes the destination pixels [Left, Right) x [Top, Bottom) of pSrc (Width x Height) scaled down by Factor.
+		// The rectangle is clipped to the destination size. Pitches are in bytes.
+		void DownscaleBgraBox(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height, uint32_t Factor,
+			uint8_t* pDst, size_t DstPitch,
+			uint32_t Left, uint32_t Top, uint32_t Right, uint32_t Bottom);
+	}
+}
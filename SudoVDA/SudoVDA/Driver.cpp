@@ -24,6 +24,9 @@ Environment:
 #include <thread>
 #include <mutex>
 
+#include <sddl.h>
+#include <aclapi.h>
+
 #include <AdapterOption.h>
 #include <sudovda-ioctl.h>
 
@@ -38,6 +41,12 @@ bool preferredAdapterChanged = false;
 std::mutex monitorListOp;
 std::queue<size_t> freeConnectorSlots;
 std::list<IndirectMonitorContext*> monitorCtxList;
+// Modes of every monitor by EDID, for the monitor description callbacks
+EdidIndex<MonitorModes> monitorEdidIndex;
+// Modes of edid-less monitors and the defaults of every other, compiled from modeListFile when it's set
+ModeList defaultModeList;
+MODE_LIST_REPORT modeListReport = {};
+HRESULT modeListStatus = S_FALSE; // S_FALSE while no mode file is set
 
 bool isHDRSupported = false;
 bool testMode = false;
@@ -46,155 +55,164 @@ DWORD watchdogCountdown = 0;
 std::thread watchdogThread;
 
 DWORD MaxVirtualMonitorCount = 10;
+DWORD FrameExportSlots = 0; // 0 disables the shared-memory frame export
+bool FrameDuplicateDetection = false;
+DWORD FramePreviewScale = 0; // 0 disables the preview ring
+DWORD FramePreviewFps = 10;
+DWORD IdleRefreshMs = 0; // 0 disables idle refinement
+DWORD IdleRefreshIntervalMs = 1000;
+DWORD IdleRefreshMaxPasses = 0; // 0 means no limit
+bool SharedWorkerPool = false;
+bool CursorCompositing = false;
+DWORD HdrToneMapping = 0; // SDR white in nits, 0 disables tone mapping
 IDDCX_BITS_PER_COMPONENT SDRBITS = IDDCX_BITS_PER_COMPONENT_8;
 IDDCX_BITS_PER_COMPONENT HDRBITS = IDDCX_BITS_PER_COMPONENT_10;
 
-#pragma region SampleMonitors
-
-static const UINT mode_scale_factors[] = {
-    // Put 100 at the first for convenience and fool proof
-    100,
-    50,
-    75,
-    125,
-    150,
-};
+#pragma region helpers
 
-// Default modes reported for edid-less monitors. The second mode is set as preferred
-static const struct VirtualMonitorMode s_DefaultModes[] = {
-    {950, 1080, 60000},
-    {950, 1080, 90000},
-    {950, 1080, 120000},
-    {1260, 1440, 60000},
-    {1260, 1440, 90000},
-    {1260, 1440, 120000},
-    {1920, 1080, 60000},
-    {1920, 1080, 90000},
-    {1920, 1080, 120000},
-    {1920, 1200, 60000},
-    {1920, 1200, 90000},
-    {1920, 1200, 120000},
-
-    {2560, 1440, 60000},
-    {2560, 1440, 90000},
-    {2560, 1440, 120000},
-    {2560, 1600, 60000},
-    {2560, 1600, 90000},
-    {2560, 1600, 120000},
-
-    {2880, 1080, 60000},
-    {2880, 1080, 90000},
-    {2880, 1080, 120000},
-    {2880, 1200, 60000},
-    {2880, 1200, 90000},
-    {2880, 1200, 120000},
-
-    {3840, 1080, 60000},
-    {3840, 1080, 90000},
-    {3840, 1080, 120000},
-    {3840, 1200, 60000},
-    {3840, 1200, 90000},
-    {3840, 1200, 120000},
-    {3840, 1440, 60000},
-    {3840, 1440, 90000},
-    {3840, 1440, 120000},
-    {3840, 1600, 60000},
-    {3840, 1600, 90000},
-    {3840, 1600, 120000},
-
-    {5120, 1440, 60000},
-    {5120, 1440, 90000},
-    {5120, 1440, 120000},
-    {5120, 1600, 60000},
-    {5120, 1600, 90000},
-    {5120, 1600, 120000},
-};
+// Pool shared by all swap-chains when sharedWorkerPool is set, nullptr otherwise. It is created on first use and
+// never destroyed, joining its workers while the host unloads the driver could deadlock on the loader lock.
+static WorkerPool* GetSharedWorkerPool()
+{
+    if (!SharedWorkerPool)
+    {
+        return nullptr;
+    }
 
-#pragma endregion
+    static WorkerPool* Pool = new WorkerPool(0, [](uint32_t)
+    {
+        // Same scheduling class the dedicated swap-chain threads register with
+        DWORD AvTask = 0;
+        AvSetMmThreadCharacteristicsW(L"DisplayPostProcessing", &AvTask);
+    });
 
-#pragma region helpers
+    return Pool;
+}
 
-static inline void FillSignalInfo(DISPLAYCONFIG_VIDEO_SIGNAL_INFO& Mode, DWORD Width, DWORD Height, DWORD VSync, bool bMonitorMode)
+// Render devices shared by the monitors of each adapter
+static DeviceCache<Direct3DDevice>& GetDeviceCache()
 {
-    Mode.totalSize.cx = Mode.activeSize.cx = Width;
-    Mode.totalSize.cy = Mode.activeSize.cy = Height;
+    static D3D11DeviceFactory Factory;
+    static DeviceCache<Direct3DDevice> Cache(Factory);
 
-    // See https://docs.microsoft.com/en-us/windows/win32/api/wingdi/ns-wingdi-displayconfig_video_signal_info
-    Mode.AdditionalSignalInfo.vSyncFreqDivider = bMonitorMode ? 0 : 1;
-    Mode.AdditionalSignalInfo.videoStandard = 255;
+    return Cache;
+}
 
-    DWORD Denominator = 1000;
+// Compiles the mode file at Path into defaultModeList, which keeps the built-in modes unless a line is valid. The
+// file is only mapped for the time it takes to compile it.
+static HRESULT LoadModeList(const wchar_t* Path)
+{
+    const LONGLONG MaxModeListSize = 64 << 20;
 
-    if (isHDRSupported)
+    HANDLE hFile = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
     {
-        if (VSync < 1000)
-        {
-            VSync *= 1000;
-        }
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER Size = {};
+    if (!GetFileSizeEx(hFile, &Size))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (Size.QuadPart > MaxModeListSize)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+    else if (Size.QuadPart == 0)
+    {
+        // Empty files can't be mapped, and have no mode anyway
+        hr = defaultModeList.Compile(nullptr, 0, modeListReport) ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
     }
     else
     {
-        if (VSync % 1000 > 500)
+        HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        const void* pView = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!pView)
         {
-            VSync = (VSync / 1000) + 1;
+            hr = HRESULT_FROM_WIN32(GetLastError());
         }
-        else
+        else if (!defaultModeList.Compile((const char*)pView, (size_t)Size.QuadPart, modeListReport))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        if (pView)
+        {
+            UnmapViewOfFile(pView);
+        }
+        if (hMapping)
         {
-            VSync /= 1000;
+            CloseHandle(hMapping);
         }
-        Denominator = 1;
     }
 
-    Mode.vSyncFreq.Numerator = VSync;
-    Mode.vSyncFreq.Denominator = Denominator;
-    Mode.hSyncFreq.Numerator = VSync * Height;
-    Mode.hSyncFreq.Denominator = Denominator;
+    CloseHandle(hFile);
+    return hr;
+}
+
+static inline void FillSignalInfo(DISPLAYCONFIG_VIDEO_SIGNAL_INFO& Mode, const MODE_TIMING& Timing, bool bMonitorMode)
+{
+    Mode.activeSize.cx = Timing.Width;
+    Mode.activeSize.cy = Timing.Height;
+    Mode.totalSize.cx = Timing.TotalWidth;
+    Mode.totalSize.cy = Timing.TotalHeight;
+
+    // See https://docs.microsoft.com/en-us/windows/win32/api/wingdi/ns-wingdi-displayconfig_video_signal_info
+    Mode.AdditionalSignalInfo.vSyncFreqDivider = bMonitorMode ? 0 : 1;
+    Mode.AdditionalSignalInfo.videoStandard = 255;
+
+    Mode.vSyncFreq.Numerator = Timing.VSyncNumerator;
+    Mode.vSyncFreq.Denominator = Timing.VSyncDenominator;
+    Mode.hSyncFreq.Numerator = Timing.HSyncNumerator;
+    Mode.hSyncFreq.Denominator = Timing.HSyncDenominator;
 
     Mode.scanLineOrdering = DISPLAYCONFIG_SCANLINE_ORDERING_PROGRESSIVE;
 
-    Mode.pixelRate = ((UINT64)VSync) * ((UINT64)Width) * ((UINT64)Height) / Denominator;
+    Mode.pixelRate = Timing.PixelRate;
 }
 
-static IDDCX_MONITOR_MODE CreateIddCxMonitorMode(DWORD Width, DWORD Height, DWORD VSync, IDDCX_MONITOR_MODE_ORIGIN Origin = IDDCX_MONITOR_MODE_ORIGIN_DRIVER)
+static IDDCX_MONITOR_MODE CreateIddCxMonitorMode(const MODE_TIMING& Timing, IDDCX_MONITOR_MODE_ORIGIN Origin = IDDCX_MONITOR_MODE_ORIGIN_DRIVER)
 {
     IDDCX_MONITOR_MODE Mode = {};
 
     Mode.Size = sizeof(Mode);
     Mode.Origin = Origin;
-    FillSignalInfo(Mode.MonitorVideoSignalInfo, Width, Height, VSync, true);
+    FillSignalInfo(Mode.MonitorVideoSignalInfo, Timing, true);
 
     return Mode;
 }
 
-static IDDCX_MONITOR_MODE2 CreateIddCxMonitorMode2(DWORD Width, DWORD Height, DWORD VSync, IDDCX_MONITOR_MODE_ORIGIN Origin = IDDCX_MONITOR_MODE_ORIGIN_DRIVER)
+static IDDCX_MONITOR_MODE2 CreateIddCxMonitorMode2(const MODE_TIMING& Timing, IDDCX_MONITOR_MODE_ORIGIN Origin = IDDCX_MONITOR_MODE_ORIGIN_DRIVER)
 {
     IDDCX_MONITOR_MODE2 Mode = {};
 
     Mode.Size = sizeof(Mode);
     Mode.Origin = Origin;
     Mode.BitsPerComponent.Rgb = SDRBITS | HDRBITS;
-    FillSignalInfo(Mode.MonitorVideoSignalInfo, Width, Height, VSync, true);
+    FillSignalInfo(Mode.MonitorVideoSignalInfo, Timing, true);
 
     return Mode;
 }
 
-static IDDCX_TARGET_MODE CreateIddCxTargetMode(DWORD Width, DWORD Height, DWORD VSync)
+static IDDCX_TARGET_MODE CreateIddCxTargetMode(const MODE_TIMING& Timing)
 {
     IDDCX_TARGET_MODE Mode = {};
 
     Mode.Size = sizeof(Mode);
-    FillSignalInfo(Mode.TargetVideoSignalInfo.targetVideoSignalInfo, Width, Height, VSync, false);
+    FillSignalInfo(Mode.TargetVideoSignalInfo.targetVideoSignalInfo, Timing, false);
 
     return Mode;
 }
 
-static IDDCX_TARGET_MODE2 CreateIddCxTargetMode2(DWORD Width, DWORD Height, DWORD VSync)
+static IDDCX_TARGET_MODE2 CreateIddCxTargetMode2(const MODE_TIMING& Timing)
 {
     IDDCX_TARGET_MODE2 Mode = {};
 
     Mode.Size = sizeof(Mode);
     Mode.BitsPerComponent.Rgb = SDRBITS | HDRBITS;
-    FillSignalInfo(Mode.TargetVideoSignalInfo.targetVideoSignalInfo, Width, Height, VSync, false);
+    FillSignalInfo(Mode.TargetVideoSignalInfo.targetVideoSignalInfo, Timing, false);
 
     return Mode;
 }
@@ -316,6 +334,97 @@ void LoadSettings()
         MaxVirtualMonitorCount = _maxMonitorCount;
     }
 
+    // Query frame export slot count
+    DWORD _frameExportSlots;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"frameExportSlots", NULL, NULL, (LPBYTE)&_frameExportSlots, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        if (_frameExportSlots)
+        {
+            FrameExportSlots = std::clamp<DWORD>(_frameExportSlots, 2, SUVDA_FRAME_RING_MAX_SLOTS);
+        }
+        else
+        {
+            FrameExportSlots = 0;
+        }
+    }
+
+    // Query frame duplicate detection
+    DWORD _frameDuplicateDetection;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"frameDuplicateDetection", NULL, NULL, (LPBYTE)&_frameDuplicateDetection, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        FrameDuplicateDetection = !!_frameDuplicateDetection;
+    }
+
+    // Query preview scale and rate
+    DWORD _framePreview;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"framePreviewScale", NULL, NULL, (LPBYTE)&_framePreview, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        FramePreviewScale = DownscaleIsSupportedFactor(_framePreview) ? _framePreview : 0;
+    }
+
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"framePreviewFps", NULL, NULL, (LPBYTE)&_framePreview, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        FramePreviewFps = std::clamp<DWORD>(_framePreview, 1, 30);
+    }
+
+    // Query idle refinement
+    DWORD _idleRefresh;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"idleRefreshMs", NULL, NULL, (LPBYTE)&_idleRefresh, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        IdleRefreshMs = _idleRefresh;
+    }
+
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"idleRefreshIntervalMs", NULL, NULL, (LPBYTE)&_idleRefresh, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        IdleRefreshIntervalMs = _idleRefresh;
+    }
+
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"idleRefreshMaxPasses", NULL, NULL, (LPBYTE)&_idleRefresh, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        IdleRefreshMaxPasses = _idleRefresh;
+    }
+
+    // Query shared worker pool
+    DWORD _sharedWorkerPool;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"sharedWorkerPool", NULL, NULL, (LPBYTE)&_sharedWorkerPool, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        SharedWorkerPool = !!_sharedWorkerPool;
+    }
+
+    // Query cursor compositing
+    DWORD _cursorCompositing;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"cursorCompositing", NULL, NULL, (LPBYTE)&_cursorCompositing, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        CursorCompositing = !!_cursorCompositing;
+    }
+
+    // Query HDR tone mapping
+    DWORD _hdrToneMapping;
+    bufferSize = sizeof(DWORD);
+    lResult = RegQueryValueExW(hKey, L"hdrToneMapping", NULL, NULL, (LPBYTE)&_hdrToneMapping, &bufferSize);
+    if (lResult == ERROR_SUCCESS)
+    {
+        HdrToneMapping = _hdrToneMapping ? std::clamp<DWORD>(_hdrToneMapping, 80, 1000) : 0;
+    }
+
     // Query SDRBits
     DWORD _sdrBits;
     bufferSize = sizeof(DWORD);
@@ -340,6 +449,15 @@ void LoadSettings()
         }
     }
 
+    // Query mode list file
+    wchar_t _modeListFile[MAX_PATH] = {};
+    bufferSize = sizeof(_modeListFile) - sizeof(wchar_t);
+    lResult = RegQueryValueExW(hKey, L"modeListFile", NULL, NULL, (LPBYTE)_modeListFile, &bufferSize);
+    if (lResult == ERROR_SUCCESS && _modeListFile[0])
+    {
+        modeListStatus = LoadModeList(_modeListFile);
+    }
+
     // Close the registry key
     RegCloseKey(hKey);
 }
@@ -358,12 +476,27 @@ void DisconnectAllMonitors()
         auto* ctx = *it;
         // Remove the monitor
         freeConnectorSlots.push(ctx->connectorId);
+        ctx->ForgetModes();
         IddCxMonitorDeparture(ctx->GetMonitor());
     }
 
     monitorCtxList.clear();
 }
 
+// Caller must hold monitorListOp
+IndirectMonitorContext* FindMonitorByGuid(const GUID& MonitorGuid)
+{
+    for (auto* ctx : monitorCtxList)
+    {
+        if (ctx->monitorGuid == MonitorGuid)
+        {
+            return ctx;
+        }
+    }
+
+    return nullptr;
+}
+
 void RunWatchdog()
 {
     if (watchdogTimeout)
@@ -575,18 +708,13 @@ Direct3DDevice::Direct3DDevice()
     AdapterLuid = {};
 }
 
-HRESULT Direct3DDevice::Init()
+HRESULT Direct3DDevice::Init(IDXGIFactory5* pFactory)
 {
-    // The DXGI factory could be cached, but if a new render adapter appears on the system, a new factory needs to be
-    // created. If caching is desired, check DxgiFactory->IsCurrent() each time and recreate the factory if !IsCurrent.
-    HRESULT hr = CreateDXGIFactory2(0, IID_PPV_ARGS(&DxgiFactory));
-    if (FAILED(hr))
-    {
-        return hr;
-    }
+    // The factory is cached by D3D11DeviceFactory, which recreates it once a render adapter appears or goes away
+    DxgiFactory = pFactory;
 
     // Find the specified render adapter
-    hr = DxgiFactory->EnumAdapterByLuid(AdapterLuid, IID_PPV_ARGS(&Adapter));
+    HRESULT hr = DxgiFactory->EnumAdapterByLuid(AdapterLuid, IID_PPV_ARGS(&Adapter));
     if (FAILED(hr))
     {
         return hr;
@@ -601,1128 +729,4037 @@ HRESULT Direct3DDevice::Init()
         return hr;
     }
 
+    // Every monitor on the adapter shares the device, their swap-chain threads use the immediate context at once
+    ComPtr<ID3D11Multithread> Multithread;
+    hr = DeviceContext.As(&Multithread);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    Multithread->SetMultithreadProtected(TRUE);
+
     return S_OK;
 }
 
 #pragma endregion
 
-#pragma region SwapChainProcessor
+#pragma region D3D11DeviceFactory
 
-SwapChainProcessor::SwapChainProcessor(IDDCX_SWAPCHAIN hSwapChain, shared_ptr<Direct3DDevice> Device, HANDLE NewFrameEvent)
-    : m_hSwapChain(hSwapChain), m_Device(Device), m_hAvailableBufferEvent(NewFrameEvent)
+bool D3D11DeviceFactory::IsCurrent()
 {
-    m_hTerminateEvent.Attach(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    return !m_Factory || m_Factory->IsCurrent();
+}
 
-    // Immediately create and run the swap-chain processing thread, passing 'this' as the thread parameter
-    m_hThread.Attach(CreateThread(nullptr, 0, RunThread, this, 0, nullptr));
+void D3D11DeviceFactory::Refresh()
+{
+    m_Factory.Reset();
 }
 
-SwapChainProcessor::~SwapChainProcessor()
+shared_ptr<Direct3DDevice> D3D11DeviceFactory::Create(uint64_t AdapterKey)
 {
-    // Alert the swap-chain processing thread to terminate
-    SetEvent(m_hTerminateEvent.Get());
+    if (!m_Factory && FAILED(CreateDXGIFactory2(0, IID_PPV_ARGS(&m_Factory))))
+    {
+        return nullptr;
+    }
 
-    if (m_hThread.Get())
+    LUID AdapterLuid;
+    AdapterLuid.LowPart = (DWORD)AdapterKey;
+    AdapterLuid.HighPart = (LONG)(AdapterKey >> 32);
+
+    auto Device = make_shared<Direct3DDevice>(AdapterLuid);
+    if (FAILED(Device->Init(m_Factory.Get())))
     {
-        // Wait for the thread to terminate
-        WaitForSingleObject(m_hThread.Get(), INFINITE);
+        return nullptr;
     }
+
+    return Device;
 }
 
-DWORD CALLBACK SwapChainProcessor::RunThread(LPVOID Argument)
+bool D3D11DeviceFactory::IsUsable(Direct3DDevice& Device)
 {
-    reinterpret_cast<SwapChainProcessor*>(Argument)->Run();
-    return 0;
+    // Removed adapters and driver resets leave the device permanently failing
+    return Device.Device->GetDeviceRemovedReason() == S_OK;
 }
 
-void SwapChainProcessor::Run()
+#pragma endregion
+
+#pragma region D3D11StagingBackend
+
+HRESULT D3D11StagingBackend::Init(ID3D11Device* pDevice, ID3D11DeviceContext* pContext, UINT SlotCount)
 {
-    // For improved performance, make use of the Multimedia Class Scheduler Service, which will intelligently
-    // prioritize this thread for improved throughput in high CPU-load scenarios.
-    DWORD AvTask = 0;
-    HANDLE AvTaskHandle = AvSetMmThreadCharacteristicsW(L"DisplayPostProcessing", &AvTask);
+    m_Context = pContext;
+
+    D3D11_QUERY_DESC QueryDesc = {};
+    QueryDesc.Query = D3D11_QUERY_EVENT;
+
+    for (UINT i = 0; i < StagingRing::MaxSlots; i++)
+    {
+        m_Fences[i].Reset();
+        if (i < SlotCount)
+        {
+            HRESULT hr = pDevice->CreateQuery(&QueryDesc, &m_Fences[i]);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+    }
 
-    RunCore();
+    return S_OK;
+}
 
-    // Always delete the swap-chain object when swap-chain processing loop terminates in order to kick the system to
-    // provide a new swap-chain if necessary.
-    WdfObjectDelete((WDFOBJECT)m_hSwapChain);
-    m_hSwapChain = nullptr;
+void D3D11StagingBackend::SignalFence(uint32_t Slot)
+{
+    m_Context->End(m_Fences[Slot].Get());
 
-    AvRevertMmThreadCharacteristics(AvTaskHandle);
+    // Submit the copies now, polling with DONOTFLUSH would otherwise never see them complete
+    m_Context->Flush();
 }
 
-void SwapChainProcessor::RunCore()
+bool D3D11StagingBackend::IsFenceComplete(uint32_t Slot)
 {
-    // Get the DXGI device interface
-    ComPtr<IDXGIDevice> DxgiDevice;
-    HRESULT hr = m_Device->Device.As(&DxgiDevice);
-    if (FAILED(hr))
+    return m_Context->GetData(m_Fences[Slot].Get(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_FALSE;
+}
+
+void D3D11StagingBackend::WaitFence(uint32_t Slot)
+{
+    // A device removal makes GetData fail instead of returning S_FALSE, which ends the wait as well
+    while (m_Context->GetData(m_Fences[Slot].Get(), nullptr, 0, 0) == S_FALSE)
     {
-        return;
+        SwitchToThread();
     }
+}
 
-    IDARG_IN_SWAPCHAINSETDEVICE SetDevice = {};
-    SetDevice.pDevice = DxgiDevice.Get();
+#pragma endregion
 
-    hr = IddCxSwapChainSetDevice(m_hSwapChain, &SetDevice);
-    if (FAILED(hr))
+#pragma region Win32CaptureSink
+
+// Like the frame ring, but inherited by the files in it. Admins and interactive users may list and read.
+static const wchar_t* CAPTURE_DIRECTORY_SDDL = L"D:P(A;OICI;GA;;;SY)(A;OICI;GA;;;LS)(A;OICI;0x1200a9;;;BA)(A;OICI;0x1200a9;;;IU)";
+
+// Users may create folders in %ProgramData%, so a level of the capture directory that already exists is only used when
+// it is a real directory owned by the system, the driver's account or administrators. It gets the driver's DACL back
+// either way.
+static HRESULT EnsureCaptureDirectory(const std::wstring& Path, PSECURITY_DESCRIPTOR pSecurityDescriptor)
+{
+    SECURITY_ATTRIBUTES SecurityAttributes = {};
+    SecurityAttributes.nLength = sizeof(SecurityAttributes);
+    SecurityAttributes.lpSecurityDescriptor = pSecurityDescriptor;
+    if (!CreateDirectoryW(Path.c_str(), &SecurityAttributes) && GetLastError() != ERROR_ALREADY_EXISTS)
     {
-        return;
+        return HRESULT_FROM_WIN32(GetLastError());
     }
 
-    // Acquire and release buffers in a loop
-    for (;;)
+    Wrappers::FileHandle hDirectory(CreateFileW(Path.c_str(), READ_CONTROL | WRITE_DAC, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, nullptr));
+    BY_HANDLE_FILE_INFORMATION Info = {};
+    if (!hDirectory.IsValid() || !GetFileInformationByHandle(hDirectory.Get(), &Info))
     {
-        ComPtr<IDXGIResource> AcquiredBuffer;
-
-        IDXGIResource* pSurface;
-
-        if (IDD_IS_FUNCTION_AVAILABLE(IddCxSwapChainReleaseAndAcquireBuffer2))
-        {
-            IDARG_IN_RELEASEANDACQUIREBUFFER2 BufferInArgs = {};
-            BufferInArgs.Size = sizeof(BufferInArgs);
-            IDARG_OUT_RELEASEANDACQUIREBUFFER2 Buffer = {};
-            hr = IddCxSwapChainReleaseAndAcquireBuffer2(m_hSwapChain, &BufferInArgs, &Buffer);
-            pSurface = Buffer.MetaData.pSurface;
-        }
-        else
-        {
-            IDARG_OUT_RELEASEANDACQUIREBUFFER Buffer = {};
-            hr = IddCxSwapChainReleaseAndAcquireBuffer(m_hSwapChain, &Buffer);
-            pSurface = Buffer.MetaData.pSurface;
-        }
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-        // Ask for the next buffer from the producer
-        // IDARG_OUT_RELEASEANDACQUIREBUFFER Buffer = {};
-        // hr = IddCxSwapChainReleaseAndAcquireBuffer(m_hSwapChain, &Buffer);
+    if (!(Info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || (Info.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+    {
+        return E_ACCESSDENIED;
+    }
 
-        // AcquireBuffer immediately returns STATUS_PENDING if no buffer is yet available
-        if (hr == E_PENDING)
-        {
-            // We must wait for a new buffer
-            HANDLE WaitHandles[] =
-            {
-                m_hAvailableBufferEvent,
-                m_hTerminateEvent.Get()
-            };
-            DWORD WaitResult = WaitForMultipleObjects(ARRAYSIZE(WaitHandles), WaitHandles, FALSE, 16);
-            if (WaitResult == WAIT_OBJECT_0 || WaitResult == WAIT_TIMEOUT)
-            {
-                // We have a new buffer, so try the AcquireBuffer again
-                continue;
-            }
-            else if (WaitResult == WAIT_OBJECT_0 + 1)
-            {
-                // We need to terminate
-                break;
-            }
-            else
-            {
-                // The wait was cancelled or something unexpected happened
-                hr = HRESULT_FROM_WIN32(WaitResult);
-                break;
-            }
-        }
-        else if (SUCCEEDED(hr))
-        {
-            // We have new frame to process, the surface has a reference on it that the driver has to release
-            AcquiredBuffer.Attach(pSurface);
-
-            // ==============================
-            // TODO: Process the frame here
-            //
-            // This is the most performance-critical section of code in an IddCx driver. It's important that whatever
-            // is done with the acquired surface be finished as quickly as possible. This operation could be:
-            //  * a GPU copy to another buffer surface for later processing (such as a staging surface for mapping to CPU memory)
-            //  * a GPU encode operation
-            //  * a GPU VPBlt to another surface
-            //  * a GPU custom compute shader encode operation
-            // ==============================
-
-            // We have finished processing this frame hence we release the reference on it.
-            // If the driver forgets to release the reference to the surface, it will be leaked which results in the
-            // surfaces being left around after swapchain is destroyed.
-            // NOTE: Although in this sample we release reference to the surface here; the driver still
-            // owns the Buffer.MetaData.pSurface surface until IddCxSwapChainReleaseAndAcquireBuffer returns
-            // S_OK and gives us a new frame, a driver may want to use the surface in future to re-encode the desktop
-            // for better quality if there is no new frame for a while
-            AcquiredBuffer.Reset();
-
-            // Indicate to OS that we have finished inital processing of the frame, it is a hint that
-            // OS could start preparing another frame
-            hr = IddCxSwapChainFinishedProcessingFrame(m_hSwapChain);
-            if (FAILED(hr))
-            {
-                break;
-            }
+    PSID pOwner = nullptr;
+    PSECURITY_DESCRIPTOR pCurrent = nullptr;
+    DWORD Error = GetSecurityInfo(hDirectory.Get(), SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION, &pOwner, nullptr, nullptr, nullptr, &pCurrent);
+    if (Error != ERROR_SUCCESS)
+    {
+        return HRESULT_FROM_WIN32(Error);
+    }
 
-            // ==============================
-            // TODO: Report frame statistics once the asynchronous encode/send work is completed
-            //
-            // Drivers should report information about sub-frame timings, like encode time, send time, etc.
-            // ==============================
-            // IddCxSwapChainReportFrameStatistics(m_hSwapChain, ...);
-        }
-        else
-        {
-            // The swap-chain was likely abandoned (e.g. DXGI_ERROR_ACCESS_LOST), so exit the processing loop
-            break;
-        }
+    bool Trusted = IsWellKnownSid(pOwner, WinLocalSystemSid) || IsWellKnownSid(pOwner, WinLocalServiceSid) || IsWellKnownSid(pOwner, WinBuiltinAdministratorsSid);
+    LocalFree(pCurrent);
+    if (!Trusted)
+    {
+        return E_ACCESSDENIED;
     }
+
+    BOOL Present = FALSE;
+    BOOL Defaulted = FALSE;
+    PACL pDacl = nullptr;
+    GetSecurityDescriptorDacl(pSecurityDescriptor, &Present, &pDacl, &Defaulted);
+    Error = SetSecurityInfo(hDirectory.Get(), SE_FILE_OBJECT, DACL_SECURITY_INFORMATION | PROTECTED_DACL_SECURITY_INFORMATION, nullptr, nullptr, pDacl, nullptr);
+    return HRESULT_FROM_WIN32(Error);
 }
 
-#pragma endregion
+// Creates %ProgramData%\SUVDA_CAPTURE_DIRECTORY level by level
+static HRESULT OpenCaptureDirectory(std::wstring& Directory)
+{
+    wchar_t ProgramData[MAX_PATH];
+    DWORD Length = GetEnvironmentVariableW(L"ProgramData", ProgramData, ARRAYSIZE(ProgramData));
+    if (!Length || Length >= ARRAYSIZE(ProgramData))
+    {
+        return HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND);
+    }
 
-#pragma region IndirectDeviceContext
+    PSECURITY_DESCRIPTOR pSecurityDescriptor = nullptr;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(CAPTURE_DIRECTORY_SDDL, SDDL_REVISION_1, &pSecurityDescriptor, nullptr))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-IndirectDeviceContext::IndirectDeviceContext(_In_ WDFDEVICE WdfDevice) :
-    m_WdfDevice(WdfDevice)
-{
-    m_Adapter = {};
-    for (size_t i = 0; i < MaxVirtualMonitorCount; i++)
+    const std::wstring Relative = L"" SUVDA_CAPTURE_DIRECTORY;
+    Directory = ProgramData;
+    HRESULT hr = S_OK;
+    for (size_t Start = 0; SUCCEEDED(hr) && Start < Relative.size();)
     {
-        freeConnectorSlots.push(i);
+        size_t End = Relative.find(L'\\', Start);
+        End = End == std::wstring::npos ? Relative.size() : End;
+        Directory += L'\\';
+        Directory.append(Relative, Start, End - Start);
+        hr = EnsureCaptureDirectory(Directory, pSecurityDescriptor);
+        Start = End + 1;
     }
-}
 
-IndirectDeviceContext::~IndirectDeviceContext()
-{
+    LocalFree(pSecurityDescriptor);
+    return hr;
 }
 
-void IndirectDeviceContext::InitAdapter()
+HRESULT Win32CaptureSink::Open(const wchar_t* pName, bool Unbuffered)
 {
-    // ==============================
-    // TODO: Update the below diagnostic information in accordance with the target hardware. The strings and version
-    // numbers are used for telemetry and may be displayed to the user in some situations.
-    //
-    // This is also where static per-adapter capabilities are determined.
-    // ==============================
+    if (!IsCaptureFileName(pName))
+    {
+        return E_INVALIDARG;
+    }
 
-    IDDCX_ADAPTER_CAPS AdapterCaps = {};
-    AdapterCaps.Size = sizeof(AdapterCaps);
+    std::wstring Path;
+    HRESULT hr = OpenCaptureDirectory(Path);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    Path += L'\\';
+    Path += pName;
 
-    if (IDD_IS_FUNCTION_AVAILABLE(IddCxSwapChainReleaseAndAcquireBuffer2))
+    // Captured frames are never read back by the driver, caching them would only evict other files. Raw blocks are
+    // SUVDA_CAPTURE_DATA_ALIGNMENT (4 KiB) aligned, which covers the logical sector size of any disk Windows boots from.
+    DWORD Flags = Unbuffered ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_ATTRIBUTE_NORMAL;
+
+    m_hFile.Attach(CreateFileW(Path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, Flags, nullptr));
+    if (!m_hFile.IsValid())
     {
-        AdapterCaps.Flags = IDDCX_ADAPTER_FLAGS_CAN_PROCESS_FP16;
+        return HRESULT_FROM_WIN32(GetLastError());
     }
 
-    // Declare basic feature support for the adapter (required)
-    AdapterCaps.MaxMonitorsSupported = MaxVirtualMonitorCount;
-    AdapterCaps.EndPointDiagnostics.Size = sizeof(AdapterCaps.EndPointDiagnostics);
-    AdapterCaps.EndPointDiagnostics.GammaSupport = IDDCX_FEATURE_IMPLEMENTATION_NONE;
-    AdapterCaps.EndPointDiagnostics.TransmissionType = IDDCX_TRANSMISSION_TYPE_WIRED_OTHER;
+    // Device names like NUL resolve in any directory
+    if (GetFileType(m_hFile.Get()) != FILE_TYPE_DISK)
+    {
+        m_hFile.Close();
+        return E_ACCESSDENIED;
+    }
 
-    // Declare your device strings for telemetry (required)
-    AdapterCaps.EndPointDiagnostics.pEndPointFriendlyName = L"SudoMaker Virtual Display Adapter";
-    AdapterCaps.EndPointDiagnostics.pEndPointManufacturerName = L"SudoMaker";
-    AdapterCaps.EndPointDiagnostics.pEndPointModelName = L"SudoVDA";
+    return S_OK;
+}
 
-    // Declare your hardware and firmware versions (required)
-    IDDCX_ENDPOINT_VERSION Version = {};
-    Version.Size = sizeof(Version);
-    Version.MajorVer = 1;
-    AdapterCaps.EndPointDiagnostics.pFirmwareVersion = &Version;
-    AdapterCaps.EndPointDiagnostics.pHardwareVersion = &Version;
+bool Win32CaptureSink::Write(const void* pData, size_t Bytes)
+{
+    // The writer never hands out more than FrameCaptureWriter::MaxWriteBytes at once
+    DWORD Written = 0;
+    return WriteFile(m_hFile.Get(), pData, (DWORD)Bytes, &Written, nullptr) && Written == Bytes;
+}
 
-    // Initialize a WDF context that can store a pointer to the device context object
-    WDF_OBJECT_ATTRIBUTES Attr;
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attr, IndirectDeviceContextWrapper);
+#pragma endregion
 
-    IDARG_IN_ADAPTER_INIT AdapterInit = {};
-    AdapterInit.WdfDevice = m_WdfDevice;
-    AdapterInit.pCaps = &AdapterCaps;
-    AdapterInit.ObjectAttributes = &Attr;
+#pragma region SharedFrameRing
 
-    // Start the initialization of the adapter, which will trigger the AdapterFinishInit callback later
-    IDARG_OUT_ADAPTER_INIT AdapterInitOut;
-    NTSTATUS Status = IddCxAdapterInitAsync(&AdapterInit, &AdapterInitOut);
+// SYSTEM and LocalService (the UMDF host) get full access, admins and interactive users may map and wait read-only
+static const wchar_t* FRAME_EXPORT_SDDL = L"D:P(A;;GA;;;SY)(A;;GA;;;LS)(A;;0x120005;;;BA)(A;;0x120005;;;IU)";
 
-    if (NT_SUCCESS(Status))
-    {
-        // Store a reference to the WDF adapter handle
-        m_Adapter = AdapterInitOut.AdapterObject;
+SharedFrameRing::SharedFrameRing(const GUID& MonitorGuid, const wchar_t* pName, UINT SlotCount) :
+    m_Name(pName),
+    m_SlotCount(SlotCount)
+{
+    wchar_t guidString[40] = {};
+    StringFromGUID2(MonitorGuid, guidString, ARRAYSIZE(guidString));
+    m_GuidString = guidString;
+}
 
-        // Store the device context object into the WDF object context
-        auto* pContext = WdfObjectGet_IndirectDeviceContextWrapper(AdapterInitOut.AdapterObject);
-        pContext->pContext = this;
-    }
+SharedFrameRing::~SharedFrameRing()
+{
+    Close();
 }
 
-void IndirectDeviceContext::SetRenderAdapter(const LUID& AdapterLuid)
+void SharedFrameRing::Close()
 {
-    IDARG_IN_ADAPTERSETRENDERADAPTER inArgs{AdapterLuid};
-    IddCxAdapterSetRenderAdapter(m_Adapter, &inArgs);
+    std::lock_guard<std::mutex> lg(m_Lock);
+
+    // Consumers keep their own references to the section, so they can still finish reading after we let go
+    m_Ring.Abandon();
+    m_Ring = FrameRingWriter();
+
+    if (m_pView)
+    {
+        UnmapViewOfFile(m_pView);
+        m_pView = nullptr;
+    }
+
+    m_hMapping.Close();
+    m_MappingSize = 0;
 }
 
-NTSTATUS IndirectDeviceContext::CreateMonitor(IndirectMonitorContext*& pMonitorContext, uint8_t* edidData, const GUID& containerId, const VirtualMonitorMode& preferredMode)
+HRESULT SharedFrameRing::Ensure(UINT64 SlotDataSize)
 {
-    // ==============================
-    // TODO: In a real driver, the EDID should be retrieved dynamically from a connected physical monitor. The EDIDs
-    // provided here are purely for demonstration.
-    // Monitor manufacturers are required to correctly fill in physical monitor attributes in order to allow the OS
-    // to optimize settings like viewing distance and scale factor. Manufacturers should also use a unique serial
-    // number every single device to ensure the OS can tell the monitors apart.
-    // ==============================
+    if (m_Ring.IsInitialized() && m_Ring.SlotDataSize() >= SlotDataSize)
+    {
+        return S_OK;
+    }
 
-    WDF_OBJECT_ATTRIBUTES Attr;
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attr, IndirectMonitorContextWrapper);
+    Close();
 
-    // In the sample driver, we report a monitor right away but a real driver would do this when a monitor connection event occurs
-    IDDCX_MONITOR_INFO MonitorInfo = {};
-    MonitorInfo.Size = sizeof(MonitorInfo);
-    MonitorInfo.MonitorType = DISPLAYCONFIG_OUTPUT_TECHNOLOGY_HDMI;
-    MonitorInfo.ConnectorIndex = (UINT)freeConnectorSlots.front();
+    std::lock_guard<std::mutex> lg(m_Lock);
 
-    MonitorInfo.MonitorDescription.Size = sizeof(MonitorInfo.MonitorDescription);
-    MonitorInfo.MonitorDescription.Type = IDDCX_MONITOR_DESCRIPTION_TYPE_EDID;
-    MonitorInfo.MonitorDescription.DataSize = sizeof(edid_base);
-    MonitorInfo.MonitorDescription.pData = edidData;
-    MonitorInfo.MonitorContainerId = containerId;
+    PSECURITY_DESCRIPTOR pSecurityDescriptor = nullptr;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(FRAME_EXPORT_SDDL, SDDL_REVISION_1, &pSecurityDescriptor, nullptr))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-    IDARG_IN_MONITORCREATE MonitorCreate = {};
-    MonitorCreate.ObjectAttributes = &Attr;
-    MonitorCreate.pMonitorInfo = &MonitorInfo;
+    SECURITY_ATTRIBUTES SecurityAttributes = {};
+    SecurityAttributes.nLength = sizeof(SecurityAttributes);
+    SecurityAttributes.lpSecurityDescriptor = pSecurityDescriptor;
 
-    // Create a monitor object with the specified monitor descriptor
-    IDARG_OUT_MONITORCREATE MonitorCreateOut;
-    NTSTATUS Status = IddCxMonitorCreate(m_Adapter, &MonitorCreate, &MonitorCreateOut);
-    if (NT_SUCCESS(Status))
+    HRESULT hr = S_OK;
+
+    if (!m_hFrameEvent.IsValid())
     {
-        freeConnectorSlots.pop();
-        // Create a new monitor context object and attach it to the Idd monitor object
-        auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorCreateOut.MonitorObject);
-        pMonitorContext = new IndirectMonitorContext(MonitorCreateOut.MonitorObject);
-        pMonitorContextWrapper->pContext = pMonitorContext;
+        m_EventName = L"Global\\SudoVDA." + m_Name + L"Event." + m_GuidString;
+        m_hFrameEvent.Attach(CreateEventW(&SecurityAttributes, FALSE, FALSE, m_EventName.c_str()));
+    }
 
-        pMonitorContext->monitorGuid = containerId;
-        pMonitorContext->connectorId = MonitorInfo.ConnectorIndex;
-        pMonitorContext->pEdidData = edidData;
-        pMonitorContext->preferredMode = preferredMode;
-        pMonitorContext->m_Adapter = m_Adapter;
+    // Every resize gets a new generation so consumers still holding the previous section never see it change size
+    m_Generation++;
+    m_MappingName = L"Global\\SudoVDA." + m_Name + L"." + m_GuidString + L"." + std::to_wstring(m_Generation);
+    UINT64 mappingSize = FrameRingRequiredSize(m_SlotCount, SlotDataSize);
 
-        // Tell the OS that the monitor has been plugged in
-        IDARG_OUT_MONITORARRIVAL ArrivalOut;
-        Status = IddCxMonitorArrival(MonitorCreateOut.MonitorObject, &ArrivalOut);
-        if (NT_SUCCESS(Status))
-        {
-            pMonitorContext->adapterLuid = ArrivalOut.OsAdapterLuid;
-            pMonitorContext->targetId = ArrivalOut.OsTargetId;
-        }
+    m_hMapping.Attach(CreateFileMappingW(INVALID_HANDLE_VALUE, &SecurityAttributes, PAGE_READWRITE, (DWORD)(mappingSize >> 32), (DWORD)mappingSize, m_MappingName.c_str()));
+    if (!m_hMapping.IsValid())
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
     }
     else
     {
-        // Avoid memory leak
-        free(edidData);
+        m_pView = MapViewOfFile(m_hMapping.Get(), FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (!m_pView || !m_Ring.Initialize(m_pView, mappingSize, m_SlotCount, SlotDataSize))
+        {
+            hr = m_pView ? E_FAIL : HRESULT_FROM_WIN32(GetLastError());
+        }
+        else
+        {
+            m_MappingSize = mappingSize;
+        }
     }
 
-    return Status;
-}
-
-IndirectMonitorContext::IndirectMonitorContext(_In_ IDDCX_MONITOR Monitor) :
-    m_Monitor(Monitor)
-{
-    // Store context for later use
-    monitorCtxList.emplace_back(this);
-}
+    LocalFree(pSecurityDescriptor);
 
-IndirectMonitorContext::~IndirectMonitorContext()
-{
-    m_ProcessingThread.reset();
-    if (pEdidData && pEdidData != edid_base)
-    {
-        free(pEdidData);
-    }
+    return hr;
 }
 
-IDDCX_MONITOR IndirectMonitorContext::GetMonitor() const
+void SharedFrameRing::PublishFrame()
 {
-    return m_Monitor;
+    m_Ring.PublishFrame();
+    SetEvent(m_hFrameEvent.Get());
 }
 
-void IndirectMonitorContext::AssignSwapChain(const IDDCX_MONITOR& MonitorObject, const IDDCX_SWAPCHAIN& SwapChain, const LUID& RenderAdapter, const HANDLE& NewFrameEvent)
+HRESULT SharedFrameRing::GetInfo(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info)
 {
-    m_ProcessingThread.reset();
+    std::lock_guard<std::mutex> lg(m_Lock);
 
-    auto Device = make_shared<Direct3DDevice>(RenderAdapter);
-    if (FAILED(Device->Init()))
+    if (!m_Ring.IsInitialized())
     {
-        // It's important to delete the swap-chain if D3D initialization fails, so that the OS knows to generate a new
-        // swap-chain and try again.
-        WdfObjectDelete(SwapChain);
+        // Nothing has been rendered to this monitor yet
+        return E_PENDING;
     }
-    else
-    {
-        // Create a new swap-chain processing thread
-        m_ProcessingThread.reset(new SwapChainProcessor(SwapChain, Device, NewFrameEvent));
 
-        //create an event to get notified new cursor data
-        HANDLE mouseEvent = CreateEventA(
-            nullptr, //TODO set proper SECURITY_ATTRIBUTES
-            false,
-            false,
-            "arbitraryMouseEventName"
-        );
+    Info = {};
+    wcsncpy_s(Info.MappingName, m_MappingName.c_str(), _TRUNCATE);
+    wcsncpy_s(Info.EventName, m_EventName.c_str(), _TRUNCATE);
+    Info.MappingSize = m_MappingSize;
+    Info.Generation = m_Generation;
 
-        if (!mouseEvent)
-        {
-            //do error handling
-            return;
-        }
+    return S_OK;
+}
 
-        //set up cursor capabilities
-        IDDCX_CURSOR_CAPS cursorInfo = {};
-        cursorInfo.Size = sizeof(cursorInfo);
-        cursorInfo.ColorXorCursorSupport = IDDCX_XOR_CURSOR_SUPPORT_FULL; //TODO play around with XOR cursors
-        cursorInfo.AlphaCursorSupport = true;
-        cursorInfo.MaxX = 64; //TODO figure out correct maximum value
-        cursorInfo.MaxY = 64; //TODO figure out correct maximum value
+#pragma endregion
 
-        //prepare IddCxMonitorSetupHardwareCursor arguments
-        IDARG_IN_SETUP_HWCURSOR hwCursor = {};
-        hwCursor.CursorInfo = cursorInfo;
-        hwCursor.hNewCursorDataAvailable = mouseEvent; //this event will be called when new cursor data is available
+#pragma region FrameExporter
 
-        NTSTATUS Status = IddCxMonitorSetupHardwareCursor(
-            MonitorObject, //handle to the monitor we want to enable hardware mouse on
-            &hwCursor
-        );
+// Beyond this many rectangles individual copies cost more than copying the whole frame
+static const size_t FRAME_EXPORT_MAX_GPU_RECTS = 64;
+static const size_t FRAME_EXPORT_MAX_CPU_RECTS = 256;
 
-        if (FAILED(Status))
-        {
-            //do error handling
-        }
+static SUVDA_FRAME_FORMAT ToFrameFormat(DXGI_FORMAT Format)
+{
+    switch (Format)
+    {
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+        return SUVDA_FRAME_FORMAT_BGRA8;
+    case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        return SUVDA_FRAME_FORMAT_RGBA16F;
+    case DXGI_FORMAT_R10G10B10A2_UNORM:
+        return SUVDA_FRAME_FORMAT_RGB10A2;
+    default:
+        return SUVDA_FRAME_FORMAT_UNKNOWN;
     }
 }
 
-void IndirectMonitorContext::UnassignSwapChain()
+FrameExporter::FrameExporter(const GUID& MonitorGuid, UINT SlotCount, bool DetectDuplicates, UINT PreviewScale, UINT PreviewFps, bool CompositeCursor, UINT ToneMapWhiteNits, WorkerPool* pPool) :
+    m_SlotCount(SlotCount),
+    m_Ring(MonitorGuid, L"Frame", SlotCount),
+    m_DetectDuplicates(DetectDuplicates),
+    m_pPool(pPool),
+    m_CompositeCursor(CompositeCursor)
 {
-    // Stop processing the last swap-chain
-    m_ProcessingThread.reset();
-}
-
-#pragma endregion
+    m_CursorBackup.reserve(SUVDA_CURSOR_MAX_SIZE * SUVDA_CURSOR_MAX_SIZE * 4);
 
-#pragma region DDI Callbacks
-
-void IndirectDeviceContext::_TestCreateMonitor()
-{
-    auto connectorIndex = freeConnectorSlots.front();
-    std::string idx = std::to_string(connectorIndex);
-    std::string serialStr = "VDD2408";
-    serialStr += idx;
-    std::string dispName = "SudoVDD #";
-    dispName += idx;
-    GUID containerId;
-    CoCreateGuid(&containerId);
-    uint8_t* edidData = generate_edid(containerId.Data1, serialStr.c_str(), dispName.c_str());
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    m_QpcFrequency = Frequency.QuadPart;
 
-    VirtualMonitorMode mode{3000 + (DWORD)connectorIndex * 2, 2120 + (DWORD)connectorIndex, 120 + (DWORD)connectorIndex};
+    if (PreviewScale)
+    {
+        m_Preview.reset(new FramePreview(MonitorGuid, PreviewScale, PreviewFps, m_QpcFrequency, pPool));
+    }
 
-    IndirectMonitorContext* pContext;
-    CreateMonitor(pContext, edidData, containerId, mode);
+    // The peak follows the monitor's HDR metadata once the swap-chain passes it on
+    if (ToneMapWhiteNits)
+    {
+        m_ToneMapper.reset(new ToneMapper(ToneMapDefaultPeakNits, (float)ToneMapWhiteNits));
+    }
 }
 
-_Use_decl_annotations_
+FrameExporter::~FrameExporter()
+{
+    m_Preview.reset();
+    m_Ring.Close();
+}
 
-NTSTATUS SudoVDAAdapterInitFinished(IDDCX_ADAPTER AdapterObject, const IDARG_IN_ADAPTER_INIT_FINISHED* pInArgs)
+HRESULT FrameExporter::EnsureStaging(Direct3DDevice& Device, const D3D11_TEXTURE2D_DESC& Desc)
 {
-    // UNREFERENCED_PARAMETER(AdapterObject);
-    // UNREFERENCED_PARAMETER(pInArgs);
+    if (m_Staging[0] && m_StagingDevice.Get() == Device.Device.Get() &&
+        m_StagingDesc.Width == Desc.Width && m_StagingDesc.Height == Desc.Height && m_StagingDesc.Format == Desc.Format)
+    {
+        return S_OK;
+    }
 
-    if (NT_SUCCESS(pInArgs->AdapterInitStatus))
+    // Frames still in flight belong to the old textures and are dropped
+    m_StagingRing.Reset();
+    for (auto& Staging : m_Staging)
     {
-        if (preferredAdapterChanged)
-        {
-            IDARG_IN_ADAPTERSETRENDERADAPTER inArgs{preferredAdapterLuid};
-            IddCxAdapterSetRenderAdapter(AdapterObject, &inArgs);
-            preferredAdapterChanged = false;
-        }
+        Staging.Reset();
+    }
+    m_StagingDevice = Device.Device;
+    m_StagingContext = Device.DeviceContext;
+    m_DamageGeneration = 0;
+
+    D3D11_TEXTURE2D_DESC StagingDesc = {};
+    StagingDesc.Width = Desc.Width;
+    StagingDesc.Height = Desc.Height;
+    StagingDesc.MipLevels = 1;
+    StagingDesc.ArraySize = 1;
+    StagingDesc.Format = Desc.Format;
+    StagingDesc.SampleDesc.Count = 1;
+    StagingDesc.Usage = D3D11_USAGE_STAGING;
+    StagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+    HRESULT hr = m_StagingBackend.Init(Device.Device.Get(), Device.DeviceContext.Get(), StagingDepth);
+    for (UINT i = 0; i < StagingDepth && SUCCEEDED(hr); i++)
+    {
+        hr = Device.Device->CreateTexture2D(&StagingDesc, nullptr, &m_Staging[i]);
     }
 
-    if (testMode)
+    if (FAILED(hr))
     {
-        auto* pDeviceContextWrapper = WdfObjectGet_IndirectDeviceContextWrapper(AdapterObject);
-        if (NT_SUCCESS(pInArgs->AdapterInitStatus))
-        {
-            for (size_t i = 0; i < 3; i++)
-            {
-                pDeviceContextWrapper->pContext->_TestCreateMonitor();
-            }
-        }
+        m_Staging[0].Reset();
+        return hr;
     }
 
-    // return STATUS_SUCCESS;
-    return pInArgs->AdapterInitStatus;
+    m_StagingDesc = StagingDesc;
+    return S_OK;
 }
 
-_Use_decl_annotations_
+SUVDA_FRAME_FORMAT FrameExporter::ExportedFormat(SUVDA_FRAME_FORMAT Format) const
+{
+    return m_ToneMapper && ToneMapper::IsSupportedFormat(Format) ? SUVDA_FRAME_FORMAT_BGRA8 : Format;
+}
 
-NTSTATUS SudoVDAAdapterCommitModes(IDDCX_ADAPTER AdapterObject, const IDARG_IN_COMMITMODES* pInArgs)
+void FrameExporter::ResetDamage(UINT Width, UINT Height)
 {
-    UNREFERENCED_PARAMETER(AdapterObject);
-    UNREFERENCED_PARAMETER(pInArgs);
+    m_FrameDamage.Resize(Width, Height);
+    m_SkippedDamage.Resize(Width, Height);
+    m_SkippedDamage.Clear();
+    m_StagingDamage.resize(StagingDepth);
+    m_SlotDamage.resize(m_SlotCount);
+
+    // Every staging texture and slot holds a stale image, so the next write to each must be a full one
+    for (auto& StagingDamage : m_StagingDamage)
+    {
+        StagingDamage.Resize(Width, Height);
+        StagingDamage.MarkAll();
+    }
+
+    for (auto& SlotDamage : m_SlotDamage)
+    {
+        SlotDamage.Resize(Width, Height);
+        SlotDamage.MarkAll();
+    }
 
-    // For the sample, do nothing when modes are picked - the swap-chain is taken care of by IddCx
+    m_TileHashes.assign((size_t)m_FrameDamage.TilesX() * m_FrameDamage.TilesY(), 0);
+    m_TileHashesValid = false;
 
-    // ==============================
-    // TODO: In a real driver, this function would be used to reconfigure the device to commit the new modes. Loop
-    // through pInArgs->pPaths and look for IDDCX_PATH_FLAGS_ACTIVE. Any path not active is inactive (e.g. the monitor
-    // should be turned off).
-    // ==============================
+    // The slots are rewritten in full, without any cursor to restore
+    m_CursorRects.assign(m_SlotCount, SUVDA_FRAME_RECT{});
+    m_CursorDamage.Resize(Width, Height);
 
-    return STATUS_SUCCESS;
+    m_DamageGeneration = m_Ring.Generation();
 }
 
-_Use_decl_annotations_
-
-NTSTATUS SudoVDAAdapterCommitModes2(
-    IDDCX_ADAPTER AdapterObject,
-    const IDARG_IN_COMMITMODES2* pInArgs
-)
+HRESULT FrameExporter::ExportFrame(Direct3DDevice& Device, ID3D11Texture2D* pSurface, const FrameTimestamps& Times, const std::vector<RECT>& Damage, bool FullDamage)
 {
-    UNREFERENCED_PARAMETER(AdapterObject);
-    UNREFERENCED_PARAMETER(pInArgs);
+    m_LastExportedSlot = -1;
 
-    return STATUS_SUCCESS;
-}
+    D3D11_TEXTURE2D_DESC Desc;
+    pSurface->GetDesc(&Desc);
 
-_Use_decl_annotations_
+    auto Format = ToFrameFormat(Desc.Format);
+    if (Format == SUVDA_FRAME_FORMAT_UNKNOWN)
+    {
+        return E_NOTIMPL;
+    }
 
-NTSTATUS SudoVDAParseMonitorDescription(const IDARG_IN_PARSEMONITORDESCRIPTION* pInArgs, IDARG_OUT_PARSEMONITORDESCRIPTION* pOutArgs)
-{
-    // ==============================
-    // TODO: In a real driver, this function would be called to generate monitor modes for an EDID by parsing it. In
-    // this sample driver, we hard-code the EDID, so this function can generate known modes.
-    // ==============================
+    // Geometry changes recreate staging, which drops the frames still in flight for the old ring
+    HRESULT hr = EnsureStaging(Device, Desc);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
 
-    if (pInArgs->MonitorDescription.DataSize != sizeof(edid_base))
-        return STATUS_INVALID_PARAMETER;
+    hr = m_Ring.Ensure((UINT64)Desc.Width * FrameFormatBytesPerPixel(ExportedFormat(Format)) * Desc.Height);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
 
-    pOutArgs->MonitorModeBufferOutputCount = std::size(s_DefaultModes);
+    if (m_DamageGeneration != m_Ring.Generation() || m_FrameDamage.Width() != Desc.Width || m_FrameDamage.Height() != Desc.Height)
+    {
+        ResetDamage(Desc.Width, Desc.Height);
+        FullDamage = true;
+    }
 
-    VirtualMonitorMode* pPreferredMode = nullptr;
+    // Publish whatever finished copying since the last frame
+    DrainStaging(false);
 
-    for (auto& it : monitorCtxList)
+    int32_t StagingSlot = m_StagingRing.BeginCopy();
+    if (StagingSlot < 0)
     {
-        if (memcmp(pInArgs->MonitorDescription.pData, it->pEdidData, sizeof(edid_base)) == 0)
+        // Every staging texture is in flight, the oldest frame has to be read back before its texture is reused
+        DrainStaging(true);
+        StagingSlot = m_StagingRing.BeginCopy();
+        if (StagingSlot < 0)
         {
-            if (it->preferredMode.Width)
-            {
-                // We're adding 10 different modes, 1 original and 4 scaled x doubled refresh rate
-                pOutArgs->MonitorModeBufferOutputCount += std::size(mode_scale_factors) * 2;
-                pPreferredMode = &it->preferredMode;
-            }
-            break;
+            return E_UNEXPECTED;
         }
     }
 
-    if (pInArgs->MonitorModeBufferInputCount < pOutArgs->MonitorModeBufferOutputCount)
+    m_FrameDamage.Clear();
+    if (FullDamage)
     {
-        // Return success if there was no buffer, since the caller was only asking for a count of modes
-        return (pInArgs->MonitorModeBufferInputCount > 0) ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+        m_FrameDamage.MarkAll();
     }
     else
     {
-        float vsyncMultiplier = 1;
-
-        if (pPreferredMode && pPreferredMode->VSync)
+        for (auto& Rect : Damage)
         {
-            float fVSync = (float)pPreferredMode->VSync / 1000;
-            vsyncMultiplier = fVSync / round(fVSync);
-            if (vsyncMultiplier > 1)
-            {
-                vsyncMultiplier = 1;
-            }
+            m_FrameDamage.AddRect(Rect.left, Rect.top, Rect.right, Rect.bottom);
         }
+    }
 
-        for (DWORD ModeIndex = 0; ModeIndex < std::size(s_DefaultModes); ModeIndex++)
-        {
-            auto vsyncTarget = s_DefaultModes[ModeIndex].VSync;
-            if (vsyncMultiplier != 1 && !(vsyncTarget % 1000))
-            {
-                vsyncTarget = (DWORD)(vsyncTarget * vsyncMultiplier);
-            }
-            pInArgs->pMonitorModes[ModeIndex] = CreateIddCxMonitorMode(
-                s_DefaultModes[ModeIndex].Width,
-                s_DefaultModes[ModeIndex].Height,
-                vsyncTarget,
-                IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR
-            );
-        }
+    // Frames the decimation skipped changed the surface too
+    m_FrameDamage.Merge(m_SkippedDamage);
+    m_SkippedDamage.Clear();
+
+    for (auto& StagingDamage : m_StagingDamage)
+    {
+        StagingDamage.Merge(m_FrameDamage);
+    }
 
-        if (pPreferredMode && pPreferredMode->Width)
+    // Bring the staging texture up to date with the surface
+    auto& StagingDamage = m_StagingDamage[StagingSlot];
+    auto* pStaging = m_Staging[StagingSlot].Get();
+    if (StagingDamage.BuildPlan(m_Plan, FRAME_EXPORT_MAX_GPU_RECTS))
+    {
+        for (auto& Rect : m_Plan)
         {
-            auto width = pPreferredMode->Width;
-            auto height = pPreferredMode->Height;
-            auto vsync = pPreferredMode->VSync;
+            D3D11_BOX Box = { (UINT)Rect.Left, (UINT)Rect.Top, 0, (UINT)Rect.Right, (UINT)Rect.Bottom, 1 };
+            Device.DeviceContext->CopySubresourceRegion(pStaging, 0, Box.left, Box.top, 0, pSurface, 0, &Box);
+        }
+    }
+    else
+    {
+        Device.DeviceContext->CopySubresourceRegion(pStaging, 0, 0, 0, 0, pSurface, 0, nullptr);
+    }
+    StagingDamage.Clear();
 
-            for (uint8_t idx = 0; idx < std::size(mode_scale_factors); idx++)
-            {
-                auto scalc_factor = mode_scale_factors[idx];
-                auto _width = width * scalc_factor / 100;
-                auto _height = height * scalc_factor / 100;
+    auto& Pending = m_PendingFrames[StagingSlot];
+    Pending.Times = Times;
+    Pending.FullDamage = FullDamage;
+    Pending.Damage = m_FrameDamage;
 
-                pInArgs->pMonitorModes[std::size(s_DefaultModes) + idx * 2] = CreateIddCxMonitorMode(
-                    _width,
-                    _height,
-                    vsync,
-                    IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR
-                );
+    m_StagingRing.EndCopy(StagingSlot);
+    m_LastExportedSlot = StagingSlot;
 
-                pInArgs->pMonitorModes[std::size(s_DefaultModes) + idx * 2 + 1] = CreateIddCxMonitorMode(
-                    _width,
-                    _height,
-                    vsync * 2,
-                    IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR
-                );
-            }
+    return S_OK;
+}
 
-            pOutArgs->PreferredMonitorModeIdx = std::size(s_DefaultModes);
-        }
-        else
-        {
-            pOutArgs->PreferredMonitorModeIdx = 1;
-        }
+void FrameExporter::SkipFrame(const std::vector<RECT>& Damage, bool FullDamage)
+{
+    // Before the first export every tile is due anyway
+    if (!m_SkippedDamage.Width())
+    {
+        return;
+    }
 
-        return STATUS_SUCCESS;
+    if (FullDamage)
+    {
+        m_SkippedDamage.MarkAll();
+        return;
+    }
+
+    for (auto& Rect : Damage)
+    {
+        m_SkippedDamage.AddRect(Rect.left, Rect.top, Rect.right, Rect.bottom);
     }
 }
 
-_Use_decl_annotations_
+void FrameExporter::CompleteFrame(UINT64 ProcessQpc, UINT64 FinishQpc)
+{
+    if (m_LastExportedSlot >= 0)
+    {
+        auto& Times = m_PendingFrames[m_LastExportedSlot].Times;
+        Times.ProcessQpc = ProcessQpc;
+        Times.FinishQpc = FinishQpc;
+        m_LastExportedSlot = -1;
+    }
+}
 
-NTSTATUS SudoVDAParseMonitorDescription2(
-    const IDARG_IN_PARSEMONITORDESCRIPTION2* pInArgs,
-    IDARG_OUT_PARSEMONITORDESCRIPTION* pOutArgs
-)
+void FrameExporter::Flush()
 {
-    if (pInArgs->MonitorDescription.DataSize != sizeof(edid_base))
-        return STATUS_INVALID_PARAMETER;
+    DrainStaging(false);
+}
+
+DWORD FrameExporter::PollPreview(UINT64 Qpc)
+{
+    if (!m_Preview)
+    {
+        return INFINITE;
+    }
+
+    // Anything held back is part of the last frame in the ring by now, unless it is still in staging
+    const SUVDA_FRAME_SLOT* pLast = m_Ring.IsInitialized() ? m_Ring.LastPublished() : nullptr;
+    return m_Preview->Poll(pLast, pLast ? m_Ring.SlotData(pLast) : nullptr, Qpc);
+}
+
+UINT FrameExporter::PendingFrames() const
+{
+    return m_StagingRing.InFlight();
+}
+
+UINT64 FrameExporter::FramesUnchanged() const
+{
+    return m_FramesUnchanged.load(std::memory_order_relaxed);
+}
+
+HRESULT FrameExporter::StartCapture(std::unique_ptr<FrameCaptureWriter> Writer)
+{
+    std::lock_guard<std::mutex> lg(m_CaptureLock);
+
+    if (m_Capture)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BUSY);
+    }
+
+    m_Capture = std::move(Writer);
+    return S_OK;
+}
+
+bool FrameExporter::IsCapturing()
+{
+    std::lock_guard<std::mutex> lg(m_CaptureLock);
+    return m_Capture != nullptr;
+}
+
+std::unique_ptr<FrameCaptureWriter> FrameExporter::TakeCapture()
+{
+    std::lock_guard<std::mutex> lg(m_CaptureLock);
+    return std::move(m_Capture);
+}
+
+void FrameExporter::CaptureFrame(const SUVDA_FRAME_SLOT& Slot, const uint8_t* pData)
+{
+    std::lock_guard<std::mutex> lg(m_CaptureLock);
+
+    if (m_Capture)
+    {
+        m_Capture->Submit(Slot, pData);
+    }
+}
+
+HRESULT FrameExporter::StartTrace(std::unique_ptr<FrameTraceWriter> Writer)
+{
+    std::lock_guard<std::mutex> lg(m_TraceLock);
+
+    if (m_Trace)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BUSY);
+    }
+
+    m_Trace = std::move(Writer);
+    return S_OK;
+}
+
+bool FrameExporter::IsTracing()
+{
+    std::lock_guard<std::mutex> lg(m_TraceLock);
+    return m_Trace != nullptr;
+}
+
+std::unique_ptr<FrameTraceWriter> FrameExporter::TakeTrace()
+{
+    std::lock_guard<std::mutex> lg(m_TraceLock);
+    return std::move(m_Trace);
+}
+
+void FrameExporter::SummarizeHandoff(LATENCY_SUMMARY& Summary) const
+{
+    m_HandoffLatency.Summarize(Summary);
+}
+
+// Records how long the frame took from acquire to publish, and traces it if a trace is running. Runs right after the
+// slot has been published, so the publish time is exact.
+void FrameExporter::TraceFrame(const SUVDA_FRAME_SLOT& Slot, const FrameTimestamps& Times)
+{
+    if (Slot.AcquireQpc && Slot.PublishQpc >= Slot.AcquireQpc && m_QpcFrequency)
+    {
+        UINT64 Ticks = Slot.PublishQpc - Slot.AcquireQpc;
+        m_HandoffLatency.Record((Ticks / m_QpcFrequency) * 1000000000ULL + (Ticks % m_QpcFrequency) * 1000000000ULL / m_QpcFrequency);
+    }
+
+    std::lock_guard<std::mutex> lg(m_TraceLock);
+
+    if (m_Trace)
+    {
+        SUVDA_TRACE_RECORD Record = {};
+        Record.FrameNumber = Slot.FrameNumber;
+        Record.Source = SUVDA_TRACE_SOURCE_DRIVER;
+        Record.PresentationFrameNumber = Times.PresentationFrameNumber;
+        Record.PresentQpc = Times.PresentQpc;
+        Record.AcquireQpc = Times.AcquireQpc;
+        Record.ProcessQpc = Times.ProcessQpc;
+        Record.FinishQpc = Times.FinishQpc;
+        Record.PublishQpc = Slot.PublishQpc;
+        Record.Flags = Slot.Flags;
+        m_Trace->Record(Record);
+    }
+}
+
+// Claims the next slot and copies the last published frame into it, flags and cursor included. The caller finishes
+// the slot and publishes it.
+HRESULT FrameExporter::BeginRepublish(UINT64 Qpc, SUVDA_FRAME_SLOT*& pSlot, uint8_t*& pData)
+{
+    // A republished frame must never overtake a frame that is still in staging
+    DrainStaging(false);
+    if (m_StagingRing.InFlight())
+    {
+        return E_PENDING;
+    }
 
-    pOutArgs->MonitorModeBufferOutputCount = std::size(s_DefaultModes);
+    const SUVDA_FRAME_SLOT* pLast = m_Ring.IsInitialized() ? m_Ring.LastPublished() : nullptr;
+    if (!pLast || m_DamageGeneration != m_Ring.Generation())
+    {
+        return E_PENDING;
+    }
 
-    VirtualMonitorMode* pPreferredMode = nullptr;
+    // The last published slot is complete, bring the next one up to date from it instead of from staging
+    UINT SlotIndex = m_Ring.NextSlotIndex();
+    UINT LastIndex = (SlotIndex + m_SlotCount - 1) % m_SlotCount;
+    auto& SlotDamage = m_SlotDamage[SlotIndex];
+    if (!SlotDamage.BuildPlan(m_Plan, FRAME_EXPORT_MAX_CPU_RECTS))
+    {
+        m_Plan.assign(1, SUVDA_FRAME_RECT{ 0, 0, (int32_t)pLast->Width, (int32_t)pLast->Height });
+    }
 
-    for (auto& it : monitorCtxList)
+    // Either slot may hold a cursor where the other doesn't
+    for (UINT Index : { SlotIndex, LastIndex })
     {
-        if (memcmp(pInArgs->MonitorDescription.pData, it->pEdidData, sizeof(edid_base)) == 0)
+        if (m_CursorRects[Index].Right > m_CursorRects[Index].Left)
         {
-            if (it->preferredMode.Width)
-            {
-                // We're adding 10 different modes, 1 original and 4 scaled x doubled refresh rate
-                pOutArgs->MonitorModeBufferOutputCount += std::size(mode_scale_factors) * 2;
-                pPreferredMode = &it->preferredMode;
-            }
-            break;
+            m_Plan.push_back(m_CursorRects[Index]);
         }
     }
 
-    if (pInArgs->MonitorModeBufferInputCount < pOutArgs->MonitorModeBufferOutputCount)
+    UINT BytesPerPixel = FrameFormatBytesPerPixel(pLast->Format);
+    const uint8_t* pSrc = m_Ring.SlotData(pLast);
+
+    pData = m_Ring.BeginFrame(pSlot);
+
+    for (auto& Rect : m_Plan)
     {
-        // Return success if there was no buffer, since the caller was only asking for a count of modes
-        return (pInArgs->MonitorModeBufferInputCount > 0) ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+        size_t Offset = (size_t)Rect.Top * pLast->Pitch + (size_t)Rect.Left * BytesPerPixel;
+        size_t Bytes = (size_t)(Rect.Right - Rect.Left) * BytesPerPixel;
+
+        for (int32_t y = Rect.Top; y < Rect.Bottom; y++, Offset += pLast->Pitch)
+        {
+            memcpy(pData + Offset, pSrc + Offset, Bytes);
+        }
     }
-    else
+    SlotDamage.Clear();
+    m_CursorRects[SlotIndex] = m_CursorRects[LastIndex];
+
+    pSlot->PresentQpc = Qpc;
+    pSlot->AcquireQpc = 0;
+    pSlot->Width = pLast->Width;
+    pSlot->Height = pLast->Height;
+    pSlot->Pitch = pLast->Pitch;
+    pSlot->Format = pLast->Format;
+    pSlot->DataSize = pLast->DataSize;
+    pSlot->Flags = pLast->Flags & SUVDA_FRAME_FLAG_CURSOR;
+    pSlot->DamageRectCount = 0;
+
+    return S_OK;
+}
+
+HRESULT FrameExporter::RefreshLastFrame(UINT64 Qpc)
+{
+    SUVDA_FRAME_SLOT* pSlot;
+    uint8_t* pData;
+    HRESULT hr = BeginRepublish(Qpc, pSlot, pData);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    pSlot->Flags |= SUVDA_FRAME_FLAG_REFINEMENT;
+
+    CaptureFrame(*pSlot, pData);
+    pSlot->PublishQpc = Qpc;
+    m_Ring.PublishFrame();
+
+    FrameTimestamps Times;
+    Times.PresentQpc = Qpc;
+    TraceFrame(*pSlot, Times);
+
+    return S_OK;
+}
+
+// Drops the tiles whose content hashes the same as when they were last published from the frame's damage. Where the
+// last published slot holds the staged pixels as they are, a matching hash is confirmed against it byte for byte.
+// Tone mapped and gamma corrected slots don't, their tiles are dropped on the 64-bit hash alone, see
+// SUVDA_FRAME_FLAG_UNCHANGED. Tiles under a composited cursor never compare equal and stay damaged.
+void FrameExporter::RemoveUnchangedTiles(const D3D11_MAPPED_SUBRESOURCE& Mapped, TileDamageMap& Damage)
+{
+    auto Format = ToFrameFormat(m_StagingDesc.Format);
+    UINT BytesPerPixel = FrameFormatBytesPerPixel(Format);
+    UINT TileSize = Damage.TileSize();
+    auto* pBase = static_cast<const uint8_t*>(Mapped.pData);
+    bool HashesValid = m_TileHashesValid;
+
+    const SUVDA_FRAME_SLOT* pLast = HashesValid && m_LastPublishedRaw && m_DamageGeneration == m_Ring.Generation() ? m_Ring.LastPublished() : nullptr;
+    if (pLast && (pLast->Format != Format || pLast->Width != Damage.Width() || pLast->Height != Damage.Height()))
     {
-        float vsyncMultiplier = 1;
+        pLast = nullptr;
+    }
+    const uint8_t* pPublished = pLast ? m_Ring.SlotData(pLast) : nullptr;
 
-        if (pPreferredMode && pPreferredMode->VSync)
+    auto SameAsPublished = [&](const uint8_t* pTile, UINT Top, UINT Left, UINT RowBytes, UINT Rows)
+    {
+        const uint8_t* pSlotTile = pPublished + (size_t)Top * pLast->Pitch + (size_t)Left * BytesPerPixel;
+        for (UINT y = 0; y < Rows; y++)
         {
-            float fVSync = (float)pPreferredMode->VSync / 1000;
-            vsyncMultiplier = fVSync / round(fVSync);
-            if (vsyncMultiplier > 1)
+            if (memcmp(pTile + (size_t)y * Mapped.RowPitch, pSlotTile + (size_t)y * pLast->Pitch, RowBytes))
             {
-                vsyncMultiplier = 1;
+                return false;
             }
         }
+        return true;
+    };
+
+    // Tile rows touch disjoint hashes and damage words, so they can be hashed in parallel
+    auto HashRow = [&](uint32_t ty)
+    {
+        UINT Top = ty * TileSize;
+        UINT Rows = std::min(TileSize, Damage.Height() - Top);
 
-        for (DWORD ModeIndex = 0; ModeIndex < std::size(s_DefaultModes); ModeIndex++)
+        for (UINT tx = 0; tx < Damage.TilesX(); tx++)
         {
-            auto vsyncTarget = s_DefaultModes[ModeIndex].VSync;
-            if (vsyncMultiplier != 1 && !(vsyncTarget % 1000))
+            if (!Damage.IsTileDamaged(tx, ty))
             {
-                vsyncTarget = (DWORD)(vsyncTarget * vsyncMultiplier);
+                continue;
             }
-            pInArgs->pMonitorModes[ModeIndex] = CreateIddCxMonitorMode2(
-                s_DefaultModes[ModeIndex].Width,
-                s_DefaultModes[ModeIndex].Height,
-                vsyncTarget,
-                IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR
-            );
-        }
 
-        if (pPreferredMode && pPreferredMode->Width)
-        {
-            auto width = pPreferredMode->Width;
-            auto height = pPreferredMode->Height;
-            auto vsync = pPreferredMode->VSync;
+            UINT Left = tx * TileSize;
+            UINT Columns = std::min(TileSize, Damage.Width() - Left);
+            const uint8_t* pTile = pBase + (size_t)Top * Mapped.RowPitch + (size_t)Left * BytesPerPixel;
+            UINT64 Hash = HashRegion(pTile, Mapped.RowPitch, Columns * BytesPerPixel, Rows);
 
-            for (uint8_t idx = 0; idx < std::size(mode_scale_factors); idx++)
+            UINT64& Previous = m_TileHashes[(size_t)ty * Damage.TilesX() + tx];
+            if (HashesValid && Previous == Hash && (!pPublished || SameAsPublished(pTile, Top, Left, Columns * BytesPerPixel, Rows)))
             {
-                auto scalc_factor = mode_scale_factors[idx];
-                auto _width = width * scalc_factor / 100;
-                auto _height = height * scalc_factor / 100;
-
-                pInArgs->pMonitorModes[std::size(s_DefaultModes) + idx * 2] = CreateIddCxMonitorMode2(
-                    _width,
-                    _height,
-                    vsync,
-                    IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR
-                );
-
-                pInArgs->pMonitorModes[std::size(s_DefaultModes) + idx * 2 + 1] = CreateIddCxMonitorMode2(
-                    _width,
-                    _height,
-                    vsync,
-                    IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR
-                );
+                Damage.ClearTile(tx, ty);
             }
-
-            pOutArgs->PreferredMonitorModeIdx = std::size(s_DefaultModes);
+            Previous = Hash;
         }
-        else
+    };
+
+    if (m_pPool)
+    {
+        m_pPool->ParallelFor(Damage.TilesY(), HashRow);
+    }
+    else
+    {
+        for (UINT ty = 0; ty < Damage.TilesY(); ty++)
         {
-            pOutArgs->PreferredMonitorModeIdx = 1;
+            HashRow(ty);
         }
-
-        return STATUS_SUCCESS;
     }
+
+    // Frames after a reset are full damage, so every tile has a hash from here on
+    m_TileHashesValid = true;
 }
 
-_Use_decl_annotations_
+void FrameExporter::DrainStaging(bool WaitOldest)
+{
+    int32_t StagingSlot;
+    while ((StagingSlot = m_StagingRing.AcquireReadable(WaitOldest)) >= 0)
+    {
+        // A failed readback loses the frame, but its damage is still carried into the ring slots
+        PublishFrame(StagingSlot);
+        m_StagingRing.EndRead(StagingSlot);
+        WaitOldest = false;
+    }
+}
 
-NTSTATUS SudoVDAMonitorGetDefaultModes(IDDCX_MONITOR MonitorObject, const IDARG_IN_GETDEFAULTDESCRIPTIONMODES* pInArgs, IDARG_OUT_GETDEFAULTDESCRIPTIONMODES* pOutArgs)
+HRESULT FrameExporter::PublishFrame(UINT StagingSlot)
 {
-    // ==============================
-    // TODO: In a real driver, this function would be called to generate monitor modes for a monitor with no EDID.
-    // Drivers should report modes that are guaranteed to be supported by the transport protocol and by nearly all
-    // monitors (such 640x480, 800x600, or 1024x768). If the driver has access to monitor modes from a descriptor other
-    // than an EDID, those modes would also be reported here.
-    // ==============================
+    auto& Pending = m_PendingFrames[StagingSlot];
+    auto SourceFormat = ToFrameFormat(m_StagingDesc.Format);
+    auto Format = ExportedFormat(SourceFormat);
+    UINT BytesPerPixel = FrameFormatBytesPerPixel(Format);
+    UINT Pitch = m_StagingDesc.Width * BytesPerPixel;
+
+    // The copy has retired, so this doesn't wait for the GPU
+    D3D11_MAPPED_SUBRESOURCE Mapped;
+    HRESULT hr = m_StagingContext->Map(m_Staging[StagingSlot].Get(), 0, D3D11_MAP_READ, 0, &Mapped);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
 
-    UNREFERENCED_PARAMETER(MonitorObject);
+    // The OS reports whatever was drawn to, which often repaints identical pixels
+    bool Unchanged = false;
+    if (m_DetectDuplicates)
+    {
+        bool HashesValid = m_TileHashesValid;
+        RemoveUnchangedTiles(Mapped, Pending.Damage);
+        if (HashesValid && Pending.FullDamage && Pending.Damage.DamagedTileCount() < Pending.Damage.TilesX() * Pending.Damage.TilesY())
+        {
+            Pending.FullDamage = false;
+        }
 
-    pOutArgs->DefaultMonitorModeBufferOutputCount = std::size(s_DefaultModes);
-    pOutArgs->PreferredMonitorModeIdx = 1;
+        Unchanged = Pending.Damage.IsEmpty() && !m_OutputChanged;
+        if (Unchanged)
+        {
+            m_FramesUnchanged.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
 
-    if (pInArgs->DefaultMonitorModeBufferInputCount == 0)
+    // Every slot and the consumers' copies were made with the previous peak or ramp
+    if (m_OutputChanged)
     {
-        return STATUS_SUCCESS;
+        m_OutputChanged = false;
+        Pending.FullDamage = true;
+        for (auto& SlotDamage : m_SlotDamage)
+        {
+            SlotDamage.MarkAll();
+        }
     }
-    else if (pInArgs->DefaultMonitorModeBufferInputCount < pOutArgs->DefaultMonitorModeBufferOutputCount)
+
+    for (auto& SlotDamage : m_SlotDamage)
     {
-        return STATUS_BUFFER_TOO_SMALL;
+        SlotDamage.Merge(Pending.Damage);
     }
 
-    for (DWORD ModeIndex = 0; ModeIndex < std::size(s_DefaultModes); ModeIndex++)
+    // Rects published to consumers describe the change since the previous frame only
+    SUVDA_FRAME_RECT FrameRects[SUVDA_FRAME_MAX_DAMAGE_RECTS];
+    bool FrameFullDamage = Pending.FullDamage || !Pending.Damage.BuildPlan(m_Plan, SUVDA_FRAME_MAX_DAMAGE_RECTS);
+    UINT FrameRectCount = FrameFullDamage ? 0 : (UINT)m_Plan.size();
+    if (FrameRectCount)
     {
-        pInArgs->pDefaultMonitorModes[ModeIndex] = CreateIddCxMonitorMode(
-            s_DefaultModes[ModeIndex].Width,
-            s_DefaultModes[ModeIndex].Height,
-            s_DefaultModes[ModeIndex].VSync,
-            IDDCX_MONITOR_MODE_ORIGIN_DRIVER
-        );
+        memcpy(FrameRects, m_Plan.data(), FrameRectCount * sizeof(SUVDA_FRAME_RECT));
     }
 
-    return STATUS_SUCCESS;
-}
-
-_Use_decl_annotations_
-
-NTSTATUS SudoVDAMonitorQueryModes(IDDCX_MONITOR MonitorObject, const IDARG_IN_QUERYTARGETMODES* pInArgs, IDARG_OUT_QUERYTARGETMODES* pOutArgs)
-{
-    UNREFERENCED_PARAMETER(MonitorObject);
-
-    pOutArgs->TargetModeBufferOutputCount = (UINT)std::size(s_DefaultModes);
-    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
-    if (pMonitorContextWrapper->pContext->preferredMode.Width)
+    // The slot about to be written last saw the ring SlotCount frames ago, refresh everything changed since then
+    UINT SlotIndex = m_Ring.NextSlotIndex();
+    auto& SlotDamage = m_SlotDamage[SlotIndex];
+    if (!SlotDamage.BuildPlan(m_Plan, FRAME_EXPORT_MAX_CPU_RECTS))
     {
-        pOutArgs->TargetModeBufferOutputCount += std::size(mode_scale_factors) * 2;
+        m_Plan.assign(1, SUVDA_FRAME_RECT{ 0, 0, (int32_t)m_StagingDesc.Width, (int32_t)m_StagingDesc.Height });
     }
 
-    if (pInArgs->TargetModeBufferInputCount >= pOutArgs->TargetModeBufferOutputCount)
+    // The cursor blended into the slot isn't in the staged image either
+    auto& SlotCursor = m_CursorRects[SlotIndex];
+    if (SlotCursor.Right > SlotCursor.Left)
     {
-        vector<IDDCX_TARGET_MODE> TargetModes;
+        m_Plan.push_back(SlotCursor);
+    }
 
-        auto width = pMonitorContextWrapper->pContext->preferredMode.Width;
-        auto height = pMonitorContextWrapper->pContext->preferredMode.Height;
-        auto vsync = pMonitorContextWrapper->pContext->preferredMode.VSync;
+    SUVDA_FRAME_SLOT* pSlot;
+    uint8_t* pData = m_Ring.BeginFrame(pSlot);
+
+    auto* pSrc = static_cast<const uint8_t*>(Mapped.pData);
+    auto CopyRect = [&](const SUVDA_FRAME_RECT& Rect)
+    {
+        size_t Offset = (size_t)Rect.Left * BytesPerPixel;
+        size_t Bytes = (size_t)(Rect.Right - Rect.Left) * BytesPerPixel;
 
-        float vsyncMultiplier = 1;
+        for (int32_t y = Rect.Top; y < Rect.Bottom; y++)
+        {
+            memcpy(pData + (size_t)y * Pitch + Offset, pSrc + (size_t)y * Mapped.RowPitch + Offset, Bytes);
+        }
+    };
 
+    const GammaLut* pGamma = UpdateGammaLut(Format);
+    m_LastPublishedRaw = Format == SourceFormat && !pGamma;
+    if (Format != SourceFormat || pGamma)
+    {
+        // Tone mapping and gamma cost far more than the copy, so they are split across the pool in bands, each
+        // corrected while its rows are still in the cache
+        m_Bands.clear();
+        for (auto& Rect : m_Plan)
         {
-            float fVSync = (float)vsync / 1000;
-            vsyncMultiplier = fVSync / round(fVSync);
-            if (vsyncMultiplier > 1)
+            for (int32_t Top = Rect.Top; Top < Rect.Bottom; Top += BandRows)
             {
-                vsyncMultiplier = 1;
+                m_Bands.push_back(SUVDA_FRAME_RECT{ Rect.Left, Top, Rect.Right, (std::min)(Top + (int32_t)BandRows, Rect.Bottom) });
             }
         }
 
-        // Create a set of modes supported for frame processing and scan-out. These are typically not based on the
-        // monitor's descriptor and instead are based on the static processing capability of the device. The OS will
-        // report the available set of modes for a given output as the intersection of monitor modes with target modes.
+        auto ProcessBand = [&](uint32_t i)
+        {
+            auto& Band = m_Bands[i];
+            if (Format != SourceFormat)
+            {
+                m_ToneMapper->Map(SourceFormat, pSrc, Mapped.RowPitch, pData, Pitch,
+                    (uint32_t)Band.Left, (uint32_t)Band.Top, (uint32_t)Band.Right, (uint32_t)Band.Bottom);
+            }
+            else
+            {
+                CopyRect(Band);
+            }
+
+            if (pGamma)
+            {
+                pGamma->Apply(pData, Pitch, (uint32_t)Band.Left, (uint32_t)Band.Top, (uint32_t)Band.Right, (uint32_t)Band.Bottom);
+            }
+        };
 
-        for (size_t i = 0; i < std::size(s_DefaultModes); i++)
+        if (m_pPool)
+        {
+            m_pPool->ParallelFor((uint32_t)m_Bands.size(), ProcessBand);
+        }
+        else
         {
-            auto vsyncTarget = s_DefaultModes[i].VSync;
-            if (vsyncMultiplier != 1 && !(vsyncTarget % 1000))
+            for (uint32_t i = 0; i < (uint32_t)m_Bands.size(); i++)
             {
-                vsyncTarget = (DWORD)(vsyncTarget * vsyncMultiplier);
+                ProcessBand(i);
             }
-            TargetModes.push_back(CreateIddCxTargetMode(
-                s_DefaultModes[i].Width,
-                s_DefaultModes[i].Height,
-                vsyncTarget
-            ));
         }
+    }
+    else
+    {
+        for (auto& Rect : m_Plan)
+        {
+            CopyRect(Rect);
+        }
+    }
 
-        for (uint8_t idx = 0; idx < std::size(mode_scale_factors); idx++)
+    m_StagingContext->Unmap(m_Staging[StagingSlot].Get(), 0);
+    SlotDamage.Clear();
+
+    pSlot->PresentQpc = Pending.Times.PresentQpc;
+    pSlot->AcquireQpc = Pending.Times.AcquireQpc;
+    pSlot->Width = m_StagingDesc.Width;
+    pSlot->Height = m_StagingDesc.Height;
+    pSlot->Pitch = Pitch;
+    pSlot->Format = Format;
+    pSlot->DataSize = (UINT64)Pitch * m_StagingDesc.Height;
+    pSlot->Flags = (FrameFullDamage ? SUVDA_FRAME_FLAG_FULL_DAMAGE : 0) | (Unchanged ? SUVDA_FRAME_FLAG_UNCHANGED : 0) |
+        (Format != SourceFormat ? SUVDA_FRAME_FLAG_TONE_MAPPED : 0);
+    pSlot->DamageRectCount = FrameRectCount;
+    memcpy(pSlot->DamageRects, FrameRects, FrameRectCount * sizeof(SUVDA_FRAME_RECT));
+
+    if (m_CompositeCursor)
+    {
+        // Consumers hold the previous frame with its own cursor, which has to be repainted when the cursor changed
+        SUVDA_FRAME_RECT Previous = m_CursorRects[(SlotIndex + m_SlotCount - 1) % m_SlotCount];
+        bool CursorChanged = m_PublishedCursorSerial != m_CursorSerial;
+        ApplyCursor(*pSlot, pData, SlotIndex);
+        if (CursorChanged)
         {
-            auto scalc_factor = mode_scale_factors[idx];
-            auto _width = width * scalc_factor / 100;
-            auto _height = height * scalc_factor / 100;
+            AddCursorDamage(*pSlot, Previous, SlotCursor, Pending.Damage);
+        }
+    }
 
-            TargetModes.push_back(CreateIddCxTargetMode(
-                _width,
-                _height,
-                vsync
-            ));
+    CaptureFrame(*pSlot, pData);
 
-            TargetModes.push_back(CreateIddCxTargetMode(
-                _width,
-                _height,
-                vsync * 2
-            ));
-        }
+    LARGE_INTEGER PublishQpc;
+    QueryPerformanceCounter(&PublishQpc);
+    pSlot->PublishQpc = PublishQpc.QuadPart;
+    m_Ring.PublishFrame();
 
-        copy(TargetModes.begin(), TargetModes.end(), pInArgs->pTargetModes);
+    TraceFrame(*pSlot, Pending.Times);
+
+    // The slot isn't rewritten before SlotCount more frames, so the preview can read it after publishing
+    if (m_Preview)
+    {
+        m_Preview->OnFrame(*pSlot, pData, Pending.Damage, Pending.FullDamage, PublishQpc.QuadPart);
     }
-    else if (pInArgs->TargetModeBufferInputCount != 0)
+
+    return S_OK;
+}
+
+void FrameExporter::SetCursor(const CursorSnapshot& Cursor)
+{
+    if (!m_CompositeCursor)
     {
-        return STATUS_BUFFER_TOO_SMALL;
+        return;
     }
 
-    return STATUS_SUCCESS;
+    if (Cursor.Visible != m_Cursor.Visible || Cursor.X != m_Cursor.X || Cursor.Y != m_Cursor.Y || Cursor.Image != m_Cursor.Image)
+    {
+        m_Cursor = Cursor;
+        m_CursorSerial++;
+    }
 }
 
-_Use_decl_annotations_
+bool FrameExporter::IsCompositingCursor() const
+{
+    return m_CompositeCursor;
+}
 
-NTSTATUS SudoVDAMonitorQueryModes2(IDDCX_MONITOR MonitorObject, const IDARG_IN_QUERYTARGETMODES2* pInArgs, IDARG_OUT_QUERYTARGETMODES* pOutArgs)
+bool FrameExporter::IsToneMapping() const
 {
-    UNREFERENCED_PARAMETER(MonitorObject);
+    return !!m_ToneMapper;
+}
+
+void FrameExporter::SetToneMapPeak(float PeakNits)
+{
+    if (!m_ToneMapper || m_ToneMapper->SourcePeakNits() == PeakNits)
+    {
+        return;
+    }
 
-    pOutArgs->TargetModeBufferOutputCount = (UINT)std::size(s_DefaultModes);
+    m_ToneMapper->Configure(PeakNits, m_ToneMapper->SdrWhiteNits());
+    m_OutputChanged = true;
+}
 
-    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+void FrameExporter::SetGammaRamp(std::shared_ptr<const GAMMA_RAMP> Ramp)
+{
+    // Slots only need correcting again when the correction itself changes. Both ramps are compared as tables for the
+    // format frames were last published in, so night light setting a ramp equal to the last one, or a tool replacing
+    // an identity ramp with none, costs nothing.
+    SUVDA_FRAME_FORMAT Format = m_GammaLut ? (SUVDA_FRAME_FORMAT)m_GammaLut->Format() : SUVDA_FRAME_FORMAT_BGRA8;
+    bool WasApplied = UpdateGammaLut(Format) != nullptr;
+    std::unique_ptr<GammaLut> Previous = std::move(m_GammaLut);
+
+    m_GammaRamp = std::move(Ramp);
+    const GammaLut* pGamma = UpdateGammaLut(Format);
+
+    bool Changed = WasApplied ? !pGamma || !pGamma->HasSameTables(*Previous) : pGamma != nullptr;
+    m_OutputChanged = m_OutputChanged || Changed;
+}
 
-    if (pMonitorContextWrapper->pContext->preferredMode.Width)
+const GammaLut* FrameExporter::UpdateGammaLut(SUVDA_FRAME_FORMAT Format)
+{
+    if (!m_GammaRamp || !GammaLut::IsSupportedFormat(Format))
     {
-        pOutArgs->TargetModeBufferOutputCount += std::size(mode_scale_factors) * 2;
+        return nullptr;
     }
 
-    if (pInArgs->TargetModeBufferInputCount >= pOutArgs->TargetModeBufferOutputCount)
+    if (!m_GammaLut || m_GammaLut->Format() != Format)
     {
-        vector<IDDCX_TARGET_MODE2> TargetModes;
+        m_GammaLut.reset(new GammaLut(*m_GammaRamp, Format));
+    }
+
+    // The default ramp of most tools changes nothing, the frame is copied as it is
+    return m_GammaLut->IsIdentity() ? nullptr : m_GammaLut.get();
+}
+
+HRESULT FrameExporter::PublishCursor(UINT64 Qpc)
+{
+    if (!m_CompositeCursor || m_PublishedCursorSerial == m_CursorSerial)
+    {
+        return S_FALSE;
+    }
+
+    // Nothing to publish if the cursor is off the frame before and after, or the frame can't hold one
+    const SUVDA_FRAME_SLOT* pLast = m_Ring.IsInitialized() && !m_CursorRects.empty() ? m_Ring.LastPublished() : nullptr;
+    if (pLast)
+    {
+        const auto& Previous = m_CursorRects[(m_Ring.NextSlotIndex() + m_SlotCount - 1) % m_SlotCount];
+        SUVDA_FRAME_RECT Rect;
+        bool Covers = m_Cursor.Visible && m_Cursor.Image && pLast->Format == SUVDA_FRAME_FORMAT_BGRA8 &&
+            CursorCoverage(pLast->Width, pLast->Height, *m_Cursor.Image, m_Cursor.X, m_Cursor.Y, Rect);
+        if (!Covers && Previous.Right <= Previous.Left)
+        {
+            m_PublishedCursorSerial = m_CursorSerial;
+            return S_FALSE;
+        }
+    }
+
+    SUVDA_FRAME_SLOT* pSlot;
+    uint8_t* pData;
+    HRESULT hr = BeginRepublish(Qpc, pSlot, pData);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Both slots hold the old cursor now, take it out again to get the plain frame under the new one
+    UINT SlotIndex = m_Ring.NextSlotIndex();
+    SUVDA_FRAME_RECT Previous = m_CursorRects[SlotIndex];
+    size_t RowBytes = (size_t)(Previous.Right - Previous.Left) * 4;
+    for (int32_t y = Previous.Top; y < Previous.Bottom; y++)
+    {
+        memcpy(pData + (size_t)y * pSlot->Pitch + (size_t)Previous.Left * 4, m_CursorBackup.data() + (y - Previous.Top) * RowBytes, RowBytes);
+    }
+
+    pSlot->Flags = SUVDA_FRAME_FLAG_CURSOR_ONLY;
+    ApplyCursor(*pSlot, pData, SlotIndex);
+    m_CursorDamage.Clear();
+    AddCursorDamage(*pSlot, Previous, m_CursorRects[SlotIndex], m_CursorDamage);
+
+    CaptureFrame(*pSlot, pData);
+    pSlot->PublishQpc = Qpc;
+    m_Ring.PublishFrame();
+
+    FrameTimestamps Times;
+    Times.PresentQpc = Qpc;
+    TraceFrame(*pSlot, Times);
+
+    if (m_Preview)
+    {
+        m_Preview->OnFrame(*pSlot, pData, m_CursorDamage, false, Qpc);
+    }
+
+    return S_OK;
+}
+
+// Blends the current cursor into a slot that was just brought up to date, keeping the pixels it covers
+void FrameExporter::ApplyCursor(SUVDA_FRAME_SLOT& Slot, uint8_t* pData, UINT SlotIndex)
+{
+    auto& Rect = m_CursorRects[SlotIndex];
+    Rect = SUVDA_FRAME_RECT{};
+    m_PublishedCursorSerial = m_CursorSerial;
+
+    if (!m_Cursor.Visible || !m_Cursor.Image || Slot.Format != SUVDA_FRAME_FORMAT_BGRA8 ||
+        !CursorCoverage(Slot.Width, Slot.Height, *m_Cursor.Image, m_Cursor.X, m_Cursor.Y, Rect))
+    {
+        return;
+    }
+
+    size_t RowBytes = (size_t)(Rect.Right - Rect.Left) * 4;
+    m_CursorBackup.resize(RowBytes * (Rect.Bottom - Rect.Top));
+    for (int32_t y = Rect.Top; y < Rect.Bottom; y++)
+    {
+        memcpy(m_CursorBackup.data() + (y - Rect.Top) * RowBytes, pData + (size_t)y * Slot.Pitch + (size_t)Rect.Left * 4, RowBytes);
+    }
+
+    CompositeCursor(pData, Slot.Pitch, Slot.Width, Slot.Height, *m_Cursor.Image, m_Cursor.X, m_Cursor.Y);
+    Slot.Flags |= SUVDA_FRAME_FLAG_CURSOR;
+}
+
+// Adds where the cursor was in the previous frame and where it is now to a slot's damage rects and to Damage
+void FrameExporter::AddCursorDamage(SUVDA_FRAME_SLOT& Slot, const SUVDA_FRAME_RECT& Previous, const SUVDA_FRAME_RECT& Current, TileDamageMap& Damage)
+{
+    for (auto* pRect : { &Previous, &Current })
+    {
+        if (pRect->Right <= pRect->Left)
+        {
+            continue;
+        }
+
+        Damage.AddRect(pRect->Left, pRect->Top, pRect->Right, pRect->Bottom);
+        if (Slot.Flags & SUVDA_FRAME_FLAG_FULL_DAMAGE)
+        {
+            continue;
+        }
+
+        if (Slot.DamageRectCount < SUVDA_FRAME_MAX_DAMAGE_RECTS)
+        {
+            Slot.DamageRects[Slot.DamageRectCount++] = *pRect;
+        }
+        else
+        {
+            Slot.Flags |= SUVDA_FRAME_FLAG_FULL_DAMAGE;
+            Slot.DamageRectCount = 0;
+        }
+    }
+
+    Slot.Flags &= ~SUVDA_FRAME_FLAG_UNCHANGED;
+}
+
+HRESULT FrameExporter::GetRingInfo(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info)
+{
+    return m_Ring.GetInfo(Info);
+}
+
+HRESULT FrameExporter::GetPreviewRingInfo(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info)
+{
+    return m_Preview ? m_Preview->GetRingInfo(Info) : E_NOTIMPL;
+}
+
+#pragma endregion
+
+#pragma region FramePreview
+
+FramePreview::FramePreview(const GUID& MonitorGuid, UINT Scale, UINT MaxFps, UINT64 QpcFrequency, WorkerPool* pPool) :
+    m_Ring(MonitorGuid, L"Preview", SlotCount),
+    m_Scale(Scale),
+    m_QpcFrequency(QpcFrequency),
+    m_pPool(pPool),
+    m_Pacing(QpcFrequency)
+{
+    m_Pacing.Configure(MaxFps, 1, 0, 0);
+}
+
+void FramePreview::OnFrame(const SUVDA_FRAME_SLOT& Slot, const uint8_t* pData, const TileDamageMap& Damage, bool FullDamage, UINT64 Qpc)
+{
+    // HDR frames have no preview
+    if (Slot.Format != SUVDA_FRAME_FORMAT_BGRA8)
+    {
+        return;
+    }
+
+    if (m_Damage.Width() != Slot.Width || m_Damage.Height() != Slot.Height)
+    {
+        m_Damage.Resize(Slot.Width, Slot.Height);
+        m_Damage.MarkAll();
+        m_Image.assign((size_t)DownscaledSize(Slot.Width, m_Scale) * DownscaledSize(Slot.Height, m_Scale) * 4, 0);
+    }
+    else if (FullDamage)
+    {
+        m_Damage.MarkAll();
+    }
+    else
+    {
+        m_Damage.Merge(Damage);
+    }
+
+    if (m_Damage.IsEmpty())
+    {
+        return;
+    }
+
+    if (m_Pacing.ShouldKeep(Qpc))
+    {
+        Render(Slot, pData);
+    }
+    else
+    {
+        m_Pending = true;
+    }
+}
+
+DWORD FramePreview::Poll(const SUVDA_FRAME_SLOT* pLast, const uint8_t* pData, UINT64 Qpc)
+{
+    if (!m_Pending)
+    {
+        return INFINITE;
+    }
+
+    // The frame ring was recreated or switched format since, the next frame starts over anyway
+    if (!pLast || pLast->Format != SUVDA_FRAME_FORMAT_BGRA8 || pLast->Width != m_Damage.Width() || pLast->Height != m_Damage.Height())
+    {
+        m_Pending = false;
+        return INFINITE;
+    }
+
+    if (!m_Pacing.IsOverdue(Qpc))
+    {
+        UINT64 Ticks = m_Pacing.TimeUntilOverdue(Qpc);
+        return (DWORD)(std::min)((Ticks * 1000 + m_QpcFrequency - 1) / m_QpcFrequency, (UINT64)INFINITE - 1);
+    }
+
+    m_Pacing.ShouldKeep(Qpc);
+    Render(*pLast, pData);
+    return INFINITE;
+}
+
+HRESULT FramePreview::Render(const SUVDA_FRAME_SLOT& Slot, const uint8_t* pData)
+{
+    m_Pending = false;
+
+    UINT Width = DownscaledSize(Slot.Width, m_Scale);
+    UINT Height = DownscaledSize(Slot.Height, m_Scale);
+    UINT Pitch = Width * 4;
+
+    HRESULT hr = m_Ring.Ensure((UINT64)Pitch * Height);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Tiles are a multiple of every scale, so each damaged rect maps to whole preview pixels
+    if (!m_Damage.BuildPlan(m_Plan, FRAME_EXPORT_MAX_CPU_RECTS))
+    {
+        m_Plan.assign(1, SUVDA_FRAME_RECT{ 0, 0, (int32_t)Slot.Width, (int32_t)Slot.Height });
+    }
+    m_Damage.Clear();
+
+    m_Bands.clear();
+    for (auto& Rect : m_Plan)
+    {
+        int32_t Left = Rect.Left / (int32_t)m_Scale;
+        int32_t Right = (int32_t)DownscaledSize((uint32_t)Rect.Right, m_Scale);
+        int32_t Bottom = (int32_t)DownscaledSize((uint32_t)Rect.Bottom, m_Scale);
+        for (int32_t Top = Rect.Top / (int32_t)m_Scale; Top < Bottom; Top += BandRows)
+        {
+            m_Bands.push_back(SUVDA_FRAME_RECT{ Left, Top, Right, (std::min)(Top + (int32_t)BandRows, Bottom) });
+        }
+    }
+
+    auto DownscaleBand = [&](uint32_t i)
+    {
+        auto& Band = m_Bands[i];
+        DownscaleBgraBox(pData, Slot.Pitch, Slot.Width, Slot.Height, m_Scale, m_Image.data(), Pitch,
+            (uint32_t)Band.Left, (uint32_t)Band.Top, (uint32_t)Band.Right, (uint32_t)Band.Bottom);
+    };
+
+    if (m_pPool)
+    {
+        m_pPool->ParallelFor((uint32_t)m_Bands.size(), DownscaleBand);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < (uint32_t)m_Bands.size(); i++)
+        {
+            DownscaleBand(i);
+        }
+    }
+
+    // The preview is small, so every slot gets all of it rather than tracking what each one is missing
+    SUVDA_FRAME_SLOT* pSlot;
+    uint8_t* pOut = m_Ring.BeginFrame(pSlot);
+    memcpy(pOut, m_Image.data(), m_Image.size());
+
+    pSlot->PresentQpc = Slot.PresentQpc;
+    pSlot->AcquireQpc = Slot.AcquireQpc;
+    pSlot->Width = Width;
+    pSlot->Height = Height;
+    pSlot->Pitch = Pitch;
+    pSlot->Format = SUVDA_FRAME_FORMAT_BGRA8;
+    pSlot->DataSize = (UINT64)Pitch * Height;
+    pSlot->Flags = SUVDA_FRAME_FLAG_FULL_DAMAGE;
+    pSlot->DamageRectCount = 0;
+
+    LARGE_INTEGER PublishQpc;
+    QueryPerformanceCounter(&PublishQpc);
+    pSlot->PublishQpc = PublishQpc.QuadPart;
+    m_Ring.PublishFrame();
+
+    return S_OK;
+}
+
+HRESULT FramePreview::GetRingInfo(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info)
+{
+    return m_Ring.GetInfo(Info);
+}
+
+#pragma endregion
+
+#pragma region MonitorFrameState
+
+MonitorFrameState::MonitorFrameState() :
+    m_AssignTimer(QpcClock().Frequency())
+{
+}
+
+void MonitorFrameState::SetCommittedRefresh(const DISPLAYCONFIG_RATIONAL& Rate)
+{
+    m_CommittedRefresh.store(((UINT64)Rate.Numerator << 32) | Rate.Denominator, std::memory_order_relaxed);
+}
+
+DISPLAYCONFIG_RATIONAL MonitorFrameState::GetCommittedRefresh() const
+{
+    UINT64 Packed = m_CommittedRefresh.load(std::memory_order_relaxed);
+    return DISPLAYCONFIG_RATIONAL{(UINT32)(Packed >> 32), (UINT32)Packed};
+}
+
+void MonitorFrameState::SetConsumerRate(UINT Consumer, const DISPLAYCONFIG_RATIONAL& Rate)
+{
+    std::lock_guard<std::mutex> lg(m_ConsumerRateLock);
+    m_ConsumerRates[Consumer] = (Rate.Numerator && Rate.Denominator) ? Rate : DISPLAYCONFIG_RATIONAL{};
+    m_ConsumerRateGeneration.fetch_add(1, std::memory_order_release);
+}
+
+UINT64 MonitorFrameState::GetConsumerRates(DISPLAYCONFIG_RATIONAL (&Rates)[SUVDA_MAX_RATE_CONSUMERS]) const
+{
+    std::lock_guard<std::mutex> lg(m_ConsumerRateLock);
+    memcpy(Rates, m_ConsumerRates, sizeof(m_ConsumerRates));
+    return m_ConsumerRateGeneration.load(std::memory_order_relaxed);
+}
+
+UINT64 MonitorFrameState::ConsumerRateGeneration() const
+{
+    return m_ConsumerRateGeneration.load(std::memory_order_acquire);
+}
+
+void MonitorFrameState::SetCursor(const CursorSnapshot& Cursor)
+{
+    std::lock_guard<std::mutex> lg(m_CursorLock);
+    m_Cursor = Cursor;
+    m_CursorGeneration.fetch_add(1, std::memory_order_release);
+}
+
+UINT64 MonitorFrameState::GetCursor(CursorSnapshot& Cursor) const
+{
+    std::lock_guard<std::mutex> lg(m_CursorLock);
+    Cursor = m_Cursor;
+    return m_CursorGeneration.load(std::memory_order_relaxed);
+}
+
+UINT64 MonitorFrameState::CursorGeneration() const
+{
+    return m_CursorGeneration.load(std::memory_order_acquire);
+}
+
+void MonitorFrameState::SetHdrMetadata(UINT Type, const SUVDA_HDR10_METADATA& Hdr10)
+{
+    std::lock_guard<std::mutex> lg(m_HdrMetadataLock);
+    m_HdrMetadataType = Type;
+    m_Hdr10 = Type == SUVDA_HDR_METADATA_HDR10 ? Hdr10 : SUVDA_HDR10_METADATA{};
+    m_HdrMetadataGeneration.fetch_add(1, std::memory_order_release);
+}
+
+UINT64 MonitorFrameState::GetHdrMetadata(VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT& Metadata) const
+{
+    std::lock_guard<std::mutex> lg(m_HdrMetadataLock);
+    UINT64 Generation = m_HdrMetadataGeneration.load(std::memory_order_relaxed);
+    Metadata.Type = m_HdrMetadataType;
+    Metadata.Generation = (UINT)Generation;
+    Metadata.Hdr10 = m_Hdr10;
+    return Generation;
+}
+
+UINT64 MonitorFrameState::HdrMetadataGeneration() const
+{
+    return m_HdrMetadataGeneration.load(std::memory_order_acquire);
+}
+
+void MonitorFrameState::SetGammaRamp(std::shared_ptr<const GAMMA_RAMP> Ramp)
+{
+    std::lock_guard<std::mutex> lg(m_GammaRampLock);
+    m_GammaRamp.swap(Ramp);
+    m_GammaRampGeneration.fetch_add(1, std::memory_order_release);
+}
+
+UINT64 MonitorFrameState::GetGammaRamp(std::shared_ptr<const GAMMA_RAMP>& Ramp) const
+{
+    std::lock_guard<std::mutex> lg(m_GammaRampLock);
+    Ramp = m_GammaRamp;
+    return m_GammaRampGeneration.load(std::memory_order_relaxed);
+}
+
+UINT64 MonitorFrameState::GammaRampGeneration() const
+{
+    return m_GammaRampGeneration.load(std::memory_order_acquire);
+}
+
+UINT64 MonitorFrameState::BeginAssignment(UINT64 Now, bool Rearmed)
+{
+    return m_AssignTimer.Begin(Now, Rearmed);
+}
+
+void MonitorFrameState::MarkAssignPhase(UINT64 AssignId, ASSIGN_PHASE Phase, UINT64 Now)
+{
+    m_AssignTimer.Mark(AssignId, Phase, Now);
+}
+
+void MonitorFrameState::GetAssignStats(VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT& Stats) const
+{
+    ASSIGN_TIMING_STATS Timing;
+    m_AssignTimer.Snapshot(Timing);
+
+    Stats = {};
+    Stats.Assignments = Timing.Assignments;
+    Stats.Rearms = Timing.Rearms;
+    Stats.Failures = Timing.Failures;
+    Stats.LastRearmed = Timing.LastRearmed;
+
+    for (UINT i = 0; i < SUVDA_ASSIGN_PHASE_COUNT; i++)
+    {
+        Stats.LastPhaseNs[i] = Timing.LastPhaseNs[i];
+        Stats.Phases[i].Count = Timing.Phases[i].Count;
+        Stats.Phases[i].MeanNs = Timing.Phases[i].Mean;
+        Stats.Phases[i].P50Ns = Timing.Phases[i].P50;
+        Stats.Phases[i].P90Ns = Timing.Phases[i].P90;
+        Stats.Phases[i].P99Ns = Timing.Phases[i].P99;
+        Stats.Phases[i].P999Ns = Timing.Phases[i].P999;
+        Stats.Phases[i].MaxNs = Timing.Phases[i].Max;
+    }
+}
+
+// Source level tone mapped to SDR white: the content's MaxCLL, else the mastering display's peak
+static float ToneMapPeakNits(const VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT& Metadata)
+{
+    if (Metadata.Type != SUVDA_HDR_METADATA_HDR10)
+    {
+        return ToneMapDefaultPeakNits;
+    }
+
+    if (Metadata.Hdr10.MaxContentLightLevel)
+    {
+        return Metadata.Hdr10.MaxContentLightLevel;
+    }
+
+    return Metadata.Hdr10.MaxMasteringLuminance ? (float)(std::min)(Metadata.Hdr10.MaxMasteringLuminance, 10000u) : ToneMapDefaultPeakNits;
+}
+
+void MonitorFrameState::RecordStage(SUVDA_FRAME_STAGE Stage, UINT64 Nanoseconds)
+{
+    m_StageLatency[Stage].Record(Nanoseconds);
+}
+
+void MonitorFrameState::GetStats(VIRTUAL_DISPLAY_GET_FRAME_STATS_OUT& Stats) const
+{
+    Stats = {};
+    Stats.FramesAcquired = FramesAcquired.load(std::memory_order_relaxed);
+    Stats.FramesDropped = FramesDropped.load(std::memory_order_relaxed);
+    Stats.FramesExported = FramesExported.load(std::memory_order_relaxed);
+    Stats.ExportFailures = ExportFailures.load(std::memory_order_relaxed);
+    Stats.FramesUnchanged = Exporter ? Exporter->FramesUnchanged() : 0;
+    Stats.FramesRefined = FramesRefined.load(std::memory_order_relaxed);
+    Stats.FramesDecimated = FramesDecimated.load(std::memory_order_relaxed);
+    Stats.PendingDepth = PendingDepth.load(std::memory_order_relaxed);
+
+    for (UINT i = 0; i < SUVDA_FRAME_STAGE_COUNT; i++)
+    {
+        LATENCY_SUMMARY Summary;
+        if (i == SUVDA_FRAME_STAGE_HANDOFF)
+        {
+            // Frames are published from the exporter's readback, which is the only place that knows when
+            if (Exporter)
+            {
+                Exporter->SummarizeHandoff(Summary);
+            }
+            else
+            {
+                Summary = {};
+            }
+        }
+        else
+        {
+            m_StageLatency[i].Summarize(Summary);
+        }
+
+        Stats.Stages[i].Count = Summary.Count;
+        Stats.Stages[i].MeanNs = Summary.Mean;
+        Stats.Stages[i].P50Ns = Summary.P50;
+        Stats.Stages[i].P90Ns = Summary.P90;
+        Stats.Stages[i].P99Ns = Summary.P99;
+        Stats.Stages[i].P999Ns = Summary.P999;
+        Stats.Stages[i].MaxNs = Summary.Max;
+    }
+}
+
+uint64_t QpcClock::Now()
+{
+    LARGE_INTEGER Counter;
+    QueryPerformanceCounter(&Counter);
+    return Counter.QuadPart;
+}
+
+uint64_t QpcClock::Frequency()
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    return Frequency.QuadPart;
+}
+
+#pragma endregion
+
+#pragma region SwapChainProcessor
+
+SwapChainProcessor::SwapChainProcessor(IDDCX_SWAPCHAIN hSwapChain, shared_ptr<Direct3DDevice> Device, HANDLE NewFrameEvent, UINT64 AssignId, shared_ptr<MonitorFrameState> State, WorkerPool* pPool)
+    : m_hSwapChain(hSwapChain), m_Device(Device), m_hAvailableBufferEvent(NewFrameEvent), m_AssignId(AssignId), m_State(State), m_ClockFrequency(m_Clock.Frequency()), m_Pacer(m_Clock), m_IdleRefresh(m_Clock), m_Decimation(m_Clock)
+{
+    m_hTerminateEvent.Attach(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    m_IdleRefresh.Configure(IdleRefreshMs, IdleRefreshIntervalMs, IdleRefreshMaxPasses);
+
+    // A high resolution timer lets us sleep right up to the next vblank. It's not available before Windows 10 1803,
+    // in which case we fall back to millisecond wait timeouts.
+    m_hDeadlineTimer.Attach(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS));
+
+    if (pPool)
+    {
+        // Frames are processed as jobs on the shared pool, woken by a thread-pool wait on the new frame event
+        m_Strand.reset(new WorkerStrand(*pPool));
+        m_BufferWait = CreateThreadpoolWait(BufferWaitCallback, this, nullptr);
+        if (m_BufferWait)
+        {
+            m_Strand->Post([this]
+            {
+                m_State->MarkAssignPhase(m_AssignId, ASSIGN_PHASE_THREAD, m_Clock.Now());
+                if (SetDevice())
+                {
+                    RunPooled();
+                }
+                else
+                {
+                    m_Terminating.store(true, std::memory_order_release);
+                    WdfObjectDelete((WDFOBJECT)m_hSwapChain);
+                    m_hSwapChain = nullptr;
+                }
+            });
+            return;
+        }
+
+        m_Strand.reset();
+    }
+
+    // Immediately create and run the swap-chain processing thread, passing 'this' as the thread parameter. The thread
+    // picks the swap-chain up from m_Rearm like every later one.
+    Assignment First;
+    First.hSwapChain = hSwapChain;
+    First.Device = Device;
+    First.hNewFrameEvent = NewFrameEvent;
+    First.AssignId = AssignId;
+    m_Rearm.Arm(std::move(First));
+
+    m_hThread.Attach(CreateThread(nullptr, 0, RunThread, this, 0, nullptr));
+}
+
+SwapChainProcessor::~SwapChainProcessor()
+{
+    if (m_Strand)
+    {
+        m_Terminating.store(true, std::memory_order_release);
+        m_Strand->WaitIdle();
+
+        // Nothing re-arms the wait once the strand is idle, a callback that already fired may still post one last
+        // job, which returns right away
+        SetThreadpoolWait(m_BufferWait, nullptr, nullptr);
+        WaitForThreadpoolWaitCallbacks(m_BufferWait, TRUE);
+        m_Strand->WaitIdle();
+        CloseThreadpoolWait(m_BufferWait);
+
+        if (m_hSwapChain)
+        {
+            WdfObjectDelete((WDFOBJECT)m_hSwapChain);
+            m_hSwapChain = nullptr;
+        }
+        return;
+    }
+
+    // Alert the swap-chain processing thread to terminate, it deletes the swap-chain it still has first
+    m_Rearm.Shutdown();
+    SetEvent(m_hTerminateEvent.Get());
+
+    if (m_hThread.Get())
+    {
+        // Wait for the thread to terminate
+        WaitForSingleObject(m_hThread.Get(), INFINITE);
+    }
+}
+
+bool SwapChainProcessor::CanRearm() const
+{
+    return !m_Strand && m_hThread.Get();
+}
+
+bool SwapChainProcessor::Rearm(IDDCX_SWAPCHAIN hSwapChain, shared_ptr<Direct3DDevice> Device, HANDLE NewFrameEvent, UINT64 AssignId)
+{
+    Assignment Next;
+    Next.hSwapChain = hSwapChain;
+    Next.Device = std::move(Device);
+    Next.hNewFrameEvent = NewFrameEvent;
+    Next.AssignId = AssignId;
+    return m_Rearm.Arm(std::move(Next));
+}
+
+void SwapChainProcessor::Release()
+{
+    // Nothing to wait for if the thread already let go of the swap-chain on its own, e.g. after it was abandoned
+    if (m_Rearm.RequestRelease())
+    {
+        SetEvent(m_hTerminateEvent.Get());
+        m_Rearm.WaitReleased();
+    }
+}
+
+DWORD CALLBACK SwapChainProcessor::RunThread(LPVOID Argument)
+{
+    reinterpret_cast<SwapChainProcessor*>(Argument)->Run();
+    return 0;
+}
+
+void SwapChainProcessor::Run()
+{
+    // For improved performance, make use of the Multimedia Class Scheduler Service, which will intelligently
+    // prioritize this thread for improved throughput in high CPU-load scenarios.
+    DWORD AvTask = 0;
+    HANDLE AvTaskHandle = AvSetMmThreadCharacteristicsW(L"DisplayPostProcessing", &AvTask);
+
+    // One swap-chain after the other, parked in between, until the processor is destroyed
+    Assignment Next;
+    while (m_Rearm.WaitForAssignment(Next))
+    {
+        m_hSwapChain = Next.hSwapChain;
+        m_Device = std::move(Next.Device);
+        m_hAvailableBufferEvent = Next.hNewFrameEvent;
+        m_AssignId = Next.AssignId;
+        m_AwaitingFirstFrame = true;
+        m_State->MarkAssignPhase(m_AssignId, ASSIGN_PHASE_THREAD, m_Clock.Now());
+
+        // The previous swap-chain may have ended without waiting on the terminate event. A release requested after
+        // the reset sets it again, one requested before is caught right here.
+        ResetEvent(m_hTerminateEvent.Get());
+        if (!m_Rearm.ShouldRelease())
+        {
+            RunCore();
+        }
+
+        // Always delete the swap-chain object when swap-chain processing loop terminates in order to kick the system to
+        // provide a new swap-chain if necessary.
+        WdfObjectDelete((WDFOBJECT)m_hSwapChain);
+        m_hSwapChain = nullptr;
+
+        // Nothing of the old swap-chain is used with the next one. The device goes too, the next swap-chain may
+        // render on another adapter.
+        m_SkippedSurface.Reset();
+        m_LastPresentationFrameNumber = 0;
+        m_Device.reset();
+        m_Rearm.Released();
+    }
+
+    AvRevertMmThreadCharacteristics(AvTaskHandle);
+}
+
+bool SwapChainProcessor::ArmDeadlineTimer()
+{
+    if (!m_hDeadlineTimer.IsValid())
+    {
+        return false;
+    }
+
+    // Relative due time in 100ns units, must be negative and non-zero
+    uint64_t Ticks = m_Pacer.TimeUntilDeadline();
+    LARGE_INTEGER DueTime;
+    DueTime.QuadPart = -(std::max)((LONGLONG)(Ticks * 10000000 / m_Clock.Frequency()), 1LL);
+
+    return !!SetWaitableTimer(m_hDeadlineTimer.Get(), &DueTime, 0, nullptr, nullptr, FALSE);
+}
+
+UINT64 SwapChainProcessor::TicksToNanoseconds(UINT64 Ticks) const
+{
+    // Split to keep the intermediate product from overflowing
+    return (Ticks / m_ClockFrequency) * 1000000000ULL + (Ticks % m_ClockFrequency) * 1000000000ULL / m_ClockFrequency;
+}
+
+// Collects the dirty rects and move destinations of the acquired frame into m_Damage. Returns false when the damage
+// is unknown and the whole frame has to be treated as changed.
+bool SwapChainProcessor::GetFrameDamage(UINT DirtyRectCount, UINT MoveRegionCount)
+{
+    // The OS reports no rects at all for frames where it didn't track damage, e.g. the first frame after a mode change
+    if (!DirtyRectCount && !MoveRegionCount)
+    {
+        return false;
+    }
+
+    m_Damage.resize(DirtyRectCount);
+    if (DirtyRectCount)
+    {
+        IDARG_IN_GETDIRTYRECTS InArgs = {};
+        InArgs.DirtyRectInCount = DirtyRectCount;
+        InArgs.pDirtyRects = m_Damage.data();
+        IDARG_OUT_GETDIRTYRECTS OutArgs = {};
+        if (FAILED(IddCxSwapChainGetDirtyRects(m_hSwapChain, &InArgs, &OutArgs)))
+        {
+            return false;
+        }
+        m_Damage.resize(OutArgs.DirtyRectOutCount);
+    }
+
+    if (MoveRegionCount)
+    {
+        m_MoveRegions.resize(MoveRegionCount);
+        IDARG_IN_GETMOVEREGIONS InArgs = {};
+        InArgs.MoveRegionInCount = MoveRegionCount;
+        InArgs.pMoveRegions = m_MoveRegions.data();
+        IDARG_OUT_GETMOVEREGIONS OutArgs = {};
+        if (FAILED(IddCxSwapChainGetMoveRegions(m_hSwapChain, &InArgs, &OutArgs)))
+        {
+            return false;
+        }
+
+        // Only the destination of a move changes, the source keeps its content
+        for (UINT i = 0; i < OutArgs.MoveRegionOutCount; i++)
+        {
+            m_Damage.push_back(m_MoveRegions[i].DestRect);
+        }
+    }
+
+    return true;
+}
+
+void SwapChainProcessor::ReportFrameStatistics(UINT PresentationFrameNumber, bool Completed, UINT64 AcquireTick, UINT64 ProcessTick)
+{
+    if (!IDD_IS_FUNCTION_AVAILABLE(IddCxSwapChainReportFrameStatistics))
+    {
+        return;
+    }
+
+    // Our own processing steps, reported as device defined steps: acquire, then processing done
+    IDDCX_FRAME_STATISTICS_STEP Steps[2] = {};
+    Steps[0].Size = sizeof(Steps[0]);
+    Steps[0].Type = (IDDCX_FRAME_STATISTICS_STEP_TYPE)(IDDCX_FRAME_STATISTICS_STEP_TYPE_DEVICE_DEFINED_BASE + 0);
+    Steps[0].QpcTime = AcquireTick;
+    Steps[1].Size = sizeof(Steps[1]);
+    Steps[1].Type = (IDDCX_FRAME_STATISTICS_STEP_TYPE)(IDDCX_FRAME_STATISTICS_STEP_TYPE_DEVICE_DEFINED_BASE + 1);
+    Steps[1].QpcTime = ProcessTick;
+
+    IDARG_IN_REPORTFRAMESTATISTICS Args = {};
+    Args.FrameStatistics.Size = sizeof(Args.FrameStatistics);
+    Args.FrameStatistics.PresentationFrameNumber = PresentationFrameNumber;
+    Args.FrameStatistics.FrameStatus = Completed ? IDDCX_FRAME_STATUS_COMPLETED : IDDCX_FRAME_STATUS_DROPPED;
+    Args.FrameStatistics.FrameProcessingStepsCount = ARRAYSIZE(Steps);
+    Args.FrameStatistics.pFrameProcessingStep = Steps;
+
+    IddCxSwapChainReportFrameStatistics(m_hSwapChain, &Args);
+}
+
+bool SwapChainProcessor::SetDevice()
+{
+    // Get the DXGI device interface
+    ComPtr<IDXGIDevice> DxgiDevice;
+    HRESULT hr = m_Device->Device.As(&DxgiDevice);
+    if (FAILED(hr))
+    {
+        return false;
+    }
+
+    IDARG_IN_SWAPCHAINSETDEVICE SetDevice = {};
+    SetDevice.pDevice = DxgiDevice.Get();
+
+    hr = IddCxSwapChainSetDevice(m_hSwapChain, &SetDevice);
+    if (FAILED(hr))
+    {
+        return false;
+    }
+
+    m_State->MarkAssignPhase(m_AssignId, ASSIGN_PHASE_SET_DEVICE, m_Clock.Now());
+    return true;
+}
+
+void SwapChainProcessor::RunCore()
+{
+    if (!SetDevice())
+    {
+        return;
+    }
+
+    // Acquire and release buffers in a loop
+    for (;;)
+    {
+        HRESULT hr = ProcessNextFrame();
+
+        // AcquireBuffer immediately returns STATUS_PENDING if no buffer is yet available
+        if (hr == E_PENDING)
+        {
+            // We must wait for a new buffer, or until the next vblank of the committed mode
+            HANDLE WaitHandles[] =
+            {
+                m_hAvailableBufferEvent,
+                m_hTerminateEvent.Get(),
+                m_hDeadlineTimer.Get()
+            };
+            DWORD WaitCount = ARRAYSIZE(WaitHandles);
+
+            bool TimerArmed;
+            DWORD Timeout = PrepareIdleWait(true, TimerArmed);
+            if (!TimerArmed)
+            {
+                WaitCount--;
+            }
+
+            DWORD WaitResult = WaitForMultipleObjects(WaitCount, WaitHandles, FALSE, Timeout);
+            if (WaitResult == WAIT_OBJECT_0)
+            {
+                // We have a new buffer, so try the AcquireBuffer again
+                m_Pacer.OnWake(PACER_WAKE_NEW_SURFACE);
+                continue;
+            }
+            else if (WaitResult == WAIT_OBJECT_0 + 2 || WaitResult == WAIT_TIMEOUT)
+            {
+                // The vblank deadline passed without a signal, or PrepareIdleWait() shortened the wait to poll. Look
+                // at the swap-chain once more either way.
+                m_Pacer.OnWake(WaitResult == WAIT_OBJECT_0 + 2 ? PACER_WAKE_DEADLINE : m_Pacer.TimeoutReason(m_Clock.Now()));
+                continue;
+            }
+            else if (WaitResult == WAIT_OBJECT_0 + 1)
+            {
+                // We need to terminate
+                break;
+            }
+            else
+            {
+                // The wait was cancelled or something unexpected happened
+                break;
+            }
+        }
+        else if (FAILED(hr))
+        {
+            // The swap-chain was likely abandoned (e.g. DXGI_ERROR_ACCESS_LOST), so exit the processing loop
+            break;
+        }
+    }
+}
+
+// Acquires and processes the next buffer. Returns E_PENDING when none is available yet, any other failure ends
+// swap-chain processing.
+HRESULT SwapChainProcessor::ProcessNextFrame()
+{
+    HRESULT hr;
+    ComPtr<IDXGIResource> AcquiredBuffer;
+
+    IDXGIResource* pSurface;
+    UINT64 PresentQpc;
+    UINT PresentationFrameNumber;
+    UINT DirtyRectCount;
+    UINT MoveRegionCount;
+
+    if (IDD_IS_FUNCTION_AVAILABLE(IddCxSwapChainReleaseAndAcquireBuffer2))
+    {
+        IDARG_IN_RELEASEANDACQUIREBUFFER2 BufferInArgs = {};
+        BufferInArgs.Size = sizeof(BufferInArgs);
+        IDARG_OUT_RELEASEANDACQUIREBUFFER2 Buffer = {};
+        hr = IddCxSwapChainReleaseAndAcquireBuffer2(m_hSwapChain, &BufferInArgs, &Buffer);
+        pSurface = Buffer.MetaData.pSurface;
+        PresentQpc = Buffer.MetaData.PresentDisplayQPCTime;
+        PresentationFrameNumber = Buffer.MetaData.PresentationFrameNumber;
+        DirtyRectCount = Buffer.MetaData.DirtyRectCount;
+        MoveRegionCount = Buffer.MetaData.MoveRegionCount;
+    }
+    else
+    {
+        IDARG_OUT_RELEASEANDACQUIREBUFFER Buffer = {};
+        hr = IddCxSwapChainReleaseAndAcquireBuffer(m_hSwapChain, &Buffer);
+        pSurface = Buffer.MetaData.pSurface;
+        PresentQpc = Buffer.MetaData.PresentDisplayQPCTime;
+        PresentationFrameNumber = Buffer.MetaData.PresentationFrameNumber;
+        DirtyRectCount = Buffer.MetaData.DirtyRectCount;
+        MoveRegionCount = Buffer.MetaData.MoveRegionCount;
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // We have new frame to process, the surface has a reference on it that the driver has to release
+    AcquiredBuffer.Attach(pSurface);
+
+    // The OS took back the surface decimation held on to
+    m_SkippedSurface.Reset();
+    UINT64 AcquireTick = m_Clock.Now();
+    if (m_AwaitingFirstFrame)
+    {
+        m_State->MarkAssignPhase(m_AssignId, ASSIGN_PHASE_FIRST_FRAME, AcquireTick);
+        m_AwaitingFirstFrame = false;
+    }
+    m_Pacer.OnFrame(PresentQpc);
+    m_IdleRefresh.OnFrame();
+
+    m_State->FramesAcquired.fetch_add(1, std::memory_order_relaxed);
+    if (m_LastPresentationFrameNumber && PresentationFrameNumber > m_LastPresentationFrameNumber + 1)
+    {
+        m_State->FramesDropped.fetch_add(PresentationFrameNumber - m_LastPresentationFrameNumber - 1, std::memory_order_relaxed);
+    }
+    m_LastPresentationFrameNumber = PresentationFrameNumber;
+
+    if (PresentQpc && PresentQpc <= AcquireTick)
+    {
+        m_State->RecordStage(SUVDA_FRAME_STAGE_ACQUIRE, TicksToNanoseconds(AcquireTick - PresentQpc));
+    }
+
+    // The frame is exported with the cursor, HDR metadata and gamma ramp as they are now
+    SyncCursor();
+    SyncHdrMetadata();
+    SyncGammaRamp();
+
+    // This is the most performance-critical section of code in an IddCx driver. It's important that whatever
+    // is done with the acquired surface be finished as quickly as possible.
+    bool Completed = true;
+    bool Exported = false;
+    if (m_State->Exporter)
+    {
+        ComPtr<ID3D11Texture2D> Texture;
+        hr = AcquiredBuffer.As(&Texture);
+        if (SUCCEEDED(hr))
+        {
+            // A failed export only costs the consumers this frame, never the swap-chain
+            bool FullDamage = !GetFrameDamage(DirtyRectCount, MoveRegionCount);
+            FrameTimestamps Times;
+            Times.PresentationFrameNumber = PresentationFrameNumber;
+            Times.PresentQpc = PresentQpc;
+            Times.AcquireQpc = AcquireTick;
+
+            // Frames no consumer wants at its rate are never copied, only their damage is remembered
+            UpdateDecimation();
+            if (m_Decimation.ShouldKeep(PresentQpc ? PresentQpc : AcquireTick))
+            {
+                hr = m_State->Exporter->ExportFrame(*m_Device, Texture.Get(), Times, m_Damage, FullDamage);
+                Exported = SUCCEEDED(hr);
+            }
+            else
+            {
+                m_State->Exporter->SkipFrame(m_Damage, FullDamage);
+                m_SkippedSurface = Texture;
+                m_SkippedTimes = Times;
+                m_State->FramesDecimated.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Completed = SUCCEEDED(hr);
+        if (Exported)
+        {
+            m_State->FramesExported.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (!Completed)
+        {
+            m_State->ExportFailures.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_State->PendingDepth.store(m_State->Exporter->PendingFrames(), std::memory_order_relaxed);
+    }
+
+    UINT64 ProcessTick = m_Clock.Now();
+    m_State->RecordStage(SUVDA_FRAME_STAGE_PROCESS, TicksToNanoseconds(ProcessTick - AcquireTick));
+
+    // We have finished processing this frame hence we release the reference on it.
+    // If the driver forgets to release the reference to the surface, it will be leaked which results in the
+    // surfaces being left around after swapchain is destroyed.
+    // NOTE: Although in this sample we release reference to the surface here; the driver still
+    // owns the Buffer.MetaData.pSurface surface until IddCxSwapChainReleaseAndAcquireBuffer returns
+    // S_OK and gives us a new frame, a driver may want to use the surface in future to re-encode the desktop
+    // for better quality if there is no new frame for a while
+    // Idle refinement (see IdleRefreshPolicy) republishes the exported copy instead, so the surface isn't kept.
+    // Only the last frame skipped by decimation is kept, in m_SkippedSurface, until it is exported or replaced.
+    AcquiredBuffer.Reset();
+
+    // Indicate to OS that we have finished inital processing of the frame, it is a hint that
+    // OS could start preparing another frame
+    hr = IddCxSwapChainFinishedProcessingFrame(m_hSwapChain);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    UINT64 FinishTick = m_Clock.Now();
+    m_State->RecordStage(SUVDA_FRAME_STAGE_FINISH, TicksToNanoseconds(FinishTick - AcquireTick));
+    if (Exported)
+    {
+        m_State->Exporter->CompleteFrame(ProcessTick, FinishTick);
+    }
+
+    ReportFrameStatistics(PresentationFrameNumber, Completed, AcquireTick, ProcessTick);
+
+    return S_OK;
+}
+
+// Brings the decimation up to date with the committed mode and the rates the consumers registered
+void SwapChainProcessor::UpdateDecimation()
+{
+    auto Refresh = m_State->GetCommittedRefresh();
+    m_Decimation.SetSourceRate(Refresh.Numerator, Refresh.Denominator);
+
+    if (m_State->ConsumerRateGeneration() != m_ConsumerRateGeneration)
+    {
+        DISPLAYCONFIG_RATIONAL Rates[SUVDA_MAX_RATE_CONSUMERS];
+        m_ConsumerRateGeneration = m_State->GetConsumerRates(Rates);
+        for (UINT i = 0; i < SUVDA_MAX_RATE_CONSUMERS; i++)
+        {
+            m_Decimation.Configure(i, Rates[i].Numerator, Rates[i].Denominator);
+        }
+    }
+}
+
+// Exports the frame decimation skipped last, once a consumer's deadline passed without a newer frame
+void SwapChainProcessor::ExportSkippedFrame()
+{
+    m_Decimation.ShouldKeep(m_Clock.Now());
+
+    // Its damage is already recorded in the exporter
+    HRESULT hr = m_State->Exporter->ExportFrame(*m_Device, m_SkippedSurface.Get(), m_SkippedTimes, std::vector<RECT>(), false);
+    (SUCCEEDED(hr) ? m_State->FramesExported : m_State->ExportFailures).fetch_add(1, std::memory_order_relaxed);
+    if (SUCCEEDED(hr))
+    {
+        m_State->FramesDecimated.fetch_sub(1, std::memory_order_relaxed);
+    }
+    m_SkippedSurface.Reset();
+}
+
+// Hands the cursor last published by the monitor's cursor thread to the exporter for compositing
+void SwapChainProcessor::SyncCursor()
+{
+    if (!m_State->Exporter || !m_State->Exporter->IsCompositingCursor() || m_State->CursorGeneration() == m_CursorGeneration)
+    {
+        return;
+    }
+
+    CursorSnapshot Cursor;
+    m_CursorGeneration = m_State->GetCursor(Cursor);
+    m_State->Exporter->SetCursor(Cursor);
+}
+
+// Follows the HDR metadata the OS set for the monitor with the peak the exporter tone maps from
+void SwapChainProcessor::SyncHdrMetadata()
+{
+    if (!m_State->Exporter || !m_State->Exporter->IsToneMapping() || m_State->HdrMetadataGeneration() == m_HdrMetadataGeneration)
+    {
+        return;
+    }
+
+    VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT Metadata = {};
+    m_HdrMetadataGeneration = m_State->GetHdrMetadata(Metadata);
+    m_State->Exporter->SetToneMapPeak(ToneMapPeakNits(Metadata));
+}
+
+// Hands the gamma ramp the OS last set for the monitor to the exporter
+void SwapChainProcessor::SyncGammaRamp()
+{
+    if (!m_State->Exporter || m_State->GammaRampGeneration() == m_GammaRampGeneration)
+    {
+        return;
+    }
+
+    std::shared_ptr<const GAMMA_RAMP> Ramp;
+    m_GammaRampGeneration = m_State->GetGammaRamp(Ramp);
+    m_State->Exporter->SetGammaRamp(std::move(Ramp));
+}
+
+// Housekeeping while no buffer is available. Returns how long the caller may wait for the next one. With UseTimer the
+// deadline timer is armed for the next vblank if possible, TimerArmed tells whether it has to be waited on as well.
+DWORD SwapChainProcessor::PrepareIdleWait(bool UseTimer, bool& TimerArmed)
+{
+    auto Refresh = m_State->GetCommittedRefresh();
+    m_Pacer.SetRefreshRate(Refresh.Numerator, Refresh.Denominator);
+
+    DWORD Timeout = INFINITE;
+    TimerArmed = UseTimer && ArmDeadlineTimer();
+    if (!TimerArmed)
+    {
+        Timeout = m_Pacer.TimeUntilDeadlineMs();
+    }
+
+    if (m_State->Exporter)
+    {
+        // A consumer's deadline may pass before the next frame arrives, it then gets the newest skipped one
+        if (m_SkippedSurface)
+        {
+            UpdateDecimation();
+            UINT64 Now = m_Clock.Now();
+            if (!m_Decimation.IsEnabled() || m_Decimation.IsOverdue(Now))
+            {
+                ExportSkippedFrame();
+            }
+            else
+            {
+                UINT64 Ticks = m_Decimation.TimeUntilOverdue(Now);
+                Timeout = (std::min)(Timeout, (DWORD)(std::min)((Ticks * 1000 + m_ClockFrequency - 1) / m_ClockFrequency, (UINT64)INFINITE - 1));
+            }
+        }
+
+        // Readbacks have no wait handle, keep polling while copies are in flight so the last frame before
+        // an idle period doesn't get stuck in staging
+        m_State->Exporter->Flush();
+        UINT Pending = m_State->Exporter->PendingFrames();
+        m_State->PendingDepth.store(Pending, std::memory_order_relaxed);
+        if (Pending && Timeout > 1)
+        {
+            Timeout = 1;
+        }
+
+        Timeout = (std::min)(Timeout, m_State->Exporter->PollPreview(m_Clock.Now()));
+
+        // A cursor that moved over an idle desktop is republished on the last frame, while copies are in flight
+        // the next published frame picks it up instead
+        SyncCursor();
+        m_State->Exporter->PublishCursor(m_Clock.Now());
+
+        // Nothing new arrived for a while, give the consumers the last frame again to refine. A skipped frame
+        // still waiting for its deadline is newer than the last exported one, so it isn't refined.
+        if (!Pending && !m_SkippedSurface && m_IdleRefresh.ShouldRefresh())
+        {
+            if (SUCCEEDED(m_State->Exporter->RefreshLastFrame(m_Clock.Now())))
+            {
+                m_State->FramesRefined.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_IdleRefresh.OnRefresh();
+        }
+
+        Timeout = (std::min)(Timeout, (DWORD)m_IdleRefresh.TimeUntilRefreshMs());
+    }
+
+    return Timeout;
+}
+
+// Runs on the monitor's strand, one frame per job so that the worker is shared fairly between monitors
+void SwapChainProcessor::RunPooled()
+{
+    if (m_Terminating.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    HRESULT hr = ProcessNextFrame();
+    if (SUCCEEDED(hr))
+    {
+        m_Strand->Post([this] { RunPooled(); });
+    }
+    else if (hr == E_PENDING)
+    {
+        bool TimerArmed;
+        DWORD Timeout = PrepareIdleWait(false, TimerArmed);
+
+        // The millisecond timeout is rounded up, wake up right at the vblank instead when it comes first
+        UINT64 Deadline = m_Pacer.TimeUntilDeadline() * 10000000 / m_ClockFrequency;
+        UINT64 Relative = (std::max)((std::min)((UINT64)Timeout * 10000, Deadline), 1ULL);
+
+        ULARGE_INTEGER DueTime;
+        DueTime.QuadPart = (ULONGLONG)-(LONGLONG)Relative;
+        FILETIME Due = { DueTime.LowPart, DueTime.HighPart };
+        SetThreadpoolWait(m_BufferWait, m_hAvailableBufferEvent, &Due);
+    }
+    else
+    {
+        // Same as the end of Run(), the OS provides a new swap-chain if necessary
+        m_Terminating.store(true, std::memory_order_release);
+        WdfObjectDelete((WDFOBJECT)m_hSwapChain);
+        m_hSwapChain = nullptr;
+    }
+}
+
+VOID CALLBACK SwapChainProcessor::BufferWaitCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult)
+{
+    UNREFERENCED_PARAMETER(Instance);
+    UNREFERENCED_PARAMETER(Wait);
+
+    auto* pThis = reinterpret_cast<SwapChainProcessor*>(Context);
+    bool NewSurface = WaitResult == WAIT_OBJECT_0;
+    // The pacer belongs to the strand, only the time of the timeout is taken here
+    UINT64 Now = pThis->m_Clock.Now();
+
+    pThis->m_Strand->Post([pThis, NewSurface, Now]
+    {
+        pThis->m_Pacer.OnWake(NewSurface ? PACER_WAKE_NEW_SURFACE : pThis->m_Pacer.TimeoutReason(Now));
+        pThis->RunPooled();
+    });
+}
+#pragma endregion
+
+#pragma region CursorProcessor
+
+CursorProcessor::CursorProcessor(IDDCX_MONITOR hMonitor, const GUID& MonitorGuid, shared_ptr<MonitorFrameState> State) :
+    m_hMonitor(hMonitor),
+    m_State(State)
+{
+    m_Shape.resize(SUVDA_CURSOR_SHAPE_BUFFER_SIZE);
+
+    CreatePlane(MonitorGuid);
+
+    m_hCursorEvent.Attach(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    m_hTerminateEvent.Attach(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    m_hThread.Attach(CreateThread(nullptr, 0, RunThread, this, 0, nullptr));
+}
+
+CursorProcessor::~CursorProcessor()
+{
+    // Alert the cursor thread to terminate
+    SetEvent(m_hTerminateEvent.Get());
+
+    if (m_hThread.Get())
+    {
+        WaitForSingleObject(m_hThread.Get(), INFINITE);
+    }
+
+    if (m_pView)
+    {
+        UnmapViewOfFile(m_pView);
+    }
+}
+
+// Shares the plane like the frame rings, a section the consumers map read-only plus an event. Without a section the
+// plane lives in the driver's heap and is only served through IOCTL_GET_CURSOR.
+void CursorProcessor::CreatePlane(const GUID& MonitorGuid)
+{
+    wchar_t guidString[40] = {};
+    StringFromGUID2(MonitorGuid, guidString, ARRAYSIZE(guidString));
+
+    PSECURITY_DESCRIPTOR pSecurityDescriptor = nullptr;
+    if (ConvertStringSecurityDescriptorToSecurityDescriptorW(FRAME_EXPORT_SDDL, SDDL_REVISION_1, &pSecurityDescriptor, nullptr))
+    {
+        SECURITY_ATTRIBUTES SecurityAttributes = {};
+        SecurityAttributes.nLength = sizeof(SecurityAttributes);
+        SecurityAttributes.lpSecurityDescriptor = pSecurityDescriptor;
+
+        m_EventName = wstring(L"Global\\SudoVDA.CursorEvent.") + guidString;
+        m_hUpdateEvent.Attach(CreateEventW(&SecurityAttributes, FALSE, FALSE, m_EventName.c_str()));
+
+        m_MappingName = wstring(L"Global\\SudoVDA.Cursor.") + guidString;
+        m_hMapping.Attach(CreateFileMappingW(INVALID_HANDLE_VALUE, &SecurityAttributes, PAGE_READWRITE, 0, sizeof(SUVDA_CURSOR_PLANE), m_MappingName.c_str()));
+        if (m_hMapping.IsValid())
+        {
+            m_pView = MapViewOfFile(m_hMapping.Get(), FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        }
+
+        LocalFree(pSecurityDescriptor);
+    }
+
+    void* pPlane = m_pView;
+    if (!pPlane)
+    {
+        m_hMapping.Close();
+        m_pPrivatePlane.reset(new SUVDA_CURSOR_PLANE);
+        pPlane = m_pPrivatePlane.get();
+    }
+
+    m_Writer.Initialize(pPlane, sizeof(SUVDA_CURSOR_PLANE));
+    m_Reader.Attach(pPlane, sizeof(SUVDA_CURSOR_PLANE));
+}
+
+NTSTATUS CursorProcessor::SetupHardwareCursor()
+{
+    IDDCX_CURSOR_CAPS cursorInfo = {};
+    cursorInfo.Size = sizeof(cursorInfo);
+    cursorInfo.ColorXorCursorSupport = IDDCX_XOR_CURSOR_SUPPORT_FULL; // Decoded by DecodeCursorShape()
+    cursorInfo.AlphaCursorSupport = true;
+    cursorInfo.MaxX = SUVDA_CURSOR_MAX_SIZE; // Larger shapes are drawn into the frames by the OS
+    cursorInfo.MaxY = SUVDA_CURSOR_MAX_SIZE;
+
+    IDARG_IN_SETUP_HWCURSOR hwCursor = {};
+    hwCursor.CursorInfo = cursorInfo;
+    hwCursor.hNewCursorDataAvailable = m_hCursorEvent.Get(); // Signaled by the OS whenever the cursor changes
+
+    return IddCxMonitorSetupHardwareCursor(m_hMonitor, &hwCursor);
+}
+
+DWORD CALLBACK CursorProcessor::RunThread(LPVOID Argument)
+{
+    reinterpret_cast<CursorProcessor*>(Argument)->Run();
+    return 0;
+}
+
+void CursorProcessor::Run()
+{
+    // Cursor updates are latency sensitive but tiny, the same class as the swap-chain thread
+    DWORD AvTask = 0;
+    HANDLE AvTaskHandle = AvSetMmThreadCharacteristicsW(L"Distribution", &AvTask);
+
+    HANDLE WaitHandles[] = { m_hCursorEvent.Get(), m_hTerminateEvent.Get() };
+    for (;;)
+    {
+        if (WaitForMultipleObjects(ARRAYSIZE(WaitHandles), WaitHandles, FALSE, INFINITE) != WAIT_OBJECT_0)
+        {
+            break;
+        }
+
+        // A burst of moves is published at most once per refresh period, nobody sees the cursor more often
+        // than that. The moves that come in meanwhile are picked up by the single query afterwards.
+        UINT64 Now = m_Clock.Now();
+        if (Now < m_NextUpdate)
+        {
+            DWORD Delay = (DWORD)((m_NextUpdate - Now) * 1000 / m_Clock.Frequency());
+            if (Delay && WaitForSingleObject(m_hTerminateEvent.Get(), Delay) == WAIT_OBJECT_0)
+            {
+                break;
+            }
+        }
+
+        Update();
+    }
+
+    if (AvTaskHandle)
+    {
+        AvRevertMmThreadCharacteristics(AvTaskHandle);
+    }
+}
+
+void CursorProcessor::Update()
+{
+    IDARG_IN_QUERY_HWCURSOR QueryIn = {};
+    QueryIn.LastShapeId = m_Cursor.ShapeId;
+    QueryIn.ShapeBufferSizeInBytes = (UINT)m_Shape.size();
+    QueryIn.pShapeBuffer = m_Shape.data();
+
+    IDARG_OUT_QUERY_HWCURSOR QueryOut = {};
+    UINT64 Qpc = m_Clock.Now();
+    if (FAILED(IddCxMonitorQueryHardwareCursor(m_hMonitor, &QueryIn, &QueryOut)))
+    {
+        return;
+    }
+
+    auto Refresh = m_State->GetCommittedRefresh();
+    UINT64 Period = (Refresh.Numerator && Refresh.Denominator) ?
+        m_Clock.Frequency() * Refresh.Denominator / Refresh.Numerator : m_Clock.Frequency() / 60;
+    m_NextUpdate = Qpc + Period;
+
+    // The shape's bytes are only written to the plane when the OS handed us a new one
+    const BYTE* pShape = nullptr;
+    if (QueryOut.IsCursorShapeUpdated)
+    {
+        auto& Info = QueryOut.CursorShapeInfo;
+        pShape = m_Shape.data();
+        m_Published.ShapeId = Info.ShapeId;
+        m_Published.ShapeType = Info.CursorType;
+        m_Published.Width = Info.Width;
+        m_Published.Height = Info.Height;
+        m_Published.Pitch = Info.Pitch;
+        m_Published.HotX = Info.XHot;
+        m_Published.HotY = Info.YHot;
+        m_Published.ShapeSize = (std::min)(Info.Pitch * Info.Height, (UINT)SUVDA_CURSOR_SHAPE_BUFFER_SIZE);
+
+        m_Cursor.ShapeId = Info.ShapeId;
+        m_Cursor.Image.reset();
+
+        // Only decoded when it is composited, consumers decode the exported shape themselves
+        if (m_State->Exporter && m_State->Exporter->IsCompositingCursor())
+        {
+            auto Image = make_shared<SUVDA_CURSOR_IMAGE>();
+            if (DecodeCursorShape(Info.CursorType, m_Shape.data(), Info.Pitch, Info.Width, Info.Height, *Image))
+            {
+                m_Cursor.Image = Image;
+            }
+        }
+    }
+
+    m_Published.UpdateQpc = Qpc;
+    m_Published.Visible = QueryOut.IsCursorVisible;
+    m_Published.X = QueryOut.X;
+    m_Published.Y = QueryOut.Y;
+
+    m_Writer.Publish(m_Published, pShape);
+    if (m_hUpdateEvent.IsValid())
+    {
+        SetEvent(m_hUpdateEvent.Get());
+    }
+
+    m_Cursor.Visible = !!QueryOut.IsCursorVisible;
+    m_Cursor.X = QueryOut.X;
+    m_Cursor.Y = QueryOut.Y;
+    if (m_State->Exporter && m_State->Exporter->IsCompositingCursor())
+    {
+        m_State->SetCursor(m_Cursor);
+    }
+}
+
+void CursorProcessor::GetCursor(UINT LastShapeId, VIRTUAL_DISPLAY_GET_CURSOR_OUT& Cursor)
+{
+    static_assert(SUVDA_CURSOR_SHAPE_BUFFER_SIZE == sizeof(SUVDA_CURSOR_PLANE::Shape), "The IOCTL must hold the largest cursor");
+
+    // IOCTLs may come in on several threads, each read gets a reader of its own
+    CursorPlaneReader Reader = m_Reader;
+    SUVDA_CURSOR_STATE State;
+    bool ShapeCopied = false;
+    if (!Reader.Read(LastShapeId, State, Cursor.Shape, ShapeCopied))
+    {
+        State = {};
+    }
+
+    Cursor.Visible = State.Visible;
+    Cursor.X = State.X;
+    Cursor.Y = State.Y;
+    Cursor.ShapeId = State.ShapeId;
+    Cursor.ShapeType = State.ShapeType;
+    Cursor.Width = State.Width;
+    Cursor.Height = State.Height;
+    Cursor.Pitch = State.Pitch;
+    Cursor.HotX = State.HotX;
+    Cursor.HotY = State.HotY;
+    Cursor.ShapeSize = ShapeCopied ? State.ShapeSize : 0;
+}
+
+HRESULT CursorProcessor::GetPlaneInfo(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info)
+{
+    if (!m_pView)
+    {
+        return E_NOTIMPL;
+    }
+
+    Info = {};
+    wcsncpy_s(Info.MappingName, m_MappingName.c_str(), _TRUNCATE);
+    wcsncpy_s(Info.EventName, m_EventName.c_str(), _TRUNCATE);
+    Info.MappingSize = sizeof(SUVDA_CURSOR_PLANE);
+
+    return S_OK;
+}
+
+#pragma endregion
+
+#pragma region IndirectDeviceContext
+
+IndirectDeviceContext::IndirectDeviceContext(_In_ WDFDEVICE WdfDevice) :
+    m_WdfDevice(WdfDevice)
+{
+    m_Adapter = {};
+    for (size_t i = 0; i < MaxVirtualMonitorCount; i++)
+    {
+        freeConnectorSlots.push(i);
+    }
+}
+
+IndirectDeviceContext::~IndirectDeviceContext()
+{
+}
+
+void IndirectDeviceContext::InitAdapter()
+{
+    // ==============================
+    // TODO: Update the below diagnostic information in accordance with the target hardware. The strings and version
+    // numbers are used for telemetry and may be displayed to the user in some situations.
+    //
+    // This is also where static per-adapter capabilities are determined.
+    // ==============================
+
+    IDDCX_ADAPTER_CAPS AdapterCaps = {};
+    AdapterCaps.Size = sizeof(AdapterCaps);
+
+    if (IDD_IS_FUNCTION_AVAILABLE(IddCxSwapChainReleaseAndAcquireBuffer2))
+    {
+        AdapterCaps.Flags = IDDCX_ADAPTER_FLAGS_CAN_PROCESS_FP16;
+    }
+
+    // Declare basic feature support for the adapter (required)
+    AdapterCaps.MaxMonitorsSupported = MaxVirtualMonitorCount;
+    AdapterCaps.EndPointDiagnostics.Size = sizeof(AdapterCaps.EndPointDiagnostics);
+    AdapterCaps.EndPointDiagnostics.GammaSupport = IDDCX_FEATURE_IMPLEMENTATION_SOFTWARE;
+    AdapterCaps.EndPointDiagnostics.TransmissionType = IDDCX_TRANSMISSION_TYPE_WIRED_OTHER;
+
+    // Declare your device strings for telemetry (required)
+    AdapterCaps.EndPointDiagnostics.pEndPointFriendlyName = L"SudoMaker Virtual Display Adapter";
+    AdapterCaps.EndPointDiagnostics.pEndPointManufacturerName = L"SudoMaker";
+    AdapterCaps.EndPointDiagnostics.pEndPointModelName = L"SudoVDA";
+
+    // Declare your hardware and firmware versions (required)
+    IDDCX_ENDPOINT_VERSION Version = {};
+    Version.Size = sizeof(Version);
+    Version.MajorVer = 1;
+    AdapterCaps.EndPointDiagnostics.pFirmwareVersion = &Version;
+    AdapterCaps.EndPointDiagnostics.pHardwareVersion = &Version;
+
+    // Initialize a WDF context that can store a pointer to the device context object
+    WDF_OBJECT_ATTRIBUTES Attr;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attr, IndirectDeviceContextWrapper);
+
+    IDARG_IN_ADAPTER_INIT AdapterInit = {};
+    AdapterInit.WdfDevice = m_WdfDevice;
+    AdapterInit.pCaps = &AdapterCaps;
+    AdapterInit.ObjectAttributes = &Attr;
+
+    // Start the initialization of the adapter, which will trigger the AdapterFinishInit callback later
+    IDARG_OUT_ADAPTER_INIT AdapterInitOut;
+    NTSTATUS Status = IddCxAdapterInitAsync(&AdapterInit, &AdapterInitOut);
+
+    if (NT_SUCCESS(Status))
+    {
+        // Store a reference to the WDF adapter handle
+        m_Adapter = AdapterInitOut.AdapterObject;
+
+        // Store the device context object into the WDF object context
+        auto* pContext = WdfObjectGet_IndirectDeviceContextWrapper(AdapterInitOut.AdapterObject);
+        pContext->pContext = this;
+    }
+}
+
+void IndirectDeviceContext::SetRenderAdapter(const LUID& AdapterLuid)
+{
+    IDARG_IN_ADAPTERSETRENDERADAPTER inArgs{AdapterLuid};
+    IddCxAdapterSetRenderAdapter(m_Adapter, &inArgs);
+}
+
+NTSTATUS IndirectDeviceContext::CreateMonitor(IndirectMonitorContext*& pMonitorContext, uint8_t* edidData, const GUID& containerId, const VirtualMonitorMode& preferredMode)
+{
+    // ==============================
+    // TODO: In a real driver, the EDID should be retrieved dynamically from a connected physical monitor. The EDIDs
+    // provided here are purely for demonstration.
+    // Monitor manufacturers are required to correctly fill in physical monitor attributes in order to allow the OS
+    // to optimize settings like viewing distance and scale factor. Manufacturers should also use a unique serial
+    // number every single device to ensure the OS can tell the monitors apart.
+    // ==============================
+
+    WDF_OBJECT_ATTRIBUTES Attr;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&Attr, IndirectMonitorContextWrapper);
+
+    // In the sample driver, we report a monitor right away but a real driver would do this when a monitor connection event occurs
+    IDDCX_MONITOR_INFO MonitorInfo = {};
+    MonitorInfo.Size = sizeof(MonitorInfo);
+    MonitorInfo.MonitorType = DISPLAYCONFIG_OUTPUT_TECHNOLOGY_HDMI;
+    MonitorInfo.ConnectorIndex = (UINT)freeConnectorSlots.front();
+
+    MonitorInfo.MonitorDescription.Size = sizeof(MonitorInfo.MonitorDescription);
+    MonitorInfo.MonitorDescription.Type = IDDCX_MONITOR_DESCRIPTION_TYPE_EDID;
+    MonitorInfo.MonitorDescription.DataSize = sizeof(edid_base);
+    MonitorInfo.MonitorDescription.pData = edidData;
+    MonitorInfo.MonitorContainerId = containerId;
+
+    IDARG_IN_MONITORCREATE MonitorCreate = {};
+    MonitorCreate.ObjectAttributes = &Attr;
+    MonitorCreate.pMonitorInfo = &MonitorInfo;
+
+    // Create a monitor object with the specified monitor descriptor
+    IDARG_OUT_MONITORCREATE MonitorCreateOut;
+    NTSTATUS Status = IddCxMonitorCreate(m_Adapter, &MonitorCreate, &MonitorCreateOut);
+    if (NT_SUCCESS(Status))
+    {
+        freeConnectorSlots.pop();
+        // Create a new monitor context object and attach it to the Idd monitor object
+        auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorCreateOut.MonitorObject);
+        pMonitorContext = new IndirectMonitorContext(MonitorCreateOut.MonitorObject);
+        pMonitorContextWrapper->pContext = pMonitorContext;
+
+        pMonitorContext->monitorGuid = containerId;
+        pMonitorContext->connectorId = MonitorInfo.ConnectorIndex;
+        pMonitorContext->pEdidData = edidData;
+        pMonitorContext->preferredMode = preferredMode;
+        pMonitorContext->m_Adapter = m_Adapter;
+        pMonitorContext->CacheModes();
+
+        if (FrameExportSlots)
+        {
+            pMonitorContext->GetFrameState()->Exporter.reset(new FrameExporter(containerId, FrameExportSlots, FrameDuplicateDetection, FramePreviewScale, FramePreviewFps, CursorCompositing, HdrToneMapping, GetSharedWorkerPool()));
+        }
+
+        // Tell the OS that the monitor has been plugged in
+        IDARG_OUT_MONITORARRIVAL ArrivalOut;
+        Status = IddCxMonitorArrival(MonitorCreateOut.MonitorObject, &ArrivalOut);
+        if (NT_SUCCESS(Status))
+        {
+            pMonitorContext->adapterLuid = ArrivalOut.OsAdapterLuid;
+            pMonitorContext->targetId = ArrivalOut.OsTargetId;
+        }
+    }
+    else
+    {
+        // Avoid memory leak
+        free(edidData);
+    }
+
+    return Status;
+}
+
+IndirectMonitorContext::IndirectMonitorContext(_In_ IDDCX_MONITOR Monitor) :
+    m_Monitor(Monitor), m_FrameState(make_shared<MonitorFrameState>())
+{
+    // Store context for later use
+    monitorCtxList.emplace_back(this);
+}
+
+IndirectMonitorContext::~IndirectMonitorContext()
+{
+    m_ProcessingThread.reset();
+    m_CursorProcessor.reset();
+    ForgetModes();
+    if (pEdidData && pEdidData != edid_base)
+    {
+        free(pEdidData);
+    }
+}
+
+IDDCX_MONITOR IndirectMonitorContext::GetMonitor() const
+{
+    return m_Monitor;
+}
+
+MonitorFrameState* IndirectMonitorContext::GetFrameState() const
+{
+    return m_FrameState.get();
+}
+
+CursorProcessor* IndirectMonitorContext::GetCursorProcessor() const
+{
+    return m_CursorProcessor.get();
+}
+
+void IndirectMonitorContext::CacheModes()
+{
+    MODE_SPEC Preferred = { preferredMode.Width, preferredMode.Height, preferredMode.VSync };
+    FRACTION DoubleVSync = MultiplyFraction(Preferred.VSync, 2, 1);
+    vector<MODE_TIMING> Timings;
+    auto Modes = make_shared<MonitorModes>();
+
+    // Target modes are the modes supported for frame processing and scan-out. The OS reports the available set of
+    // modes for a given output as the intersection of monitor modes with target modes. Every scaled preferred mode is
+    // offered at twice its refresh rate as well.
+    Modes->PreferredIndex = BuildMonitorModes(defaultModeList, Preferred, DoubleVSync, Timings);
+    for (auto& Timing : Timings)
+    {
+        if (isHDRSupported)
+        {
+            Modes->Target2.push_back(CreateIddCxTargetMode2(Timing));
+        }
+        else
+        {
+            Modes->Target.push_back(CreateIddCxTargetMode(Timing));
+        }
+    }
+
+    // The monitor description has the same modes, except that the newer description callback has always repeated
+    // the preferred refresh rate instead of doubling it. The older one reuses the target timings as they are.
+    if (isHDRSupported)
+    {
+        BuildMonitorModes(defaultModeList, Preferred, Preferred.VSync, Timings);
+    }
+    for (auto& Timing : Timings)
+    {
+        if (isHDRSupported)
+        {
+            Modes->Description2.push_back(CreateIddCxMonitorMode2(Timing, IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR));
+        }
+        else
+        {
+            Modes->Description.push_back(CreateIddCxMonitorMode(Timing, IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR));
+        }
+    }
+
+    m_Modes = Modes;
+    monitorEdidIndex.Insert(pEdidData, sizeof(edid_base), m_Modes);
+}
+
+void IndirectMonitorContext::ForgetModes()
+{
+    if (m_Modes)
+    {
+        monitorEdidIndex.Remove(pEdidData, sizeof(edid_base), m_Modes.get());
+    }
+}
+
+const MonitorModes& IndirectMonitorContext::GetModes() const
+{
+    return *m_Modes;
+}
+
+void IndirectMonitorContext::AssignSwapChain(const IDDCX_MONITOR& MonitorObject, const IDDCX_SWAPCHAIN& SwapChain, const LUID& RenderAdapter, const HANDLE& NewFrameEvent)
+{
+    QpcClock Clock;
+    bool Rearm = m_ProcessingThread && m_ProcessingThread->CanRearm();
+    UINT64 AssignId = m_FrameState->BeginAssignment(Clock.Now(), Rearm);
+
+    // A processing thread of its own only lets go of the previous swap-chain and waits for the new one
+    if (Rearm)
+    {
+        m_ProcessingThread->Release();
+    }
+    else
+    {
+        m_ProcessingThread.reset();
+    }
+    m_FrameState->MarkAssignPhase(AssignId, ASSIGN_PHASE_RELEASE, Clock.Now());
+
+    // Monitors rendered by the same adapter share its device, so only the first assignment creates one
+    auto Device = GetDeviceCache().Acquire(AdapterLuidKey(RenderAdapter));
+    if (!Device)
+    {
+        // It's important to delete the swap-chain if D3D initialization fails, so that the OS knows to generate a new
+        // swap-chain and try again.
+        WdfObjectDelete(SwapChain);
+    }
+    else
+    {
+        m_FrameState->MarkAssignPhase(AssignId, ASSIGN_PHASE_DEVICE, Clock.Now());
+
+        // Re-arm the parked thread, or create a new swap-chain processing thread or a strand on the shared pool
+        if (!Rearm || !m_ProcessingThread->Rearm(SwapChain, Device, NewFrameEvent, AssignId))
+        {
+            m_ProcessingThread.reset(new SwapChainProcessor(SwapChain, Device, NewFrameEvent, AssignId, m_FrameState, GetSharedWorkerPool()));
+        }
+
+        // The cursor thread and its plane outlive the swap-chain, every new swap-chain only needs the cursor set up again
+        if (!m_CursorProcessor)
+        {
+            m_CursorProcessor.reset(new CursorProcessor(MonitorObject, monitorGuid, m_FrameState));
+        }
+
+        // If this fails the OS keeps drawing the cursor into the frames, which is all we can fall back to
+        m_CursorProcessor->SetupHardwareCursor();
+    }
+}
+
+void IndirectMonitorContext::UnassignSwapChain()
+{
+    // Stop processing the last swap-chain, a thread of its own stays parked for the next one
+    if (m_ProcessingThread && m_ProcessingThread->CanRearm())
+    {
+        m_ProcessingThread->Release();
+    }
+    else
+    {
+        m_ProcessingThread.reset();
+    }
+}
+
+#pragma endregion
+
+#pragma region DDI Callbacks
+
+void IndirectDeviceContext::_TestCreateMonitor()
+{
+    auto connectorIndex = freeConnectorSlots.front();
+    std::string idx = std::to_string(connectorIndex);
+    std::string serialStr = "VDD2408";
+    serialStr += idx;
+    std::string dispName = "SudoVDD #";
+    dispName += idx;
+    GUID containerId;
+    CoCreateGuid(&containerId);
+    uint8_t* edidData = generate_edid(containerId.Data1, serialStr.c_str(), dispName.c_str());
+
+    VirtualMonitorMode mode{3000 + (DWORD)connectorIndex * 2, 2120 + (DWORD)connectorIndex, RefreshRateFromMillihertz(120 + (DWORD)connectorIndex)};
+
+    IndirectMonitorContext* pContext;
+    CreateMonitor(pContext, edidData, containerId, mode);
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAAdapterInitFinished(IDDCX_ADAPTER AdapterObject, const IDARG_IN_ADAPTER_INIT_FINISHED* pInArgs)
+{
+    // UNREFERENCED_PARAMETER(AdapterObject);
+    // UNREFERENCED_PARAMETER(pInArgs);
+
+    if (NT_SUCCESS(pInArgs->AdapterInitStatus))
+    {
+        if (preferredAdapterChanged)
+        {
+            IDARG_IN_ADAPTERSETRENDERADAPTER inArgs{preferredAdapterLuid};
+            IddCxAdapterSetRenderAdapter(AdapterObject, &inArgs);
+            preferredAdapterChanged = false;
+        }
+    }
+
+    if (testMode)
+    {
+        auto* pDeviceContextWrapper = WdfObjectGet_IndirectDeviceContextWrapper(AdapterObject);
+        if (NT_SUCCESS(pInArgs->AdapterInitStatus))
+        {
+            for (size_t i = 0; i < 3; i++)
+            {
+                pDeviceContextWrapper->pContext->_TestCreateMonitor();
+            }
+        }
+    }
+
+    // return STATUS_SUCCESS;
+    return pInArgs->AdapterInitStatus;
+}
+
+// Remembers the refresh rate of every committed path so the swap-chain threads can pace themselves to its vblank
+template<typename TPath>
+static void CommitPathRefreshRates(UINT PathCount, const TPath* pPaths)
+{
+    for (UINT i = 0; i < PathCount; i++)
+    {
+        if (!pPaths[i].MonitorObject)
+        {
+            continue;
+        }
+
+        auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(pPaths[i].MonitorObject);
+        if (!pMonitorContextWrapper || !pMonitorContextWrapper->pContext)
+        {
+            continue;
+        }
+
+        // Any path not active is inactive (e.g. the monitor should be turned off)
+        DISPLAYCONFIG_RATIONAL Rate = {};
+        if (pPaths[i].Flags & IDDCX_PATH_FLAGS_ACTIVE)
+        {
+            Rate = pPaths[i].TargetVideoSignalInfo.vSyncFreq;
+        }
+
+        pMonitorContextWrapper->pContext->GetFrameState()->SetCommittedRefresh(Rate);
+    }
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAAdapterCommitModes(IDDCX_ADAPTER AdapterObject, const IDARG_IN_COMMITMODES* pInArgs)
+{
+    UNREFERENCED_PARAMETER(AdapterObject);
+
+    // The swap-chain itself is taken care of by IddCx
+    CommitPathRefreshRates(pInArgs->PathCount, pInArgs->pPaths);
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAAdapterCommitModes2(
+    IDDCX_ADAPTER AdapterObject,
+    const IDARG_IN_COMMITMODES2* pInArgs
+)
+{
+    UNREFERENCED_PARAMETER(AdapterObject);
+
+    CommitPathRefreshRates(pInArgs->PathCount, pInArgs->pPaths);
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAParseMonitorDescription(const IDARG_IN_PARSEMONITORDESCRIPTION* pInArgs, IDARG_OUT_PARSEMONITORDESCRIPTION* pOutArgs)
+{
+    // ==============================
+    // TODO: In a real driver, this function would be called to generate monitor modes for an EDID by parsing it. In
+    // this sample driver, we hard-code the EDID, so this function can generate known modes.
+    // ==============================
+
+    if (pInArgs->MonitorDescription.DataSize != sizeof(edid_base))
+        return STATUS_INVALID_PARAMETER;
+
+    // Our monitors' modes were built when they were created, an EDID that isn't ours gets the defaults. The index is
+    // read without locking, this runs while the monitor's creator holds monitorListOp.
+    auto Modes = monitorEdidIndex.Find((const uint8_t*)pInArgs->MonitorDescription.pData, pInArgs->MonitorDescription.DataSize);
+    pOutArgs->MonitorModeBufferOutputCount = Modes ? (UINT)Modes->Description.size() : (UINT)defaultModeList.Count();
+
+    if (pInArgs->MonitorModeBufferInputCount < pOutArgs->MonitorModeBufferOutputCount)
+    {
+        // Return success if there was no buffer, since the caller was only asking for a count of modes
+        return (pInArgs->MonitorModeBufferInputCount > 0) ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+    }
+
+    if (Modes)
+    {
+        copy(Modes->Description.begin(), Modes->Description.end(), pInArgs->pMonitorModes);
+        pOutArgs->PreferredMonitorModeIdx = Modes->PreferredIndex;
+    }
+    else
+    {
+        const MODE_TIMING* pDefaults = defaultModeList.Timings();
+        for (size_t ModeIndex = 0; ModeIndex < defaultModeList.Count(); ModeIndex++)
+        {
+            pInArgs->pMonitorModes[ModeIndex] = CreateIddCxMonitorMode(pDefaults[ModeIndex], IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR);
+        }
+        pOutArgs->PreferredMonitorModeIdx = defaultModeList.PreferredIndex();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAParseMonitorDescription2(
+    const IDARG_IN_PARSEMONITORDESCRIPTION2* pInArgs,
+    IDARG_OUT_PARSEMONITORDESCRIPTION* pOutArgs
+)
+{
+    if (pInArgs->MonitorDescription.DataSize != sizeof(edid_base))
+        return STATUS_INVALID_PARAMETER;
+
+    auto Modes = monitorEdidIndex.Find((const uint8_t*)pInArgs->MonitorDescription.pData, pInArgs->MonitorDescription.DataSize);
+    pOutArgs->MonitorModeBufferOutputCount = Modes ? (UINT)Modes->Description2.size() : (UINT)defaultModeList.Count();
+
+    if (pInArgs->MonitorModeBufferInputCount < pOutArgs->MonitorModeBufferOutputCount)
+    {
+        // Return success if there was no buffer, since the caller was only asking for a count of modes
+        return (pInArgs->MonitorModeBufferInputCount > 0) ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+    }
+
+    if (Modes)
+    {
+        copy(Modes->Description2.begin(), Modes->Description2.end(), pInArgs->pMonitorModes);
+        pOutArgs->PreferredMonitorModeIdx = Modes->PreferredIndex;
+    }
+    else
+    {
+        const MODE_TIMING* pDefaults = defaultModeList.Timings();
+        for (size_t ModeIndex = 0; ModeIndex < defaultModeList.Count(); ModeIndex++)
+        {
+            pInArgs->pMonitorModes[ModeIndex] = CreateIddCxMonitorMode2(pDefaults[ModeIndex], IDDCX_MONITOR_MODE_ORIGIN_MONITORDESCRIPTOR);
+        }
+        pOutArgs->PreferredMonitorModeIdx = defaultModeList.PreferredIndex();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorGetDefaultModes(IDDCX_MONITOR MonitorObject, const IDARG_IN_GETDEFAULTDESCRIPTIONMODES* pInArgs, IDARG_OUT_GETDEFAULTDESCRIPTIONMODES* pOutArgs)
+{
+    // ==============================
+    // TODO: In a real driver, this function would be called to generate monitor modes for a monitor with no EDID.
+    // Drivers should report modes that are guaranteed to be supported by the transport protocol and by nearly all
+    // monitors (such 640x480, 800x600, or 1024x768). If the driver has access to monitor modes from a descriptor other
+    // than an EDID, those modes would also be reported here.
+    // ==============================
+
+    UNREFERENCED_PARAMETER(MonitorObject);
+
+    pOutArgs->DefaultMonitorModeBufferOutputCount = (UINT)defaultModeList.Count();
+    pOutArgs->PreferredMonitorModeIdx = defaultModeList.PreferredIndex();
+
+    if (pInArgs->DefaultMonitorModeBufferInputCount == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+    else if (pInArgs->DefaultMonitorModeBufferInputCount < pOutArgs->DefaultMonitorModeBufferOutputCount)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    const MODE_TIMING* pDefaults = defaultModeList.Timings();
+    for (size_t ModeIndex = 0; ModeIndex < defaultModeList.Count(); ModeIndex++)
+    {
+        pInArgs->pDefaultMonitorModes[ModeIndex] = CreateIddCxMonitorMode(pDefaults[ModeIndex], IDDCX_MONITOR_MODE_ORIGIN_DRIVER);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorQueryModes(IDDCX_MONITOR MonitorObject, const IDARG_IN_QUERYTARGETMODES* pInArgs, IDARG_OUT_QUERYTARGETMODES* pOutArgs)
+{
+    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+    auto& Modes = pMonitorContextWrapper->pContext->GetModes().Target;
+
+    pOutArgs->TargetModeBufferOutputCount = (UINT)Modes.size();
+
+    if (pInArgs->TargetModeBufferInputCount >= pOutArgs->TargetModeBufferOutputCount)
+    {
+        copy(Modes.begin(), Modes.end(), pInArgs->pTargetModes);
+    }
+    else if (pInArgs->TargetModeBufferInputCount != 0)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorQueryModes2(IDDCX_MONITOR MonitorObject, const IDARG_IN_QUERYTARGETMODES2* pInArgs, IDARG_OUT_QUERYTARGETMODES* pOutArgs)
+{
+    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+    auto& Modes = pMonitorContextWrapper->pContext->GetModes().Target2;
+
+    pOutArgs->TargetModeBufferOutputCount = (UINT)Modes.size();
+
+    if (pInArgs->TargetModeBufferInputCount >= pOutArgs->TargetModeBufferOutputCount)
+    {
+        copy(Modes.begin(), Modes.end(), pInArgs->pTargetModes);
+    }
+    else if (pInArgs->TargetModeBufferInputCount != 0)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorAssignSwapChain(IDDCX_MONITOR MonitorObject, const IDARG_IN_SETSWAPCHAIN* pInArgs)
+{
+    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+
+    if (preferredAdapterChanged)
+    {
+        if (memcmp(&pInArgs->RenderAdapterLuid, &preferredAdapterLuid, sizeof(LUID)))
+        {
+            IDARG_IN_ADAPTERSETRENDERADAPTER inArgs{preferredAdapterLuid};
+            IddCxAdapterSetRenderAdapter(pMonitorContextWrapper->pContext->m_Adapter, &inArgs);
+            return STATUS_GRAPHICS_INDIRECT_DISPLAY_ABANDON_SWAPCHAIN;
+        }
+        preferredAdapterChanged = false;
+    }
+
+    pMonitorContextWrapper->pContext->AssignSwapChain(MonitorObject, pInArgs->hSwapChain, pInArgs->RenderAdapterLuid, pInArgs->hNextSurfaceAvailable);
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorUnassignSwapChain(IDDCX_MONITOR MonitorObject)
+{
+    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+    pMonitorContextWrapper->pContext->UnassignSwapChain();
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAAdapterQueryTargetInfo(
+    IDDCX_ADAPTER AdapterObject,
+    IDARG_IN_QUERYTARGET_INFO* pInArgs,
+    IDARG_OUT_QUERYTARGET_INFO* pOutArgs
+)
+{
+    UNREFERENCED_PARAMETER(AdapterObject);
+    UNREFERENCED_PARAMETER(pInArgs);
+    pOutArgs->TargetCaps = IDDCX_TARGET_CAPS_HIGH_COLOR_SPACE | IDDCX_TARGET_CAPS_WIDE_COLOR_SPACE;
+    pOutArgs->DitheringSupport.Rgb = HDRBITS;
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorSetDefaultHdrMetadata(
+    IDDCX_MONITOR MonitorObject,
+    const IDARG_IN_MONITOR_SET_DEFAULT_HDR_METADATA* pInArgs
+)
+{
+    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+
+    // Kept for consumers and the tone mapping, the frames themselves are passed on untouched
+    SUVDA_HDR10_METADATA Hdr10 = {};
+    UINT Type = SUVDA_HDR_METADATA_NONE;
+    if (pInArgs->Type == IDDCX_HDR_METADATA_TYPE_HDR10)
+    {
+        auto& In = pInArgs->Hdr10;
+        static_assert(sizeof(In.RedPrimary) == sizeof(Hdr10.RedPrimary), "Chromaticities are copied as they are");
+        memcpy(Hdr10.RedPrimary, In.RedPrimary, sizeof(Hdr10.RedPrimary));
+        memcpy(Hdr10.GreenPrimary, In.GreenPrimary, sizeof(Hdr10.GreenPrimary));
+        memcpy(Hdr10.BluePrimary, In.BluePrimary, sizeof(Hdr10.BluePrimary));
+        memcpy(Hdr10.WhitePoint, In.WhitePoint, sizeof(Hdr10.WhitePoint));
+        Hdr10.MaxMasteringLuminance = In.MaxMasteringLuminance;
+        Hdr10.MinMasteringLuminance = In.MinMasteringLuminance;
+        Hdr10.MaxContentLightLevel = In.MaxContentLightLevel;
+        Hdr10.MaxFrameAverageLightLevel = In.MaxFrameAverageLightLevel;
+        Type = SUVDA_HDR_METADATA_HDR10;
+    }
+
+    pMonitorContextWrapper->pContext->GetFrameState()->SetHdrMetadata(Type, Hdr10);
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+
+NTSTATUS SudoVDAMonitorSetGammaRamp(
+    IDDCX_MONITOR MonitorObject,
+    const IDARG_IN_SET_GAMMARAMP* pInArgs
+)
+{
+    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
+
+    // The default ramp and 3x4 color space transforms (HDR modes) leave the frames alone
+    std::shared_ptr<const GAMMA_RAMP> Ramp;
+    if (pInArgs->Type == IDDCX_GAMMARAMP_TYPE_RGB256x3x16)
+    {
+        if (pInArgs->GammaRampSizeInBytes < sizeof(GAMMA_RAMP) || !pInArgs->pGammaRampData)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        auto pRamp = std::make_shared<GAMMA_RAMP>();
+        memcpy(pRamp.get(), pInArgs->pGammaRampData, sizeof(GAMMA_RAMP));
+        Ramp = std::move(pRamp);
+    }
+
+    // Swapped in whole, the swap-chain thread picks it up with the next frame
+    pMonitorContextWrapper->pContext->GetFrameState()->SetGammaRamp(std::move(Ramp));
+
+    return STATUS_SUCCESS;
+}
+
+#pragma endregion
+
+VOID SudoVDAIoDeviceControl(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _In_ size_t OutputBufferLength,
+    _In_ size_t InputBufferLength,
+    _In_ ULONG IoControlCode
+)
+{
+    // Reset watchdog
+    if (IoControlCode != IOCTL_GET_WATCHDOG)
+    {
+        watchdogCountdown = watchdogTimeout;
+    }
+
+    NTSTATUS Status = STATUS_INVALID_DEVICE_REQUEST;
+    size_t bytesReturned = 0;
+
+    switch (IoControlCode)
+    {
+    case IOCTL_ADD_VIRTUAL_DISPLAY:
+        {
+            if (freeConnectorSlots.empty())
+            {
+                Status = STATUS_TOO_MANY_NODES;
+                break;
+            }
+
+            // Older clients send the parameters without RefreshRateDenominator
+            const size_t MinAddParamsSize = offsetof(VIRTUAL_DISPLAY_ADD_PARAMS, RefreshRateDenominator);
+            if (InputBufferLength < MinAddParamsSize || OutputBufferLength < sizeof(VIRTUAL_DISPLAY_ADD_OUT))
+            {
+                Status = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+
+            PVIRTUAL_DISPLAY_ADD_PARAMS params;
+            PVIRTUAL_DISPLAY_ADD_OUT output;
+            Status = WdfRequestRetrieveInputBuffer(Request, MinAddParamsSize, (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_ADD_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            bool guidFound = false;
+
+            for (auto it = monitorCtxList.begin(); it != monitorCtxList.end(); ++it)
+            {
+                auto* ctx = *it;
+                if (ctx->monitorGuid == params->MonitorGuid)
+                {
+                    guidFound = true;
+                    output->AdapterLuid = ctx->adapterLuid;
+                    output->TargetId = ctx->targetId;
+                    bytesReturned = sizeof(VIRTUAL_DISPLAY_ADD_OUT);
+                    break;
+                }
+            }
+
+            if (guidFound)
+            {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            UINT RefreshRateDenominator = InputBufferLength >= sizeof(VIRTUAL_DISPLAY_ADD_PARAMS) ? params->RefreshRateDenominator : 0;
+            VirtualMonitorMode preferredMode = {params->Width, params->Height, {}};
+            if (RefreshRateDenominator)
+            {
+                preferredMode.VSync = MakeFraction(params->RefreshRate, RefreshRateDenominator);
+            }
+            else
+            {
+                preferredMode.VSync = RefreshRateFromMillihertz(params->RefreshRate);
+            }
 
-        auto width = pMonitorContextWrapper->pContext->preferredMode.Width;
-        auto height = pMonitorContextWrapper->pContext->preferredMode.Height;
-        auto vsync = pMonitorContextWrapper->pContext->preferredMode.VSync;
+            // Validate and add the virtual display. Sizes up to ModeMaxSize and rates up to ModeMaxVSync keep the timings of
+            // every mode built from the preferred one in range, see ModeTableTest.
+            if (params->Width > 0 && params->Height > 0 && params->Width <= ModeMaxSize && params->Height <= ModeMaxSize &&
+                preferredMode.VSync.Numerator && !FractionLess(FRACTION{ ModeMaxVSync / 1000, 1 }, preferredMode.VSync))
+            {
+                std::lock_guard<std::mutex> lg(monitorListOp);
+
+                auto* pDeviceContextWrapper = WdfObjectGet_IndirectDeviceContextWrapper(Device);
+
+                IndirectMonitorContext* pMonitorContext;
+                uint8_t* edidData = generate_edid(params->MonitorGuid.Data1, params->SerialNumber, params->DeviceName);
+                Status = pDeviceContextWrapper->pContext->CreateMonitor(pMonitorContext, edidData, params->MonitorGuid, preferredMode);
+
+                if (!NT_SUCCESS(Status))
+                {
+                    break;
+                }
+
+                output->AdapterLuid = pMonitorContext->adapterLuid;
+                output->TargetId = pMonitorContext->targetId;
+                bytesReturned = sizeof(VIRTUAL_DISPLAY_ADD_OUT);
+            }
+            else
+            {
+                Status = STATUS_INVALID_PARAMETER;
+            }
+
+            break;
+        }
+    case IOCTL_REMOVE_VIRTUAL_DISPLAY:
+        {
+            if (InputBufferLength < sizeof(VIRTUAL_DISPLAY_REMOVE_PARAMS))
+            {
+                Status = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+
+            PVIRTUAL_DISPLAY_REMOVE_PARAMS params;
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_REMOVE_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            Status = STATUS_NOT_FOUND;
+
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            for (auto it = monitorCtxList.begin(); it != monitorCtxList.end(); ++it)
+            {
+                auto* ctx = *it;
+                if (ctx->monitorGuid == params->MonitorGuid)
+                {
+                    // Remove the monitor
+                    freeConnectorSlots.push(ctx->connectorId);
+                    ctx->ForgetModes();
+                    IddCxMonitorDeparture(ctx->GetMonitor());
+                    monitorCtxList.erase(it);
+                    Status = STATUS_SUCCESS;
+                    break;
+                }
+            }
+
+            break;
+        }
+    case IOCTL_SET_RENDER_ADAPTER:
+        {
+            PVIRTUAL_DISPLAY_SET_RENDER_ADAPTER_PARAMS params;
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_SET_RENDER_ADAPTER_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            auto* pDeviceContextWrapper = WdfObjectGet_IndirectDeviceContextWrapper(Device);
+
+            preferredAdapterLuid = params->AdapterLuid;
+            pDeviceContextWrapper->pContext->SetRenderAdapter(params->AdapterLuid);
+            preferredAdapterChanged = true;
+
+            break;
+        }
+    case IOCTL_GET_WATCHDOG:
+        {
+            Status = STATUS_SUCCESS;
+            PVIRTUAL_DISPLAY_GET_WATCHDOG_OUT output;
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_WATCHDOG_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            output->Timeout = watchdogTimeout;
+            output->Countdown = watchdogCountdown;
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_WATCHDOG_OUT);
+
+            break;
+        }
+    case IOCTL_GET_FRAME_RING:
+        {
+            PVIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_FRAME_RING_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            auto* pExporter = ctx->GetFrameState()->Exporter.get();
+            if (!pExporter)
+            {
+                Status = STATUS_NOT_SUPPORTED;
+            }
+            else if (FAILED(pExporter->GetRingInfo(*output)))
+            {
+                Status = STATUS_DEVICE_NOT_READY;
+            }
+            else
+            {
+                bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT);
+            }
+
+            break;
+        }
+    case IOCTL_GET_PREVIEW_RING:
+        {
+            PVIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_FRAME_RING_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            auto* pExporter = ctx->GetFrameState()->Exporter.get();
+            HRESULT hr = pExporter ? pExporter->GetPreviewRingInfo(*output) : E_NOTIMPL;
+            if (hr == E_NOTIMPL)
+            {
+                Status = STATUS_NOT_SUPPORTED;
+            }
+            else if (FAILED(hr))
+            {
+                Status = STATUS_DEVICE_NOT_READY;
+            }
+            else
+            {
+                bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT);
+            }
+
+            break;
+        }
+    case IOCTL_GET_FRAME_STATS:
+        {
+            PVIRTUAL_DISPLAY_GET_FRAME_STATS_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_FRAME_STATS_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_STATS_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_STATS_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            ctx->GetFrameState()->GetStats(*output);
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_FRAME_STATS_OUT);
+
+            break;
+        }
+    case IOCTL_START_FRAME_CAPTURE:
+        {
+            PVIRTUAL_DISPLAY_START_FRAME_CAPTURE_PARAMS params;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_START_FRAME_CAPTURE_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            params->FileName[SUVDA_CAPTURE_PATH_LENGTH - 1] = L'\0';
+            if (!IsCaptureFileName(params->FileName) || (params->Format != SUVDA_CAPTURE_FORMAT_RAW && params->Format != SUVDA_CAPTURE_FORMAT_Y4M) || params->QueuePolicy > SUVDA_CAPTURE_QUEUE_BLOCK)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            // Frames are captured as they are published, so there is nothing to capture without the frame ring
+            auto* pState = ctx->GetFrameState();
+            if (!pState->Exporter)
+            {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            // Opening replaces the file, which must not happen to the running capture's. Another START can't get in
+            // between while monitorListOp is held.
+            if (pState->Exporter->IsCapturing())
+            {
+                Status = STATUS_DEVICE_BUSY;
+                break;
+            }
+
+            std::unique_ptr<Win32CaptureSink> DataSink(new Win32CaptureSink());
+            std::unique_ptr<Win32CaptureSink> IndexSink;
+            // Raw frames are written in whole aligned blocks, Y4M frames aren't
+            HRESULT hr = DataSink->Open(params->FileName, params->Format == SUVDA_CAPTURE_FORMAT_RAW);
+            if (SUCCEEDED(hr) && params->Format == SUVDA_CAPTURE_FORMAT_RAW)
+            {
+                std::wstring IndexName = std::wstring(params->FileName) + L"" SUVDA_CAPTURE_INDEX_SUFFIX;
+                IndexSink.reset(new Win32CaptureSink());
+                hr = IndexSink->Open(IndexName.c_str());
+            }
+
+            if (FAILED(hr))
+            {
+                Status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            auto Refresh = pState->GetCommittedRefresh();
+            LARGE_INTEGER Frequency;
+            QueryPerformanceFrequency(&Frequency);
+
+            FRAME_CAPTURE_CONFIG Config = {};
+            Config.Format = (SUVDA_CAPTURE_FORMAT)params->Format;
+            Config.BufferCount = params->BufferCount ? params->BufferCount : 8;
+            Config.QueuePolicy = (SUVDA_CAPTURE_QUEUE_POLICY)params->QueuePolicy;
+            Config.QueueTimeoutMs = params->QueueTimeoutMs;
+            Config.RateNumerator = Refresh.Numerator;
+            Config.RateDenominator = Refresh.Denominator;
+            Config.QpcFrequency = Frequency.QuadPart;
+
+            std::unique_ptr<FrameCaptureWriter> Writer(new FrameCaptureWriter(std::move(DataSink), std::move(IndexSink), Config));
+            if (!Writer->Start())
+            {
+                Status = STATUS_UNSUCCESSFUL;
+                break;
+            }
+
+            Status = SUCCEEDED(pState->Exporter->StartCapture(std::move(Writer))) ? STATUS_SUCCESS : STATUS_DEVICE_BUSY;
+            break;
+        }
+    case IOCTL_STOP_FRAME_CAPTURE:
+        {
+            PVIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_PARAMS params;
+            PVIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            std::unique_ptr<FrameCaptureWriter> Writer;
+            {
+                std::lock_guard<std::mutex> lg(monitorListOp);
+
+                auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+                if (!ctx)
+                {
+                    Status = STATUS_NOT_FOUND;
+                    break;
+                }
+
+                auto* pExporter = ctx->GetFrameState()->Exporter.get();
+                if (pExporter)
+                {
+                    Writer = pExporter->TakeCapture();
+                }
+            }
+
+            if (!Writer)
+            {
+                Status = STATUS_INVALID_DEVICE_STATE;
+                break;
+            }
+
+            // Flushing what is still queued can take a while on a slow disk, every other IOCTL would wait for it
+            // under monitorListOp. The file stays open until then, so a new capture can't replace it meanwhile.
+            Writer->Stop();
+            FRAME_CAPTURE_STATS Stats = Writer->Stats();
+
+            output->FramesWritten = Stats.FramesWritten;
+            output->FramesDropped = Stats.FramesDropped;
+            output->FramesSkipped = Stats.FramesSkipped;
+            output->BytesWritten = Stats.BytesWritten;
+            output->WriteErrors = Stats.WriteErrors;
+            output->DroppedNewest = Stats.Queue.DroppedNewest;
+            output->DroppedOldest = Stats.Queue.DroppedOldest;
+            output->TimedOut = Stats.Queue.TimedOut;
+            output->FramesBlocked = Stats.Queue.Blocked;
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_STOP_FRAME_CAPTURE_OUT);
+
+            break;
+        }
+    case IOCTL_START_FRAME_TRACE:
+        {
+            PVIRTUAL_DISPLAY_START_FRAME_TRACE_PARAMS params;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_START_FRAME_TRACE_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            params->FileName[SUVDA_CAPTURE_PATH_LENGTH - 1] = L'\0';
+            if (!IsCaptureFileName(params->FileName))
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
 
-        float vsyncMultiplier = 1;
+            // Records are written as frames are published to the frame ring
+            auto* pState = ctx->GetFrameState();
+            if (!pState->Exporter)
+            {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
 
-        {
-            float fVSync = (float)vsync / 1000;
-            vsyncMultiplier = fVSync / round(fVSync);
-            if (vsyncMultiplier > 1)
+            // Like captures, the running trace's file must not be replaced
+            if (pState->Exporter->IsTracing())
             {
-                vsyncMultiplier = 1;
+                Status = STATUS_DEVICE_BUSY;
+                break;
             }
-        }
 
-        for (size_t i = 0; i < std::size(s_DefaultModes); i++)
-        {
-            auto vsyncTarget = s_DefaultModes[i].VSync;
-            if (vsyncMultiplier != 1 && !(vsyncTarget % 1000))
+            std::unique_ptr<Win32CaptureSink> Sink(new Win32CaptureSink());
+            if (FAILED(Sink->Open(params->FileName)))
             {
-                vsyncTarget = (DWORD)(vsyncTarget * vsyncMultiplier);
+                Status = STATUS_ACCESS_DENIED;
+                break;
             }
-            TargetModes.push_back(CreateIddCxTargetMode2(
-                s_DefaultModes[i].Width,
-                s_DefaultModes[i].Height,
-                vsyncTarget
-            ));
-        }
 
-        for (uint8_t idx = 0; idx < std::size(mode_scale_factors); idx++)
-        {
-            auto scalc_factor = mode_scale_factors[idx];
-            auto _width = width * scalc_factor / 100;
-            auto _height = height * scalc_factor / 100;
+            LARGE_INTEGER Frequency;
+            QueryPerformanceFrequency(&Frequency);
 
-            TargetModes.push_back(CreateIddCxTargetMode2(
-                _width,
-                _height,
-                vsync
-            ));
+            std::unique_ptr<FrameTraceWriter> Writer(new FrameTraceWriter(std::move(Sink), Frequency.QuadPart));
+            if (!Writer->Start())
+            {
+                Status = STATUS_UNSUCCESSFUL;
+                break;
+            }
 
-            TargetModes.push_back(CreateIddCxTargetMode2(
-                _width,
-                _height,
-                vsync * 2
-            ));
+            Status = SUCCEEDED(pState->Exporter->StartTrace(std::move(Writer))) ? STATUS_SUCCESS : STATUS_DEVICE_BUSY;
+            break;
         }
-
-        copy(TargetModes.begin(), TargetModes.end(), pInArgs->pTargetModes);
-    }
-    else if (pInArgs->TargetModeBufferInputCount != 0)
-    {
-        return STATUS_BUFFER_TOO_SMALL;
-    }
-
-    return STATUS_SUCCESS;
-}
-
-_Use_decl_annotations_
-
-NTSTATUS SudoVDAMonitorAssignSwapChain(IDDCX_MONITOR MonitorObject, const IDARG_IN_SETSWAPCHAIN* pInArgs)
-{
-    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
-
-    if (preferredAdapterChanged)
-    {
-        if (memcmp(&pInArgs->RenderAdapterLuid, &preferredAdapterLuid, sizeof(LUID)))
+    case IOCTL_STOP_FRAME_TRACE:
         {
-            IDARG_IN_ADAPTERSETRENDERADAPTER inArgs{preferredAdapterLuid};
-            IddCxAdapterSetRenderAdapter(pMonitorContextWrapper->pContext->m_Adapter, &inArgs);
-            return STATUS_GRAPHICS_INDIRECT_DISPLAY_ABANDON_SWAPCHAIN;
-        }
-        preferredAdapterChanged = false;
-    }
-
-    pMonitorContextWrapper->pContext->AssignSwapChain(MonitorObject, pInArgs->hSwapChain, pInArgs->RenderAdapterLuid, pInArgs->hNextSurfaceAvailable);
-    return STATUS_SUCCESS;
-}
-
-_Use_decl_annotations_
-
-NTSTATUS SudoVDAMonitorUnassignSwapChain(IDDCX_MONITOR MonitorObject)
-{
-    auto* pMonitorContextWrapper = WdfObjectGet_IndirectMonitorContextWrapper(MonitorObject);
-    pMonitorContextWrapper->pContext->UnassignSwapChain();
-    return STATUS_SUCCESS;
-}
+            PVIRTUAL_DISPLAY_STOP_FRAME_TRACE_PARAMS params;
+            PVIRTUAL_DISPLAY_STOP_FRAME_TRACE_OUT output;
 
-_Use_decl_annotations_
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_STOP_FRAME_TRACE_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
 
-NTSTATUS SudoVDAAdapterQueryTargetInfo(
-    IDDCX_ADAPTER AdapterObject,
-    IDARG_IN_QUERYTARGET_INFO* pInArgs,
-    IDARG_OUT_QUERYTARGET_INFO* pOutArgs
-)
-{
-    UNREFERENCED_PARAMETER(AdapterObject);
-    UNREFERENCED_PARAMETER(pInArgs);
-    pOutArgs->TargetCaps = IDDCX_TARGET_CAPS_HIGH_COLOR_SPACE | IDDCX_TARGET_CAPS_WIDE_COLOR_SPACE;
-    pOutArgs->DitheringSupport.Rgb = HDRBITS;
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_STOP_FRAME_TRACE_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
 
-    return STATUS_SUCCESS;
-}
+            std::unique_ptr<FrameTraceWriter> Writer;
+            {
+                std::lock_guard<std::mutex> lg(monitorListOp);
 
-_Use_decl_annotations_
+                auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+                if (!ctx)
+                {
+                    Status = STATUS_NOT_FOUND;
+                    break;
+                }
 
-NTSTATUS SudoVDAMonitorSetDefaultHdrMetadata(
-    IDDCX_MONITOR MonitorObject,
-    const IDARG_IN_MONITOR_SET_DEFAULT_HDR_METADATA* pInArgs
-)
-{
-    UNREFERENCED_PARAMETER(MonitorObject);
-    UNREFERENCED_PARAMETER(pInArgs);
+                auto* pExporter = ctx->GetFrameState()->Exporter.get();
+                if (pExporter)
+                {
+                    Writer = pExporter->TakeTrace();
+                }
+            }
 
-    return STATUS_SUCCESS;
-}
+            if (!Writer)
+            {
+                Status = STATUS_INVALID_DEVICE_STATE;
+                break;
+            }
 
-_Use_decl_annotations_
+            // Flushed outside monitorListOp like captures
+            Writer->Stop();
+            FRAME_TRACE_STATS Stats = Writer->Stats();
 
-NTSTATUS SudoVDAMonitorSetGammaRamp(
-    IDDCX_MONITOR MonitorObject,
-    const IDARG_IN_SET_GAMMARAMP* pInArgs
-)
-{
-    UNREFERENCED_PARAMETER(MonitorObject);
-    UNREFERENCED_PARAMETER(pInArgs);
+            output->RecordsWritten = Stats.RecordsWritten;
+            output->RecordsDropped = Stats.RecordsDropped;
+            output->WriteErrors = Stats.WriteErrors;
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_STOP_FRAME_TRACE_OUT);
 
-    return STATUS_SUCCESS;
-}
+            break;
+        }
+    case IOCTL_SET_CONSUMER_FRAME_RATE:
+        {
+            PVIRTUAL_DISPLAY_SET_CONSUMER_FRAME_RATE_PARAMS params;
 
-#pragma endregion
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_SET_CONSUMER_FRAME_RATE_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
 
-VOID SudoVDAIoDeviceControl(
-    _In_ WDFDEVICE Device,
-    _In_ WDFREQUEST Request,
-    _In_ size_t OutputBufferLength,
-    _In_ size_t InputBufferLength,
-    _In_ ULONG IoControlCode
-)
-{
-    // Reset watchdog
-    if (IoControlCode != IOCTL_GET_WATCHDOG)
-    {
-        watchdogCountdown = watchdogTimeout;
-    }
+            // A zero numerator clears the consumer, any other rate has to be a real one
+            UINT64 Numerator = params->RateNumerator;
+            if (params->ConsumerIndex >= SUVDA_MAX_RATE_CONSUMERS ||
+                (Numerator && (!params->RateDenominator || Numerator > (UINT64)SUVDA_MAX_CONSUMER_FRAME_RATE * params->RateDenominator)))
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
 
-    NTSTATUS Status = STATUS_INVALID_DEVICE_REQUEST;
-    size_t bytesReturned = 0;
+            std::lock_guard<std::mutex> lg(monitorListOp);
 
-    switch (IoControlCode)
-    {
-    case IOCTL_ADD_VIRTUAL_DISPLAY:
-        {
-            if (freeConnectorSlots.empty())
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
             {
-                Status = STATUS_TOO_MANY_NODES;
+                Status = STATUS_NOT_FOUND;
                 break;
             }
 
-            if (InputBufferLength < sizeof(VIRTUAL_DISPLAY_ADD_PARAMS) || OutputBufferLength < sizeof(VIRTUAL_DISPLAY_ADD_OUT))
+            // Without a frame ring there is nothing to decimate
+            auto pState = ctx->GetFrameState();
+            if (!pState->Exporter)
             {
-                Status = STATUS_BUFFER_TOO_SMALL;
+                Status = STATUS_NOT_SUPPORTED;
                 break;
             }
 
-            PVIRTUAL_DISPLAY_ADD_PARAMS params;
-            PVIRTUAL_DISPLAY_ADD_OUT output;
-            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_ADD_PARAMS), (PVOID*)&params, NULL);
+            pState->SetConsumerRate(params->ConsumerIndex, DISPLAYCONFIG_RATIONAL{params->RateNumerator, params->RateDenominator});
+
+            break;
+        }
+    case IOCTL_GET_CURSOR:
+        {
+            PVIRTUAL_DISPLAY_GET_CURSOR_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_CURSOR_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_CURSOR_PARAMS), (PVOID*)&params, NULL);
             if (!NT_SUCCESS(Status))
             {
                 break;
             }
 
-            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_ADD_OUT), (PVOID*)&output, NULL);
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_CURSOR_OUT), (PVOID*)&output, NULL);
             if (!NT_SUCCESS(Status))
             {
                 break;
             }
 
-            bool guidFound = false;
+            std::lock_guard<std::mutex> lg(monitorListOp);
 
-            for (auto it = monitorCtxList.begin(); it != monitorCtxList.end(); ++it)
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
             {
-                auto* ctx = *it;
-                if (ctx->monitorGuid == params->MonitorGuid)
-                {
-                    guidFound = true;
-                    output->AdapterLuid = ctx->adapterLuid;
-                    output->TargetId = ctx->targetId;
-                    bytesReturned = sizeof(VIRTUAL_DISPLAY_ADD_OUT);
-                    break;
-                }
+                Status = STATUS_NOT_FOUND;
+                break;
             }
 
-            if (guidFound)
+            auto* pCursor = ctx->GetCursorProcessor();
+            if (!pCursor)
             {
-                Status = STATUS_SUCCESS;
+                // No swap-chain was ever assigned, the OS hasn't handed us a cursor yet
+                Status = STATUS_DEVICE_NOT_READY;
                 break;
             }
 
-            // Validate and add the virtual display
-            if (params->Width > 0 && params->Height > 0 && params->RefreshRate > 0)
+            // Only the valid part of the shape is copied back
+            pCursor->GetCursor(params->LastShapeId, *output);
+            bytesReturned = offsetof(VIRTUAL_DISPLAY_GET_CURSOR_OUT, Shape) + output->ShapeSize;
+
+            break;
+        }
+    case IOCTL_GET_CURSOR_PLANE:
+        {
+            PVIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_FRAME_RING_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
             {
-                std::lock_guard<std::mutex> lg(monitorListOp);
+                break;
+            }
 
-                auto* pDeviceContextWrapper = WdfObjectGet_IndirectDeviceContextWrapper(Device);
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
 
-                IndirectMonitorContext* pMonitorContext;
-                uint8_t* edidData = generate_edid(params->MonitorGuid.Data1, params->SerialNumber, params->DeviceName);
-                VirtualMonitorMode preferredMode = {params->Width, params->Height, params->RefreshRate};
-                if (preferredMode.VSync < 1000)
-                {
-                    preferredMode.VSync *= 1000;
-                }
-                Status = pDeviceContextWrapper->pContext->CreateMonitor(pMonitorContext, edidData, params->MonitorGuid, preferredMode);
+            std::lock_guard<std::mutex> lg(monitorListOp);
 
-                if (!NT_SUCCESS(Status))
-                {
-                    break;
-                }
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
 
-                output->AdapterLuid = pMonitorContext->adapterLuid;
-                output->TargetId = pMonitorContext->targetId;
-                bytesReturned = sizeof(VIRTUAL_DISPLAY_ADD_OUT);
+            auto* pCursor = ctx->GetCursorProcessor();
+            HRESULT hr = pCursor ? pCursor->GetPlaneInfo(*output) : E_PENDING;
+            if (hr == E_NOTIMPL)
+            {
+                Status = STATUS_NOT_SUPPORTED;
+            }
+            else if (FAILED(hr))
+            {
+                Status = STATUS_DEVICE_NOT_READY;
             }
             else
             {
-                Status = STATUS_INVALID_PARAMETER;
+                bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_FRAME_RING_OUT);
             }
 
             break;
         }
-    case IOCTL_REMOVE_VIRTUAL_DISPLAY:
+    case IOCTL_GET_HDR_METADATA:
         {
-            if (InputBufferLength < sizeof(VIRTUAL_DISPLAY_REMOVE_PARAMS))
+            PVIRTUAL_DISPLAY_GET_HDR_METADATA_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_HDR_METADATA_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_HDR_METADATA_PARAMS), (PVOID*)&params, NULL);
+            if (!NT_SUCCESS(Status))
             {
-                Status = STATUS_BUFFER_TOO_SMALL;
                 break;
             }
 
-            PVIRTUAL_DISPLAY_REMOVE_PARAMS params;
-            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_REMOVE_PARAMS), (PVOID*)&params, NULL);
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT), (PVOID*)&output, NULL);
             if (!NT_SUCCESS(Status))
             {
                 break;
             }
 
-            Status = STATUS_NOT_FOUND;
-
             std::lock_guard<std::mutex> lg(monitorListOp);
 
-            for (auto it = monitorCtxList.begin(); it != monitorCtxList.end(); ++it)
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
             {
-                auto* ctx = *it;
-                if (ctx->monitorGuid == params->MonitorGuid)
-                {
-                    // Remove the monitor
-                    freeConnectorSlots.push(ctx->connectorId);
-                    IddCxMonitorDeparture(ctx->GetMonitor());
-                    monitorCtxList.erase(it);
-                    Status = STATUS_SUCCESS;
-                    break;
-                }
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            auto* pState = ctx->GetFrameState();
+            VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT Metadata = {};
+            pState->GetHdrMetadata(Metadata);
+
+            // Tone mapping only applies to exported frames
+            if (pState->Exporter && pState->Exporter->IsToneMapping())
+            {
+                Metadata.ToneMapWhiteNits = HdrToneMapping;
+                Metadata.ToneMapPeakNits = (UINT)ToneMapPeakNits(Metadata);
             }
 
+            *output = Metadata;
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT);
+
             break;
         }
-    case IOCTL_SET_RENDER_ADAPTER:
+    case IOCTL_GET_ASSIGN_STATS:
         {
-            PVIRTUAL_DISPLAY_SET_RENDER_ADAPTER_PARAMS params;
-            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_SET_RENDER_ADAPTER_PARAMS), (PVOID*)&params, NULL);
+            PVIRTUAL_DISPLAY_GET_ASSIGN_STATS_PARAMS params;
+            PVIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT output;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_ASSIGN_STATS_PARAMS), (PVOID*)&params, NULL);
             if (!NT_SUCCESS(Status))
             {
                 break;
             }
 
-            auto* pDeviceContextWrapper = WdfObjectGet_IndirectDeviceContextWrapper(Device);
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT), (PVOID*)&output, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
 
-            preferredAdapterLuid = params->AdapterLuid;
-            pDeviceContextWrapper->pContext->SetRenderAdapter(params->AdapterLuid);
-            preferredAdapterChanged = true;
+            std::lock_guard<std::mutex> lg(monitorListOp);
+
+            auto* ctx = FindMonitorByGuid(params->MonitorGuid);
+            if (!ctx)
+            {
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT Stats;
+            ctx->GetFrameState()->GetAssignStats(Stats);
+            *output = Stats;
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT);
 
             break;
         }
-    case IOCTL_GET_WATCHDOG:
+    case IOCTL_GET_MODE_LIST:
         {
-            Status = STATUS_SUCCESS;
-            PVIRTUAL_DISPLAY_GET_WATCHDOG_OUT output;
+            PVIRTUAL_DISPLAY_GET_MODE_LIST_OUT output;
 
-            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_WATCHDOG_OUT), (PVOID*)&output, NULL);
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTUAL_DISPLAY_GET_MODE_LIST_OUT), (PVOID*)&output, NULL);
             if (!NT_SUCCESS(Status))
             {
                 break;
             }
 
-            output->Timeout = watchdogTimeout;
-            output->Countdown = watchdogCountdown;
-            bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_WATCHDOG_OUT);
+            static_assert(ModeList::MaxIssues == SUVDA_MODE_LIST_MAX_ISSUES, "Every issue kept must fit the IOCTL");
+            static_assert(MODE_ISSUE_REASON_COUNT == SUVDA_MODE_ISSUE_DUPLICATE + 1, "Issue reasons are passed as they are");
+
+            // Compiled once in DriverEntry, read-only since
+            VIRTUAL_DISPLAY_GET_MODE_LIST_OUT List = {};
+            List.Status = modeListStatus;
+            List.Entries = modeListReport.Entries;
+            List.Modes = (UINT)defaultModeList.Count();
+            List.Duplicates = modeListReport.Duplicates;
+            List.Rejected = modeListReport.Rejected;
+            List.IssueCount = (UINT)modeListReport.Issues.size();
+            for (UINT i = 0; i < List.IssueCount; i++)
+            {
+                const MODE_ISSUE& Issue = modeListReport.Issues[i];
+                List.Issues[i] = { Issue.Line, (UINT)Issue.Reason, Issue.Width, Issue.Height, Issue.Refresh };
+            }
+
+            *output = List;
+            bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_MODE_LIST_OUT);
+
+            break;
         }
     case IOCTL_DRIVER_PING:
         {
@@ -1742,6 +4779,8 @@ VOID SudoVDAIoDeviceControl(
 
             output->Version = VDAProtocolVersion;
             bytesReturned = sizeof(VIRTUAL_DISPLAY_GET_PROTOCOL_VERSION_OUT);
+
+            break;
         }
     default:
         break;
@@ -8,14 +8,41 @@
 #include <iddcx.h>
 
 #include <dxgi1_5.h>
-#include <d3d11_2.h>
+#include <d3d11_4.h>
 #include <avrt.h>
 #include <wrl.h>
 
 #include <memory>
 #include <queue>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <sudovda-ioctl.h>
+#include <sudovda-frame.h>
+#include <sudovda-trace.h>
+#include <sudovda-cursor.h>
 
 #include "Trace.h"
+#include "FramePacer.h"
+#include "LatencyHistogram.h"
+#include "DamageTracker.h"
+#include "StagingRing.h"
+#include "FrameHash.h"
+#include "IdleRefresh.h"
+#include "FrameCapture.h"
+#include "FrameTrace.h"
+#include "FrameDecimator.h"
+#include "Downscale.h"
+#include "CursorComposite.h"
+#include "ToneMap.h"
+#include "GammaRamp.h"
+#include "WorkerPool.h"
+#include "DeviceCache.h"
+#include "SwapChainAssign.h"
+#include "ModeTable.h"
+#include "EdidIndex.h"
 
 namespace Microsoft
 {
@@ -25,6 +52,9 @@ namespace Microsoft
 		{
 			// Adds a wrapper for thread handles to the existing set of WRL handle wrapper classes
 			typedef HandleT<HandleTraits::HANDLENullTraits> Thread;
+			// Same for file mapping and waitable timer handles, which are NULL rather than INVALID_HANDLE_VALUE on failure
+			typedef HandleT<HandleTraits::HANDLENullTraits> FileMapping;
+			typedef HandleT<HandleTraits::HANDLENullTraits> WaitableTimer;
 		}
 	}
 }
@@ -36,7 +66,7 @@ namespace Microsoft
 		struct VirtualMonitorMode {
 			DWORD Width;
 			DWORD Height;
-			DWORD VSync;
+			FRACTION VSync;
 		};
 
 		/// <summary>
@@ -46,7 +76,8 @@ namespace Microsoft
 		{
 			Direct3DDevice(LUID AdapterLuid);
 			Direct3DDevice();
-			HRESULT Init();
+			// Enumerates the adapter through pFactory, which the device keeps a reference to
+			HRESULT Init(IDXGIFactory5* pFactory);
 
 			LUID AdapterLuid;
 			Microsoft::WRL::ComPtr<IDXGIFactory5> DxgiFactory;
@@ -56,25 +87,579 @@ namespace Microsoft
 		};
 
 		/// <summary>
-		/// Manages a thread that consumes buffers from an indirect display swap-chain object.
+		/// IDeviceFactory creating Direct3DDevices from one cached DXGI factory, keyed by AdapterLuidKey().
+		/// </summary>
+		class D3D11DeviceFactory : public IDeviceFactory<Direct3DDevice>
+		{
+		public:
+			bool IsCurrent() override;
+			void Refresh() override;
+			std::shared_ptr<Direct3DDevice> Create(uint64_t AdapterKey) override;
+			bool IsUsable(Direct3DDevice& Device) override;
+
+		private:
+			Microsoft::WRL::ComPtr<IDXGIFactory5> m_Factory;
+		};
+
+		inline uint64_t AdapterLuidKey(const LUID& Luid)
+		{
+			return ((uint64_t)(uint32_t)Luid.HighPart << 32) | Luid.LowPart;
+		}
+
+		/// <summary>
+		/// IStagingBackend backed by D3D11 event queries on the device's immediate context.
+		/// </summary>
+		class D3D11StagingBackend : public IStagingBackend
+		{
+		public:
+			HRESULT Init(ID3D11Device* pDevice, ID3D11DeviceContext* pContext, UINT SlotCount);
+
+			void SignalFence(uint32_t Slot) override;
+			bool IsFenceComplete(uint32_t Slot) override;
+			void WaitFence(uint32_t Slot) override;
+
+		private:
+			Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_Context;
+			Microsoft::WRL::ComPtr<ID3D11Query> m_Fences[StagingRing::MaxSlots];
+		};
+
+		/// <summary>
+		/// ICaptureSink writing to a Win32 file.
+		/// </summary>
+		class Win32CaptureSink : public ICaptureSink
+		{
+		public:
+			// Creates or replaces the file pName in the capture directory, see SUVDA_CAPTURE_DIRECTORY. Unbuffered
+			// sinks bypass the file cache, every write must then start at a sector aligned address and cover whole
+			// sectors, which FrameCaptureWriter guarantees for raw frame data.
+			HRESULT Open(const wchar_t* pName, bool Unbuffered = false);
+
+			bool Write(const void* pData, size_t Bytes) override;
+
+		private:
+			Microsoft::WRL::Wrappers::FileHandle m_hFile;
+		};
+
+		/// <summary>
+		/// QPC timestamps of a frame's way through the swap-chain processor, 0 for stages not reached yet.
+		/// </summary>
+		struct FrameTimestamps
+		{
+			UINT PresentationFrameNumber = 0;
+			UINT64 PresentQpc = 0;
+			UINT64 AcquireQpc = 0;
+			UINT64 ProcessQpc = 0;
+			UINT64 FinishQpc = 0;
+		};
+
+		/// <summary>
+		/// Hardware cursor as last reported by the OS.
+		/// </summary>
+		struct CursorSnapshot
+		{
+			bool Visible = false;
+			// Top left of the shape in monitor coordinates
+			INT X = 0;
+			INT Y = 0;
+			UINT ShapeId = 0;
+			// Null until a shape was decoded
+			std::shared_ptr<const SUDOVDA::SUVDA_CURSOR_IMAGE> Image;
+		};
+
+		/// <summary>
+		/// A named shared-memory frame ring (see sudovda-frame.h) and the event signaled for every frame published to it.
+		/// </summary>
+		class SharedFrameRing
+		{
+		public:
+			// The section is named Global\SudoVDA.<Name>.<monitor guid>.<generation>, the event
+			// Global\SudoVDA.<Name>Event.<monitor guid>
+			SharedFrameRing(const GUID& MonitorGuid, const wchar_t* pName, UINT SlotCount);
+			~SharedFrameRing();
+
+			// Recreates the ring under a new generation unless it already fits SlotDataSize bytes per slot
+			HRESULT Ensure(UINT64 SlotDataSize);
+			void Close();
+			HRESULT GetInfo(SUDOVDA::VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info);
+
+			bool IsInitialized() const
+			{
+				return m_Ring.IsInitialized();
+			}
+
+			UINT Generation() const
+			{
+				return m_Generation;
+			}
+
+			uint32_t NextSlotIndex() const
+			{
+				return m_Ring.NextSlotIndex();
+			}
+
+			const SUDOVDA::SUVDA_FRAME_SLOT* LastPublished() const
+			{
+				return m_Ring.LastPublished();
+			}
+
+			const uint8_t* SlotData(const SUDOVDA::SUVDA_FRAME_SLOT* pSlot) const
+			{
+				return m_Ring.SlotData(pSlot);
+			}
+
+			uint8_t* BeginFrame(SUDOVDA::SUVDA_FRAME_SLOT*& pSlot)
+			{
+				return m_Ring.BeginFrame(pSlot);
+			}
+
+			// Publishes the frame claimed by BeginFrame() and signals the event
+			void PublishFrame();
+
+		private:
+			std::wstring m_Name;
+			std::wstring m_GuidString;
+			std::wstring m_MappingName;
+			std::wstring m_EventName;
+			UINT m_SlotCount;
+			UINT m_Generation = 0;
+			UINT64 m_MappingSize = 0;
+			void* m_pView = nullptr;
+			SUDOVDA::FrameRingWriter m_Ring;
+			Microsoft::WRL::Wrappers::FileMapping m_hMapping;
+			Microsoft::WRL::Wrappers::Event m_hFrameEvent;
+
+			// Guards the handles against concurrent IOCTL queries
+			std::mutex m_Lock;
+		};
+
+		/// <summary>
+		/// Low resolution copy of a monitor's frames in a frame ring of its own, for control panels that show many
+		/// monitors at once. Built from the frames published to the full resolution ring at a capped rate, downscaling
+		/// only what changed since the last preview.
+		/// </summary>
+		class FramePreview
+		{
+		public:
+			static const UINT SlotCount = 3;
+
+			// Scale is the downscale factor, see DownscaleIsSupportedFactor(). Previews are published at most MaxFps
+			// times a second. Downscaling is split across pPool when one is given.
+			FramePreview(const GUID& MonitorGuid, UINT Scale, UINT MaxFps, UINT64 QpcFrequency, WorkerPool* pPool);
+
+			// Called for every frame published to the full resolution ring, Damage is what changed since the previous one
+			void OnFrame(const SUDOVDA::SUVDA_FRAME_SLOT& Slot, const uint8_t* pData, const TileDamageMap& Damage, bool FullDamage, UINT64 Qpc);
+			// Publishes a change held back by the rate cap once it is due, from the frame last published to the full
+			// resolution ring. Returns the milliseconds until it wants to be polled again, INFINITE if nothing is held back.
+			DWORD Poll(const SUDOVDA::SUVDA_FRAME_SLOT* pLast, const uint8_t* pData, UINT64 Qpc);
+			HRESULT GetRingInfo(SUDOVDA::VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info);
+
+		private:
+			// Preview rows downscaled per job when the work is split across the pool
+			static const UINT BandRows = 16;
+
+			HRESULT Render(const SUDOVDA::SUVDA_FRAME_SLOT& Slot, const uint8_t* pData);
+
+			SharedFrameRing m_Ring;
+			UINT m_Scale;
+			UINT64 m_QpcFrequency;
+			WorkerPool* m_pPool;
+			FrameDecimator m_Pacing;
+
+			// Frame pixels changed since the last preview, and whether a frame is waiting for the rate cap
+			TileDamageMap m_Damage;
+			bool m_Pending = false;
+
+			// The preview as last rendered, every published preview is a full copy of it
+			std::vector<uint8_t> m_Image;
+			std::vector<SUDOVDA::SUVDA_FRAME_RECT> m_Plan;
+			std::vector<SUDOVDA::SUVDA_FRAME_RECT> m_Bands;
+		};
+
+		/// <summary>
+		/// Copies processed frames into a named shared-memory frame ring (see sudovda-frame.h) that external consumers
+		/// map read-only. Owned by the monitor so the ring survives swap-chain reassignment.
+		/// </summary>
+		class FrameExporter
+		{
+		public:
+			// DetectDuplicates hashes every damaged tile to flag frames identical to the previous one. A non-zero
+			// PreviewScale also publishes a preview downscaled by it, at most PreviewFps times a second. Hashing and
+			// downscaling are split across pPool when one is given. CompositeCursor blends the cursor passed to
+			// SetCursor() into every BGRA8 frame. A non-zero ToneMapWhiteNits publishes HDR frames tone mapped to
+			// BGRA8 with SDR white at that level.
+			FrameExporter(const GUID& MonitorGuid, UINT SlotCount, bool DetectDuplicates, UINT PreviewScale, UINT PreviewFps, bool CompositeCursor, UINT ToneMapWhiteNits, WorkerPool* pPool);
+			~FrameExporter();
+
+			// Damage lists the regions of pSurface that changed since the previous frame, FullDamage overrides it
+			HRESULT ExportFrame(Direct3DDevice& Device, ID3D11Texture2D* pSurface, const FrameTimestamps& Times, const std::vector<RECT>& Damage, bool FullDamage);
+			// Records the damage of a frame that isn't exported, so the next exported frame covers it
+			void SkipFrame(const std::vector<RECT>& Damage, bool FullDamage);
+			// Stamps the frame last passed to ExportFrame with the stages that end after it returns. Frames are only
+			// published from a later call, so the stamps always make it into the frame's trace record.
+			void CompleteFrame(UINT64 ProcessQpc, UINT64 FinishQpc);
+			// Publishes every frame whose readback has completed, never blocks on the GPU
+			void Flush();
+			// Publishes a preview held back by its rate cap once it is due. Returns the milliseconds until the next
+			// poll is needed, INFINITE if there is nothing to wait for.
+			DWORD PollPreview(UINT64 Qpc);
+			// Frames copied to staging but not yet published
+			UINT PendingFrames() const;
+			UINT64 FramesUnchanged() const;
+			// Publishes the last frame again as a refinement pass. Fails with E_PENDING while there is no frame or a
+			// newer one is still being read back.
+			HRESULT RefreshLastFrame(UINT64 Qpc);
+			// Cursor composited into the frames published from now on, ignored unless compositing is enabled
+			void SetCursor(const CursorSnapshot& Cursor);
+			bool IsCompositingCursor() const;
+			// Publishes the last frame again with the cursor passed to SetCursor() once it differs from the one in the
+			// ring. Fails with E_PENDING like RefreshLastFrame(), returns S_FALSE when there is nothing to update.
+			HRESULT PublishCursor(UINT64 Qpc);
+			// Source level mapped to SDR white from the next published frame on, ignored unless tone mapping
+			bool IsToneMapping() const;
+			void SetToneMapPeak(float PeakNits);
+			// Ramp applied to BGRA8 and RGB10A2 frames published from now on, null for none
+			void SetGammaRamp(std::shared_ptr<const GAMMA_RAMP> Ramp);
+			// Streams every published frame to Writer until TakeCapture(), one capture at a time
+			HRESULT StartCapture(std::unique_ptr<FrameCaptureWriter> Writer);
+			bool IsCapturing();
+			// Ends the capture and hands its writer back, null if there was none. Stopping the writer flushes what is
+			// still queued, the caller does that without holding up the swap-chain thread.
+			std::unique_ptr<FrameCaptureWriter> TakeCapture();
+			// Writes a latency record for every published frame to Writer until TakeTrace(), one trace at a time
+			HRESULT StartTrace(std::unique_ptr<FrameTraceWriter> Writer);
+			bool IsTracing();
+			// Ends the trace like TakeCapture()
+			std::unique_ptr<FrameTraceWriter> TakeTrace();
+			// Acquire to publish latency of every published frame
+			void SummarizeHandoff(LATENCY_SUMMARY& Summary) const;
+			HRESULT GetRingInfo(SUDOVDA::VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info);
+			// E_NOTIMPL when previews are disabled
+			HRESULT GetPreviewRingInfo(SUDOVDA::VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info);
+
+		private:
+			// Number of staging textures, one frame is copied while the previous one is read back
+			static const UINT StagingDepth = 3;
+			// Rows tone mapped or gamma corrected per pool task
+			static const UINT BandRows = 32;
+
+			// What is needed to publish a frame once its staging copy retires
+			struct PendingFrame
+			{
+				FrameTimestamps Times;
+				bool FullDamage = false;
+				TileDamageMap Damage;
+			};
+
+			HRESULT EnsureStaging(Direct3DDevice& Device, const D3D11_TEXTURE2D_DESC& Desc);
+			// Format frames of Format are published in
+			SUDOVDA::SUVDA_FRAME_FORMAT ExportedFormat(SUDOVDA::SUVDA_FRAME_FORMAT Format) const;
+			// Tables for the ramp in Format, null when there is nothing to apply
+			const GammaLut* UpdateGammaLut(SUDOVDA::SUVDA_FRAME_FORMAT Format);
+			void ResetDamage(UINT Width, UINT Height);
+			void DrainStaging(bool WaitOldest);
+			HRESULT PublishFrame(UINT StagingSlot);
+			void RemoveUnchangedTiles(const D3D11_MAPPED_SUBRESOURCE& Mapped, TileDamageMap& Damage);
+			void CaptureFrame(const SUDOVDA::SUVDA_FRAME_SLOT& Slot, const uint8_t* pData);
+			void TraceFrame(const SUDOVDA::SUVDA_FRAME_SLOT& Slot, const FrameTimestamps& Times);
+			HRESULT BeginRepublish(UINT64 Qpc, SUDOVDA::SUVDA_FRAME_SLOT*& pSlot, uint8_t*& pData);
+			void ApplyCursor(SUDOVDA::SUVDA_FRAME_SLOT& Slot, uint8_t* pData, UINT SlotIndex);
+			void AddCursorDamage(SUDOVDA::SUVDA_FRAME_SLOT& Slot, const SUDOVDA::SUVDA_FRAME_RECT& Previous, const SUDOVDA::SUVDA_FRAME_RECT& Current, TileDamageMap& Damage);
+
+			UINT m_SlotCount;
+			SharedFrameRing m_Ring;
+			std::unique_ptr<FramePreview> m_Preview;
+			Microsoft::WRL::ComPtr<ID3D11Device> m_StagingDevice;
+			Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_StagingContext;
+			Microsoft::WRL::ComPtr<ID3D11Texture2D> m_Staging[StagingDepth];
+			D3D11_TEXTURE2D_DESC m_StagingDesc{};
+			D3D11StagingBackend m_StagingBackend;
+			StagingRing m_StagingRing{m_StagingBackend, StagingDepth};
+			PendingFrame m_PendingFrames[StagingDepth];
+			int32_t m_LastExportedSlot = -1;
+
+			// Staging textures and ring slots keep the image they last received, so only tiles damaged since then
+			// need to be refreshed
+			UINT m_DamageGeneration = 0;
+			TileDamageMap m_FrameDamage;
+			TileDamageMap m_SkippedDamage;
+			std::vector<TileDamageMap> m_StagingDamage;
+			std::vector<TileDamageMap> m_SlotDamage;
+			std::vector<SUDOVDA::SUVDA_FRAME_RECT> m_Plan;
+
+			// Hash of every tile as last published, only valid once a full frame has been hashed
+			bool m_DetectDuplicates;
+			WorkerPool* m_pPool;
+			bool m_TileHashesValid = false;
+			std::vector<UINT64> m_TileHashes;
+			// The last published slot holds the staged pixels unchanged, no tone mapping or gamma ramp
+			bool m_LastPublishedRaw = false;
+			std::atomic<UINT64> m_FramesUnchanged{0};
+
+			std::unique_ptr<FrameCaptureWriter> m_Capture;
+			std::mutex m_CaptureLock;
+
+			UINT64 m_QpcFrequency;
+			LatencyHistogram m_HandoffLatency;
+			std::unique_ptr<FrameTraceWriter> m_Trace;
+			std::mutex m_TraceLock;
+
+			// The cursor as set and the version of it in the last published frame
+			bool m_CompositeCursor;
+			CursorSnapshot m_Cursor;
+			UINT64 m_CursorSerial = 0;
+			UINT64 m_PublishedCursorSerial = 0;
+			// Where the cursor was blended into every slot, empty for none. Slots are restored from these before
+			// they are brought up to date.
+			std::vector<SUDOVDA::SUVDA_FRAME_RECT> m_CursorRects;
+			// Frame pixels under the cursor of the last published slot, tightly packed
+			std::vector<uint8_t> m_CursorBackup;
+			TileDamageMap m_CursorDamage;
+
+			// Null unless tone mapping
+			std::unique_ptr<ToneMapper> m_ToneMapper;
+			// Built from m_GammaRamp for the last published format on demand
+			std::shared_ptr<const GAMMA_RAMP> m_GammaRamp;
+			std::unique_ptr<GammaLut> m_GammaLut;
+			// A new peak or gamma correction invalidates every slot
+			bool m_OutputChanged = false;
+			std::vector<SUDOVDA::SUVDA_FRAME_RECT> m_Bands;
+		};
+
+		/// <summary>
+		/// Per-monitor frame pipeline state shared between the DDI callbacks, the IOCTL handler and the swap-chain
+		/// processing thread. Outlives any single swap-chain.
+		/// </summary>
+		struct MonitorFrameState
+		{
+			MonitorFrameState();
+
+			void SetCommittedRefresh(const DISPLAYCONFIG_RATIONAL& Rate);
+			DISPLAYCONFIG_RATIONAL GetCommittedRefresh() const;
+
+			void RecordStage(SUDOVDA::SUVDA_FRAME_STAGE Stage, UINT64 Nanoseconds);
+			void GetStats(SUDOVDA::VIRTUAL_DISPLAY_GET_FRAME_STATS_OUT& Stats) const;
+
+			// A zero rate clears the consumer
+			void SetConsumerRate(UINT Consumer, const DISPLAYCONFIG_RATIONAL& Rate);
+			// Fills every consumer's rate and returns the generation they belong to
+			UINT64 GetConsumerRates(DISPLAYCONFIG_RATIONAL (&Rates)[SUVDA_MAX_RATE_CONSUMERS]) const;
+			UINT64 ConsumerRateGeneration() const;
+
+			// Hardware cursor handed from the cursor thread to the swap-chain thread for compositing
+			void SetCursor(const CursorSnapshot& Cursor);
+			// Fills the cursor and returns the generation it belongs to
+			UINT64 GetCursor(CursorSnapshot& Cursor) const;
+			UINT64 CursorGeneration() const;
+
+			// HDR metadata the OS last set as the monitor's default, Type is SUVDA_HDR_METADATA_NONE until then
+			void SetHdrMetadata(UINT Type, const SUDOVDA::SUVDA_HDR10_METADATA& Hdr10);
+			// Fills Type, Generation and Hdr10 of Metadata and returns the full generation
+			UINT64 GetHdrMetadata(SUDOVDA::VIRTUAL_DISPLAY_GET_HDR_METADATA_OUT& Metadata) const;
+			UINT64 HdrMetadataGeneration() const;
+
+			// Gamma ramp the OS last set, null while it is the default. Ramps are never modified once set, so
+			// readers keep theirs as long as they like.
+			void SetGammaRamp(std::shared_ptr<const GAMMA_RAMP> Ramp);
+			UINT64 GetGammaRamp(std::shared_ptr<const GAMMA_RAMP>& Ramp) const;
+			UINT64 GammaRampGeneration() const;
+
+			// Swap-chain assignment phases, timestamps are QPC ticks. Marks of an assignment that was replaced are
+			// dropped.
+			UINT64 BeginAssignment(UINT64 Now, bool Rearmed);
+			void MarkAssignPhase(UINT64 AssignId, ASSIGN_PHASE Phase, UINT64 Now);
+			void GetAssignStats(SUDOVDA::VIRTUAL_DISPLAY_GET_ASSIGN_STATS_OUT& Stats) const;
+
+			std::unique_ptr<FrameExporter> Exporter;
+
+			// Written by the swap-chain thread only
+			std::atomic<UINT64> FramesAcquired{0};
+			std::atomic<UINT64> FramesDropped{0};
+			std::atomic<UINT64> FramesExported{0};
+			std::atomic<UINT64> ExportFailures{0};
+			std::atomic<UINT64> FramesRefined{0};
+			std::atomic<UINT64> FramesDecimated{0};
+			std::atomic<UINT> PendingDepth{0};
+
+		private:
+			// Refresh rate of the committed mode packed as (Numerator << 32 | Denominator), 0 while inactive
+			std::atomic<UINT64> m_CommittedRefresh{0};
+			LatencyHistogram m_StageLatency[SUDOVDA::SUVDA_FRAME_STAGE_COUNT];
+
+			mutable std::mutex m_ConsumerRateLock;
+			DISPLAYCONFIG_RATIONAL m_ConsumerRates[SUVDA_MAX_RATE_CONSUMERS] = {};
+			std::atomic<UINT64> m_ConsumerRateGeneration{0};
+
+			mutable std::mutex m_CursorLock;
+			CursorSnapshot m_Cursor;
+			std::atomic<UINT64> m_CursorGeneration{0};
+
+			mutable std::mutex m_HdrMetadataLock;
+			UINT m_HdrMetadataType = SUVDA_HDR_METADATA_NONE;
+			SUDOVDA::SUVDA_HDR10_METADATA m_Hdr10 = {};
+			std::atomic<UINT64> m_HdrMetadataGeneration{0};
+
+			mutable std::mutex m_GammaRampLock;
+			std::shared_ptr<const GAMMA_RAMP> m_GammaRamp;
+			std::atomic<UINT64> m_GammaRampGeneration{0};
+
+			static_assert(ASSIGN_PHASE_COUNT == SUDOVDA::SUVDA_ASSIGN_PHASE_COUNT, "Assignment phases must match the IOCTL");
+			AssignPhaseTimer m_AssignTimer;
+		};
+
+		/// <summary>
+		/// IPacingClock backed by QueryPerformanceCounter.
+		/// </summary>
+		class QpcClock : public IPacingClock
+		{
+		public:
+			uint64_t Now() override;
+			uint64_t Frequency() override;
+		};
+
+		/// <summary>
+		/// Consumes buffers from an indirect display swap-chain object, either on a thread of its own or, with pPool,
+		/// as a strand of jobs on the shared worker pool. A thread of its own outlives the swap-chain: it parks once
+		/// released and is re-armed with the monitor's next swap-chain.
 		/// </summary>
 		class SwapChainProcessor
 		{
 		public:
-			SwapChainProcessor(IDDCX_SWAPCHAIN hSwapChain, std::shared_ptr<Direct3DDevice> Device, HANDLE NewFrameEvent);
+			SwapChainProcessor(IDDCX_SWAPCHAIN hSwapChain, std::shared_ptr<Direct3DDevice> Device, HANDLE NewFrameEvent, UINT64 AssignId, std::shared_ptr<MonitorFrameState> State, WorkerPool* pPool);
 			~SwapChainProcessor();
 
+			// Whether Release() and Rearm() are available, only with a thread of its own
+			bool CanRearm() const;
+			// Hands the next swap-chain to the parked thread, false unless it was released
+			bool Rearm(IDDCX_SWAPCHAIN hSwapChain, std::shared_ptr<Direct3DDevice> Device, HANDLE NewFrameEvent, UINT64 AssignId);
+			// Stops processing and deletes the current swap-chain, the thread parks until re-armed
+			void Release();
+
 		private:
+			struct Assignment
+			{
+				IDDCX_SWAPCHAIN hSwapChain = nullptr;
+				std::shared_ptr<Direct3DDevice> Device;
+				HANDLE hNewFrameEvent = nullptr;
+				UINT64 AssignId = 0;
+			};
+
 			static DWORD CALLBACK RunThread(LPVOID Argument);
 
+			static VOID CALLBACK BufferWaitCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult);
+
 			void Run();
 			void RunCore();
+			void RunPooled();
+			bool SetDevice();
+			HRESULT ProcessNextFrame();
+			DWORD PrepareIdleWait(bool UseTimer, bool& TimerArmed);
+			bool ArmDeadlineTimer();
+			UINT64 TicksToNanoseconds(UINT64 Ticks) const;
+			void ReportFrameStatistics(UINT PresentationFrameNumber, bool Completed, UINT64 AcquireTick, UINT64 ProcessTick);
+			bool GetFrameDamage(UINT DirtyRectCount, UINT MoveRegionCount);
+			void UpdateDecimation();
+			void ExportSkippedFrame();
+			void SyncCursor();
+			void SyncHdrMetadata();
+			void SyncGammaRamp();
 
 			IDDCX_SWAPCHAIN m_hSwapChain;
 			std::shared_ptr<Direct3DDevice> m_Device;
 			HANDLE m_hAvailableBufferEvent;
+			UINT64 m_AssignId;
+			bool m_AwaitingFirstFrame = true;
+			std::shared_ptr<MonitorFrameState> m_State;
+			QpcClock m_Clock;
+			UINT64 m_ClockFrequency;
+			FramePacer m_Pacer;
+			IdleRefreshPolicy m_IdleRefresh;
+			static_assert(SUVDA_MAX_RATE_CONSUMERS == FrameDecimatorSet::MaxConsumers, "Every consumer slot needs a decimator");
+			FrameDecimatorSet m_Decimation;
+			UINT64 m_ConsumerRateGeneration = 0;
+			// Last frame the decimation skipped, exported late if no newer frame arrives in time for a consumer. The
+			// OS lets us use it until the next buffer is acquired.
+			Microsoft::WRL::ComPtr<ID3D11Texture2D> m_SkippedSurface;
+			FrameTimestamps m_SkippedTimes;
+			UINT m_LastPresentationFrameNumber = 0;
+			// Regions of the current frame that changed, reused across frames to avoid allocations
+			std::vector<RECT> m_Damage;
+			std::vector<IDDCX_MOVEREGION> m_MoveRegions;
+			UINT64 m_CursorGeneration = 0;
+			UINT64 m_HdrMetadataGeneration = 0;
+			UINT64 m_GammaRampGeneration = 0;
+			Microsoft::WRL::Wrappers::WaitableTimer m_hDeadlineTimer;
 			Microsoft::WRL::Wrappers::Thread m_hThread;
 			Microsoft::WRL::Wrappers::Event m_hTerminateEvent;
+			SwapChainRearm<Assignment> m_Rearm;
+
+			// Pooled mode only
+			std::unique_ptr<WorkerStrand> m_Strand;
+			PTP_WAIT m_BufferWait = nullptr;
+			std::atomic<bool> m_Terminating{false};
+		};
+
+		/// <summary>
+		/// Follows a monitor's hardware cursor on a thread of its own. Woken by the OS for every change, it publishes
+		/// the cursor to a shared-memory cursor plane (see sudovda-cursor.h) and to the monitor's frame state for
+		/// compositing. Owned by the monitor so the plane survives swap-chain reassignment.
+		/// </summary>
+		class CursorProcessor
+		{
+		public:
+			CursorProcessor(IDDCX_MONITOR hMonitor, const GUID& MonitorGuid, std::shared_ptr<MonitorFrameState> State);
+			~CursorProcessor();
+
+			// Has the OS hand the cursor to this processor, needed again for every new swap-chain
+			NTSTATUS SetupHardwareCursor();
+			// The shape's bytes are only copied when its id differs from LastShapeId
+			void GetCursor(UINT LastShapeId, SUDOVDA::VIRTUAL_DISPLAY_GET_CURSOR_OUT& Cursor);
+			// E_NOTIMPL when the plane couldn't be shared and only lives in the driver
+			HRESULT GetPlaneInfo(SUDOVDA::VIRTUAL_DISPLAY_GET_FRAME_RING_OUT& Info);
+
+		private:
+			static DWORD CALLBACK RunThread(LPVOID Argument);
+
+			void Run();
+			void CreatePlane(const GUID& MonitorGuid);
+			void Update();
+
+			IDDCX_MONITOR m_hMonitor;
+			std::shared_ptr<MonitorFrameState> m_State;
+			QpcClock m_Clock;
+
+			std::wstring m_MappingName;
+			std::wstring m_EventName;
+			Microsoft::WRL::Wrappers::FileMapping m_hMapping;
+			void* m_pView = nullptr;
+			// Stands in for the section when it can't be created, so IOCTL_GET_CURSOR keeps working
+			std::unique_ptr<SUDOVDA::SUVDA_CURSOR_PLANE> m_pPrivatePlane;
+			SUDOVDA::CursorPlaneWriter m_Writer;
+			SUDOVDA::CursorPlaneReader m_Reader;
+
+			// Signaled by the OS for cursor changes, and by us for the plane's readers
+			Microsoft::WRL::Wrappers::Event m_hCursorEvent;
+			Microsoft::WRL::Wrappers::Event m_hUpdateEvent;
+			Microsoft::WRL::Wrappers::Event m_hTerminateEvent;
+			Microsoft::WRL::Wrappers::Thread m_hThread;
+
+			// Cursor thread only
+			SUDOVDA::SUVDA_CURSOR_STATE m_Published = {};
+			CursorSnapshot m_Cursor;
+			std::vector<BYTE> m_Shape;
+			UINT64 m_NextUpdate = 0;
+		};
+
+		/// <summary>
+		/// Modes a monitor reports, in the IddCx structures of the callbacks in use (the *2 ones on HDR capable
+		/// systems). Built once with the monitor, see ModeTable.h.
+		/// </summary>
+		struct MonitorModes
+		{
+			std::vector<IDDCX_MONITOR_MODE> Description;
+			std::vector<IDDCX_MONITOR_MODE2> Description2;
+			std::vector<IDDCX_TARGET_MODE> Target;
+			std::vector<IDDCX_TARGET_MODE2> Target2;
+			UINT PreferredIndex = DefaultPreferredModeIndex;
 		};
 
 		class IndirectMonitorContext
@@ -95,11 +680,24 @@ namespace Microsoft
 			void AssignSwapChain(const IDDCX_MONITOR& MonitorObject, const IDDCX_SWAPCHAIN& SwapChain, const LUID& RenderAdapter, const HANDLE& NewFrameEvent);
 			void UnassignSwapChain();
 
+			// Builds the monitor's modes from preferredMode and pEdidData, which must not change afterwards, and
+			// indexes them by the EDID. Called before the monitor arrives, the OS asks for its modes right away.
+			void CacheModes();
+			// Drops the modes from the EDID index, when the monitor departs
+			void ForgetModes();
+			const MonitorModes& GetModes() const;
+
 			IDDCX_MONITOR GetMonitor() const;
+			MonitorFrameState* GetFrameState() const;
+			// Null until the first swap-chain is assigned
+			CursorProcessor* GetCursorProcessor() const;
 
 		private:
 			IDDCX_MONITOR m_Monitor;
+			std::shared_ptr<MonitorFrameState> m_FrameState;
 			std::unique_ptr<SwapChainProcessor> m_ProcessingThread;
+			std::unique_ptr<CursorProcessor> m_CursorProcessor;
+			std::shared_ptr<const MonitorModes> m_Modes;
 		} ;
 
 		/// <summary>
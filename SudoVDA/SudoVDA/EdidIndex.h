@@ -0,0 +1,240 @@
+#pragma once
+
+// Monitors looked up by their EDID from the monitor description callbacks.
+//
+// The OS hands the EDID back when it parses a monitor's description, and the driver has to find the monitor it
+// belongs to. Those callbacks can run while IOCTLs add and remove monitors, so the lookup must not walk the monitor
+// list, and must not wait for whoever holds its lock either: that's the thread creating the monitor whose
+// description is being parsed.
+//
+// EdidIndex keeps an immutable snapshot of every entry, sorted by fingerprint (the EDID's serial number and its
+// HashRegion() hash). Readers binary search the current snapshot and compare the EDID bytes of matching fingerprints,
+// without taking a lock. Writers are serialized, copy the snapshot with their change and publish the copy, RCU style.
+// A replaced snapshot is freed once every reader that might still see it has left:
+//
+//  * Readers announce themselves on one of two counters, picked by the parity of the current epoch, and check that the
+//    epoch didn't move while they did. A reader that raced with an epoch change retries on the other counter.
+//  * After publishing, the writer advances the epoch and waits for the previous epoch's counter to drain. Readers that
+//    arrive after the advance count on the other counter and can only have loaded the new snapshot.
+//
+// Lookups hand out the value's shared_ptr, so a monitor removed meanwhile stays valid for the caller. Several monitors
+// may share an EDID, the earliest inserted one is found, like the monitor list walk used to.
+//
+// Only the standard library is used besides FrameHash, so the index runs unchanged in the driver and in benchmarks.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameHash.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef struct _EDID_FINGERPRINT {
+			uint64_t Hash;
+			uint32_t Serial;                 // ID serial number, bytes 12 to 15 of the EDID
+		} EDID_FINGERPRINT;
+
+		inline EDID_FINGERPRINT MakeEdidFingerprint(const uint8_t* pEdid, size_t Size)
+		{
+			const size_t SerialOffset = 0x0C;
+
+			EDID_FINGERPRINT Fingerprint = {};
+			Fingerprint.Hash = HashRegion(pEdid, Size, (uint32_t)Size, 1);
+			if (Size >= SerialOffset + sizeof(Fingerprint.Serial))
+			{
+				memcpy(&Fingerprint.Serial, pEdid + SerialOffset, sizeof(Fingerprint.Serial));
+			}
+			return Fingerprint;
+		}
+
+		template <typename TValue>
+		class EdidIndex
+		{
+		public:
+			EdidIndex() :
+				m_Current(new Snapshot())
+			{
+			}
+
+			EdidIndex(const EdidIndex&) = delete;
+			EdidIndex& operator=(const EdidIndex&) = delete;
+
+			~EdidIndex()
+			{
+				delete m_Current.load(std::memory_order_relaxed);
+			}
+
+			// Adds Value under the EDID. Value is also what Remove() identifies the entry by.
+			void Insert(const uint8_t* pEdid, size_t Size, std::shared_ptr<const TValue> Value)
+			{
+				std::lock_guard<std::mutex> lg(m_WriteLock);
+
+				const Snapshot* pOld = m_Current.load(std::memory_order_relaxed);
+				Entry New;
+				New.Fingerprint = MakeEdidFingerprint(pEdid, Size);
+				New.Sequence = m_NextSequence++;
+				New.Edid.assign(pEdid, pEdid + Size);
+				New.Value = std::move(Value);
+
+				auto* pNew = new Snapshot(*pOld);
+				pNew->Entries.insert(std::upper_bound(pNew->Entries.begin(), pNew->Entries.end(), New, Before), std::move(New));
+				Publish(pNew);
+			}
+
+			// Removes the entry of pValue under the EDID, false if there is none
+			bool Remove(const uint8_t* pEdid, size_t Size, const TValue* pValue)
+			{
+				std::lock_guard<std::mutex> lg(m_WriteLock);
+
+				const Snapshot* pOld = m_Current.load(std::memory_order_relaxed);
+				EDID_FINGERPRINT Fingerprint = MakeEdidFingerprint(pEdid, Size);
+
+				auto Range = EqualRange(pOld->Entries, Fingerprint);
+				for (auto It = Range.first; It != Range.second; ++It)
+				{
+					if (It->Value.get() == pValue)
+					{
+						auto* pNew = new Snapshot(*pOld);
+						pNew->Entries.erase(pNew->Entries.begin() + (It - pOld->Entries.begin()));
+						Publish(pNew);
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+			// Value of the earliest inserted entry with exactly this EDID, null if there is none. Never blocks.
+			std::shared_ptr<const TValue> Find(const uint8_t* pEdid, size_t Size) const
+			{
+				EDID_FINGERPRINT Fingerprint = MakeEdidFingerprint(pEdid, Size);
+				ReadSection Section(*this);
+
+				auto Range = EqualRange(Section.Current()->Entries, Fingerprint);
+				for (auto It = Range.first; It != Range.second; ++It)
+				{
+					if (It->Edid.size() == Size && memcmp(It->Edid.data(), pEdid, Size) == 0)
+					{
+						return It->Value;
+					}
+				}
+
+				return nullptr;
+			}
+
+			size_t Count() const
+			{
+				ReadSection Section(*this);
+				return Section.Current()->Entries.size();
+			}
+
+		private:
+			struct Entry
+			{
+				EDID_FINGERPRINT Fingerprint;
+				uint64_t Sequence;               // Insertion order among equal fingerprints
+				std::vector<uint8_t> Edid;
+				std::shared_ptr<const TValue> Value;
+			};
+
+			struct Snapshot
+			{
+				std::vector<Entry> Entries;
+			};
+
+			class ReadSection
+			{
+			public:
+				explicit ReadSection(const EdidIndex& Index) :
+					m_Index(Index)
+				{
+					for (;;)
+					{
+						m_Epoch = m_Index.m_Epoch.load(std::memory_order_seq_cst);
+						m_Index.m_Readers[m_Epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+						if (m_Index.m_Epoch.load(std::memory_order_seq_cst) == m_Epoch)
+						{
+							break;
+						}
+						m_Index.m_Readers[m_Epoch & 1].fetch_sub(1, std::memory_order_release);
+					}
+
+					m_pCurrent = m_Index.m_Current.load(std::memory_order_acquire);
+				}
+
+				~ReadSection()
+				{
+					m_Index.m_Readers[m_Epoch & 1].fetch_sub(1, std::memory_order_release);
+				}
+
+				const Snapshot* Current() const
+				{
+					return m_pCurrent;
+				}
+
+			private:
+				const EdidIndex& m_Index;
+				uint64_t m_Epoch;
+				const Snapshot* m_pCurrent;
+			};
+
+			static bool Less(const EDID_FINGERPRINT& Left, const EDID_FINGERPRINT& Right)
+			{
+				return Left.Hash != Right.Hash ? Left.Hash < Right.Hash : Left.Serial < Right.Serial;
+			}
+
+			static bool Before(const Entry& Left, const Entry& Right)
+			{
+				if (Less(Left.Fingerprint, Right.Fingerprint) || Less(Right.Fingerprint, Left.Fingerprint))
+				{
+					return Less(Left.Fingerprint, Right.Fingerprint);
+				}
+				return Left.Sequence < Right.Sequence;
+			}
+
+			typedef typename std::vector<Entry>::const_iterator EntryIterator;
+
+			static std::pair<EntryIterator, EntryIterator> EqualRange(const std::vector<Entry>& Entries, const EDID_FINGERPRINT& Fingerprint)
+			{
+				auto First = std::lower_bound(Entries.begin(), Entries.end(), Fingerprint, [](const Entry& Left, const EDID_FINGERPRINT& Right) { return Less(Left.Fingerprint, Right); });
+				auto Last = First;
+				while (Last != Entries.end() && !Less(Fingerprint, Last->Fingerprint))
+				{
+					++Last;
+				}
+				return { First, Last };
+			}
+
+			// Writer only: makes pNew current and frees the snapshot it replaces once no reader can see it anymore
+			void Publish(Snapshot* pNew)
+			{
+				const Snapshot* pOld = m_Current.exchange(pNew, std::memory_order_seq_cst);
+
+				uint64_t Retired = m_Epoch.load(std::memory_order_relaxed);
+				m_Epoch.store(Retired + 1, std::memory_order_seq_cst);
+				while (m_Readers[Retired & 1].load(std::memory_order_seq_cst))
+				{
+					std::this_thread::yield();
+				}
+
+				delete pOld;
+			}
+
+			std::mutex m_WriteLock;
+			uint64_t m_NextSequence = 0;
+			std::atomic<const Snapshot*> m_Current;
+			mutable std::atomic<uint64_t> m_Epoch{0};
+			mutable std::atomic<uint64_t> m_Readers[2] = {};
+		};
+	}
+}
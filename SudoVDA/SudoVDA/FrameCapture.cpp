@@ -0,0 +1,358 @@
+#include "FrameCapture.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+
+using namespace SUDOVDA;
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		FrameCaptureWriter::FrameCaptureWriter(std::unique_ptr<ICaptureSink> Data, std::unique_ptr<ICaptureSink> Index, const FRAME_CAPTURE_CONFIG& Config) :
+			m_Data(std::move(Data)),
+			m_Index(std::move(Index)),
+			m_Config(Config)
+		{
+			uint32_t Count = Config.BufferCount < MinBuffers ? MinBuffers : (Config.BufferCount > MaxBuffers ? MaxBuffers : Config.BufferCount);
+
+			HANDOFF_POLICY Policy = HANDOFF_DROP_NEWEST;
+			uint32_t TimeoutMs = 0;
+			switch (Config.QueuePolicy)
+			{
+			case SUVDA_CAPTURE_QUEUE_DROP_OLDEST:
+				Policy = HANDOFF_DROP_OLDEST;
+				break;
+			case SUVDA_CAPTURE_QUEUE_BLOCK:
+				Policy = HANDOFF_BLOCK;
+				TimeoutMs = !Config.QueueTimeoutMs ? DefaultBlockMs : (Config.QueueTimeoutMs > MaxBlockMs ? MaxBlockMs : Config.QueueTimeoutMs);
+				break;
+			default:
+				break;
+			}
+
+			m_BlockMs = TimeoutMs;
+			m_Buffers.resize(Count + 2);
+			m_FreeBuffers.reset(new HandoffQueue<uint32_t>(Count + 2));
+			m_Queued.reset(new HandoffQueue<uint32_t>(Count, Policy, TimeoutMs));
+			for (uint32_t i = 0; i < Count + 2; i++)
+			{
+				m_FreeBuffers->TryPush(i);
+			}
+
+			if (!m_Config.MaxBufferBytes)
+			{
+				m_Config.MaxBufferBytes = DefaultMaxBufferBytes;
+			}
+
+			if (!m_Config.RateNumerator || !m_Config.RateDenominator)
+			{
+				m_Config.RateNumerator = 60;
+				m_Config.RateDenominator = 1;
+			}
+		}
+
+		FrameCaptureWriter::~FrameCaptureWriter()
+		{
+			Stop();
+		}
+
+		bool FrameCaptureWriter::Start()
+		{
+			if (m_Config.Format == SUVDA_CAPTURE_FORMAT_RAW)
+			{
+				if (!m_Index)
+				{
+					return false;
+				}
+
+				SUVDA_CAPTURE_INDEX_HEADER Header = {};
+				Header.Magic = SUVDA_CAPTURE_INDEX_MAGIC;
+				Header.Version = SUVDA_CAPTURE_VERSION;
+				Header.HeaderSize = sizeof(SUVDA_CAPTURE_INDEX_HEADER);
+				Header.EntrySize = sizeof(SUVDA_CAPTURE_INDEX_ENTRY);
+				Header.QpcFrequency = m_Config.QpcFrequency;
+
+				if (!m_Index->Write(&Header, sizeof(Header)))
+				{
+					return false;
+				}
+			}
+			else if (m_Config.Format != SUVDA_CAPTURE_FORMAT_Y4M)
+			{
+				return false;
+			}
+
+			m_Thread = std::thread(&FrameCaptureWriter::Run, this);
+			return true;
+		}
+
+		bool FrameCaptureWriter::Submit(const SUVDA_FRAME_SLOT& Desc, const uint8_t* pData)
+		{
+			m_FramesSubmitted.fetch_add(1, std::memory_order_relaxed);
+
+			if (m_Config.Format == SUVDA_CAPTURE_FORMAT_Y4M)
+			{
+				// A Y4M stream has one geometry and holds YUV only
+				if (Desc.Format != SUVDA_FRAME_FORMAT_BGRA8 || (m_StreamWidth && (Desc.Width != m_StreamWidth || Desc.Height != m_StreamHeight)))
+				{
+					m_FramesSkipped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				m_StreamWidth = Desc.Width;
+				m_StreamHeight = Desc.Height;
+			}
+
+			// Don't copy a frame that is going to be dropped anyway
+			if (m_Queued->IsClosed() || (m_Queued->Policy() == HANDOFF_DROP_NEWEST && m_Queued->Size() >= m_Queued->Capacity()))
+			{
+				m_FramesRejected.fetch_add(1, std::memory_order_relaxed);
+				m_FramesDropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			uint32_t Index;
+			size_t Padded = (size_t)CaptureAlignUp(Desc.DataSize);
+			if (!AcquireBuffer(Padded, Index))
+			{
+				m_FramesDropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			auto& Frame = m_Buffers[Index];
+			memcpy(Frame.pData, pData, (size_t)Desc.DataSize);
+			memset(Frame.pData + Desc.DataSize, 0, Padded - (size_t)Desc.DataSize);
+
+			auto& Entry = Frame.Entry;
+			Entry.FrameNumber = Desc.FrameNumber;
+			Entry.PresentQpc = Desc.PresentQpc;
+			Entry.DataSize = Desc.DataSize;
+			Entry.Width = Desc.Width;
+			Entry.Height = Desc.Height;
+			Entry.Pitch = Desc.Pitch;
+			Entry.Format = Desc.Format;
+			Entry.Flags = Desc.Flags;
+
+			auto Result = m_Queued->Push(Index, [this](uint32_t&& Evicted)
+			{
+				m_FramesDropped.fetch_add(1, std::memory_order_relaxed);
+				m_FreeBuffers->TryPush(Evicted);
+			});
+
+			if (Result != HANDOFF_QUEUED)
+			{
+				m_FramesDropped.fetch_add(1, std::memory_order_relaxed);
+				m_FreeBuffers->TryPush(Index);
+				return false;
+			}
+
+			return true;
+		}
+
+		// Pops a free buffer holding at least Bytes. Buffers too small for the frame are grown while the budget allows,
+		// the others give their memory back and are retired.
+		bool FrameCaptureWriter::AcquireBuffer(size_t Bytes, uint32_t& Index)
+		{
+			while (m_FreeBuffers->TryPop(Index) || WaitForBuffer(Index))
+			{
+				auto& Frame = m_Buffers[Index];
+				if (Frame.Capacity >= Bytes)
+				{
+					return true;
+				}
+
+				uint64_t Others = m_BufferBytes - Frame.Capacity;
+				m_BufferBytes = Others;
+				Frame.Storage.reset();
+				Frame.pData = nullptr;
+				Frame.Capacity = 0;
+				if (Others && Others + Bytes > m_Config.MaxBufferBytes)
+				{
+					continue;
+				}
+
+				Frame.Storage.reset(new uint8_t[Bytes + SUVDA_CAPTURE_DATA_ALIGNMENT]);
+				uintptr_t Base = (uintptr_t)Frame.Storage.get();
+				Frame.pData = Frame.Storage.get() + (CaptureAlignUp(Base) - Base);
+				Frame.Capacity = Bytes;
+				m_BufferBytes += Bytes;
+				return true;
+			}
+
+			return false;
+		}
+
+		// No buffer is free, they are all queued or being written. This is what the queue policy would do if the
+		// queue were full, returns false when the frame is to be dropped.
+		bool FrameCaptureWriter::WaitForBuffer(uint32_t& Index)
+		{
+			switch (m_Queued->Policy())
+			{
+			case HANDOFF_DROP_OLDEST:
+				if (m_Queued->TryPop(Index))
+				{
+					m_FramesEvicted.fetch_add(1, std::memory_order_relaxed);
+					m_FramesDropped.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+				m_FramesRejected.fetch_add(1, std::memory_order_relaxed);
+				return false;
+
+			case HANDOFF_BLOCK:
+				m_FramesBlocked.fetch_add(1, std::memory_order_relaxed);
+				if (m_FreeBuffers->Pop(Index, m_BlockMs))
+				{
+					return true;
+				}
+				m_FramesTimedOut.fetch_add(1, std::memory_order_relaxed);
+				return false;
+
+			default:
+				m_FramesRejected.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		void FrameCaptureWriter::Stop()
+		{
+			m_Queued->Close();
+
+			if (m_Thread.joinable())
+			{
+				m_Thread.join();
+			}
+		}
+
+		FRAME_CAPTURE_STATS FrameCaptureWriter::Stats() const
+		{
+			FRAME_CAPTURE_STATS Stats;
+			Stats.FramesSubmitted = m_FramesSubmitted.load(std::memory_order_relaxed);
+			Stats.FramesWritten = m_FramesWritten.load(std::memory_order_relaxed);
+			Stats.FramesDropped = m_FramesDropped.load(std::memory_order_relaxed);
+			Stats.FramesSkipped = m_FramesSkipped.load(std::memory_order_relaxed);
+			Stats.BytesWritten = m_BytesWritten.load(std::memory_order_relaxed);
+			Stats.WriteErrors = m_WriteErrors.load(std::memory_order_relaxed);
+			Stats.Queue = m_Queued->Stats();
+			Stats.Queue.DroppedNewest += m_FramesRejected.load(std::memory_order_relaxed);
+			Stats.Queue.DroppedOldest += m_FramesEvicted.load(std::memory_order_relaxed);
+			Stats.Queue.Blocked += m_FramesBlocked.load(std::memory_order_relaxed);
+			Stats.Queue.TimedOut += m_FramesTimedOut.load(std::memory_order_relaxed);
+			return Stats;
+		}
+
+		void FrameCaptureWriter::Run()
+		{
+			// Stopping still writes out everything that was queued
+			uint32_t Index;
+			while (m_Queued->Pop(Index))
+			{
+				WriteFrame(m_Buffers[Index]);
+				m_FreeBuffers->TryPush(Index);
+			}
+		}
+
+		void FrameCaptureWriter::WriteFrame(Buffer& Frame)
+		{
+			if (m_Config.Format == SUVDA_CAPTURE_FORMAT_RAW)
+			{
+				WriteRaw(Frame);
+			}
+			else
+			{
+				WriteY4m(Frame);
+			}
+		}
+
+		void FrameCaptureWriter::WriteRaw(Buffer& Frame)
+		{
+			auto& Entry = Frame.Entry;
+			size_t Padded = (size_t)CaptureAlignUp(Entry.DataSize);
+			if (!WriteData(Frame.pData, Padded))
+			{
+				return;
+			}
+
+			Entry.DataOffset = m_DataOffset;
+			m_DataOffset += Padded;
+
+			if (!m_Index->Write(&Entry, sizeof(Entry)))
+			{
+				m_WriteErrors.fetch_add(1, std::memory_order_relaxed);
+				m_Failed = true;
+				return;
+			}
+
+			m_FramesWritten.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void FrameCaptureWriter::WriteY4m(Buffer& Frame)
+		{
+			uint32_t Width = Frame.Entry.Width;
+			uint32_t Height = Frame.Entry.Height;
+
+			if (!m_DataOffset)
+			{
+				char Header[128];
+				int Length = snprintf(Header, sizeof(Header), "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+					Width, Height, m_Config.RateNumerator, m_Config.RateDenominator);
+				if (!WriteData((const uint8_t*)Header, (size_t)Length))
+				{
+					return;
+				}
+				m_DataOffset += Length;
+			}
+
+			static const char FrameTag[] = "FRAME\n";
+			const size_t TagBytes = sizeof(FrameTag) - 1;
+			size_t ChromaWidth = (Width + 1) / 2;
+			size_t ChromaHeight = (Height + 1) / 2;
+			size_t LumaBytes = (size_t)Width * Height;
+			size_t ChromaBytes = ChromaWidth * ChromaHeight;
+
+			// Tag and planes go out in a single write
+			m_Planes.resize(TagBytes + LumaBytes + 2 * ChromaBytes);
+			uint8_t* pY = m_Planes.data() + TagBytes;
+			memcpy(m_Planes.data(), FrameTag, TagBytes);
+
+			ConvertBgraToI420(Frame.pData, Frame.Entry.Pitch, Width, Height,
+				pY, Width,
+				pY + LumaBytes, ChromaWidth,
+				pY + LumaBytes + ChromaBytes, ChromaWidth);
+
+			if (!WriteData(m_Planes.data(), m_Planes.size()))
+			{
+				return;
+			}
+			m_DataOffset += m_Planes.size();
+
+			m_FramesWritten.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		bool FrameCaptureWriter::WriteData(const uint8_t* pData, size_t Bytes)
+		{
+			if (m_Failed)
+			{
+				m_WriteErrors.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			while (Bytes)
+			{
+				size_t Chunk = Bytes < MaxWriteBytes ? Bytes : MaxWriteBytes;
+				if (!m_Data->Write(pData, Chunk))
+				{
+					m_WriteErrors.fetch_add(1, std::memory_order_relaxed);
+					m_Failed = true;
+					return false;
+				}
+
+				pData += Chunk;
+				Bytes -= Chunk;
+				m_BytesWritten.fetch_add(Chunk, std::memory_order_relaxed);
+			}
+
+			return true;
+		}
+	}
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+// Asynchronous capture of published frames to disk, see sudovda-capture.h for the file formats.
+//
+// Submit() runs on the swap-chain thread. It copies the frame into one of a fixed number of buffers and hands it to
+// the writer thread through a HandoffQueue. When every buffer is still queued the capture's queue policy applies: by
+// default the new frame is dropped and counted, so a slow disk costs captured frames, never presented ones.
+//
+// The buffers together hold at most MaxBufferBytes. A buffer the budget can't grow for a larger frame is retired for
+// the rest of the capture, so at 8K fewer frames are queued than BufferCount asks for, and the queue policy applies as
+// soon as the remaining buffers are in use.
+//
+// The writer only sees ICaptureSink, so the same code records to Win32 files in the driver and to stdio files in the
+// harnesses. Raw frames are written from 4 KiB aligned buffers in whole blocks of SUVDA_CAPTURE_DATA_ALIGNMENT, which
+// also suits unbuffered file handles.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sudovda-capture.h>
+
+#include "HandoffQueue.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		/// <summary>
+		/// Sequential output file of a capture.
+		/// </summary>
+		class ICaptureSink
+		{
+		public:
+			virtual ~ICaptureSink() = default;
+
+			virtual bool Write(const void* pData, size_t Bytes) = 0;
+		};
+
+		/// <summary>
+		/// ICaptureSink writing to a stdio stream, which it closes when destroyed.
+		/// </summary>
+		class StdioCaptureSink : public ICaptureSink
+		{
+		public:
+			explicit StdioCaptureSink(FILE* pFile) : m_pFile(pFile)
+			{
+				// Frames are written in large blocks already, stdio buffering would only add a copy
+				setvbuf(m_pFile, nullptr, _IONBF, 0);
+			}
+
+			~StdioCaptureSink()
+			{
+				fclose(m_pFile);
+			}
+
+			bool Write(const void* pData, size_t Bytes) override
+			{
+				return fwrite(pData, 1, Bytes, m_pFile) == Bytes;
+			}
+
+		private:
+			FILE* m_pFile;
+		};
+
+		typedef struct _FRAME_CAPTURE_CONFIG {
+			SUDOVDA::SUVDA_CAPTURE_FORMAT Format;
+			uint32_t BufferCount;             // Frames that can be queued for the writer, clamped to 2-64
+			SUDOVDA::SUVDA_CAPTURE_QUEUE_POLICY QueuePolicy;
+			uint32_t QueueTimeoutMs;          // SUVDA_CAPTURE_QUEUE_BLOCK only, 0 for the default
+			uint32_t RateNumerator;           // Nominal frame rate written to Y4M headers
+			uint32_t RateDenominator;
+			uint64_t QpcFrequency;            // Recorded in the raw index
+			uint64_t MaxBufferBytes;          // Memory all buffers may hold together, 0 for DefaultMaxBufferBytes
+		} FRAME_CAPTURE_CONFIG;
+
+		typedef struct _FRAME_CAPTURE_STATS {
+			uint64_t FramesSubmitted;
+			uint64_t FramesWritten;
+			uint64_t FramesDropped;           // Lost to the queue policy, in any of the ways counted in Queue
+			uint64_t FramesSkipped;           // Format or geometry the capture format can't hold
+			uint64_t BytesWritten;
+			uint64_t WriteErrors;
+			HANDOFF_QUEUE_STATS Queue;
+		} FRAME_CAPTURE_STATS;
+
+		class FrameCaptureWriter
+		{
+		public:
+			static const uint32_t MinBuffers = 2;
+			static const uint32_t MaxBuffers = 64;
+			// Eight 8K BGRA frames. A single buffer is always allowed, whatever its size.
+			static const uint64_t DefaultMaxBufferBytes = 1ull << 30;
+			// Largest single write, keeps a stalled write from holding a buffer for too long
+			static const size_t MaxWriteBytes = 4 << 20;
+			// SUVDA_CAPTURE_QUEUE_BLOCK waits, about a frame by default and never long enough to trip the OS watchdog
+			static const uint32_t DefaultBlockMs = 20;
+			static const uint32_t MaxBlockMs = 1000;
+
+			// Index is only used by SUVDA_CAPTURE_FORMAT_RAW and may be null otherwise
+			FrameCaptureWriter(std::unique_ptr<ICaptureSink> Data, std::unique_ptr<ICaptureSink> Index, const FRAME_CAPTURE_CONFIG& Config);
+			~FrameCaptureWriter();
+
+			// Starts the writer thread
+			bool Start();
+
+			// Queues a copy of the frame for writing, returns false if it was dropped or skipped. Only waits for I/O
+			// with SUVDA_CAPTURE_QUEUE_BLOCK. The only allocation happens the first time a buffer is used for a larger
+			// frame, and only within MaxBufferBytes.
+			bool Submit(const SUDOVDA::SUVDA_FRAME_SLOT& Desc, const uint8_t* pData);
+
+			// Writes everything still queued and stops the writer thread
+			void Stop();
+
+			FRAME_CAPTURE_STATS Stats() const;
+
+		private:
+			struct Buffer
+			{
+				std::unique_ptr<uint8_t[]> Storage;
+				uint8_t* pData = nullptr; // Aligned to SUVDA_CAPTURE_DATA_ALIGNMENT within Storage
+				size_t Capacity = 0;
+				SUDOVDA::SUVDA_CAPTURE_INDEX_ENTRY Entry{}; // DataOffset is filled in when written
+			};
+
+			bool AcquireBuffer(size_t Bytes, uint32_t& Index);
+			bool WaitForBuffer(uint32_t& Index);
+			void Run();
+			void WriteFrame(Buffer& Frame);
+			void WriteRaw(Buffer& Frame);
+			void WriteY4m(Buffer& Frame);
+			bool WriteData(const uint8_t* pData, size_t Bytes);
+
+			std::unique_ptr<ICaptureSink> m_Data;
+			std::unique_ptr<ICaptureSink> m_Index;
+			FRAME_CAPTURE_CONFIG m_Config;
+			std::vector<Buffer> m_Buffers;
+
+			// Every buffer is either free, being filled by Submit(), queued, being written, or retired. Holding
+			// BufferCount + 2 buffers means Submit() finds a free one until buffers are retired, after that it applies
+			// the queue policy to the free buffers itself.
+			std::unique_ptr<HandoffQueue<uint32_t>> m_FreeBuffers;
+			std::unique_ptr<HandoffQueue<uint32_t>> m_Queued;
+			uint32_t m_BlockMs = 0;
+			uint64_t m_BufferBytes = 0;       // Held by all buffers, only Submit() allocates
+			std::thread m_Thread;
+
+			// Geometry of the Y4M stream, fixed by the first frame submitted
+			uint32_t m_StreamWidth = 0;
+			uint32_t m_StreamHeight = 0;
+
+			// Writer thread state. After a failed write the file layout is unknown, so nothing more is written.
+			uint64_t m_DataOffset = 0;
+			bool m_Failed = false;
+			std::vector<uint8_t> m_Planes;
+
+			std::atomic<uint64_t> m_FramesSubmitted{0};
+			std::atomic<uint64_t> m_FramesWritten{0};
+			std::atomic<uint64_t> m_FramesDropped{0};
+			std::atomic<uint64_t> m_FramesRejected{0}; // Dropped before copying, counted as DroppedNewest
+			std::atomic<uint64_t> m_FramesEvicted{0};  // Queued frames whose buffer a newer one took, DroppedOldest
+			std::atomic<uint64_t> m_FramesBlocked{0};  // Waits for a buffer, counted with the queue's
+			std::atomic<uint64_t> m_FramesTimedOut{0};
+			std::atomic<uint64_t> m_FramesSkipped{0};
+			std::atomic<uint64_t> m_BytesWritten{0};
+			std::atomic<uint64_t> m_WriteErrors{0};
+		};
+	}
+}
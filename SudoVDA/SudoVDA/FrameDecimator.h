@@ -0,0 +1,297 @@
+#pragma once
+
+// Per-consumer frame-rate decimation for the swap-chain processing loop.
+//
+// A monitor often runs at a high refresh rate for the games on it while a consumer of its frames only wants 30 or 60
+// fps. Every consumer can register a target rate, and a FrameDecimator per rate decides for every acquired frame,
+// before anything is copied, whether that consumer needs it. A frame is exported when any consumer needs it.
+//
+// The decimator keeps a grid of target-rate deadlines in exact rational ticks and keeps the frame closest to each
+// deadline: a frame is due once it is less than half a source period before the next deadline. Keeping a frame
+// advances the deadline by whole target periods, never to the frame's time, so the output stays phase-locked to the
+// grid. A 59.94 Hz source decimated to 30 fps alternates 2 and 1 frame steps exactly as often as needed to average
+// 30 fps instead of drifting to 29.97, and 143.9 Hz to 60 fps mixes 2 and 3 frame steps.
+//
+// Like the FramePacer all time is measured in ticks of an IPacingClock.
+
+#include <stdint.h>
+
+#include "FramePacer.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		class FrameDecimator
+		{
+		public:
+			explicit FrameDecimator(uint64_t Frequency = 0) : m_Frequency(Frequency)
+			{
+			}
+
+			// Target rate as a fraction in Hz, a zero numerator or denominator keeps every frame. The source rate is
+			// the committed mode's refresh rate, it only sets how early a frame may be kept, 0 when unknown.
+			void Configure(uint32_t TargetNumerator, uint32_t TargetDenominator, uint32_t SourceNumerator, uint32_t SourceDenominator)
+			{
+				bool Enabled = TargetNumerator && TargetDenominator;
+				if (Enabled != IsEnabled() || TargetNumerator != m_TargetNumerator || TargetDenominator != m_TargetDenominator)
+				{
+					m_TargetNumerator = Enabled ? TargetNumerator : 0;
+					m_TargetDenominator = Enabled ? TargetDenominator : 0;
+					m_Started = false;
+
+					if (Enabled)
+					{
+						// Period in ticks is Frequency * Den / Num, split into whole ticks and a remainder in 1/Num ticks
+						uint64_t Scaled = m_Frequency * TargetDenominator;
+						m_PeriodTicks = Scaled / TargetNumerator;
+						m_PeriodFraction = Scaled % TargetNumerator;
+					}
+				}
+
+				// Half a source period, or a quarter of the target period while the source rate is unknown
+				if (SourceNumerator && SourceDenominator)
+				{
+					m_Tolerance = m_Frequency * SourceDenominator / SourceNumerator / 2;
+				}
+				else
+				{
+					m_Tolerance = m_PeriodTicks / 4;
+				}
+
+				// A source slower than the target would otherwise let frames in early and pull the grid forward
+				if (m_Tolerance > m_PeriodTicks / 2)
+				{
+					m_Tolerance = m_PeriodTicks / 2;
+				}
+			}
+
+			bool IsEnabled() const
+			{
+				return m_TargetNumerator != 0;
+			}
+
+			// Whether the frame presented at Ticks is kept. Every frame has to be offered, in order.
+			bool ShouldKeep(uint64_t Ticks)
+			{
+				if (!IsEnabled())
+				{
+					return true;
+				}
+
+				if (!m_Started)
+				{
+					// The first frame anchors the grid
+					m_Started = true;
+					m_DueTicks = Ticks;
+					m_DueFraction = 0;
+					Advance(1);
+					return true;
+				}
+
+				if (Ticks + m_Tolerance < DueCeiling())
+				{
+					return false;
+				}
+
+				// Move to the first deadline that this frame doesn't satisfy. After an idle period that skips every
+				// deadline that passed without a frame, the grid keeps its phase. The deadlines up to Reached are counted
+				// from the exact period, (Reached - Due) * Num / (Frequency * Den), however long the idle period was.
+				uint64_t Reached = Ticks + m_Tolerance;
+				uint64_t Missed = MulSubDiv(Reached - m_DueTicks, m_TargetNumerator, m_DueFraction, m_Frequency * m_TargetDenominator);
+				Advance(Missed + 1);
+
+				return true;
+			}
+
+			// True once the next deadline has passed by more than the tolerance without a frame
+			bool IsOverdue(uint64_t Now) const
+			{
+				return IsEnabled() && m_Started && Now >= DueCeiling() + m_Tolerance;
+			}
+
+			// Ticks until IsOverdue() turns true, UINT64_MAX if it never does
+			uint64_t TimeUntilOverdue(uint64_t Now) const
+			{
+				if (!IsEnabled() || !m_Started)
+				{
+					return UINT64_MAX;
+				}
+
+				uint64_t Overdue = DueCeiling() + m_Tolerance;
+				return Overdue > Now ? Overdue - Now : 0;
+			}
+
+		private:
+			uint64_t DueCeiling() const
+			{
+				return m_DueTicks + (m_DueFraction ? 1 : 0);
+			}
+
+			void Advance(uint64_t Periods)
+			{
+				// Whole numerators of periods first, so the fractions never overflow
+				uint64_t Fraction = m_DueFraction + Periods % m_TargetNumerator * m_PeriodFraction;
+				m_DueTicks += Periods * m_PeriodTicks + Periods / m_TargetNumerator * m_PeriodFraction + Fraction / m_TargetNumerator;
+				m_DueFraction = Fraction % m_TargetNumerator;
+			}
+
+			// (A * B - C) / D for A * B >= C, with the 128-bit product MSVC has no portable type for. The quotient
+			// must fit 64 bits.
+			static uint64_t MulSubDiv(uint64_t A, uint64_t B, uint64_t C, uint64_t D)
+			{
+				uint64_t LowLow = (A & 0xFFFFFFFF) * (B & 0xFFFFFFFF);
+				uint64_t HighLow = (A >> 32) * (B & 0xFFFFFFFF);
+				uint64_t LowHigh = (A & 0xFFFFFFFF) * (B >> 32);
+				uint64_t Middle = (LowLow >> 32) + (HighLow & 0xFFFFFFFF) + (LowHigh & 0xFFFFFFFF);
+				uint64_t High = (A >> 32) * (B >> 32) + (HighLow >> 32) + (LowHigh >> 32) + (Middle >> 32);
+				uint64_t Low = A * B;
+				High -= Low < C ? 1 : 0;
+				Low -= C;
+
+				uint64_t Quotient = 0;
+				uint64_t Remainder = 0;
+				for (int Bit = 127; Bit >= 0; Bit--)
+				{
+					bool Carry = (Remainder >> 63) != 0;
+					Remainder = Remainder << 1 | ((Bit >= 64 ? High >> (Bit - 64) : Low >> Bit) & 1);
+					Quotient <<= 1;
+					if (Carry || Remainder >= D)
+					{
+						Remainder -= D;
+						Quotient |= 1;
+					}
+				}
+
+				return Quotient;
+			}
+
+			uint64_t m_Frequency;
+			uint32_t m_TargetNumerator = 0;
+			uint32_t m_TargetDenominator = 0;
+			uint64_t m_PeriodTicks = 0;
+			uint64_t m_PeriodFraction = 0;  // In 1/m_TargetNumerator ticks
+			uint64_t m_Tolerance = 0;
+			bool m_Started = false;
+			uint64_t m_DueTicks = 0;
+			uint64_t m_DueFraction = 0;     // In 1/m_TargetNumerator ticks
+		};
+
+		typedef struct _DECIMATION_STATS {
+			uint64_t Kept;
+			uint64_t Skipped;
+		} DECIMATION_STATS;
+
+		/// <summary>
+		/// The decimators of every consumer registered on a monitor.
+		/// </summary>
+		class FrameDecimatorSet
+		{
+		public:
+			static const uint32_t MaxConsumers = 8;
+
+			explicit FrameDecimatorSet(IPacingClock& Clock)
+			{
+				for (auto& Decimator : m_Decimators)
+				{
+					Decimator = FrameDecimator(Clock.Frequency());
+				}
+			}
+
+			void Configure(uint32_t Consumer, uint32_t TargetNumerator, uint32_t TargetDenominator)
+			{
+				if (Consumer < MaxConsumers)
+				{
+					m_Targets[Consumer][0] = TargetNumerator;
+					m_Targets[Consumer][1] = TargetDenominator;
+					m_Decimators[Consumer].Configure(TargetNumerator, TargetDenominator, m_SourceNumerator, m_SourceDenominator);
+				}
+			}
+
+			void SetSourceRate(uint32_t Numerator, uint32_t Denominator)
+			{
+				if (Numerator == m_SourceNumerator && Denominator == m_SourceDenominator)
+				{
+					return;
+				}
+
+				m_SourceNumerator = Numerator;
+				m_SourceDenominator = Denominator;
+				for (uint32_t i = 0; i < MaxConsumers; i++)
+				{
+					m_Decimators[i].Configure(m_Targets[i][0], m_Targets[i][1], Numerator, Denominator);
+				}
+			}
+
+			bool IsEnabled() const
+			{
+				for (auto& Decimator : m_Decimators)
+				{
+					if (Decimator.IsEnabled())
+					{
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+			// Whether any consumer needs the frame presented at Ticks. Every decimator sees every frame.
+			bool ShouldKeep(uint64_t Ticks)
+			{
+				bool Enabled = false;
+				bool Keep = false;
+				for (auto& Decimator : m_Decimators)
+				{
+					if (Decimator.IsEnabled())
+					{
+						Enabled = true;
+						Keep |= Decimator.ShouldKeep(Ticks);
+					}
+				}
+
+				Keep |= !Enabled;
+				(Keep ? m_Stats.Kept : m_Stats.Skipped)++;
+				return Keep;
+			}
+
+			// True once some consumer's deadline passed without a frame. The last skipped frame is then due after all.
+			bool IsOverdue(uint64_t Now) const
+			{
+				for (auto& Decimator : m_Decimators)
+				{
+					if (Decimator.IsOverdue(Now))
+					{
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+			uint64_t TimeUntilOverdue(uint64_t Now) const
+			{
+				uint64_t Ticks = UINT64_MAX;
+				for (auto& Decimator : m_Decimators)
+				{
+					uint64_t Until = Decimator.TimeUntilOverdue(Now);
+					Ticks = Until < Ticks ? Until : Ticks;
+				}
+
+				return Ticks;
+			}
+
+			const DECIMATION_STATS& Stats() const
+			{
+				return m_Stats;
+			}
+
+		private:
+			FrameDecimator m_Decimators[MaxConsumers];
+			uint32_t m_Targets[MaxConsumers][2] = {};
+			uint32_t m_SourceNumerator = 0;
+			uint32_t m_SourceDenominator = 0;
+			DECIMATION_STATS m_Stats{};
+		};
+	}
+}
@@ -0,0 +1,287 @@
+#include "FrameHash.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FRAME_HASH_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define FRAME_HASH_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// Flatten pulls the generic row loop into the AVX2 entry point, GCC and Clang won't inline AVX2 code otherwise
+#if defined(_MSC_VER) && !defined(__clang__)
+#define FRAME_HASH_TARGET_AVX2
+#else
+#define FRAME_HASH_TARGET_AVX2 __attribute__((target("avx2"), flatten))
+#endif
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			const uint32_t StripeBytes = 64;
+			const uint32_t Lanes = StripeBytes / 8;
+
+			const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+			const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+			const uint64_t KeyStep = 0x165667B19E3779F9ULL;
+
+			const uint64_t InitialKey[Lanes] =
+			{
+				0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+				0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+			};
+
+			inline uint64_t Load64(const uint8_t* p)
+			{
+				uint64_t Value;
+				memcpy(&Value, p, sizeof(Value));
+				return Value;
+			}
+
+			inline uint64_t Mix(uint64_t Value)
+			{
+				Value ^= Value >> 33;
+				Value *= Prime2;
+				Value ^= Value >> 29;
+				Value *= Prime1;
+				Value ^= Value >> 32;
+				return Value;
+			}
+
+			// Copies the partial stripe at the end of a row into a zero padded buffer
+			inline const uint8_t* PadTail(const uint8_t* pRow, uint32_t Offset, uint32_t RowBytes, uint8_t* pBuffer)
+			{
+				memset(pBuffer, 0, StripeBytes);
+				memcpy(pBuffer, pRow + Offset, RowBytes - Offset);
+				return pBuffer;
+			}
+
+			uint64_t Finalize(const uint64_t* pAcc, uint32_t RowBytes, uint32_t Rows)
+			{
+				uint64_t Hash = ((uint64_t)RowBytes << 32 | Rows) * Prime1;
+				for (uint32_t i = 0; i < Lanes; i++)
+				{
+					Hash = Mix(Hash ^ pAcc[i]) + i;
+				}
+
+				return Hash;
+			}
+
+			struct ScalarLanes
+			{
+				uint64_t Acc[Lanes] = {};
+				uint64_t Key[Lanes];
+
+				ScalarLanes()
+				{
+					memcpy(Key, InitialKey, sizeof(Key));
+				}
+
+				void Stripe(const uint8_t* p)
+				{
+					uint64_t Data[Lanes];
+					for (uint32_t i = 0; i < Lanes; i++)
+					{
+						Data[i] = Load64(p + 8 * i);
+					}
+
+					for (uint32_t i = 0; i < Lanes; i++)
+					{
+						uint64_t Keyed = Data[i] ^ Key[i];
+						Acc[i] += Data[i ^ 1] + (Keyed & 0xffffffff) * (Keyed >> 32);
+						Key[i] += KeyStep;
+					}
+				}
+
+				void Store(uint64_t* pAcc) const
+				{
+					memcpy(pAcc, Acc, sizeof(Acc));
+				}
+			};
+
+#if FRAME_HASH_X64
+			struct Sse2Lanes
+			{
+				__m128i Acc[4];
+				__m128i Key[4];
+
+				Sse2Lanes()
+				{
+					for (int i = 0; i < 4; i++)
+					{
+						Acc[i] = _mm_setzero_si128();
+						Key[i] = _mm_loadu_si128((const __m128i*)&InitialKey[2 * i]);
+					}
+				}
+
+				void Stripe(const uint8_t* p)
+				{
+					const __m128i Step = _mm_set1_epi64x((long long)KeyStep);
+					for (int i = 0; i < 4; i++)
+					{
+						__m128i Data = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+						__m128i Keyed = _mm_xor_si128(Data, Key[i]);
+						__m128i Product = _mm_mul_epu32(Keyed, _mm_srli_epi64(Keyed, 32));
+						__m128i Swapped = _mm_shuffle_epi32(Data, _MM_SHUFFLE(1, 0, 3, 2));
+						Acc[i] = _mm_add_epi64(Acc[i], _mm_add_epi64(Swapped, Product));
+						Key[i] = _mm_add_epi64(Key[i], Step);
+					}
+				}
+
+				void Store(uint64_t* pAcc) const
+				{
+					for (int i = 0; i < 4; i++)
+					{
+						_mm_storeu_si128((__m128i*)&pAcc[2 * i], Acc[i]);
+					}
+				}
+			};
+
+			struct Avx2Lanes
+			{
+				__m256i Acc[2];
+				__m256i Key[2];
+
+				FRAME_HASH_TARGET_AVX2 Avx2Lanes()
+				{
+					for (int i = 0; i < 2; i++)
+					{
+						Acc[i] = _mm256_setzero_si256();
+						Key[i] = _mm256_loadu_si256((const __m256i*)&InitialKey[4 * i]);
+					}
+				}
+
+				FRAME_HASH_TARGET_AVX2 void Stripe(const uint8_t* p)
+				{
+					const __m256i Step = _mm256_set1_epi64x((long long)KeyStep);
+					for (int i = 0; i < 2; i++)
+					{
+						__m256i Data = _mm256_loadu_si256((const __m256i*)(p + 32 * i));
+						__m256i Keyed = _mm256_xor_si256(Data, Key[i]);
+						__m256i Product = _mm256_mul_epu32(Keyed, _mm256_srli_epi64(Keyed, 32));
+						__m256i Swapped = _mm256_shuffle_epi32(Data, _MM_SHUFFLE(1, 0, 3, 2));
+						Acc[i] = _mm256_add_epi64(Acc[i], _mm256_add_epi64(Swapped, Product));
+						Key[i] = _mm256_add_epi64(Key[i], Step);
+					}
+				}
+
+				FRAME_HASH_TARGET_AVX2 void Store(uint64_t* pAcc) const
+				{
+					for (int i = 0; i < 2; i++)
+					{
+						_mm256_storeu_si256((__m256i*)&pAcc[4 * i], Acc[i]);
+					}
+				}
+			};
+#endif
+
+#if FRAME_HASH_ARM64
+			struct NeonLanes
+			{
+				uint64x2_t Acc[4];
+				uint64x2_t Key[4];
+
+				NeonLanes()
+				{
+					for (int i = 0; i < 4; i++)
+					{
+						Acc[i] = vdupq_n_u64(0);
+						Key[i] = vld1q_u64(&InitialKey[2 * i]);
+					}
+				}
+
+				void Stripe(const uint8_t* p)
+				{
+					const uint64x2_t Step = vdupq_n_u64(KeyStep);
+					for (int i = 0; i < 4; i++)
+					{
+						uint64x2_t Data = vreinterpretq_u64_u8(vld1q_u8(p + 16 * i));
+						uint64x2_t Keyed = veorq_u64(Data, Key[i]);
+						uint64x2_t Product = vmull_u32(vmovn_u64(Keyed), vshrn_n_u64(Keyed, 32));
+						uint64x2_t Swapped = vextq_u64(Data, Data, 1);
+						Acc[i] = vaddq_u64(Acc[i], vaddq_u64(Swapped, Product));
+						Key[i] = vaddq_u64(Key[i], Step);
+					}
+				}
+
+				void Store(uint64_t* pAcc) const
+				{
+					for (int i = 0; i < 4; i++)
+					{
+						vst1q_u64(&pAcc[2 * i], Acc[i]);
+					}
+				}
+			};
+#endif
+
+			template<typename TLanes>
+			inline uint64_t HashWith(TLanes& State, const uint8_t* pData, size_t Pitch, uint32_t RowBytes, uint32_t Rows)
+			{
+				uint8_t Tail[StripeBytes];
+
+				for (uint32_t y = 0; y < Rows; y++)
+				{
+					const uint8_t* pRow = pData + y * Pitch;
+					uint32_t x = 0;
+
+					for (; x + StripeBytes <= RowBytes; x += StripeBytes)
+					{
+						State.Stripe(pRow + x);
+					}
+
+					if (x < RowBytes)
+					{
+						State.Stripe(PadTail(pRow, x, RowBytes, Tail));
+					}
+				}
+
+				uint64_t Acc[Lanes];
+				State.Store(Acc);
+				return Finalize(Acc, RowBytes, Rows);
+			}
+
+#if FRAME_HASH_X64
+			FRAME_HASH_TARGET_AVX2 uint64_t HashRegionAvx2(const uint8_t* pData, size_t Pitch, uint32_t RowBytes, uint32_t Rows)
+			{
+				Avx2Lanes State;
+				return HashWith(State, pData, Pitch, RowBytes, Rows);
+			}
+#endif
+		}
+
+		uint64_t HashRegionScalar(const uint8_t* pData, size_t Pitch, uint32_t RowBytes, uint32_t Rows)
+		{
+			ScalarLanes State;
+			return HashWith(State, pData, Pitch, RowBytes, Rows);
+		}
+
+		uint64_t HashRegion(const uint8_t* pData, size_t Pitch, uint32_t RowBytes, uint32_t Rows)
+		{
+#if FRAME_HASH_X64
+			// SSE2 is part of x64, AVX2 follows the instruction set picked for pixel conversion
+			if (PixelConvertGetIsa() == PIXEL_CONVERT_ISA_AVX2)
+			{
+				return HashRegionAvx2(pData, Pitch, RowBytes, Rows);
+			}
+
+			Sse2Lanes State;
+			return HashWith(State, pData, Pitch, RowBytes, Rows);
+#elif FRAME_HASH_ARM64
+			NeonLanes State;
+			return HashWith(State, pData, Pitch, RowBytes, Rows);
+#else
+			return HashRegionScalar(pData, Pitch, RowBytes, Rows);
+#endif
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Fast non-cryptographic hashing of 2D pixel regions, used to detect frames that repeat the previous one.
+//
+// The hash keeps eight 64-bit lanes that consume the region in 64-byte stripes, XXH3 style: every lane adds its
+// neighbour's input and the product of the two 32-bit halves of (input ^ key). The key advances with every stripe, so
+// the same bytes at a different position hash differently and swapped rows are detected. The lanes map directly
+// onto SSE2, AVX2 and NEON registers. All paths produce the same value, so hashes can be compared across them.
+//
+// A hash match is only a candidate, the driver confirms it byte for byte where it still has the previous frame (see
+// SUVDA_FRAME_FLAG_UNCHANGED). With 64-bit hashes an accidental collision between consecutive frames of the same tile
+// is far less likely than a transmission error, so the confirmation almost never fails.
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		// Hashes Rows rows of RowBytes bytes each, Pitch bytes apart
+		uint64_t HashRegion(const uint8_t* pData, size_t Pitch, uint32_t RowBytes, uint32_t Rows);
+
+		// Scalar reference implementation, for verifying the dispatched one
+		uint64_t HashRegionScalar(const uint8_t* pData, size_t Pitch, uint32_t RowBytes, uint32_t Rows);
+	}
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+// Deadline-driven frame pacing for the swap-chain processing loop.
+//
+// The pacer keeps a virtual vblank grid for the committed refresh rate and tells the processing loop how long it may
+// sleep before the next vblank. All time is measured in ticks of an IPacingClock, so the logic runs unchanged against
+// QueryPerformanceCounter in the driver and against a synthetic clock in tests.
+
+#include <stdint.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		/// <summary>
+		/// Monotonic time source used by the pacer.
+		/// </summary>
+		class IPacingClock
+		{
+		public:
+			virtual ~IPacingClock() = default;
+
+			virtual uint64_t Now() = 0;
+			virtual uint64_t Frequency() = 0; // Ticks per second
+		};
+
+		typedef enum _PACER_WAKE_REASON {
+			PACER_WAKE_NEW_SURFACE,
+			PACER_WAKE_DEADLINE,
+			PACER_WAKE_POLL,             // A wait cut short before the deadline, e.g. to poll readbacks
+			PACER_WAKE_REASON_COUNT,
+		} PACER_WAKE_REASON;
+
+		typedef struct _PACER_STATS {
+			uint64_t Wakes[PACER_WAKE_REASON_COUNT];
+			uint64_t LateWakes;          // Deadline wakes that arrived more than a quarter period late
+			uint64_t TotalLatenessTicks; // Sum over all deadline wakes
+			uint64_t MaxLatenessTicks;
+		} PACER_STATS;
+
+		class FramePacer
+		{
+		public:
+			// Period used while no refresh rate is known, matches the historical 16 ms poll
+			static const uint32_t FallbackIntervalMs = 16;
+
+			explicit FramePacer(IPacingClock& Clock) : m_Clock(Clock), m_Frequency(Clock.Frequency())
+			{
+			}
+
+			// Sets the committed mode's refresh rate as a fraction in Hz. A zero numerator or denominator disables
+			// pacing and the fallback interval is used.
+			void SetRefreshRate(uint32_t Numerator, uint32_t Denominator)
+			{
+				if (Numerator == m_Numerator && Denominator == m_Denominator)
+				{
+					return;
+				}
+
+				m_Numerator = Numerator;
+				m_Denominator = Denominator;
+				Reanchor(m_Clock.Now());
+			}
+
+			bool IsPaced() const
+			{
+				return m_Numerator && m_Denominator;
+			}
+
+			// Aligns the vblank grid to a known presentation time, e.g. the OS present timestamp of a frame
+			void OnFrame(uint64_t PresentTick)
+			{
+				if (PresentTick)
+				{
+					Reanchor(PresentTick);
+				}
+			}
+
+			// Absolute tick of the first vblank strictly after now
+			uint64_t NextDeadline()
+			{
+				uint64_t Now = m_Clock.Now();
+
+				if (!IsPaced())
+				{
+					m_Deadline = Now + m_Frequency * FallbackIntervalMs / 1000;
+					return m_Deadline;
+				}
+
+				if (Now < m_Anchor)
+				{
+					m_Deadline = m_Anchor;
+					return m_Deadline;
+				}
+
+				// After a long stall (e.g. system sleep) the old phase is meaningless anyway
+				if (Now - m_Anchor > m_Frequency * 3600)
+				{
+					Reanchor(Now);
+				}
+
+				// Keep the products below 2^64 by moving the anchor forward once it gets far behind
+				uint64_t Index = VblankIndex(Now) + 1;
+				if (Index > (1u << 20))
+				{
+					Reanchor(VblankTick(Index - 1));
+					Index = 1;
+				}
+
+				m_Deadline = VblankTick(Index);
+				return m_Deadline;
+			}
+
+			// Ticks until the next deadline, computed with NextDeadline()
+			uint64_t TimeUntilDeadline()
+			{
+				uint64_t Deadline = NextDeadline();
+				uint64_t Now = m_Clock.Now();
+
+				return Deadline > Now ? Deadline - Now : 0;
+			}
+
+			// Same as TimeUntilDeadline() but rounded up to whole milliseconds, for waits without a precise timer
+			uint32_t TimeUntilDeadlineMs()
+			{
+				uint64_t Ticks = TimeUntilDeadline();
+
+				return (uint32_t)((Ticks * 1000 + m_Frequency - 1) / m_Frequency);
+			}
+
+			// Reason for a wait that timed out at Now: the deadline once it has passed, else a poll that the loop
+			// scheduled before it
+			PACER_WAKE_REASON TimeoutReason(uint64_t Now) const
+			{
+				return m_Deadline && Now >= m_Deadline ? PACER_WAKE_DEADLINE : PACER_WAKE_POLL;
+			}
+
+			// Records why the processing loop woke up. Deadline wakes are measured against the last computed deadline.
+			void OnWake(PACER_WAKE_REASON Reason)
+			{
+				m_Stats.Wakes[Reason]++;
+
+				if (Reason != PACER_WAKE_DEADLINE || !m_Deadline)
+				{
+					return;
+				}
+
+				uint64_t Now = m_Clock.Now();
+				uint64_t Lateness = Now > m_Deadline ? Now - m_Deadline : 0;
+
+				m_Stats.TotalLatenessTicks += Lateness;
+				if (Lateness > m_Stats.MaxLatenessTicks)
+				{
+					m_Stats.MaxLatenessTicks = Lateness;
+				}
+
+				if (IsPaced() && Lateness * 4 * m_Numerator > m_Frequency * m_Denominator)
+				{
+					m_Stats.LateWakes++;
+				}
+			}
+
+			const PACER_STATS& Stats() const
+			{
+				return m_Stats;
+			}
+
+		private:
+			void Reanchor(uint64_t Tick)
+			{
+				m_Anchor = Tick;
+			}
+
+			// Index of the last vblank at or before Tick, Tick must not precede the anchor
+			uint64_t VblankIndex(uint64_t Tick) const
+			{
+				return (Tick - m_Anchor) * m_Numerator / (m_Frequency * m_Denominator);
+			}
+
+			// Tick of vblank Index, rounded up so that waking at it never lands before the vblank
+			uint64_t VblankTick(uint64_t Index) const
+			{
+				uint64_t Period = m_Frequency * m_Denominator;
+
+				return m_Anchor + (Index * Period + m_Numerator - 1) / m_Numerator;
+			}
+
+			IPacingClock& m_Clock;
+			uint64_t m_Frequency;
+			uint32_t m_Numerator = 0;
+			uint32_t m_Denominator = 0;
+			uint64_t m_Anchor = 0;
+			uint64_t m_Deadline = 0;
+			PACER_STATS m_Stats{};
+		};
+	}
+}
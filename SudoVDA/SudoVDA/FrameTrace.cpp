@@ -0,0 +1,121 @@
+#include "FrameTrace.h"
+
+using namespace SUDOVDA;
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		FrameTraceWriter::FrameTraceWriter(std::unique_ptr<ICaptureSink> Sink, uint64_t QpcFrequency, uint32_t Capacity) :
+			m_Sink(std::move(Sink)),
+			m_QpcFrequency(QpcFrequency),
+			m_Capacity(Capacity < 2 ? 2 : Capacity)
+		{
+			m_Batch.reserve(m_Capacity);
+		}
+
+		FrameTraceWriter::~FrameTraceWriter()
+		{
+			Stop();
+		}
+
+		bool FrameTraceWriter::Start()
+		{
+			SUVDA_TRACE_HEADER Header;
+			FillTraceHeader(Header, m_QpcFrequency);
+			if (!m_Sink->Write(&Header, sizeof(Header)))
+			{
+				return false;
+			}
+
+			m_Thread = std::thread(&FrameTraceWriter::Run, this);
+			return true;
+		}
+
+		bool FrameTraceWriter::Record(const SUVDA_TRACE_RECORD& Record)
+		{
+			bool Wake;
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				if (m_Stopping || m_Batch.size() >= m_Capacity)
+				{
+					m_RecordsDropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				m_Batch.push_back(Record);
+				Wake = m_Batch.size() == m_Capacity / 2;
+			}
+
+			if (Wake)
+			{
+				m_Wake.notify_one();
+			}
+
+			return true;
+		}
+
+		void FrameTraceWriter::Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				m_Stopping = true;
+			}
+			m_Wake.notify_one();
+
+			if (m_Thread.joinable())
+			{
+				m_Thread.join();
+			}
+		}
+
+		FRAME_TRACE_STATS FrameTraceWriter::Stats() const
+		{
+			FRAME_TRACE_STATS Stats;
+			Stats.RecordsWritten = m_RecordsWritten.load(std::memory_order_relaxed);
+			Stats.RecordsDropped = m_RecordsDropped.load(std::memory_order_relaxed);
+			Stats.WriteErrors = m_WriteErrors.load(std::memory_order_relaxed);
+			return Stats;
+		}
+
+		void FrameTraceWriter::Run()
+		{
+			// Swapped with the batch, so neither side allocates once both have grown to capacity
+			std::vector<SUVDA_TRACE_RECORD> Writing;
+			Writing.reserve(m_Capacity);
+
+			for (;;)
+			{
+				bool Stopping;
+				{
+					std::unique_lock<std::mutex> ul(m_Lock);
+					m_Wake.wait_for(ul, std::chrono::milliseconds(FlushIntervalMs), [this]
+					{
+						return m_Stopping || m_Batch.size() >= m_Capacity / 2;
+					});
+
+					Stopping = m_Stopping;
+					Writing.swap(m_Batch);
+				}
+
+				if (!Writing.empty())
+				{
+					if (m_Sink->Write(Writing.data(), Writing.size() * sizeof(SUVDA_TRACE_RECORD)))
+					{
+						m_RecordsWritten.fetch_add(Writing.size(), std::memory_order_relaxed);
+					}
+					else
+					{
+						m_WriteErrors.fetch_add(1, std::memory_order_relaxed);
+					}
+					Writing.clear();
+				}
+
+				if (Stopping)
+				{
+					return;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// Asynchronous writer for per-frame latency traces, see sudovda-trace.h for the file format.
+//
+// Record() runs on the swap-chain thread for every published frame. It appends to an in-memory batch under a short
+// lock and never touches the disk. A writer thread swaps the batch out and writes it whenever it is half full or a
+// flush interval has passed. Records arriving while the batch is full are dropped and counted.
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sudovda-trace.h>
+
+#include "FrameCapture.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef struct _FRAME_TRACE_STATS {
+			uint64_t RecordsWritten;
+			uint64_t RecordsDropped;
+			uint64_t WriteErrors;
+		} FRAME_TRACE_STATS;
+
+		class FrameTraceWriter
+		{
+		public:
+			// Records held in memory at most, about 4 seconds of frames at 240 Hz
+			static const uint32_t DefaultCapacity = 1024;
+			static const uint32_t FlushIntervalMs = 250;
+
+			FrameTraceWriter(std::unique_ptr<ICaptureSink> Sink, uint64_t QpcFrequency, uint32_t Capacity = DefaultCapacity);
+			~FrameTraceWriter();
+
+			// Writes the file header and starts the writer thread
+			bool Start();
+
+			// Queues a record, returns false if it was dropped. Never waits for I/O.
+			bool Record(const SUDOVDA::SUVDA_TRACE_RECORD& Record);
+
+			// Writes everything still queued and stops the writer thread
+			void Stop();
+
+			FRAME_TRACE_STATS Stats() const;
+
+		private:
+			void Run();
+
+			std::unique_ptr<ICaptureSink> m_Sink;
+			uint64_t m_QpcFrequency;
+			uint32_t m_Capacity;
+
+			std::mutex m_Lock;
+			std::condition_variable m_Wake;
+			std::vector<SUDOVDA::SUVDA_TRACE_RECORD> m_Batch;
+			bool m_Stopping = false;
+			std::thread m_Thread;
+
+			std::atomic<uint64_t> m_RecordsWritten{0};
+			std::atomic<uint64_t> m_RecordsDropped{0};
+			std::atomic<uint64_t> m_WriteErrors{0};
+		};
+	}
+}
@@ -0,0 +1,226 @@
+#include "GammaRamp.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+
+#include <sudovda-frame.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define GAMMA_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define GAMMA_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// MSVC allows any intrinsic in any function, GCC and Clang need the target spelled out per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GAMMA_TARGET_AVX2
+#else
+#define GAMMA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace SUDOVDA;
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			// Applies the tables to Pixels pixels of a row whose channels are Bits wide. pBytes is null unless Bits is 8.
+			typedef void (*GAMMA_ROW)(uint8_t* pRow, uint32_t Pixels, const uint32_t* pTable, const uint8_t* pBytes, uint32_t Bits);
+
+#pragma region Scalar
+
+			// Also finishes the SIMD paths' tails
+			void GammaRowFrom(uint32_t Start, uint8_t* pRow, uint32_t Pixels, const uint32_t* pTable, uint32_t Bits)
+			{
+				uint32_t Codes = 1u << Bits;
+				uint32_t Mask = Codes - 1;
+				uint32_t Alpha = ~((1u << (3 * Bits)) - 1);
+
+				for (uint32_t x = Start; x < Pixels; x++)
+				{
+					uint32_t Px;
+					memcpy(&Px, pRow + x * 4, sizeof(Px));
+					Px = (Px & Alpha) | pTable[Px & Mask] | pTable[Codes + ((Px >> Bits) & Mask)] | pTable[2 * Codes + ((Px >> (2 * Bits)) & Mask)];
+					memcpy(pRow + x * 4, &Px, sizeof(Px));
+				}
+			}
+
+			// Without gathers or wide table shuffles the three loads per pixel are as cheap as it gets, so SSE4.1 and
+			// 10-bit NEON use this too
+			void GammaRowScalar(uint8_t* pRow, uint32_t Pixels, const uint32_t* pTable, const uint8_t*, uint32_t Bits)
+			{
+				GammaRowFrom(0, pRow, Pixels, pTable, Bits);
+			}
+
+#pragma endregion
+
+#if GAMMA_X64
+
+#pragma region AVX2
+
+			// Eight pixels at a time, one gather per channel
+			GAMMA_TARGET_AVX2 void GammaRowAvx2(uint8_t* pRow, uint32_t Pixels, const uint32_t* pTable, const uint8_t*, uint32_t Bits)
+			{
+				const int* pBase = reinterpret_cast<const int*>(pTable);
+				__m256i Codes = _mm256_set1_epi32(1 << Bits);
+				__m256i Mask = _mm256_set1_epi32((1 << Bits) - 1);
+				__m256i Alpha = _mm256_set1_epi32((int)~((1u << (3 * Bits)) - 1));
+				__m128i Shift = _mm_cvtsi32_si128((int)Bits);
+
+				uint32_t x = 0;
+				for (; x + 8 <= Pixels; x += 8)
+				{
+					__m256i Px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRow + x * 4));
+					__m256i Index0 = _mm256_and_si256(Px, Mask);
+					__m256i Shifted = _mm256_srl_epi32(Px, Shift);
+					__m256i Index1 = _mm256_add_epi32(_mm256_and_si256(Shifted, Mask), Codes);
+					__m256i Index2 = _mm256_add_epi32(_mm256_and_si256(_mm256_srl_epi32(Shifted, Shift), Mask), _mm256_add_epi32(Codes, Codes));
+
+					__m256i Out = _mm256_and_si256(Px, Alpha);
+					Out = _mm256_or_si256(Out, _mm256_i32gather_epi32(pBase, Index0, 4));
+					Out = _mm256_or_si256(Out, _mm256_i32gather_epi32(pBase, Index1, 4));
+					Out = _mm256_or_si256(Out, _mm256_i32gather_epi32(pBase, Index2, 4));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(pRow + x * 4), Out);
+				}
+
+				GammaRowFrom(x, pRow, Pixels, pTable, Bits);
+			}
+
+#pragma endregion
+
+#endif // GAMMA_X64
+
+#if GAMMA_ARM64
+
+#pragma region NEON
+
+			// 256 byte table of one channel lookup, four 64 byte TBL/TBX steps cover every code
+			inline uint8x16_t LookupNeon(const uint8x16x4_t (&Table)[4], uint8x16_t Index)
+			{
+				uint8x16_t Step = vdupq_n_u8(64);
+				uint8x16_t Out = vqtbl4q_u8(Table[0], Index);
+				Index = vsubq_u8(Index, Step);
+				Out = vqtbx4q_u8(Out, Table[1], Index);
+				Index = vsubq_u8(Index, Step);
+				Out = vqtbx4q_u8(Out, Table[2], Index);
+				Index = vsubq_u8(Index, Step);
+				return vqtbx4q_u8(Out, Table[3], Index);
+			}
+
+			// 8-bit only, sixteen pixels at a time deinterleaved into channel planes
+			void GammaRowNeon(uint8_t* pRow, uint32_t Pixels, const uint32_t* pTable, const uint8_t* pBytes, uint32_t Bits)
+			{
+				if (!pBytes)
+				{
+					GammaRowFrom(0, pRow, Pixels, pTable, Bits);
+					return;
+				}
+
+				uint8x16x4_t Tables[3][4];
+				for (int c = 0; c < 3; c++)
+				{
+					for (int q = 0; q < 4; q++)
+					{
+						Tables[c][q] = vld1q_u8_x4(pBytes + c * 256 + q * 64);
+					}
+				}
+
+				uint32_t x = 0;
+				for (; x + 16 <= Pixels; x += 16)
+				{
+					uint8x16x4_t Px = vld4q_u8(pRow + x * 4);
+					for (int c = 0; c < 3; c++)
+					{
+						Px.val[c] = LookupNeon(Tables[c], Px.val[c]);
+					}
+					vst4q_u8(pRow + x * 4, Px);
+				}
+
+				GammaRowFrom(x, pRow, Pixels, pTable, Bits);
+			}
+
+#pragma endregion
+
+#endif // GAMMA_ARM64
+
+			GAMMA_ROW GammaRow()
+			{
+				switch (PixelConvertGetIsa())
+				{
+#if GAMMA_X64
+				case PIXEL_CONVERT_ISA_AVX2:
+					return GammaRowAvx2;
+#endif
+#if GAMMA_ARM64
+				case PIXEL_CONVERT_ISA_NEON:
+					return GammaRowNeon;
+#endif
+				default:
+					return GammaRowScalar;
+				}
+			}
+		}
+
+		GammaLut::GammaLut(const GAMMA_RAMP& Ramp, uint32_t Format) :
+			m_Format(Format),
+			m_Bits(Format == SUVDA_FRAME_FORMAT_RGB10A2 ? 10 : 8)
+		{
+			// Channels from the lowest bits of the pixel up
+			const uint16_t* Channels[3] = { Ramp.Blue, Ramp.Green, Ramp.Red };
+			if (Format == SUVDA_FRAME_FORMAT_RGB10A2)
+			{
+				Channels[0] = Ramp.Red;
+				Channels[2] = Ramp.Blue;
+			}
+
+			uint32_t Codes = 1u << m_Bits;
+			uint32_t Max = Codes - 1;
+			m_Table.resize(3 * Codes);
+
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				const uint16_t* pRamp = Channels[c];
+				for (uint32_t v = 0; v < Codes; v++)
+				{
+					// The code sits at v * 255 / Max on the ramp, interpolated in units of 1 / Max
+					uint32_t Position = v * (GammaRampEntries - 1);
+					uint32_t i = Position / Max;
+					uint32_t Fraction = Position % Max;
+					uint32_t Next = i + 1 < GammaRampEntries ? i + 1 : i;
+					uint32_t Value = pRamp[i] * (Max - Fraction) + pRamp[Next] * Fraction;
+
+					// Value / 65535 is the ramp entry scaled by Max, rounded to the nearest code
+					uint32_t Out = (Value + 32767) / 65535;
+					m_Table[c * Codes + v] = Out << (c * m_Bits);
+					if (m_Bits == 8)
+					{
+						m_Bytes.push_back((uint8_t)Out);
+					}
+					m_Identity = m_Identity && Out == v;
+				}
+			}
+		}
+
+		bool GammaLut::IsSupportedFormat(uint32_t Format)
+		{
+			return Format == SUVDA_FRAME_FORMAT_BGRA8 || Format == SUVDA_FRAME_FORMAT_RGB10A2;
+		}
+
+		void GammaLut::Apply(uint8_t* pFrame, size_t Pitch, uint32_t Left, uint32_t Top, uint32_t Right, uint32_t Bottom) const
+		{
+			GAMMA_ROW Row = GammaRow();
+			for (uint32_t y = Top; y < Bottom; y++)
+			{
+				Row(pFrame + y * Pitch + (size_t)Left * 4, Right - Left, m_Table.data(), m_Bytes.empty() ? nullptr : m_Bytes.data(), m_Bits);
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// Gamma ramps set by the OS (night light, calibration tools) applied to exported frames.
+//
+// The OS hands over three 256 entry 16-bit ramps. They are expanded into one table per channel for the frame format,
+// 256 entries for BGRA8 and 1024 for RGB10A2 (interpolated linearly between ramp entries), every entry already shifted
+// to its channel's bits of the 32-bit pixel, so a pixel takes three lookups ORed with its alpha bits. Ramps that map
+// every code to itself are detected so the frame can be left alone.
+//
+// The instruction set follows PixelConvertGetIsa(), all paths are bit-exact.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		const uint32_t GammaRampEntries = 256;
+
+		// Laid out like D3DDDI_GAMMA_RAMP_RGB256x3x16, 0 to 65535 for every channel
+		typedef struct _GAMMA_RAMP {
+			uint16_t Red[GammaRampEntries];
+			uint16_t Green[GammaRampEntries];
+			uint16_t Blue[GammaRampEntries];
+		} GAMMA_RAMP, * PGAMMA_RAMP;
+
+		class GammaLut
+		{
+		public:
+			// Format is SUVDA_FRAME_FORMAT_BGRA8 or SUVDA_FRAME_FORMAT_RGB10A2
+			GammaLut(const GAMMA_RAMP& Ramp, uint32_t Format);
+
+			static bool IsSupportedFormat(uint32_t Format);
+
+			uint32_t Format() const
+			{
+				return m_Format;
+			}
+
+			// Every code maps to itself, Apply() wouldn't change anything
+			bool IsIdentity() const
+			{
+				return m_Identity;
+			}
+
+			// Both map every code of the same format to the same value, so frames corrected with either look the same
+			bool HasSameTables(const GammaLut& Other) const
+			{
+				return m_Format == Other.m_Format && m_Table == Other.m_Table;
+			}
+
+			// Applies the ramp in place to the pixels [Left, Right) x [Top, Bottom). pFrame points at the top left of
+			// the frame, Pitch is in bytes. Alpha is kept.
+			void Apply(uint8_t* pFrame, size_t Pitch, uint32_t Left, uint32_t Top, uint32_t Right, uint32_t Bottom) const;
+
+		private:
+			uint32_t m_Format;
+			uint32_t m_Bits;
+			bool m_Identity = true;
+			// (1 << m_Bits) entries per channel, from the lowest bits of the pixel up
+			std::vector<uint32_t> m_Table;
+			// The same without the shift, 8-bit only, for byte shuffles
+			std::vector<uint8_t> m_Bytes;
+		};
+	}
+}
@@ -0,0 +1,372 @@
+#pragma once
+
+// Bounded hand-off queue between the swap-chain thread and the work downstream of it.
+//
+// Anything done inside the processing block delays IddCxSwapChainFinishedProcessingFrame, and with it the compositor.
+// Downstream work is therefore pushed through a HandoffQueue and run elsewhere, and the queue's policy decides what
+// happens when the consumer falls behind:
+//
+//  * HANDOFF_DROP_NEWEST rejects the new item, the producer never waits. This is the default.
+//  * HANDOFF_DROP_OLDEST evicts the oldest queued item to make room, so consumers always get the most recent work.
+//  * HANDOFF_BLOCK waits up to a timeout for room. Only for consumers that must not lose anything and whose owner
+//    accepts throttling the producer.
+//
+// The ring is the bounded MPMC queue by Dmitry Vyukov: every cell carries a sequence number that tells producers and
+// consumers whose turn it is, so an uncontended push or pop is one CAS and no lock. It serves a single producer and
+// consumer just as well. Sequence numbers count in steps of two, so a full cell and an empty one a lap later never
+// share one, even with a single cell. Waiting, for HANDOFF_BLOCK and for blocking pops, parks on a condition variable
+// that the fast path only touches while somebody is parked.
+//
+// Only the standard library is used, so the queue runs unchanged in the driver and in the benchmarks.
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef enum _HANDOFF_POLICY {
+			HANDOFF_DROP_NEWEST,
+			HANDOFF_DROP_OLDEST,
+			HANDOFF_BLOCK,
+		} HANDOFF_POLICY;
+
+		typedef enum _HANDOFF_RESULT {
+			HANDOFF_QUEUED,
+			HANDOFF_DROPPED,   // HANDOFF_DROP_NEWEST found the queue full
+			HANDOFF_TIMED_OUT, // HANDOFF_BLOCK found no room in time
+			HANDOFF_CLOSED,
+		} HANDOFF_RESULT;
+
+		typedef struct _HANDOFF_QUEUE_STATS {
+			uint64_t Pushed;
+			uint64_t Popped;
+			uint64_t DroppedNewest;
+			uint64_t DroppedOldest;  // Evicted to make room for a newer item
+			uint64_t Blocked;        // Pushes that had to wait for room
+			uint64_t TimedOut;
+		} HANDOFF_QUEUE_STATS;
+
+		template <typename T>
+		class HandoffQueue
+		{
+		public:
+			static const uint32_t WaitInfinite = UINT32_MAX;
+
+			explicit HandoffQueue(uint32_t Capacity, HANDOFF_POLICY Policy = HANDOFF_DROP_NEWEST, uint32_t TimeoutMs = 0) :
+				m_Capacity(Capacity ? Capacity : 1),
+				m_Policy(Policy),
+				m_TimeoutMs(TimeoutMs),
+				m_Cells(new Cell[m_Capacity])
+			{
+				for (uint32_t i = 0; i < m_Capacity; i++)
+				{
+					m_Cells[i].Sequence.store((uint64_t)i * 2, std::memory_order_relaxed);
+				}
+			}
+
+			HandoffQueue(const HandoffQueue&) = delete;
+			HandoffQueue& operator=(const HandoffQueue&) = delete;
+
+			uint32_t Capacity() const
+			{
+				return m_Capacity;
+			}
+
+			HANDOFF_POLICY Policy() const
+			{
+				return m_Policy;
+			}
+
+			// Approximate while other threads push or pop
+			uint32_t Size() const
+			{
+				uint64_t Head = m_Head.load(std::memory_order_relaxed);
+				uint64_t Tail = m_Tail.load(std::memory_order_relaxed);
+				return Tail > Head ? (uint32_t)(Tail - Head) : 0;
+			}
+
+			// Lock-free, leaves Item untouched on failure
+			bool TryPush(T& Item)
+			{
+				if (!PushCell(Item))
+				{
+					return false;
+				}
+
+				WakeWaiters();
+				return true;
+			}
+
+			// Lock-free
+			bool TryPop(T& Item)
+			{
+				if (!PopCell(Item))
+				{
+					return false;
+				}
+
+				WakeWaiters();
+				return true;
+			}
+
+			// Queues Item according to the policy. Items evicted by HANDOFF_DROP_OLDEST are passed to OnEvicted, which
+			// runs on the calling thread.
+			template <typename F>
+			HANDOFF_RESULT Push(T Item, F&& OnEvicted)
+			{
+				if (m_Closed.load(std::memory_order_acquire))
+				{
+					return HANDOFF_CLOSED;
+				}
+
+				if (TryPush(Item))
+				{
+					return HANDOFF_QUEUED;
+				}
+
+				switch (m_Policy)
+				{
+				case HANDOFF_DROP_OLDEST:
+					for (;;)
+					{
+						T Evicted;
+						if (TryPop(Evicted))
+						{
+							m_DroppedOldest.fetch_add(1, std::memory_order_relaxed);
+							OnEvicted(std::move(Evicted));
+						}
+
+						// Another producer may take the room first, or a consumer may have emptied the queue already
+						if (TryPush(Item))
+						{
+							return HANDOFF_QUEUED;
+						}
+					}
+
+				case HANDOFF_BLOCK:
+				{
+					m_Blocked.fetch_add(1, std::memory_order_relaxed);
+					if (Wait([&] { return PushCell(Item); }, m_TimeoutMs))
+					{
+						return HANDOFF_QUEUED;
+					}
+
+					if (m_Closed.load(std::memory_order_acquire))
+					{
+						return HANDOFF_CLOSED;
+					}
+
+					m_TimedOut.fetch_add(1, std::memory_order_relaxed);
+					return HANDOFF_TIMED_OUT;
+				}
+
+				default:
+					m_DroppedNewest.fetch_add(1, std::memory_order_relaxed);
+					return HANDOFF_DROPPED;
+				}
+			}
+
+			HANDOFF_RESULT Push(T Item)
+			{
+				return Push(std::move(Item), [](T&&) {});
+			}
+
+			// Waits up to TimeoutMs for an item. Returns false on timeout, or once the queue is closed and empty.
+			bool Pop(T& Item, uint32_t TimeoutMs = WaitInfinite)
+			{
+				return TryPop(Item) || Wait([&] { return PopCell(Item); }, TimeoutMs);
+			}
+
+			// Fails every later push and wakes all waiters. Items already queued can still be popped.
+			void Close()
+			{
+				{
+					std::lock_guard<std::mutex> lg(m_WaitLock);
+					m_Closed.store(true, std::memory_order_release);
+				}
+				m_Wake.notify_all();
+			}
+
+			bool IsClosed() const
+			{
+				return m_Closed.load(std::memory_order_acquire);
+			}
+
+			HANDOFF_QUEUE_STATS Stats() const
+			{
+				HANDOFF_QUEUE_STATS Stats;
+				Stats.Pushed = m_Pushed.load(std::memory_order_relaxed);
+				Stats.Popped = m_Popped.load(std::memory_order_relaxed);
+				Stats.DroppedNewest = m_DroppedNewest.load(std::memory_order_relaxed);
+				Stats.DroppedOldest = m_DroppedOldest.load(std::memory_order_relaxed);
+				Stats.Blocked = m_Blocked.load(std::memory_order_relaxed);
+				Stats.TimedOut = m_TimedOut.load(std::memory_order_relaxed);
+				return Stats;
+			}
+
+		private:
+			bool PushCell(T& Item)
+			{
+				uint64_t Pos = m_Tail.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					Cell& Target = m_Cells[Pos % m_Capacity];
+					uint64_t Sequence = Target.Sequence.load(std::memory_order_acquire);
+					int64_t Diff = (int64_t)(Sequence - Pos * 2);
+
+					if (Diff == 0)
+					{
+						if (m_Tail.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+						{
+							Target.Value = std::move(Item);
+							Target.Sequence.store(Pos * 2 + 1, std::memory_order_release);
+							m_Pushed.fetch_add(1, std::memory_order_relaxed);
+							return true;
+						}
+					}
+					else if (Diff < 0)
+					{
+						// The cell still holds the item pushed a full lap ago
+						return false;
+					}
+					else
+					{
+						Pos = m_Tail.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			bool PopCell(T& Item)
+			{
+				uint64_t Pos = m_Head.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					Cell& Source = m_Cells[Pos % m_Capacity];
+					uint64_t Sequence = Source.Sequence.load(std::memory_order_acquire);
+					int64_t Diff = (int64_t)(Sequence - (Pos * 2 + 1));
+
+					if (Diff == 0)
+					{
+						if (m_Head.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed))
+						{
+							Item = std::move(Source.Value);
+							Source.Sequence.store((Pos + m_Capacity) * 2, std::memory_order_release);
+							m_Popped.fetch_add(1, std::memory_order_relaxed);
+							return true;
+						}
+					}
+					else if (Diff < 0)
+					{
+						return false;
+					}
+					else
+					{
+						Pos = m_Head.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			// Items are only ever touched by the thread that won the cell through its sequence number
+			struct Cell
+			{
+				std::atomic<uint64_t> Sequence;
+				T Value;
+			};
+
+			// Spins briefly, then parks until Attempt succeeds, the timeout passes or the queue is closed. Attempt is a
+			// PushCell or PopCell, it runs under the wait lock and must not wake anybody itself.
+			template <typename F>
+			bool Wait(F&& Attempt, uint32_t TimeoutMs)
+			{
+				for (uint32_t i = 0; i < SpinCount; i++)
+				{
+					std::this_thread::yield();
+					if (Attempt())
+					{
+						WakeWaiters();
+						return true;
+					}
+				}
+
+				auto Deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TimeoutMs);
+
+				m_Waiters.fetch_add(1, std::memory_order_seq_cst);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				std::unique_lock<std::mutex> ul(m_WaitLock);
+				bool Done;
+				for (;;)
+				{
+					// Checked under the lock after registering, so a wake-up between the check and the wait isn't lost
+					Done = Attempt();
+					if (Done || m_Closed.load(std::memory_order_acquire))
+					{
+						break;
+					}
+
+					if (TimeoutMs == WaitInfinite)
+					{
+						m_Wake.wait(ul);
+					}
+					else if (m_Wake.wait_until(ul, Deadline) == std::cv_status::timeout)
+					{
+						Done = Attempt();
+						break;
+					}
+				}
+				ul.unlock();
+				m_Waiters.fetch_sub(1, std::memory_order_relaxed);
+
+				if (Done)
+				{
+					WakeWaiters();
+				}
+
+				return Done;
+			}
+
+			void WakeWaiters()
+			{
+				// Pairs with the registration in Wait(): either the waiter sees this push or pop, or we see the waiter
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_Waiters.load(std::memory_order_relaxed))
+				{
+					{
+						std::lock_guard<std::mutex> lg(m_WaitLock);
+					}
+					m_Wake.notify_all();
+				}
+			}
+
+			static const uint32_t SpinCount = 16;
+
+			const uint32_t m_Capacity;
+			const HANDOFF_POLICY m_Policy;
+			const uint32_t m_TimeoutMs;
+			std::unique_ptr<Cell[]> m_Cells;
+
+			// Producers and consumers each get a cache line of their own
+			alignas(64) std::atomic<uint64_t> m_Tail{0};
+			alignas(64) std::atomic<uint64_t> m_Head{0};
+			alignas(64) std::atomic<uint32_t> m_Waiters{0};
+			std::atomic<bool> m_Closed{false};
+			std::mutex m_WaitLock;
+			std::condition_variable m_Wake;
+
+			std::atomic<uint64_t> m_Pushed{0};
+			std::atomic<uint64_t> m_Popped{0};
+			std::atomic<uint64_t> m_DroppedNewest{0};
+			std::atomic<uint64_t> m_DroppedOldest{0};
+			std::atomic<uint64_t> m_Blocked{0};
+			std::atomic<uint64_t> m_TimedOut{0};
+		};
+	}
+}
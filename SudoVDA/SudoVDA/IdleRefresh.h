@@ -0,0 +1,133 @@
+#pragma once
+
+// Idle refinement scheduling for the swap-chain processing loop.
+//
+// Once the desktop stops changing, the last exported frame is all a consumer has. Encoders that streamed it at a low
+// quality while it was changing would have to wait for the next repaint to improve it. The IdleRefreshPolicy decides
+// when the last frame should be published again as a refinement pass instead: after the display has been idle for a
+// configurable time, and then at most once per refresh interval, optionally limited to a number of passes per idle
+// period. Any new frame ends the idle period and restarts the countdown.
+//
+// Like the FramePacer all time is measured in ticks of an IPacingClock, so the schedule can be driven by a simulated
+// producer and a synthetic clock.
+
+#include <stdint.h>
+
+#include "FramePacer.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef struct _IDLE_REFRESH_STATS {
+			uint64_t Refreshes;   // Refinement passes issued
+			uint64_t IdlePeriods; // Idle periods that issued at least one pass
+		} IDLE_REFRESH_STATS;
+
+		class IdleRefreshPolicy
+		{
+		public:
+			// Shortest spacing between two passes, regardless of configuration
+			static const uint32_t MinIntervalMs = 50;
+
+			explicit IdleRefreshPolicy(IPacingClock& Clock) : m_Clock(Clock), m_Frequency(Clock.Frequency())
+			{
+			}
+
+			// IdleMs is how long no frame may arrive before the first pass, 0 disables refinement. IntervalMs spaces
+			// the passes that follow. MaxPasses limits the passes per idle period, 0 means no limit.
+			void Configure(uint32_t IdleMs, uint32_t IntervalMs, uint32_t MaxPasses)
+			{
+				m_IdleTicks = MsToTicks(IdleMs);
+				m_IntervalTicks = MsToTicks(IntervalMs < MinIntervalMs ? MinIntervalMs : IntervalMs);
+				m_MaxPasses = MaxPasses;
+			}
+
+			bool IsEnabled() const
+			{
+				return m_IdleTicks != 0;
+			}
+
+			// A new frame was produced, the idle period starts over
+			void OnFrame()
+			{
+				m_HaveFrame = true;
+				m_Passes = 0;
+				m_Due = m_Clock.Now() + m_IdleTicks;
+			}
+
+			// True once a pass is due. The caller issues it and reports back with OnRefresh().
+			bool ShouldRefresh()
+			{
+				return IsPending() && m_Clock.Now() >= m_Due;
+			}
+
+			// Records an issued pass and schedules the next one. Failed passes should be reported too, so a frame that
+			// can't be refined doesn't get retried in a tight loop.
+			void OnRefresh()
+			{
+				if (!m_Passes)
+				{
+					m_Stats.IdlePeriods++;
+				}
+
+				m_Passes++;
+				m_Stats.Refreshes++;
+
+				// Late passes don't bunch up, the next one is a full interval away from now
+				m_Due = m_Clock.Now() + m_IntervalTicks;
+			}
+
+			// Ticks until the next pass is due, UINT64_MAX if none is pending
+			uint64_t TimeUntilRefresh()
+			{
+				if (!IsPending())
+				{
+					return UINT64_MAX;
+				}
+
+				uint64_t Now = m_Clock.Now();
+				return m_Due > Now ? m_Due - Now : 0;
+			}
+
+			// Same as TimeUntilRefresh() but rounded up to whole milliseconds, UINT32_MAX if none is pending
+			uint32_t TimeUntilRefreshMs()
+			{
+				uint64_t Ticks = TimeUntilRefresh();
+				if (Ticks == UINT64_MAX)
+				{
+					return UINT32_MAX;
+				}
+
+				uint64_t Ms = (Ticks * 1000 + m_Frequency - 1) / m_Frequency;
+				return Ms >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)Ms;
+			}
+
+			const IDLE_REFRESH_STATS& Stats() const
+			{
+				return m_Stats;
+			}
+
+		private:
+			bool IsPending() const
+			{
+				return IsEnabled() && m_HaveFrame && (!m_MaxPasses || m_Passes < m_MaxPasses);
+			}
+
+			uint64_t MsToTicks(uint32_t Ms) const
+			{
+				return m_Frequency * Ms / 1000;
+			}
+
+			IPacingClock& m_Clock;
+			uint64_t m_Frequency;
+			uint64_t m_IdleTicks = 0;
+			uint64_t m_IntervalTicks = 0;
+			uint32_t m_MaxPasses = 0;
+			bool m_HaveFrame = false;
+			uint32_t m_Passes = 0;
+			uint64_t m_Due = 0;
+			IDLE_REFRESH_STATS m_Stats{};
+		};
+	}
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+// Fixed-memory, lock-free log-linear latency histogram.
+//
+// Values below 2^SubBucketBits land in exact buckets, every power of two above that is split into 2^SubBucketBits
+// linear sub-buckets, which bounds the relative error of any reported quantile to 1/2^SubBucketBits (~6%).
+//
+// A histogram has a single writer (the monitor's swap-chain processing) and any number of concurrent readers. The
+// writer only does relaxed loads and stores on its own counters, so recording never takes a lock or issues a locked
+// read-modify-write instruction. Readers may observe a sample in a bucket before it shows in Count(), which is fine
+// for monitoring purposes.
+
+#include <stdint.h>
+#include <atomic>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		static inline uint32_t HighestBitIndex(uint64_t Value)
+		{
+#if defined(_MSC_VER)
+			unsigned long Index;
+			_BitScanReverse64(&Index, Value);
+			return Index;
+#else
+			return 63 - __builtin_clzll(Value);
+#endif
+		}
+
+		typedef struct _LATENCY_SUMMARY {
+			uint64_t Count;
+			uint64_t Mean;
+			uint64_t P50;
+			uint64_t P90;
+			uint64_t P99;
+			uint64_t P999;
+			uint64_t Max;
+		} LATENCY_SUMMARY;
+
+		class LatencyHistogram
+		{
+		public:
+			static const uint32_t SubBucketBits = 4;
+			static const uint32_t SubBucketCount = 1 << SubBucketBits;
+			static const uint32_t BucketCount = SubBucketCount + (64 - SubBucketBits) * SubBucketCount;
+
+			static uint32_t BucketIndex(uint64_t Value)
+			{
+				if (Value < SubBucketCount)
+				{
+					return (uint32_t)Value;
+				}
+
+				uint32_t Shift = HighestBitIndex(Value) - SubBucketBits;
+				uint32_t SubBucket = (uint32_t)(Value >> Shift) - SubBucketCount;
+
+				return SubBucketCount + Shift * SubBucketCount + SubBucket;
+			}
+
+			// Smallest value that maps to the bucket
+			static uint64_t BucketLowerBound(uint32_t Index)
+			{
+				if (Index < SubBucketCount)
+				{
+					return Index;
+				}
+
+				uint32_t Shift = (Index - SubBucketCount) / SubBucketCount;
+				uint64_t SubBucket = (Index - SubBucketCount) % SubBucketCount;
+
+				return (SubBucketCount + SubBucket) << Shift;
+			}
+
+			// Largest value that maps to the bucket
+			static uint64_t BucketUpperBound(uint32_t Index)
+			{
+				return Index + 1 < BucketCount ? BucketLowerBound(Index + 1) - 1 : UINT64_MAX;
+			}
+
+			void Record(uint64_t Value)
+			{
+				Bump(m_Buckets[BucketIndex(Value)], 1);
+				Bump(m_Count, 1);
+				Bump(m_Sum, Value);
+
+				if (Value > m_Max.load(std::memory_order_relaxed))
+				{
+					m_Max.store(Value, std::memory_order_relaxed);
+				}
+			}
+
+			uint64_t Count() const
+			{
+				return m_Count.load(std::memory_order_relaxed);
+			}
+
+			// Value at the given quantile (0-1), reported as the upper bound of the containing bucket and clamped to
+			// the largest recorded value
+			uint64_t ValueAtQuantile(double Quantile) const
+			{
+				uint64_t Total = 0;
+				for (uint32_t i = 0; i < BucketCount; i++)
+				{
+					Total += m_Buckets[i].load(std::memory_order_relaxed);
+				}
+
+				if (!Total)
+				{
+					return 0;
+				}
+
+				uint64_t Rank = (uint64_t)(Quantile * (double)Total);
+				if (Rank >= Total)
+				{
+					Rank = Total - 1;
+				}
+
+				uint64_t Max = m_Max.load(std::memory_order_relaxed);
+				uint64_t Seen = 0;
+				for (uint32_t i = 0; i < BucketCount; i++)
+				{
+					Seen += m_Buckets[i].load(std::memory_order_relaxed);
+					if (Seen > Rank)
+					{
+						uint64_t Upper = BucketUpperBound(i);
+						return Upper < Max ? Upper : Max;
+					}
+				}
+
+				return Max;
+			}
+
+			void Summarize(LATENCY_SUMMARY& Summary) const
+			{
+				Summary.Count = Count();
+				Summary.Mean = Summary.Count ? m_Sum.load(std::memory_order_relaxed) / Summary.Count : 0;
+				Summary.P50 = ValueAtQuantile(0.5);
+				Summary.P90 = ValueAtQuantile(0.9);
+				Summary.P99 = ValueAtQuantile(0.99);
+				Summary.P999 = ValueAtQuantile(0.999);
+				Summary.Max = m_Max.load(std::memory_order_relaxed);
+			}
+
+			// Only safe while nothing is recording
+			void Reset()
+			{
+				for (auto& Bucket : m_Buckets)
+				{
+					Bucket.store(0, std::memory_order_relaxed);
+				}
+				m_Count.store(0, std::memory_order_relaxed);
+				m_Sum.store(0, std::memory_order_relaxed);
+				m_Max.store(0, std::memory_order_relaxed);
+			}
+
+		private:
+			// Single writer, so a plain load/store pair is enough and avoids a locked instruction
+			static void Bump(std::atomic<uint64_t>& Counter, uint64_t Amount)
+			{
+				Counter.store(Counter.load(std::memory_order_relaxed) + Amount, std::memory_order_relaxed);
+			}
+
+			std::atomic<uint64_t> m_Buckets[BucketCount] = {};
+			std::atomic<uint64_t> m_Count{0};
+			std::atomic<uint64_t> m_Sum{0};
+			std::atomic<uint64_t> m_Max{0};
+		};
+	}
+}
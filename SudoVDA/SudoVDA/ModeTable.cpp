@@ -0,0 +1,294 @@
+#include "ModeTable.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			bool IsBlank(char c)
+			{
+				return c == ' ' || c == '\t' || c == '\r';
+			}
+
+			// Reads up to 9 digits, enough for any valid field without overflowing
+			bool ParseNumber(const char*& p, const char* pEnd, uint32_t& Value)
+			{
+				const char* pStart = p;
+				Value = 0;
+				while (p < pEnd && *p >= '0' && *p <= '9')
+				{
+					if (p - pStart == 9)
+					{
+						return false;
+					}
+					Value = Value * 10 + (uint32_t)(*p - '0');
+					p++;
+				}
+				return p != pStart;
+			}
+
+			void SkipBlanks(const char*& p, const char* pEnd)
+			{
+				while (p < pEnd && IsBlank(*p))
+				{
+					p++;
+				}
+			}
+
+			// Reads "number[, number...]" up to the end of the line or a comment, at most 3 numbers. Returns how many
+			// were read, or -1 if the line is anything else.
+			int ParseLine(const char* p, const char* pEnd, uint32_t (&Values)[3])
+			{
+				int Count = 0;
+				SkipBlanks(p, pEnd);
+				while (p < pEnd && *p != '#')
+				{
+					if (Count == 3 || (Count && *p++ != ','))
+					{
+						return -1;
+					}
+					SkipBlanks(p, pEnd);
+					if (!ParseNumber(p, pEnd, Values[Count++]))
+					{
+						return -1;
+					}
+					SkipBlanks(p, pEnd);
+				}
+				return Count;
+			}
+
+			bool SpecLess(const MODE_SPEC& Left, const MODE_SPEC& Right)
+			{
+				if (Left.Width != Right.Width)
+				{
+					return Left.Width < Right.Width;
+				}
+				if (Left.Height != Right.Height)
+				{
+					return Left.Height < Right.Height;
+				}
+				return FractionLess(Left.VSync, Right.VSync);
+			}
+
+			bool SpecEqual(const MODE_SPEC& Left, const MODE_SPEC& Right)
+			{
+				return Left.Width == Right.Width && Left.Height == Right.Height && FractionEqual(Left.VSync, Right.VSync);
+			}
+		}
+
+		ModeList::ModeList() :
+			m_Specs(DefaultModes, DefaultModes + DefaultModeCount),
+			m_PreferredIndex(DefaultPreferredModeIndex)
+		{
+			m_Timings.assign(DefaultModeTimings.begin(), DefaultModeTimings.end());
+		}
+
+		bool ModeList::Compile(const char* pText, size_t Size, MODE_LIST_REPORT& Report)
+		{
+			Report.Entries = 0;
+			Report.Modes = 0;
+			Report.Duplicates = 0;
+			Report.Rejected = 0;
+			Report.Issues.clear();
+
+			auto AddIssue = [&Report](uint32_t Line, MODE_ISSUE_REASON Reason, uint32_t Width, uint32_t Height, uint32_t Refresh) {
+				if (Report.Issues.size() < MaxIssues)
+				{
+					Report.Issues.push_back({ Line, Reason, Width, Height, Refresh });
+				}
+			};
+
+			// Valid modes in file order. Duplicates are found once sorted, the stable sort keeps the earliest line of
+			// each mode first.
+			struct Parsed
+			{
+				MODE_SPEC Spec;
+				uint32_t Line;
+				uint32_t Refresh;                // As written
+			};
+			std::vector<Parsed> Modes;
+			Modes.reserve(Size / 16);
+
+			const char* p = pText;
+			const char* pEnd = pText + Size;
+			uint32_t Line = 0;
+			bool First = true;
+
+			while (p < pEnd)
+			{
+				const char* pEol = (const char*)memchr(p, '\n', pEnd - p);
+				if (!pEol)
+				{
+					pEol = pEnd;
+				}
+				Line++;
+
+				uint32_t Values[3] = {};
+				int Count = ParseLine(p, pEol, Values);
+				p = pEol + 1;
+
+				if (!Count)
+				{
+					continue;
+				}
+
+				bool Header = First && Count == 1;
+				First = false;
+				if (Header)
+				{
+					continue;
+				}
+
+				Report.Entries++;
+				if (Count != 3)
+				{
+					Report.Rejected++;
+					AddIssue(Line, MODE_ISSUE_SYNTAX, 0, 0, 0);
+					continue;
+				}
+
+				uint32_t Width = Values[0];
+				uint32_t Height = Values[1];
+				uint32_t Refresh = Values[2];
+				uint32_t VSync = Refresh < 1000 ? Refresh * 1000 : Refresh;
+				uint32_t Long = std::max(Width, Height);
+				uint32_t Short = std::min(Width, Height);
+
+				MODE_ISSUE_REASON Reason = MODE_ISSUE_REASON_COUNT;
+				if (Short < ModeMinSize || Long > ModeMaxSize)
+				{
+					Reason = MODE_ISSUE_SIZE;
+				}
+				else if (Long > Short * ModeMaxAspect)
+				{
+					Reason = MODE_ISSUE_ASPECT;
+				}
+				else if (VSync < ModeMinVSync || VSync > ModeMaxVSync)
+				{
+					Reason = MODE_ISSUE_REFRESH;
+				}
+
+				if (Reason != MODE_ISSUE_REASON_COUNT)
+				{
+					Report.Rejected++;
+					AddIssue(Line, Reason, Width, Height, Refresh);
+					continue;
+				}
+
+				Modes.push_back({ { Width, Height, RefreshRateFromMillihertz(Refresh) }, Line, Refresh });
+			}
+
+			if (Modes.empty())
+			{
+				return false;
+			}
+
+			MODE_SPEC Preferred = Modes[0].Spec;
+
+			std::stable_sort(Modes.begin(), Modes.end(), [](const Parsed& Left, const Parsed& Right) { return SpecLess(Left.Spec, Right.Spec); });
+
+			std::vector<MODE_SPEC> Specs;
+			std::vector<Parsed> Duplicated;
+			Specs.reserve(Modes.size());
+			for (const Parsed& Mode : Modes)
+			{
+				if (!Specs.empty() && SpecEqual(Specs.back(), Mode.Spec))
+				{
+					Duplicated.push_back(Mode);
+					continue;
+				}
+				Specs.push_back(Mode.Spec);
+			}
+
+			// Merge the earliest duplicates into the issues, which stay the first MaxIssues in file order
+			Report.Duplicates = (uint32_t)Duplicated.size();
+			if (!Duplicated.empty())
+			{
+				size_t Count = std::min(Duplicated.size(), MaxIssues);
+				std::partial_sort(Duplicated.begin(), Duplicated.begin() + Count, Duplicated.end(),
+					[](const Parsed& Left, const Parsed& Right) { return Left.Line < Right.Line; });
+
+				std::vector<MODE_ISSUE> Duplicates;
+				Duplicates.reserve(Count);
+				for (size_t i = 0; i < Count; i++)
+				{
+					const Parsed& Duplicate = Duplicated[i];
+					Duplicates.push_back({ Duplicate.Line, MODE_ISSUE_DUPLICATE, Duplicate.Spec.Width, Duplicate.Spec.Height, Duplicate.Refresh });
+				}
+
+				std::vector<MODE_ISSUE> Issues;
+				Issues.reserve(Report.Issues.size() + Count);
+				std::merge(Report.Issues.begin(), Report.Issues.end(), Duplicates.begin(), Duplicates.end(), std::back_inserter(Issues),
+					[](const MODE_ISSUE& Left, const MODE_ISSUE& Right) { return Left.Line < Right.Line; });
+				if (Issues.size() > MaxIssues)
+				{
+					Issues.resize(MaxIssues);
+				}
+				Report.Issues = std::move(Issues);
+			}
+
+			m_Specs = std::move(Specs);
+			m_PreferredIndex = (uint32_t)(std::lower_bound(m_Specs.begin(), m_Specs.end(), Preferred, SpecLess) - m_Specs.begin());
+			m_Timings.resize(m_Specs.size());
+			for (size_t i = 0; i < m_Specs.size(); i++)
+			{
+				m_Timings[i] = MakeModeTiming(m_Specs[i].Width, m_Specs[i].Height, m_Specs[i].VSync);
+			}
+
+			Report.Modes = (uint32_t)m_Specs.size();
+			return true;
+		}
+
+		uint32_t BuildMonitorModes(const ModeList& Defaults, const MODE_SPEC& Preferred, const FRACTION& SecondVSync, std::vector<MODE_TIMING>& Modes)
+		{
+			const MODE_SPEC* pDefaultSpecs = Defaults.Specs();
+			const MODE_TIMING* pDefaults = Defaults.Timings();
+			size_t DefaultCount = Defaults.Count();
+
+			if (!Preferred.Width)
+			{
+				Modes.assign(pDefaults, pDefaults + DefaultCount);
+				return Defaults.PreferredIndex();
+			}
+
+			Modes.clear();
+			Modes.reserve(DefaultCount + PreferredModeCount);
+
+			// Whole hertz defaults follow a preferred rate just below a whole one, scaled by the preferred rate over
+			// that whole rate: at 60000/1001 Hz, 60, 90 and 120 Hz turn into 60000/1001, 90000/1001 and 120000/1001 Hz.
+			const FRACTION& Rate = Preferred.VSync;
+			uint64_t WholeRate = ((uint64_t)Rate.Numerator * 2 + Rate.Denominator) / ((uint64_t)Rate.Denominator * 2);
+			bool FollowRate = WholeRate && Rate.Numerator < WholeRate * Rate.Denominator;
+
+			for (size_t i = 0; i < DefaultCount; i++)
+			{
+				const MODE_SPEC& Spec = pDefaultSpecs[i];
+				if (!FollowRate || Spec.VSync.Denominator != 1)
+				{
+					Modes.push_back(pDefaults[i]);
+					continue;
+				}
+
+				FRACTION VSync = MultiplyFraction(Spec.VSync, Rate.Numerator, Rate.Denominator * WholeRate);
+				Modes.push_back(MakeModeTiming(Spec.Width, Spec.Height, VSync));
+			}
+
+			for (size_t i = 0; i < ModeScaleFactorCount; i++)
+			{
+				uint32_t Width = Preferred.Width * ModeScaleFactors[i] / 100;
+				uint32_t Height = Preferred.Height * ModeScaleFactors[i] / 100;
+
+				Modes.push_back(MakeModeTiming(Width, Height, Preferred.VSync));
+				Modes.push_back(MakeModeTiming(Width, Height, SecondVSync));
+			}
+
+			return (uint32_t)DefaultCount;
+		}
+	}
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+// Display modes reported to the OS.
+//
+// The OS asks for a monitor's modes over and over during every topology change, through the monitor description and
+// target mode callbacks. None of the answers change while the monitor exists, so nothing is computed in the callbacks:
+//
+//  * The default modes don't depend on the monitor. Their timings are generated at compile time. A mode file can
+//    replace them, it is compiled into a ModeList once when the driver loads.
+//  * A monitor created with a preferred mode reports the defaults with their refresh rates pulled down to the
+//    preferred mode's fraction (59.94 Hz next to 60 Hz), followed by the preferred mode at every scale factor. That
+//    list is built once with the monitor, see BuildMonitorModes().
+//
+// Refresh rates are exact fractions of hertz from the IOCTL to the signal info: NTSC 59.94 Hz is 60000/1001, never
+// 59940/1000 nor 60, and the line rate derives from it without rounding. Only the pixel rate, a whole number of hertz,
+// is rounded. Rates given in millihertz that are N/1.001 Hz rounded are taken for that exact fraction.
+//
+// Every mode has the blanking of CVT reduced blanking v2 (see CvtTiming.h), so its totals, line rate and pixel rate
+// are those of a real monitor. Timings are kept apart from the IddCx mode structures, which the driver fills from
+// them once, so the tables are built and checked the same on any platform.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <array>
+#include <vector>
+
+#include "CvtTiming.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		// A rate in hertz, always reduced
+		typedef struct _FRACTION {
+			uint32_t Numerator;
+			uint32_t Denominator;
+		} FRACTION;
+
+		constexpr uint64_t Gcd(uint64_t a, uint64_t b)
+		{
+			while (b)
+			{
+				uint64_t t = a % b;
+				a = b;
+				b = t;
+			}
+			return a;
+		}
+
+		// Reduces Numerator/Denominator. A fraction that still doesn't fit in 32 bits is replaced with the closest
+		// convergent of its continued fraction that does. Zero, or a zero denominator, makes 0/1.
+		constexpr FRACTION MakeFraction(uint64_t Numerator, uint64_t Denominator)
+		{
+			if (!Denominator || !Numerator)
+			{
+				return { 0, 1 };
+			}
+
+			uint64_t Divisor = Gcd(Numerator, Denominator);
+			Numerator /= Divisor;
+			Denominator /= Divisor;
+			if (Numerator <= UINT32_MAX && Denominator <= UINT32_MAX)
+			{
+				return { (uint32_t)Numerator, (uint32_t)Denominator };
+			}
+
+			// Convergents h/k, from 0/1 and 1/0
+			uint64_t h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+			uint64_t n = Numerator, d = Denominator;
+			while (d)
+			{
+				uint64_t a = n / d;
+				if ((h1 && a > (UINT32_MAX - h0) / h1) || (k1 && a > (UINT32_MAX - k0) / k1))
+				{
+					break;
+				}
+
+				uint64_t h2 = a * h1 + h0;
+				uint64_t k2 = a * k1 + k0;
+				h0 = h1;
+				h1 = h2;
+				k0 = k1;
+				k1 = k2;
+
+				uint64_t r = n % d;
+				n = d;
+				d = r;
+			}
+
+			// Only a rate above 4 GHz runs out of convergents at once
+			return k1 ? FRACTION{ (uint32_t)h1, (uint32_t)k1 } : FRACTION{ UINT32_MAX, 1 };
+		}
+
+		constexpr FRACTION MultiplyFraction(const FRACTION& Rate, uint64_t Numerator, uint64_t Denominator)
+		{
+			return MakeFraction(Rate.Numerator * Numerator, Rate.Denominator * Denominator);
+		}
+
+		constexpr bool FractionLess(const FRACTION& Left, const FRACTION& Right)
+		{
+			return (uint64_t)Left.Numerator * Right.Denominator < (uint64_t)Right.Numerator * Left.Denominator;
+		}
+
+		constexpr bool FractionEqual(const FRACTION& Left, const FRACTION& Right)
+		{
+			return Left.Numerator == Right.Numerator && Left.Denominator == Right.Denominator;
+		}
+
+		// Refresh rate given in millihertz, or in hertz below 1000 like IOCTL_ADD_VIRTUAL_DISPLAY always took it.
+		// Within a millihertz of N/1.001 Hz it is that exact fraction, so 59940 and 23976 are 60000/1001 and
+		// 24000/1001.
+		constexpr FRACTION RefreshRateFromMillihertz(uint32_t Rate)
+		{
+			if (Rate < 1000)
+			{
+				return MakeFraction(Rate, 1);
+			}
+
+			// The N whose N/1.001 Hz is nearest, as long as N * 1000 fits
+			uint64_t Hz = ((uint64_t)Rate * 1001 + 500000) / 1000000;
+			if (Rate % 1000 && Hz * 1000 <= UINT32_MAX)
+			{
+				int64_t Error = (int64_t)Rate * 1001 - (int64_t)Hz * 1000000;
+				if (Error >= -1001 && Error <= 1001)
+				{
+					return MakeFraction(Hz * 1000, 1001);
+				}
+			}
+
+			return MakeFraction(Rate, 1000);
+		}
+
+		// A mode as requested
+		typedef struct _MODE_SPEC {
+			uint32_t Width;
+			uint32_t Height;
+			FRACTION VSync;
+		} MODE_SPEC;
+
+		// Signal timing of a mode, laid out after DISPLAYCONFIG_VIDEO_SIGNAL_INFO. HSync is exactly VSync times
+		// TotalHeight, PixelRate the closest whole number to HSync times TotalWidth.
+		typedef struct _MODE_TIMING {
+			uint32_t Width;
+			uint32_t Height;
+			uint32_t TotalWidth;
+			uint32_t TotalHeight;
+			uint32_t VSyncNumerator;
+			uint32_t VSyncDenominator;
+			uint32_t HSyncNumerator;
+			uint32_t HSyncDenominator;
+			uint64_t PixelRate;
+		} MODE_TIMING;
+
+		// Default modes reported for edid-less monitors. The second mode is set as preferred
+		constexpr MODE_SPEC DefaultModes[] = {
+			{950, 1080, { 60, 1 }},
+			{950, 1080, { 90, 1 }},
+			{950, 1080, { 120, 1 }},
+			{1260, 1440, { 60, 1 }},
+			{1260, 1440, { 90, 1 }},
+			{1260, 1440, { 120, 1 }},
+			{1920, 1080, { 60, 1 }},
+			{1920, 1080, { 90, 1 }},
+			{1920, 1080, { 120, 1 }},
+			{1920, 1200, { 60, 1 }},
+			{1920, 1200, { 90, 1 }},
+			{1920, 1200, { 120, 1 }},
+
+			{2560, 1440, { 60, 1 }},
+			{2560, 1440, { 90, 1 }},
+			{2560, 1440, { 120, 1 }},
+			{2560, 1600, { 60, 1 }},
+			{2560, 1600, { 90, 1 }},
+			{2560, 1600, { 120, 1 }},
+
+			{2880, 1080, { 60, 1 }},
+			{2880, 1080, { 90, 1 }},
+			{2880, 1080, { 120, 1 }},
+			{2880, 1200, { 60, 1 }},
+			{2880, 1200, { 90, 1 }},
+			{2880, 1200, { 120, 1 }},
+
+			{3840, 1080, { 60, 1 }},
+			{3840, 1080, { 90, 1 }},
+			{3840, 1080, { 120, 1 }},
+			{3840, 1200, { 60, 1 }},
+			{3840, 1200, { 90, 1 }},
+			{3840, 1200, { 120, 1 }},
+			{3840, 1440, { 60, 1 }},
+			{3840, 1440, { 90, 1 }},
+			{3840, 1440, { 120, 1 }},
+			{3840, 1600, { 60, 1 }},
+			{3840, 1600, { 90, 1 }},
+			{3840, 1600, { 120, 1 }},
+
+			{5120, 1440, { 60, 1 }},
+			{5120, 1440, { 90, 1 }},
+			{5120, 1440, { 120, 1 }},
+			{5120, 1600, { 60, 1 }},
+			{5120, 1600, { 90, 1 }},
+			{5120, 1600, { 120, 1 }},
+		};
+
+		constexpr size_t DefaultModeCount = sizeof(DefaultModes) / sizeof(DefaultModes[0]);
+		constexpr uint32_t DefaultPreferredModeIndex = 1;
+
+		// Percent of the preferred mode's size, 100 first so the preferred mode itself leads its scaled variants
+		constexpr uint32_t ModeScaleFactors[] = {
+			100,
+			50,
+			75,
+			125,
+			150,
+		};
+
+		constexpr size_t ModeScaleFactorCount = sizeof(ModeScaleFactors) / sizeof(ModeScaleFactors[0]);
+
+		// Every scale factor at the preferred refresh rate and at the second one
+		constexpr size_t PreferredModeCount = ModeScaleFactorCount * 2;
+
+		// Totals from CVT-RB v2. The refresh rate stays the one requested, and the pixel rate follows from it rather
+		// than being CVT's clock, floored to 1 kHz, so that the three rates reported agree exactly.
+		constexpr MODE_TIMING MakeModeTiming(uint32_t Width, uint32_t Height, const FRACTION& VSync)
+		{
+			CVT_TIMING Cvt = MakeCvtRbV2Timing(Width, Height, VSync.Numerator, VSync.Denominator);
+
+			MODE_TIMING Timing = {};
+			Timing.Width = Width;
+			Timing.Height = Height;
+			Timing.TotalWidth = Cvt.HTotal;
+			Timing.TotalHeight = Cvt.VTotal;
+
+			FRACTION HSync = MultiplyFraction(VSync, Timing.TotalHeight, 1);
+			Timing.VSyncNumerator = VSync.Numerator;
+			Timing.VSyncDenominator = VSync.Denominator;
+			Timing.HSyncNumerator = HSync.Numerator;
+			Timing.HSyncDenominator = HSync.Denominator;
+
+			uint64_t Pixels = (uint64_t)Timing.TotalWidth * Timing.TotalHeight * VSync.Numerator;
+			Timing.PixelRate = (Pixels + VSync.Denominator / 2) / VSync.Denominator;
+			return Timing;
+		}
+
+		template <size_t Count>
+		constexpr std::array<MODE_TIMING, Count> MakeModeTimings(const MODE_SPEC (&Specs)[Count])
+		{
+			std::array<MODE_TIMING, Count> Timings = {};
+			for (size_t i = 0; i < Count; i++)
+			{
+				Timings[i] = MakeModeTiming(Specs[i].Width, Specs[i].Height, Specs[i].VSync);
+			}
+			return Timings;
+		}
+
+		constexpr std::array<MODE_TIMING, DefaultModeCount> DefaultModeTimings = MakeModeTimings(DefaultModes);
+
+		// Limits of modes read from a mode file. IOCTL_ADD_VIRTUAL_DISPLAY takes sizes up to ModeMaxSize and rates up to
+		// ModeMaxVSync too, which keeps every total, line rate and pixel rate computed from them in range.
+		constexpr uint32_t ModeMinSize = 320;
+		constexpr uint32_t ModeMaxSize = 16384;          // Largest D3D11 texture
+		constexpr uint32_t ModeMaxAspect = 4;            // Longer side at most this many times the shorter one
+		constexpr uint32_t ModeMinVSync = 1000;          // 1 Hz
+		constexpr uint32_t ModeMaxVSync = 1000000;       // 1000 Hz
+
+		typedef enum _MODE_ISSUE_REASON {
+			MODE_ISSUE_SYNTAX = 0,                       // Not "width, height, refresh"
+			MODE_ISSUE_SIZE,                             // Width or height out of ModeMinSize to ModeMaxSize
+			MODE_ISSUE_ASPECT,                           // Wider or taller than ModeMaxAspect to 1
+			MODE_ISSUE_REFRESH,                          // Refresh rate out of ModeMinVSync to ModeMaxVSync
+			MODE_ISSUE_DUPLICATE,                        // Same mode as an earlier line, ignored
+			MODE_ISSUE_REASON_COUNT
+		} MODE_ISSUE_REASON;
+
+		typedef struct _MODE_ISSUE {
+			uint32_t Line;                               // 1-based
+			MODE_ISSUE_REASON Reason;
+			uint32_t Width;                              // As written, all zero on syntax errors
+			uint32_t Height;
+			uint32_t Refresh;                            // In the file's unit
+		} MODE_ISSUE;
+
+		typedef struct _MODE_LIST_REPORT {
+			uint32_t Entries;                            // Lines holding something else than blanks and comments
+			uint32_t Modes;                              // Distinct valid modes
+			uint32_t Duplicates;
+			uint32_t Rejected;
+			std::vector<MODE_ISSUE> Issues;              // The first MaxIssues problems, in file order
+		} MODE_LIST_REPORT;
+
+		/// <summary>
+		/// Default modes with their timings, the built-in ones unless a mode file was compiled.
+		/// </summary>
+		class ModeList
+		{
+		public:
+			static constexpr size_t MaxIssues = 64;
+
+			ModeList();
+
+			// Compiles a mode file, one "width, height, refresh" per line. Refresh rates below 1000 are in hertz,
+			// others in millihertz, see RefreshRateFromMillihertz(). Blank lines and everything
+			// after a '#' are ignored, so is a lone number on the first line (the monitor count of older option.txt
+			// files). Invalid and duplicate lines are reported and skipped, the rest sorted by width, height and
+			// refresh rate. The first valid line is the preferred mode. Returns false and keeps the current modes if
+			// no line is valid.
+			bool Compile(const char* pText, size_t Size, MODE_LIST_REPORT& Report);
+
+			size_t Count() const
+			{
+				return m_Specs.size();
+			}
+
+			const MODE_SPEC* Specs() const
+			{
+				return m_Specs.data();
+			}
+
+			const MODE_TIMING* Timings() const
+			{
+				return m_Timings.data();
+			}
+
+			uint32_t PreferredIndex() const
+			{
+				return m_PreferredIndex;
+			}
+
+		private:
+			std::vector<MODE_SPEC> m_Specs;
+			std::vector<MODE_TIMING> m_Timings;
+			uint32_t m_PreferredIndex;
+		};
+
+		// Replaces Modes with the modes of a monitor whose preferred mode is Preferred: the defaults, then
+		// PreferredModeCount modes of the preferred mode scaled, each at its refresh rate and then at SecondVSync.
+		// Without a preferred mode (zero width) that's only the defaults. Returns the index of the preferred mode.
+		uint32_t BuildMonitorModes(const ModeList& Defaults, const MODE_SPEC& Preferred, const FRACTION& SecondVSync, std::vector<MODE_TIMING>& Modes);
+	}
+}
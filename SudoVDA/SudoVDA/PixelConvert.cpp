@@ -0,0 +1,1022 @@
+#include "PixelConvert.h"
+
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define PIXEL_CONVERT_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define PIXEL_CONVERT_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// MSVC allows any intrinsic in any function, GCC and Clang need the target spelled out per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define PIXEL_TARGET_SSE41
+#define PIXEL_TARGET_AVX2
+#else
+#define PIXEL_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define PIXEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			typedef void (*BGRA_420_ROWS)(const uint8_t* pRow0, const uint8_t* pRow1, uint32_t Width, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, bool Interleaved);
+			typedef void (*BGRA_444_ROW)(const uint8_t* pRow, uint32_t Width, uint8_t* pY, uint8_t* pU, uint8_t* pV);
+			typedef void (*SCRGB_420_ROWS)(const uint16_t* pRow0, const uint16_t* pRow1, uint32_t Width, uint16_t* pY0, uint16_t* pY1, uint16_t* pUV);
+
+			typedef struct _PIXEL_KERNELS {
+				PIXEL_CONVERT_ISA Isa;
+				BGRA_420_ROWS Bgra420;
+				BGRA_444_ROW Bgra444;
+				SCRGB_420_ROWS ScRgb420;
+			} PIXEL_KERNELS;
+
+			constexpr int32_t Fixed(double Value)
+			{
+				return (int32_t)(Value < 0 ? Value - 0.5 : Value + 0.5);
+			}
+
+			// BT.709 limited range in 8.8 fixed point, coefficients in B, G, R order to match the memory layout.
+			// Each chroma row sums to zero so grey stays exactly at 128.
+			const int32_t YB = 16, YG = 157, YR = 47;
+			const int32_t UB = 112, UG = -86, UR = -26;
+			const int32_t VB = -10, VG = -102, VR = 112;
+
+			// scRGB (BT.709 primaries, 1.0 = 80 nits) to BT.2020 primaries normalised to the 10000 nits PQ peak
+			const float ScRgbScale = 80.0f / 10000.0f;
+			const float M00 = 0.627404f * ScRgbScale, M01 = 0.329283f * ScRgbScale, M02 = 0.043313f * ScRgbScale;
+			const float M10 = 0.069097f * ScRgbScale, M11 = 0.919540f * ScRgbScale, M12 = 0.011362f * ScRgbScale;
+			const float M20 = 0.016391f * ScRgbScale, M21 = 0.088013f * ScRgbScale, M22 = 0.895595f * ScRgbScale;
+
+			// BT.2020 non-constant luminance, 10-bit limited range, applied to 16-bit PQ values in 12.20 fixed point
+			const double Kr = 0.2627, Kg = 0.6780, Kb = 0.0593;
+			const double LumaScale = 876.0 * (1 << 20) / 65535.0;
+			const double ChromaScale = 896.0 * (1 << 20) / 65535.0;
+			const int32_t PY_R = Fixed(Kr * LumaScale), PY_G = Fixed(Kg * LumaScale), PY_B = Fixed(Kb * LumaScale);
+			const int32_t PCb_R = Fixed(-Kr / 1.8814 * ChromaScale), PCb_G = Fixed(-Kg / 1.8814 * ChromaScale), PCb_B = Fixed(0.5 * ChromaScale);
+			const int32_t PCr_R = Fixed(0.5 * ChromaScale), PCr_G = Fixed(-Kg / 1.4746 * ChromaScale), PCr_B = Fixed(-Kb / 1.4746 * ChromaScale);
+
+			// The PQ curve is sampled at every float with an 8-bit mantissa between 2^-24 and 1.0, which keeps the
+			// interpolation-free lookup within a fifth of a 10-bit code and the table (12 KB) in L1. Lookups index it
+			// with the rounded upper bits of the float.
+			const uint32_t PqMantissaBits = 8;
+			const uint32_t PqIndexShift = 23 - PqMantissaBits;
+			const uint32_t PqMinExponent = 127 - 24;
+			const int32_t PqIndexBase = (int32_t)(PqMinExponent << PqMantissaBits);
+			const int32_t PqLastIndex = 24 << PqMantissaBits;
+
+			struct PqTable
+			{
+				// One spare entry so a 32-bit gather at the last index stays inside the table
+				uint16_t Values[PqLastIndex + 2];
+
+				PqTable()
+				{
+					const double m1 = 2610.0 / 16384.0, m2 = 2523.0 / 4096.0 * 128.0;
+					const double c1 = 3424.0 / 4096.0, c2 = 2413.0 / 4096.0 * 32.0, c3 = 2392.0 / 4096.0 * 32.0;
+
+					for (int32_t i = 0; i <= PqLastIndex; i++)
+					{
+						uint32_t Bits = (uint32_t)(i + PqIndexBase) << PqIndexShift;
+						float L;
+						memcpy(&L, &Bits, sizeof(L));
+
+						// Anything below the table maps to the first entry, keep that at true black
+						double Lm = i ? pow((double)L, m1) : 0.0;
+						double E = pow((c1 + c2 * Lm) / (1.0 + c3 * Lm), m2);
+						Values[i] = (uint16_t)(E * 65535.0 + 0.5);
+					}
+					Values[PqLastIndex + 1] = Values[PqLastIndex];
+				}
+			};
+
+			const uint16_t* PqLut()
+			{
+				static const PqTable Table;
+				return Table.Values;
+			}
+
+			// Exact for finite halves, infinities and NaNs turn into large finite values that clamp to peak white
+			inline float HalfToFloat(uint16_t Half)
+			{
+				uint32_t Bits = (uint32_t)(Half & 0x7fff) << 13;
+				float Value;
+				memcpy(&Value, &Bits, sizeof(Value));
+				Value *= 5.192296858534828e33f; // 2^112 rebiases the exponent
+				memcpy(&Bits, &Value, sizeof(Bits));
+				Bits |= (uint32_t)(Half & 0x8000) << 16;
+				memcpy(&Value, &Bits, sizeof(Value));
+				return Value;
+			}
+
+			inline int32_t PqIndex(float L)
+			{
+				L = L > 0.0f ? (L < 1.0f ? L : 1.0f) : 0.0f;
+
+				uint32_t Bits;
+				memcpy(&Bits, &L, sizeof(Bits));
+				int32_t Index = (int32_t)((Bits + (1u << (PqIndexShift - 1))) >> PqIndexShift) - PqIndexBase;
+				return Index < 0 ? 0 : (Index > PqLastIndex ? PqLastIndex : Index);
+			}
+
+			inline uint8_t Luma8(const uint8_t* p)
+			{
+				return (uint8_t)(((YB * p[0] + YG * p[1] + YR * p[2] + 128) >> 8) + 16);
+			}
+
+			inline uint8_t Chroma8(int32_t B, int32_t G, int32_t R, int32_t CB, int32_t CG, int32_t CR)
+			{
+				return (uint8_t)(((CB * B + CG * G + CR * R + 128) >> 8) + 128);
+			}
+
+			// Gamut conversion and PQ encoding of one scRGB pixel into 16-bit PQ values
+			inline void ScRgbToPq(const uint16_t* p, const uint16_t* pLut, int32_t& ER, int32_t& EG, int32_t& EB)
+			{
+				float r = HalfToFloat(p[0]), g = HalfToFloat(p[1]), b = HalfToFloat(p[2]);
+
+				ER = pLut[PqIndex(M00 * r + M01 * g + M02 * b)];
+				EG = pLut[PqIndex(M10 * r + M11 * g + M12 * b)];
+				EB = pLut[PqIndex(M20 * r + M21 * g + M22 * b)];
+			}
+
+			inline uint16_t PqLuma10(int32_t R, int32_t G, int32_t B)
+			{
+				return (uint16_t)((((PY_R * R + PY_G * G + PY_B * B + (1 << 19)) >> 20) + 64) << 6);
+			}
+
+			inline uint16_t PqChroma10(int32_t R, int32_t G, int32_t B, int32_t CR, int32_t CG, int32_t CB)
+			{
+				return (uint16_t)((((CR * R + CG * G + CB * B + (1 << 19)) >> 20) + 512) << 6);
+			}
+
+#pragma region Scalar
+
+			// Converts pixels [Start, Width) of a row pair, Start must be even. Also finishes the SIMD paths' tails.
+			void Bgra420RowsFrom(uint32_t Start, const uint8_t* pRow0, const uint8_t* pRow1, uint32_t Width, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, bool Interleaved)
+			{
+				for (uint32_t x = Start; x < Width; x += 2)
+				{
+					uint32_t x1 = x + 1 < Width ? x + 1 : x;
+					const uint8_t* p00 = pRow0 + 4 * x;
+					const uint8_t* p01 = pRow0 + 4 * x1;
+					const uint8_t* p10 = pRow1 + 4 * x;
+					const uint8_t* p11 = pRow1 + 4 * x1;
+
+					pY0[x] = Luma8(p00);
+					pY1[x] = Luma8(p10);
+					if (x1 != x)
+					{
+						pY0[x1] = Luma8(p01);
+						pY1[x1] = Luma8(p11);
+					}
+
+					int32_t B = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+					int32_t G = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+					int32_t R = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+
+					uint32_t c = x / 2;
+					uint8_t U = Chroma8(B, G, R, UB, UG, UR);
+					uint8_t V = Chroma8(B, G, R, VB, VG, VR);
+					if (Interleaved)
+					{
+						pU[2 * c] = U;
+						pU[2 * c + 1] = V;
+					}
+					else
+					{
+						pU[c] = U;
+						pV[c] = V;
+					}
+				}
+			}
+
+			void Bgra444RowFrom(uint32_t Start, const uint8_t* pRow, uint32_t Width, uint8_t* pY, uint8_t* pU, uint8_t* pV)
+			{
+				for (uint32_t x = Start; x < Width; x++)
+				{
+					const uint8_t* p = pRow + 4 * x;
+					pY[x] = Luma8(p);
+					pU[x] = Chroma8(p[0], p[1], p[2], UB, UG, UR);
+					pV[x] = Chroma8(p[0], p[1], p[2], VB, VG, VR);
+				}
+			}
+
+			void ScRgb420RowsFrom(uint32_t Start, const uint16_t* pRow0, const uint16_t* pRow1, uint32_t Width, uint16_t* pY0, uint16_t* pY1, uint16_t* pUV)
+			{
+				const uint16_t* pLut = PqLut();
+
+				for (uint32_t x = Start; x < Width; x += 2)
+				{
+					uint32_t x1 = x + 1 < Width ? x + 1 : x;
+					int32_t R[4], G[4], B[4];
+
+					ScRgbToPq(pRow0 + 4 * x, pLut, R[0], G[0], B[0]);
+					ScRgbToPq(pRow0 + 4 * x1, pLut, R[1], G[1], B[1]);
+					ScRgbToPq(pRow1 + 4 * x, pLut, R[2], G[2], B[2]);
+					ScRgbToPq(pRow1 + 4 * x1, pLut, R[3], G[3], B[3]);
+
+					pY0[x] = PqLuma10(R[0], G[0], B[0]);
+					pY1[x] = PqLuma10(R[2], G[2], B[2]);
+					if (x1 != x)
+					{
+						pY0[x1] = PqLuma10(R[1], G[1], B[1]);
+						pY1[x1] = PqLuma10(R[3], G[3], B[3]);
+					}
+
+					int32_t Ra = (R[0] + R[1] + R[2] + R[3] + 2) >> 2;
+					int32_t Ga = (G[0] + G[1] + G[2] + G[3] + 2) >> 2;
+					int32_t Ba = (B[0] + B[1] + B[2] + B[3] + 2) >> 2;
+
+					pUV[x] = PqChroma10(Ra, Ga, Ba, PCb_R, PCb_G, PCb_B);
+					pUV[x + 1] = PqChroma10(Ra, Ga, Ba, PCr_R, PCr_G, PCr_B);
+				}
+			}
+
+			void Bgra420RowsScalar(const uint8_t* pRow0, const uint8_t* pRow1, uint32_t Width, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, bool Interleaved)
+			{
+				Bgra420RowsFrom(0, pRow0, pRow1, Width, pY0, pY1, pU, pV, Interleaved);
+			}
+
+			void Bgra444RowScalar(const uint8_t* pRow, uint32_t Width, uint8_t* pY, uint8_t* pU, uint8_t* pV)
+			{
+				Bgra444RowFrom(0, pRow, Width, pY, pU, pV);
+			}
+
+			void ScRgb420RowsScalar(const uint16_t* pRow0, const uint16_t* pRow1, uint32_t Width, uint16_t* pY0, uint16_t* pY1, uint16_t* pUV)
+			{
+				ScRgb420RowsFrom(0, pRow0, pRow1, Width, pY0, pY1, pUV);
+			}
+
+			const PIXEL_KERNELS ScalarKernels = { PIXEL_CONVERT_ISA_SCALAR, Bgra420RowsScalar, Bgra444RowScalar, ScRgb420RowsScalar };
+
+#pragma endregion
+
+#if PIXEL_CONVERT_X64
+
+#pragma region SSE41
+
+			// Luma of 4 BGRA pixels as 32-bit integers
+			PIXEL_TARGET_SSE41 inline __m128i Luma4Sse(__m128i Lo, __m128i Hi)
+			{
+				const __m128i Coef = _mm_setr_epi16(YB, YG, YR, 0, YB, YG, YR, 0);
+				__m128i Y = _mm_hadd_epi32(_mm_madd_epi16(Lo, Coef), _mm_madd_epi16(Hi, Coef));
+				return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(Y, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+			}
+
+			PIXEL_TARGET_SSE41 inline __m128i Chroma4Sse(__m128i Lo, __m128i Hi, __m128i Coef)
+			{
+				__m128i C = _mm_hadd_epi32(_mm_madd_epi16(Lo, Coef), _mm_madd_epi16(Hi, Coef));
+				return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(C, _mm_set1_epi32(128)), 8), _mm_set1_epi32(128));
+			}
+
+			// Packs 16 pixels worth of 32-bit results into bytes
+			PIXEL_TARGET_SSE41 inline __m128i Pack16Sse(__m128i a, __m128i b, __m128i c, __m128i d)
+			{
+				return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			}
+
+			// [U0, U1, V0, V1] of the two 2x2 blocks covered by 4 pixels of a row pair
+			PIXEL_TARGET_SSE41 inline __m128i Chroma2x2Sse(__m128i Row0, __m128i Row1)
+			{
+				const __m128i Zero = _mm_setzero_si128();
+				const __m128i CoefU = _mm_setr_epi16(UB, UG, UR, 0, UB, UG, UR, 0);
+				const __m128i CoefV = _mm_setr_epi16(VB, VG, VR, 0, VB, VG, VR, 0);
+
+				__m128i SumLo = _mm_add_epi16(_mm_unpacklo_epi8(Row0, Zero), _mm_unpacklo_epi8(Row1, Zero));
+				__m128i SumHi = _mm_add_epi16(_mm_unpackhi_epi8(Row0, Zero), _mm_unpackhi_epi8(Row1, Zero));
+				SumLo = _mm_add_epi16(SumLo, _mm_srli_si128(SumLo, 8));
+				SumHi = _mm_add_epi16(SumHi, _mm_srli_si128(SumHi, 8));
+
+				__m128i Avg = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(SumLo, SumHi), _mm_set1_epi16(2)), 2);
+				__m128i C = _mm_hadd_epi32(_mm_madd_epi16(Avg, CoefU), _mm_madd_epi16(Avg, CoefV));
+				return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(C, _mm_set1_epi32(128)), 8), _mm_set1_epi32(128));
+			}
+
+			PIXEL_TARGET_SSE41 void Bgra420RowsSse41(const uint8_t* pRow0, const uint8_t* pRow1, uint32_t Width, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, bool Interleaved)
+			{
+				const __m128i Zero = _mm_setzero_si128();
+				uint32_t x = 0;
+
+				for (; x + 16 <= Width; x += 16)
+				{
+					__m128i Row0[4], Row1[4], Y0[4], Y1[4], C[4];
+					for (int i = 0; i < 4; i++)
+					{
+						Row0[i] = _mm_loadu_si128((const __m128i*)(pRow0 + 4 * x + 16 * i));
+						Row1[i] = _mm_loadu_si128((const __m128i*)(pRow1 + 4 * x + 16 * i));
+						Y0[i] = Luma4Sse(_mm_unpacklo_epi8(Row0[i], Zero), _mm_unpackhi_epi8(Row0[i], Zero));
+						Y1[i] = Luma4Sse(_mm_unpacklo_epi8(Row1[i], Zero), _mm_unpackhi_epi8(Row1[i], Zero));
+						C[i] = Chroma2x2Sse(Row0[i], Row1[i]);
+					}
+
+					_mm_storeu_si128((__m128i*)(pY0 + x), Pack16Sse(Y0[0], Y0[1], Y0[2], Y0[3]));
+					_mm_storeu_si128((__m128i*)(pY1 + x), Pack16Sse(Y1[0], Y1[1], Y1[2], Y1[3]));
+
+					__m128i U = _mm_packs_epi32(_mm_unpacklo_epi64(C[0], C[1]), _mm_unpacklo_epi64(C[2], C[3]));
+					__m128i V = _mm_packs_epi32(_mm_unpackhi_epi64(C[0], C[1]), _mm_unpackhi_epi64(C[2], C[3]));
+					if (Interleaved)
+					{
+						_mm_storeu_si128((__m128i*)(pU + x), _mm_packus_epi16(_mm_unpacklo_epi16(U, V), _mm_unpackhi_epi16(U, V)));
+					}
+					else
+					{
+						_mm_storel_epi64((__m128i*)(pU + x / 2), _mm_packus_epi16(U, U));
+						_mm_storel_epi64((__m128i*)(pV + x / 2), _mm_packus_epi16(V, V));
+					}
+				}
+
+				Bgra420RowsFrom(x, pRow0, pRow1, Width, pY0, pY1, pU, pV, Interleaved);
+			}
+
+			PIXEL_TARGET_SSE41 void Bgra444RowSse41(const uint8_t* pRow, uint32_t Width, uint8_t* pY, uint8_t* pU, uint8_t* pV)
+			{
+				const __m128i Zero = _mm_setzero_si128();
+				const __m128i CoefU = _mm_setr_epi16(UB, UG, UR, 0, UB, UG, UR, 0);
+				const __m128i CoefV = _mm_setr_epi16(VB, VG, VR, 0, VB, VG, VR, 0);
+				uint32_t x = 0;
+
+				for (; x + 16 <= Width; x += 16)
+				{
+					__m128i Y[4], U[4], V[4];
+					for (int i = 0; i < 4; i++)
+					{
+						__m128i Px = _mm_loadu_si128((const __m128i*)(pRow + 4 * x + 16 * i));
+						__m128i Lo = _mm_unpacklo_epi8(Px, Zero);
+						__m128i Hi = _mm_unpackhi_epi8(Px, Zero);
+						Y[i] = Luma4Sse(Lo, Hi);
+						U[i] = Chroma4Sse(Lo, Hi, CoefU);
+						V[i] = Chroma4Sse(Lo, Hi, CoefV);
+					}
+
+					_mm_storeu_si128((__m128i*)(pY + x), Pack16Sse(Y[0], Y[1], Y[2], Y[3]));
+					_mm_storeu_si128((__m128i*)(pU + x), Pack16Sse(U[0], U[1], U[2], U[3]));
+					_mm_storeu_si128((__m128i*)(pV + x), Pack16Sse(V[0], V[1], V[2], V[3]));
+				}
+
+				Bgra444RowFrom(x, pRow, Width, pY, pU, pV);
+			}
+
+			PIXEL_TARGET_SSE41 inline __m128 HalfToFloatSse(__m128i Half)
+			{
+				__m128i Bits = _mm_slli_epi32(_mm_and_si128(Half, _mm_set1_epi32(0x7fff)), 13);
+				__m128 Value = _mm_mul_ps(_mm_castsi128_ps(Bits), _mm_set1_ps(5.192296858534828e33f));
+				__m128i Sign = _mm_slli_epi32(_mm_and_si128(Half, _mm_set1_epi32(0x8000)), 16);
+				return _mm_or_ps(Value, _mm_castsi128_ps(Sign));
+			}
+
+			PIXEL_TARGET_SSE41 inline __m128i PqIndexSse(__m128 L)
+			{
+				L = _mm_min_ps(_mm_max_ps(L, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+				__m128i Index = _mm_srli_epi32(_mm_add_epi32(_mm_castps_si128(L), _mm_set1_epi32(1 << (PqIndexShift - 1))), PqIndexShift);
+				Index = _mm_sub_epi32(Index, _mm_set1_epi32(PqIndexBase));
+				return _mm_min_epi32(_mm_max_epi32(Index, _mm_setzero_si128()), _mm_set1_epi32(PqLastIndex));
+			}
+
+			PIXEL_TARGET_SSE41 inline __m128i PqLookupSse(__m128i Index, const uint16_t* pLut)
+			{
+				return _mm_setr_epi32(
+					pLut[_mm_extract_epi32(Index, 0)], pLut[_mm_extract_epi32(Index, 1)],
+					pLut[_mm_extract_epi32(Index, 2)], pLut[_mm_extract_epi32(Index, 3)]);
+			}
+
+			// 16-bit PQ values of 4 scRGB pixels, one vector per channel
+			PIXEL_TARGET_SSE41 inline void ScRgb4ToPqSse(const uint16_t* p, const uint16_t* pLut, __m128i& ER, __m128i& EG, __m128i& EB)
+			{
+				__m128i Px01 = _mm_loadu_si128((const __m128i*)p);
+				__m128i Px23 = _mm_loadu_si128((const __m128i*)(p + 8));
+
+				__m128 P0 = HalfToFloatSse(_mm_cvtepu16_epi32(Px01));
+				__m128 P1 = HalfToFloatSse(_mm_cvtepu16_epi32(_mm_srli_si128(Px01, 8)));
+				__m128 P2 = HalfToFloatSse(_mm_cvtepu16_epi32(Px23));
+				__m128 P3 = HalfToFloatSse(_mm_cvtepu16_epi32(_mm_srli_si128(Px23, 8)));
+				_MM_TRANSPOSE4_PS(P0, P1, P2, P3);
+
+				__m128 R = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(M00), P0), _mm_mul_ps(_mm_set1_ps(M01), P1)), _mm_mul_ps(_mm_set1_ps(M02), P2));
+				__m128 G = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(M10), P0), _mm_mul_ps(_mm_set1_ps(M11), P1)), _mm_mul_ps(_mm_set1_ps(M12), P2));
+				__m128 B = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(M20), P0), _mm_mul_ps(_mm_set1_ps(M21), P1)), _mm_mul_ps(_mm_set1_ps(M22), P2));
+
+				ER = PqLookupSse(PqIndexSse(R), pLut);
+				EG = PqLookupSse(PqIndexSse(G), pLut);
+				EB = PqLookupSse(PqIndexSse(B), pLut);
+			}
+
+			PIXEL_TARGET_SSE41 inline __m128i PqComponentSse(__m128i R, __m128i G, __m128i B, int32_t CR, int32_t CG, int32_t CB, int32_t Offset)
+			{
+				__m128i Sum = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(R, _mm_set1_epi32(CR)), _mm_mullo_epi32(G, _mm_set1_epi32(CG))), _mm_mullo_epi32(B, _mm_set1_epi32(CB)));
+				Sum = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(Sum, _mm_set1_epi32(1 << 19)), 20), _mm_set1_epi32(Offset));
+				return _mm_slli_epi32(Sum, 6);
+			}
+
+			PIXEL_TARGET_SSE41 inline __m128i PqPairAverageSse(__m128i Row0a, __m128i Row1a, __m128i Row0b, __m128i Row1b)
+			{
+				__m128i Sum = _mm_hadd_epi32(_mm_add_epi32(Row0a, Row1a), _mm_add_epi32(Row0b, Row1b));
+				return _mm_srai_epi32(_mm_add_epi32(Sum, _mm_set1_epi32(2)), 2);
+			}
+
+			PIXEL_TARGET_SSE41 void ScRgb420RowsSse41(const uint16_t* pRow0, const uint16_t* pRow1, uint32_t Width, uint16_t* pY0, uint16_t* pY1, uint16_t* pUV)
+			{
+				const uint16_t* pLut = PqLut();
+				uint32_t x = 0;
+
+				for (; x + 8 <= Width; x += 8)
+				{
+					__m128i R[4], G[4], B[4];
+					ScRgb4ToPqSse(pRow0 + 4 * x, pLut, R[0], G[0], B[0]);
+					ScRgb4ToPqSse(pRow0 + 4 * x + 16, pLut, R[1], G[1], B[1]);
+					ScRgb4ToPqSse(pRow1 + 4 * x, pLut, R[2], G[2], B[2]);
+					ScRgb4ToPqSse(pRow1 + 4 * x + 16, pLut, R[3], G[3], B[3]);
+
+					_mm_storeu_si128((__m128i*)(pY0 + x), _mm_packus_epi32(
+						PqComponentSse(R[0], G[0], B[0], PY_R, PY_G, PY_B, 64), PqComponentSse(R[1], G[1], B[1], PY_R, PY_G, PY_B, 64)));
+					_mm_storeu_si128((__m128i*)(pY1 + x), _mm_packus_epi32(
+						PqComponentSse(R[2], G[2], B[2], PY_R, PY_G, PY_B, 64), PqComponentSse(R[3], G[3], B[3], PY_R, PY_G, PY_B, 64)));
+
+					__m128i Ra = PqPairAverageSse(R[0], R[2], R[1], R[3]);
+					__m128i Ga = PqPairAverageSse(G[0], G[2], G[1], G[3]);
+					__m128i Ba = PqPairAverageSse(B[0], B[2], B[1], B[3]);
+					__m128i Cb = PqComponentSse(Ra, Ga, Ba, PCb_R, PCb_G, PCb_B, 512);
+					__m128i Cr = PqComponentSse(Ra, Ga, Ba, PCr_R, PCr_G, PCr_B, 512);
+
+					_mm_storeu_si128((__m128i*)(pUV + x), _mm_packus_epi32(_mm_unpacklo_epi32(Cb, Cr), _mm_unpackhi_epi32(Cb, Cr)));
+				}
+
+				ScRgb420RowsFrom(x, pRow0, pRow1, Width, pY0, pY1, pUV);
+			}
+
+			const PIXEL_KERNELS Sse41Kernels = { PIXEL_CONVERT_ISA_SSE41, Bgra420RowsSse41, Bgra444RowSse41, ScRgb420RowsSse41 };
+
+#pragma endregion
+
+#pragma region AVX2
+
+			// The 256-bit pack and horizontal-add instructions work per 128-bit lane, this restores pixel order after them
+			PIXEL_TARGET_AVX2 inline __m256i InterleaveLanes(__m256i Value)
+			{
+				return _mm256_permutevar8x32_epi32(Value, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+			}
+
+			// Luma of 8 BGRA pixels as 32-bit integers in pixel order
+			PIXEL_TARGET_AVX2 inline __m256i Luma8Avx2(__m256i Lo, __m256i Hi)
+			{
+				const __m256i Coef = _mm256_setr_epi16(YB, YG, YR, 0, YB, YG, YR, 0, YB, YG, YR, 0, YB, YG, YR, 0);
+				__m256i Y = _mm256_hadd_epi32(_mm256_madd_epi16(Lo, Coef), _mm256_madd_epi16(Hi, Coef));
+				return _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(Y, _mm256_set1_epi32(128)), 8), _mm256_set1_epi32(16));
+			}
+
+			PIXEL_TARGET_AVX2 inline __m256i Chroma8Avx2(__m256i Lo, __m256i Hi, __m256i Coef)
+			{
+				__m256i C = _mm256_hadd_epi32(_mm256_madd_epi16(Lo, Coef), _mm256_madd_epi16(Hi, Coef));
+				return _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(C, _mm256_set1_epi32(128)), 8), _mm256_set1_epi32(128));
+			}
+
+			PIXEL_TARGET_AVX2 inline __m256i Pack32Avx2(__m256i a, __m256i b, __m256i c, __m256i d)
+			{
+				return InterleaveLanes(_mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d)));
+			}
+
+			// Per lane [U0, U1, V0, V1] of the 2x2 blocks covered by 8 pixels of a row pair
+			PIXEL_TARGET_AVX2 inline __m256i Chroma2x2Avx2(__m256i Row0, __m256i Row1)
+			{
+				const __m256i Zero = _mm256_setzero_si256();
+				const __m256i CoefU = _mm256_setr_epi16(UB, UG, UR, 0, UB, UG, UR, 0, UB, UG, UR, 0, UB, UG, UR, 0);
+				const __m256i CoefV = _mm256_setr_epi16(VB, VG, VR, 0, VB, VG, VR, 0, VB, VG, VR, 0, VB, VG, VR, 0);
+
+				__m256i SumLo = _mm256_add_epi16(_mm256_unpacklo_epi8(Row0, Zero), _mm256_unpacklo_epi8(Row1, Zero));
+				__m256i SumHi = _mm256_add_epi16(_mm256_unpackhi_epi8(Row0, Zero), _mm256_unpackhi_epi8(Row1, Zero));
+				SumLo = _mm256_add_epi16(SumLo, _mm256_srli_si256(SumLo, 8));
+				SumHi = _mm256_add_epi16(SumHi, _mm256_srli_si256(SumHi, 8));
+
+				__m256i Avg = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(SumLo, SumHi), _mm256_set1_epi16(2)), 2);
+				__m256i C = _mm256_hadd_epi32(_mm256_madd_epi16(Avg, CoefU), _mm256_madd_epi16(Avg, CoefV));
+				return _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(C, _mm256_set1_epi32(128)), 8), _mm256_set1_epi32(128));
+			}
+
+			PIXEL_TARGET_AVX2 void Bgra420RowsAvx2(const uint8_t* pRow0, const uint8_t* pRow1, uint32_t Width, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, bool Interleaved)
+			{
+				const __m256i Zero = _mm256_setzero_si256();
+				uint32_t x = 0;
+
+				for (; x + 32 <= Width; x += 32)
+				{
+					__m256i Row0[4], Row1[4], Y0[4], Y1[4], C[4];
+					for (int i = 0; i < 4; i++)
+					{
+						Row0[i] = _mm256_loadu_si256((const __m256i*)(pRow0 + 4 * x + 32 * i));
+						Row1[i] = _mm256_loadu_si256((const __m256i*)(pRow1 + 4 * x + 32 * i));
+						Y0[i] = Luma8Avx2(_mm256_unpacklo_epi8(Row0[i], Zero), _mm256_unpackhi_epi8(Row0[i], Zero));
+						Y1[i] = Luma8Avx2(_mm256_unpacklo_epi8(Row1[i], Zero), _mm256_unpackhi_epi8(Row1[i], Zero));
+						C[i] = Chroma2x2Avx2(Row0[i], Row1[i]);
+					}
+
+					_mm256_storeu_si256((__m256i*)(pY0 + x), Pack32Avx2(Y0[0], Y0[1], Y0[2], Y0[3]));
+					_mm256_storeu_si256((__m256i*)(pY1 + x), Pack32Avx2(Y1[0], Y1[1], Y1[2], Y1[3]));
+
+					__m256i U = InterleaveLanes(_mm256_packs_epi32(_mm256_unpacklo_epi64(C[0], C[1]), _mm256_unpacklo_epi64(C[2], C[3])));
+					__m256i V = InterleaveLanes(_mm256_packs_epi32(_mm256_unpackhi_epi64(C[0], C[1]), _mm256_unpackhi_epi64(C[2], C[3])));
+					if (Interleaved)
+					{
+						_mm256_storeu_si256((__m256i*)(pU + x), _mm256_packus_epi16(_mm256_unpacklo_epi16(U, V), _mm256_unpackhi_epi16(U, V)));
+					}
+					else
+					{
+						__m256i Planar = _mm256_permute4x64_epi64(_mm256_packus_epi16(U, V), _MM_SHUFFLE(3, 1, 2, 0));
+						_mm_storeu_si128((__m128i*)(pU + x / 2), _mm256_castsi256_si128(Planar));
+						_mm_storeu_si128((__m128i*)(pV + x / 2), _mm256_extracti128_si256(Planar, 1));
+					}
+				}
+
+				Bgra420RowsFrom(x, pRow0, pRow1, Width, pY0, pY1, pU, pV, Interleaved);
+			}
+
+			PIXEL_TARGET_AVX2 void Bgra444RowAvx2(const uint8_t* pRow, uint32_t Width, uint8_t* pY, uint8_t* pU, uint8_t* pV)
+			{
+				const __m256i Zero = _mm256_setzero_si256();
+				const __m256i CoefU = _mm256_setr_epi16(UB, UG, UR, 0, UB, UG, UR, 0, UB, UG, UR, 0, UB, UG, UR, 0);
+				const __m256i CoefV = _mm256_setr_epi16(VB, VG, VR, 0, VB, VG, VR, 0, VB, VG, VR, 0, VB, VG, VR, 0);
+				uint32_t x = 0;
+
+				for (; x + 32 <= Width; x += 32)
+				{
+					__m256i Y[4], U[4], V[4];
+					for (int i = 0; i < 4; i++)
+					{
+						__m256i Px = _mm256_loadu_si256((const __m256i*)(pRow + 4 * x + 32 * i));
+						__m256i Lo = _mm256_unpacklo_epi8(Px, Zero);
+						__m256i Hi = _mm256_unpackhi_epi8(Px, Zero);
+						Y[i] = Luma8Avx2(Lo, Hi);
+						U[i] = Chroma8Avx2(Lo, Hi, CoefU);
+						V[i] = Chroma8Avx2(Lo, Hi, CoefV);
+					}
+
+					_mm256_storeu_si256((__m256i*)(pY + x), Pack32Avx2(Y[0], Y[1], Y[2], Y[3]));
+					_mm256_storeu_si256((__m256i*)(pU + x), Pack32Avx2(U[0], U[1], U[2], U[3]));
+					_mm256_storeu_si256((__m256i*)(pV + x), Pack32Avx2(V[0], V[1], V[2], V[3]));
+				}
+
+				Bgra444RowFrom(x, pRow, Width, pY, pU, pV);
+			}
+
+			PIXEL_TARGET_AVX2 inline __m256 HalfToFloatAvx2(__m256i Half)
+			{
+				__m256i Bits = _mm256_slli_epi32(_mm256_and_si256(Half, _mm256_set1_epi32(0x7fff)), 13);
+				__m256 Value = _mm256_mul_ps(_mm256_castsi256_ps(Bits), _mm256_set1_ps(5.192296858534828e33f));
+				__m256i Sign = _mm256_slli_epi32(_mm256_and_si256(Half, _mm256_set1_epi32(0x8000)), 16);
+				return _mm256_or_ps(Value, _mm256_castsi256_ps(Sign));
+			}
+
+			PIXEL_TARGET_AVX2 inline __m256i PqLookupAvx2(__m256 L, const uint16_t* pLut)
+			{
+				L = _mm256_min_ps(_mm256_max_ps(L, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+				__m256i Index = _mm256_srli_epi32(_mm256_add_epi32(_mm256_castps_si256(L), _mm256_set1_epi32(1 << (PqIndexShift - 1))), PqIndexShift);
+				Index = _mm256_sub_epi32(Index, _mm256_set1_epi32(PqIndexBase));
+				Index = _mm256_min_epi32(_mm256_max_epi32(Index, _mm256_setzero_si256()), _mm256_set1_epi32(PqLastIndex));
+
+				__m256i Value = _mm256_i32gather_epi32((const int*)pLut, Index, 2);
+				return _mm256_and_si256(Value, _mm256_set1_epi32(0xffff));
+			}
+
+			// 16-bit PQ values of 8 scRGB pixels, one vector per channel in pixel order
+			PIXEL_TARGET_AVX2 inline void ScRgb8ToPqAvx2(const uint16_t* p, const uint16_t* pLut, __m256i& ER, __m256i& EG, __m256i& EB)
+			{
+				__m128i Px01 = _mm_loadu_si128((const __m128i*)p);
+				__m128i Px23 = _mm_loadu_si128((const __m128i*)(p + 8));
+				__m128i Px45 = _mm_loadu_si128((const __m128i*)(p + 16));
+				__m128i Px67 = _mm_loadu_si128((const __m128i*)(p + 24));
+
+				// Pixel i goes to the low lane and pixel i + 4 to the high lane, so a per-lane transpose yields pixel order
+				__m256 P0 = HalfToFloatAvx2(_mm256_cvtepu16_epi32(_mm_unpacklo_epi64(Px01, Px45)));
+				__m256 P1 = HalfToFloatAvx2(_mm256_cvtepu16_epi32(_mm_unpackhi_epi64(Px01, Px45)));
+				__m256 P2 = HalfToFloatAvx2(_mm256_cvtepu16_epi32(_mm_unpacklo_epi64(Px23, Px67)));
+				__m256 P3 = HalfToFloatAvx2(_mm256_cvtepu16_epi32(_mm_unpackhi_epi64(Px23, Px67)));
+
+				__m256 T0 = _mm256_unpacklo_ps(P0, P1);
+				__m256 T1 = _mm256_unpacklo_ps(P2, P3);
+				__m256 T2 = _mm256_unpackhi_ps(P0, P1);
+				__m256 T3 = _mm256_unpackhi_ps(P2, P3);
+				__m256 r = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(T0), _mm256_castps_pd(T1)));
+				__m256 g = _mm256_castpd_ps(_mm256_unpackhi_pd(_mm256_castps_pd(T0), _mm256_castps_pd(T1)));
+				__m256 b = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(T2), _mm256_castps_pd(T3)));
+
+				__m256 R = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(M00), r), _mm256_mul_ps(_mm256_set1_ps(M01), g)), _mm256_mul_ps(_mm256_set1_ps(M02), b));
+				__m256 G = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(M10), r), _mm256_mul_ps(_mm256_set1_ps(M11), g)), _mm256_mul_ps(_mm256_set1_ps(M12), b));
+				__m256 B = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(M20), r), _mm256_mul_ps(_mm256_set1_ps(M21), g)), _mm256_mul_ps(_mm256_set1_ps(M22), b));
+
+				ER = PqLookupAvx2(R, pLut);
+				EG = PqLookupAvx2(G, pLut);
+				EB = PqLookupAvx2(B, pLut);
+			}
+
+			PIXEL_TARGET_AVX2 inline __m256i PqComponentAvx2(__m256i R, __m256i G, __m256i B, int32_t CR, int32_t CG, int32_t CB, int32_t Offset)
+			{
+				__m256i Sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(R, _mm256_set1_epi32(CR)), _mm256_mullo_epi32(G, _mm256_set1_epi32(CG))), _mm256_mullo_epi32(B, _mm256_set1_epi32(CB)));
+				Sum = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(Sum, _mm256_set1_epi32(1 << 19)), 20), _mm256_set1_epi32(Offset));
+				return _mm256_slli_epi32(Sum, 6);
+			}
+
+			PIXEL_TARGET_AVX2 inline __m256i PqPairAverageAvx2(__m256i Row0a, __m256i Row1a, __m256i Row0b, __m256i Row1b)
+			{
+				__m256i Sum = _mm256_hadd_epi32(_mm256_add_epi32(Row0a, Row1a), _mm256_add_epi32(Row0b, Row1b));
+				Sum = _mm256_permutevar8x32_epi32(Sum, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+				return _mm256_srai_epi32(_mm256_add_epi32(Sum, _mm256_set1_epi32(2)), 2);
+			}
+
+			PIXEL_TARGET_AVX2 void ScRgb420RowsAvx2(const uint16_t* pRow0, const uint16_t* pRow1, uint32_t Width, uint16_t* pY0, uint16_t* pY1, uint16_t* pUV)
+			{
+				const uint16_t* pLut = PqLut();
+				uint32_t x = 0;
+
+				for (; x + 16 <= Width; x += 16)
+				{
+					__m256i R[4], G[4], B[4];
+					ScRgb8ToPqAvx2(pRow0 + 4 * x, pLut, R[0], G[0], B[0]);
+					ScRgb8ToPqAvx2(pRow0 + 4 * x + 32, pLut, R[1], G[1], B[1]);
+					ScRgb8ToPqAvx2(pRow1 + 4 * x, pLut, R[2], G[2], B[2]);
+					ScRgb8ToPqAvx2(pRow1 + 4 * x + 32, pLut, R[3], G[3], B[3]);
+
+					__m256i Y0 = _mm256_packus_epi32(
+						PqComponentAvx2(R[0], G[0], B[0], PY_R, PY_G, PY_B, 64), PqComponentAvx2(R[1], G[1], B[1], PY_R, PY_G, PY_B, 64));
+					__m256i Y1 = _mm256_packus_epi32(
+						PqComponentAvx2(R[2], G[2], B[2], PY_R, PY_G, PY_B, 64), PqComponentAvx2(R[3], G[3], B[3], PY_R, PY_G, PY_B, 64));
+					_mm256_storeu_si256((__m256i*)(pY0 + x), _mm256_permute4x64_epi64(Y0, _MM_SHUFFLE(3, 1, 2, 0)));
+					_mm256_storeu_si256((__m256i*)(pY1 + x), _mm256_permute4x64_epi64(Y1, _MM_SHUFFLE(3, 1, 2, 0)));
+
+					__m256i Ra = PqPairAverageAvx2(R[0], R[2], R[1], R[3]);
+					__m256i Ga = PqPairAverageAvx2(G[0], G[2], G[1], G[3]);
+					__m256i Ba = PqPairAverageAvx2(B[0], B[2], B[1], B[3]);
+					__m256i Cb = PqComponentAvx2(Ra, Ga, Ba, PCb_R, PCb_G, PCb_B, 512);
+					__m256i Cr = PqComponentAvx2(Ra, Ga, Ba, PCr_R, PCr_G, PCr_B, 512);
+
+					_mm256_storeu_si256((__m256i*)(pUV + x), _mm256_packus_epi32(_mm256_unpacklo_epi32(Cb, Cr), _mm256_unpackhi_epi32(Cb, Cr)));
+				}
+
+				ScRgb420RowsFrom(x, pRow0, pRow1, Width, pY0, pY1, pUV);
+			}
+
+			const PIXEL_KERNELS Avx2Kernels = { PIXEL_CONVERT_ISA_AVX2, Bgra420RowsAvx2, Bgra444RowAvx2, ScRgb420RowsAvx2 };
+
+#pragma endregion
+
+#endif // PIXEL_CONVERT_X64
+
+#if PIXEL_CONVERT_ARM64
+
+#pragma region NEON
+
+			inline uint8x8_t Luma8Neon(uint8x8_t B, uint8x8_t G, uint8x8_t R)
+			{
+				uint16x8_t Y = vmull_u8(B, vdup_n_u8(YB));
+				Y = vmlal_u8(Y, G, vdup_n_u8(YG));
+				Y = vmlal_u8(Y, R, vdup_n_u8(YR));
+				return vadd_u8(vrshrn_n_u16(Y, 8), vdup_n_u8(16));
+			}
+
+			inline uint8x16_t Luma16Neon(uint8x16x4_t Px)
+			{
+				return vcombine_u8(
+					Luma8Neon(vget_low_u8(Px.val[0]), vget_low_u8(Px.val[1]), vget_low_u8(Px.val[2])),
+					Luma8Neon(vget_high_u8(Px.val[0]), vget_high_u8(Px.val[1]), vget_high_u8(Px.val[2])));
+			}
+
+			inline uint8x8_t Chroma8Neon(int16x8_t B, int16x8_t G, int16x8_t R, int16_t CB, int16_t CG, int16_t CR)
+			{
+				int16x8_t C = vmulq_n_s16(B, CB);
+				C = vmlaq_n_s16(C, G, CG);
+				C = vmlaq_n_s16(C, R, CR);
+				return vqmovun_s16(vaddq_s16(vrshrq_n_s16(C, 8), vdupq_n_s16(128)));
+			}
+
+			void Bgra420RowsNeon(const uint8_t* pRow0, const uint8_t* pRow1, uint32_t Width, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, bool Interleaved)
+			{
+				uint32_t x = 0;
+
+				for (; x + 16 <= Width; x += 16)
+				{
+					uint8x16x4_t Px0 = vld4q_u8(pRow0 + 4 * x);
+					uint8x16x4_t Px1 = vld4q_u8(pRow1 + 4 * x);
+
+					vst1q_u8(pY0 + x, Luma16Neon(Px0));
+					vst1q_u8(pY1 + x, Luma16Neon(Px1));
+
+					int16x8_t B = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(Px0.val[0]), Px1.val[0]), 2));
+					int16x8_t G = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(Px0.val[1]), Px1.val[1]), 2));
+					int16x8_t R = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(Px0.val[2]), Px1.val[2]), 2));
+
+					uint8x8x2_t UV;
+					UV.val[0] = Chroma8Neon(B, G, R, UB, UG, UR);
+					UV.val[1] = Chroma8Neon(B, G, R, VB, VG, VR);
+					if (Interleaved)
+					{
+						vst2_u8(pU + x, UV);
+					}
+					else
+					{
+						vst1_u8(pU + x / 2, UV.val[0]);
+						vst1_u8(pV + x / 2, UV.val[1]);
+					}
+				}
+
+				Bgra420RowsFrom(x, pRow0, pRow1, Width, pY0, pY1, pU, pV, Interleaved);
+			}
+
+			void Bgra444RowNeon(const uint8_t* pRow, uint32_t Width, uint8_t* pY, uint8_t* pU, uint8_t* pV)
+			{
+				uint32_t x = 0;
+
+				for (; x + 16 <= Width; x += 16)
+				{
+					uint8x16x4_t Px = vld4q_u8(pRow + 4 * x);
+					vst1q_u8(pY + x, Luma16Neon(Px));
+
+					int16x8_t BLo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(Px.val[0])));
+					int16x8_t GLo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(Px.val[1])));
+					int16x8_t RLo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(Px.val[2])));
+					int16x8_t BHi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(Px.val[0])));
+					int16x8_t GHi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(Px.val[1])));
+					int16x8_t RHi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(Px.val[2])));
+
+					vst1q_u8(pU + x, vcombine_u8(Chroma8Neon(BLo, GLo, RLo, UB, UG, UR), Chroma8Neon(BHi, GHi, RHi, UB, UG, UR)));
+					vst1q_u8(pV + x, vcombine_u8(Chroma8Neon(BLo, GLo, RLo, VB, VG, VR), Chroma8Neon(BHi, GHi, RHi, VB, VG, VR)));
+				}
+
+				Bgra444RowFrom(x, pRow, Width, pY, pU, pV);
+			}
+
+			inline float32x4_t HalfToFloatNeon(uint16x4_t Half)
+			{
+				uint32x4_t Wide = vmovl_u16(Half);
+				uint32x4_t Bits = vshlq_n_u32(vandq_u32(Wide, vdupq_n_u32(0x7fff)), 13);
+				float32x4_t Value = vmulq_f32(vreinterpretq_f32_u32(Bits), vdupq_n_f32(5.192296858534828e33f));
+				uint32x4_t Sign = vshlq_n_u32(vandq_u32(Wide, vdupq_n_u32(0x8000)), 16);
+				return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(Value), Sign));
+			}
+
+			inline int32x4_t PqLookupNeon(float32x4_t L, const uint16_t* pLut)
+			{
+				L = vminq_f32(vmaxq_f32(L, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+				int32x4_t Index = vreinterpretq_s32_u32(vshrq_n_u32(vaddq_u32(vreinterpretq_u32_f32(L), vdupq_n_u32(1 << (PqIndexShift - 1))), PqIndexShift));
+				Index = vsubq_s32(Index, vdupq_n_s32(PqIndexBase));
+				Index = vminq_s32(vmaxq_s32(Index, vdupq_n_s32(0)), vdupq_n_s32(PqLastIndex));
+
+				int32_t Lanes[4];
+				vst1q_s32(Lanes, Index);
+				for (auto& Lane : Lanes)
+				{
+					Lane = pLut[Lane];
+				}
+				return vld1q_s32(Lanes);
+			}
+
+			// 16-bit PQ values of 4 scRGB pixels already split into channels
+			inline void ScRgb4ToPqNeon(uint16x4_t HalfR, uint16x4_t HalfG, uint16x4_t HalfB, const uint16_t* pLut, int32x4_t& ER, int32x4_t& EG, int32x4_t& EB)
+			{
+				float32x4_t r = HalfToFloatNeon(HalfR), g = HalfToFloatNeon(HalfG), b = HalfToFloatNeon(HalfB);
+
+				float32x4_t R = vaddq_f32(vaddq_f32(vmulq_n_f32(r, M00), vmulq_n_f32(g, M01)), vmulq_n_f32(b, M02));
+				float32x4_t G = vaddq_f32(vaddq_f32(vmulq_n_f32(r, M10), vmulq_n_f32(g, M11)), vmulq_n_f32(b, M12));
+				float32x4_t B = vaddq_f32(vaddq_f32(vmulq_n_f32(r, M20), vmulq_n_f32(g, M21)), vmulq_n_f32(b, M22));
+
+				ER = PqLookupNeon(R, pLut);
+				EG = PqLookupNeon(G, pLut);
+				EB = PqLookupNeon(B, pLut);
+			}
+
+			inline uint16x4_t PqComponentNeon(int32x4_t R, int32x4_t G, int32x4_t B, int32_t CR, int32_t CG, int32_t CB, int32_t Offset)
+			{
+				int32x4_t Sum = vaddq_s32(vaddq_s32(vmulq_n_s32(R, CR), vmulq_n_s32(G, CG)), vmulq_n_s32(B, CB));
+				Sum = vaddq_s32(vshrq_n_s32(vaddq_s32(Sum, vdupq_n_s32(1 << 19)), 20), vdupq_n_s32(Offset));
+				return vqmovun_s32(vshlq_n_s32(Sum, 6));
+			}
+
+			void ScRgb420RowsNeon(const uint16_t* pRow0, const uint16_t* pRow1, uint32_t Width, uint16_t* pY0, uint16_t* pY1, uint16_t* pUV)
+			{
+				const uint16_t* pLut = PqLut();
+				uint32_t x = 0;
+
+				for (; x + 8 <= Width; x += 8)
+				{
+					uint16x8x4_t Px0 = vld4q_u16(pRow0 + 4 * x);
+					uint16x8x4_t Px1 = vld4q_u16(pRow1 + 4 * x);
+
+					// Index 0/1 are the low/high halves of row 0, 2/3 the same for row 1
+					int32x4_t R[4], G[4], B[4];
+					ScRgb4ToPqNeon(vget_low_u16(Px0.val[0]), vget_low_u16(Px0.val[1]), vget_low_u16(Px0.val[2]), pLut, R[0], G[0], B[0]);
+					ScRgb4ToPqNeon(vget_high_u16(Px0.val[0]), vget_high_u16(Px0.val[1]), vget_high_u16(Px0.val[2]), pLut, R[1], G[1], B[1]);
+					ScRgb4ToPqNeon(vget_low_u16(Px1.val[0]), vget_low_u16(Px1.val[1]), vget_low_u16(Px1.val[2]), pLut, R[2], G[2], B[2]);
+					ScRgb4ToPqNeon(vget_high_u16(Px1.val[0]), vget_high_u16(Px1.val[1]), vget_high_u16(Px1.val[2]), pLut, R[3], G[3], B[3]);
+
+					vst1q_u16(pY0 + x, vcombine_u16(
+						PqComponentNeon(R[0], G[0], B[0], PY_R, PY_G, PY_B, 64), PqComponentNeon(R[1], G[1], B[1], PY_R, PY_G, PY_B, 64)));
+					vst1q_u16(pY1 + x, vcombine_u16(
+						PqComponentNeon(R[2], G[2], B[2], PY_R, PY_G, PY_B, 64), PqComponentNeon(R[3], G[3], B[3], PY_R, PY_G, PY_B, 64)));
+
+					int32x4_t Ra = vshrq_n_s32(vaddq_s32(vpaddq_s32(vaddq_s32(R[0], R[2]), vaddq_s32(R[1], R[3])), vdupq_n_s32(2)), 2);
+					int32x4_t Ga = vshrq_n_s32(vaddq_s32(vpaddq_s32(vaddq_s32(G[0], G[2]), vaddq_s32(G[1], G[3])), vdupq_n_s32(2)), 2);
+					int32x4_t Ba = vshrq_n_s32(vaddq_s32(vpaddq_s32(vaddq_s32(B[0], B[2]), vaddq_s32(B[1], B[3])), vdupq_n_s32(2)), 2);
+
+					uint16x4x2_t UV;
+					UV.val[0] = PqComponentNeon(Ra, Ga, Ba, PCb_R, PCb_G, PCb_B, 512);
+					UV.val[1] = PqComponentNeon(Ra, Ga, Ba, PCr_R, PCr_G, PCr_B, 512);
+					vst2_u16(pUV + x, UV);
+				}
+
+				ScRgb420RowsFrom(x, pRow0, pRow1, Width, pY0, pY1, pUV);
+			}
+
+			const PIXEL_KERNELS NeonKernels = { PIXEL_CONVERT_ISA_NEON, Bgra420RowsNeon, Bgra444RowNeon, ScRgb420RowsNeon };
+
+#pragma endregion
+
+#endif // PIXEL_CONVERT_ARM64
+
+#pragma region Dispatch
+
+			bool CpuHasSse41()
+			{
+#if PIXEL_CONVERT_X64
+#if defined(_MSC_VER)
+				int Info[4];
+				__cpuid(Info, 1);
+				return (Info[2] & (1 << 19)) != 0;
+#else
+				return __builtin_cpu_supports("sse4.1");
+#endif
+#else
+				return false;
+#endif
+			}
+
+			bool CpuHasAvx2()
+			{
+#if PIXEL_CONVERT_X64
+#if defined(_MSC_VER)
+				int Info[4];
+				__cpuid(Info, 1);
+				bool OsSavesYmm = (Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+				if (!OsSavesYmm)
+				{
+					return false;
+				}
+
+				__cpuidex(Info, 7, 0);
+				return (Info[1] & (1 << 5)) != 0;
+#else
+				return __builtin_cpu_supports("avx2");
+#endif
+#else
+				return false;
+#endif
+			}
+
+			const PIXEL_KERNELS* KernelsFor(PIXEL_CONVERT_ISA Isa)
+			{
+				switch (Isa)
+				{
+#if PIXEL_CONVERT_X64
+				case PIXEL_CONVERT_ISA_SSE41:
+					return CpuHasSse41() ? &Sse41Kernels : nullptr;
+				case PIXEL_CONVERT_ISA_AVX2:
+					return CpuHasAvx2() ? &Avx2Kernels : nullptr;
+#endif
+#if PIXEL_CONVERT_ARM64
+				case PIXEL_CONVERT_ISA_NEON:
+					return &NeonKernels;
+#endif
+				case PIXEL_CONVERT_ISA_SCALAR:
+					return &ScalarKernels;
+				default:
+					return nullptr;
+				}
+			}
+
+			std::atomic<const PIXEL_KERNELS*> g_Kernels{nullptr};
+
+			const PIXEL_KERNELS* Kernels()
+			{
+				const PIXEL_KERNELS* pKernels = g_Kernels.load(std::memory_order_acquire);
+				if (!pKernels)
+				{
+					pKernels = KernelsFor(PixelConvertBestIsa());
+					g_Kernels.store(pKernels, std::memory_order_release);
+				}
+
+				return pKernels;
+			}
+
+#pragma endregion
+		}
+
+		PIXEL_CONVERT_ISA PixelConvertBestIsa()
+		{
+			const PIXEL_CONVERT_ISA Preferred[] = { PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON, PIXEL_CONVERT_ISA_SSE41 };
+			for (auto Isa : Preferred)
+			{
+				if (PixelConvertIsaSupported(Isa))
+				{
+					return Isa;
+				}
+			}
+
+			return PIXEL_CONVERT_ISA_SCALAR;
+		}
+
+		bool PixelConvertIsaSupported(PIXEL_CONVERT_ISA Isa)
+		{
+			return KernelsFor(Isa) != nullptr;
+		}
+
+		PIXEL_CONVERT_ISA PixelConvertGetIsa()
+		{
+			return Kernels()->Isa;
+		}
+
+		bool PixelConvertSetIsa(PIXEL_CONVERT_ISA Isa)
+		{
+			const PIXEL_KERNELS* pKernels = KernelsFor(Isa);
+			if (!pKernels)
+			{
+				return false;
+			}
+
+			g_Kernels.store(pKernels, std::memory_order_release);
+			return true;
+		}
+
+		static void ConvertBgraTo420(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch, uint8_t* pU, size_t UPitch, uint8_t* pV, size_t VPitch, bool Interleaved)
+		{
+			BGRA_420_ROWS Convert = Kernels()->Bgra420;
+
+			for (uint32_t y = 0; y < Height; y += 2)
+			{
+				// The last row of an odd height is paired with itself
+				uint32_t y1 = y + 1 < Height ? y + 1 : y;
+
+				Convert(pSrc + y * SrcPitch, pSrc + y1 * SrcPitch, Width,
+					pY + y * YPitch, pY + y1 * YPitch,
+					pU + (y / 2) * UPitch, Interleaved ? nullptr : pV + (y / 2) * VPitch, Interleaved);
+			}
+		}
+
+		void ConvertBgraToNv12(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch,
+			uint8_t* pUV, size_t UVPitch)
+		{
+			ConvertBgraTo420(pSrc, SrcPitch, Width, Height, pY, YPitch, pUV, UVPitch, nullptr, 0, true);
+		}
+
+		void ConvertBgraToI420(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch,
+			uint8_t* pU, size_t UPitch,
+			uint8_t* pV, size_t VPitch)
+		{
+			ConvertBgraTo420(pSrc, SrcPitch, Width, Height, pY, YPitch, pU, UPitch, pV, VPitch, false);
+		}
+
+		void ConvertBgraToYuv444(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch,
+			uint8_t* pU, size_t UPitch,
+			uint8_t* pV, size_t VPitch)
+		{
+			BGRA_444_ROW Convert = Kernels()->Bgra444;
+
+			for (uint32_t y = 0; y < Height; y++)
+			{
+				Convert(pSrc + y * SrcPitch, Width, pY + y * YPitch, pU + y * UPitch, pV + y * VPitch);
+			}
+		}
+
+		void ConvertScRgbToP010(
+			const uint16_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint16_t* pY, size_t YPitch,
+			uint16_t* pUV, size_t UVPitch)
+		{
+			SCRGB_420_ROWS Convert = Kernels()->ScRgb420;
+			auto Row = [](auto* pBase, size_t Pitch, uint32_t y) {
+				return (decltype(pBase))((uintptr_t)pBase + y * Pitch);
+			};
+
+			for (uint32_t y = 0; y < Height; y += 2)
+			{
+				uint32_t y1 = y + 1 < Height ? y + 1 : y;
+
+				Convert(Row(pSrc, SrcPitch, y), Row(pSrc, SrcPitch, y1), Width,
+					Row(pY, YPitch, y), Row(pY, YPitch, y1), Row(pUV, UVPitch, y / 2));
+			}
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// Pixel format conversion for frames handed to video encoders.
+//
+// Desktop surfaces arrive as BGRA8 (SDR) or as FP16 scRGB (HDR, when the adapter advertises
+// IDDCX_ADAPTER_FLAGS_CAN_PROCESS_FP16), while encoders want planar YUV:
+//  * BGRA8 -> NV12, I420 or YUV444, BT.709 limited range. Chroma is sited at the centre of every 2x2 block.
+//  * FP16 scRGB -> P010, BT.2020 primaries with SMPTE ST 2084 (PQ) transfer, limited range, 1.0 = 80 nits.
+//
+// Every conversion has a scalar reference and SSE4.1, AVX2 and NEON paths, picked at runtime for the CPU. The 8-bit
+// conversions are pure integer math and the SIMD paths are bit-exact with the scalar one. The P010 conversion runs
+// its gamut conversion in float, so paths may differ by one code value where a sample sits on a rounding boundary.
+//
+// Odd widths and heights are handled by replicating the last column and row into the chroma average. Pitches are in
+// bytes, planes may be unaligned.
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef enum _PIXEL_CONVERT_ISA {
+			PIXEL_CONVERT_ISA_SCALAR,
+			PIXEL_CONVERT_ISA_SSE41,
+			PIXEL_CONVERT_ISA_AVX2,
+			PIXEL_CONVERT_ISA_NEON,
+		} PIXEL_CONVERT_ISA;
+
+		// Fastest instruction set the CPU supports
+		PIXEL_CONVERT_ISA PixelConvertBestIsa();
+		bool PixelConvertIsaSupported(PIXEL_CONVERT_ISA Isa);
+
+		// Instruction set used by the conversions below, the best supported one unless overridden
+		PIXEL_CONVERT_ISA PixelConvertGetIsa();
+		// Forces an instruction set, e.g. to compare paths. Returns false if the CPU doesn't support it.
+		bool PixelConvertSetIsa(PIXEL_CONVERT_ISA Isa);
+
+		// Y is Width x Height, UV is interleaved at half resolution
+		void ConvertBgraToNv12(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch,
+			uint8_t* pUV, size_t UVPitch);
+
+		// Y is Width x Height, U and V are separate planes at half resolution
+		void ConvertBgraToI420(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch,
+			uint8_t* pU, size_t UPitch,
+			uint8_t* pV, size_t VPitch);
+
+		// All three planes at full resolution
+		void ConvertBgraToYuv444(
+			const uint8_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint8_t* pY, size_t YPitch,
+			uint8_t* pU, size_t UPitch,
+			uint8_t* pV, size_t VPitch);
+
+		// pSrc holds R16G16B16A16_FLOAT pixels. Samples are 10 bits stored in the high bits of each 16-bit word.
+		void ConvertScRgbToP010(
+			const uint16_t* pSrc, size_t SrcPitch, uint32_t Width, uint32_t Height,
+			uint16_t* pY, size_t YPitch,
+			uint16_t* pUV, size_t UVPitch);
+	}
+}
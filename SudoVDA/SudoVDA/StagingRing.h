@@ -0,0 +1,230 @@
+#pragma once
+
+// Multi-buffered GPU to CPU readback scheduling.
+//
+// Reading a frame back through a single staging texture makes the CPU wait in Map() for the copy that was just
+// queued. The StagingRing spreads consecutive frames over N staging slots instead: frame K is copied into slot
+// K % N, a completion fence is queued behind the copy, and the slot is only handed out for reading once its fence has
+// retired. While the GPU copies frame K the CPU reads back frame K - 1, so acquire, copy and readback overlap.
+//
+// Slots are used strictly in submission order, which keeps frames in order without any bookkeeping beyond a head and
+// a tail index. When every slot is still in flight the oldest one is waited on, the stall is counted, and nothing is
+// ever dropped.
+//
+// The ring only schedules. Resource creation, the copies themselves and the fences live behind IStagingBackend, so the
+// same logic runs against D3D11 in the driver and against FakeStagingBackend on machines without a GPU.
+
+#include <stdint.h>
+
+#include "FramePacer.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		/// <summary>
+		/// Fence operations for the staging slots of one device.
+		/// </summary>
+		class IStagingBackend
+		{
+		public:
+			virtual ~IStagingBackend() = default;
+
+			// Queues a fence that completes once every copy recorded into the slot so far has finished
+			virtual void SignalFence(uint32_t Slot) = 0;
+			// Polls the slot's fence without blocking
+			virtual bool IsFenceComplete(uint32_t Slot) = 0;
+			// Blocks until the slot's fence has completed
+			virtual void WaitFence(uint32_t Slot) = 0;
+		};
+
+		typedef enum _STAGING_SLOT_STATE {
+			STAGING_SLOT_FREE,
+			STAGING_SLOT_RECORDING, // Handed out by BeginCopy(), copies are being recorded
+			STAGING_SLOT_COPYING,   // Fence queued, copy may still be running on the GPU
+			STAGING_SLOT_READY,     // Fence retired, waiting to be read back
+			STAGING_SLOT_READING,   // Handed out by AcquireReadable()
+		} STAGING_SLOT_STATE;
+
+		typedef struct _STAGING_STATS {
+			uint64_t Copies;
+			uint64_t Readbacks;
+			uint64_t Stalls; // Readbacks that had to wait for the GPU because every slot was in flight
+		} STAGING_STATS;
+
+		class StagingRing
+		{
+		public:
+			static const uint32_t MaxSlots = 8;
+
+			StagingRing(IStagingBackend& Backend, uint32_t SlotCount) : m_Backend(Backend)
+			{
+				m_SlotCount = SlotCount < 1 ? 1 : (SlotCount > MaxSlots ? MaxSlots : SlotCount);
+				Reset();
+			}
+
+			uint32_t SlotCount() const
+			{
+				return m_SlotCount;
+			}
+
+			// Frames copied but not read back yet
+			uint32_t InFlight() const
+			{
+				return (uint32_t)(m_Head - m_Tail);
+			}
+
+			STAGING_SLOT_STATE SlotState(uint32_t Slot) const
+			{
+				return m_State[Slot];
+			}
+
+			const STAGING_STATS& Stats() const
+			{
+				return m_Stats;
+			}
+
+			// Forgets every frame in flight, e.g. after the staging resources were recreated
+			void Reset()
+			{
+				m_Head = 0;
+				m_Tail = 0;
+				for (auto& State : m_State)
+				{
+					State = STAGING_SLOT_FREE;
+				}
+			}
+
+			// Returns the slot to record the next frame's copies into, or -1 if every slot is still in flight. In that
+			// case the caller has to read back the oldest frame with AcquireReadable(true) first.
+			int32_t BeginCopy()
+			{
+				if (InFlight() >= m_SlotCount)
+				{
+					return -1;
+				}
+
+				uint32_t Slot = (uint32_t)(m_Head % m_SlotCount);
+				if (m_State[Slot] != STAGING_SLOT_FREE)
+				{
+					return -1;
+				}
+
+				m_State[Slot] = STAGING_SLOT_RECORDING;
+				return (int32_t)Slot;
+			}
+
+			// Queues the slot's completion fence, the frame becomes readable once it retires
+			void EndCopy(uint32_t Slot)
+			{
+				m_Backend.SignalFence(Slot);
+				m_State[Slot] = STAGING_SLOT_COPYING;
+				m_Head++;
+				m_Stats.Copies++;
+			}
+
+			// Returns the oldest frame in flight once its copy has retired, or -1 if there is none. With Wait set the
+			// oldest frame is waited for instead of returning -1 while its copy is still running.
+			int32_t AcquireReadable(bool Wait)
+			{
+				if (!InFlight())
+				{
+					return -1;
+				}
+
+				uint32_t Slot = (uint32_t)(m_Tail % m_SlotCount);
+				if (m_State[Slot] != STAGING_SLOT_COPYING && m_State[Slot] != STAGING_SLOT_READY)
+				{
+					// Still being read
+					return -1;
+				}
+
+				if (m_State[Slot] == STAGING_SLOT_COPYING)
+				{
+					if (m_Backend.IsFenceComplete(Slot))
+					{
+						m_State[Slot] = STAGING_SLOT_READY;
+					}
+					else if (Wait)
+					{
+						m_Backend.WaitFence(Slot);
+						m_State[Slot] = STAGING_SLOT_READY;
+						m_Stats.Stalls++;
+					}
+					else
+					{
+						return -1;
+					}
+				}
+
+				m_State[Slot] = STAGING_SLOT_READING;
+				return (int32_t)Slot;
+			}
+
+			// Returns a slot handed out by AcquireReadable() for reuse
+			void EndRead(uint32_t Slot)
+			{
+				m_State[Slot] = STAGING_SLOT_FREE;
+				m_Tail++;
+				m_Stats.Readbacks++;
+			}
+
+		private:
+			IStagingBackend& m_Backend;
+			uint32_t m_SlotCount = 1;
+			uint64_t m_Head = 0; // Frames submitted
+			uint64_t m_Tail = 0; // Frames read back
+			STAGING_SLOT_STATE m_State[MaxSlots];
+			STAGING_STATS m_Stats{};
+		};
+
+		/// <summary>
+		/// Backend without a GPU. Every copy completes a fixed number of clock ticks after its fence was queued, which
+		/// lets the scheduling be exercised with a synthetic IPacingClock.
+		/// </summary>
+		class FakeStagingBackend : public IStagingBackend
+		{
+		public:
+			FakeStagingBackend(IPacingClock& Clock, uint64_t CopyLatencyTicks) : m_Clock(Clock), m_CopyLatency(CopyLatencyTicks)
+			{
+			}
+
+			void SetCopyLatency(uint64_t CopyLatencyTicks)
+			{
+				m_CopyLatency = CopyLatencyTicks;
+			}
+
+			void SignalFence(uint32_t Slot) override
+			{
+				m_CompleteAt[Slot] = m_Clock.Now() + m_CopyLatency;
+			}
+
+			bool IsFenceComplete(uint32_t Slot) override
+			{
+				return m_Clock.Now() >= m_CompleteAt[Slot];
+			}
+
+			// The clock is not ours to advance, so the time that would have been spent blocking is only accounted
+			void WaitFence(uint32_t Slot) override
+			{
+				uint64_t Now = m_Clock.Now();
+				if (Now < m_CompleteAt[Slot])
+				{
+					m_WaitedTicks += m_CompleteAt[Slot] - Now;
+					m_CompleteAt[Slot] = Now;
+				}
+			}
+
+			uint64_t WaitedTicks() const
+			{
+				return m_WaitedTicks;
+			}
+
+		private:
+			IPacingClock& m_Clock;
+			uint64_t m_CopyLatency;
+			uint64_t m_CompleteAt[StagingRing::MaxSlots] = {};
+			uint64_t m_WaitedTicks = 0;
+		};
+	}
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+// Swap-chain assignment: phase timing and hand-over to a processing thread that outlives its swap-chains.
+//
+// Every mode change, adapter switch or watchdog reconnect replaces the monitor's swap-chain, and the screen stays
+// black from the assignment until the first buffer of the new swap-chain is acquired. AssignPhaseTimer timestamps the
+// phases in between for every assignment:
+//
+//   Begin -> RELEASE (previous swap-chain let go) -> DEVICE (render device ready) -> THREAD (processing thread has the
+//   swap-chain) -> SET_DEVICE (IddCxSwapChainSetDevice returned) -> FIRST_FRAME (first buffer acquired)
+//
+// Phases are recorded from whichever thread reaches them, marks of an assignment that was superseded are dropped.
+//
+// SwapChainRearm lets the processing thread park between swap-chains instead of being torn down and created again:
+//
+//   IDLE --Arm()--> ARMED --WaitForAssignment()--> RUNNING --RequestRelease()--> RELEASING
+//     ^                                               |                              |
+//     +------------------ Released() ----------------+------------------------------+
+//
+// The processing thread owns the swap-chain from WaitForAssignment() until Released(), including deleting it, and
+// polls ShouldRelease() whenever its wait for frames is woken. The assigning thread arms it and, to take a swap-chain
+// away, requests the release, wakes the processing thread through its own means and waits for Released(). Shutdown()
+// releases whatever is running and makes WaitForAssignment() return false.
+//
+// Only the standard library is used, so both run unchanged in the driver and against a simulated IddCx.
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+#include "LatencyHistogram.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef enum _ASSIGN_PHASE {
+			ASSIGN_PHASE_RELEASE = 0,
+			ASSIGN_PHASE_DEVICE,
+			ASSIGN_PHASE_THREAD,
+			ASSIGN_PHASE_SET_DEVICE,
+			ASSIGN_PHASE_FIRST_FRAME,
+			ASSIGN_PHASE_COUNT
+		} ASSIGN_PHASE;
+
+		typedef struct _ASSIGN_TIMING_STATS {
+			uint64_t Assignments;
+			uint64_t Rearms;                             // Assignments that reused the parked processing thread
+			uint64_t Failures;                           // Assignments superseded before their first frame
+			uint64_t LastPhaseNs[ASSIGN_PHASE_COUNT];    // From the start of the latest assignment, 0 if not reached
+			bool LastRearmed;
+			LATENCY_SUMMARY Phases[ASSIGN_PHASE_COUNT];  // From the start of every assignment that reached the phase
+		} ASSIGN_TIMING_STATS;
+
+		class AssignPhaseTimer
+		{
+		public:
+			// Timestamps are in ticks of Frequency per second
+			explicit AssignPhaseTimer(uint64_t Frequency) :
+				m_Frequency(Frequency ? Frequency : 1)
+			{
+			}
+
+			// Starts timing a new assignment and returns its id, Rearmed tells whether it reuses the processing thread
+			uint64_t Begin(uint64_t Now, bool Rearmed)
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+
+				if (m_Id && !m_Marked[ASSIGN_PHASE_FIRST_FRAME])
+				{
+					m_Failures++;
+				}
+
+				m_Id++;
+				m_Start = Now;
+				m_Rearmed = Rearmed;
+				m_Rearms += Rearmed;
+				for (uint32_t i = 0; i < ASSIGN_PHASE_COUNT; i++)
+				{
+					m_Marked[i] = false;
+					m_PhaseNs[i] = 0;
+				}
+
+				return m_Id;
+			}
+
+			// Records that assignment Id reached Phase, ignored once a newer assignment began or the phase is recorded
+			void Mark(uint64_t Id, ASSIGN_PHASE Phase, uint64_t Now)
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+
+				if (Id != m_Id || m_Marked[Phase])
+				{
+					return;
+				}
+
+				uint64_t Ticks = Now > m_Start ? Now - m_Start : 0;
+				m_PhaseNs[Phase] = Ticks / m_Frequency * 1000000000 + Ticks % m_Frequency * 1000000000 / m_Frequency;
+				m_Marked[Phase] = true;
+				m_Latency[Phase].Record(m_PhaseNs[Phase]);
+			}
+
+			void Snapshot(ASSIGN_TIMING_STATS& Stats) const
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+
+				Stats.Assignments = m_Id;
+				Stats.Rearms = m_Rearms;
+				Stats.Failures = m_Failures;
+				Stats.LastRearmed = m_Rearmed;
+				for (uint32_t i = 0; i < ASSIGN_PHASE_COUNT; i++)
+				{
+					Stats.LastPhaseNs[i] = m_PhaseNs[i];
+					m_Latency[i].Summarize(Stats.Phases[i]);
+				}
+			}
+
+		private:
+			uint64_t m_Frequency;
+			mutable std::mutex m_Lock;
+			uint64_t m_Id = 0;
+			uint64_t m_Start = 0;
+			bool m_Rearmed = false;
+			uint64_t m_Rearms = 0;
+			uint64_t m_Failures = 0;
+			bool m_Marked[ASSIGN_PHASE_COUNT] = {};
+			uint64_t m_PhaseNs[ASSIGN_PHASE_COUNT] = {};
+			LatencyHistogram m_Latency[ASSIGN_PHASE_COUNT];
+		};
+
+		typedef enum _REARM_STATE {
+			REARM_IDLE,       // Parked without a swap-chain
+			REARM_ARMED,      // A swap-chain waits for the processing thread
+			REARM_RUNNING,
+			REARM_RELEASING,  // Asked to let go of the swap-chain
+			REARM_SHUTDOWN,
+		} REARM_STATE;
+
+		template <typename TAssignment>
+		class SwapChainRearm
+		{
+		public:
+			SwapChainRearm() = default;
+			SwapChainRearm(const SwapChainRearm&) = delete;
+			SwapChainRearm& operator=(const SwapChainRearm&) = delete;
+
+			// Assigning thread: hands Assignment to the processing thread. False unless it was idle, release first.
+			bool Arm(TAssignment Assignment)
+			{
+				{
+					std::lock_guard<std::mutex> lg(m_Lock);
+					if (m_State != REARM_IDLE)
+					{
+						return false;
+					}
+
+					m_Pending = std::move(Assignment);
+					m_State = REARM_ARMED;
+				}
+
+				m_Changed.notify_all();
+				return true;
+			}
+
+			// Assigning thread: asks the processing thread to let go of its swap-chain. True if it has one to let go
+			// of, the caller then wakes it and calls WaitReleased(). An armed swap-chain is still picked up, and
+			// released right away.
+			bool RequestRelease()
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				if (m_State == REARM_ARMED || m_State == REARM_RUNNING)
+				{
+					m_State = REARM_RELEASING;
+				}
+
+				return m_State == REARM_RELEASING;
+			}
+
+			void WaitReleased()
+			{
+				std::unique_lock<std::mutex> ul(m_Lock);
+				m_Changed.wait(ul, [this] { return m_State == REARM_IDLE || m_State == REARM_SHUTDOWN; });
+			}
+
+			// Assigning thread: makes WaitForAssignment() return false from now on, a running swap-chain is to be let
+			// go like with RequestRelease()
+			void Shutdown()
+			{
+				{
+					std::lock_guard<std::mutex> lg(m_Lock);
+					m_ShutdownRequested = true;
+					if (m_State == REARM_IDLE)
+					{
+						m_State = REARM_SHUTDOWN;
+					}
+					else if (m_State != REARM_SHUTDOWN)
+					{
+						m_State = REARM_RELEASING;
+					}
+				}
+
+				m_Changed.notify_all();
+			}
+
+			// Processing thread: blocks until a swap-chain is armed. False once shut down.
+			bool WaitForAssignment(TAssignment& Assignment)
+			{
+				std::unique_lock<std::mutex> ul(m_Lock);
+				m_Changed.wait(ul, [this] { return m_State == REARM_ARMED || m_State == REARM_RELEASING || m_State == REARM_SHUTDOWN; });
+				if (m_State == REARM_SHUTDOWN)
+				{
+					return false;
+				}
+
+				// Released before it was picked up, it's still ours to let go of
+				Assignment = std::move(m_Pending);
+				m_Pending = TAssignment();
+				if (m_State == REARM_ARMED)
+				{
+					m_State = REARM_RUNNING;
+				}
+				m_Pickups++;
+				return true;
+			}
+
+			// Processing thread: the swap-chain has to be let go of
+			bool ShouldRelease() const
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				return m_State == REARM_RELEASING;
+			}
+
+			// Processing thread: done with the swap-chain from WaitForAssignment()
+			void Released()
+			{
+				{
+					std::lock_guard<std::mutex> lg(m_Lock);
+					m_State = m_ShutdownRequested ? REARM_SHUTDOWN : REARM_IDLE;
+				}
+
+				m_Changed.notify_all();
+			}
+
+			REARM_STATE State() const
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				return m_State;
+			}
+
+			// Swap-chains picked up by the processing thread
+			uint64_t Pickups() const
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				return m_Pickups;
+			}
+
+		private:
+			mutable std::mutex m_Lock;
+			std::condition_variable m_Changed;
+			REARM_STATE m_State = REARM_IDLE;
+			bool m_ShutdownRequested = false;
+			TAssignment m_Pending = TAssignment();
+			uint64_t m_Pickups = 0;
+		};
+	}
+}
@@ -0,0 +1,601 @@
+#include "ToneMap.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+#include <math.h>
+
+#include <sudovda-frame.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define TONEMAP_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define TONEMAP_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// MSVC allows any intrinsic in any function, GCC and Clang need the target spelled out per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TONEMAP_TARGET_SSE41
+#define TONEMAP_TARGET_AVX2
+#else
+#define TONEMAP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TONEMAP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace SUDOVDA;
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			// Maps Pixels pixels of a row to BGRA8, pGain is the table built by ToneMapper::Configure()
+			typedef void (*TONE_MAP_ROW)(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain);
+
+			typedef struct _TONE_MAP_KERNELS {
+				TONE_MAP_ROW ScRgb;
+				TONE_MAP_ROW Hdr10;
+			} TONE_MAP_KERNELS;
+
+			// Linear light is normalised to the 10000 nits PQ peak throughout, scRGB 1.0 is 80 nits
+			const float ScRgbScale = 80.0f / 10000.0f;
+
+			// BT.2020 to BT.709 primaries, both linear
+			const float M00 = 1.660491f, M01 = -0.587641f, M02 = -0.072850f;
+			const float M10 = -0.124550f, M11 = 1.132900f, M12 = -0.008349f;
+			const float M20 = -0.018151f, M21 = -0.100579f, M22 = 1.118730f;
+
+			// Both curves are sampled at every float with an 8-bit mantissa up to 1.0 and indexed with the rounded
+			// upper bits of the float, which keeps the lookups within a fifth of an 8-bit code. The gain table starts
+			// at 2^-20 (0.01 nits), below which the EETF is linear anyway, the sRGB table at 2^-13, which is below
+			// half a code.
+			const uint32_t MantissaBits = 8;
+			const uint32_t IndexShift = 23 - MantissaBits;
+			const int32_t GainIndexBase = (127 - 20) << MantissaBits;
+			const int32_t GainLastIndex = 20 << MantissaBits;
+			const int32_t SrgbIndexBase = (127 - 13) << MantissaBits;
+			const int32_t SrgbLastIndex = 13 << MantissaBits;
+
+			const uint32_t PqCodes = 1024;
+
+			// The float a table entry was sampled at
+			inline double IndexValue(int32_t Index, int32_t Base)
+			{
+				uint32_t Bits = (uint32_t)(Index + Base) << IndexShift;
+				float Value;
+				memcpy(&Value, &Bits, sizeof(Value));
+				return Value;
+			}
+
+			// SMPTE ST 2084, L is normalised to 10000 nits
+			const double m1 = 2610.0 / 16384.0, m2 = 2523.0 / 4096.0 * 128.0;
+			const double c1 = 3424.0 / 4096.0, c2 = 2413.0 / 4096.0 * 32.0, c3 = 2392.0 / 4096.0 * 32.0;
+
+			double PqEncode(double L)
+			{
+				double Lm = pow(L > 0.0 ? L : 0.0, m1);
+				return pow((c1 + c2 * Lm) / (1.0 + c3 * Lm), m2);
+			}
+
+			double PqDecode(double E)
+			{
+				double Ep = pow(E > 0.0 ? E : 0.0, 1.0 / m2);
+				double Num = Ep - c1;
+				return pow((Num > 0.0 ? Num : 0.0) / (c2 - c3 * Ep), 1.0 / m1);
+			}
+
+			struct PqTable
+			{
+				// Linear light of every 10-bit PQ code
+				float Values[PqCodes];
+
+				PqTable()
+				{
+					for (uint32_t i = 0; i < PqCodes; i++)
+					{
+						Values[i] = (float)PqDecode(i / (double)(PqCodes - 1));
+					}
+				}
+			};
+
+			struct SrgbTable
+			{
+				// Three spare entries so a 32-bit gather at the last index stays inside the table
+				uint8_t Values[SrgbLastIndex + 4];
+
+				SrgbTable()
+				{
+					for (int32_t i = 0; i <= SrgbLastIndex; i++)
+					{
+						double L = IndexValue(i, SrgbIndexBase);
+						double V = L <= 0.0031308 ? 12.92 * L : 1.055 * pow(L, 1.0 / 2.4) - 0.055;
+						Values[i] = (uint8_t)(V * 255.0 + 0.5);
+					}
+
+					// Anything below the table maps to the first entry, keep that at true black
+					Values[0] = 0;
+					memset(Values + SrgbLastIndex + 1, Values[SrgbLastIndex], 3);
+				}
+			};
+
+			const float* PqLut()
+			{
+				static const PqTable Table;
+				return Table.Values;
+			}
+
+			const uint8_t* SrgbLut()
+			{
+				static const SrgbTable Table;
+				return Table.Values;
+			}
+
+			// Clamps Value to [0, 1] and returns its table index. NaNs end up at 0.
+			inline int32_t LogIndex(float Value, int32_t Base, int32_t Last)
+			{
+				Value = Value > 0.0f ? (Value < 1.0f ? Value : 1.0f) : 0.0f;
+
+				uint32_t Bits;
+				memcpy(&Bits, &Value, sizeof(Bits));
+				int32_t Index = (int32_t)((Bits + (1u << (IndexShift - 1))) >> IndexShift) - Base;
+				return Index < 0 ? 0 : (Index > Last ? Last : Index);
+			}
+
+			// Exact for finite halves, infinities and NaNs turn into large finite values that clamp to the peak
+			inline float HalfToFloat(uint16_t Half)
+			{
+				uint32_t Bits = (uint32_t)(Half & 0x7fff) << 13;
+				float Value;
+				memcpy(&Value, &Bits, sizeof(Value));
+				Value *= 5.192296858534828e33f; // 2^112 rebiases the exponent
+				memcpy(&Bits, &Value, sizeof(Bits));
+				Bits |= (uint32_t)(Half & 0x8000) << 16;
+				memcpy(&Value, &Bits, sizeof(Value));
+				return Value;
+			}
+
+			// Tone maps one pixel of linear BT.709 light to BGRA8. Levels above the table, which gamut conversion and
+			// scRGB can produce, are all beyond the source peak and land at SDR white, the gain of 1.0 divided by Max.
+			inline void MapPixel(float R, float G, float B, const float* pGain, const uint8_t* pSrgb, uint8_t* pOut)
+			{
+				float Max = R > G ? R : G;
+				Max = Max > B ? Max : B;
+				float Gain = pGain[LogIndex(Max, GainIndexBase, GainLastIndex)] / (Max > 1.0f ? Max : 1.0f);
+
+				pOut[0] = pSrgb[LogIndex(B * Gain, SrgbIndexBase, SrgbLastIndex)];
+				pOut[1] = pSrgb[LogIndex(G * Gain, SrgbIndexBase, SrgbLastIndex)];
+				pOut[2] = pSrgb[LogIndex(R * Gain, SrgbIndexBase, SrgbLastIndex)];
+				pOut[3] = 0xFF;
+			}
+
+#pragma region Scalar
+
+			// Maps pixels [Start, Pixels) of a row, also finishes the SIMD paths' tails
+			void ScRgbRowFrom(uint32_t Start, const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const uint8_t* pSrgb = SrgbLut();
+				for (uint32_t x = Start; x < Pixels; x++)
+				{
+					uint16_t Px[4];
+					memcpy(Px, pSrc + x * 8, sizeof(Px));
+					MapPixel(HalfToFloat(Px[0]) * ScRgbScale, HalfToFloat(Px[1]) * ScRgbScale, HalfToFloat(Px[2]) * ScRgbScale, pGain, pSrgb, pDst + x * 4);
+				}
+			}
+
+			void Hdr10RowFrom(uint32_t Start, const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const float* pPq = PqLut();
+				const uint8_t* pSrgb = SrgbLut();
+				for (uint32_t x = Start; x < Pixels; x++)
+				{
+					uint32_t Px;
+					memcpy(&Px, pSrc + x * 4, sizeof(Px));
+					float r = pPq[Px & 0x3ff], g = pPq[(Px >> 10) & 0x3ff], b = pPq[(Px >> 20) & 0x3ff];
+
+					MapPixel(M00 * r + M01 * g + M02 * b, M10 * r + M11 * g + M12 * b, M20 * r + M21 * g + M22 * b, pGain, pSrgb, pDst + x * 4);
+				}
+			}
+
+			void ScRgbRowScalar(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				ScRgbRowFrom(0, pSrc, pDst, Pixels, pGain);
+			}
+
+			void Hdr10RowScalar(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				Hdr10RowFrom(0, pSrc, pDst, Pixels, pGain);
+			}
+
+			const TONE_MAP_KERNELS ScalarKernels = { ScRgbRowScalar, Hdr10RowScalar };
+
+#pragma endregion
+
+#if TONEMAP_X64
+
+#pragma region SSE41
+
+			TONEMAP_TARGET_SSE41 inline __m128 HalfToFloatSse(__m128i Half)
+			{
+				__m128i Bits = _mm_slli_epi32(_mm_and_si128(Half, _mm_set1_epi32(0x7fff)), 13);
+				__m128 Value = _mm_mul_ps(_mm_castsi128_ps(Bits), _mm_set1_ps(5.192296858534828e33f));
+				__m128i Sign = _mm_slli_epi32(_mm_and_si128(Half, _mm_set1_epi32(0x8000)), 16);
+				return _mm_or_ps(Value, _mm_castsi128_ps(Sign));
+			}
+
+			TONEMAP_TARGET_SSE41 inline __m128i LogIndexSse(__m128 Value, int32_t Base, int32_t Last)
+			{
+				Value = _mm_min_ps(_mm_max_ps(Value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+				__m128i Index = _mm_srli_epi32(_mm_add_epi32(_mm_castps_si128(Value), _mm_set1_epi32(1 << (IndexShift - 1))), IndexShift);
+				Index = _mm_sub_epi32(Index, _mm_set1_epi32(Base));
+				return _mm_min_epi32(_mm_max_epi32(Index, _mm_setzero_si128()), _mm_set1_epi32(Last));
+			}
+
+			TONEMAP_TARGET_SSE41 inline __m128 LookupSse(const float* pTable, __m128i Index)
+			{
+				return _mm_setr_ps(
+					pTable[_mm_extract_epi32(Index, 0)], pTable[_mm_extract_epi32(Index, 1)],
+					pTable[_mm_extract_epi32(Index, 2)], pTable[_mm_extract_epi32(Index, 3)]);
+			}
+
+			TONEMAP_TARGET_SSE41 inline __m128i LookupSse(const uint8_t* pTable, __m128i Index)
+			{
+				return _mm_setr_epi32(
+					pTable[_mm_extract_epi32(Index, 0)], pTable[_mm_extract_epi32(Index, 1)],
+					pTable[_mm_extract_epi32(Index, 2)], pTable[_mm_extract_epi32(Index, 3)]);
+			}
+
+			// Four BGRA8 pixels of linear BT.709 light, one vector per channel
+			TONEMAP_TARGET_SSE41 inline __m128i MapSse(__m128 R, __m128 G, __m128 B, const float* pGain, const uint8_t* pSrgb)
+			{
+				__m128 Max = _mm_max_ps(_mm_max_ps(R, G), B);
+				__m128 Gain = LookupSse(pGain, LogIndexSse(Max, GainIndexBase, GainLastIndex));
+				Gain = _mm_div_ps(Gain, _mm_max_ps(Max, _mm_set1_ps(1.0f)));
+
+				__m128i OutB = LookupSse(pSrgb, LogIndexSse(_mm_mul_ps(B, Gain), SrgbIndexBase, SrgbLastIndex));
+				__m128i OutG = LookupSse(pSrgb, LogIndexSse(_mm_mul_ps(G, Gain), SrgbIndexBase, SrgbLastIndex));
+				__m128i OutR = LookupSse(pSrgb, LogIndexSse(_mm_mul_ps(R, Gain), SrgbIndexBase, SrgbLastIndex));
+
+				__m128i Out = _mm_or_si128(OutB, _mm_slli_epi32(OutG, 8));
+				return _mm_or_si128(Out, _mm_or_si128(_mm_slli_epi32(OutR, 16), _mm_set1_epi32((int)0xFF000000)));
+			}
+
+			TONEMAP_TARGET_SSE41 void ScRgbRowSse41(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const uint8_t* pSrgb = SrgbLut();
+				const __m128 Scale = _mm_set1_ps(ScRgbScale);
+
+				uint32_t x = 0;
+				for (; x + 4 <= Pixels; x += 4)
+				{
+					__m128i Px01 = _mm_loadu_si128((const __m128i*)(pSrc + x * 8));
+					__m128i Px23 = _mm_loadu_si128((const __m128i*)(pSrc + x * 8 + 16));
+
+					__m128 P0 = HalfToFloatSse(_mm_cvtepu16_epi32(Px01));
+					__m128 P1 = HalfToFloatSse(_mm_cvtepu16_epi32(_mm_srli_si128(Px01, 8)));
+					__m128 P2 = HalfToFloatSse(_mm_cvtepu16_epi32(Px23));
+					__m128 P3 = HalfToFloatSse(_mm_cvtepu16_epi32(_mm_srli_si128(Px23, 8)));
+					_MM_TRANSPOSE4_PS(P0, P1, P2, P3);
+
+					__m128i Out = MapSse(_mm_mul_ps(P0, Scale), _mm_mul_ps(P1, Scale), _mm_mul_ps(P2, Scale), pGain, pSrgb);
+					_mm_storeu_si128((__m128i*)(pDst + x * 4), Out);
+				}
+
+				ScRgbRowFrom(x, pSrc, pDst, Pixels, pGain);
+			}
+
+			TONEMAP_TARGET_SSE41 void Hdr10RowSse41(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const float* pPq = PqLut();
+				const uint8_t* pSrgb = SrgbLut();
+				const __m128i Mask = _mm_set1_epi32(0x3ff);
+
+				uint32_t x = 0;
+				for (; x + 4 <= Pixels; x += 4)
+				{
+					__m128i Px = _mm_loadu_si128((const __m128i*)(pSrc + x * 4));
+					__m128 r = LookupSse(pPq, _mm_and_si128(Px, Mask));
+					__m128 g = LookupSse(pPq, _mm_and_si128(_mm_srli_epi32(Px, 10), Mask));
+					__m128 b = LookupSse(pPq, _mm_and_si128(_mm_srli_epi32(Px, 20), Mask));
+
+					__m128 R = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(M00), r), _mm_mul_ps(_mm_set1_ps(M01), g)), _mm_mul_ps(_mm_set1_ps(M02), b));
+					__m128 G = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(M10), r), _mm_mul_ps(_mm_set1_ps(M11), g)), _mm_mul_ps(_mm_set1_ps(M12), b));
+					__m128 B = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(M20), r), _mm_mul_ps(_mm_set1_ps(M21), g)), _mm_mul_ps(_mm_set1_ps(M22), b));
+
+					_mm_storeu_si128((__m128i*)(pDst + x * 4), MapSse(R, G, B, pGain, pSrgb));
+				}
+
+				Hdr10RowFrom(x, pSrc, pDst, Pixels, pGain);
+			}
+
+			const TONE_MAP_KERNELS Sse41Kernels = { ScRgbRowSse41, Hdr10RowSse41 };
+
+#pragma endregion
+
+#pragma region AVX2
+
+			TONEMAP_TARGET_AVX2 inline __m256 HalfToFloatAvx2(__m256i Half)
+			{
+				__m256i Bits = _mm256_slli_epi32(_mm256_and_si256(Half, _mm256_set1_epi32(0x7fff)), 13);
+				__m256 Value = _mm256_mul_ps(_mm256_castsi256_ps(Bits), _mm256_set1_ps(5.192296858534828e33f));
+				__m256i Sign = _mm256_slli_epi32(_mm256_and_si256(Half, _mm256_set1_epi32(0x8000)), 16);
+				return _mm256_or_ps(Value, _mm256_castsi256_ps(Sign));
+			}
+
+			TONEMAP_TARGET_AVX2 inline __m256i LogIndexAvx2(__m256 Value, int32_t Base, int32_t Last)
+			{
+				Value = _mm256_min_ps(_mm256_max_ps(Value, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+				__m256i Index = _mm256_srli_epi32(_mm256_add_epi32(_mm256_castps_si256(Value), _mm256_set1_epi32(1 << (IndexShift - 1))), IndexShift);
+				Index = _mm256_sub_epi32(Index, _mm256_set1_epi32(Base));
+				return _mm256_min_epi32(_mm256_max_epi32(Index, _mm256_setzero_si256()), _mm256_set1_epi32(Last));
+			}
+
+			TONEMAP_TARGET_AVX2 inline __m256i SrgbLookupAvx2(__m256 Value, const uint8_t* pSrgb)
+			{
+				__m256i Bytes = _mm256_i32gather_epi32((const int*)pSrgb, LogIndexAvx2(Value, SrgbIndexBase, SrgbLastIndex), 1);
+				return _mm256_and_si256(Bytes, _mm256_set1_epi32(0xff));
+			}
+
+			// Eight BGRA8 pixels of linear BT.709 light, one vector per channel
+			TONEMAP_TARGET_AVX2 inline __m256i MapAvx2(__m256 R, __m256 G, __m256 B, const float* pGain, const uint8_t* pSrgb)
+			{
+				__m256 Max = _mm256_max_ps(_mm256_max_ps(R, G), B);
+				__m256 Gain = _mm256_i32gather_ps(pGain, LogIndexAvx2(Max, GainIndexBase, GainLastIndex), 4);
+				Gain = _mm256_div_ps(Gain, _mm256_max_ps(Max, _mm256_set1_ps(1.0f)));
+
+				__m256i OutB = SrgbLookupAvx2(_mm256_mul_ps(B, Gain), pSrgb);
+				__m256i OutG = SrgbLookupAvx2(_mm256_mul_ps(G, Gain), pSrgb);
+				__m256i OutR = SrgbLookupAvx2(_mm256_mul_ps(R, Gain), pSrgb);
+
+				__m256i Out = _mm256_or_si256(OutB, _mm256_slli_epi32(OutG, 8));
+				return _mm256_or_si256(Out, _mm256_or_si256(_mm256_slli_epi32(OutR, 16), _mm256_set1_epi32((int)0xFF000000)));
+			}
+
+			TONEMAP_TARGET_AVX2 void ScRgbRowAvx2(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const uint8_t* pSrgb = SrgbLut();
+				const __m256 Scale = _mm256_set1_ps(ScRgbScale);
+				// Gathers the R|G and B|A halves of four pixels into the low and high lane
+				const __m256i Split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+				uint32_t x = 0;
+				for (; x + 8 <= Pixels; x += 8)
+				{
+					__m256i Px03 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(pSrc + x * 8)), Split);
+					__m256i Px47 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(pSrc + x * 8 + 32)), Split);
+					__m256i RG = _mm256_permute2x128_si256(Px03, Px47, 0x20);
+					__m256i BA = _mm256_permute2x128_si256(Px03, Px47, 0x31);
+
+					// The conversion only looks at the low 16 bits
+					__m256 R = _mm256_mul_ps(HalfToFloatAvx2(RG), Scale);
+					__m256 G = _mm256_mul_ps(HalfToFloatAvx2(_mm256_srli_epi32(RG, 16)), Scale);
+					__m256 B = _mm256_mul_ps(HalfToFloatAvx2(BA), Scale);
+
+					_mm256_storeu_si256((__m256i*)(pDst + x * 4), MapAvx2(R, G, B, pGain, pSrgb));
+				}
+
+				ScRgbRowFrom(x, pSrc, pDst, Pixels, pGain);
+			}
+
+			TONEMAP_TARGET_AVX2 void Hdr10RowAvx2(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const float* pPq = PqLut();
+				const uint8_t* pSrgb = SrgbLut();
+				const __m256i Mask = _mm256_set1_epi32(0x3ff);
+
+				uint32_t x = 0;
+				for (; x + 8 <= Pixels; x += 8)
+				{
+					__m256i Px = _mm256_loadu_si256((const __m256i*)(pSrc + x * 4));
+					__m256 r = _mm256_i32gather_ps(pPq, _mm256_and_si256(Px, Mask), 4);
+					__m256 g = _mm256_i32gather_ps(pPq, _mm256_and_si256(_mm256_srli_epi32(Px, 10), Mask), 4);
+					__m256 b = _mm256_i32gather_ps(pPq, _mm256_and_si256(_mm256_srli_epi32(Px, 20), Mask), 4);
+
+					__m256 R = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(M00), r), _mm256_mul_ps(_mm256_set1_ps(M01), g)), _mm256_mul_ps(_mm256_set1_ps(M02), b));
+					__m256 G = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(M10), r), _mm256_mul_ps(_mm256_set1_ps(M11), g)), _mm256_mul_ps(_mm256_set1_ps(M12), b));
+					__m256 B = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(M20), r), _mm256_mul_ps(_mm256_set1_ps(M21), g)), _mm256_mul_ps(_mm256_set1_ps(M22), b));
+
+					_mm256_storeu_si256((__m256i*)(pDst + x * 4), MapAvx2(R, G, B, pGain, pSrgb));
+				}
+
+				Hdr10RowFrom(x, pSrc, pDst, Pixels, pGain);
+			}
+
+			const TONE_MAP_KERNELS Avx2Kernels = { ScRgbRowAvx2, Hdr10RowAvx2 };
+
+#pragma endregion
+
+#endif // TONEMAP_X64
+
+#if TONEMAP_ARM64
+
+#pragma region NEON
+
+			inline float32x4_t HalfToFloatNeon(uint16x4_t Half)
+			{
+				uint32x4_t Wide = vmovl_u16(Half);
+				uint32x4_t Bits = vshlq_n_u32(vandq_u32(Wide, vdupq_n_u32(0x7fff)), 13);
+				float32x4_t Value = vmulq_f32(vreinterpretq_f32_u32(Bits), vdupq_n_f32(5.192296858534828e33f));
+				uint32x4_t Sign = vshlq_n_u32(vandq_u32(Wide, vdupq_n_u32(0x8000)), 16);
+				return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(Value), Sign));
+			}
+
+			inline void LogIndexNeon(float32x4_t Value, int32_t Base, int32_t Last, int32_t (&Lanes)[4])
+			{
+				Value = vminq_f32(vmaxq_f32(Value, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+				int32x4_t Index = vreinterpretq_s32_u32(vshrq_n_u32(vaddq_u32(vreinterpretq_u32_f32(Value), vdupq_n_u32(1 << (IndexShift - 1))), IndexShift));
+				Index = vsubq_s32(Index, vdupq_n_s32(Base));
+				vst1q_s32(Lanes, vminq_s32(vmaxq_s32(Index, vdupq_n_s32(0)), vdupq_n_s32(Last)));
+			}
+
+			inline uint32x4_t SrgbLookupNeon(float32x4_t Value, const uint8_t* pSrgb)
+			{
+				int32_t Lanes[4];
+				LogIndexNeon(Value, SrgbIndexBase, SrgbLastIndex, Lanes);
+
+				uint32_t Bytes[4] = { pSrgb[Lanes[0]], pSrgb[Lanes[1]], pSrgb[Lanes[2]], pSrgb[Lanes[3]] };
+				return vld1q_u32(Bytes);
+			}
+
+			// Four BGRA8 pixels of linear BT.709 light, one vector per channel
+			inline uint32x4_t MapNeon(float32x4_t R, float32x4_t G, float32x4_t B, const float* pGain, const uint8_t* pSrgb)
+			{
+				float32x4_t Max = vmaxq_f32(vmaxq_f32(R, G), B);
+				int32_t Lanes[4];
+				LogIndexNeon(Max, GainIndexBase, GainLastIndex, Lanes);
+				float Gains[4] = { pGain[Lanes[0]], pGain[Lanes[1]], pGain[Lanes[2]], pGain[Lanes[3]] };
+				float32x4_t Gain = vdivq_f32(vld1q_f32(Gains), vmaxq_f32(Max, vdupq_n_f32(1.0f)));
+
+				uint32x4_t OutB = SrgbLookupNeon(vmulq_f32(B, Gain), pSrgb);
+				uint32x4_t OutG = SrgbLookupNeon(vmulq_f32(G, Gain), pSrgb);
+				uint32x4_t OutR = SrgbLookupNeon(vmulq_f32(R, Gain), pSrgb);
+
+				uint32x4_t Out = vorrq_u32(OutB, vshlq_n_u32(OutG, 8));
+				return vorrq_u32(Out, vorrq_u32(vshlq_n_u32(OutR, 16), vdupq_n_u32(0xFF000000)));
+			}
+
+			// Eight pixels at a time, deinterleaved into channel planes
+			void ScRgbRowNeon(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const uint8_t* pSrgb = SrgbLut();
+
+				uint32_t x = 0;
+				for (; x + 8 <= Pixels; x += 8)
+				{
+					uint16x8x4_t Px = vld4q_u16((const uint16_t*)(pSrc + x * 8));
+
+					uint32x4_t Lo = MapNeon(
+						vmulq_n_f32(HalfToFloatNeon(vget_low_u16(Px.val[0])), ScRgbScale),
+						vmulq_n_f32(HalfToFloatNeon(vget_low_u16(Px.val[1])), ScRgbScale),
+						vmulq_n_f32(HalfToFloatNeon(vget_low_u16(Px.val[2])), ScRgbScale), pGain, pSrgb);
+					uint32x4_t Hi = MapNeon(
+						vmulq_n_f32(HalfToFloatNeon(vget_high_u16(Px.val[0])), ScRgbScale),
+						vmulq_n_f32(HalfToFloatNeon(vget_high_u16(Px.val[1])), ScRgbScale),
+						vmulq_n_f32(HalfToFloatNeon(vget_high_u16(Px.val[2])), ScRgbScale), pGain, pSrgb);
+
+					vst1q_u32((uint32_t*)(pDst + x * 4), Lo);
+					vst1q_u32((uint32_t*)(pDst + x * 4 + 16), Hi);
+				}
+
+				ScRgbRowFrom(x, pSrc, pDst, Pixels, pGain);
+			}
+
+			void Hdr10RowNeon(const uint8_t* pSrc, uint8_t* pDst, uint32_t Pixels, const float* pGain)
+			{
+				const float* pPq = PqLut();
+				const uint8_t* pSrgb = SrgbLut();
+
+				uint32_t x = 0;
+				for (; x + 4 <= Pixels; x += 4)
+				{
+					uint32_t Px[4];
+					memcpy(Px, pSrc + x * 4, sizeof(Px));
+
+					float Channels[3][4];
+					for (int i = 0; i < 4; i++)
+					{
+						Channels[0][i] = pPq[Px[i] & 0x3ff];
+						Channels[1][i] = pPq[(Px[i] >> 10) & 0x3ff];
+						Channels[2][i] = pPq[(Px[i] >> 20) & 0x3ff];
+					}
+					float32x4_t r = vld1q_f32(Channels[0]), g = vld1q_f32(Channels[1]), b = vld1q_f32(Channels[2]);
+
+					float32x4_t R = vaddq_f32(vaddq_f32(vmulq_n_f32(r, M00), vmulq_n_f32(g, M01)), vmulq_n_f32(b, M02));
+					float32x4_t G = vaddq_f32(vaddq_f32(vmulq_n_f32(r, M10), vmulq_n_f32(g, M11)), vmulq_n_f32(b, M12));
+					float32x4_t B = vaddq_f32(vaddq_f32(vmulq_n_f32(r, M20), vmulq_n_f32(g, M21)), vmulq_n_f32(b, M22));
+
+					vst1q_u32((uint32_t*)(pDst + x * 4), MapNeon(R, G, B, pGain, pSrgb));
+				}
+
+				Hdr10RowFrom(x, pSrc, pDst, Pixels, pGain);
+			}
+
+			const TONE_MAP_KERNELS NeonKernels = { ScRgbRowNeon, Hdr10RowNeon };
+
+#pragma endregion
+
+#endif // TONEMAP_ARM64
+
+			const TONE_MAP_KERNELS& Kernels()
+			{
+				switch (PixelConvertGetIsa())
+				{
+#if TONEMAP_X64
+				case PIXEL_CONVERT_ISA_SSE41:
+					return Sse41Kernels;
+				case PIXEL_CONVERT_ISA_AVX2:
+					return Avx2Kernels;
+#endif
+#if TONEMAP_ARM64
+				case PIXEL_CONVERT_ISA_NEON:
+					return NeonKernels;
+#endif
+				default:
+					return ScalarKernels;
+				}
+			}
+		}
+
+		ToneMapper::ToneMapper(float SourcePeakNits, float SdrWhiteNits)
+		{
+			Configure(SourcePeakNits, SdrWhiteNits);
+		}
+
+		void ToneMapper::Configure(float SourcePeakNits, float SdrWhiteNits)
+		{
+			m_SourcePeakNits = SourcePeakNits;
+			m_SdrWhiteNits = SdrWhiteNits;
+
+			// BT.2390 EETF with the target black at zero, in PQ values normalised to the source peak. A source no
+			// brighter than SDR white is only clipped.
+			double White = SdrWhiteNits / 10000.0;
+			double PeakE = PqEncode((SourcePeakNits > SdrWhiteNits ? SourcePeakNits : SdrWhiteNits) / 10000.0);
+			double MaxLum = PqEncode(White) / PeakE;
+			double Knee = 1.5 * MaxLum - 0.5;
+			Knee = Knee > 0.0 ? Knee : 0.0;
+
+			m_Gain.resize(GainLastIndex + 1);
+			for (int32_t i = 0; i <= GainLastIndex; i++)
+			{
+				double L = IndexValue(i, GainIndexBase);
+				double E = PqEncode(L) / PeakE;
+				E = E < 1.0 ? E : 1.0;
+
+				if (E > Knee)
+				{
+					double T = (E - Knee) / (1.0 - Knee);
+					double T2 = T * T, T3 = T2 * T;
+					E = (2 * T3 - 3 * T2 + 1) * Knee + (T3 - 2 * T2 + T) * (1.0 - Knee) + (-2 * T3 + 3 * T2) * MaxLum;
+				}
+
+				// Scales every channel of a pixel whose brightest channel is L to linear SDR
+				m_Gain[i] = (float)(PqDecode(E * PeakE) / L / White);
+			}
+		}
+
+		bool ToneMapper::IsSupportedFormat(uint32_t Format)
+		{
+			return Format == SUVDA_FRAME_FORMAT_RGBA16F || Format == SUVDA_FRAME_FORMAT_RGB10A2;
+		}
+
+		void ToneMapper::Map(
+			uint32_t Format, const uint8_t* pSrc, size_t SrcPitch,
+			uint8_t* pDst, size_t DstPitch,
+			uint32_t Left, uint32_t Top, uint32_t Right, uint32_t Bottom) const
+		{
+			const TONE_MAP_KERNELS& Kernel = Kernels();
+			TONE_MAP_ROW Row = Format == SUVDA_FRAME_FORMAT_RGBA16F ? Kernel.ScRgb : Kernel.Hdr10;
+			uint32_t BytesPerPixel = FrameFormatBytesPerPixel(Format);
+
+			for (uint32_t y = Top; y < Bottom; y++)
+			{
+				Row(pSrc + y * SrcPitch + (size_t)Left * BytesPerPixel, pDst + y * DstPitch + (size_t)Left * 4, Right - Left, m_Gain.data());
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// Tone mapping of HDR frames to SDR BGRA8, for consumers that can't show HDR.
+//
+// Two HDR inputs are supported:
+//  * RGBA16F scRGB: linear with BT.709 primaries, 1.0 = 80 nits. Negative values (colors outside BT.709) are clipped.
+//  * RGB10A2 HDR10: SMPTE ST 2084 (PQ) with BT.2020 primaries, what 10-bit advanced color surfaces hold.
+//
+// Every pixel is brought to linear light with BT.709 primaries, through a 1D LUT for the PQ curve and a 3x3 matrix
+// for BT.2020. Its brightest channel is then compressed from the source peak down to SDR white with the EETF of ITU-R
+// BT.2390 (identity up to a knee, a Hermite spline above it, in the PQ domain), and all three channels are scaled by
+// the same gain so hue is kept. The result is encoded with the sRGB curve, alpha is opaque.
+//
+// The gain of the EETF is folded into a 1D LUT indexed by the upper bits of the float, like the PQ table of the P010
+// conversion, and the sRGB curve into another, so the per-pixel work is a max, a few lookups and multiplies. A 3D LUT
+// would fold the matrix in as well, but costs an interpolation per pixel and can't take the unbounded scRGB input.
+//
+// The instruction set follows PixelConvertGetIsa(). The math is in float, so paths may differ by one code value where
+// a sample sits on a rounding boundary.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		// Used when the OS set no HDR10 metadata, or metadata without any luminance
+		const float ToneMapDefaultPeakNits = 1000.0f;
+
+		class ToneMapper
+		{
+		public:
+			ToneMapper(float SourcePeakNits, float SdrWhiteNits);
+
+			// SourcePeakNits is the brightest level kept apart, e.g. the MaxCLL of the HDR10 metadata, and ends up at
+			// SdrWhiteNits, which is encoded as 255. Levels up to the knee below SdrWhiteNits are passed unchanged.
+			void Configure(float SourcePeakNits, float SdrWhiteNits);
+
+			float SourcePeakNits() const
+			{
+				return m_SourcePeakNits;
+			}
+
+			float SdrWhiteNits() const
+			{
+				return m_SdrWhiteNits;
+			}
+
+			// SUVDA_FRAME_FORMAT_RGBA16F or SUVDA_FRAME_FORMAT_RGB10A2
+			static bool IsSupportedFormat(uint32_t Format);
+
+			// Writes the pixels [Left, Right) x [Top, Bottom) of a frame in Format to the same pixels of a BGRA8 frame.
+			// pSrc and pDst point at the top left of the frames, pitches are in bytes.
+			void Map(
+				uint32_t Format, const uint8_t* pSrc, size_t SrcPitch,
+				uint8_t* pDst, size_t DstPitch,
+				uint32_t Left, uint32_t Top, uint32_t Right, uint32_t Bottom) const;
+
+		private:
+			float m_SourcePeakNits = 0.0f;
+			float m_SdrWhiteNits = 0.0f;
+			// Gain from linear light (1.0 = 10000 nits) to linear SDR (1.0 = SDR white), by brightest channel
+			std::vector<float> m_Gain;
+		};
+	}
+}
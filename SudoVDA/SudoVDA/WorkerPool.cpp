@@ -0,0 +1,253 @@
+#include "WorkerPool.h"
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		namespace
+		{
+			// Pool and index of the worker running on this thread, used to keep submissions local
+			thread_local const WorkerPool* CurrentPool = nullptr;
+			thread_local uint32_t CurrentWorker = 0;
+		}
+
+		WorkerPool::WorkerPool(uint32_t ThreadCount, std::function<void(uint32_t)> OnThreadStart)
+		{
+			if (!ThreadCount)
+			{
+				ThreadCount = std::thread::hardware_concurrency();
+				if (!ThreadCount)
+				{
+					ThreadCount = 1;
+				}
+			}
+
+			m_Workers.reserve(ThreadCount);
+			for (uint32_t i = 0; i < ThreadCount; i++)
+			{
+				m_Workers.emplace_back(new Worker());
+			}
+
+			// Every deque exists before the first worker may try to steal from it
+			for (uint32_t i = 0; i < ThreadCount; i++)
+			{
+				m_Workers[i]->Thread = std::thread(&WorkerPool::Run, this, i, OnThreadStart);
+			}
+		}
+
+		WorkerPool::~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lg(m_SleepLock);
+				m_Stopping = true;
+			}
+			m_Wake.notify_all();
+
+			for (auto& pWorker : m_Workers)
+			{
+				pWorker->Thread.join();
+			}
+		}
+
+		void WorkerPool::Submit(Job Task)
+		{
+			uint32_t Index = CurrentPool == this ? CurrentWorker : m_NextWorker.fetch_add(1, std::memory_order_relaxed) % ThreadCount();
+
+			{
+				auto& Target = *m_Workers[Index];
+				std::lock_guard<std::mutex> lg(Target.Lock);
+				Target.Jobs.push_back(std::move(Task));
+			}
+			m_Queued.fetch_add(1, std::memory_order_release);
+
+			// Taking the lock orders this against a worker that just found nothing queued and is about to sleep
+			{
+				std::lock_guard<std::mutex> lg(m_SleepLock);
+			}
+			m_Wake.notify_one();
+		}
+
+		void WorkerPool::ParallelFor(uint32_t Count, const std::function<void(uint32_t)>& Body)
+		{
+			struct Shared
+			{
+				std::atomic<uint32_t> Next{0};
+				std::atomic<uint32_t> Done{0};
+				uint32_t Count = 0;
+				const std::function<void(uint32_t)>* pBody = nullptr;
+
+				void Work()
+				{
+					for (uint32_t i; (i = Next.fetch_add(1, std::memory_order_relaxed)) < Count;)
+					{
+						(*pBody)(i);
+						Done.fetch_add(1, std::memory_order_release);
+					}
+				}
+			};
+
+			if (Count <= 1)
+			{
+				if (Count)
+				{
+					Body(0);
+				}
+				return;
+			}
+
+			// Helpers that only start after all the work was claimed return without touching Body
+			auto State = std::make_shared<Shared>();
+			State->Count = Count;
+			State->pBody = &Body;
+
+			uint32_t Helpers = (Count < ThreadCount() ? Count : ThreadCount()) - 1;
+			for (uint32_t i = 0; i < Helpers; i++)
+			{
+				Submit([State] { State->Work(); });
+			}
+
+			State->Work();
+
+			// The remaining items are running on other workers, they are short enough not to be worth a sleep
+			while (State->Done.load(std::memory_order_acquire) < Count)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		WORKER_POOL_STATS WorkerPool::Stats() const
+		{
+			WORKER_POOL_STATS Stats;
+			Stats.Executed = m_Executed.load(std::memory_order_relaxed);
+			Stats.Stolen = m_Stolen.load(std::memory_order_relaxed);
+			return Stats;
+		}
+
+		bool WorkerPool::TryRunOne(uint32_t Index)
+		{
+			Job Task;
+			bool Stolen = false;
+
+			{
+				auto& Own = *m_Workers[Index];
+				std::lock_guard<std::mutex> lg(Own.Lock);
+				if (!Own.Jobs.empty())
+				{
+					Task = std::move(Own.Jobs.back());
+					Own.Jobs.pop_back();
+				}
+			}
+
+			for (uint32_t i = 1; !Task && i < ThreadCount(); i++)
+			{
+				auto& Victim = *m_Workers[(Index + i) % ThreadCount()];
+				std::lock_guard<std::mutex> lg(Victim.Lock);
+				if (!Victim.Jobs.empty())
+				{
+					// The oldest job is the one its owner is least likely to have in cache
+					Task = std::move(Victim.Jobs.front());
+					Victim.Jobs.pop_front();
+					Stolen = true;
+				}
+			}
+
+			if (!Task)
+			{
+				return false;
+			}
+
+			m_Queued.fetch_sub(1, std::memory_order_relaxed);
+			Task();
+
+			m_Executed.fetch_add(1, std::memory_order_relaxed);
+			if (Stolen)
+			{
+				m_Stolen.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			return true;
+		}
+
+		void WorkerPool::Run(uint32_t Index, const std::function<void(uint32_t)>& OnThreadStart)
+		{
+			CurrentPool = this;
+			CurrentWorker = Index;
+
+			if (OnThreadStart)
+			{
+				OnThreadStart(Index);
+			}
+
+			for (;;)
+			{
+				if (TryRunOne(Index))
+				{
+					continue;
+				}
+
+				std::unique_lock<std::mutex> ul(m_SleepLock);
+				if (m_Queued.load(std::memory_order_acquire))
+				{
+					// A job was queued after the scan, or is being taken by another worker right now
+					ul.unlock();
+					std::this_thread::yield();
+					continue;
+				}
+
+				if (m_Stopping)
+				{
+					return;
+				}
+
+				m_Wake.wait(ul);
+			}
+		}
+
+		void WorkerStrand::Post(WorkerPool::Job Task)
+		{
+			bool Schedule;
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				m_Jobs.push_back(std::move(Task));
+				Schedule = !m_Scheduled;
+				m_Scheduled = true;
+			}
+
+			if (Schedule)
+			{
+				m_Pool.Submit([this] { Drain(); });
+			}
+		}
+
+		void WorkerStrand::WaitIdle()
+		{
+			std::unique_lock<std::mutex> ul(m_Lock);
+			m_Idle.wait(ul, [this] { return !m_Scheduled; });
+		}
+
+		void WorkerStrand::Drain()
+		{
+			for (uint32_t i = 0; i < MaxBatch; i++)
+			{
+				WorkerPool::Job Task;
+				{
+					std::lock_guard<std::mutex> lg(m_Lock);
+					if (m_Jobs.empty())
+					{
+						m_Scheduled = false;
+						m_Idle.notify_all();
+						return;
+					}
+
+					Task = std::move(m_Jobs.front());
+					m_Jobs.pop_front();
+				}
+
+				Task();
+			}
+
+			// Let other strands on this worker run before continuing, the strand stays scheduled so order is kept
+			m_Pool.Submit([this] { Drain(); });
+		}
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+// Fixed-size work-stealing thread pool shared by all monitors.
+//
+// Every worker owns a deque. Jobs submitted from a worker go to the back of its own deque and are popped from there
+// again, so follow-up work stays on a warm cache. Jobs submitted from other threads are spread round-robin. An idle
+// worker steals from the front of the other workers' deques before going to sleep, which keeps all cores busy when a
+// few monitors produce most of the frames.
+//
+// The pool runs jobs in no particular order. WorkerStrand layers FIFO, one-at-a-time execution on top of it, which is
+// what a swap-chain needs: its frames are processed in order and never concurrently, while different monitors spread
+// over all workers. ParallelFor splits a single job, e.g. hashing or converting a frame, across idle workers.
+//
+// The pool only uses the standard library, so it runs unchanged in the driver and in the scaling harnesses.
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Microsoft
+{
+	namespace IndirectDisp
+	{
+		typedef struct _WORKER_POOL_STATS {
+			uint64_t Executed;
+			uint64_t Stolen;  // Jobs run by a worker other than the one they were queued on
+		} WORKER_POOL_STATS;
+
+		class WorkerPool
+		{
+		public:
+			typedef std::function<void()> Job;
+
+			// ThreadCount 0 uses one worker per hardware thread. OnThreadStart runs first on every worker, e.g. to
+			// register it with a scheduler service.
+			explicit WorkerPool(uint32_t ThreadCount = 0, std::function<void(uint32_t)> OnThreadStart = nullptr);
+			// Runs every job still queued, then joins the workers
+			~WorkerPool();
+
+			WorkerPool(const WorkerPool&) = delete;
+			WorkerPool& operator=(const WorkerPool&) = delete;
+
+			uint32_t ThreadCount() const
+			{
+				return (uint32_t)m_Workers.size();
+			}
+
+			void Submit(Job Task);
+
+			// Calls Body(i) for every i below Count, spread over the calling thread and idle workers. Returns once
+			// every call has finished. Safe to call from inside a job.
+			void ParallelFor(uint32_t Count, const std::function<void(uint32_t)>& Body);
+
+			WORKER_POOL_STATS Stats() const;
+
+		private:
+			struct Worker
+			{
+				std::mutex Lock;
+				std::deque<Job> Jobs;
+				std::thread Thread;
+			};
+
+			void Run(uint32_t Index, const std::function<void(uint32_t)>& OnThreadStart);
+			bool TryRunOne(uint32_t Index);
+
+			std::vector<std::unique_ptr<Worker>> m_Workers;
+			std::atomic<uint32_t> m_NextWorker{0};
+			std::atomic<uint64_t> m_Queued{0};
+
+			std::mutex m_SleepLock;
+			std::condition_variable m_Wake;
+			bool m_Stopping = false;
+
+			std::atomic<uint64_t> m_Executed{0};
+			std::atomic<uint64_t> m_Stolen{0};
+		};
+
+		/// <summary>
+		/// Runs the jobs posted to it one at a time and in order on a WorkerPool.
+		/// </summary>
+		class WorkerStrand
+		{
+		public:
+			// Jobs run back to back before the strand yields its worker to other strands
+			static const uint32_t MaxBatch = 8;
+
+			explicit WorkerStrand(WorkerPool& Pool) : m_Pool(Pool)
+			{
+			}
+
+			~WorkerStrand()
+			{
+				WaitIdle();
+			}
+
+			WorkerStrand(const WorkerStrand&) = delete;
+			WorkerStrand& operator=(const WorkerStrand&) = delete;
+
+			void Post(WorkerPool::Job Task);
+
+			// Blocks until every job posted so far has run. Must not be called from a job of this strand.
+			void WaitIdle();
+
+		private:
+			void Drain();
+
+			WorkerPool& m_Pool;
+			std::mutex m_Lock;
+			std::condition_variable m_Idle;
+			std::deque<WorkerPool::Job> m_Jobs;
+			bool m_Scheduled = false;
+		};
+	}
+}
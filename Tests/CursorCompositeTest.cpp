@@ -0,0 +1,206 @@
+// Cursor compositing: shape decoding, hand-checked alpha, masked color and XOR pixels, every instruction set against
+// a reference computed from the raw shape, and the coverage rectangle of cursors partly or fully off screen.
+
+#include "TestHarness.h"
+#include "CursorComposite.h"
+#include "PixelConvert.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+
+namespace
+{
+	uint8_t Round(double Value)
+	{
+		return (uint8_t)floor(Value + 0.5);
+	}
+
+	// Applies a raw shape in floating point, without going through DecodeCursorShape()
+	void Reference(uint8_t* pFrame, size_t Pitch, uint32_t Width, uint32_t Height, uint32_t Type,
+		const uint8_t* pShape, uint32_t ShapePitch, uint32_t ShapeWidth, uint32_t ShapeHeight, int32_t X, int32_t Y)
+	{
+		for (uint32_t j = 0; j < ShapeHeight; j++)
+		{
+			for (uint32_t i = 0; i < ShapeWidth; i++)
+			{
+				int32_t Column = X + (int32_t)i;
+				int32_t Row = Y + (int32_t)j;
+				if (Column < 0 || Row < 0 || Column >= (int32_t)Width || Row >= (int32_t)Height)
+				{
+					continue;
+				}
+
+				uint8_t* pPixel = pFrame + Row * Pitch + Column * 4;
+				const uint8_t* pIn = pShape + j * ShapePitch + i * 4;
+				for (uint32_t c = 0; c < 3; c++)
+				{
+					int Value;
+					if (Type == SUVDA_CURSOR_SHAPE_ALPHA)
+					{
+						Value = Round(pIn[c] * pIn[3] / 255.0) + Round(pPixel[c] * (255 - pIn[3]) / 255.0);
+						Value = Value > 255 ? 255 : Value;
+					}
+					else
+					{
+						Value = pIn[3] == 0xFF ? pPixel[c] ^ pIn[c] : pIn[c];
+					}
+					pPixel[c] = (uint8_t)Value;
+				}
+			}
+		}
+	}
+
+	void TestDiv255()
+	{
+		bool Exact = true;
+		for (uint32_t a = 0; a < 256; a++)
+		{
+			for (uint32_t b = 0; b < 256; b++)
+			{
+				Exact &= CursorDiv255(a * b) == Round(a * b / 255.0);
+			}
+		}
+		CHECK(Exact);
+	}
+
+	void TestShapes()
+	{
+		static SUVDA_CURSOR_IMAGE Image;
+
+		// Half transparent white, then a fully transparent pixel
+		uint8_t Alpha[] = { 255, 255, 255, 128,   0x40, 0x40, 0x40, 0 };
+		CHECK(DecodeCursorShape(SUVDA_CURSOR_SHAPE_ALPHA, Alpha, 8, 2, 1, Image));
+		CHECK(!Image.HasXor);
+		uint8_t Frame[] = { 0, 0, 0, 7,   255, 255, 255, 9,   10, 20, 30, 40 };
+		CompositeCursor(Frame, 12, 3, 1, Image, 0, 0);
+		CHECK(Frame[0] == 128 && Frame[1] == 128 && Frame[2] == 128);
+		CHECK_EQ(Frame[3], 7);
+		CHECK(Frame[4] == 255 && Frame[7] == 9);
+		CHECK(Frame[8] == 10 && Frame[9] == 20 && Frame[10] == 30);
+
+		// Only the transparent pixel lands on a one pixel frame
+		uint8_t Single[] = { 0x80, 0x80, 0x80, 1 };
+		CompositeCursor(Single, 4, 1, 1, Image, -1, 0);
+		CHECK_EQ(Single[0], 0x80);
+
+		// White, an inverting pixel, and a transparent one
+		uint8_t Masked[] = { 0xFF, 0xFF, 0xFF, 0,   0xFF, 0xFF, 0xFF, 0xFF,   0, 0, 0, 0xFF };
+		CHECK(DecodeCursorShape(SUVDA_CURSOR_SHAPE_MASKED_COLOR, Masked, 12, 3, 1, Image));
+		CHECK(Image.HasXor);
+		uint8_t Screen[] = { 0x40, 0x10, 0x20, 3,   0x40, 0x10, 0x20, 3,   0x40, 0x10, 0x20, 3 };
+		CompositeCursor(Screen, 12, 3, 1, Image, 0, 0);
+		CHECK(Screen[0] == 0xFF && Screen[1] == 0xFF && Screen[2] == 0xFF && Screen[3] == 3);
+		CHECK(Screen[4] == 0xBF && Screen[5] == 0xEF && Screen[6] == 0xDF && Screen[7] == 3);
+		CHECK(Screen[8] == 0x40 && Screen[9] == 0x10 && Screen[10] == 0x20);
+
+		// Black XOR pixels alone don't need the XOR plane
+		uint8_t Transparent[] = { 0, 0, 0, 0xFF };
+		CHECK(DecodeCursorShape(SUVDA_CURSOR_SHAPE_MASKED_COLOR, Transparent, 4, 1, 1, Image));
+		CHECK(!Image.HasXor);
+
+		// Unknown types, oversized shapes and short pitches
+		CHECK(!DecodeCursorShape(SUVDA_CURSOR_SHAPE_NONE, Masked, 12, 3, 1, Image));
+		CHECK(!DecodeCursorShape(3, Masked, 12, 3, 1, Image));
+		CHECK(!DecodeCursorShape(SUVDA_CURSOR_SHAPE_ALPHA, Masked, 12, SUVDA_CURSOR_MAX_SIZE + 1, 1, Image));
+		CHECK(!DecodeCursorShape(SUVDA_CURSOR_SHAPE_ALPHA, Masked, 8, 3, 1, Image));
+		CHECK(!DecodeCursorShape(SUVDA_CURSOR_SHAPE_ALPHA, Masked, 12, 0, 1, Image));
+	}
+
+	// Random shapes at random positions, many of them clipped, on every instruction set
+	void TestAgainstReference()
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON };
+		const char* Names[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+		static SUVDA_CURSOR_IMAGE Image;
+
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertSetIsa(Isa))
+			{
+				printf("%s not supported, skipped\n", Names[Isa]);
+				continue;
+			}
+
+			std::mt19937 Random(1);
+			bool Matches = true;
+			bool Covered = true;
+			for (int Run = 0; Run < 3000; Run++)
+			{
+				uint32_t Type = Random() % 2 ? SUVDA_CURSOR_SHAPE_ALPHA : SUVDA_CURSOR_SHAPE_MASKED_COLOR;
+				uint32_t ShapeWidth = 1 + Random() % SUVDA_CURSOR_MAX_SIZE;
+				uint32_t ShapeHeight = 1 + Random() % SUVDA_CURSOR_MAX_SIZE;
+				uint32_t ShapePitch = ShapeWidth * 4 + (Random() % 3) * 4;
+				std::vector<uint8_t> Shape(ShapePitch * ShapeHeight);
+				for (auto& Value : Shape)
+				{
+					Value = (uint8_t)Random();
+				}
+
+				// Masks are 0x00 or 0xFF, and alpha shapes get plenty of fully opaque and transparent pixels
+				for (uint32_t j = 0; j < ShapeHeight; j++)
+				{
+					for (uint32_t i = 0; i < ShapeWidth; i++)
+					{
+						uint8_t& A = Shape[j * ShapePitch + i * 4 + 3];
+						if (Type == SUVDA_CURSOR_SHAPE_MASKED_COLOR || Random() % 2)
+						{
+							A = Random() % 2 ? 0xFF : 0;
+						}
+					}
+				}
+				CHECK(DecodeCursorShape(Type, Shape.data(), ShapePitch, ShapeWidth, ShapeHeight, Image));
+
+				uint32_t Width = 1 + Random() % 150;
+				uint32_t Height = 1 + Random() % 150;
+				size_t Pitch = Width * 4 + (Random() % 2) * 16;
+				std::vector<uint8_t> Frame(Pitch * Height);
+				for (auto& Value : Frame)
+				{
+					Value = (uint8_t)Random();
+				}
+				std::vector<uint8_t> Expected = Frame;
+
+				int32_t X = (int32_t)(Random() % (Width + 80)) - 64;
+				int32_t Y = (int32_t)(Random() % (Height + 80)) - 64;
+				CompositeCursor(Frame.data(), Pitch, Width, Height, Image, X, Y);
+				Reference(Expected.data(), Pitch, Width, Height, Type, Shape.data(), ShapePitch, ShapeWidth, ShapeHeight, X, Y);
+				Matches &= Frame == Expected;
+
+				// The coverage is the intersection of the cursor and the frame
+				SUVDA_FRAME_RECT Rect;
+				bool Visible = X < (int32_t)Width && Y < (int32_t)Height && X + (int32_t)ShapeWidth > 0 && Y + (int32_t)ShapeHeight > 0;
+				bool Any = CursorCoverage(Width, Height, Image, X, Y, Rect);
+				Covered &= Any == Visible;
+				if (Any)
+				{
+					Covered &= Rect.Left == std::max(X, 0) && Rect.Top == std::max(Y, 0);
+					Covered &= Rect.Right == std::min((int32_t)Width, X + (int32_t)ShapeWidth);
+					Covered &= Rect.Bottom == std::min((int32_t)Height, Y + (int32_t)ShapeHeight);
+				}
+			}
+
+			if (!Matches)
+			{
+				fprintf(stderr, "%s differs from the reference\n", Names[Isa]);
+			}
+			CHECK(Matches);
+			CHECK(Covered);
+		}
+
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	}
+}
+
+int main()
+{
+	TestDiv255();
+	TestShapes();
+	TestAgainstReference();
+	return TEST_RESULT();
+}
@@ -0,0 +1,212 @@
+// Cursor plane: header validation, publishing with and without a new shape, and a writer racing readers that must
+// never see a torn state or a shape that doesn't belong to the state's shape id.
+
+#include "TestHarness.h"
+#include <sudovda-cursor.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace SUDOVDA;
+
+namespace
+{
+	// The shape bytes of a shape id, so readers can tell which shape they got
+	void FillShape(uint8_t* pShape, uint32_t Size, uint32_t ShapeId)
+	{
+		for (uint32_t i = 0; i < Size; i++)
+		{
+			pShape[i] = (uint8_t)(ShapeId * 31 + i);
+		}
+	}
+
+	bool ShapeMatches(const uint8_t* pShape, uint32_t Size, uint32_t ShapeId)
+	{
+		for (uint32_t i = 0; i < Size; i++)
+		{
+			if (pShape[i] != (uint8_t)(ShapeId * 31 + i))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	SUVDA_CURSOR_STATE MakeState(uint32_t ShapeId, int32_t X)
+	{
+		SUVDA_CURSOR_STATE State = {};
+		State.Visible = 1;
+		State.X = X;
+		State.Y = -X;
+		State.ShapeId = ShapeId;
+		State.ShapeType = SUVDA_CURSOR_SHAPE_ALPHA;
+		State.Width = 32;
+		State.Height = 32;
+		State.Pitch = 128;
+		State.ShapeSize = 32 * 128;
+		return State;
+	}
+
+	void TestAttach()
+	{
+		auto pPlane = std::make_unique<SUVDA_CURSOR_PLANE>();
+		CursorPlaneWriter Writer;
+		CursorPlaneReader Reader;
+		CHECK(!Writer.Initialize(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE) - 1));
+		CHECK(!Writer.IsInitialized());
+		CHECK(!Reader.Attach(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+
+		CHECK(Writer.Initialize(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+		CHECK(Writer.IsInitialized());
+		CHECK(!Reader.Attach(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE) - 1));
+		CHECK(Reader.Attach(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+		CHECK(!Reader.HasUpdate());
+
+		// A plane of another version is refused
+		pPlane->Version++;
+		CHECK(!Reader.Attach(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+	}
+
+	void TestPublish()
+	{
+		auto pPlane = std::make_unique<SUVDA_CURSOR_PLANE>();
+		CursorPlaneWriter Writer;
+		CursorPlaneReader Reader;
+		CHECK(Writer.Initialize(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+		CHECK(Reader.Attach(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+
+		std::vector<uint8_t> Shape(sizeof(pPlane->Shape));
+		std::vector<uint8_t> Copy(sizeof(pPlane->Shape));
+		SUVDA_CURSOR_STATE State = MakeState(1, 10);
+		FillShape(Shape.data(), State.ShapeSize, 1);
+		Writer.Publish(State, Shape.data());
+		CHECK(Reader.HasUpdate());
+
+		SUVDA_CURSOR_STATE Read;
+		bool ShapeCopied = false;
+		CHECK(Reader.Read(0, Read, Copy.data(), ShapeCopied));
+		CHECK(ShapeCopied);
+		CHECK_EQ(Read.UpdateCount, 1u);
+		CHECK_EQ(Read.X, 10);
+		CHECK(ShapeMatches(Copy.data(), Read.ShapeSize, 1));
+		CHECK(!Reader.HasUpdate());
+
+		// A move keeps the shape and its size, and a reader that has the shape doesn't copy it again
+		State.X = 20;
+		State.ShapeSize = 0;
+		Writer.Publish(State, nullptr);
+		CHECK(Reader.Read(1, Read, Copy.data(), ShapeCopied));
+		CHECK(!ShapeCopied);
+		CHECK_EQ(Read.UpdateCount, 2u);
+		CHECK_EQ(Read.X, 20);
+		CHECK_EQ(Read.ShapeSize, 32u * 128);
+		CHECK(ShapeMatches(pPlane->Shape, Read.ShapeSize, 1));
+
+		// Oversized shapes are cut to the plane
+		State = MakeState(2, 0);
+		State.ShapeSize = (uint32_t)sizeof(pPlane->Shape) + 100;
+		Shape.resize(State.ShapeSize);
+		FillShape(Shape.data(), State.ShapeSize, 2);
+		Writer.Publish(State, Shape.data());
+		CHECK(Reader.Read(1, Read, Copy.data(), ShapeCopied));
+		CHECK(ShapeCopied);
+		CHECK_EQ(Read.ShapeSize, (uint32_t)sizeof(pPlane->Shape));
+		CHECK(ShapeMatches(Copy.data(), Read.ShapeSize, 2));
+
+		// A plane left mid-update makes readers give up after their attempts
+		pPlane->Sequence.fetch_add(1);
+		CHECK(Reader.HasUpdate());
+		CHECK(!Reader.Read(0, Read, Copy.data(), ShapeCopied, 10));
+		CHECK(!ShapeCopied);
+		CHECK_EQ(Reader.Retries(), 10u);
+	}
+
+	// One writer moving the cursor and changing its shape against two readers polling it
+	void TestConcurrentReaders()
+	{
+		constexpr uint32_t Updates = 200000;
+		auto pPlane = std::make_unique<SUVDA_CURSOR_PLANE>();
+		CursorPlaneWriter Writer;
+		CHECK(Writer.Initialize(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)));
+
+		std::atomic<bool> Done{ false };
+		std::atomic<uint32_t> Torn{ 0 };
+		std::atomic<uint32_t> Snapshots{ 0 };
+		auto Poll = [&] {
+			CursorPlaneReader Reader;
+			if (!Reader.Attach(pPlane.get(), sizeof(SUVDA_CURSOR_PLANE)))
+			{
+				Torn++;
+				return;
+			}
+
+			std::vector<uint8_t> Shape(sizeof(pPlane->Shape));
+			uint32_t ShapeId = 0;
+			uint64_t LastCount = 0;
+			while (!Done.load(std::memory_order_relaxed))
+			{
+				SUVDA_CURSOR_STATE State;
+				bool ShapeCopied;
+				if (!Reader.HasUpdate() || !Reader.Read(ShapeId, State, Shape.data(), ShapeCopied))
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				// X and Y are written together, the update count only grows, and the shape is that of the id
+				bool Consistent = State.Y == -State.X && State.UpdateCount >= LastCount && State.ShapeId == (uint32_t)State.X / 64 + 1;
+				if (ShapeCopied)
+				{
+					ShapeId = State.ShapeId;
+					Consistent &= ShapeMatches(Shape.data(), State.ShapeSize, ShapeId);
+				}
+				Consistent &= ShapeId == State.ShapeId;
+				if (!Consistent)
+				{
+					Torn++;
+				}
+				LastCount = State.UpdateCount;
+				Snapshots++;
+			}
+		};
+
+		std::thread First(Poll);
+		std::thread Second(Poll);
+		std::vector<uint8_t> Shape(sizeof(pPlane->Shape));
+		for (uint32_t i = 0; i < Updates; i++)
+		{
+			// A new shape every 64 moves
+			uint32_t ShapeId = i / 64 + 1;
+			SUVDA_CURSOR_STATE State = MakeState(ShapeId, (int32_t)i);
+			bool NewShape = i % 64 == 0;
+			if (NewShape)
+			{
+				FillShape(Shape.data(), State.ShapeSize, ShapeId);
+			}
+			Writer.Publish(State, NewShape ? Shape.data() : nullptr);
+
+			if (i % 16 == 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+		Done = true;
+		First.join();
+		Second.join();
+
+		CHECK_EQ(pPlane->State.UpdateCount, Updates);
+		CHECK_EQ(pPlane->Sequence.load(), 2ull * Updates);
+		CHECK_EQ(Torn.load(), 0u);
+		CHECK(Snapshots.load() > 0);
+	}
+}
+
+int main()
+{
+	TestAttach();
+	TestPublish();
+	TestConcurrentReaders();
+	return TEST_RESULT();
+}
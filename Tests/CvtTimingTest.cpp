@@ -0,0 +1,135 @@
+// CVT reduced blanking v2: reference timings from the VESA CVT 1.2 spreadsheet, the video optimized N/1.001 Hz
+// variant, the minimum blank at the extremes, and random modes against the spreadsheet's floating-point formulas.
+
+#include "TestHarness.h"
+#include "CvtTiming.h"
+
+#include <math.h>
+
+#include <random>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	// The spreadsheet's own examples, worked out at compile time
+	constexpr CVT_TIMING Cvt1080p60 = MakeCvtRbV2Timing(1920, 1080, 60, 1);
+	static_assert(Cvt1080p60.HTotal == 2000 && Cvt1080p60.VTotal == 1111, "1920x1080 at 60 Hz totals");
+	static_assert(Cvt1080p60.PixelClockKhz == 133320, "1920x1080 at 60 Hz clock");
+	static_assert(!Cvt1080p60.VideoOptimized, "1920x1080 at 60 Hz");
+
+	constexpr CVT_TIMING Cvt2160p60 = MakeCvtRbV2Timing(3840, 2160, 60, 1);
+	static_assert(Cvt2160p60.HTotal == 3920 && Cvt2160p60.VTotal == 2222, "3840x2160 at 60 Hz totals");
+	static_assert(Cvt2160p60.PixelClockKhz == 522614, "3840x2160 at 60 Hz clock");
+
+	// 59.94 Hz has the blank of 60 Hz and the clock scaled by 1000/1001
+	constexpr CVT_TIMING Cvt1080p5994 = MakeCvtRbV2Timing(1920, 1080, 60000, 1001);
+	static_assert(Cvt1080p5994.VideoOptimized, "1920x1080 at 59.94 Hz");
+	static_assert(Cvt1080p5994.HTotal == 2000 && Cvt1080p5994.VTotal == 1111, "1920x1080 at 59.94 Hz totals");
+	static_assert(Cvt1080p5994.PixelClockKhz == 133186, "1920x1080 at 59.94 Hz clock");
+
+	void TestReferenceTimings()
+	{
+		const struct {
+			uint32_t Width;
+			uint32_t Height;
+			uint32_t Rate;
+			uint32_t HTotal;
+			uint32_t VTotal;
+			uint32_t VFrontPorch;
+			uint64_t PixelClockKhz;
+		} Modes[] = {
+			{ 1920, 1080, 60, 2000, 1111, 17, 133320 },
+			{ 2560, 1440, 60, 2640, 1481, 27, 234590 },
+			{ 3840, 2160, 60, 3920, 2222, 48, 522614 },
+			{ 3840, 2160, 120, 3920, 2287, 113, 1075804 },
+			{ 1920, 1080, 144, 2000, 1157, 63, 333216 },
+		};
+		for (const auto& Mode : Modes)
+		{
+			CVT_TIMING Timing = MakeCvtRbV2Timing(Mode.Width, Mode.Height, Mode.Rate, 1);
+			CHECK_EQ(Timing.HTotal, Mode.HTotal);
+			CHECK_EQ(Timing.VTotal, Mode.VTotal);
+			CHECK_EQ(Timing.VFrontPorch, Mode.VFrontPorch);
+			CHECK_EQ(Timing.PixelClockKhz, Mode.PixelClockKhz);
+			CHECK(Timing.HFrontPorch == 8 && Timing.HSync == 32 && Timing.HBackPorch == 40);
+			CHECK(Timing.VSync == 8 && Timing.VBackPorch == 6);
+			CHECK(!Timing.VideoOptimized);
+
+			// The video optimized rate keeps the totals, the clock is that of N Hz times 1000/1001, floored
+			CVT_TIMING Video = MakeCvtRbV2Timing(Mode.Width, Mode.Height, Mode.Rate * 1000, 1001);
+			uint64_t Pixels = (uint64_t)Timing.HTotal * Timing.VTotal * Mode.Rate * 1000;
+			CHECK(Video.VideoOptimized);
+			CHECK(Video.HTotal == Timing.HTotal && Video.VTotal == Timing.VTotal);
+			CHECK_EQ(Video.PixelClockKhz, Pixels / 1001 / 1000);
+		}
+	}
+
+	void TestExtremes()
+	{
+		// Whole rates given as a fraction are not video optimized
+		CHECK(!MakeCvtRbV2Timing(1920, 1080, 60000, 1000).VideoOptimized);
+		CHECK_EQ(MakeCvtRbV2Timing(1920, 1080, 60000, 1000).PixelClockKhz, 133320u);
+		CHECK(!MakeCvtRbV2Timing(1920, 1080, 1001000, 1001).VideoOptimized);
+
+		// No rate, or one leaving no time to scan the lines, gets the minimum blank of 15 lines
+		const uint64_t Rates[][2] = { { 0, 1 }, { 60, 0 }, { 2174, 1 }, { 1000000, 1 }, { UINT32_MAX, 1 } };
+		for (const auto& Rate : Rates)
+		{
+			CVT_TIMING Timing = MakeCvtRbV2Timing(1920, 1080, Rate[0], Rate[1]);
+			CHECK_EQ(Timing.VTotal, 1080u + 15);
+			CHECK_EQ(Timing.VFrontPorch, 1u);
+		}
+
+		// Below that the blank grows, and stays the minimum at low rates
+		CHECK(MakeCvtRbV2Timing(1920, 1080, 2173, 1).VTotal > 1080 * 2);
+		CHECK_EQ(MakeCvtRbV2Timing(1920, 1080, 1, 1).VTotal, 1080u + 15);
+	}
+
+	// The spreadsheet computes in floating point, which floors exact integers that come out as x.999... Only there may
+	// the integer engine be one above it.
+	void TestAgainstSpreadsheet()
+	{
+		std::mt19937 Random(3);
+		int Boundaries = 0;
+		bool Matching = true;
+		for (int i = 0; i < 200000; i++)
+		{
+			uint32_t Width = 320 + Random() % 16065;
+			uint32_t Height = 320 + Random() % 16065;
+			uint64_t Rate = 1 + Random() % 500;
+			bool Video = Random() % 2;
+
+			double LinePeriodUs = (1000000.0 / Rate - 460.0) / Height;
+			uint32_t VBlank = (uint32_t)floor(460.0 / LinePeriodUs) + 1;
+			VBlank = VBlank < 15 ? 15 : VBlank;
+			double ClockKhz = floor((double)Rate * (Height + VBlank) * (Width + 80) / 1000.0 * (Video ? 1000.0 / 1001.0 : 1.0));
+
+			CVT_TIMING Timing = Video ? MakeCvtRbV2Timing(Width, Height, Rate * 1000, 1001) : MakeCvtRbV2Timing(Width, Height, Rate, 1);
+			if (Timing.VTotal != Height + VBlank)
+			{
+				// 460 * rate * height / (1000000 - 460 * rate) is a whole number of lines
+				Matching &= 460 * Rate * Height % (1000000 - 460 * Rate) == 0 && Timing.VTotal == Height + VBlank + 1;
+				Boundaries++;
+				continue;
+			}
+			if ((double)Timing.PixelClockKhz != ClockKhz)
+			{
+				// The clock is a whole number of kHz
+				uint64_t Pixels = (uint64_t)Timing.HTotal * Timing.VTotal * Rate * (Video ? 1000 : 1);
+				Matching &= Pixels % (Video ? 1001000 : 1000) == 0 && Timing.PixelClockKhz == ClockKhz + 1;
+				Boundaries++;
+			}
+		}
+		printf("%d of 200000 modes on a boundary the spreadsheet floors\n", Boundaries);
+		CHECK(Matching);
+	}
+}
+
+int main()
+{
+	TestReferenceTimings();
+	TestExtremes();
+	TestAgainstSpreadsheet();
+	return TEST_RESULT();
+}
@@ -0,0 +1,149 @@
+// TileDamageMap on the damage a 4K desktop typically reports: a blinking caret, typing, a dragged window, a scrolling
+// page, a busy terminal and a full redraw. Reports the cost of snapping the rects and building the plan, how much of
+// the frame the plan copies, and the copy itself against a full frame copy. The numbers depend on the machine and are
+// only reported, what is checked is that each plan covers exactly the damaged tiles.
+
+#include "TestHarness.h"
+#include "DamageTracker.h"
+
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using SUDOVDA::SUVDA_FRAME_RECT;
+
+namespace
+{
+	constexpr uint32_t Width = 3840;
+	constexpr uint32_t Height = 2160;
+	constexpr uint32_t Pitch = Width * 4;
+	constexpr size_t MaxRects = 256;
+	constexpr int PlanRuns = 2000;
+	constexpr int CopyRuns = 20;
+
+	// The plan's tiles are exactly the damaged ones
+	bool PlanMatches(const TileDamageMap& Map, const std::vector<SUVDA_FRAME_RECT>& Plan)
+	{
+		TileDamageMap Covered;
+		Covered.Resize(Width, Height);
+		for (const auto& Rect : Plan)
+		{
+			Covered.AddRect(Rect.Left, Rect.Top, Rect.Right, Rect.Bottom);
+		}
+		uint32_t Tiles = Covered.DamagedTileCount();
+		Covered.Merge(Map);
+		return Tiles == Map.DamagedTileCount() && Covered.DamagedTileCount() == Tiles;
+	}
+
+	void CopyPlan(uint8_t* pDest, const uint8_t* pSource, const std::vector<SUVDA_FRAME_RECT>& Plan)
+	{
+		for (const auto& Rect : Plan)
+		{
+			size_t Bytes = (size_t)(Rect.Right - Rect.Left) * 4;
+			for (int32_t y = Rect.Top; y < Rect.Bottom; y++)
+			{
+				size_t Offset = (size_t)y * Pitch + (size_t)Rect.Left * 4;
+				memcpy(pDest + Offset, pSource + Offset, Bytes);
+			}
+		}
+	}
+
+	void Run(const char* Name, const std::vector<SUVDA_FRAME_RECT>& Rects, const std::vector<uint8_t>& Source,
+		std::vector<uint8_t>& Dest, uint64_t FullCopyNs)
+	{
+		TileDamageMap Map;
+		Map.Resize(Width, Height);
+		std::vector<SUVDA_FRAME_RECT> Plan;
+		bool Planned = false;
+
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < PlanRuns; i++)
+		{
+			Map.Clear();
+			for (const auto& Rect : Rects)
+			{
+				Map.AddRect(Rect.Left, Rect.Top, Rect.Right, Rect.Bottom);
+			}
+			Planned = Map.BuildPlan(Plan, MaxRects);
+		}
+		uint64_t PlanNs = SudoVdaTest::NowNs() - Start;
+
+		if (!Planned)
+		{
+			printf("%-16s %4zu rects: %7.2f us to plan, over %zu rects, full copy\n", Name, Rects.size(),
+				PlanNs / 1e3 / PlanRuns, MaxRects);
+			return;
+		}
+		CHECK(PlanMatches(Map, Plan));
+
+		uint64_t Pixels = 0;
+		for (const auto& Rect : Plan)
+		{
+			Pixels += (uint64_t)(Rect.Right - Rect.Left) * (Rect.Bottom - Rect.Top);
+		}
+
+		Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < CopyRuns; i++)
+		{
+			CopyPlan(Dest.data(), Source.data(), Plan);
+		}
+		uint64_t CopyNs = SudoVdaTest::NowNs() - Start;
+
+		printf("%-16s %4zu rects: %7.2f us to plan %3zu rects, %5.1f%% of the frame, copy %8.1f us (%5.1f%% of full)\n",
+			Name, Rects.size(), PlanNs / 1e3 / PlanRuns, Plan.size(), 100.0 * Pixels / ((uint64_t)Width * Height),
+			CopyNs / 1e3 / CopyRuns, 100.0 * CopyNs / CopyRuns / FullCopyNs);
+	}
+}
+
+int main()
+{
+	std::vector<uint8_t> Source((size_t)Pitch * Height);
+	std::vector<uint8_t> Dest(Source.size());
+	for (size_t i = 0; i < Source.size(); i++)
+	{
+		Source[i] = (uint8_t)(i * 31);
+	}
+	memcpy(Dest.data(), Source.data(), Dest.size());
+
+	uint64_t Start = SudoVdaTest::NowNs();
+	for (int i = 0; i < CopyRuns; i++)
+	{
+		memcpy(Dest.data(), Source.data(), Dest.size());
+	}
+	uint64_t FullCopyNs = (SudoVdaTest::NowNs() - Start) / CopyRuns;
+	printf("full frame copy %.1f us\n", FullCopyNs / 1e3);
+
+	Run("caret", { { 1201, 803, 1203, 827 } }, Source, Dest, FullCopyNs);
+
+	std::vector<SUVDA_FRAME_RECT> Typing;
+	for (int32_t i = 0; i < 12; i++)
+	{
+		Typing.push_back({ 400 + i * 11, 803, 411 + i * 11, 827 });
+	}
+	Run("typing", Typing, Source, Dest, FullCopyNs);
+
+	// The window's old and new position, overlapping, plus its shadow
+	Run("window drag", { { 900, 500, 2100, 1300 }, { 924, 512, 2124, 1312 }, { 890, 490, 2134, 1322 } }, Source, Dest,
+		FullCopyNs);
+
+	Run("scrolling page", { { 960, 180, 2880, 2100 }, { 2860, 180, 2880, 2100 } }, Source, Dest, FullCopyNs);
+
+	// Glyph cells of a 240x80 terminal updated at random
+	std::mt19937 Random(9);
+	std::vector<SUVDA_FRAME_RECT> Terminal;
+	for (int i = 0; i < 400; i++)
+	{
+		int32_t Column = (int32_t)(Random() % 240);
+		int32_t Row = (int32_t)(Random() % 80);
+		Terminal.push_back({ Column * 16, Row * 27, Column * 16 + 16, Row * 27 + 27 });
+	}
+	Run("terminal", std::vector<SUVDA_FRAME_RECT>(Terminal.begin(), Terminal.begin() + 40), Source, Dest, FullCopyNs);
+	Run("busy terminal", Terminal, Source, Dest, FullCopyNs);
+
+	Run("full redraw", { { 0, 0, (int32_t)Width, (int32_t)Height } }, Source, Dest, FullCopyNs);
+
+	CHECK(memcmp(Dest.data(), Source.data(), Dest.size()) == 0);
+	return TEST_RESULT();
+}
@@ -0,0 +1,216 @@
+// TileDamageMap: rect snapping and clipping, and copy plans checked against the damage bitmap for exact coverage,
+// disjointness and tile alignment.
+
+#include "TestHarness.h"
+#include "DamageTracker.h"
+
+#include <random>
+
+using namespace Microsoft::IndirectDisp;
+using SUDOVDA::SUVDA_FRAME_RECT;
+
+namespace
+{
+	bool SameRect(const SUVDA_FRAME_RECT& Rect, int32_t Left, int32_t Top, int32_t Right, int32_t Bottom)
+	{
+		return Rect.Left == Left && Rect.Top == Top && Rect.Right == Right && Rect.Bottom == Bottom;
+	}
+
+	// The plan covers exactly the damaged tiles, every rect once, each inside the frame and on the tile grid
+	bool PlanMatches(const TileDamageMap& Map, const std::vector<SUVDA_FRAME_RECT>& Plan)
+	{
+		TileDamageMap Covered;
+		Covered.Resize(Map.Width(), Map.Height(), Map.TileSize());
+		uint32_t Tiles = 0;
+		int32_t Size = (int32_t)Map.TileSize();
+
+		for (const auto& Rect : Plan)
+		{
+			if (Rect.Left < 0 || Rect.Top < 0 || Rect.Right > (int32_t)Map.Width() || Rect.Bottom > (int32_t)Map.Height() ||
+				Rect.Left >= Rect.Right || Rect.Top >= Rect.Bottom || Rect.Left % Size || Rect.Top % Size ||
+				(Rect.Right % Size && Rect.Right != (int32_t)Map.Width()) ||
+				(Rect.Bottom % Size && Rect.Bottom != (int32_t)Map.Height()))
+			{
+				return false;
+			}
+
+			TileDamageMap Single;
+			Single.Resize(Map.Width(), Map.Height(), Map.TileSize());
+			Single.AddRect(Rect.Left, Rect.Top, Rect.Right, Rect.Bottom);
+			Tiles += Single.DamagedTileCount();
+			Covered.Merge(Single);
+		}
+
+		// Overlapping rects would count tiles twice
+		if (Tiles != Covered.DamagedTileCount() || Tiles != Map.DamagedTileCount())
+		{
+			return false;
+		}
+
+		for (uint32_t ty = 0; ty < Map.TilesY(); ty++)
+		{
+			for (uint32_t tx = 0; tx < Map.TilesX(); tx++)
+			{
+				if (Map.IsTileDamaged(tx, ty) != Covered.IsTileDamaged(tx, ty))
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	void TestSnapping()
+	{
+		TileDamageMap Map;
+		Map.Resize(1366, 768);
+		CHECK_EQ(Map.TilesX(), 22u);
+		CHECK_EQ(Map.TilesY(), 12u);
+		CHECK(Map.IsEmpty());
+
+		// A one pixel rect damages its tile, a rect ending on a tile edge doesn't spill into the next one
+		Map.AddRect(65, 1, 66, 2);
+		CHECK(Map.IsTileDamaged(1, 0));
+		CHECK_EQ(Map.DamagedTileCount(), 1u);
+		Map.Clear();
+		Map.AddRect(0, 0, 128, 64);
+		CHECK_EQ(Map.DamagedTileCount(), 2u);
+		CHECK(!Map.IsTileDamaged(2, 0));
+		CHECK(!Map.IsTileDamaged(0, 1));
+
+		// Rects are clipped to the frame, empty and fully outside ones are ignored
+		Map.Clear();
+		Map.AddRect(-500, -500, 10, 10);
+		Map.AddRect(1360, 760, 5000, 5000);
+		Map.AddRect(300, 300, 300, 400);
+		Map.AddRect(400, 300, 350, 400);
+		Map.AddRect(2000, 0, 3000, 100);
+		CHECK_EQ(Map.DamagedTileCount(), 2u);
+		CHECK(Map.IsTileDamaged(0, 0));
+		CHECK(Map.IsTileDamaged(21, 11));
+
+		std::vector<SUVDA_FRAME_RECT> Plan;
+		CHECK(Map.BuildPlan(Plan, 8));
+		CHECK_EQ(Plan.size(), 2u);
+		CHECK(SameRect(Plan[0], 0, 0, 64, 64));
+		CHECK(SameRect(Plan[1], 1344, 704, 1366, 768));
+		CHECK(PlanMatches(Map, Plan));
+
+		Map.ClearTile(0, 0);
+		CHECK_EQ(Map.DamagedTileCount(), 1u);
+		Map.ClearTile(21, 11);
+		CHECK(Map.IsEmpty());
+		CHECK(Map.BuildPlan(Plan, 8));
+		CHECK(Plan.empty());
+	}
+
+	void TestMerging()
+	{
+		TileDamageMap Map;
+		Map.Resize(7680, 4320);
+		CHECK_EQ(Map.TilesX(), 120u);
+
+		// Overlapping rects of a moved window collapse into one rectangle
+		Map.AddRect(100, 100, 900, 700);
+		Map.AddRect(120, 110, 920, 690);
+		Map.AddRect(500, 300, 600, 400);
+		std::vector<SUVDA_FRAME_RECT> Plan;
+		CHECK(Map.BuildPlan(Plan, 64));
+		CHECK_EQ(Plan.size(), 1u);
+		CHECK(SameRect(Plan[0], 64, 64, 960, 704));
+
+		// A run crossing the 64 tile word boundary stays one rect
+		Map.Clear();
+		Map.AddRect(4000, 0, 4200, 10);
+		CHECK(Map.BuildPlan(Plan, 64));
+		CHECK_EQ(Plan.size(), 1u);
+		CHECK(SameRect(Plan[0], 3968, 0, 4224, 64));
+
+		// An L shape needs two rects, rows with different spans don't stack
+		Map.Clear();
+		Map.AddRect(0, 0, 256, 64);
+		Map.AddRect(0, 64, 64, 256);
+		CHECK(Map.BuildPlan(Plan, 64));
+		CHECK_EQ(Plan.size(), 2u);
+		CHECK(SameRect(Plan[0], 0, 0, 256, 64));
+		CHECK(SameRect(Plan[1], 0, 64, 64, 256));
+
+		// Full damage is a single frame sized rect
+		Map.MarkAll();
+		CHECK_EQ(Map.DamagedTileCount(), 120u * 68);
+		CHECK(Map.BuildPlan(Plan, 1));
+		CHECK_EQ(Plan.size(), 1u);
+		CHECK(SameRect(Plan[0], 0, 0, 7680, 4320));
+
+		// Merging accumulates the damage of frames the consumer didn't see
+		TileDamageMap Other;
+		Other.Resize(7680, 4320);
+		Other.AddRect(0, 0, 1, 1);
+		Map.Clear();
+		Map.AddRect(7679, 4319, 7680, 4320);
+		Map.Merge(Other);
+		CHECK_EQ(Map.DamagedTileCount(), 2u);
+	}
+
+	void TestOverflow()
+	{
+		// A checkerboard can't be merged, the plan stops at MaxRects and asks for a full copy
+		TileDamageMap Map;
+		Map.Resize(1024, 1024);
+		for (uint32_t ty = 0; ty < Map.TilesY(); ty++)
+		{
+			for (uint32_t tx = (ty & 1); tx < Map.TilesX(); tx += 2)
+			{
+				Map.AddRect(tx * 64, ty * 64, tx * 64 + 1, ty * 64 + 1);
+			}
+		}
+
+		std::vector<SUVDA_FRAME_RECT> Plan;
+		CHECK(!Map.BuildPlan(Plan, SUVDA_FRAME_MAX_DAMAGE_RECTS));
+		CHECK_EQ(Plan.size(), (size_t)SUVDA_FRAME_MAX_DAMAGE_RECTS);
+		CHECK(Map.BuildPlan(Plan, 128));
+		CHECK_EQ(Plan.size(), 128u);
+		CHECK(PlanMatches(Map, Plan));
+	}
+
+	void TestRandom()
+	{
+		std::mt19937 Random(3);
+		const uint32_t Sizes[][3] = { { 7680, 4320, 64 }, { 1366, 768, 64 }, { 1920, 1080, 32 }, { 100, 50, 16 } };
+
+		for (const auto& Size : Sizes)
+		{
+			TileDamageMap Map;
+			Map.Resize(Size[0], Size[1], Size[2]);
+			std::vector<SUVDA_FRAME_RECT> Plan;
+
+			for (int Frame = 0; Frame < 300; Frame++)
+			{
+				Map.Clear();
+				int Rects = Random() % 24;
+				for (int i = 0; i < Rects; i++)
+				{
+					int32_t x = (int32_t)(Random() % (Size[0] + 200)) - 100;
+					int32_t y = (int32_t)(Random() % (Size[1] + 200)) - 100;
+					Map.AddRect(x, y, x + (int32_t)(Random() % (Size[0] / 4 + 1)), y + (int32_t)(Random() % (Size[1] / 4 + 1)));
+				}
+
+				if (!Map.BuildPlan(Plan, SIZE_MAX) || !PlanMatches(Map, Plan))
+				{
+					CHECK(PlanMatches(Map, Plan));
+					break;
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	TestSnapping();
+	TestMerging();
+	TestOverflow();
+	TestRandom();
+	return TEST_RESULT();
+}
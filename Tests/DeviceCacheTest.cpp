@@ -0,0 +1,163 @@
+// DeviceCache against a counting fake factory: sharing per adapter, release with the last holder, stale adapter
+// enumerations, broken devices, creation failures, and monitors of one adapter acquiring at the same time.
+
+#include "TestHarness.h"
+#include "DeviceCache.h"
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	struct FakeDevice
+	{
+		uint64_t AdapterKey;
+		uint64_t Generation;          // Adapter enumeration it was created from
+		bool Usable = true;
+	};
+
+	class FakeFactory : public IDeviceFactory<FakeDevice>
+	{
+	public:
+		bool IsCurrent() override
+		{
+			return Current;
+		}
+
+		void Refresh() override
+		{
+			Current = true;
+			Generation++;
+		}
+
+		std::shared_ptr<FakeDevice> Create(uint64_t AdapterKey) override
+		{
+			Creates++;
+			if (AdapterKey == MissingAdapter)
+			{
+				return nullptr;
+			}
+
+			// Give other threads a chance to race the creation
+			std::this_thread::yield();
+			auto Device = std::make_shared<FakeDevice>();
+			Device->AdapterKey = AdapterKey;
+			Device->Generation = Generation;
+			return Device;
+		}
+
+		bool IsUsable(FakeDevice& Device) override
+		{
+			return Device.Usable;
+		}
+
+		static const uint64_t MissingAdapter = 99;
+		bool Current = true;
+		uint64_t Generation = 0;
+		std::atomic<uint32_t> Creates{ 0 };
+	};
+
+	void TestSharing()
+	{
+		FakeFactory Factory;
+		DeviceCache<FakeDevice> Cache(Factory);
+
+		auto First = Cache.Acquire(1);
+		auto Second = Cache.Acquire(1);
+		auto Other = Cache.Acquire(2);
+		CHECK(First && Second && Other);
+		CHECK(First == Second);
+		CHECK(First != Other);
+		CHECK_EQ(Other->AdapterKey, 2u);
+		CHECK_EQ(Cache.LiveDevices(), 2u);
+		CHECK_EQ(Cache.Stats().Created, 2u);
+		CHECK_EQ(Cache.Stats().Reused, 1u);
+
+		// The device goes away with its last holder and is created again on demand
+		First.reset();
+		CHECK_EQ(Cache.LiveDevices(), 2u);
+		Second.reset();
+		CHECK_EQ(Cache.LiveDevices(), 1u);
+		auto Again = Cache.Acquire(1);
+		CHECK(Again != nullptr);
+		CHECK_EQ(Cache.Stats().Created, 3u);
+		CHECK_EQ(Factory.Creates.load(), 3u);
+	}
+
+	void TestRefreshAndReplace()
+	{
+		FakeFactory Factory;
+		DeviceCache<FakeDevice> Cache(Factory);
+		auto Device = Cache.Acquire(1);
+
+		// A stale enumeration is dropped, devices of adapters that are still there stay shared
+		Factory.Current = false;
+		auto Same = Cache.Acquire(1);
+		CHECK(Same == Device);
+		CHECK_EQ(Cache.Stats().Refreshes, 1u);
+		auto New = Cache.Acquire(3);
+		CHECK_EQ(New->Generation, 1u);
+
+		// A broken device is replaced, its holders keep the old one
+		Device->Usable = false;
+		auto Replacement = Cache.Acquire(1);
+		CHECK(Replacement && Replacement != Device);
+		CHECK_EQ(Cache.Stats().Replaced, 1u);
+		CHECK(Cache.Acquire(1) == Replacement);
+
+		// Failures hand out nothing and cache nothing
+		CHECK(Cache.Acquire(FakeFactory::MissingAdapter) == nullptr);
+		CHECK(Cache.Acquire(FakeFactory::MissingAdapter) == nullptr);
+		CHECK_EQ(Cache.Stats().Failed, 2u);
+		CHECK_EQ(Cache.LiveDevices(), 2u);
+	}
+
+	// Monitors of a handful of adapters acquiring at once share one device per adapter
+	void TestConcurrentAcquire()
+	{
+		const uint32_t Threads = 8;
+		const uint32_t Adapters = 3;
+		FakeFactory Factory;
+		DeviceCache<FakeDevice> Cache(Factory);
+
+		std::vector<std::shared_ptr<FakeDevice>> Devices(Threads * Adapters);
+		std::vector<std::thread> Monitors;
+		for (uint32_t t = 0; t < Threads; t++)
+		{
+			Monitors.emplace_back([&, t] {
+				for (uint32_t a = 0; a < Adapters; a++)
+				{
+					Devices[t * Adapters + a] = Cache.Acquire((a + t) % Adapters);
+				}
+			});
+		}
+		for (auto& Monitor : Monitors)
+		{
+			Monitor.join();
+		}
+
+		std::set<FakeDevice*> Distinct;
+		bool Matching = true;
+		for (uint32_t i = 0; i < Devices.size(); i++)
+		{
+			Distinct.insert(Devices[i].get());
+			Matching &= Devices[i] && Devices[i]->AdapterKey == ((i % Adapters) + i / Adapters) % Adapters;
+		}
+		CHECK(Matching);
+		CHECK_EQ(Distinct.size(), (size_t)Adapters);
+		CHECK_EQ(Factory.Creates.load(), Adapters);
+		CHECK_EQ(Cache.Stats().Reused, Threads * Adapters - Adapters);
+	}
+}
+
+int main()
+{
+	TestSharing();
+	TestRefreshAndReplace();
+	TestConcurrentAcquire();
+	return TEST_RESULT();
+}
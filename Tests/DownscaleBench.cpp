@@ -0,0 +1,96 @@
+// Box downscaling of 4K and 8K BGRA frames by every factor on every instruction set the CPU supports, and the partial
+// update of a preview for one damaged 256x256 region. The numbers depend on the machine and are only reported, what is
+// checked is that each SIMD path's preview matches the scalar one byte for byte.
+
+#include "TestHarness.h"
+#include "Downscale.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	const char* IsaNames[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+	constexpr int DamageRuns = 500;
+
+	void Run(const std::vector<uint8_t>& Source, uint32_t Width, uint32_t Height, int Runs)
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2,
+			PIXEL_CONVERT_ISA_NEON };
+		size_t Pitch = (size_t)Width * 4;
+		size_t SourceBytes = Pitch * Height;
+
+		for (uint32_t Factor : { 2, 4, 8, 16 })
+		{
+			CHECK(DownscaleIsSupportedFactor(Factor));
+			uint32_t DstWidth = DownscaledSize(Width, Factor);
+			uint32_t DstHeight = DownscaledSize(Height, Factor);
+			size_t DstPitch = (size_t)DstWidth * 4;
+			std::vector<uint8_t> Reference;
+			std::vector<uint8_t> Preview(DstPitch * DstHeight);
+
+			printf("%ux%u to %ux%u\n", Width, Height, DstWidth, DstHeight);
+			for (auto Isa : Isas)
+			{
+				if (!PixelConvertSetIsa(Isa))
+				{
+					continue;
+				}
+
+				uint64_t Start = SudoVdaTest::NowNs();
+				for (int i = 0; i < Runs; i++)
+				{
+					DownscaleBgraBox(Source.data(), Pitch, Width, Height, Factor, Preview.data(), DstPitch, 0, 0, DstWidth,
+						DstHeight);
+				}
+				uint64_t FullNs = (SudoVdaTest::NowNs() - Start) / Runs;
+
+				// A damaged 256x256 region in the middle of the frame
+				uint32_t Left = Width / 2 / Factor;
+				uint32_t Top = Height / 2 / Factor;
+				uint32_t Size = 256 / Factor;
+				Start = SudoVdaTest::NowNs();
+				for (int i = 0; i < DamageRuns; i++)
+				{
+					DownscaleBgraBox(Source.data(), Pitch, Width, Height, Factor, Preview.data(), DstPitch, Left, Top,
+						Left + Size, Top + Size);
+				}
+				uint64_t DamageNs = (SudoVdaTest::NowNs() - Start) / DamageRuns;
+
+				if (Isa == PIXEL_CONVERT_ISA_SCALAR)
+				{
+					Reference = Preview;
+				}
+				else
+				{
+					CHECK(memcmp(Preview.data(), Reference.data(), Preview.size()) == 0);
+				}
+				printf("  %-7s %8.2f ms/frame %6.2f GB/s, 256x256 damage %6.1f us\n", IsaNames[Isa], FullNs / 1e6,
+					(double)SourceBytes / FullNs, DamageNs / 1e3);
+			}
+		}
+	}
+}
+
+int main()
+{
+	// Sized for 8K, the 4K runs use the start of it
+	constexpr uint32_t MaxWidth = 7680;
+	constexpr uint32_t MaxHeight = 4320;
+	std::vector<uint8_t> Source((size_t)MaxWidth * MaxHeight * 4);
+	uint32_t Random = 1;
+	for (size_t i = 0; i < Source.size(); i++)
+	{
+		Random = Random * 1103515245 + 12345;
+		Source[i] = (uint8_t)((i / 4 % MaxWidth) / 30 + (Random >> 28));
+	}
+
+	Run(Source, 3840, 2160, 4);
+	Run(Source, MaxWidth, MaxHeight, 2);
+	CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	return TEST_RESULT();
+}
@@ -0,0 +1,162 @@
+// Box downscaling for the monitor previews: every instruction set against a straightforward reference, edge
+// replication, and partial updates that must only touch the requested destination rectangle.
+
+#include "TestHarness.h"
+#include "Downscale.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	const uint8_t Guard = 0xcd;
+
+	// Averages every Factor x Factor block, the last row and column repeated past the edges, rounded to nearest
+	void Reference(const std::vector<uint8_t>& Src, size_t SrcPitch, uint32_t Width, uint32_t Height, uint32_t Factor, std::vector<uint8_t>& Dst, size_t DstPitch)
+	{
+		uint32_t Shift = 0;
+		while ((1u << Shift) < Factor * Factor)
+		{
+			Shift++;
+		}
+
+		for (uint32_t y = 0; y < DownscaledSize(Height, Factor); y++)
+		{
+			for (uint32_t x = 0; x < DownscaledSize(Width, Factor); x++)
+			{
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					uint32_t Sum = 0;
+					for (uint32_t j = 0; j < Factor; j++)
+					{
+						for (uint32_t i = 0; i < Factor; i++)
+						{
+							uint32_t Row = std::min(y * Factor + j, Height - 1);
+							uint32_t Column = std::min(x * Factor + i, Width - 1);
+							Sum += Src[Row * SrcPitch + Column * 4 + c];
+						}
+					}
+					Dst[y * DstPitch + x * 4 + c] = (uint8_t)((Sum + (1u << (Shift - 1))) >> Shift);
+				}
+			}
+		}
+	}
+
+	void TestFactors()
+	{
+		for (uint32_t Factor = 0; Factor <= 32; Factor++)
+		{
+			CHECK_EQ(DownscaleIsSupportedFactor(Factor), Factor == 2 || Factor == 4 || Factor == 8 || Factor == 16);
+		}
+		CHECK_EQ(DownscaledSize(1920, 16), 120u);
+		CHECK_EQ(DownscaledSize(1921, 16), 121u);
+		CHECK_EQ(DownscaledSize(1, 2), 1u);
+	}
+
+	// Full images and a partial update per size, factor and instruction set
+	void TestAgainstReference()
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON };
+		const char* Names[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+		// Widths around the 256 column chunks, heights that leave partial strips
+		const uint32_t Sizes[][2] = { { 1, 1 }, { 17, 9 }, { 255, 33 }, { 256, 16 }, { 257, 17 }, { 1023, 517 }, { 1920, 1080 } };
+		std::mt19937 Random(1);
+
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertSetIsa(Isa))
+			{
+				printf("%s not supported, skipped\n", Names[Isa]);
+				continue;
+			}
+
+			bool Matches = true;
+			bool Contained = true;
+			for (const auto& Size : Sizes)
+			{
+				for (uint32_t Factor = 2; Factor <= DownscaleMaxFactor; Factor *= 2)
+				{
+					uint32_t Width = Size[0];
+					uint32_t Height = Size[1];
+
+					// Unaligned pitches on purpose, and saturated images for the 16-bit sums
+					size_t SrcPitch = Width * 4 + 12;
+					std::vector<uint8_t> Src(SrcPitch * Height);
+					bool Saturated = Random() % 3 == 0;
+					for (auto& Value : Src)
+					{
+						Value = Saturated ? 255 : (uint8_t)Random();
+					}
+
+					uint32_t DstWidth = DownscaledSize(Width, Factor);
+					uint32_t DstHeight = DownscaledSize(Height, Factor);
+					size_t DstPitch = DstWidth * 4 + 4;
+					std::vector<uint8_t> Expected(DstPitch * DstHeight, Guard);
+					Reference(Src, SrcPitch, Width, Height, Factor, Expected, DstPitch);
+
+					std::vector<uint8_t> Full(DstPitch * DstHeight, Guard);
+					DownscaleBgraBox(Src.data(), SrcPitch, Width, Height, Factor, Full.data(), DstPitch, 0, 0, DstWidth, DstHeight);
+					Matches &= Full == Expected;
+
+					// A rectangle reaching past the destination is clipped, nothing outside it is written
+					uint32_t Left = DstWidth / 3;
+					uint32_t Top = DstHeight / 4;
+					uint32_t Right = DstWidth - DstWidth / 5 + 7;
+					uint32_t Bottom = DstHeight + 3;
+					std::vector<uint8_t> Partial(DstPitch * DstHeight, Guard);
+					DownscaleBgraBox(Src.data(), SrcPitch, Width, Height, Factor, Partial.data(), DstPitch, Left, Top, Right, Bottom);
+					for (uint32_t y = 0; y < DstHeight; y++)
+					{
+						for (uint32_t x = 0; x < DstPitch; x++)
+						{
+							bool Inside = x / 4 >= Left && x / 4 < std::min(Right, DstWidth) && y >= Top;
+							uint8_t Value = Partial[y * DstPitch + x];
+							Contained &= Inside ? Value == Expected[y * DstPitch + x] : Value == Guard;
+						}
+					}
+				}
+			}
+
+			if (!Matches || !Contained)
+			{
+				fprintf(stderr, "%s differs from the reference\n", Names[Isa]);
+			}
+			CHECK(Matches);
+			CHECK(Contained);
+		}
+
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	}
+
+	// Constant blocks stay constant, and a 2x2 block rounds half up
+	void TestValues()
+	{
+		std::vector<uint8_t> Src = {
+			0, 0, 0, 0,   1, 1, 1, 255,   9, 9, 9, 9,
+			0, 0, 0, 0,   0, 0, 0, 255,   9, 9, 9, 9,
+			7, 7, 7, 7,   7, 7, 7, 7,     3, 3, 3, 3,
+		};
+		std::vector<uint8_t> Dst(2 * 2 * 4, Guard);
+		DownscaleBgraBox(Src.data(), 12, 3, 3, 2, Dst.data(), 8, 0, 0, 2, 2);
+
+		// (0 + 1 + 0 + 0) / 4 rounds to 0, (0 + 255 + 0 + 255) / 4 to 128
+		CHECK_EQ(Dst[0], 0);
+		CHECK_EQ(Dst[3], 128);
+		// The last column and row are repeated
+		CHECK_EQ(Dst[4], 9);
+		CHECK_EQ(Dst[8], 7);
+		CHECK_EQ(Dst[12], 3);
+	}
+}
+
+int main()
+{
+	TestFactors();
+	TestAgainstReference();
+	TestValues();
+	return TEST_RESULT();
+}
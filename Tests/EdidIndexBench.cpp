@@ -0,0 +1,106 @@
+// EdidIndex lookup cost against the monitor list walk it replaced, for 10 to 1000 monitors whose EDIDs only differ in
+// their strings, like the ones the driver generates. Also reports the cost of a remove and insert, which copies the
+// snapshot. The numbers depend on the machine and are only reported, what is checked is that every lookup resolves to
+// the same monitor both ways.
+
+#include "TestHarness.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t BYTE;
+#include "edid.h"
+#include "EdidIndex.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr size_t EdidSize = sizeof(edid_base);
+	constexpr int Lookups = 200000;
+	constexpr int Updates = 50;
+
+	struct Modes
+	{
+		int Id;
+	};
+
+	struct Monitor
+	{
+		std::vector<uint8_t> Edid;
+		std::shared_ptr<const Modes> Value;
+	};
+
+	std::vector<uint8_t> MakeEdid(uint32_t Serial, int i)
+	{
+		std::string SerialString = "VDD2408" + std::to_string(i);
+		std::string Name = "SudoVDD #" + std::to_string(i);
+		uint8_t* pEdid = generate_edid(Serial, SerialString.c_str(), Name.c_str());
+		std::vector<uint8_t> Edid(pEdid, pEdid + EdidSize);
+		free(pEdid);
+		return Edid;
+	}
+
+	void Run(int MonitorCount)
+	{
+		EdidIndex<Modes> Index;
+		std::list<Monitor> Monitors;
+		std::vector<const uint8_t*> Probes;
+		for (int i = 0; i < MonitorCount; i++)
+		{
+			Monitors.push_back({ MakeEdid(0x12345678, i), std::make_shared<const Modes>(Modes{ i }) });
+			Index.Insert(Monitors.back().Edid.data(), EdidSize, Monitors.back().Value);
+			Probes.push_back(Monitors.back().Edid.data());
+		}
+
+		int64_t Sum = 0;
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < Lookups; i++)
+		{
+			const uint8_t* pProbe = Probes[(i * 7919) % MonitorCount];
+			for (const auto& Monitor : Monitors)
+			{
+				if (memcmp(pProbe, Monitor.Edid.data(), EdidSize) == 0)
+				{
+					Sum += Monitor.Value->Id;
+					break;
+				}
+			}
+		}
+		uint64_t WalkNs = SudoVdaTest::NowNs() - Start;
+
+		Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < Lookups; i++)
+		{
+			Sum -= Index.Find(Probes[(i * 7919) % MonitorCount], EdidSize)->Id;
+		}
+		uint64_t IndexNs = SudoVdaTest::NowNs() - Start;
+		CHECK_EQ(Sum, 0);
+
+		const Monitor& First = Monitors.front();
+		Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < Updates; i++)
+		{
+			CHECK(Index.Remove(First.Edid.data(), EdidSize, First.Value.get()));
+			Index.Insert(First.Edid.data(), EdidSize, First.Value);
+		}
+		uint64_t UpdateNs = SudoVdaTest::NowNs() - Start;
+
+		printf("%4d monitors: list walk %8.1f ns, index %6.1f ns per lookup, remove+insert %7.1f us\n", MonitorCount,
+			(double)WalkNs / Lookups, (double)IndexNs / Lookups, UpdateNs / 1e3 / Updates);
+	}
+}
+
+int main()
+{
+	for (int MonitorCount : { 10, 100, 1000 })
+	{
+		Run(MonitorCount);
+	}
+	return TEST_RESULT();
+}
@@ -0,0 +1,179 @@
+// EdidIndex: lookups by exact EDID with duplicates and removal by value, and lock-free readers racing writers that add
+// and remove monitors. Also built with ThreadSanitizer as EdidIndexTsanTest where the compiler supports it.
+
+#include "TestHarness.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t BYTE;
+#include "edid.h"
+#include "EdidIndex.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr size_t EdidSize = sizeof(edid_base);
+
+	struct Modes
+	{
+		int Id;
+	};
+
+	// The EDIDs the driver generates for monitor i, sharing the serial number like sequential GUIDs would
+	std::vector<uint8_t> MakeEdid(uint32_t Serial, int i)
+	{
+		std::string SerialString = "VDD2408" + std::to_string(i);
+		std::string Name = "SudoVDD #" + std::to_string(i);
+		uint8_t* pEdid = generate_edid(Serial, SerialString.c_str(), Name.c_str());
+		std::vector<uint8_t> Edid(pEdid, pEdid + EdidSize);
+		free(pEdid);
+		return Edid;
+	}
+
+	void TestLookup()
+	{
+		EdidIndex<Modes> Index;
+		std::vector<uint8_t> Edid = MakeEdid(7, 1);
+		auto First = std::make_shared<const Modes>(Modes{ 1 });
+		auto Second = std::make_shared<const Modes>(Modes{ 2 });
+		CHECK(!Index.Find(Edid.data(), EdidSize));
+
+		// Monitors sharing an EDID are found in insertion order
+		Index.Insert(Edid.data(), EdidSize, First);
+		Index.Insert(Edid.data(), EdidSize, Second);
+		CHECK_EQ(Index.Count(), 2u);
+		CHECK(Index.Find(Edid.data(), EdidSize) == First);
+
+		// Removal goes by value
+		CHECK(!Index.Remove(Edid.data(), EdidSize, nullptr));
+		CHECK(Index.Remove(Edid.data(), EdidSize, First.get()));
+		CHECK(!Index.Remove(Edid.data(), EdidSize, First.get()));
+		CHECK(Index.Find(Edid.data(), EdidSize) == Second);
+
+		// A found value outlives its removal
+		auto Found = Index.Find(Edid.data(), EdidSize);
+		CHECK(Index.Remove(Edid.data(), EdidSize, Second.get()));
+		Second.reset();
+		CHECK_EQ(Found->Id, 2);
+		CHECK(!Index.Find(Edid.data(), EdidSize));
+		CHECK_EQ(Index.Count(), 0u);
+
+		// Only the exact bytes match, a string that differs or a truncated EDID doesn't
+		std::vector<std::vector<uint8_t>> Edids;
+		std::vector<std::shared_ptr<const Modes>> Owners;
+		for (int i = 0; i < 100; i++)
+		{
+			Edids.push_back(MakeEdid(0x12345678, i));
+			Owners.push_back(std::make_shared<const Modes>(Modes{ i }));
+			Index.Insert(Edids[i].data(), EdidSize, Owners[i]);
+		}
+		bool AllFound = true;
+		for (int i = 0; i < 100; i++)
+		{
+			auto Value = Index.Find(Edids[i].data(), EdidSize);
+			AllFound &= Value && Value->Id == i;
+		}
+		CHECK(AllFound);
+		std::vector<uint8_t> Flipped = Edids[42];
+		Flipped[200] ^= 1;
+		CHECK(!Index.Find(Flipped.data(), EdidSize));
+		CHECK(!Index.Find(Edids[42].data(), 128));
+	}
+
+	// Readers look up stable and churning monitors while writers add and remove the churning ones. Stable monitors must
+	// always be found, and nothing may ever resolve to another monitor's value.
+	void TestConcurrentUpdates()
+	{
+		constexpr int Stable = 32;
+		constexpr int Churning = 32;
+		constexpr int Readers = 4;
+		constexpr int Writers = 2;
+		constexpr int Cycles = 1000;
+
+		EdidIndex<Modes> Index;
+		std::vector<std::vector<uint8_t>> Edids;
+		std::vector<std::shared_ptr<const Modes>> Values;
+		for (int i = 0; i < Stable + Churning; i++)
+		{
+			Edids.push_back(MakeEdid(0xABC, i));
+			Values.push_back(std::make_shared<const Modes>(Modes{ i }));
+			if (i < Stable)
+			{
+				Index.Insert(Edids[i].data(), EdidSize, Values[i]);
+			}
+		}
+
+		std::atomic<bool> Stop{ false };
+		std::atomic<uint64_t> Lookups{ 0 };
+		std::atomic<uint64_t> Wrong{ 0 };
+		std::vector<std::thread> Threads;
+		for (int r = 0; r < Readers; r++)
+		{
+			Threads.emplace_back([&, r] {
+				uint32_t Random = r + 1;
+				while (!Stop.load(std::memory_order_relaxed))
+				{
+					Random = Random * 1103515245 + 12345;
+					int i = (Random >> 8) % (Stable + Churning);
+					auto Value = Index.Find(Edids[i].data(), EdidSize);
+					if (Value ? Value->Id != i : i < Stable)
+					{
+						Wrong++;
+					}
+					Lookups++;
+					std::this_thread::yield();
+				}
+			});
+		}
+		for (int w = 0; w < Writers; w++)
+		{
+			Threads.emplace_back([&, w] {
+				for (int n = 0; n < Cycles; n++)
+				{
+					int i = Stable + (n * Writers + w) % Churning;
+					Index.Insert(Edids[i].data(), EdidSize, Values[i]);
+					std::this_thread::yield();
+					Index.Remove(Edids[i].data(), EdidSize, Values[i].get());
+				}
+			});
+		}
+
+		for (int w = 0; w < Writers; w++)
+		{
+			Threads[Readers + w].join();
+		}
+		Stop = true;
+		for (int r = 0; r < Readers; r++)
+		{
+			Threads[r].join();
+		}
+
+		printf("%llu lookups during %d updates\n", (unsigned long long)Lookups.load(), Writers * Cycles * 2);
+		CHECK(Lookups.load() > 0);
+		CHECK_EQ(Wrong.load(), 0u);
+		CHECK_EQ(Index.Count(), (size_t)Stable);
+
+		// Only the test still holds the values, every replaced snapshot released its references
+		bool Released = true;
+		for (auto& Value : Values)
+		{
+			Released &= Value.use_count() == (&Value - Values.data() < Stable ? 2 : 1);
+		}
+		CHECK(Released);
+	}
+}
+
+int main()
+{
+	TestLookup();
+	TestConcurrentUpdates();
+	return TEST_RESULT();
+}
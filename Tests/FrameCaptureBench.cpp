@@ -0,0 +1,158 @@
+// FrameCaptureWriter recording 4K BGRA frames: the cost of Submit() on the swap-chain thread and the writer's
+// throughput into a sink that discards everything, for raw and Y4M, then 36 frames at 60 Hz into a sink limited to disk
+// speed with each queue policy, BLOCK with its default timeout. The numbers depend on the machine and are only
+// reported, what is checked is that every frame is accounted for as written or dropped and that nothing is lost when
+// the writer keeps up.
+
+#include "TestHarness.h"
+#include "FrameCapture.h"
+#include "LatencyHistogram.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+
+namespace
+{
+	constexpr uint32_t Width = 3840;
+	constexpr uint32_t Height = 2160;
+	constexpr uint64_t FrameBytes = (uint64_t)Width * Height * 4;
+	constexpr uint64_t FrameIntervalNs = 1000000000 / 60;
+	constexpr uint32_t BufferCount = 4;
+	// Each of the BufferCount + 2 buffers is allocated by the first frame it takes, only later submits are timed
+	constexpr uint64_t WarmupFrames = BufferCount + 2;
+
+	// Throws away what it is given, optionally taking as long as a disk writing BytesPerUs would
+	class DiscardSink : public ICaptureSink
+	{
+	public:
+		explicit DiscardSink(uint64_t BytesPerUs = 0) : m_BytesPerUs(BytesPerUs)
+		{
+		}
+
+		bool Write(const void*, size_t Bytes) override
+		{
+			if (m_BytesPerUs)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(Bytes / m_BytesPerUs));
+			}
+			return true;
+		}
+
+	private:
+		uint64_t m_BytesPerUs;
+	};
+
+	struct FRAME
+	{
+		SUVDA_FRAME_SLOT Desc{};
+		std::vector<uint8_t> Pixels;
+	};
+
+	FRAME_CAPTURE_CONFIG MakeConfig(SUVDA_CAPTURE_FORMAT Format, SUVDA_CAPTURE_QUEUE_POLICY Policy, uint32_t TimeoutMs)
+	{
+		return FRAME_CAPTURE_CONFIG{ Format, BufferCount, Policy, TimeoutMs, 60, 1, 10000000, 0 };
+	}
+
+	void PrintSubmit(const char* Name, const LatencyHistogram& Submits)
+	{
+		LATENCY_SUMMARY Summary;
+		Submits.Summarize(Summary);
+		printf("%-20s submit mean %6.1f p99 %7.1f max %7.1f us", Name, Summary.Mean / 1e3, Summary.P99 / 1e3,
+			Summary.Max / 1e3);
+	}
+
+	void RunUnthrottled(const char* Name, SUVDA_CAPTURE_FORMAT Format, FRAME& Frame)
+	{
+		constexpr uint64_t Frames = 48;
+		FrameCaptureWriter Writer(std::make_unique<DiscardSink>(), std::make_unique<DiscardSink>(),
+			MakeConfig(Format, SUVDA_CAPTURE_QUEUE_BLOCK, FrameCaptureWriter::MaxBlockMs));
+		CHECK(Writer.Start());
+
+		auto Submits = std::make_unique<LatencyHistogram>();
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < Frames; i++)
+		{
+			Frame.Desc.FrameNumber = i;
+			uint64_t Begin = SudoVdaTest::NowNs();
+			CHECK(Writer.Submit(Frame.Desc, Frame.Pixels.data()));
+			if (i >= WarmupFrames)
+			{
+				Submits->Record(SudoVdaTest::NowNs() - Begin);
+			}
+		}
+		Writer.Stop();
+		uint64_t ElapsedNs = SudoVdaTest::NowNs() - Start;
+
+		auto Stats = Writer.Stats();
+		CHECK_EQ(Stats.FramesWritten, Frames);
+		CHECK_EQ(Stats.FramesDropped, 0u);
+		PrintSubmit(Name, *Submits);
+		printf(", %6.1f frames/s, %5.2f GB/s written\n", Frames * 1e9 / ElapsedNs, (double)Stats.BytesWritten / ElapsedNs);
+	}
+
+	void RunSlowDisk(const char* Name, SUVDA_CAPTURE_QUEUE_POLICY Policy, FRAME& Frame)
+	{
+		constexpr uint64_t Frames = 36;
+		constexpr uint64_t DiskBytesPerUs = 600; // 600 MB/s, about 18 4K frames per second
+		FrameCaptureWriter Writer(std::make_unique<DiscardSink>(DiskBytesPerUs), std::make_unique<DiscardSink>(),
+			MakeConfig(SUVDA_CAPTURE_FORMAT_RAW, Policy, 0));
+		CHECK(Writer.Start());
+
+		auto Submits = std::make_unique<LatencyHistogram>();
+		uint64_t Due = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < Frames; i++)
+		{
+			Frame.Desc.FrameNumber = i;
+			uint64_t Begin = SudoVdaTest::NowNs();
+			Writer.Submit(Frame.Desc, Frame.Pixels.data());
+			if (i >= WarmupFrames)
+			{
+				Submits->Record(SudoVdaTest::NowNs() - Begin);
+			}
+
+			Due += FrameIntervalNs;
+			while (SudoVdaTest::NowNs() < Due)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		}
+		auto Stats = Writer.Stats();
+		Writer.Stop();
+
+		CHECK_EQ(Stats.FramesSubmitted, Frames);
+		CHECK(Stats.FramesWritten + Stats.FramesDropped <= Frames);
+		Stats = Writer.Stats();
+		CHECK_EQ(Stats.FramesWritten + Stats.FramesDropped, Frames);
+		PrintSubmit(Name, *Submits);
+		printf(", %2llu of %llu written, %2llu dropped\n", (unsigned long long)Stats.FramesWritten,
+			(unsigned long long)Frames, (unsigned long long)Stats.FramesDropped);
+	}
+}
+
+int main()
+{
+	FRAME Frame;
+	Frame.Desc.Width = Width;
+	Frame.Desc.Height = Height;
+	Frame.Desc.Pitch = Width * 4;
+	Frame.Desc.Format = SUVDA_FRAME_FORMAT_BGRA8;
+	Frame.Desc.DataSize = FrameBytes;
+	Frame.Pixels.resize(FrameBytes);
+	for (size_t i = 0; i < Frame.Pixels.size(); i++)
+	{
+		Frame.Pixels[i] = (uint8_t)((i / 4 % Width) / 15 + i % 4 * 40);
+	}
+
+	RunUnthrottled("raw", SUVDA_CAPTURE_FORMAT_RAW, Frame);
+	RunUnthrottled("y4m", SUVDA_CAPTURE_FORMAT_Y4M, Frame);
+
+	RunSlowDisk("slow disk, newest", SUVDA_CAPTURE_QUEUE_DROP_NEWEST, Frame);
+	RunSlowDisk("slow disk, oldest", SUVDA_CAPTURE_QUEUE_DROP_OLDEST, Frame);
+	RunSlowDisk("slow disk, block", SUVDA_CAPTURE_QUEUE_BLOCK, Frame);
+	return TEST_RESULT();
+}
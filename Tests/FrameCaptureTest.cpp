@@ -0,0 +1,330 @@
+// FrameCaptureWriter against in-memory sinks: raw and Y4M file layouts, the queue policies with a stalled disk, the
+// buffer memory budget, write errors, and the file names clients may pass.
+
+#include "TestHarness.h"
+#include "MemorySink.h"
+#include "FrameCapture.h"
+#include "PixelConvert.h"
+
+#include <string>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+using SudoVdaTest::MemorySink;
+using SudoVdaTest::SinkState;
+
+namespace
+{
+	FRAME_CAPTURE_CONFIG MakeConfig(SUVDA_CAPTURE_FORMAT Format, uint32_t Buffers,
+		SUVDA_CAPTURE_QUEUE_POLICY Policy = SUVDA_CAPTURE_QUEUE_DROP_NEWEST, uint32_t TimeoutMs = 0)
+	{
+		return FRAME_CAPTURE_CONFIG{ Format, Buffers, Policy, TimeoutMs, 60000, 1001, 10000000, 0 };
+	}
+
+	// Slots hold an atomic and can't be copied, frames are passed around by pointer
+	struct TestFrame
+	{
+		SUVDA_FRAME_SLOT Desc{};
+		std::vector<uint8_t> Pixels;
+	};
+
+	std::unique_ptr<TestFrame> MakeFrame(uint64_t Number, uint32_t Width, uint32_t Height, uint32_t Format = SUVDA_FRAME_FORMAT_BGRA8)
+	{
+		auto pFrame = std::make_unique<TestFrame>();
+		auto& Frame = *pFrame;
+		Frame.Desc.FrameNumber = Number;
+		Frame.Desc.PresentQpc = 1000 + Number * 166833;
+		Frame.Desc.Width = Width;
+		Frame.Desc.Height = Height;
+		Frame.Desc.Pitch = Width * FrameFormatBytesPerPixel(Format);
+		Frame.Desc.Format = Format;
+		Frame.Desc.Flags = (uint32_t)Number & SUVDA_FRAME_FLAG_UNCHANGED;
+		Frame.Desc.DataSize = (uint64_t)Frame.Desc.Pitch * Height;
+		Frame.Pixels.resize((size_t)Frame.Desc.DataSize);
+		for (size_t i = 0; i < Frame.Pixels.size(); i++)
+		{
+			Frame.Pixels[i] = (uint8_t)(i * 7 + Number * 13);
+		}
+		return pFrame;
+	}
+
+	bool Submit(FrameCaptureWriter& Writer, const std::unique_ptr<TestFrame>& pFrame)
+	{
+		return Writer.Submit(pFrame->Desc, pFrame->Pixels.data());
+	}
+
+	void TestRaw()
+	{
+		auto Data = std::make_shared<SinkState>();
+		auto Index = std::make_shared<SinkState>();
+
+		// Raw needs an index, unknown formats are refused
+		CHECK(!FrameCaptureWriter(std::make_unique<MemorySink>(Data), nullptr, MakeConfig(SUVDA_CAPTURE_FORMAT_RAW, 4)).Start());
+		CHECK(!FrameCaptureWriter(std::make_unique<MemorySink>(Data), nullptr, MakeConfig((SUVDA_CAPTURE_FORMAT)7, 4)).Start());
+
+		FrameCaptureWriter Writer(std::make_unique<MemorySink>(Data), std::make_unique<MemorySink>(Index),
+			MakeConfig(SUVDA_CAPTURE_FORMAT_RAW, 64, SUVDA_CAPTURE_QUEUE_BLOCK, 1000));
+		CHECK(Writer.Start());
+
+		// Sizes that aren't block multiples, and a mode change to FP16 halfway through
+		std::vector<std::unique_ptr<TestFrame>> Frames;
+		for (uint64_t i = 0; i < 12; i++)
+		{
+			Frames.push_back(i < 6 ? MakeFrame(i, 33 + (uint32_t)i, 17) : MakeFrame(i, 640, 360, SUVDA_FRAME_FORMAT_RGBA16F));
+			CHECK(Submit(Writer, Frames.back()));
+		}
+		Writer.Stop();
+
+		auto Stats = Writer.Stats();
+		CHECK_EQ(Stats.FramesSubmitted, 12u);
+		CHECK_EQ(Stats.FramesWritten, 12u);
+		CHECK_EQ(Stats.FramesDropped, 0u);
+		CHECK_EQ(Stats.WriteErrors, 0u);
+		CHECK_EQ(Stats.BytesWritten, Data->Bytes.size());
+
+		// Index header, then one entry per frame pointing at aligned, zero padded data
+		CHECK_EQ(Index->Bytes.size(), sizeof(SUVDA_CAPTURE_INDEX_HEADER) + 12 * sizeof(SUVDA_CAPTURE_INDEX_ENTRY));
+		SUVDA_CAPTURE_INDEX_HEADER Header;
+		memcpy(&Header, Index->Bytes.data(), sizeof(Header));
+		CHECK_EQ(Header.Magic, (uint32_t)SUVDA_CAPTURE_INDEX_MAGIC);
+		CHECK_EQ(Header.Version, (uint32_t)SUVDA_CAPTURE_VERSION);
+		CHECK_EQ(Header.EntrySize, sizeof(SUVDA_CAPTURE_INDEX_ENTRY));
+		CHECK_EQ(Header.QpcFrequency, 10000000u);
+
+		uint64_t Offset = 0;
+		for (size_t i = 0; i < Frames.size() && i * sizeof(SUVDA_CAPTURE_INDEX_ENTRY) + sizeof(Header) < Index->Bytes.size(); i++)
+		{
+			SUVDA_CAPTURE_INDEX_ENTRY Entry;
+			memcpy(&Entry, Index->Bytes.data() + sizeof(Header) + i * sizeof(Entry), sizeof(Entry));
+			const auto& Desc = Frames[i]->Desc;
+			CHECK_EQ(Entry.FrameNumber, Desc.FrameNumber);
+			CHECK_EQ(Entry.PresentQpc, Desc.PresentQpc);
+			CHECK_EQ(Entry.Format, Desc.Format);
+			CHECK_EQ(Entry.Width, Desc.Width);
+			CHECK_EQ(Entry.Pitch, Desc.Pitch);
+			CHECK_EQ(Entry.Flags, Desc.Flags);
+			CHECK_EQ(Entry.DataSize, Desc.DataSize);
+			CHECK_EQ(Entry.DataOffset, Offset);
+			CHECK_EQ(Entry.DataOffset % SUVDA_CAPTURE_DATA_ALIGNMENT, 0u);
+			CHECK(Entry.DataOffset + CaptureAlignUp(Entry.DataSize) <= Data->Bytes.size());
+			if (Entry.DataOffset + CaptureAlignUp(Entry.DataSize) > Data->Bytes.size())
+			{
+				break;
+			}
+
+			const uint8_t* pStored = Data->Bytes.data() + Entry.DataOffset;
+			CHECK(!memcmp(pStored, Frames[i]->Pixels.data(), Frames[i]->Pixels.size()));
+			bool Padding = true;
+			for (uint64_t k = Entry.DataSize; k < CaptureAlignUp(Entry.DataSize); k++)
+			{
+				Padding &= !pStored[k];
+			}
+			CHECK(Padding);
+			Offset += CaptureAlignUp(Entry.DataSize);
+		}
+		CHECK_EQ(Offset, Data->Bytes.size());
+
+		// Raw data goes out from aligned buffers in whole blocks, as unbuffered handles require
+		bool Aligned = true;
+		for (auto Address : Data->Addresses)
+		{
+			Aligned &= Address % SUVDA_CAPTURE_DATA_ALIGNMENT == 0;
+		}
+		CHECK(Aligned);
+	}
+
+	void TestY4m()
+	{
+		auto Data = std::make_shared<SinkState>();
+		FrameCaptureWriter Writer(std::make_unique<MemorySink>(Data), nullptr,
+			MakeConfig(SUVDA_CAPTURE_FORMAT_Y4M, 8, SUVDA_CAPTURE_QUEUE_BLOCK, 1000));
+		CHECK(Writer.Start());
+
+		constexpr uint32_t Width = 37;
+		constexpr uint32_t Height = 21;
+		auto First = MakeFrame(0, Width, Height);
+		auto Second = MakeFrame(1, Width, Height);
+		CHECK(Submit(Writer, First));
+		// The stream's geometry and format are fixed by the first frame
+		CHECK(!Submit(Writer, MakeFrame(2, Width + 1, Height)));
+		CHECK(!Submit(Writer, MakeFrame(3, Width, Height, SUVDA_FRAME_FORMAT_RGBA16F)));
+		CHECK(Submit(Writer, Second));
+		Writer.Stop();
+
+		auto Stats = Writer.Stats();
+		CHECK_EQ(Stats.FramesSubmitted, 4u);
+		CHECK_EQ(Stats.FramesWritten, 2u);
+		CHECK_EQ(Stats.FramesSkipped, 2u);
+
+		std::string Header = "YUV4MPEG2 W37 H21 F60000:1001 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n";
+		size_t ChromaBytes = ((Width + 1) / 2) * ((Height + 1) / 2);
+		size_t FrameBytes = 6 + Width * Height + 2 * ChromaBytes;
+		CHECK_EQ(Data->Bytes.size(), Header.size() + 2 * FrameBytes);
+		CHECK(std::string(Data->Bytes.begin(), Data->Bytes.begin() + Header.size()) == Header);
+
+		size_t Offset = Header.size();
+		for (const auto* pFrame : { &First, &Second })
+		{
+			if (Offset + FrameBytes > Data->Bytes.size())
+			{
+				break;
+			}
+			CHECK(!memcmp(Data->Bytes.data() + Offset, "FRAME\n", 6));
+
+			std::vector<uint8_t> Planes(FrameBytes - 6);
+			uint8_t* pY = Planes.data();
+			ConvertBgraToI420((*pFrame)->Pixels.data(), (*pFrame)->Desc.Pitch, Width, Height, pY, Width,
+				pY + Width * Height, (Width + 1) / 2, pY + Width * Height + ChromaBytes, (Width + 1) / 2);
+			CHECK(!memcmp(Data->Bytes.data() + Offset + 6, Planes.data(), Planes.size()));
+			Offset += FrameBytes;
+		}
+	}
+
+	// Returns the frame numbers that reached the disk when the writer stalls on frame 0 while 1-9 are submitted
+	std::vector<uint64_t> RunStalled(SUVDA_CAPTURE_QUEUE_POLICY Policy, FRAME_CAPTURE_STATS& Stats, uint64_t MaxBufferBytes = 0)
+	{
+		auto Data = std::make_shared<SinkState>();
+		auto Index = std::make_shared<SinkState>();
+		FRAME_CAPTURE_CONFIG Config = MakeConfig(SUVDA_CAPTURE_FORMAT_RAW, 3, Policy, 30);
+		Config.MaxBufferBytes = MaxBufferBytes;
+		FrameCaptureWriter Writer(std::make_unique<MemorySink>(Data), std::make_unique<MemorySink>(Index), Config);
+		CHECK(Writer.Start());
+
+		Data->Stall(true);
+		CHECK(Submit(Writer, MakeFrame(0, 8, 8)));
+		Data->WaitForWriter();
+		for (uint64_t i = 1; i < 10; i++)
+		{
+			Submit(Writer, MakeFrame(i, 8, 8));
+		}
+		Data->Stall(false);
+		Writer.Stop();
+		Stats = Writer.Stats();
+
+		std::vector<uint64_t> Written;
+		for (size_t Offset = sizeof(SUVDA_CAPTURE_INDEX_HEADER); Offset < Index->Bytes.size(); Offset += sizeof(SUVDA_CAPTURE_INDEX_ENTRY))
+		{
+			SUVDA_CAPTURE_INDEX_ENTRY Entry;
+			memcpy(&Entry, Index->Bytes.data() + Offset, sizeof(Entry));
+			Written.push_back(Entry.FrameNumber);
+		}
+		return Written;
+	}
+
+	void TestQueuePolicies()
+	{
+		FRAME_CAPTURE_STATS Stats;
+
+		// Three buffers queue behind the stalled write, the rest is dropped without being copied
+		auto Written = RunStalled(SUVDA_CAPTURE_QUEUE_DROP_NEWEST, Stats);
+		CHECK(Written == std::vector<uint64_t>({ 0, 1, 2, 3 }));
+		CHECK_EQ(Stats.FramesDropped, 6u);
+		CHECK_EQ(Stats.Queue.DroppedNewest, 6u);
+		CHECK_EQ(Stats.FramesWritten + Stats.FramesDropped, Stats.FramesSubmitted);
+
+		// The most recent frames replace the queued ones
+		Written = RunStalled(SUVDA_CAPTURE_QUEUE_DROP_OLDEST, Stats);
+		CHECK(Written == std::vector<uint64_t>({ 0, 7, 8, 9 }));
+		CHECK_EQ(Stats.FramesDropped, 6u);
+		CHECK_EQ(Stats.Queue.DroppedOldest, 6u);
+
+		// Every blocked submit waits out its timeout, then gives up on the frame
+		uint64_t Start = SudoVdaTest::NowNs();
+		Written = RunStalled(SUVDA_CAPTURE_QUEUE_BLOCK, Stats);
+		uint64_t ElapsedMs = (SudoVdaTest::NowNs() - Start) / 1000000;
+		CHECK(Written == std::vector<uint64_t>({ 0, 1, 2, 3 }));
+		CHECK_EQ(Stats.Queue.TimedOut, 6u);
+		CHECK_EQ(Stats.FramesDropped, 6u);
+		CHECK(ElapsedMs >= 6 * 30);
+	}
+
+	// 8x8 frames take one aligned block each and the budget has room for two, the one being written and one queued.
+	// The other buffers are retired and the policies apply as if the queue held a single frame.
+	void TestBufferBudget()
+	{
+		const uint64_t Budget = SUVDA_CAPTURE_DATA_ALIGNMENT * 5 / 2;
+		FRAME_CAPTURE_STATS Stats;
+
+		auto Written = RunStalled(SUVDA_CAPTURE_QUEUE_DROP_NEWEST, Stats, Budget);
+		CHECK(Written == std::vector<uint64_t>({ 0, 1 }));
+		CHECK_EQ(Stats.FramesDropped, 8u);
+		CHECK_EQ(Stats.Queue.DroppedNewest, 8u);
+
+		Written = RunStalled(SUVDA_CAPTURE_QUEUE_DROP_OLDEST, Stats, Budget);
+		CHECK(Written == std::vector<uint64_t>({ 0, 9 }));
+		CHECK_EQ(Stats.FramesDropped, 8u);
+		CHECK_EQ(Stats.Queue.DroppedOldest, 8u);
+
+		Written = RunStalled(SUVDA_CAPTURE_QUEUE_BLOCK, Stats, Budget);
+		CHECK(Written == std::vector<uint64_t>({ 0, 1 }));
+		CHECK_EQ(Stats.FramesDropped, 8u);
+		CHECK_EQ(Stats.Queue.TimedOut, 8u);
+		CHECK_EQ(Stats.FramesWritten + Stats.FramesDropped, Stats.FramesSubmitted);
+
+		// A frame larger than the whole budget still gets a buffer, as long as it is the only one holding memory
+		auto Data = std::make_shared<SinkState>();
+		auto Index = std::make_shared<SinkState>();
+		FRAME_CAPTURE_CONFIG Config = MakeConfig(SUVDA_CAPTURE_FORMAT_RAW, 8, SUVDA_CAPTURE_QUEUE_BLOCK, 1000);
+		Config.MaxBufferBytes = 1000;
+		FrameCaptureWriter Writer(std::make_unique<MemorySink>(Data), std::make_unique<MemorySink>(Index), Config);
+		CHECK(Writer.Start());
+		for (uint64_t i = 0; i < 4; i++)
+		{
+			CHECK(Submit(Writer, MakeFrame(i, 64, 64)));
+		}
+		Writer.Stop();
+		CHECK_EQ(Writer.Stats().FramesWritten, 4u);
+		CHECK_EQ(Data->Bytes.size(), 4 * CaptureAlignUp(64 * 64 * 4));
+	}
+
+	void TestWriteErrors()
+	{
+		auto Data = std::make_shared<SinkState>();
+		auto Index = std::make_shared<SinkState>();
+		Data->FailAfter = 1;
+		FrameCaptureWriter Writer(std::make_unique<MemorySink>(Data), std::make_unique<MemorySink>(Index),
+			MakeConfig(SUVDA_CAPTURE_FORMAT_RAW, 8, SUVDA_CAPTURE_QUEUE_BLOCK, 1000));
+		CHECK(Writer.Start());
+		for (uint64_t i = 0; i < 5; i++)
+		{
+			CHECK(Submit(Writer, MakeFrame(i, 16, 16)));
+		}
+		Writer.Stop();
+
+		// After the failed write nothing else touches the file, every later frame counts as an error
+		auto Stats = Writer.Stats();
+		CHECK_EQ(Stats.FramesWritten, 1u);
+		CHECK_EQ(Stats.WriteErrors, 4u);
+		CHECK_EQ(Data->Bytes.size(), CaptureAlignUp(16 * 16 * 4));
+		CHECK_EQ(Index->Bytes.size(), sizeof(SUVDA_CAPTURE_INDEX_HEADER) + sizeof(SUVDA_CAPTURE_INDEX_ENTRY));
+
+		// Submitting after Stop() drops the frame
+		CHECK(!Submit(Writer, MakeFrame(5, 16, 16)));
+	}
+
+	void TestFileNames()
+	{
+		CHECK(IsCaptureFileName(L"capture.raw"));
+		CHECK(IsCaptureFileName(L"2024-08-01 12.00 #1.y4m"));
+		CHECK(IsCaptureFileName(L".trace"));
+
+		// Anything that could leave the capture directory or name a stream
+		const wchar_t* Invalid[] = { L"", L"..", L"..capture", L"a..b", L"sub\\capture.raw", L"sub/capture.raw",
+			L"C:capture.raw", L"\\\\server\\share\\capture.raw", L"capture.raw:stream", L"line\nbreak" };
+		for (const wchar_t* pName : Invalid)
+		{
+			CHECK(!IsCaptureFileName(pName));
+		}
+	}
+}
+
+int main()
+{
+	TestRaw();
+	TestY4m();
+	TestQueuePolicies();
+	TestBufferBudget();
+	TestWriteErrors();
+	TestFileNames();
+	return TEST_RESULT();
+}
@@ -0,0 +1,204 @@
+// FrameDecimator against simulated sources: kept frame counts over ten minutes, the frame steps that average
+// fractional ratios, jittered presentation times, idle periods up to a year at extreme rates and the union of several
+// consumers.
+
+#include "TestHarness.h"
+#include "FrameDecimator.h"
+
+#include <map>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	class FakeClock : public IPacingClock
+	{
+	public:
+		uint64_t Now() override
+		{
+			return 0;
+		}
+
+		uint64_t Frequency() override
+		{
+			return 10000000;
+		}
+	};
+
+	// Offers Seconds of a SourceNum/SourceDen Hz source to a single consumer at TargetNum/TargetDen fps, with
+	// presentation times shifted by up to Jitter ticks. The kept count must match the target rate over the whole run,
+	// not drift with the source, and the steps between kept frames must be the two whole numbers around the ratio.
+	void Run(uint32_t SourceNum, uint32_t SourceDen, uint32_t TargetNum, uint32_t TargetDen, uint64_t Seconds, uint64_t Jitter = 0)
+	{
+		FakeClock Clock;
+		FrameDecimatorSet Set(Clock);
+		Set.SetSourceRate(SourceNum, SourceDen);
+		Set.Configure(0, TargetNum, TargetDen);
+
+		uint64_t Frequency = Clock.Frequency();
+		uint64_t Frames = Seconds * SourceNum / SourceDen;
+		std::map<uint64_t, uint64_t> Steps;
+		uint64_t Kept = 0;
+		uint64_t Last = 0;
+		uint64_t Random = 1;
+		for (uint64_t k = 0; k < Frames; k++)
+		{
+			uint64_t Ticks = 1000000 + k * Frequency * SourceDen / SourceNum;
+			if (Jitter)
+			{
+				Random = Random * 6364136223846793005ull + 1442695040888963407ull;
+				Ticks += (Random >> 33) % Jitter;
+			}
+
+			if (Set.ShouldKeep(Ticks))
+			{
+				if (Kept++)
+				{
+					Steps[k - Last]++;
+				}
+				Last = k;
+			}
+		}
+
+		// The slower of the two rates sets the count
+		bool Decimating = (uint64_t)TargetNum * SourceDen < (uint64_t)SourceNum * TargetDen;
+		uint64_t Expected = Decimating ? Seconds * TargetNum / TargetDen : Frames;
+		CHECK(Kept + 2 >= Expected && Kept <= Expected + 2);
+		CHECK_EQ(Set.Stats().Kept, Kept);
+		CHECK_EQ(Set.Stats().Skipped, Frames - Kept);
+
+		if (Decimating)
+		{
+			uint64_t Ratio = (uint64_t)SourceNum * TargetDen / ((uint64_t)TargetNum * SourceDen);
+			CHECK(Steps.size() <= 2);
+			for (auto& Step : Steps)
+			{
+				CHECK(Step.first >= Ratio && Step.first <= Ratio + 1);
+			}
+		}
+		else
+		{
+			CHECK(Steps.size() == 1 && Steps.begin()->first == 1);
+		}
+	}
+
+	void TestRates()
+	{
+		// 59.94 Hz to 30 fps averages 30, not 29.97
+		Run(60000, 1001, 30, 1, 600);
+		Run(60000, 1001, 30000, 1001, 600);
+		// 143.9 Hz mixes 2 and 3 frame steps, or 4 and 5
+		Run(1439, 10, 60, 1, 600);
+		Run(1439, 10, 30, 1, 600);
+		Run(1439, 10, 60000, 1001, 600);
+		Run(240, 1, 60, 1, 600);
+		Run(240, 1, 144, 1, 60);
+		// A target above the source keeps every frame
+		Run(60, 1, 120, 1, 60);
+		// Presentation jitter of up to 0.5 ms
+		Run(240, 1, 60, 1, 600, 5000);
+		Run(1439, 10, 60, 1, 600, 2000);
+	}
+
+	// Deadlines missed while the display is idle are skipped, and the grid keeps its phase
+	void TestIdle()
+	{
+		FakeClock Clock;
+		FrameDecimatorSet Set(Clock);
+		Set.SetSourceRate(240, 1);
+		Set.Configure(0, 60, 1);
+		uint64_t Period = Clock.Frequency() / 240;
+
+		CHECK(Set.ShouldKeep(0));
+		CHECK(!Set.ShouldKeep(Period));
+		CHECK(!Set.IsOverdue(3 * Period));
+		CHECK(Set.IsOverdue(4 * Period + Period / 2 + 10));
+		CHECK_EQ(Set.TimeUntilOverdue(4 * Period + Period / 2 + 10), 0u);
+
+		// 1000.25 target periods later the frame is kept, the next one is due at 1001
+		CHECK(Set.ShouldKeep(4 * Period * 1000 + Period));
+		CHECK(!Set.ShouldKeep(4 * Period * 1000 + 2 * Period));
+		CHECK(Set.ShouldKeep(4 * Period * 1001));
+	}
+
+	// Rates above the clock's frequency, and fractions whose products with the idle time overflow 64 bits, catch up
+	// with the grid in a single step
+	void TestLongIdle()
+	{
+		FakeClock Clock;
+		FrameDecimatorSet Set(Clock);
+		Set.SetSourceRate(240, 1);
+		uint64_t Day = Clock.Frequency() * 86400;
+		uint64_t Tolerance = Clock.Frequency() / 240 / 2;
+
+		// A period shorter than a tick keeps every frame
+		Set.Configure(0, 4000000000u, 1);
+		const uint64_t Times[] = { 0, 41666, Day, Day + 41666, 365 * Day };
+		bool AllKept = true;
+		for (uint64_t Ticks : Times)
+		{
+			AllKept &= Set.ShouldKeep(Ticks);
+		}
+		CHECK(AllKept);
+
+		// Exactly 30 Hz, the deadlines are at k * 1000000 / 3 ticks
+		Set.Configure(0, 3000000000u, 100000000u);
+		uint64_t Start = SudoVdaTest::NowNs();
+		CHECK(Set.ShouldKeep(0));
+		uint64_t Now = 365 * Day + 12345;
+		CHECK(Set.ShouldKeep(Now));
+		uint64_t Deadline = (Now + Tolerance) * 3 / 1000000 + 1;
+		uint64_t Due = (Deadline * 1000000 + 2) / 3;
+		CHECK(!Set.ShouldKeep(Due - Tolerance - 1));
+		CHECK(Set.ShouldKeep(Due - Tolerance));
+		CHECK(SudoVdaTest::NowNs() - Start < 100000000);
+	}
+
+	// A frame is exported when any consumer needs it, and with no consumer every frame is
+	void TestConsumers()
+	{
+		FakeClock Clock;
+		FrameDecimatorSet Set(Clock);
+		CHECK(!Set.IsEnabled());
+		CHECK(Set.ShouldKeep(5));
+		CHECK_EQ(Set.TimeUntilOverdue(5), UINT64_MAX);
+
+		Set.SetSourceRate(240, 1);
+		Set.Configure(0, 30, 1);
+		Set.Configure(3, 60, 1);
+		CHECK(Set.IsEnabled());
+		uint64_t Period = Clock.Frequency() / 240;
+		int Kept = 0;
+		for (int i = 0; i < 240; i++)
+		{
+			Kept += Set.ShouldKeep(i * Period);
+		}
+		CHECK_EQ(Kept, 60);
+
+		// The remaining consumer's grid isn't disturbed by the other one leaving
+		Set.Configure(3, 0, 0);
+		Kept = 0;
+		for (int i = 240; i < 480; i++)
+		{
+			Kept += Set.ShouldKeep(i * Period);
+		}
+		CHECK_EQ(Kept, 30);
+
+		Set.Configure(0, 0, 0);
+		CHECK(!Set.IsEnabled());
+		CHECK(Set.ShouldKeep(480 * Period + 1));
+
+		// Out of range consumers are ignored
+		Set.Configure(FrameDecimatorSet::MaxConsumers, 30, 1);
+		CHECK(!Set.IsEnabled());
+	}
+}
+
+int main()
+{
+	TestRates();
+	TestIdle();
+	TestLongIdle();
+	TestConsumers();
+	return TEST_RESULT();
+}
@@ -0,0 +1,114 @@
+// Region hashing: the dispatched paths (SSE2 or AVX2 on x64, NEON on ARM64) agree with the scalar reference for every
+// row length and stripe remainder, and the hash reacts to the changes duplicate detection must not miss.
+
+#include "TestHarness.h"
+#include "FrameHash.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	void TestPathsAgree()
+	{
+		std::mt19937 Random(5);
+		constexpr size_t Pitch = 1100;
+		std::vector<uint8_t> Buffer(Pitch * 70);
+		for (auto& Value : Buffer)
+		{
+			Value = (uint8_t)Random();
+		}
+
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON };
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertSetIsa(Isa))
+			{
+				continue;
+			}
+
+			bool Agree = true;
+			for (uint32_t RowBytes : { 0u, 1u, 4u, 60u, 63u, 64u, 65u, 68u, 127u, 200u, 256u, 1024u })
+			{
+				for (uint32_t Rows : { 0u, 1u, 3u, 64u, 70u })
+				{
+					// Unaligned start as well
+					for (size_t Offset : { (size_t)0, (size_t)3 })
+					{
+						Agree &= HashRegion(Buffer.data() + Offset, Pitch, RowBytes, Rows) ==
+							HashRegionScalar(Buffer.data() + Offset, Pitch, RowBytes, Rows);
+					}
+				}
+			}
+			CHECK(Agree);
+		}
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	}
+
+	void TestSensitivity()
+	{
+		std::mt19937 Random(9);
+		constexpr uint32_t RowBytes = 256;
+		constexpr uint32_t Rows = 64;
+		std::vector<uint8_t> Tile(RowBytes * Rows);
+		for (auto& Value : Tile)
+		{
+			Value = (uint8_t)Random();
+		}
+		uint64_t Original = HashRegion(Tile.data(), RowBytes, RowBytes, Rows);
+
+		// Same bytes, same hash, whatever the surrounding pitch
+		std::vector<uint8_t> Padded(RowBytes * 3 * Rows, 0x5a);
+		for (uint32_t Row = 0; Row < Rows; Row++)
+		{
+			std::copy_n(&Tile[Row * RowBytes], RowBytes, &Padded[Row * RowBytes * 3]);
+		}
+		CHECK_EQ(HashRegion(Padded.data(), RowBytes * 3, RowBytes, Rows), Original);
+
+		// Every single bit flip anywhere in the tile changes the hash
+		bool AllFlipsDetected = true;
+		for (size_t Byte = 0; Byte < Tile.size(); Byte += 7)
+		{
+			for (int Bit = 0; Bit < 8; Bit++)
+			{
+				Tile[Byte] ^= (uint8_t)(1 << Bit);
+				AllFlipsDetected &= HashRegion(Tile.data(), RowBytes, RowBytes, Rows) != Original;
+				Tile[Byte] ^= (uint8_t)(1 << Bit);
+			}
+		}
+		CHECK(AllFlipsDetected);
+
+		// Swapped rows and swapped stripes within a row are detected
+		std::swap_ranges(Tile.begin(), Tile.begin() + RowBytes, Tile.begin() + RowBytes);
+		CHECK(HashRegion(Tile.data(), RowBytes, RowBytes, Rows) != Original);
+		std::swap_ranges(Tile.begin(), Tile.begin() + RowBytes, Tile.begin() + RowBytes);
+		CHECK_EQ(HashRegion(Tile.data(), RowBytes, RowBytes, Rows), Original);
+		std::swap_ranges(Tile.begin(), Tile.begin() + 64, Tile.begin() + 64);
+		CHECK(HashRegion(Tile.data(), RowBytes, RowBytes, Rows) != Original);
+
+		// Uniform tiles of different colors, the common case on a desktop, don't collide
+		std::vector<uint64_t> Hashes;
+		for (int Color = 0; Color < 256; Color++)
+		{
+			std::fill(Tile.begin(), Tile.end(), (uint8_t)Color);
+			Hashes.push_back(HashRegion(Tile.data(), RowBytes, RowBytes, Rows));
+		}
+		std::sort(Hashes.begin(), Hashes.end());
+		CHECK(std::adjacent_find(Hashes.begin(), Hashes.end()) == Hashes.end());
+
+		// The region's shape is part of the hash
+		std::fill(Tile.begin(), Tile.end(), 0);
+		CHECK(HashRegion(Tile.data(), 128, 128, 128) != HashRegion(Tile.data(), 256, 256, 64));
+	}
+}
+
+int main()
+{
+	TestPathsAgree();
+	TestSensitivity();
+	return TEST_RESULT();
+}
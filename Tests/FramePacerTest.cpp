@@ -0,0 +1,195 @@
+// FramePacer against a synthetic IPacingClock: vblank grid placement for whole and fractional rates, reanchoring,
+// stalls, and wake statistics.
+
+#include "TestHarness.h"
+#include "FramePacer.h"
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	class FakeClock : public IPacingClock
+	{
+	public:
+		explicit FakeClock(uint64_t Frequency) : m_Frequency(Frequency)
+		{
+		}
+
+		uint64_t Now() override
+		{
+			return Tick;
+		}
+
+		uint64_t Frequency() override
+		{
+			return m_Frequency;
+		}
+
+		uint64_t Tick = 1000;
+
+	private:
+		uint64_t m_Frequency;
+	};
+
+	// QPC runs at 10 MHz on current Windows versions
+	constexpr uint64_t Qpc = 10000000;
+
+	// Exact tick of vblank Index on a grid anchored at Anchor, rounded up like the pacer does
+	uint64_t ExactVblank(uint64_t Anchor, uint64_t Index, uint32_t Numerator, uint32_t Denominator)
+	{
+		uint64_t Ticks = Index * Qpc * Denominator;
+		return Anchor + (Ticks + Numerator - 1) / Numerator;
+	}
+
+	void TestFallback()
+	{
+		FakeClock Clock(Qpc);
+		FramePacer Pacer(Clock);
+		CHECK(!Pacer.IsPaced());
+		CHECK_EQ(Pacer.NextDeadline(), Clock.Tick + Qpc * FramePacer::FallbackIntervalMs / 1000);
+		CHECK_EQ(Pacer.TimeUntilDeadlineMs(), FramePacer::FallbackIntervalMs);
+
+		Pacer.SetRefreshRate(60, 0);
+		CHECK(!Pacer.IsPaced());
+		Pacer.SetRefreshRate(0, 1);
+		CHECK(!Pacer.IsPaced());
+	}
+
+	void TestGrid(uint32_t Numerator, uint32_t Denominator)
+	{
+		FakeClock Clock(Qpc);
+		FramePacer Pacer(Clock);
+		uint64_t Anchor = Clock.Tick;
+		Pacer.SetRefreshRate(Numerator, Denominator);
+		CHECK(Pacer.IsPaced());
+
+		// Waking exactly at each deadline yields the next vblank, and the grid doesn't drift over a simulated hour
+		uint64_t Frames = (uint64_t)Numerator * 3600 / Denominator;
+		uint64_t Checked = 0;
+		for (uint64_t Index = 1; Index <= Frames; Index++)
+		{
+			uint64_t Deadline = Pacer.NextDeadline();
+			if (Deadline != ExactVblank(Anchor, Index, Numerator, Denominator))
+			{
+				CHECK_EQ(Deadline, ExactVblank(Anchor, Index, Numerator, Denominator));
+				break;
+			}
+			Clock.Tick = Deadline;
+			Checked++;
+		}
+		CHECK_EQ(Checked, Frames);
+	}
+
+	void TestWaits()
+	{
+		FakeClock Clock(Qpc);
+		FramePacer Pacer(Clock);
+		Pacer.SetRefreshRate(60, 1);
+
+		// 166666.67 ticks per frame: the deadline is rounded up, the millisecond wait as well
+		CHECK_EQ(Pacer.TimeUntilDeadline(), 166667u);
+		CHECK_EQ(Pacer.TimeUntilDeadlineMs(), 17u);
+		Clock.Tick += 166667 - 10000;
+		CHECK_EQ(Pacer.TimeUntilDeadline(), 10000u);
+		CHECK_EQ(Pacer.TimeUntilDeadlineMs(), 1u);
+
+		// Setting the same rate again keeps the phase
+		Pacer.SetRefreshRate(60, 1);
+		CHECK_EQ(Pacer.TimeUntilDeadline(), 10000u);
+
+		// A present timestamp moves the grid, a zero one is ignored
+		Pacer.OnFrame(Clock.Tick - 1000);
+		CHECK_EQ(Pacer.TimeUntilDeadline(), 166667u - 1000);
+		Pacer.OnFrame(0);
+		CHECK_EQ(Pacer.TimeUntilDeadline(), 166667u - 1000);
+
+		// A present timestamp from the future is waited for
+		Pacer.OnFrame(Clock.Tick + 5000);
+		CHECK_EQ(Pacer.NextDeadline(), Clock.Tick + 5000);
+
+		// A new rate restarts the grid now
+		Pacer.SetRefreshRate(120, 1);
+		CHECK_EQ(Pacer.TimeUntilDeadline(), 83334u);
+	}
+
+	void TestStalls()
+	{
+		FakeClock Clock(Qpc);
+		FramePacer Pacer(Clock);
+		Pacer.SetRefreshRate(480, 1);
+
+		// Past 2^20 frames (some 36 minutes at 480 Hz) the anchor moves forward, the phase stays within a tick per move
+		uint64_t Anchor = Clock.Tick;
+		uint64_t Index = (1u << 20) + 12345;
+		Clock.Tick = ExactVblank(Anchor, Index, 480, 1) - 1;
+		uint64_t Deadline = Pacer.NextDeadline();
+		uint64_t Exact = ExactVblank(Anchor, Index, 480, 1);
+		CHECK(Deadline >= Exact && Deadline <= Exact + 1);
+		CHECK(Deadline > Clock.Tick);
+
+		// After more than an hour without frames (sleep, hibernation) the grid restarts at the wake
+		Clock.Tick += Qpc * 3600 * 5 + 777;
+		CHECK_EQ(Pacer.NextDeadline(), Clock.Tick + (Qpc + 479) / 480);
+	}
+
+	void TestStats()
+	{
+		FakeClock Clock(Qpc);
+		FramePacer Pacer(Clock);
+
+		// No deadline yet, the wake is only counted
+		Pacer.OnWake(PACER_WAKE_DEADLINE);
+		CHECK_EQ(Pacer.Stats().Wakes[PACER_WAKE_DEADLINE], 1u);
+		CHECK_EQ(Pacer.Stats().TotalLatenessTicks, 0u);
+
+		Pacer.SetRefreshRate(100, 1);
+
+		// Early and on-time wakes are not late
+		uint64_t Deadline = Pacer.NextDeadline();
+		Clock.Tick = Deadline - 50;
+		Pacer.OnWake(PACER_WAKE_DEADLINE);
+		CHECK_EQ(Pacer.Stats().MaxLatenessTicks, 0u);
+
+		// A quarter period (25000 ticks) late is tolerated, one tick more is a late wake
+		Deadline = Pacer.NextDeadline();
+		Clock.Tick = Deadline + 25000;
+		Pacer.OnWake(PACER_WAKE_DEADLINE);
+		CHECK_EQ(Pacer.Stats().LateWakes, 0u);
+		Clock.Tick = Deadline + 25001;
+		Pacer.OnWake(PACER_WAKE_DEADLINE);
+		CHECK_EQ(Pacer.Stats().LateWakes, 1u);
+		CHECK_EQ(Pacer.Stats().MaxLatenessTicks, 25001u);
+		CHECK_EQ(Pacer.Stats().TotalLatenessTicks, 50001u);
+
+		// New surface wakes don't count towards lateness
+		Clock.Tick += Qpc;
+		Pacer.OnWake(PACER_WAKE_NEW_SURFACE);
+		CHECK_EQ(Pacer.Stats().Wakes[PACER_WAKE_NEW_SURFACE], 1u);
+		CHECK_EQ(Pacer.Stats().Wakes[PACER_WAKE_DEADLINE], 4u);
+		CHECK_EQ(Pacer.Stats().LateWakes, 1u);
+
+		// A timeout before the deadline is a poll, neither a deadline wake nor late
+		Deadline = Pacer.NextDeadline();
+		CHECK_EQ(Pacer.TimeoutReason(Deadline - 1), PACER_WAKE_POLL);
+		CHECK_EQ(Pacer.TimeoutReason(Deadline), PACER_WAKE_DEADLINE);
+		Clock.Tick = Deadline - 1;
+		Pacer.OnWake(Pacer.TimeoutReason(Clock.Tick));
+		CHECK_EQ(Pacer.Stats().Wakes[PACER_WAKE_POLL], 1u);
+		CHECK_EQ(Pacer.Stats().Wakes[PACER_WAKE_DEADLINE], 4u);
+		CHECK_EQ(Pacer.Stats().TotalLatenessTicks, 50001u);
+	}
+}
+
+int main()
+{
+	TestFallback();
+	TestGrid(60, 1);
+	TestGrid(60000, 1001);
+	TestGrid(144, 1);
+	TestGrid(240, 1);
+	TestGrid(500, 1);
+	TestWaits();
+	TestStalls();
+	TestStats();
+	return TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+// Frame ring throughput at 8K/240 Hz, the largest mode the driver exports.
+//
+// Reports the producer's cost to publish a full frame and a damaged tile, and what a consumer taking the latest frame
+// receives while the producer is paced to 240 Hz. Copy speed depends on the machine, so the numbers are only
+// reported. What is checked is that the protocol itself costs a negligible part of the 4.17 ms frame budget and that
+// the paced consumer accounts for every frame.
+
+#include "TestHarness.h"
+#include "sudovda-frame.h"
+
+#include <thread>
+#include <vector>
+
+using namespace SUDOVDA;
+
+namespace
+{
+	constexpr uint32_t Width = 7680;
+	constexpr uint32_t Height = 4320;
+	constexpr uint32_t Pitch = Width * 4;
+	constexpr uint64_t FrameSize = (uint64_t)Pitch * Height;
+	constexpr uint32_t SlotCount = 4;
+	constexpr uint64_t FrameBudgetNs = 1000000000ull / 240;
+
+	// Copies Rows x Columns pixels from the source surface into the next slot and publishes it
+	void PublishRegion(FrameRingWriter& Writer, const uint8_t* pSource, uint32_t Columns, uint32_t Rows)
+	{
+		SUVDA_FRAME_SLOT* pSlot;
+		uint8_t* pData = Writer.BeginFrame(pSlot);
+		pSlot->Width = Width;
+		pSlot->Height = Height;
+		pSlot->Pitch = Pitch;
+		pSlot->Format = SUVDA_FRAME_FORMAT_BGRA8;
+		pSlot->DataSize = FrameSize;
+		pSlot->DamageRectCount = 1;
+		pSlot->DamageRects[0] = { 0, 0, (int32_t)Columns, (int32_t)Rows };
+		for (uint32_t Row = 0; Row < Rows; Row++)
+		{
+			memcpy(pData + (uint64_t)Row * Pitch, pSource + (uint64_t)Row * Pitch, (size_t)Columns * 4);
+		}
+		Writer.PublishFrame();
+	}
+
+	void Report(const char* Name, uint64_t Frames, uint64_t ElapsedNs, uint64_t BytesPerFrame)
+	{
+		double PerFrameMs = ElapsedNs / 1e6 / Frames;
+		double GBps = (double)BytesPerFrame * Frames / ElapsedNs;
+		printf("%-28s %8.3f ms/frame %7.2f GB/s %6.1f%% of the 240 Hz budget\n", Name, PerFrameMs, GBps,
+			100.0 * ElapsedNs / Frames / FrameBudgetNs);
+	}
+}
+
+int main()
+{
+	std::vector<uint8_t> Source(FrameSize);
+	for (uint64_t i = 0; i < FrameSize; i++)
+	{
+		Source[i] = (uint8_t)(i * 31);
+	}
+
+	std::vector<uint8_t> Mapping(FrameRingRequiredSize(SlotCount, FrameSize));
+	FrameRingWriter Writer;
+	CHECK(Writer.Initialize(Mapping.data(), Mapping.size(), SlotCount, FrameSize));
+
+	// Touch every slot once so page faults don't count against the first frames
+	for (uint32_t i = 0; i < SlotCount; i++)
+	{
+		PublishRegion(Writer, Source.data(), Width, Height);
+	}
+
+	constexpr uint64_t FullFrames = 48;
+	uint64_t Start = SudoVdaTest::NowNs();
+	for (uint64_t i = 0; i < FullFrames; i++)
+	{
+		PublishRegion(Writer, Source.data(), Width, Height);
+	}
+	uint64_t FullNs = SudoVdaTest::NowNs() - Start;
+	Report("full 8K frame", FullFrames, FullNs, FrameSize);
+
+	constexpr uint64_t TileFrames = 20000;
+	Start = SudoVdaTest::NowNs();
+	for (uint64_t i = 0; i < TileFrames; i++)
+	{
+		PublishRegion(Writer, Source.data(), 256, 256);
+	}
+	uint64_t TileNs = SudoVdaTest::NowNs() - Start;
+	Report("256x256 damage", TileFrames, TileNs, 256 * 256 * 4);
+
+	constexpr uint64_t EmptyFrames = 1000000;
+	Start = SudoVdaTest::NowNs();
+	for (uint64_t i = 0; i < EmptyFrames; i++)
+	{
+		PublishRegion(Writer, Source.data(), 0, 0);
+	}
+	uint64_t EmptyNs = SudoVdaTest::NowNs() - Start;
+	Report("protocol only", EmptyFrames, EmptyNs, 0);
+	CHECK(EmptyNs / EmptyFrames < FrameBudgetNs / 100);
+
+	// One second of 240 Hz with a 256x256 damaged region per frame, against a consumer taking the latest frame
+	FrameRingReader Reader;
+	CHECK(Reader.Attach(Mapping.data(), Mapping.size()));
+	uint64_t First = Writer.FramesPublished();
+	constexpr uint64_t PacedFrames = 240;
+	std::thread Producer([&] {
+		uint64_t Due = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < PacedFrames; i++)
+		{
+			Due += FrameBudgetNs;
+			PublishRegion(Writer, Source.data(), 256, 256);
+			while (SudoVdaTest::NowNs() < Due)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		}
+	});
+
+	uint64_t Received = 0;
+	uint64_t LatencyNs = 0;
+	std::vector<uint8_t> Copy(256 * 4);
+	while (Reader.ReadIndex() < First + PacedFrames)
+	{
+		SUVDA_FRAME_SLOT Desc;
+		const uint8_t* pData;
+		uint64_t Begin = SudoVdaTest::NowNs();
+		if (Reader.AcquireLatest(Desc, pData) != FrameRingReader::ACQUIRE_OK)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			continue;
+		}
+		memcpy(Copy.data(), pData, Copy.size());
+		if (Reader.Release())
+		{
+			Received++;
+			LatencyNs += SudoVdaTest::NowNs() - Begin;
+		}
+	}
+	Producer.join();
+
+	printf("paced 240 Hz consumer        %llu received, %llu dropped, %llu torn, %.1f us per acquire\n",
+		(unsigned long long)Received, (unsigned long long)Reader.DroppedFrames(),
+		(unsigned long long)Reader.TornFrames(), Received ? LatencyNs / 1e3 / Received : 0.0);
+	CHECK(Received > 0);
+	CHECK_EQ(Received + Reader.DroppedFrames() + Reader.TornFrames(), PacedFrames);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,291 @@
+// Frame ring protocol tests: geometry validation, overrun and tear accounting, abandonment, and a simulated producer
+// thread publishing 8K frames while a consumer reads them.
+
+#include "TestHarness.h"
+#include "sudovda-frame.h"
+
+#include <thread>
+#include <vector>
+
+using namespace SUDOVDA;
+
+namespace
+{
+	constexpr uint32_t Width8K = 7680;
+	constexpr uint32_t Height8K = 4320;
+	constexpr uint64_t Frame8KSize = (uint64_t)Width8K * Height8K * 4;
+
+	// The producer stamps the frame number this often across the slot instead of filling all 132 MB of it, a torn
+	// read shows up as a stamp that doesn't match the descriptor
+	constexpr uint64_t StampStride = 1 << 20;
+
+	void Publish(FrameRingWriter& Writer, uint64_t DataSize, uint32_t DamageRects = 0)
+	{
+		SUVDA_FRAME_SLOT* pSlot;
+		uint8_t* pData = Writer.BeginFrame(pSlot);
+		pSlot->Width = 16;
+		pSlot->Height = 16;
+		pSlot->Pitch = 64;
+		pSlot->Format = SUVDA_FRAME_FORMAT_BGRA8;
+		pSlot->DataSize = DataSize;
+		pSlot->DamageRectCount = DamageRects;
+		for (uint32_t i = 0; i < DamageRects && i < SUVDA_FRAME_MAX_DAMAGE_RECTS; i++)
+		{
+			pSlot->DamageRects[i] = { (int32_t)i, 0, (int32_t)i + 1, 1 };
+		}
+		memset(pData, (int)(pSlot->FrameNumber & 0xff), DataSize);
+		Writer.PublishFrame();
+	}
+
+	void TestGeometry()
+	{
+		uint64_t SlotSize = 64 * 64 * 4;
+		std::vector<uint8_t> Mapping(FrameRingRequiredSize(4, SlotSize));
+		FrameRingWriter Writer;
+
+		CHECK(!Writer.Initialize(nullptr, Mapping.size(), 4, SlotSize));
+		CHECK(!Writer.Initialize(Mapping.data(), Mapping.size(), 1, SlotSize));
+		CHECK(!Writer.Initialize(Mapping.data(), Mapping.size(), SUVDA_FRAME_RING_MAX_SLOTS + 1, SlotSize));
+		CHECK(!Writer.Initialize(Mapping.data(), Mapping.size() - 1, 4, SlotSize));
+		CHECK(!Writer.IsInitialized());
+
+		SUVDA_FRAME_SLOT* pSlot;
+		CHECK(Writer.BeginFrame(pSlot) == nullptr);
+		CHECK(pSlot == nullptr);
+
+		// A reader must not attach before the writer stamped the magic
+		FrameRingReader Reader;
+		CHECK(!Reader.Attach(Mapping.data(), Mapping.size()));
+
+		CHECK(Writer.Initialize(Mapping.data(), Mapping.size(), 4, SlotSize));
+		CHECK(!Reader.Attach(Mapping.data(), sizeof(SUVDA_FRAME_RING_HEADER) - 1));
+		CHECK(!Reader.Attach(Mapping.data(), Mapping.size() - 1));
+		CHECK(Reader.Attach(Mapping.data(), Mapping.size()));
+
+		// Every slot's pixel data is aligned and inside the mapping
+		auto* pHeader = reinterpret_cast<SUVDA_FRAME_RING_HEADER*>(Mapping.data());
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			CHECK(pHeader->Slots[i].DataOffset % SUVDA_FRAME_RING_DATA_ALIGNMENT == 0);
+			CHECK(pHeader->Slots[i].DataOffset + SlotSize <= Mapping.size());
+		}
+		CHECK(pHeader->Slots[0].DataOffset >= sizeof(SUVDA_FRAME_RING_HEADER));
+	}
+
+	void TestInOrder()
+	{
+		uint64_t SlotSize = 4096;
+		std::vector<uint8_t> Mapping(FrameRingRequiredSize(4, SlotSize));
+		FrameRingWriter Writer;
+		FrameRingReader Reader;
+		CHECK(Writer.Initialize(Mapping.data(), Mapping.size(), 4, SlotSize));
+		CHECK(Reader.Attach(Mapping.data(), Mapping.size()));
+
+		SUVDA_FRAME_SLOT Desc;
+		const uint8_t* pData;
+		CHECK_EQ(Reader.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_NO_FRAME);
+		CHECK(!Reader.Release());
+		CHECK(Writer.LastPublished() == nullptr);
+
+		for (uint64_t Frame = 0; Frame < 10; Frame++)
+		{
+			Publish(Writer, 100, 2);
+			CHECK_EQ(Writer.FramesPublished(), Frame + 1);
+			CHECK_EQ(Writer.LastPublished()->FrameNumber, Frame);
+
+			CHECK_EQ(Reader.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_OK);
+			CHECK_EQ(Desc.FrameNumber, Frame);
+			CHECK_EQ(Desc.Sequence.load(), 2 * Frame + 2);
+			CHECK_EQ(Desc.DataSize, 100u);
+			CHECK_EQ(Desc.DamageRectCount, 2u);
+			CHECK_EQ(Desc.DamageRects[1].Left, 1);
+			CHECK_EQ(pData[0], Frame & 0xff);
+			CHECK_EQ(pData[99], Frame & 0xff);
+			CHECK(Reader.Release());
+			CHECK_EQ(Reader.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_NO_FRAME);
+		}
+		CHECK_EQ(Reader.DroppedFrames(), 0u);
+		CHECK_EQ(Reader.TornFrames(), 0u);
+	}
+
+	void TestOverrun()
+	{
+		uint64_t SlotSize = 4096;
+		std::vector<uint8_t> Mapping(FrameRingRequiredSize(4, SlotSize));
+		FrameRingWriter Writer;
+		FrameRingReader Next;
+		FrameRingReader Latest;
+		CHECK(Writer.Initialize(Mapping.data(), Mapping.size(), 4, SlotSize));
+		CHECK(Next.Attach(Mapping.data(), Mapping.size()));
+		CHECK(Latest.Attach(Mapping.data(), Mapping.size()));
+
+		for (int i = 0; i < 10; i++)
+		{
+			Publish(Writer, 64);
+		}
+
+		// Frames 0-5 were overwritten, AcquireNext resumes at the oldest one still in the ring
+		SUVDA_FRAME_SLOT Desc;
+		const uint8_t* pData;
+		CHECK_EQ(Next.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_OK);
+		CHECK_EQ(Desc.FrameNumber, 6u);
+		CHECK_EQ(Next.DroppedFrames(), 6u);
+		CHECK(Next.Release());
+		for (uint64_t Frame = 7; Frame < 10; Frame++)
+		{
+			CHECK_EQ(Next.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_OK);
+			CHECK_EQ(Desc.FrameNumber, Frame);
+			CHECK(Next.Release());
+		}
+		CHECK_EQ(Next.DroppedFrames(), 6u);
+
+		// AcquireLatest skips straight to the newest frame and counts the rest as dropped
+		CHECK_EQ(Latest.AcquireLatest(Desc, pData), FrameRingReader::ACQUIRE_OK);
+		CHECK_EQ(Desc.FrameNumber, 9u);
+		CHECK_EQ(Latest.DroppedFrames(), 9u);
+		CHECK_EQ(Latest.ReadIndex(), 10u);
+		CHECK(Latest.Release());
+
+		// Damage that doesn't fit is clamped, not copied past the descriptor
+		Publish(Writer, 64, SUVDA_FRAME_MAX_DAMAGE_RECTS);
+		auto* pHeader = reinterpret_cast<SUVDA_FRAME_RING_HEADER*>(Mapping.data());
+		pHeader->Slots[Writer.LastPublished() - pHeader->Slots].DamageRectCount = SUVDA_FRAME_MAX_DAMAGE_RECTS + 100;
+		CHECK_EQ(Latest.AcquireLatest(Desc, pData), FrameRingReader::ACQUIRE_OK);
+		CHECK_EQ(Desc.DamageRectCount, (uint32_t)SUVDA_FRAME_MAX_DAMAGE_RECTS);
+		CHECK(Latest.Release());
+	}
+
+	void TestTornAndAbandoned()
+	{
+		uint64_t SlotSize = 4096;
+		std::vector<uint8_t> Mapping(FrameRingRequiredSize(2, SlotSize));
+		FrameRingWriter Writer;
+		FrameRingReader Reader;
+		CHECK(Writer.Initialize(Mapping.data(), Mapping.size(), 2, SlotSize));
+		CHECK(Reader.Attach(Mapping.data(), Mapping.size()));
+
+		Publish(Writer, 64);
+		SUVDA_FRAME_SLOT Desc;
+		const uint8_t* pData;
+		CHECK_EQ(Reader.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_OK);
+
+		// The producer laps the slot while it is being read, even a claimed but unpublished frame tears it
+		Publish(Writer, 64);
+		SUVDA_FRAME_SLOT* pSlot;
+		Writer.BeginFrame(pSlot);
+		CHECK(!Reader.Release());
+		CHECK_EQ(Reader.TornFrames(), 1u);
+		Writer.PublishFrame();
+
+		// A slot whose sequence doesn't match the frame the reader expects is skipped, not returned
+		auto* pHeader = reinterpret_cast<SUVDA_FRAME_RING_HEADER*>(Mapping.data());
+		Publish(Writer, 64);
+		pHeader->Slots[3 % 2].Sequence.store(2 * 3 + 1);
+		CHECK_EQ(Reader.AcquireLatest(Desc, pData), FrameRingReader::ACQUIRE_NO_FRAME);
+		CHECK_EQ(Reader.ReadIndex(), 4u);
+
+		// A data range past the mapping is never handed out
+		Publish(Writer, 64);
+		pHeader->Slots[4 % 2].DataSize = Mapping.size();
+		CHECK_EQ(Reader.AcquireLatest(Desc, pData), FrameRingReader::ACQUIRE_NO_FRAME);
+
+		Publish(Writer, 64);
+		Writer.Abandon();
+		CHECK_EQ(Reader.AcquireLatest(Desc, pData), FrameRingReader::ACQUIRE_ABANDONED);
+		CHECK_EQ(Reader.AcquireNext(Desc, pData), FrameRingReader::ACQUIRE_ABANDONED);
+	}
+
+	// A producer thread publishing 8K frames as fast as it can against a consumer that reads every frame it can get.
+	// Every frame either reaches the consumer intact or is accounted for as dropped or torn.
+	void TestSimulatedProducer8K(bool Latest)
+	{
+		constexpr uint32_t SlotCount = 4;
+		constexpr uint64_t Frames = 2000;
+		std::vector<uint8_t> Mapping(FrameRingRequiredSize(SlotCount, Frame8KSize));
+		FrameRingWriter Writer;
+		FrameRingReader Reader;
+		CHECK(Writer.Initialize(Mapping.data(), Mapping.size(), SlotCount, Frame8KSize));
+		CHECK(Reader.Attach(Mapping.data(), Mapping.size()));
+
+		std::thread Producer([&] {
+			for (uint64_t Frame = 0; Frame < Frames; Frame++)
+			{
+				SUVDA_FRAME_SLOT* pSlot;
+				uint8_t* pData = Writer.BeginFrame(pSlot);
+				pSlot->Width = Width8K;
+				pSlot->Height = Height8K;
+				pSlot->Pitch = Width8K * 4;
+				pSlot->Format = SUVDA_FRAME_FORMAT_BGRA8;
+				pSlot->DataSize = Frame8KSize;
+				pSlot->DamageRectCount = 0;
+				pSlot->Flags = SUVDA_FRAME_FLAG_FULL_DAMAGE;
+				for (uint64_t Offset = 0; Offset + sizeof(Frame) <= Frame8KSize; Offset += StampStride)
+				{
+					memcpy(pData + Offset, &Frame, sizeof(Frame));
+				}
+				memcpy(pData + Frame8KSize - sizeof(Frame), &Frame, sizeof(Frame));
+				Writer.PublishFrame();
+
+				// Give a consumer on the same core a chance, otherwise it only ever sees the last few frames
+				if (Frame % 3 == 0)
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+
+		uint64_t Received = 0;
+		uint64_t Corrupt = 0;
+		uint64_t LastFrame = 0;
+		bool OutOfOrder = false;
+		while (Reader.ReadIndex() < Frames)
+		{
+			SUVDA_FRAME_SLOT Desc;
+			const uint8_t* pData;
+			auto Result = Latest ? Reader.AcquireLatest(Desc, pData) : Reader.AcquireNext(Desc, pData);
+			if (Result != FrameRingReader::ACQUIRE_OK)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			bool Consistent = Desc.Width == Width8K && Desc.DataSize == Frame8KSize;
+			for (uint64_t Offset = 0; Consistent && Offset + sizeof(uint64_t) <= Frame8KSize; Offset += StampStride)
+			{
+				uint64_t Stamp;
+				memcpy(&Stamp, pData + Offset, sizeof(Stamp));
+				Consistent = Stamp == Desc.FrameNumber;
+			}
+
+			// Only what survives Release() counts, a torn read is allowed to be inconsistent
+			if (Reader.Release())
+			{
+				Corrupt += !Consistent;
+				OutOfOrder |= Received && Desc.FrameNumber <= LastFrame;
+				LastFrame = Desc.FrameNumber;
+				Received++;
+			}
+		}
+		Producer.join();
+
+		printf("8K %s: %llu received, %llu dropped, %llu torn\n", Latest ? "latest" : "next",
+			(unsigned long long)Received, (unsigned long long)Reader.DroppedFrames(),
+			(unsigned long long)Reader.TornFrames());
+		CHECK_EQ(Corrupt, 0u);
+		CHECK(!OutOfOrder);
+		CHECK(Received > 0);
+		CHECK_EQ(Received + Reader.DroppedFrames() + Reader.TornFrames(), Frames);
+		CHECK_EQ(LastFrame, Frames - 1);
+	}
+}
+
+int main()
+{
+	TestGeometry();
+	TestInOrder();
+	TestOverrun();
+	TestTornAndAbandoned();
+	TestSimulatedProducer8K(false);
+	TestSimulatedProducer8K(true);
+	return TEST_RESULT();
+}
@@ -0,0 +1,186 @@
+// FrameTraceWriter: file layout, batching behind a stalled disk, write errors. Also writes a driver trace and a
+// consumer trace to the working directory, which the FrameTraceAnalyze test then analyzes.
+
+#include "TestHarness.h"
+#include "MemorySink.h"
+#include "FrameTrace.h"
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+using SudoVdaTest::MemorySink;
+using SudoVdaTest::SinkState;
+
+namespace
+{
+	constexpr uint64_t Qpc = 10000000;
+
+	// A frame at 60 Hz with plausible stage times, every 500th one a refinement pass
+	SUVDA_TRACE_RECORD MakeRecord(uint64_t FrameNumber)
+	{
+		SUVDA_TRACE_RECORD Record = {};
+		Record.FrameNumber = FrameNumber;
+		Record.Source = SUVDA_TRACE_SOURCE_DRIVER;
+		Record.PresentationFrameNumber = (uint32_t)(FrameNumber + 1);
+		Record.PresentQpc = 1000000 + FrameNumber * 166667;
+		Record.AcquireQpc = Record.PresentQpc + 200 + FrameNumber % 50;
+		Record.ProcessQpc = Record.AcquireQpc + 300;
+		Record.FinishQpc = Record.ProcessQpc + 20;
+		Record.PublishQpc = Record.AcquireQpc + 5000 + (FrameNumber % 100) * 10;
+		Record.Flags = FrameNumber % 500 == 499 ? SUVDA_FRAME_FLAG_REFINEMENT : 0;
+		return Record;
+	}
+
+	std::vector<SUVDA_TRACE_RECORD> ParseRecords(const std::vector<uint8_t>& Bytes, SUVDA_TRACE_HEADER& Header)
+	{
+		std::vector<SUVDA_TRACE_RECORD> Records;
+		if (Bytes.size() < sizeof(Header))
+		{
+			return Records;
+		}
+
+		memcpy(&Header, Bytes.data(), sizeof(Header));
+		for (size_t Offset = sizeof(Header); Offset + sizeof(SUVDA_TRACE_RECORD) <= Bytes.size(); Offset += sizeof(SUVDA_TRACE_RECORD))
+		{
+			SUVDA_TRACE_RECORD Record;
+			memcpy(&Record, Bytes.data() + Offset, sizeof(Record));
+			Records.push_back(Record);
+		}
+		return Records;
+	}
+
+	void TestLayout()
+	{
+		// Room for every record, whenever the writer thread gets to run
+		auto State = std::make_shared<SinkState>();
+		FrameTraceWriter Writer(std::make_unique<MemorySink>(State), Qpc, 4096);
+		CHECK(Writer.Start());
+		for (uint64_t i = 0; i < 3000; i++)
+		{
+			CHECK(Writer.Record(MakeRecord(i)));
+		}
+		Writer.Stop();
+		CHECK(!Writer.Record(MakeRecord(3000)));
+
+		SUVDA_TRACE_HEADER Header = {};
+		auto Records = ParseRecords(State->Bytes, Header);
+		CHECK_EQ(Header.Magic, (uint32_t)SUVDA_TRACE_MAGIC);
+		CHECK_EQ(Header.Version, (uint32_t)SUVDA_TRACE_VERSION);
+		CHECK_EQ(Header.HeaderSize, sizeof(SUVDA_TRACE_HEADER));
+		CHECK_EQ(Header.RecordSize, sizeof(SUVDA_TRACE_RECORD));
+		CHECK_EQ(Header.QpcFrequency, Qpc);
+		CHECK_EQ(State->Bytes.size(), sizeof(Header) + 3000 * sizeof(SUVDA_TRACE_RECORD));
+
+		bool InOrder = Records.size() == 3000;
+		for (size_t i = 0; InOrder && i < Records.size(); i++)
+		{
+			auto Expected = MakeRecord(i);
+			InOrder &= !memcmp(&Records[i], &Expected, sizeof(Expected));
+		}
+		CHECK(InOrder);
+
+		auto Stats = Writer.Stats();
+		CHECK_EQ(Stats.RecordsWritten, 3000u);
+		CHECK_EQ(Stats.RecordsDropped, 1u);
+		CHECK_EQ(Stats.WriteErrors, 0u);
+	}
+
+	void TestStalledDisk()
+	{
+		auto State = std::make_shared<SinkState>();
+		FrameTraceWriter Writer(std::make_unique<MemorySink>(State), Qpc, 8);
+		CHECK(Writer.Start());
+		State->Stall(true);
+
+		// Half a batch wakes the writer, which then hangs in the write
+		for (uint64_t i = 0; i < 4; i++)
+		{
+			CHECK(Writer.Record(MakeRecord(i)));
+		}
+		State->WaitForWriter();
+
+		// Meanwhile recording never waits, what doesn't fit in the batch is dropped
+		uint64_t Accepted = 0;
+		for (uint64_t i = 4; i < 24; i++)
+		{
+			Accepted += Writer.Record(MakeRecord(i));
+		}
+		CHECK_EQ(Accepted, 8u);
+		CHECK_EQ(Writer.Stats().RecordsDropped, 12u);
+
+		State->Stall(false);
+		Writer.Stop();
+		SUVDA_TRACE_HEADER Header;
+		auto Records = ParseRecords(State->Bytes, Header);
+		CHECK_EQ(Records.size(), 12u);
+		CHECK_EQ(Records.back().FrameNumber, 11u);
+		CHECK_EQ(Writer.Stats().RecordsWritten, 12u);
+	}
+
+	void TestWriteErrors()
+	{
+		auto State = std::make_shared<SinkState>();
+		State->FailAfter = 0;
+		FrameTraceWriter Failing(std::make_unique<MemorySink>(State), Qpc);
+		CHECK(!Failing.Start());
+
+		State->FailAfter = 1;
+		FrameTraceWriter Writer(std::make_unique<MemorySink>(State), Qpc);
+		CHECK(Writer.Start());
+		CHECK(Writer.Record(MakeRecord(0)));
+		Writer.Stop();
+		CHECK_EQ(Writer.Stats().WriteErrors, 1u);
+		CHECK_EQ(Writer.Stats().RecordsWritten, 0u);
+	}
+
+	// Traces for the FrameTraceAnalyze test: 2000 frames, a consumer picking up two thirds of them 100 us after publish
+	void WriteSampleTraces()
+	{
+		FILE* pDriver = fopen("driver.trace", "wb");
+		FILE* pConsumer = fopen("consumer.trace", "wb");
+		CHECK(pDriver && pConsumer);
+		if (!pDriver || !pConsumer)
+		{
+			return;
+		}
+
+		FrameTraceWriter Writer(std::make_unique<StdioCaptureSink>(pDriver), Qpc, 4096);
+		CHECK(Writer.Start());
+
+		SUVDA_TRACE_HEADER Header;
+		FillTraceHeader(Header, Qpc);
+		fwrite(&Header, sizeof(Header), 1, pConsumer);
+
+		for (uint64_t i = 0; i < 2000; i++)
+		{
+			auto Record = MakeRecord(i);
+			CHECK(Writer.Record(Record));
+
+			SUVDA_FRAME_SLOT Desc{};
+			Desc.FrameNumber = i;
+			Desc.PresentQpc = Record.PresentQpc;
+			Desc.AcquireQpc = Record.AcquireQpc;
+			Desc.PublishQpc = Record.PublishQpc;
+			Desc.Flags = Record.Flags;
+			if (i % 3)
+			{
+				SUVDA_TRACE_RECORD Pickup;
+				FillConsumerTraceRecord(Pickup, Desc, Record.PublishQpc + 1000);
+				CHECK_EQ(Pickup.Source, (uint32_t)SUVDA_TRACE_SOURCE_CONSUMER);
+				fwrite(&Pickup, sizeof(Pickup), 1, pConsumer);
+			}
+		}
+
+		Writer.Stop();
+		CHECK_EQ(Writer.Stats().RecordsWritten, 2000u);
+		fclose(pConsumer);
+	}
+}
+
+int main()
+{
+	TestLayout();
+	TestStalledDisk();
+	TestWriteErrors();
+	WriteSampleTraces();
+	return TEST_RESULT();
+}
@@ -0,0 +1,125 @@
+// Gamma ramps on 4K frames: applying a night light ramp to BGRA8 and RGB10A2 on every instruction set the CPU
+// supports, building the tables when the OS sets a ramp, and what the identity check saves against applying an
+// identity ramp anyway. The numbers depend on the machine and are only reported, what is checked is that each SIMD
+// path matches the scalar one byte for byte and that an identity ramp is detected and leaves the frame alone.
+
+#include "TestHarness.h"
+#include "GammaRamp.h"
+#include "PixelConvert.h"
+#include <sudovda-frame.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+
+namespace
+{
+	const char* IsaNames[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+	constexpr uint32_t Width = 3840;
+	constexpr uint32_t Height = 2160;
+	constexpr size_t Pitch = (size_t)Width * 4;
+	constexpr int Runs = 8;
+	constexpr int TableRuns = 1000;
+
+	GAMMA_RAMP Identity()
+	{
+		GAMMA_RAMP Ramp;
+		for (uint32_t i = 0; i < GammaRampEntries; i++)
+		{
+			Ramp.Red[i] = Ramp.Green[i] = Ramp.Blue[i] = (uint16_t)(i * 257);
+		}
+		return Ramp;
+	}
+
+	// Like night light: green and blue pulled down, and a gamma tweak on red
+	GAMMA_RAMP Warm()
+	{
+		GAMMA_RAMP Ramp;
+		for (uint32_t i = 0; i < GammaRampEntries; i++)
+		{
+			Ramp.Red[i] = (uint16_t)lround(65535 * pow(i / 255.0, 0.9));
+			Ramp.Green[i] = (uint16_t)lround(i * 257 * 0.82);
+			Ramp.Blue[i] = (uint16_t)lround(i * 257 * 0.6);
+		}
+		return Ramp;
+	}
+
+	void Run(const char* Name, uint32_t Format, const std::vector<uint8_t>& Source)
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2,
+			PIXEL_CONVERT_ISA_NEON };
+		GAMMA_RAMP Ramp = Warm();
+		std::vector<uint8_t> Frame(Source.size());
+		std::vector<uint8_t> Reference;
+
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < TableRuns; i++)
+		{
+			GammaLut Lut(Ramp, Format);
+			CHECK(!Lut.IsIdentity());
+		}
+		printf("%s, tables %.1f us\n", Name, (SudoVdaTest::NowNs() - Start) / 1e3 / TableRuns);
+
+		GammaLut Lut(Ramp, Format);
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertSetIsa(Isa))
+			{
+				continue;
+			}
+
+			// Applied in place, so every run after the first corrects an already corrected frame, which costs the same
+			memcpy(Frame.data(), Source.data(), Frame.size());
+			Lut.Apply(Frame.data(), Pitch, 0, 0, Width, Height);
+			if (Isa == PIXEL_CONVERT_ISA_SCALAR)
+			{
+				Reference = Frame;
+			}
+			else
+			{
+				CHECK(memcmp(Frame.data(), Reference.data(), Frame.size()) == 0);
+			}
+
+			Start = SudoVdaTest::NowNs();
+			for (int i = 0; i < Runs; i++)
+			{
+				Lut.Apply(Frame.data(), Pitch, 0, 0, Width, Height);
+			}
+			uint64_t ElapsedNs = (SudoVdaTest::NowNs() - Start) / Runs;
+			printf("  %-7s %7.2f ms/frame %6.2f GB/s\n", IsaNames[Isa], ElapsedNs / 1e6, (double)Frame.size() / ElapsedNs);
+		}
+
+		// The exporter skips frames when the ramp is the identity, applying it anyway would cost a full pass
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+		GammaLut Straight(Identity(), Format);
+		CHECK(Straight.IsIdentity());
+		memcpy(Frame.data(), Source.data(), Frame.size());
+		Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < Runs; i++)
+		{
+			Straight.Apply(Frame.data(), Pitch, 0, 0, Width, Height);
+		}
+		uint64_t IdentityNs = (SudoVdaTest::NowNs() - Start) / Runs;
+		CHECK(memcmp(Frame.data(), Source.data(), Frame.size()) == 0);
+		printf("  identity ramp %7.2f ms/frame if applied, what IsIdentity() saves\n", IdentityNs / 1e6);
+	}
+}
+
+int main()
+{
+	std::vector<uint8_t> Source(Pitch * Height);
+	uint32_t Random = 1;
+	for (size_t i = 0; i < Source.size(); i++)
+	{
+		Random = Random * 1103515245 + 12345;
+		Source[i] = (uint8_t)((i / 4 % Width) / 15 + (Random >> 28));
+	}
+
+	Run("BGRA8", SUVDA_FRAME_FORMAT_BGRA8, Source);
+	Run("RGB10A2", SUVDA_FRAME_FORMAT_RGB10A2, Source);
+	return TEST_RESULT();
+}
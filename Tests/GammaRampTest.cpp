@@ -0,0 +1,187 @@
+// Gamma ramps: the expanded tables against a double precision interpolation of the ramp for 8-bit and 10-bit frames,
+// identity detection, table comparison, partial updates, and every instruction set against the scalar path.
+
+#include "TestHarness.h"
+#include "GammaRamp.h"
+#include "PixelConvert.h"
+#include <sudovda-frame.h>
+
+#include <math.h>
+
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+
+namespace
+{
+	// Ramp entries interpolated at the code's position, rounded to the nearest code of the format
+	uint32_t Reference(const GAMMA_RAMP& Ramp, uint32_t Pixel, uint32_t Format)
+	{
+		bool Hdr10 = Format == SUVDA_FRAME_FORMAT_RGB10A2;
+		uint32_t Bits = Hdr10 ? 10 : 8;
+		uint32_t Max = (1u << Bits) - 1;
+		const uint16_t* Channels[3] = { Hdr10 ? Ramp.Red : Ramp.Blue, Ramp.Green, Hdr10 ? Ramp.Blue : Ramp.Red };
+
+		uint32_t Out = Pixel & ~((1u << (3 * Bits)) - 1);
+		for (uint32_t c = 0; c < 3; c++)
+		{
+			uint32_t Code = (Pixel >> (c * Bits)) & Max;
+			double Position = Code * 255.0 / Max;
+			uint32_t i = (uint32_t)Position;
+			double Fraction = Position - i;
+			double Value = Channels[c][i] * (1 - Fraction) + Channels[c][i < 255 ? i + 1 : i] * Fraction;
+			Out |= (uint32_t)lround(Value * Max / 65535.0) << (c * Bits);
+		}
+		return Out;
+	}
+
+	GAMMA_RAMP Identity()
+	{
+		GAMMA_RAMP Ramp;
+		for (uint32_t i = 0; i < GammaRampEntries; i++)
+		{
+			Ramp.Red[i] = Ramp.Green[i] = Ramp.Blue[i] = (uint16_t)(i * 257);
+		}
+		return Ramp;
+	}
+
+	// Like night light: green and blue pulled down, and a gamma tweak on red
+	GAMMA_RAMP Warm()
+	{
+		GAMMA_RAMP Ramp;
+		for (uint32_t i = 0; i < GammaRampEntries; i++)
+		{
+			Ramp.Red[i] = (uint16_t)lround(65535 * pow(i / 255.0, 0.9));
+			Ramp.Green[i] = (uint16_t)lround(i * 257 * 0.82);
+			Ramp.Blue[i] = (uint16_t)lround(i * 257 * 0.6);
+		}
+		return Ramp;
+	}
+
+	const uint32_t Formats[] = { SUVDA_FRAME_FORMAT_BGRA8, SUVDA_FRAME_FORMAT_RGB10A2 };
+
+	void TestTables()
+	{
+		CHECK(GammaLut::IsSupportedFormat(SUVDA_FRAME_FORMAT_BGRA8));
+		CHECK(GammaLut::IsSupportedFormat(SUVDA_FRAME_FORMAT_RGB10A2));
+		CHECK(!GammaLut::IsSupportedFormat(SUVDA_FRAME_FORMAT_RGBA16F));
+
+		GAMMA_RAMP Straight = Identity();
+		GAMMA_RAMP Tinted = Warm();
+		for (uint32_t Format : Formats)
+		{
+			CHECK(GammaLut(Straight, Format).IsIdentity());
+			CHECK(!GammaLut(Tinted, Format).IsIdentity());
+			CHECK_EQ(GammaLut(Tinted, Format).Format(), Format);
+		}
+
+		// An entry off by less than half a code still maps every 8-bit code to itself
+		GAMMA_RAMP Nudged = Straight;
+		Nudged.Green[100] += 100;
+		CHECK(GammaLut(Nudged, SUVDA_FRAME_FORMAT_BGRA8).IsIdentity());
+		CHECK(GammaLut(Nudged, SUVDA_FRAME_FORMAT_BGRA8).HasSameTables(GammaLut(Straight, SUVDA_FRAME_FORMAT_BGRA8)));
+
+		// A whole code is a different correction, and so is another format
+		Nudged.Green[100] += 257;
+		CHECK(!GammaLut(Nudged, SUVDA_FRAME_FORMAT_BGRA8).HasSameTables(GammaLut(Straight, SUVDA_FRAME_FORMAT_BGRA8)));
+		CHECK(!GammaLut(Tinted, SUVDA_FRAME_FORMAT_BGRA8).HasSameTables(GammaLut(Tinted, SUVDA_FRAME_FORMAT_RGB10A2)));
+		CHECK(GammaLut(Tinted, SUVDA_FRAME_FORMAT_RGB10A2).HasSameTables(GammaLut(Warm(), SUVDA_FRAME_FORMAT_RGB10A2)));
+	}
+
+	// Every code of every channel, with random alpha bits that must be kept
+	void TestAgainstReference()
+	{
+		GAMMA_RAMP Tinted = Warm();
+		std::mt19937 Random(1);
+		for (uint32_t Format : Formats)
+		{
+			uint32_t Bits = Format == SUVDA_FRAME_FORMAT_RGB10A2 ? 10 : 8;
+			uint32_t Codes = 1u << Bits;
+			std::vector<uint32_t> Frame(Codes);
+			for (uint32_t v = 0; v < Codes; v++)
+			{
+				// Each channel sees every code, at different pixels
+				uint32_t Pixel = v | ((v * 7 + 3) % Codes) << Bits | ((v * 13 + 5) % Codes) << (2 * Bits);
+				Frame[v] = Pixel | (Random() & ~((1u << (3 * Bits)) - 1));
+			}
+			std::vector<uint32_t> Expected(Codes);
+			for (uint32_t v = 0; v < Codes; v++)
+			{
+				Expected[v] = Reference(Tinted, Frame[v], Format);
+			}
+
+			GammaLut Lut(Tinted, Format);
+			CHECK(PixelConvertSetIsa(PIXEL_CONVERT_ISA_SCALAR));
+			Lut.Apply((uint8_t*)Frame.data(), Codes * 4, 0, 0, Codes, 1);
+			CHECK(Frame == Expected);
+		}
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	}
+
+	// Random frames, corrected in a rectangle, bit-exact on every instruction set
+	void TestIsaEquivalence()
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON };
+		const char* Names[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+		const uint32_t Width = 1037;
+		const uint32_t Height = 7;
+		const uint32_t Pitch = Width + 3;
+		GAMMA_RAMP Tinted = Warm();
+
+		std::mt19937 Random(1);
+		std::vector<uint32_t> Source(Pitch * Height);
+		for (auto& Pixel : Source)
+		{
+			Pixel = Random();
+		}
+
+		for (uint32_t Format : Formats)
+		{
+			GammaLut Lut(Tinted, Format);
+			std::vector<uint32_t> Expected = Source;
+			CHECK(PixelConvertSetIsa(PIXEL_CONVERT_ISA_SCALAR));
+			Lut.Apply((uint8_t*)Expected.data(), Pitch * 4, 5, 1, Width - 9, Height);
+
+			// Nothing outside the rectangle changed
+			bool Contained = true;
+			for (uint32_t y = 0; y < Height; y++)
+			{
+				for (uint32_t x = 0; x < Pitch; x++)
+				{
+					bool Inside = x >= 5 && x < Width - 9 && y >= 1;
+					uint32_t Pixel = Source[y * Pitch + x];
+					Contained &= Expected[y * Pitch + x] == (Inside ? Reference(Tinted, Pixel, Format) : Pixel);
+				}
+			}
+			CHECK(Contained);
+
+			for (auto Isa : Isas)
+			{
+				if (!PixelConvertSetIsa(Isa))
+				{
+					continue;
+				}
+
+				std::vector<uint32_t> Output = Source;
+				Lut.Apply((uint8_t*)Output.data(), Pitch * 4, 5, 1, Width - 9, Height);
+				if (Output != Expected)
+				{
+					fprintf(stderr, "%s differs from scalar for format %u\n", Names[Isa], Format);
+				}
+				CHECK(Output == Expected);
+			}
+		}
+
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	}
+}
+
+int main()
+{
+	TestTables();
+	TestAgainstReference();
+	TestIsaEquivalence();
+	return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+// HandoffQueue cost uncontended and with a consumer on another thread, then a producer at 4 kHz against a consumer
+// that needs 500 us per item, with each policy: what the producer pays per push, and how old the items are that the
+// consumer gets. The numbers depend on the machine and are only reported, what is checked is that every item is either
+// delivered or counted as dropped, and that BLOCK delivers everything when its timeout covers the consumer.
+
+#include "TestHarness.h"
+#include "HandoffQueue.h"
+#include "LatencyHistogram.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr uint32_t Capacity = 8;
+	constexpr uint64_t Pairs = 10000000;
+	constexpr uint64_t Items = 2000000;
+	constexpr uint64_t PacedItems = 1000;
+	constexpr uint64_t ProducerIntervalNs = 250000;
+	constexpr uint64_t ConsumerCostNs = 500000;
+
+	void WaitUntil(uint64_t Due)
+	{
+		while (SudoVdaTest::NowNs() < Due)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+
+	void RunUncontended()
+	{
+		HandoffQueue<uint64_t> Queue(Capacity);
+		uint64_t Sum = 0;
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < Pairs; i++)
+		{
+			uint64_t Value = i;
+			Queue.TryPush(Value);
+			Queue.TryPop(Value);
+			Sum += Value;
+		}
+		uint64_t ElapsedNs = SudoVdaTest::NowNs() - Start;
+		CHECK_EQ(Sum, Pairs * (Pairs - 1) / 2);
+
+		// A consumer blocking in Pop() against a producer that never waits
+		HandoffQueue<uint64_t> Handoff(Capacity, HANDOFF_BLOCK, HandoffQueue<uint64_t>::WaitInfinite);
+		uint64_t Received = 0;
+		std::thread Consumer([&] {
+			uint64_t Value;
+			while (Handoff.Pop(Value))
+			{
+				Received++;
+			}
+		});
+		uint64_t HandoffStart = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < Items; i++)
+		{
+			Handoff.Push(i);
+		}
+		Handoff.Close();
+		Consumer.join();
+		uint64_t HandoffNs = SudoVdaTest::NowNs() - HandoffStart;
+		CHECK_EQ(Received, Items);
+
+		printf("push+pop %5.1f ns, producer to consumer thread %6.1f ns per item\n", (double)ElapsedNs / Pairs,
+			(double)HandoffNs / Items);
+	}
+
+	void RunSlowConsumer(const char* Name, HANDOFF_POLICY Policy, uint32_t TimeoutMs)
+	{
+		HandoffQueue<uint64_t> Queue(Capacity, Policy, TimeoutMs);
+		auto Pushes = std::make_unique<LatencyHistogram>();
+		auto Ages = std::make_unique<LatencyHistogram>();
+
+		std::thread Consumer([&] {
+			uint64_t Queued;
+			while (Queue.Pop(Queued))
+			{
+				uint64_t Now = SudoVdaTest::NowNs();
+				Ages->Record(Now - Queued);
+				WaitUntil(Now + ConsumerCostNs);
+			}
+		});
+
+		uint64_t Due = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < PacedItems; i++)
+		{
+			uint64_t Begin = SudoVdaTest::NowNs();
+			Queue.Push(Begin);
+			Pushes->Record(SudoVdaTest::NowNs() - Begin);
+			Due += ProducerIntervalNs;
+			WaitUntil(Due);
+		}
+		Queue.Close();
+		Consumer.join();
+
+		// Evicted items were popped too, by the producer
+		HANDOFF_QUEUE_STATS Stats = Queue.Stats();
+		uint64_t Delivered = Ages->Count();
+		CHECK_EQ(Stats.Popped, Delivered + Stats.DroppedOldest);
+		CHECK_EQ(Delivered + Stats.DroppedNewest + Stats.DroppedOldest + Stats.TimedOut, PacedItems);
+		if (Policy == HANDOFF_BLOCK && TimeoutMs * 1000000ull > 2 * ConsumerCostNs)
+		{
+			CHECK_EQ(Delivered, PacedItems);
+		}
+
+		LATENCY_SUMMARY Push;
+		LATENCY_SUMMARY Age;
+		Pushes->Summarize(Push);
+		Ages->Summarize(Age);
+		printf("%-14s %4llu delivered, %4llu dropped, push p50 %7.1f p99 %7.1f max %7.1f us, "
+			"age p50 %5.1f p99 %5.1f ms\n", Name, (unsigned long long)Delivered,
+			(unsigned long long)(PacedItems - Delivered), Push.P50 / 1e3, Push.P99 / 1e3, Push.Max / 1e3, Age.P50 / 1e6,
+			Age.P99 / 1e6);
+	}
+}
+
+int main()
+{
+	RunUncontended();
+	RunSlowConsumer("drop newest", HANDOFF_DROP_NEWEST, 0);
+	RunSlowConsumer("drop oldest", HANDOFF_DROP_OLDEST, 0);
+	RunSlowConsumer("block 20 ms", HANDOFF_BLOCK, 20);
+	return TEST_RESULT();
+}
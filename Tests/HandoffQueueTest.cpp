@@ -0,0 +1,214 @@
+// HandoffQueue: the three back-pressure policies, closing, move-only items, and an MPMC stress run in which every
+// item must come out exactly once and in order per producer.
+
+#include "TestHarness.h"
+#include "HandoffQueue.h"
+
+#include <memory>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	void TestPolicies()
+	{
+		HandoffQueue<int> Newest(3);
+		CHECK_EQ(Newest.Capacity(), 3u);
+		CHECK_EQ(Newest.Policy(), HANDOFF_DROP_NEWEST);
+		for (int i = 0; i < 5; i++)
+		{
+			CHECK_EQ(Newest.Push(i), i < 3 ? HANDOFF_QUEUED : HANDOFF_DROPPED);
+		}
+		CHECK_EQ(Newest.Size(), 3u);
+		int Value = -1;
+		for (int i = 0; i < 3; i++)
+		{
+			CHECK(Newest.TryPop(Value));
+			CHECK_EQ(Value, i);
+		}
+		CHECK(!Newest.TryPop(Value));
+		CHECK_EQ(Newest.Stats().DroppedNewest, 2u);
+
+		// Evicted items are handed back, the queue keeps the most recent ones
+		HandoffQueue<int> Oldest(3, HANDOFF_DROP_OLDEST);
+		std::vector<int> Evicted;
+		for (int i = 0; i < 7; i++)
+		{
+			CHECK_EQ(Oldest.Push(i, [&](int&& Item) { Evicted.push_back(Item); }), HANDOFF_QUEUED);
+		}
+		CHECK(Evicted == std::vector<int>({ 0, 1, 2, 3 }));
+		for (int i = 4; i < 7; i++)
+		{
+			CHECK(Oldest.TryPop(Value));
+			CHECK_EQ(Value, i);
+		}
+		CHECK_EQ(Oldest.Stats().DroppedOldest, 4u);
+		CHECK_EQ(Oldest.Stats().Pushed, 7u);
+		CHECK_EQ(Oldest.Stats().Popped, 7u);
+
+		// A full blocking queue waits out its timeout
+		HandoffQueue<int> Block(2, HANDOFF_BLOCK, 30);
+		CHECK_EQ(Block.Push(0), HANDOFF_QUEUED);
+		CHECK_EQ(Block.Push(1), HANDOFF_QUEUED);
+		uint64_t Start = SudoVdaTest::NowNs();
+		CHECK_EQ(Block.Push(2), HANDOFF_TIMED_OUT);
+		CHECK((SudoVdaTest::NowNs() - Start) / 1000000 >= 29);
+		CHECK_EQ(Block.Stats().Blocked, 1u);
+		CHECK_EQ(Block.Stats().TimedOut, 1u);
+
+		// ... and goes through as soon as a consumer makes room
+		HandoffQueue<int> Patient(1, HANDOFF_BLOCK, 10000);
+		CHECK_EQ(Patient.Push(0), HANDOFF_QUEUED);
+		std::thread Consumer([&] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			int Item;
+			Patient.Pop(Item);
+		});
+		Start = SudoVdaTest::NowNs();
+		CHECK_EQ(Patient.Push(1), HANDOFF_QUEUED);
+		CHECK((SudoVdaTest::NowNs() - Start) / 1000000 < 5000);
+		Consumer.join();
+		CHECK(Patient.TryPop(Value));
+		CHECK_EQ(Value, 1);
+		CHECK_EQ(Patient.Stats().TimedOut, 0u);
+	}
+
+	void TestClose()
+	{
+		HandoffQueue<int> Queue(4, HANDOFF_BLOCK, 10000);
+		CHECK_EQ(Queue.Push(1), HANDOFF_QUEUED);
+
+		// Timed pops return empty handed
+		int Value = 0;
+		CHECK(Queue.Pop(Value, 0));
+		CHECK(!Queue.Pop(Value, 10));
+
+		// Closing wakes a parked consumer
+		std::thread Consumer([&] {
+			int Item;
+			CHECK(!Queue.Pop(Item));
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		Queue.Close();
+		Consumer.join();
+		CHECK(Queue.IsClosed());
+		CHECK_EQ(Queue.Push(2), HANDOFF_CLOSED);
+
+		// ... and a parked producer
+		HandoffQueue<int> Full(1, HANDOFF_BLOCK, 10000);
+		CHECK_EQ(Full.Push(1), HANDOFF_QUEUED);
+		std::thread Producer([&] { CHECK_EQ(Full.Push(2), HANDOFF_CLOSED); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		Full.Close();
+		Producer.join();
+
+		// What was queued before closing still comes out
+		CHECK(Full.Pop(Value));
+		CHECK_EQ(Value, 1);
+		CHECK(!Full.Pop(Value));
+	}
+
+	void TestMoveOnly()
+	{
+		HandoffQueue<std::unique_ptr<int>> Queue(2, HANDOFF_DROP_OLDEST);
+		int Evicted = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			Queue.Push(std::make_unique<int>(i), [&](std::unique_ptr<int>&& Item) { Evicted += *Item; });
+		}
+		CHECK_EQ(Evicted, 0 + 1);
+
+		std::unique_ptr<int> Item;
+		CHECK(Queue.TryPop(Item));
+		CHECK(Item && *Item == 2);
+
+		// A failed TryPush leaves the item with the caller
+		auto Extra = std::make_unique<int>(7);
+		CHECK(Queue.TryPush(Extra));
+		auto Rejected = std::make_unique<int>(8);
+		CHECK(!Queue.TryPush(Rejected));
+		CHECK(Rejected && *Rejected == 8);
+	}
+
+	// Producers and consumers hammering a small ring with every policy's fast path
+	void TestStress()
+	{
+		constexpr int Producers = 3;
+		constexpr int Consumers = 3;
+		constexpr uint64_t Items = 100000;
+		HandoffQueue<uint64_t> Queue(64);
+		std::vector<std::vector<uint64_t>> Received(Consumers);
+		std::vector<std::thread> Threads;
+
+		for (int p = 0; p < Producers; p++)
+		{
+			Threads.emplace_back([&, p] {
+				for (uint64_t i = 0; i < Items; i++)
+				{
+					uint64_t Item = (uint64_t)p << 32 | i;
+					while (!Queue.TryPush(Item))
+					{
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		for (int c = 0; c < Consumers; c++)
+		{
+			Threads.emplace_back([&, c] {
+				uint64_t Item;
+				while (Queue.Pop(Item))
+				{
+					Received[c].push_back(Item);
+				}
+			});
+		}
+
+		for (int p = 0; p < Producers; p++)
+		{
+			Threads[p].join();
+		}
+		Queue.Close();
+		for (int c = 0; c < Consumers; c++)
+		{
+			Threads[Producers + c].join();
+		}
+
+		// Every item exactly once, and each consumer sees each producer's items in push order
+		std::vector<uint64_t> Count(Producers * Items);
+		bool Ordered = true;
+		for (auto& Stream : Received)
+		{
+			uint64_t Last[Producers] = {};
+			bool Seen[Producers] = {};
+			for (uint64_t Item : Stream)
+			{
+				uint32_t Producer = (uint32_t)(Item >> 32);
+				uint64_t Index = Item & 0xffffffff;
+				Ordered &= !Seen[Producer] || Index > Last[Producer];
+				Seen[Producer] = true;
+				Last[Producer] = Index;
+				Count[Producer * Items + Index]++;
+			}
+		}
+		bool ExactlyOnce = true;
+		for (auto Hits : Count)
+		{
+			ExactlyOnce &= Hits == 1;
+		}
+		CHECK(ExactlyOnce);
+		CHECK(Ordered);
+		CHECK_EQ(Queue.Stats().Pushed, Producers * Items);
+		CHECK_EQ(Queue.Stats().Popped, Producers * Items);
+	}
+}
+
+int main()
+{
+	TestPolicies();
+	TestClose();
+	TestMoveOnly();
+	TestStress();
+	return TEST_RESULT();
+}
@@ -0,0 +1,140 @@
+// IdleRefreshPolicy against a simulated producer and a synthetic clock: the idle countdown, pass spacing, pass limits
+// and the statistics the frame statistics IOCTL reports.
+
+#include "TestHarness.h"
+#include "IdleRefresh.h"
+
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	class FakeClock : public IPacingClock
+	{
+	public:
+		uint64_t Now() override
+		{
+			return Tick;
+		}
+
+		uint64_t Frequency() override
+		{
+			return 1000000;
+		}
+
+		uint64_t Tick = 0;
+	};
+
+	// Runs the policy in 1 ms steps like the processing loop would and returns when passes were issued, in ms
+	std::vector<uint64_t> RunIdle(FakeClock& Clock, IdleRefreshPolicy& Policy, uint64_t DurationMs)
+	{
+		std::vector<uint64_t> Passes;
+		for (uint64_t Ms = 1; Ms <= DurationMs; Ms++)
+		{
+			Clock.Tick += 1000;
+			if (Policy.ShouldRefresh())
+			{
+				Policy.OnRefresh();
+				Passes.push_back(Ms);
+			}
+		}
+		return Passes;
+	}
+
+	void TestDisabled()
+	{
+		FakeClock Clock;
+		IdleRefreshPolicy Policy(Clock);
+		CHECK(!Policy.IsEnabled());
+		Policy.OnFrame();
+		CHECK(RunIdle(Clock, Policy, 5000).empty());
+		CHECK_EQ(Policy.TimeUntilRefresh(), UINT64_MAX);
+		CHECK_EQ(Policy.TimeUntilRefreshMs(), UINT32_MAX);
+
+		// Enabled, but nothing to refine before the first frame
+		IdleRefreshPolicy Fresh(Clock);
+		Fresh.Configure(100, 100, 0);
+		CHECK(Fresh.IsEnabled());
+		CHECK_EQ(Fresh.TimeUntilRefreshMs(), UINT32_MAX);
+		CHECK(RunIdle(Clock, Fresh, 1000).empty());
+
+		// Turning refinement on picks up the frame seen while it was off
+		Policy.Configure(100, 100, 1);
+		CHECK_EQ(RunIdle(Clock, Policy, 1000).size(), 1u);
+	}
+
+	void TestSchedule()
+	{
+		FakeClock Clock;
+		IdleRefreshPolicy Policy(Clock);
+		Policy.Configure(500, 1000, 3);
+
+		// A producer at 60 fps keeps the display busy
+		for (int Frame = 0; Frame < 60; Frame++)
+		{
+			Clock.Tick += 16667;
+			Policy.OnFrame();
+			CHECK(!Policy.ShouldRefresh());
+		}
+		CHECK_EQ(Policy.TimeUntilRefreshMs(), 500u);
+
+		// Idle: the first pass after 500 ms, then one a second, three in total
+		auto Passes = RunIdle(Clock, Policy, 10000);
+		CHECK(Passes == std::vector<uint64_t>({ 500, 1500, 2500 }));
+		CHECK_EQ(Policy.TimeUntilRefreshMs(), UINT32_MAX);
+		CHECK_EQ(Policy.Stats().Refreshes, 3u);
+		CHECK_EQ(Policy.Stats().IdlePeriods, 1u);
+
+		// A new frame restarts the countdown and the pass limit
+		Policy.OnFrame();
+		CHECK_EQ(Policy.TimeUntilRefreshMs(), 500u);
+		Clock.Tick += 200000;
+		CHECK_EQ(Policy.TimeUntilRefresh(), 300000u);
+		Policy.OnFrame();
+		Passes = RunIdle(Clock, Policy, 1600);
+		CHECK(Passes == std::vector<uint64_t>({ 500, 1500 }));
+		CHECK_EQ(Policy.Stats().Refreshes, 5u);
+		CHECK_EQ(Policy.Stats().IdlePeriods, 2u);
+	}
+
+	void TestSpacing()
+	{
+		FakeClock Clock;
+		IdleRefreshPolicy Policy(Clock);
+
+		// Intervals below the minimum are raised to it, no limit means passes continue while idle
+		Policy.Configure(10, 1, 0);
+		Policy.OnFrame();
+		auto Passes = RunIdle(Clock, Policy, 1000);
+		CHECK_EQ(Passes.size(), 20u);
+		CHECK_EQ(Passes.front(), 10u);
+		bool Spaced = true;
+		for (size_t i = 1; i < Passes.size(); i++)
+		{
+			Spaced &= Passes[i] - Passes[i - 1] == IdleRefreshPolicy::MinIntervalMs;
+		}
+		CHECK(Spaced);
+
+		// A late pass doesn't make the next one come early
+		Policy.Configure(100, 200, 0);
+		Policy.OnFrame();
+		Clock.Tick += 750000;
+		CHECK(Policy.ShouldRefresh());
+		CHECK_EQ(Policy.TimeUntilRefresh(), 0u);
+		Policy.OnRefresh();
+		CHECK_EQ(Policy.TimeUntilRefreshMs(), 200u);
+
+		// Millisecond waits round up
+		Clock.Tick += 199001;
+		CHECK_EQ(Policy.TimeUntilRefreshMs(), 1u);
+	}
+}
+
+int main()
+{
+	TestDisabled();
+	TestSchedule();
+	TestSpacing();
+	return TEST_RESULT();
+}
@@ -0,0 +1,107 @@
+// LatencyHistogram recording cost against the same buckets bumped with locked fetch_add, alone and with a reader
+// summarizing in a loop like a client polling IOCTL_GET_FRAME_STATS, plus the cost of a summary. The numbers depend on
+// the machine and are only reported, what is checked is that every sample is counted and the maximum is exact.
+
+#include "TestHarness.h"
+#include "LatencyHistogram.h"
+
+#include <math.h>
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr uint64_t Samples = 20000000;
+	constexpr int Summaries = 20000;
+
+	// What the histogram would be with the usual locked read-modify-write counters
+	struct LockedHistogram
+	{
+		std::atomic<uint64_t> Buckets[LatencyHistogram::BucketCount] = {};
+		std::atomic<uint64_t> Count{ 0 };
+		std::atomic<uint64_t> Sum{ 0 };
+
+		void Record(uint64_t Value)
+		{
+			Buckets[LatencyHistogram::BucketIndex(Value)].fetch_add(1, std::memory_order_relaxed);
+			Count.fetch_add(1, std::memory_order_relaxed);
+			Sum.fetch_add(Value, std::memory_order_relaxed);
+		}
+	};
+
+	template <typename Histogram>
+	uint64_t RecordAll(Histogram& Target, const std::vector<uint64_t>& Values)
+	{
+		size_t Mask = Values.size() - 1;
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (uint64_t i = 0; i < Samples; i++)
+		{
+			Target.Record(Values[i & Mask]);
+		}
+		return SudoVdaTest::NowNs() - Start;
+	}
+}
+
+int main()
+{
+	// Stage latencies spread log-uniformly from 1 us to 20 ms, so every record lands in one of ~200 buckets
+	std::mt19937_64 Random(5);
+	std::uniform_real_distribution<double> Exponent(3.0, 7.3);
+	std::vector<uint64_t> Values(1 << 16);
+	uint64_t Largest = 0;
+	for (auto& Value : Values)
+	{
+		Value = (uint64_t)pow(10.0, Exponent(Random));
+		Largest = Value > Largest ? Value : Largest;
+	}
+
+	auto Histogram = std::make_unique<LatencyHistogram>();
+	uint64_t PlainNs = RecordAll(*Histogram, Values);
+	CHECK_EQ(Histogram->Count(), Samples);
+
+	auto Locked = std::make_unique<LockedHistogram>();
+	uint64_t LockedNs = RecordAll(*Locked, Values);
+	CHECK_EQ(Locked->Count.load(), Samples);
+
+	LATENCY_SUMMARY Summary;
+	uint64_t Start = SudoVdaTest::NowNs();
+	for (int i = 0; i < Summaries; i++)
+	{
+		Histogram->Summarize(Summary);
+	}
+	uint64_t SummaryNs = SudoVdaTest::NowNs() - Start;
+	CHECK_EQ(Summary.Max, Largest);
+
+	// Recording while a reader walks the buckets, which pulls the writer's cache lines away from it
+	Histogram->Reset();
+	std::atomic<bool> Stop{ false };
+	std::atomic<uint64_t> Polls{ 0 };
+	std::thread Reader([&] {
+		LATENCY_SUMMARY Polled;
+		while (!Stop.load(std::memory_order_relaxed))
+		{
+			Histogram->Summarize(Polled);
+			Polls++;
+		}
+	});
+	uint64_t ContendedNs = RecordAll(*Histogram, Values);
+	Stop = true;
+	Reader.join();
+	Histogram->Summarize(Summary);
+	CHECK_EQ(Summary.Count, Samples);
+	CHECK_EQ(Summary.Max, Largest);
+
+	printf("record %5.1f ns, with fetch_add %5.1f ns, with a polling reader %5.1f ns (%llu summaries)\n",
+		(double)PlainNs / Samples, (double)LockedNs / Samples, (double)ContendedNs / Samples,
+		(unsigned long long)Polls.load());
+	printf("summary %5.1f us, p50 %llu p99 %llu p99.9 %llu max %llu ns\n", SummaryNs / 1e3 / Summaries,
+		(unsigned long long)Summary.P50, (unsigned long long)Summary.P99, (unsigned long long)Summary.P999,
+		(unsigned long long)Summary.Max);
+	return TEST_RESULT();
+}
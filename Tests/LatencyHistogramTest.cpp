@@ -0,0 +1,159 @@
+// LatencyHistogram bucket layout and quantile accuracy against an exact sorted reference, plus a reader running
+// concurrently with the single writer.
+
+#include "TestHarness.h"
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	void TestBuckets()
+	{
+		// Buckets tile the whole 64-bit range without gaps or overlaps
+		CHECK_EQ(LatencyHistogram::BucketLowerBound(0), 0u);
+		for (uint32_t i = 0; i + 1 < LatencyHistogram::BucketCount; i++)
+		{
+			if (LatencyHistogram::BucketUpperBound(i) + 1 != LatencyHistogram::BucketLowerBound(i + 1) ||
+				LatencyHistogram::BucketLowerBound(i) > LatencyHistogram::BucketUpperBound(i))
+			{
+				CHECK_EQ(LatencyHistogram::BucketUpperBound(i) + 1, LatencyHistogram::BucketLowerBound(i + 1));
+				break;
+			}
+		}
+		CHECK_EQ(LatencyHistogram::BucketIndex(UINT64_MAX), LatencyHistogram::BucketCount - 1);
+		CHECK_EQ(LatencyHistogram::BucketUpperBound(LatencyHistogram::BucketCount - 1), UINT64_MAX);
+
+		// Small values are exact, everything maps into the bucket whose bounds contain it
+		for (uint64_t Value = 0; Value < LatencyHistogram::SubBucketCount; Value++)
+		{
+			CHECK_EQ(LatencyHistogram::BucketIndex(Value), Value);
+		}
+
+		std::vector<uint64_t> Values;
+		for (uint32_t Bit = 0; Bit < 64; Bit++)
+		{
+			uint64_t Power = 1ull << Bit;
+			Values.insert(Values.end(), { Power - 1, Power, Power + 1, Power + Power / 3 });
+		}
+		std::mt19937_64 Random(7);
+		for (int i = 0; i < 100000; i++)
+		{
+			Values.push_back(Random() >> (Random() % 64));
+		}
+		for (uint64_t Value : Values)
+		{
+			uint32_t Index = LatencyHistogram::BucketIndex(Value);
+			uint64_t Lower = LatencyHistogram::BucketLowerBound(Index);
+			uint64_t Upper = LatencyHistogram::BucketUpperBound(Index);
+			if (Index >= LatencyHistogram::BucketCount || Value < Lower || Value > Upper ||
+				(Upper - Lower) * LatencyHistogram::SubBucketCount > Lower)
+			{
+				CHECK(Value >= Lower && Value <= Upper);
+				CHECK((Upper - Lower) * LatencyHistogram::SubBucketCount <= Lower);
+				break;
+			}
+		}
+	}
+
+	void TestQuantiles()
+	{
+		auto Histogram = std::make_unique<LatencyHistogram>();
+		LATENCY_SUMMARY Summary;
+		Histogram->Summarize(Summary);
+		CHECK_EQ(Summary.Count, 0u);
+		CHECK_EQ(Summary.P99, 0u);
+		CHECK_EQ(Summary.Mean, 0u);
+
+		// Latencies in 100 ns units with a long tail, like the pipeline stages
+		std::mt19937_64 Random(1);
+		std::lognormal_distribution<double> Latency(8.0, 1.2);
+		std::vector<uint64_t> Values(200000);
+		uint64_t Sum = 0;
+		for (auto& Value : Values)
+		{
+			Value = (uint64_t)Latency(Random);
+			Sum += Value;
+			Histogram->Record(Value);
+		}
+		std::sort(Values.begin(), Values.end());
+
+		Histogram->Summarize(Summary);
+		CHECK_EQ(Summary.Count, Values.size());
+		CHECK_EQ(Summary.Mean, Sum / Values.size());
+		CHECK_EQ(Summary.Max, Values.back());
+
+		// A quantile is reported as its bucket's upper bound: never below the exact value and at most one sub-bucket
+		// (1/16) above it
+		for (double Quantile : { 0.0, 0.1, 0.5, 0.9, 0.99, 0.999, 1.0 })
+		{
+			uint64_t Exact = Values[std::min(Values.size() - 1, (size_t)(Quantile * Values.size()))];
+			uint64_t Reported = Histogram->ValueAtQuantile(Quantile);
+			CHECK(Reported >= Exact);
+			CHECK(Reported <= Exact + Exact / LatencyHistogram::SubBucketCount + 1);
+		}
+		CHECK_EQ(Histogram->ValueAtQuantile(1.0), Values.back());
+		CHECK(Summary.P50 <= Summary.P90 && Summary.P90 <= Summary.P99 && Summary.P99 <= Summary.P999);
+		CHECK(Summary.P999 <= Summary.Max);
+
+		Histogram->Reset();
+		CHECK_EQ(Histogram->Count(), 0u);
+		CHECK_EQ(Histogram->ValueAtQuantile(0.5), 0u);
+
+		// A single sample is every quantile
+		Histogram->Record(12345);
+		Histogram->Summarize(Summary);
+		CHECK_EQ(Summary.P50, 12345u);
+		CHECK_EQ(Summary.P999, 12345u);
+		CHECK_EQ(Summary.Max, 12345u);
+	}
+
+	// The IOCTL handler summarizes while the processing thread records
+	void TestConcurrentReader()
+	{
+		auto Histogram = std::make_unique<LatencyHistogram>();
+		constexpr uint64_t Samples = 2000000;
+		std::atomic<bool> Done{false};
+
+		std::thread Writer([&] {
+			for (uint64_t i = 0; i < Samples; i++)
+			{
+				Histogram->Record(i % 50000);
+			}
+			Done.store(true);
+		});
+
+		uint64_t LastCount = 0;
+		bool Monotonic = true;
+		bool Bounded = true;
+		while (!Done.load())
+		{
+			LATENCY_SUMMARY Summary;
+			Histogram->Summarize(Summary);
+			Monotonic &= Summary.Count >= LastCount;
+			Bounded &= Summary.Max < 50000 && Summary.P99 <= Summary.Max;
+			LastCount = Summary.Count;
+			std::this_thread::yield();
+		}
+		Writer.join();
+
+		CHECK(Monotonic);
+		CHECK(Bounded);
+		CHECK_EQ(Histogram->Count(), Samples);
+		CHECK_EQ(Histogram->ValueAtQuantile(1.0), 49999u);
+	}
+}
+
+int main()
+{
+	TestBuckets();
+	TestQuantiles();
+	TestConcurrentReader();
+	return TEST_RESULT();
+}
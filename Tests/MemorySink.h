@@ -0,0 +1,77 @@
+#pragma once
+
+// ICaptureSink keeping everything written to it in memory, for the capture and trace writer tests. The sink can be
+// stalled to simulate a slow disk and made to fail after a number of writes.
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "FrameCapture.h"
+
+namespace SudoVdaTest
+{
+	// What a sink received, shared with the test because the writer owns the sink itself
+	struct SinkState
+	{
+		std::mutex Lock;
+		std::condition_variable Changed;
+		std::vector<uint8_t> Bytes;
+		std::vector<uintptr_t> Addresses;
+		bool Stalled = false;     // Writes wait while set
+		bool Writing = false;     // A write is waiting on the stall
+		size_t FailAfter = SIZE_MAX;
+
+		void Stall(bool Value)
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			Stalled = Value;
+			Changed.notify_all();
+		}
+
+		void WaitForWriter()
+		{
+			std::unique_lock<std::mutex> Guard(Lock);
+			Changed.wait(Guard, [this] { return Writing; });
+		}
+
+		size_t Size()
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			return Bytes.size();
+		}
+	};
+
+	class MemorySink : public Microsoft::IndirectDisp::ICaptureSink
+	{
+	public:
+		explicit MemorySink(std::shared_ptr<SinkState> State) : m_State(std::move(State))
+		{
+		}
+
+		bool Write(const void* pData, size_t Bytes) override
+		{
+			std::unique_lock<std::mutex> Guard(m_State->Lock);
+			m_State->Writing = true;
+			m_State->Changed.notify_all();
+			m_State->Changed.wait(Guard, [this] { return !m_State->Stalled; });
+			m_State->Writing = false;
+
+			if (!m_State->FailAfter--)
+			{
+				return false;
+			}
+
+			m_State->Addresses.push_back((uintptr_t)pData);
+			auto* pBytes = static_cast<const uint8_t*>(pData);
+			m_State->Bytes.insert(m_State->Bytes.end(), pBytes, pBytes + Bytes);
+			return true;
+		}
+
+	private:
+		std::shared_ptr<SinkState> m_State;
+	};
+}
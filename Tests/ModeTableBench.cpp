@@ -0,0 +1,112 @@
+// Mode file compilation for files of 1k, 100k and 1M lines, with comments, invalid lines and duplicates mixed in, and
+// the mode list built for a monitor with a preferred mode from the compiled defaults. The numbers depend on the
+// machine and are only reported, what is checked is that every entry is counted as a mode, a duplicate or a reject and
+// that the compiled modes come out sorted.
+
+#include "TestHarness.h"
+#include "ModeTable.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr int BuildRuns = 10;
+
+	std::string MakeModeFile(uint32_t Lines, uint32_t Seed)
+	{
+		const uint32_t Rates[] = { 30, 60, 75, 90, 120, 144, 165, 240, 59940, 23976, 119880, 100000 };
+		std::mt19937 Random(Seed);
+		std::vector<std::string> Written;
+		std::string Text = std::to_string(Lines) + "\n";
+		for (uint32_t i = 0; i < Lines; i++)
+		{
+			uint32_t Kind = Random() % 100;
+			std::string Line;
+			if (Kind < 3)
+			{
+				Line = "# Modes for the second monitor";
+			}
+			else if (Kind < 5)
+			{
+				Line = "";
+			}
+			else if (Kind < 7)
+			{
+				Line = std::to_string(320 + Random() % 16000) + ", 100, 60";
+			}
+			else if (Kind < 12 && !Written.empty())
+			{
+				Line = Written[Random() % Written.size()];
+			}
+			else
+			{
+				uint32_t Height = 320 + Random() % 4000;
+				uint32_t Width = Height + Random() % (Height * 3);
+				Line = std::to_string(Width) + ", " + std::to_string(Height) + ", " + std::to_string(Rates[Random() % 12]);
+				Written.push_back(Line);
+			}
+			Text += Line + "\n";
+		}
+		return Text;
+	}
+
+	bool IsSorted(const ModeList& List)
+	{
+		const MODE_SPEC* pSpecs = List.Specs();
+		for (size_t i = 1; i < List.Count(); i++)
+		{
+			const MODE_SPEC& Previous = pSpecs[i - 1];
+			const MODE_SPEC& Current = pSpecs[i];
+			bool InOrder = Previous.Width != Current.Width ? Previous.Width < Current.Width :
+				Previous.Height != Current.Height ? Previous.Height < Current.Height :
+				FractionLess(Previous.VSync, Current.VSync);
+			if (!InOrder)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Run(uint32_t Lines)
+	{
+		std::string Text = MakeModeFile(Lines, Lines);
+		ModeList List;
+		MODE_LIST_REPORT Report;
+		uint64_t Start = SudoVdaTest::NowNs();
+		CHECK(List.Compile(Text.data(), Text.size(), Report));
+		uint64_t CompileNs = SudoVdaTest::NowNs() - Start;
+
+		CHECK_EQ(Report.Modes + Report.Duplicates + Report.Rejected, Report.Entries);
+		CHECK_EQ(List.Count(), (size_t)Report.Modes);
+		CHECK(Report.Issues.size() <= ModeList::MaxIssues);
+		CHECK(IsSorted(List));
+
+		std::vector<MODE_TIMING> Modes;
+		uint32_t Preferred = 0;
+		Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < BuildRuns; i++)
+		{
+			Preferred = BuildMonitorModes(List, MODE_SPEC{ 2560, 1440, { 144, 1 } }, FRACTION{ 60, 1 }, Modes);
+		}
+		uint64_t BuildNs = (SudoVdaTest::NowNs() - Start) / BuildRuns;
+		CHECK(Preferred < Modes.size() && Modes[Preferred].Width == 2560 && Modes[Preferred].Height == 1440);
+
+		printf("%8u lines, %6.2f MB: compile %8.2f ms (%6.1f MB/s), %7u modes, %6u duplicates, %6u rejected, "
+			"monitor list %8.1f us\n", Lines, Text.size() / 1e6, CompileNs / 1e6, Text.size() * 1e3 / CompileNs,
+			Report.Modes, Report.Duplicates, Report.Rejected, BuildNs / 1e3);
+	}
+}
+
+int main()
+{
+	for (uint32_t Lines : { 1000, 100000, 1000000 })
+	{
+		Run(Lines);
+	}
+	return TEST_RESULT();
+}
@@ -0,0 +1,610 @@
+// Mode tables: the compile-time default timings, the invariants every timing keeps (exact line rate, rounded pixel
+// rate, CVT totals), the mode lists built for monitors with and without a preferred mode, mode files compiled into
+// the default list, and properties of the exact refresh rates from the IOCTL to the signal info.
+
+#include "TestHarness.h"
+#include "ModeTable.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	// 1920x1080 at 60 Hz, the seventh default mode, with CVT-RB v2 totals and a pixel rate of exactly 133.32 MHz
+	static_assert(DefaultModeTimings[6].TotalWidth == 2000 && DefaultModeTimings[6].TotalHeight == 1111, "CVT totals");
+	static_assert(DefaultModeTimings[6].VSyncNumerator == 60 && DefaultModeTimings[6].VSyncDenominator == 1, "Refresh rate");
+	static_assert(DefaultModeTimings[6].HSyncNumerator == 66660 && DefaultModeTimings[6].HSyncDenominator == 1, "Line rate");
+	static_assert(DefaultModeTimings[6].PixelRate == 133320000, "Pixel rate");
+
+	constexpr MODE_SPEC NtscModes[] = {
+		{ 1920, 1080, { 60000, 1001 } },
+		{ 3840, 2160, { 24000, 1001 } },
+	};
+	constexpr auto NtscTimings = MakeModeTimings(NtscModes);
+	// 66660000/1001 lines per second reduced by the 11 in 1111, and 133186813.19 pixels rounded
+	static_assert(NtscTimings[0].HSyncNumerator == 6060000 && NtscTimings[0].HSyncDenominator == 91, "Line rate");
+	static_assert(NtscTimings[0].PixelRate == 133186813, "Pixel rate");
+	static_assert(NtscTimings[1].VSyncNumerator == 24000 && NtscTimings[1].VSyncDenominator == 1001, "Refresh rate");
+
+	// NTSC rates in mHz are their exact 1000/1001 fractions, other rates stay what they are
+	static_assert(FractionEqual(RefreshRateFromMillihertz(59940), FRACTION{ 60000, 1001 }), "59.94 Hz");
+	static_assert(FractionEqual(RefreshRateFromMillihertz(23976), FRACTION{ 24000, 1001 }), "23.976 Hz");
+	static_assert(FractionEqual(RefreshRateFromMillihertz(119880), FRACTION{ 120000, 1001 }), "119.88 Hz");
+	static_assert(FractionEqual(RefreshRateFromMillihertz(59950), FRACTION{ 1199, 20 }), "59.95 Hz");
+	static_assert(FractionEqual(RefreshRateFromMillihertz(144), FRACTION{ 144, 1 }), "Hertz below 1000");
+
+	// What every reported timing has to satisfy
+	bool IsConsistent(const MODE_TIMING& Timing)
+	{
+		FRACTION VSync = { Timing.VSyncNumerator, Timing.VSyncDenominator };
+		FRACTION HSync = MultiplyFraction(VSync, Timing.TotalHeight, 1);
+		CVT_TIMING Cvt = MakeCvtRbV2Timing(Timing.Width, Timing.Height, VSync.Numerator, VSync.Denominator);
+		uint64_t Pixels = (uint64_t)Timing.TotalWidth * Timing.TotalHeight * VSync.Numerator;
+
+		bool Reduced = Gcd(VSync.Numerator, VSync.Denominator) == 1 && Gcd(Timing.HSyncNumerator, Timing.HSyncDenominator) == 1;
+		bool LineRate = Timing.HSyncNumerator == HSync.Numerator && Timing.HSyncDenominator == HSync.Denominator;
+		bool PixelRate = Timing.PixelRate * VSync.Denominator * 2 + VSync.Denominator >= Pixels * 2 &&
+			Timing.PixelRate * VSync.Denominator * 2 <= Pixels * 2 + VSync.Denominator;
+		bool Totals = Timing.TotalWidth == Cvt.HTotal && Timing.TotalHeight == Cvt.VTotal && Timing.TotalWidth > Timing.Width &&
+			Timing.TotalHeight > Timing.Height;
+		return Reduced && LineRate && PixelRate && Totals;
+	}
+
+	void TestDefaults()
+	{
+		CHECK_EQ(DefaultModeTimings.size(), DefaultModeCount);
+		bool Consistent = true;
+		bool Matching = true;
+		for (size_t i = 0; i < DefaultModeCount; i++)
+		{
+			const MODE_TIMING& Timing = DefaultModeTimings[i];
+			Consistent &= IsConsistent(Timing);
+			Matching &= Timing.Width == DefaultModes[i].Width && Timing.Height == DefaultModes[i].Height &&
+				Timing.VSyncNumerator == DefaultModes[i].VSync.Numerator && Timing.VSyncDenominator == DefaultModes[i].VSync.Denominator;
+		}
+		CHECK(Consistent);
+		CHECK(Matching);
+		CHECK(IsConsistent(NtscTimings[0]));
+		CHECK(IsConsistent(NtscTimings[1]));
+
+		// The driver-wide list starts out as the built-in one
+		ModeList List;
+		CHECK_EQ(List.Count(), DefaultModeCount);
+		CHECK_EQ(List.PreferredIndex(), DefaultPreferredModeIndex);
+		bool Same = true;
+		for (size_t i = 0; i < List.Count(); i++)
+		{
+			Same &= memcmp(&List.Timings()[i], &DefaultModeTimings[i], sizeof(MODE_TIMING)) == 0;
+		}
+		CHECK(Same);
+	}
+
+	void TestWithoutPreferredMode()
+	{
+		ModeList Defaults;
+		std::vector<MODE_TIMING> Modes(3);
+		MODE_SPEC None = {};
+		CHECK_EQ(BuildMonitorModes(Defaults, None, FRACTION{ 120, 1 }, Modes), DefaultPreferredModeIndex);
+		CHECK_EQ(Modes.size(), DefaultModeCount);
+		CHECK_EQ(Modes[6].PixelRate, 133320000u);
+	}
+
+	// The defaults, then the preferred mode at every scale factor and both rates
+	void TestPreferredMode()
+	{
+		ModeList Defaults;
+		std::vector<MODE_TIMING> Modes;
+		MODE_SPEC Preferred = { 2560, 1440, { 144, 1 } };
+		CHECK_EQ(BuildMonitorModes(Defaults, Preferred, FRACTION{ 60, 1 }, Modes), (uint32_t)DefaultModeCount);
+		CHECK_EQ(Modes.size(), DefaultModeCount + PreferredModeCount);
+
+		// A whole rate leaves the defaults alone
+		CHECK(memcmp(Modes.data(), DefaultModeTimings.data(), sizeof(MODE_TIMING) * DefaultModeCount) == 0);
+
+		const uint32_t Sizes[][2] = { { 2560, 1440 }, { 1280, 720 }, { 1920, 1080 }, { 3200, 1800 }, { 3840, 2160 } };
+		bool Scaled = true;
+		bool Consistent = true;
+		for (size_t i = 0; i < ModeScaleFactorCount; i++)
+		{
+			const MODE_TIMING& AtPreferred = Modes[DefaultModeCount + i * 2];
+			const MODE_TIMING& AtSecond = Modes[DefaultModeCount + i * 2 + 1];
+			Scaled &= AtPreferred.Width == Sizes[i][0] && AtPreferred.Height == Sizes[i][1] && AtSecond.Width == Sizes[i][0];
+			Scaled &= AtPreferred.VSyncNumerator == 144 && AtSecond.VSyncNumerator == 60;
+			Consistent &= IsConsistent(AtPreferred) && IsConsistent(AtSecond);
+		}
+		CHECK(Scaled);
+		CHECK(Consistent);
+	}
+
+	// A preferred rate just below a whole one pulls the whole hertz defaults down with it
+	void TestFollowedRate()
+	{
+		ModeList Defaults;
+		std::vector<MODE_TIMING> Modes;
+		MODE_SPEC Preferred = { 1920, 1080, { 60000, 1001 } };
+		BuildMonitorModes(Defaults, Preferred, FRACTION{ 120000, 1001 }, Modes);
+
+		bool Followed = true;
+		bool Consistent = true;
+		for (size_t i = 0; i < DefaultModeCount; i++)
+		{
+			Followed &= Modes[i].VSyncNumerator == DefaultModes[i].VSync.Numerator * 1000 && Modes[i].VSyncDenominator == 1001;
+			Consistent &= IsConsistent(Modes[i]);
+		}
+		CHECK(Followed);
+		CHECK(Consistent);
+		CHECK(memcmp(&Modes[DefaultModeCount], &NtscTimings[0], sizeof(MODE_TIMING)) == 0);
+		CHECK_EQ(Modes[DefaultModeCount + 1].VSyncNumerator, 120000u);
+
+		// 59.5 Hz is followed as 119/120 of every default
+		Preferred.VSync = FRACTION{ 119, 2 };
+		BuildMonitorModes(Defaults, Preferred, FRACTION{ 119, 1 }, Modes);
+		CHECK(Modes[1].VSyncNumerator == 357 && Modes[1].VSyncDenominator == 4);
+
+		// Rates above a whole one are not
+		Preferred.VSync = FRACTION{ 60001, 1000 };
+		BuildMonitorModes(Defaults, Preferred, FRACTION{ 120, 1 }, Modes);
+		CHECK(memcmp(Modes.data(), DefaultModeTimings.data(), sizeof(MODE_TIMING) * DefaultModeCount) == 0);
+	}
+
+	bool SameSpec(const MODE_SPEC& Spec, uint32_t Width, uint32_t Height, uint32_t Numerator, uint32_t Denominator)
+	{
+		return Spec.Width == Width && Spec.Height == Height && Spec.VSync.Numerator == Numerator && Spec.VSync.Denominator == Denominator;
+	}
+
+	bool SameIssue(const MODE_ISSUE& Issue, uint32_t Line, MODE_ISSUE_REASON Reason)
+	{
+		return Issue.Line == Line && Issue.Reason == Reason;
+	}
+
+	void TestModeFile()
+	{
+		const char Text[] =
+			"7\n"                            // Monitor count of older option.txt files
+			"# comment\n"
+			"\n"
+			" 2560 ,1440, 59940 # NTSC\r\n"
+			"1920,1080,60\n"
+			"1920,1080\n"
+			"1920,1080,60,1\n"
+			"1920x1080\n"
+			"1920,1080,0\n"
+			"1920,1080,1000001\n"
+			"9999999999,1080,60\n"
+			"16385,4096,60\n"
+			"319,1000,60\n"
+			"320,1281,60\n"
+			"1920,1080,60000\n"
+			"16384,4096,1000\n"
+			"320,1280,1\n"
+			"7";
+		ModeList List;
+		MODE_LIST_REPORT Report;
+		CHECK(List.Compile(Text, sizeof(Text) - 1, Report));
+		CHECK_EQ(Report.Entries, 15u);
+		CHECK_EQ(Report.Modes, 4u);
+		CHECK_EQ(Report.Duplicates, 1u);
+		CHECK_EQ(Report.Rejected, 10u);
+
+		// Issues in file order, the mode as written
+		const struct {
+			uint32_t Line;
+			MODE_ISSUE_REASON Reason;
+		} Expected[] = {
+			{ 6, MODE_ISSUE_SYNTAX }, { 7, MODE_ISSUE_SYNTAX }, { 8, MODE_ISSUE_SYNTAX }, { 9, MODE_ISSUE_REFRESH },
+			{ 10, MODE_ISSUE_REFRESH }, { 11, MODE_ISSUE_SYNTAX }, { 12, MODE_ISSUE_SIZE }, { 13, MODE_ISSUE_SIZE },
+			{ 14, MODE_ISSUE_ASPECT }, { 15, MODE_ISSUE_DUPLICATE }, { 18, MODE_ISSUE_SYNTAX },
+		};
+		CHECK_EQ(Report.Issues.size(), sizeof(Expected) / sizeof(Expected[0]));
+		bool Issues = true;
+		for (size_t i = 0; i < Report.Issues.size() && i < sizeof(Expected) / sizeof(Expected[0]); i++)
+		{
+			Issues &= SameIssue(Report.Issues[i], Expected[i].Line, Expected[i].Reason);
+		}
+		CHECK(Issues);
+		CHECK(Report.Issues[3].Width == 1920 && Report.Issues[3].Height == 1080 && Report.Issues[3].Refresh == 0);
+		CHECK(Report.Issues[9].Refresh == 60000);
+
+		// Sorted by width, height and rate, the first valid line preferred
+		CHECK_EQ(List.Count(), 4u);
+		CHECK(SameSpec(List.Specs()[0], 320, 1280, 1, 1));
+		CHECK(SameSpec(List.Specs()[1], 1920, 1080, 60, 1));
+		CHECK(SameSpec(List.Specs()[2], 2560, 1440, 60000, 1001));
+		CHECK(SameSpec(List.Specs()[3], 16384, 4096, 1, 1));
+		CHECK_EQ(List.PreferredIndex(), 2u);
+		bool Consistent = true;
+		for (size_t i = 0; i < List.Count(); i++)
+		{
+			Consistent &= IsConsistent(List.Timings()[i]) && List.Timings()[i].Width == List.Specs()[i].Width;
+		}
+		CHECK(Consistent);
+
+		// Monitors build on the compiled list
+		std::vector<MODE_TIMING> Modes;
+		MODE_SPEC None = {};
+		CHECK_EQ(BuildMonitorModes(List, None, FRACTION{ 60, 1 }, Modes), 2u);
+		CHECK_EQ(Modes.size(), 4u);
+
+		// Without a valid line the current modes stay
+		const char Invalid[] = "1\n# only comments\n5,5,5";
+		CHECK(!List.Compile(Invalid, sizeof(Invalid) - 1, Report));
+		CHECK_EQ(Report.Rejected, 1u);
+		CHECK(SameIssue(Report.Issues[0], 3, MODE_ISSUE_SIZE));
+		CHECK(!List.Compile("", 0, Report));
+		CHECK_EQ(Report.Entries, 0u);
+		CHECK_EQ(List.Count(), 4u);
+		CHECK_EQ(List.PreferredIndex(), 2u);
+	}
+
+	// Only the first MaxIssues problems are kept, rejected and duplicate lines merged in file order
+	void TestIssueLimit()
+	{
+		std::string Text;
+		for (int i = 0; i < 200; i++)
+		{
+			Text += i % 2 ? "1920,1080,60\n" : "5,5,5\n";
+		}
+		ModeList List;
+		MODE_LIST_REPORT Report;
+		CHECK(List.Compile(Text.data(), Text.size(), Report));
+		CHECK_EQ(Report.Rejected, 100u);
+		CHECK_EQ(Report.Duplicates, 99u);
+		CHECK_EQ(Report.Issues.size(), ModeList::MaxIssues);
+		bool Ordered = true;
+		for (size_t i = 0; i < Report.Issues.size(); i++)
+		{
+			uint32_t Line = i ? (uint32_t)i + 2 : 1;
+			Ordered &= SameIssue(Report.Issues[i], Line, Line % 2 ? MODE_ISSUE_SIZE : MODE_ISSUE_DUPLICATE);
+		}
+		CHECK(Ordered);
+	}
+
+	struct SpecOrder
+	{
+		bool operator()(const MODE_SPEC& Left, const MODE_SPEC& Right) const
+		{
+			if (Left.Width != Right.Width || Left.Height != Right.Height)
+			{
+				return Left.Width != Right.Width ? Left.Width < Right.Width : Left.Height < Right.Height;
+			}
+			return FractionLess(Left.VSync, Right.VSync);
+		}
+	};
+
+	// Random files against a straightforward model of the rules
+	void TestModeFileFuzz()
+	{
+		std::mt19937 Random(1);
+		bool Matching = true;
+		for (int Run = 0; Run < 200; Run++)
+		{
+			std::string Text;
+			std::set<MODE_SPEC, SpecOrder> Expected;
+			MODE_SPEC Preferred = {};
+			uint32_t Rejected = 0;
+			uint32_t Duplicates = 0;
+			uint32_t Lines = Random() % 300;
+			for (uint32_t i = 0; i < Lines; i++)
+			{
+				uint32_t Width = Random() % 20000;
+				uint32_t Height = Random() % 20000;
+				uint32_t Refresh = Random() % 3 ? Random() % 1200 : Random() % 1200000;
+				if (Random() % 4 == 0)
+				{
+					Width = 1920 + Random() % 4;
+					Height = 1080;
+					Refresh = 60;
+				}
+				Text += std::to_string(Width) + ", " + std::to_string(Height) + "," + std::to_string(Refresh) + "\n";
+
+				uint32_t VSync = Refresh < 1000 ? Refresh * 1000 : Refresh;
+				uint32_t Short = std::min(Width, Height);
+				uint32_t Long = std::max(Width, Height);
+				if (Short < ModeMinSize || Long > ModeMaxSize || Long > Short * ModeMaxAspect || VSync < ModeMinVSync || VSync > ModeMaxVSync)
+				{
+					Rejected++;
+					continue;
+				}
+				MODE_SPEC Spec = { Width, Height, RefreshRateFromMillihertz(Refresh) };
+				Preferred = Expected.empty() ? Spec : Preferred;
+				Duplicates += !Expected.insert(Spec).second;
+			}
+
+			ModeList List;
+			MODE_LIST_REPORT Report;
+			bool Compiled = List.Compile(Text.data(), Text.size(), Report);
+			Matching &= Compiled == !Expected.empty() && Report.Entries == Lines && Report.Rejected == Rejected &&
+				Report.Duplicates == Duplicates;
+			if (!Compiled)
+			{
+				continue;
+			}
+
+			Matching &= Report.Modes == Expected.size() && List.Count() == Expected.size();
+			size_t i = 0;
+			for (const MODE_SPEC& Spec : Expected)
+			{
+				Matching &= i < List.Count() && SameSpec(List.Specs()[i++], Spec.Width, Spec.Height, Spec.VSync.Numerator, Spec.VSync.Denominator);
+			}
+			const MODE_SPEC& Chosen = List.Specs()[List.PreferredIndex()];
+			Matching &= SameSpec(Chosen, Preferred.Width, Preferred.Height, Preferred.VSync.Numerator, Preferred.VSync.Denominator);
+		}
+		CHECK(Matching);
+	}
+
+	// 64 x 64 bit products, to compare fractions exactly without a 128-bit type
+	struct WIDE
+	{
+		uint64_t High;
+		uint64_t Low;
+	};
+
+	WIDE Multiply(uint64_t Left, uint64_t Right)
+	{
+		uint64_t LowLow = (Left & 0xffffffff) * (Right & 0xffffffff);
+		uint64_t LowHigh = (Left & 0xffffffff) * (Right >> 32);
+		uint64_t HighLow = (Left >> 32) * (Right & 0xffffffff);
+		uint64_t Middle = (LowLow >> 32) + (LowHigh & 0xffffffff) + (HighLow & 0xffffffff);
+		return { (Left >> 32) * (Right >> 32) + (LowHigh >> 32) + (HighLow >> 32) + (Middle >> 32), Middle << 32 | (LowLow & 0xffffffff) };
+	}
+
+	bool WideLess(const WIDE& Left, const WIDE& Right)
+	{
+		return Left.High != Right.High ? Left.High < Right.High : Left.Low < Right.Low;
+	}
+
+	WIDE Distance(WIDE Left, WIDE Right)
+	{
+		if (WideLess(Left, Right))
+		{
+			std::swap(Left, Right);
+		}
+		return { Left.High - Right.High - (Left.Low < Right.Low), Left.Low - Right.Low };
+	}
+
+	// Whether Rate is Numerator/Denominator reduced. When that doesn't fit in 32 bits, whether it's a convergent of it:
+	// a reduced h/k within 1/k^2, or the 32-bit maximum above 4 GHz.
+	bool IsRate(const FRACTION& Rate, uint64_t Numerator, uint64_t Denominator)
+	{
+		if (!Rate.Denominator || Gcd(Rate.Numerator, Rate.Denominator) != 1)
+		{
+			return false;
+		}
+
+		uint64_t Divisor = Gcd(Numerator, Denominator);
+		Numerator /= Divisor;
+		Denominator /= Divisor;
+		if (Numerator <= UINT32_MAX && Denominator <= UINT32_MAX)
+		{
+			return Rate.Numerator == Numerator && Rate.Denominator == Denominator;
+		}
+		if (Numerator / Denominator > UINT32_MAX || (Numerator / Denominator == UINT32_MAX && Numerator % Denominator))
+		{
+			return Rate.Numerator == UINT32_MAX && Rate.Denominator == 1;
+		}
+
+		WIDE Error = Distance(Multiply(Numerator, Rate.Denominator), Multiply(Rate.Numerator, Denominator));
+		return !Error.High && WideLess(Multiply(Error.Low, Rate.Denominator), WIDE{ 0, Denominator });
+	}
+
+	// What FillSignalInfo() reports for a mode requested at Numerator/Denominator Hz: that rate, a line rate of exactly
+	// that rate times the total lines, and the nearest whole pixel rate
+	bool IsExactTiming(const MODE_TIMING& Timing, uint64_t Numerator, uint64_t Denominator)
+	{
+		FRACTION VSync = { Timing.VSyncNumerator, Timing.VSyncDenominator };
+		FRACTION HSync = { Timing.HSyncNumerator, Timing.HSyncDenominator };
+		bool Rates = IsRate(VSync, Numerator, Denominator) && IsRate(HSync, (uint64_t)VSync.Numerator * Timing.TotalHeight, VSync.Denominator);
+
+		WIDE Error = Distance(Multiply(Timing.PixelRate, VSync.Denominator), Multiply(VSync.Numerator, (uint64_t)Timing.TotalWidth * Timing.TotalHeight));
+		bool PixelRate = !Error.High && Error.Low <= VSync.Denominator / 2;
+
+		bool Totals = Timing.TotalWidth > Timing.Width && Timing.TotalHeight > Timing.Height;
+		return Rates && PixelRate && Totals;
+	}
+
+	void TestMakeFraction()
+	{
+		CHECK(FractionEqual(MakeFraction(0, 5), FRACTION{ 0, 1 }));
+		CHECK(FractionEqual(MakeFraction(5, 0), FRACTION{ 0, 1 }));
+		CHECK(FractionEqual(MakeFraction(0, 0), FRACTION{ 0, 1 }));
+		CHECK(FractionEqual(MakeFraction(59940, 1000), FRACTION{ 2997, 50 }));
+		CHECK(FractionEqual(MakeFraction(UINT64_MAX, 1), FRACTION{ UINT32_MAX, 1 }));
+		CHECK(FractionEqual(MakeFraction((uint64_t)UINT32_MAX + 1, 1), FRACTION{ UINT32_MAX, 1 }));
+		CHECK(FractionEqual(MakeFraction(UINT64_MAX, UINT64_MAX), FRACTION{ 1, 1 }));
+		CHECK(IsRate(MakeFraction(1, (uint64_t)1 << 40), 1, (uint64_t)1 << 40));
+
+		// Fractions of 32-bit terms come out exact whatever their common factor, others as a close convergent
+		std::mt19937_64 Random(3);
+		bool Reduced = true;
+		bool Closest = true;
+		for (int i = 0; i < 1000000; i++)
+		{
+			uint64_t Numerator = 1 + Random() % UINT32_MAX;
+			uint64_t Denominator = 1 + Random() % UINT32_MAX;
+			uint64_t Factor = 1 + Random() % (UINT64_MAX / std::max(Numerator, Denominator));
+			Reduced &= IsRate(MakeFraction(Numerator * Factor, Denominator * Factor), Numerator, Denominator);
+
+			Numerator = 1 + (Random() >> Random() % 64);
+			Denominator = 1 + (Random() >> Random() % 64);
+			Closest &= IsRate(MakeFraction(Numerator, Denominator), Numerator, Denominator);
+		}
+		CHECK(Reduced);
+		CHECK(Closest);
+	}
+
+	void TestMillihertzRates()
+	{
+		// Every N/1.001 Hz up to the limit, in mHz rounded or truncated, is exactly N*1000/1001 Hz. 2 mHz off it's not.
+		bool Snapped = true;
+		bool Apart = true;
+		bool Whole = true;
+		for (uint64_t N = 1; N <= ModeMaxVSync / 1000; N++)
+		{
+			uint32_t Truncated = (uint32_t)(N * 1000000 / 1001);
+			uint32_t Rounded = (uint32_t)((N * 1000000 + 500) / 1001);
+			for (uint32_t Rate : { Truncated, Rounded })
+			{
+				// Below 1000, rates are read as hertz, and whole ones stay whole: 999000 is 999 Hz, not 1000000/1001
+				Snapped &= Rate < 1000 || Rate % 1000 == 0 || IsRate(RefreshRateFromMillihertz(Rate), N * 1000, 1001);
+			}
+			Apart &= Truncated - 2 < 1000 || IsRate(RefreshRateFromMillihertz(Truncated - 2), Truncated - 2, 1000);
+			Whole &= IsRate(RefreshRateFromMillihertz((uint32_t)N * 1000), N, 1) && (N >= 1000 || IsRate(RefreshRateFromMillihertz((uint32_t)N), N, 1));
+		}
+		CHECK(Snapped);
+		CHECK(Apart);
+		CHECK(Whole);
+
+		// Any 32-bit rate is exact: m/1000, or N*1000/1001 Hz within a millihertz of it
+		std::mt19937 Random(4);
+		bool Exact = true;
+		for (int i = 0; i < 1000000; i++)
+		{
+			uint32_t Rate = i ? (uint32_t)Random() : UINT32_MAX;
+			FRACTION VSync = RefreshRateFromMillihertz(Rate);
+			if (Rate < 1000 || IsRate(VSync, Rate, 1000))
+			{
+				Exact &= Rate >= 1000 || IsRate(VSync, Rate, 1);
+				continue;
+			}
+			uint64_t Scaled = (uint64_t)VSync.Numerator * 1001;
+			uint64_t N = Scaled / ((uint64_t)VSync.Denominator * 1000);
+			int64_t Error = (int64_t)Rate * 1001 - (int64_t)N * 1000000;
+			Exact &= Scaled % ((uint64_t)VSync.Denominator * 1000) == 0 && Rate % 1000 && Error >= -1001 && Error <= 1001;
+		}
+		CHECK(Exact);
+	}
+
+	// A 59.94 Hz monitor: N/1.001 Hz defaults with the blank of N Hz, exactly 120000/1001 Hz for the second rate
+	void TestNtscMonitor()
+	{
+		ModeList Defaults;
+		std::vector<MODE_TIMING> Modes;
+		MODE_SPEC Preferred = { 1920, 1080, RefreshRateFromMillihertz(59940) };
+		FRACTION SecondVSync = MultiplyFraction(Preferred.VSync, 2, 1);
+		CHECK(FractionEqual(SecondVSync, FRACTION{ 120000, 1001 }));
+		uint32_t PreferredIndex = BuildMonitorModes(Defaults, Preferred, SecondVSync, Modes);
+
+		bool Exact = true;
+		bool VideoOptimized = true;
+		for (size_t i = 0; i < DefaultModeCount; i++)
+		{
+			const MODE_TIMING& Timing = Modes[i];
+			Exact &= IsExactTiming(Timing, DefaultModes[i].VSync.Numerator * 1000ull, 1001);
+			VideoOptimized &= MakeCvtRbV2Timing(Timing.Width, Timing.Height, Timing.VSyncNumerator, Timing.VSyncDenominator).VideoOptimized &&
+				Timing.TotalHeight == DefaultModeTimings[i].TotalHeight &&
+				(DefaultModeTimings[i].PixelRate * 1000 + 500) / 1001 - Timing.PixelRate <= 1;
+		}
+		CHECK(Exact);
+		CHECK(VideoOptimized);
+		CHECK(IsExactTiming(Modes[PreferredIndex], 60000, 1001));
+		CHECK(IsExactTiming(Modes[PreferredIndex + 1], 120000, 1001));
+		CHECK(memcmp(&Modes[PreferredIndex], &NtscTimings[0], sizeof(MODE_TIMING)) == 0);
+	}
+
+	// The IOCTL_ADD_VIRTUAL_DISPLAY path: the rate in mHz or as a fraction, validated like the IOCTL does, the monitor's
+	// modes built from it, and FillSignalInfo() copying every timing as is. Also run on a compiled list at the limits.
+	void TestRequestedRates()
+	{
+		ModeList Builtin;
+		ModeList Extremes;
+		MODE_LIST_REPORT Report;
+		const char Text[] = "320,1280,1\n1280,320,1000\n16384,4096,999999\n4096,16384,59940\n16384,16384,1000\n";
+		CHECK(Extremes.Compile(Text, sizeof(Text) - 1, Report));
+		CHECK_EQ(Extremes.Count(), 5u);
+
+		std::mt19937 Random(5);
+		std::vector<MODE_TIMING> Modes;
+		bool Exact = true;
+		int Accepted = 0;
+		for (int i = 0; i < 40000; i++)
+		{
+			uint32_t Width = 1 + Random() % ModeMaxSize;
+			uint32_t Height = 1 + Random() % ModeMaxSize;
+			uint32_t Rate;
+			uint32_t Denominator = 0;
+			switch (i % 4)
+			{
+			case 0:
+				Rate = (uint32_t)(((1 + Random() % 1000) * 1000000ull + (Random() % 2) * 500) / 1001);
+				break;
+			case 1:
+				Rate = 1 + Random() % ModeMaxVSync;
+				break;
+			case 2:
+				Denominator = 1 + Random() % UINT32_MAX;
+				Rate = 1 + (uint32_t)(Random() % std::min<uint64_t>((uint64_t)Denominator * 1000, UINT32_MAX));
+				break;
+			default:
+				Denominator = 1 + Random() % 1001;
+				Rate = (uint32_t)Random();
+				break;
+			}
+			if (i < 4)
+			{
+				// The largest mode at the highest rate, and at the slowest one
+				Width = Height = ModeMaxSize;
+				const uint32_t Limits[][2] = { { 1000000, 0 }, { 999999, 0 }, { UINT32_MAX, UINT32_MAX / 1000 + 1 }, { 1, UINT32_MAX } };
+				Rate = Limits[i][0];
+				Denominator = Limits[i][1];
+			}
+
+			FRACTION VSync = Denominator ? MakeFraction(Rate, Denominator) : RefreshRateFromMillihertz(Rate);
+			if (!VSync.Numerator || FractionLess(FRACTION{ ModeMaxVSync / 1000, 1 }, VSync))
+			{
+				continue;
+			}
+			Accepted++;
+
+			const ModeList& Defaults = i % 2 ? Extremes : Builtin;
+			MODE_SPEC Preferred = { Width, Height, VSync };
+			uint32_t PreferredIndex = BuildMonitorModes(Defaults, Preferred, MultiplyFraction(VSync, 2, 1), Modes);
+			Exact &= PreferredIndex == Defaults.Count() && Modes.size() == Defaults.Count() + PreferredModeCount;
+
+			// Whole hertz defaults follow a rate just below a whole one by the rate over that whole one
+			uint64_t WholeRate = ((uint64_t)VSync.Numerator * 2 + VSync.Denominator) / ((uint64_t)VSync.Denominator * 2);
+			bool FollowRate = WholeRate && VSync.Numerator < WholeRate * VSync.Denominator;
+			for (size_t j = 0; j < Defaults.Count(); j++)
+			{
+				const FRACTION& Default = Defaults.Specs()[j].VSync;
+				if (FollowRate && Default.Denominator == 1)
+				{
+					Exact &= IsExactTiming(Modes[j], (uint64_t)Default.Numerator * VSync.Numerator, VSync.Denominator * WholeRate);
+				}
+				else
+				{
+					Exact &= IsExactTiming(Modes[j], Default.Numerator, Default.Denominator);
+				}
+			}
+			for (size_t j = 0; j < ModeScaleFactorCount; j++)
+			{
+				Exact &= IsExactTiming(Modes[PreferredIndex + j * 2], VSync.Numerator, VSync.Denominator);
+				Exact &= IsExactTiming(Modes[PreferredIndex + j * 2 + 1], VSync.Numerator * 2ull, VSync.Denominator);
+			}
+		}
+		CHECK(Exact);
+		CHECK(Accepted > 20000);
+	}
+}
+
+int main()
+{
+	TestDefaults();
+	TestWithoutPreferredMode();
+	TestPreferredMode();
+	TestFollowedRate();
+	TestModeFile();
+	TestIssueLimit();
+	TestModeFileFuzz();
+	TestMakeFraction();
+	TestMillihertzRates();
+	TestNtscMonitor();
+	TestRequestedRates();
+	return TEST_RESULT();
+}
@@ -0,0 +1,144 @@
+// Pixel conversion throughput at 1080p, 4K and 8K for every conversion and every instruction set the CPU supports.
+// The numbers depend on the machine and are only reported, what is checked is that each SIMD path's NV12 output
+// matches the scalar one byte for byte at these sizes too.
+
+#include "TestHarness.h"
+#include "PixelConvert.h"
+
+#include <string.h>
+
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	const char* IsaNames[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+
+	// Float to FP16 by truncation, enough to feed the converter values in range
+	uint16_t ToHalf(float Value)
+	{
+		uint32_t Bits;
+		memcpy(&Bits, &Value, sizeof(Bits));
+		uint32_t Sign = (Bits >> 16) & 0x8000;
+		int32_t Exponent = (int32_t)((Bits >> 23) & 0xff) - 127 + 15;
+		if (Exponent <= 0)
+		{
+			return (uint16_t)Sign;
+		}
+		if (Exponent >= 31)
+		{
+			return (uint16_t)(Sign | 0x7c00);
+		}
+		return (uint16_t)(Sign | (Exponent << 10) | ((Bits & 0x7fffff) >> 13));
+	}
+
+	struct BUFFERS
+	{
+		std::vector<uint8_t> Bgra;
+		std::vector<uint16_t> ScRgb;
+		std::vector<uint8_t> Y, U, V;
+		std::vector<uint16_t> Y16, UV16;
+		std::vector<uint8_t> ReferenceY, ReferenceUV;
+	};
+
+	template <typename Convert>
+	void Measure(const char* Name, uint32_t Width, uint32_t Height, int Runs, size_t SourceBytes, Convert Function)
+	{
+		Function();
+		uint64_t Start = SudoVdaTest::NowNs();
+		for (int i = 0; i < Runs; i++)
+		{
+			Function();
+		}
+		uint64_t ElapsedNs = (SudoVdaTest::NowNs() - Start) / Runs;
+		printf("  %-12s %8.2f ms/frame %6.2f GB/s %6.2f ns/pixel\n", Name, ElapsedNs / 1e6,
+			(double)SourceBytes / ElapsedNs, (double)ElapsedNs / ((uint64_t)Width * Height));
+	}
+
+	void Run(BUFFERS& Buffers, PIXEL_CONVERT_ISA Isa, uint32_t Width, uint32_t Height, int Runs)
+	{
+		CHECK(PixelConvertSetIsa(Isa));
+		printf("%ux%u %s\n", Width, Height, IsaNames[Isa]);
+
+		const uint8_t* pBgra = Buffers.Bgra.data();
+		const uint16_t* pScRgb = Buffers.ScRgb.data();
+		size_t BgraPitch = (size_t)Width * 4;
+		size_t ScRgbPitch = (size_t)Width * 4 * sizeof(uint16_t);
+		size_t ChromaWidth = (Width + 1) / 2;
+		size_t Pixels = (size_t)Width * Height;
+		uint8_t* pY = Buffers.Y.data();
+		uint8_t* pU = Buffers.U.data();
+		uint8_t* pV = Buffers.V.data();
+
+		Measure("BGRA->NV12", Width, Height, Runs, Pixels * 4, [&] {
+			ConvertBgraToNv12(pBgra, BgraPitch, Width, Height, pY, Width, pU, ChromaWidth * 2);
+		});
+		if (Isa == PIXEL_CONVERT_ISA_SCALAR)
+		{
+			Buffers.ReferenceY.assign(pY, pY + Pixels);
+			Buffers.ReferenceUV.assign(pU, pU + ChromaWidth * 2 * ((Height + 1) / 2));
+		}
+		else
+		{
+			CHECK(memcmp(pY, Buffers.ReferenceY.data(), Buffers.ReferenceY.size()) == 0);
+			CHECK(memcmp(pU, Buffers.ReferenceUV.data(), Buffers.ReferenceUV.size()) == 0);
+		}
+
+		Measure("BGRA->I420", Width, Height, Runs, Pixels * 4, [&] {
+			ConvertBgraToI420(pBgra, BgraPitch, Width, Height, pY, Width, pU, ChromaWidth, pV, ChromaWidth);
+		});
+		Measure("BGRA->YUV444", Width, Height, Runs, Pixels * 4, [&] {
+			ConvertBgraToYuv444(pBgra, BgraPitch, Width, Height, pY, Width, pU, Width, pV, Width);
+		});
+		Measure("FP16->P010", Width, Height, Runs, Pixels * 8, [&] {
+			ConvertScRgbToP010(pScRgb, ScRgbPitch, Width, Height, Buffers.Y16.data(), Width * sizeof(uint16_t),
+				Buffers.UV16.data(), ChromaWidth * 2 * sizeof(uint16_t));
+		});
+	}
+}
+
+int main()
+{
+	const struct {
+		uint32_t Width;
+		uint32_t Height;
+		int Runs;
+	} Sizes[] = { { 1920, 1080, 16 }, { 3840, 2160, 4 }, { 7680, 4320, 1 } };
+
+	// Sized for 8K, smaller frames use the start of each buffer
+	constexpr size_t MaxPixels = (size_t)7680 * 4320;
+	BUFFERS Buffers;
+	Buffers.Bgra.resize(MaxPixels * 4);
+	Buffers.ScRgb.resize(MaxPixels * 4);
+	Buffers.Y.resize(MaxPixels);
+	Buffers.U.resize(MaxPixels);
+	Buffers.V.resize(MaxPixels);
+	Buffers.Y16.resize(MaxPixels);
+	Buffers.UV16.resize(MaxPixels / 2);
+
+	// Desktop-like content, smooth gradients broken up by noise, and HDR light up to 1000 nits
+	uint32_t Random = 1;
+	for (size_t i = 0; i < MaxPixels * 4; i++)
+	{
+		Random = Random * 1103515245 + 12345;
+		Buffers.Bgra[i] = (uint8_t)((i / 4 % 7680) / 30 + (Random >> 28));
+		Buffers.ScRgb[i] = ToHalf(i % 4 == 3 ? 1.0f : (Random >> 8) % 12500 / 1000.0f);
+	}
+
+	const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2,
+		PIXEL_CONVERT_ISA_NEON };
+	for (const auto& Size : Sizes)
+	{
+		for (auto Isa : Isas)
+		{
+			if (PixelConvertIsaSupported(Isa))
+			{
+				Run(Buffers, Isa, Size.Width, Size.Height, Size.Runs);
+			}
+		}
+	}
+
+	CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	return TEST_RESULT();
+}
@@ -0,0 +1,224 @@
+// Pixel conversion: reference code values for the scalar path, and cross-ISA equivalence of every SIMD path the CPU
+// supports (SSE4.1 and AVX2 on x64, NEON on ARM64) against the scalar one, including odd sizes, unaligned pitches and
+// writes outside the planes.
+
+#include "TestHarness.h"
+#include "PixelConvert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr uint8_t Guard = 0xEE;
+
+	// Float to FP16 by truncation, enough to feed the converter values in range
+	uint16_t ToHalf(float Value)
+	{
+		uint32_t Bits;
+		memcpy(&Bits, &Value, sizeof(Bits));
+		uint32_t Sign = (Bits >> 16) & 0x8000;
+		int32_t Exponent = (int32_t)((Bits >> 23) & 0xff) - 127 + 15;
+		if (Exponent <= 0)
+		{
+			return (uint16_t)Sign;
+		}
+		if (Exponent >= 31)
+		{
+			return (uint16_t)(Sign | 0x7c00);
+		}
+		return (uint16_t)(Sign | (Exponent << 10) | ((Bits & 0x7fffff) >> 13));
+	}
+
+	void TestReferenceValues()
+	{
+		CHECK(PixelConvertSetIsa(PIXEL_CONVERT_ISA_SCALAR));
+		CHECK_EQ(PixelConvertGetIsa(), PIXEL_CONVERT_ISA_SCALAR);
+
+		// BT.709 limited range
+		const struct {
+			uint8_t Bgra[4];
+			uint8_t Y, U, V;
+		} Colors[] = {
+			{ { 255, 255, 255, 255 }, 235, 128, 128 },
+			{ { 0, 0, 0, 255 }, 16, 128, 128 },
+			{ { 0, 0, 255, 255 }, 63, 102, 240 },
+		};
+		for (const auto& Color : Colors)
+		{
+			uint8_t Y, UV[2], U, V, Y444, U444, V444;
+			ConvertBgraToNv12(Color.Bgra, 4, 1, 1, &Y, 1, UV, 2);
+			CHECK_EQ(Y, Color.Y);
+			CHECK_EQ(UV[0], Color.U);
+			CHECK_EQ(UV[1], Color.V);
+			ConvertBgraToI420(Color.Bgra, 4, 1, 1, &Y, 1, &U, 1, &V, 1);
+			CHECK_EQ(U, Color.U);
+			CHECK_EQ(V, Color.V);
+			ConvertBgraToYuv444(Color.Bgra, 4, 1, 1, &Y444, 1, &U444, 1, &V444, 1);
+			CHECK_EQ(Y444, Color.Y);
+			CHECK_EQ(U444, Color.U);
+			CHECK_EQ(V444, Color.V);
+		}
+
+		// PQ limited range, 1.0 is 80 nits and 125.0 the 10000 nit peak
+		const struct {
+			float Value;
+			uint16_t Y;
+		} Grays[] = { { 0.0f, 64 }, { 1.0f, 490 }, { 2.5f, 571 }, { 125.0f, 940 }, { 500.0f, 940 } };
+		for (const auto& Gray : Grays)
+		{
+			uint16_t Pixel[4] = { ToHalf(Gray.Value), ToHalf(Gray.Value), ToHalf(Gray.Value), ToHalf(1.0f) };
+			uint16_t Y, UV[2];
+			ConvertScRgbToP010(Pixel, 8, 1, 1, &Y, 2, UV, 4);
+			CHECK_EQ(Y >> 6, Gray.Y);
+			CHECK_EQ(Y & 0x3f, 0);
+			CHECK_EQ(UV[0] >> 6, 512);
+			CHECK_EQ(UV[1] >> 6, 512);
+		}
+	}
+
+	typedef struct _OUTPUT {
+		std::vector<uint8_t> Nv12;
+		std::vector<uint8_t> I420;
+		std::vector<uint8_t> Yuv444;
+		std::vector<uint16_t> P010;
+	} OUTPUT;
+
+	// Planes are laid out with padded pitches, so a kernel writing past a row shows up as a changed guard byte
+	OUTPUT Convert(const std::vector<uint8_t>& Bgra, size_t BgraPitch, const std::vector<uint16_t>& ScRgb,
+		size_t ScRgbPitch, uint32_t Width, uint32_t Height)
+	{
+		size_t ChromaWidth = (Width + 1) / 2;
+		size_t ChromaHeight = (Height + 1) / 2;
+		size_t YPitch = Width + 3;
+		size_t CPitch = ChromaWidth + 5;
+		OUTPUT Output;
+
+		Output.Nv12.assign(YPitch * Height + (CPitch * 2) * ChromaHeight, Guard);
+		ConvertBgraToNv12(Bgra.data(), BgraPitch, Width, Height, Output.Nv12.data(), YPitch,
+			Output.Nv12.data() + YPitch * Height, CPitch * 2);
+
+		Output.I420.assign(YPitch * Height + 2 * CPitch * ChromaHeight, Guard);
+		uint8_t* pU = Output.I420.data() + YPitch * Height;
+		ConvertBgraToI420(Bgra.data(), BgraPitch, Width, Height, Output.I420.data(), YPitch, pU, CPitch,
+			pU + CPitch * ChromaHeight, CPitch);
+
+		Output.Yuv444.assign(3 * YPitch * Height, Guard);
+		uint8_t* pPlane = Output.Yuv444.data();
+		ConvertBgraToYuv444(Bgra.data(), BgraPitch, Width, Height, pPlane, YPitch, pPlane + YPitch * Height, YPitch,
+			pPlane + 2 * YPitch * Height, YPitch);
+
+		Output.P010.assign(YPitch * Height + CPitch * 2 * ChromaHeight, (uint16_t)(Guard << 8 | Guard));
+		ConvertScRgbToP010(ScRgb.data(), ScRgbPitch, Width, Height, Output.P010.data(), YPitch * 2,
+			Output.P010.data() + YPitch * Height, CPitch * 4);
+
+		return Output;
+	}
+
+	bool GuardsIntact(const std::vector<uint8_t>& Plane, size_t Pitch, uint32_t Width, uint32_t Rows, size_t Offset)
+	{
+		for (uint32_t Row = 0; Row < Rows; Row++)
+		{
+			for (size_t x = Width; x < Pitch; x++)
+			{
+				if (Plane[Offset + Row * Pitch + x] != Guard)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	void TestIsaEquivalence()
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON };
+		const char* Names[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+		const uint32_t Sizes[][2] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 17, 3 }, { 33, 7 }, { 63, 9 }, { 64, 2 }, { 131, 77 }, { 1920, 1080 } };
+		std::mt19937 Random(1);
+		std::uniform_real_distribution<float> Light(-0.2f, 20.0f);
+
+		CHECK(PixelConvertIsaSupported(PIXEL_CONVERT_ISA_SCALAR));
+		CHECK(PixelConvertIsaSupported(PixelConvertBestIsa()));
+
+		int Compared = 0;
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertIsaSupported(Isa))
+			{
+				CHECK(!PixelConvertSetIsa(Isa));
+				printf("%s not supported, skipped\n", Names[Isa]);
+				continue;
+			}
+
+			for (const auto& Size : Sizes)
+			{
+				uint32_t Width = Size[0];
+				uint32_t Height = Size[1];
+
+				// Unaligned pitches on purpose
+				size_t BgraPitch = Width * 4 + 12;
+				std::vector<uint8_t> Bgra(BgraPitch * Height);
+				for (auto& Value : Bgra)
+				{
+					Value = (uint8_t)Random();
+				}
+				size_t ScRgbPitch = (Width * 4 + 6) * sizeof(uint16_t);
+				std::vector<uint16_t> ScRgb(ScRgbPitch / sizeof(uint16_t) * Height);
+				for (auto& Value : ScRgb)
+				{
+					Value = ToHalf(Random() % 50 ? Light(Random) : 125.0f);
+				}
+
+				CHECK(PixelConvertSetIsa(PIXEL_CONVERT_ISA_SCALAR));
+				OUTPUT Reference = Convert(Bgra, BgraPitch, ScRgb, ScRgbPitch, Width, Height);
+				CHECK(PixelConvertSetIsa(Isa));
+				OUTPUT Output = Convert(Bgra, BgraPitch, ScRgb, ScRgbPitch, Width, Height);
+
+				// The 8-bit conversions are bit-exact, guard bytes included
+				if (Output.Nv12 != Reference.Nv12 || Output.I420 != Reference.I420 || Output.Yuv444 != Reference.Yuv444)
+				{
+					fprintf(stderr, "%s differs from scalar at %ux%u\n", Names[Isa], Width, Height);
+					CHECK(Output.Nv12 == Reference.Nv12);
+					CHECK(Output.I420 == Reference.I420);
+					CHECK(Output.Yuv444 == Reference.Yuv444);
+				}
+
+				// P010 may be off by one code value, its low 6 bits stay clear
+				int MaxDifference = 0;
+				bool LowBitsClear = true;
+				for (size_t i = 0; i < Output.P010.size(); i++)
+				{
+					int Difference = abs((int)(Output.P010[i] >> 6) - (int)(Reference.P010[i] >> 6));
+					MaxDifference = Difference > MaxDifference ? Difference : MaxDifference;
+					LowBitsClear &= Output.P010[i] == Reference.P010[i] || !(Output.P010[i] & 0x3f);
+				}
+				CHECK(MaxDifference <= 1);
+				CHECK(LowBitsClear);
+
+				size_t YPitch = Width + 3;
+				CHECK(GuardsIntact(Output.Yuv444, YPitch, Width, Height * 3, 0));
+				CHECK(GuardsIntact(Output.Nv12, YPitch, Width, Height, 0));
+				CHECK(GuardsIntact(Output.Nv12, ((Width + 1) / 2 + 5) * 2, (Width + 1) / 2 * 2, (Height + 1) / 2, YPitch * Height));
+				CHECK(Output.Nv12.back() == Guard);
+			}
+
+			printf("%s matches scalar\n", Names[Isa]);
+			Compared++;
+		}
+
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+		CHECK(Compared > 0 || PixelConvertBestIsa() == PIXEL_CONVERT_ISA_SCALAR);
+	}
+}
+
+int main()
+{
+	TestReferenceValues();
+	TestIsaEquivalence();
+	return TEST_RESULT();
+}
@@ -0,0 +1,184 @@
+// StagingRing scheduling against FakeStagingBackend: slot order, fence polling, stalls when every slot is in flight,
+// and that no frame is ever dropped or reordered.
+
+#include "TestHarness.h"
+#include "StagingRing.h"
+
+#include <deque>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	class FakeClock : public IPacingClock
+	{
+	public:
+		uint64_t Now() override
+		{
+			return Tick;
+		}
+
+		uint64_t Frequency() override
+		{
+			return 1000;
+		}
+
+		uint64_t Tick = 0;
+	};
+
+	void TestSlotStates()
+	{
+		FakeClock Clock;
+		FakeStagingBackend Backend(Clock, 5);
+		CHECK_EQ(StagingRing(Backend, 0).SlotCount(), 1u);
+		CHECK_EQ(StagingRing(Backend, 100).SlotCount(), StagingRing::MaxSlots);
+
+		StagingRing Ring(Backend, 2);
+		CHECK_EQ(Ring.AcquireReadable(true), -1);
+
+		CHECK_EQ(Ring.BeginCopy(), 0);
+		CHECK_EQ(Ring.SlotState(0), STAGING_SLOT_RECORDING);
+		// Not submitted yet, nothing to read
+		CHECK_EQ(Ring.InFlight(), 0u);
+		CHECK_EQ(Ring.AcquireReadable(false), -1);
+		Ring.EndCopy(0);
+		CHECK_EQ(Ring.SlotState(0), STAGING_SLOT_COPYING);
+		CHECK_EQ(Ring.InFlight(), 1u);
+
+		// The copy takes 5 ticks, polling doesn't block
+		CHECK_EQ(Ring.AcquireReadable(false), -1);
+		CHECK_EQ(Ring.SlotState(0), STAGING_SLOT_COPYING);
+		Clock.Tick = 5;
+		CHECK_EQ(Ring.AcquireReadable(false), 0);
+		CHECK_EQ(Ring.SlotState(0), STAGING_SLOT_READING);
+
+		// The slot being read is neither handed out again nor reused for a copy
+		CHECK_EQ(Ring.AcquireReadable(true), -1);
+		CHECK_EQ(Ring.BeginCopy(), 1);
+		Ring.EndCopy(1);
+		CHECK_EQ(Ring.BeginCopy(), -1);
+		Ring.EndRead(0);
+		CHECK_EQ(Ring.SlotState(0), STAGING_SLOT_FREE);
+		CHECK_EQ(Ring.Stats().Stalls, 0u);
+
+		// Waiting on a running copy counts a stall and accounts the blocked time
+		CHECK_EQ(Ring.AcquireReadable(true), 1);
+		CHECK_EQ(Ring.Stats().Stalls, 1u);
+		CHECK_EQ(Backend.WaitedTicks(), 5u);
+		Ring.EndRead(1);
+		CHECK_EQ(Ring.Stats().Copies, 2u);
+		CHECK_EQ(Ring.Stats().Readbacks, 2u);
+
+		// Reset forgets in-flight frames
+		Ring.EndCopy(Ring.BeginCopy());
+		CHECK_EQ(Ring.InFlight(), 1u);
+		Ring.Reset();
+		CHECK_EQ(Ring.InFlight(), 0u);
+		CHECK_EQ(Ring.BeginCopy(), 0);
+	}
+
+	typedef struct _SIMULATION {
+		uint64_t Frames;
+		uint64_t Stalls;
+		uint64_t WaitedTicks;
+		bool InOrder;
+	} SIMULATION;
+
+	// Drives the ring like the swap-chain loop: read back whatever retired, then copy the new frame, waiting for the
+	// oldest frame only when no slot is free
+	SIMULATION Simulate(uint32_t SlotCount, uint64_t FrameInterval, uint64_t CopyLatency, uint64_t Frames)
+	{
+		FakeClock Clock;
+		FakeStagingBackend Backend(Clock, CopyLatency);
+		StagingRing Ring(Backend, SlotCount);
+		std::deque<uint64_t> Pending;
+		uint64_t SlotFrame[StagingRing::MaxSlots] = {};
+		uint64_t NextRead = 0;
+		SIMULATION Result = { 0, 0, 0, true };
+
+		auto Read = [&](int32_t Slot) {
+			Result.InOrder &= SlotFrame[Slot] == NextRead;
+			NextRead++;
+			Ring.EndRead((uint32_t)Slot);
+		};
+
+		for (uint64_t Frame = 0; Frame < Frames; Frame++)
+		{
+			Clock.Tick += FrameInterval;
+
+			int32_t Slot;
+			while ((Slot = Ring.AcquireReadable(false)) >= 0)
+			{
+				Read(Slot);
+			}
+
+			Slot = Ring.BeginCopy();
+			if (Slot < 0)
+			{
+				Read(Ring.AcquireReadable(true));
+				Slot = Ring.BeginCopy();
+			}
+
+			Result.InOrder &= Slot == (int32_t)(Frame % Ring.SlotCount());
+			SlotFrame[Slot] = Frame;
+			Ring.EndCopy((uint32_t)Slot);
+		}
+
+		// Drain
+		int32_t Slot;
+		while ((Slot = Ring.AcquireReadable(true)) >= 0)
+		{
+			Read(Slot);
+		}
+
+		Result.Frames = NextRead;
+		Result.Stalls = Ring.Stats().Stalls;
+		Result.WaitedTicks = Backend.WaitedTicks();
+		Result.InOrder &= Ring.Stats().Copies == Frames && Ring.Stats().Readbacks == Frames;
+		return Result;
+	}
+
+	void TestPipelining()
+	{
+		// A copy that takes 2.5 frames: one slot waits 6 of the copy's 10 ticks on every frame, the final drain the whole
+		// copy, three slots hide the latency entirely
+		auto Single = Simulate(1, 4, 10, 1000);
+		CHECK_EQ(Single.Frames, 1000u);
+		CHECK(Single.InOrder);
+		CHECK_EQ(Single.Stalls, 1000u);
+		CHECK_EQ(Single.WaitedTicks, 999u * 6 + 10);
+
+		auto Triple = Simulate(3, 4, 10, 1000);
+		CHECK_EQ(Triple.Frames, 1000u);
+		CHECK(Triple.InOrder);
+		// Only the final drain waits
+		CHECK(Triple.Stalls <= 3);
+
+		// Two slots still stall on every frame, but only for the 2 ticks the copy runs past the second frame
+		auto Double = Simulate(2, 4, 10, 1000);
+		CHECK(Double.InOrder);
+		CHECK_EQ(Double.Stalls, Single.Stalls);
+		CHECK(Double.WaitedTicks < Single.WaitedTicks / 2);
+
+		// Below two frames of latency, two slots are enough
+		auto Short = Simulate(2, 4, 6, 1000);
+		CHECK(Short.InOrder);
+		CHECK(Short.Stalls <= 2);
+
+		// A copy faster than a frame never stalls, whatever the slot count
+		for (uint32_t Slots = 1; Slots <= StagingRing::MaxSlots; Slots++)
+		{
+			auto Fast = Simulate(Slots, 10, 3, 500);
+			CHECK(Fast.InOrder);
+			CHECK_EQ(Fast.Frames, 500u);
+			CHECK(Fast.Stalls <= Slots);
+		}
+	}
+}
+
+int main()
+{
+	TestSlotStates();
+	TestPipelining();
+	return TEST_RESULT();
+}
@@ -0,0 +1,270 @@
+// Swap-chain assignment against a simulated IddCx: a parked processing thread re-armed with a series of swap-chains
+// that are each deleted exactly once, releases racing the pickup, shutdown, and the phase timer's bookkeeping.
+
+#include "TestHarness.h"
+#include "SwapChainAssign.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	// What IddCx hands the driver: buffers show up once the OS presents them, after the device was set
+	struct SimSwapChain
+	{
+		std::atomic<bool> DeviceSet{ false };
+		std::atomic<uint32_t> Presented{ 0 };
+		std::atomic<uint32_t> Acquired{ 0 };
+		std::atomic<uint32_t> Deletes{ 0 };
+	};
+
+	struct Assignment
+	{
+		SimSwapChain* pSwapChain = nullptr;
+		uint64_t AssignId = 0;
+	};
+
+	// The auto-reset event the processing thread waits on for new buffers
+	class Event
+	{
+	public:
+		void Set()
+		{
+			{
+				std::lock_guard<std::mutex> lg(m_Lock);
+				m_Signaled = true;
+			}
+			m_Changed.notify_all();
+		}
+
+		void Wait()
+		{
+			std::unique_lock<std::mutex> ul(m_Lock);
+			m_Changed.wait(ul, [this] { return m_Signaled; });
+			m_Signaled = false;
+		}
+
+	private:
+		std::mutex m_Lock;
+		std::condition_variable m_Changed;
+		bool m_Signaled = false;
+	};
+
+	// The swap-chain processing thread as the driver runs it: parked between swap-chains, acquiring buffers until it
+	// is asked to let go, and deleting the swap-chain itself
+	class Processor
+	{
+	public:
+		explicit Processor(AssignPhaseTimer& Timer) :
+			m_Timer(Timer),
+			m_Thread([this] { Run(); })
+		{
+		}
+
+		~Processor()
+		{
+			Rearm.Shutdown();
+			Wake.Set();
+			m_Thread.join();
+		}
+
+		// Assigning thread: takes the running swap-chain away
+		void Release()
+		{
+			if (Rearm.RequestRelease())
+			{
+				Wake.Set();
+				Rearm.WaitReleased();
+			}
+		}
+
+		SwapChainRearm<Assignment> Rearm;
+		Event Wake;
+
+	private:
+		void Run()
+		{
+			Assignment Current;
+			while (Rearm.WaitForAssignment(Current))
+			{
+				SimSwapChain& SwapChain = *Current.pSwapChain;
+				m_Timer.Mark(Current.AssignId, ASSIGN_PHASE_THREAD, SudoVdaTest::NowNs());
+				if (!Rearm.ShouldRelease())
+				{
+					SwapChain.DeviceSet = true;
+					m_Timer.Mark(Current.AssignId, ASSIGN_PHASE_SET_DEVICE, SudoVdaTest::NowNs());
+
+					while (!Rearm.ShouldRelease())
+					{
+						while (SwapChain.Acquired < SwapChain.Presented)
+						{
+							SwapChain.Acquired++;
+							m_Timer.Mark(Current.AssignId, ASSIGN_PHASE_FIRST_FRAME, SudoVdaTest::NowNs());
+						}
+						Wake.Wait();
+					}
+				}
+
+				SwapChain.Deletes++;
+				Rearm.Released();
+			}
+		}
+
+		AssignPhaseTimer& m_Timer;
+		std::thread m_Thread;
+	};
+
+	// The OS presents a buffer and waits until the processing thread acquired it
+	void Present(Processor& Processor, SimSwapChain& SwapChain)
+	{
+		uint32_t Target = ++SwapChain.Presented;
+		Processor.Wake.Set();
+		while (SwapChain.Acquired < Target)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// One processing thread serves a series of assignments, some of them replaced before their first frame
+	void TestRearm()
+	{
+		const int Assignments = 20;
+		AssignPhaseTimer Timer(1000000000);
+		Processor Processor(Timer);
+		std::vector<std::unique_ptr<SimSwapChain>> SwapChains;
+
+		for (int i = 0; i < Assignments; i++)
+		{
+			SwapChains.emplace_back(new SimSwapChain);
+			uint64_t Id = Timer.Begin(SudoVdaTest::NowNs(), i > 0);
+			Processor.Release();
+			Timer.Mark(Id, ASSIGN_PHASE_RELEASE, SudoVdaTest::NowNs());
+			Timer.Mark(Id, ASSIGN_PHASE_DEVICE, SudoVdaTest::NowNs());
+			CHECK(Processor.Rearm.Arm(Assignment{ SwapChains.back().get(), Id }));
+			CHECK(!Processor.Rearm.Arm(Assignment{ SwapChains.back().get(), Id }));
+			while (Processor.Rearm.Pickups() < (uint64_t)i + 1)
+			{
+				std::this_thread::yield();
+			}
+
+			// Every fifth one is replaced before the OS presents anything
+			if (i % 5 != 4)
+			{
+				Present(Processor, *SwapChains.back());
+				Present(Processor, *SwapChains.back());
+			}
+		}
+		Processor.Release();
+
+		CHECK_EQ(Processor.Rearm.State(), REARM_IDLE);
+		CHECK_EQ(Processor.Rearm.Pickups(), (uint64_t)Assignments);
+		bool DeletedOnce = true;
+		for (auto& SwapChain : SwapChains)
+		{
+			DeletedOnce &= SwapChain->Deletes == 1;
+		}
+		CHECK(DeletedOnce);
+
+		ASSIGN_TIMING_STATS Stats;
+		Timer.Snapshot(Stats);
+		CHECK_EQ(Stats.Assignments, (uint64_t)Assignments);
+		CHECK_EQ(Stats.Rearms, (uint64_t)Assignments - 1);
+		CHECK(Stats.LastRearmed);
+		// The last one never got a frame either, but nothing superseded it yet
+		CHECK_EQ(Stats.Failures, 3u);
+		CHECK_EQ(Stats.Phases[ASSIGN_PHASE_THREAD].Count, (uint64_t)Assignments);
+		CHECK_EQ(Stats.Phases[ASSIGN_PHASE_FIRST_FRAME].Count, 16u);
+		for (uint32_t i = 1; i < ASSIGN_PHASE_COUNT; i++)
+		{
+			CHECK(!Stats.LastPhaseNs[i] || Stats.LastPhaseNs[i] >= Stats.LastPhaseNs[i - 1]);
+		}
+	}
+
+	// A swap-chain released before the processing thread picked it up is still handed over to be deleted
+	void TestReleaseBeforePickup()
+	{
+		SimSwapChain SwapChain;
+		SwapChainRearm<Assignment> Rearm;
+		CHECK(!Rearm.RequestRelease());
+		CHECK(Rearm.Arm(Assignment{ &SwapChain, 1 }));
+		CHECK(Rearm.RequestRelease());
+
+		Assignment Current;
+		CHECK(Rearm.WaitForAssignment(Current));
+		CHECK(Current.pSwapChain == &SwapChain);
+		CHECK(Rearm.ShouldRelease());
+		Rearm.Released();
+		Rearm.WaitReleased();
+		CHECK_EQ(Rearm.State(), REARM_IDLE);
+		CHECK(!Rearm.RequestRelease());
+
+		Rearm.Shutdown();
+		CHECK_EQ(Rearm.State(), REARM_SHUTDOWN);
+		CHECK(!Rearm.WaitForAssignment(Current));
+		CHECK(!Rearm.Arm(Assignment{ &SwapChain, 2 }));
+	}
+
+	// Shutting down with a swap-chain running lets it go first
+	void TestShutdownWhileRunning()
+	{
+		SimSwapChain SwapChain;
+		SwapChainRearm<Assignment> Rearm;
+		Assignment Current;
+		CHECK(Rearm.Arm(Assignment{ &SwapChain, 1 }));
+		CHECK(Rearm.WaitForAssignment(Current));
+		CHECK_EQ(Rearm.State(), REARM_RUNNING);
+
+		Rearm.Shutdown();
+		CHECK(Rearm.ShouldRelease());
+		Rearm.Released();
+		CHECK_EQ(Rearm.State(), REARM_SHUTDOWN);
+		CHECK(!Rearm.WaitForAssignment(Current));
+		Rearm.WaitReleased();
+	}
+
+	// Stale and repeated marks are dropped, assignments superseded before their first frame count as failures
+	void TestPhaseTimer()
+	{
+		AssignPhaseTimer Timer(1000);
+		uint64_t First = Timer.Begin(100, false);
+		Timer.Mark(First, ASSIGN_PHASE_RELEASE, 105);
+		Timer.Mark(First, ASSIGN_PHASE_RELEASE, 200);
+		uint64_t Second = Timer.Begin(300, true);
+		Timer.Mark(First, ASSIGN_PHASE_DEVICE, 310);
+		Timer.Mark(Second, ASSIGN_PHASE_FIRST_FRAME, 350);
+		// Clocks that go backwards count as no time at all
+		Timer.Mark(Second, ASSIGN_PHASE_RELEASE, 290);
+
+		ASSIGN_TIMING_STATS Stats;
+		Timer.Snapshot(Stats);
+		CHECK_EQ(Stats.Assignments, 2u);
+		CHECK_EQ(Stats.Rearms, 1u);
+		CHECK_EQ(Stats.Failures, 1u);
+		CHECK(Stats.LastRearmed);
+		CHECK_EQ(Stats.LastPhaseNs[ASSIGN_PHASE_FIRST_FRAME], 50000000u);
+		CHECK_EQ(Stats.LastPhaseNs[ASSIGN_PHASE_RELEASE], 0u);
+		CHECK_EQ(Stats.LastPhaseNs[ASSIGN_PHASE_DEVICE], 0u);
+		CHECK_EQ(Stats.Phases[ASSIGN_PHASE_RELEASE].Count, 2u);
+		CHECK_EQ(Stats.Phases[ASSIGN_PHASE_DEVICE].Count, 0u);
+
+		// A third assignment after one that got its frame adds no failure
+		Timer.Begin(400, true);
+		Timer.Snapshot(Stats);
+		CHECK_EQ(Stats.Failures, 1u);
+	}
+}
+
+int main()
+{
+	TestRearm();
+	TestReleaseBeforePickup();
+	TestShutdownWhileRunning();
+	TestPhaseTimer();
+	return TEST_RESULT();
+}
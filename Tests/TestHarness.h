@@ -0,0 +1,46 @@
+#pragma once
+
+// Minimal assertion helpers for the portable tests.
+//
+// The driver itself only builds with the WDK, but every component that sticks to the standard library is also built
+// on Linux by the CMake project at the repository root, one executable per component. A test keeps going after a
+// failed check so a single run reports everything that is wrong, and returns non-zero from main() through
+// TEST_RESULT(). No third party framework is used so the tests build wherever the headers do.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+
+namespace SudoVdaTest
+{
+	inline int& Failures()
+	{
+		static int Count = 0;
+		return Count;
+	}
+
+	inline void Fail(const char* File, int Line, const char* Expression)
+	{
+		fprintf(stderr, "%s:%d: check failed: %s\n", File, Line, Expression);
+		Failures()++;
+	}
+
+	// Wall clock for the benchmarks, in nanoseconds
+	inline uint64_t NowNs()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+#define CHECK(Expression) \
+	do { if (!(Expression)) SudoVdaTest::Fail(__FILE__, __LINE__, #Expression); } while (0)
+
+#define CHECK_EQ(Actual, Expected) \
+	do { if (!((Actual) == (Expected))) { \
+		SudoVdaTest::Fail(__FILE__, __LINE__, #Actual " == " #Expected); \
+		fprintf(stderr, "    actual %lld, expected %lld\n", (long long)(Actual), (long long)(Expected)); \
+	} } while (0)
+
+#define TEST_RESULT() \
+	(SudoVdaTest::Failures() ? (fprintf(stderr, "%d check(s) failed\n", SudoVdaTest::Failures()), 1) : 0)
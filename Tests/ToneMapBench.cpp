@@ -0,0 +1,137 @@
+// HDR to SDR tone mapping of 4K and 8K frames, scRGB and HDR10, on every instruction set the CPU supports, and the
+// cost of rebuilding the curve when the HDR metadata changes. The numbers depend on the machine and are only reported,
+// what is checked is that each SIMD path stays within one code value of the scalar one.
+
+#include "TestHarness.h"
+#include "ToneMap.h"
+#include "PixelConvert.h"
+#include <sudovda-frame.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+
+namespace
+{
+	const char* IsaNames[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+	constexpr uint32_t MaxWidth = 7680;
+	constexpr uint32_t MaxHeight = 4320;
+	constexpr int ConfigureRuns = 100;
+
+	// Float to FP16 by truncation, enough to feed the mapper values in range
+	uint16_t ToHalf(float Value)
+	{
+		uint32_t Bits;
+		memcpy(&Bits, &Value, sizeof(Bits));
+		uint32_t Sign = (Bits >> 16) & 0x8000;
+		int32_t Exponent = (int32_t)((Bits >> 23) & 0xff) - 127 + 15;
+		if (Exponent <= 0)
+		{
+			return (uint16_t)Sign;
+		}
+		if (Exponent >= 31)
+		{
+			return (uint16_t)(Sign | 0x7c00);
+		}
+		return (uint16_t)(Sign | (Exponent << 10) | ((Bits & 0x7fffff) >> 13));
+	}
+
+	int MaxDifference(const std::vector<uint8_t>& First, const std::vector<uint8_t>& Second, size_t Bytes)
+	{
+		int Difference = 0;
+		for (size_t i = 0; i < Bytes; i++)
+		{
+			int Value = abs((int)First[i] - (int)Second[i]);
+			Difference = Value > Difference ? Value : Difference;
+		}
+		return Difference;
+	}
+
+	void Run(const ToneMapper& Mapper, const char* Name, uint32_t Format, const uint8_t* pSrc, size_t SrcPitch,
+		uint32_t Width, uint32_t Height, int Runs, std::vector<uint8_t>& Dst, std::vector<uint8_t>& Reference)
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2,
+			PIXEL_CONVERT_ISA_NEON };
+		size_t DstPitch = (size_t)Width * 4;
+		size_t DstBytes = DstPitch * Height;
+
+		printf("%ux%u %s\n", Width, Height, Name);
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertSetIsa(Isa))
+			{
+				continue;
+			}
+
+			uint64_t Start = SudoVdaTest::NowNs();
+			for (int i = 0; i < Runs; i++)
+			{
+				Mapper.Map(Format, pSrc, SrcPitch, Dst.data(), DstPitch, 0, 0, Width, Height);
+			}
+			uint64_t ElapsedNs = (SudoVdaTest::NowNs() - Start) / Runs;
+
+			if (Isa == PIXEL_CONVERT_ISA_SCALAR)
+			{
+				memcpy(Reference.data(), Dst.data(), DstBytes);
+			}
+			else
+			{
+				CHECK(MaxDifference(Dst, Reference, DstBytes) <= 1);
+			}
+			printf("  %-7s %8.2f ms/frame %6.2f ns/pixel\n", IsaNames[Isa], ElapsedNs / 1e6,
+				(double)ElapsedNs / ((uint64_t)Width * Height));
+		}
+	}
+}
+
+int main()
+{
+	// Sized for 8K, the 4K runs use the start of each buffer. Light up to 1500 nits with some of it outside BT.709, and
+	// HDR10 codes all over the range.
+	constexpr size_t MaxPixels = (size_t)MaxWidth * MaxHeight;
+	std::vector<uint16_t> ScRgb(MaxPixels * 4);
+	std::vector<uint32_t> Hdr10(MaxPixels);
+	uint32_t Random = 1;
+	for (size_t i = 0; i < MaxPixels; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			Random = Random * 1103515245 + 12345;
+			ScRgb[i * 4 + c] = ToHalf((float)((Random >> 8) % 19000) / 1000.0f - 0.25f);
+		}
+		ScRgb[i * 4 + 3] = ToHalf(1.0f);
+		Random = Random * 1103515245 + 12345;
+		Hdr10[i] = (Random >> 2) | 0xC0000000;
+	}
+
+	std::vector<uint8_t> Dst(MaxPixels * 4);
+	std::vector<uint8_t> Reference(MaxPixels * 4);
+	ToneMapper Mapper(ToneMapDefaultPeakNits, 203.0f);
+
+	uint64_t Start = SudoVdaTest::NowNs();
+	for (int i = 0; i < ConfigureRuns; i++)
+	{
+		Mapper.Configure(i % 2 ? 1000.0f : 1500.0f, 203.0f);
+	}
+	printf("configure %.1f us\n", (SudoVdaTest::NowNs() - Start) / 1e3 / ConfigureRuns);
+
+	const struct {
+		uint32_t Width;
+		uint32_t Height;
+		int Runs;
+	} Sizes[] = { { 3840, 2160, 2 }, { MaxWidth, MaxHeight, 1 } };
+	for (const auto& Size : Sizes)
+	{
+		Run(Mapper, "scRGB", SUVDA_FRAME_FORMAT_RGBA16F, reinterpret_cast<const uint8_t*>(ScRgb.data()),
+			(size_t)Size.Width * 8, Size.Width, Size.Height, Size.Runs, Dst, Reference);
+		Run(Mapper, "HDR10", SUVDA_FRAME_FORMAT_RGB10A2, reinterpret_cast<const uint8_t*>(Hdr10.data()),
+			(size_t)Size.Width * 4, Size.Width, Size.Height, Size.Runs, Dst, Reference);
+	}
+
+	CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	return TEST_RESULT();
+}
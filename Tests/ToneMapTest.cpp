@@ -0,0 +1,268 @@
+// HDR tone mapping: every instruction set against a double precision model of the BT.2390 EETF for scRGB and HDR10
+// input, the fixed points of the curve (black, the knee, SDR white and the source peak), monotonic gray ramps and
+// partial updates.
+
+#include "TestHarness.h"
+#include "ToneMap.h"
+#include "PixelConvert.h"
+#include <sudovda-frame.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+using namespace SUDOVDA;
+
+namespace
+{
+	const double Peak = 1000.0;
+	const double White = 203.0;
+
+	uint16_t ToHalf(float Value)
+	{
+		uint32_t Bits;
+		memcpy(&Bits, &Value, sizeof(Bits));
+		uint32_t Sign = (Bits >> 16) & 0x8000;
+		int32_t Exponent = (int32_t)((Bits >> 23) & 0xff) - 127 + 15;
+		if (Exponent <= 0)
+		{
+			return (uint16_t)Sign;
+		}
+		if (Exponent >= 31)
+		{
+			return (uint16_t)(Sign | 0x7c00);
+		}
+		return (uint16_t)(Sign | (Exponent << 10) | ((Bits & 0x7fffff) >> 13));
+	}
+
+	double FromHalf(uint16_t Half)
+	{
+		int Exponent = (Half >> 10) & 31;
+		int Mantissa = Half & 1023;
+		double Value = Exponent ? ldexp(1024 + Mantissa, Exponent - 25) : ldexp(Mantissa, -24);
+		return Half & 0x8000 ? -Value : Value;
+	}
+
+	// SMPTE ST 2084, 1.0 = 10000 nits
+	const double M1 = 2610.0 / 16384;
+	const double M2 = 2523.0 / 4096 * 128;
+	const double C1 = 3424.0 / 4096;
+	const double C2 = 2413.0 / 4096 * 32;
+	const double C3 = 2392.0 / 4096 * 32;
+
+	double PqEncode(double Linear)
+	{
+		double Power = pow(std::max(Linear, 0.0), M1);
+		return pow((C1 + C2 * Power) / (1 + C3 * Power), M2);
+	}
+
+	double PqDecode(double Encoded)
+	{
+		double Power = pow(std::max(Encoded, 0.0), 1 / M2);
+		return pow(std::max(Power - C1, 0.0) / (C2 - C3 * Power), 1 / M1);
+	}
+
+	// BT.2390 with the source peak mapped to SDR white
+	double Eetf(double Linear)
+	{
+		double PeakE = PqEncode(Peak / 10000);
+		double MaxLum = PqEncode(White / 10000) / PeakE;
+		double Knee = std::max(1.5 * MaxLum - 0.5, 0.0);
+		double E = std::min(PqEncode(Linear) / PeakE, 1.0);
+		if (E > Knee)
+		{
+			double T = (E - Knee) / (1 - Knee);
+			double T2 = T * T;
+			double T3 = T2 * T;
+			E = (2 * T3 - 3 * T2 + 1) * Knee + (T3 - 2 * T2 + T) * (1 - Knee) + (-2 * T3 + 3 * T2) * MaxLum;
+		}
+		return PqDecode(E * PeakE);
+	}
+
+	int Srgb(double Linear)
+	{
+		Linear = std::min(std::max(Linear, 0.0), 1.0);
+		double Encoded = Linear <= 0.0031308 ? 12.92 * Linear : 1.055 * pow(Linear, 1 / 2.4) - 0.055;
+		return (int)(Encoded * 255 + 0.5);
+	}
+
+	// Linear BT.709 light, 1.0 = 10000 nits, to BGRA8
+	void Reference(double R, double G, double B, uint8_t* pOut)
+	{
+		double Max = std::max(R, std::max(G, B));
+		double Gain = Max > 0 ? Eetf(Max) / Max / (White / 10000) : 0;
+		pOut[0] = (uint8_t)Srgb(B * Gain);
+		pOut[1] = (uint8_t)Srgb(G * Gain);
+		pOut[2] = (uint8_t)Srgb(R * Gain);
+		pOut[3] = 255;
+	}
+
+	void TestFormats()
+	{
+		CHECK(ToneMapper::IsSupportedFormat(SUVDA_FRAME_FORMAT_RGBA16F));
+		CHECK(ToneMapper::IsSupportedFormat(SUVDA_FRAME_FORMAT_RGB10A2));
+		CHECK(!ToneMapper::IsSupportedFormat(SUVDA_FRAME_FORMAT_BGRA8));
+
+		ToneMapper Mapper((float)Peak, (float)White);
+		CHECK_EQ(Mapper.SourcePeakNits(), (float)Peak);
+		CHECK_EQ(Mapper.SdrWhiteNits(), (float)White);
+		Mapper.Configure(4000.0f, 100.0f);
+		CHECK_EQ(Mapper.SourcePeakNits(), 4000.0f);
+		CHECK_EQ(Mapper.SdrWhiteNits(), 100.0f);
+	}
+
+	// Random scRGB (negative, in range and far above peak) and HDR10 frames, every path within one code value of the
+	// model and of the scalar path
+	void TestAgainstReference()
+	{
+		const PIXEL_CONVERT_ISA Isas[] = { PIXEL_CONVERT_ISA_SCALAR, PIXEL_CONVERT_ISA_SSE41, PIXEL_CONVERT_ISA_AVX2, PIXEL_CONVERT_ISA_NEON };
+		const char* Names[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+		const uint32_t Width = 1031;
+		const uint32_t Height = 7;
+		const float Bt2020To709[9] = {
+			1.660491f, -0.587641f, -0.072850f,
+			-0.124550f, 1.132900f, -0.008349f,
+			-0.018151f, -0.100579f, 1.118730f,
+		};
+
+		std::mt19937 Random(1);
+		std::uniform_real_distribution<float> Linear(-0.2f, 40.0f);
+		std::uniform_real_distribution<float> Exponent(-12.0f, 4.0f);
+		std::vector<uint16_t> ScRgb(Width * Height * 4);
+		std::vector<uint32_t> Hdr10(Width * Height);
+		std::vector<uint8_t> ScRgbExpected(Width * Height * 4);
+		std::vector<uint8_t> Hdr10Expected(Width * Height * 4);
+		for (size_t i = 0; i < Width * Height; i++)
+		{
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				ScRgb[i * 4 + c] = ToHalf(i % 3 ? powf(2.0f, Exponent(Random)) : Linear(Random));
+			}
+			ScRgb[i * 4 + 3] = ToHalf(1.0f);
+			Hdr10[i] = (Random() & 0x3ff) | (Random() & 0x3ff) << 10 | (Random() & 0x3ff) << 20 | 3u << 30;
+
+			// scRGB 1.0 is 80 nits
+			Reference(FromHalf(ScRgb[i * 4]) * 0.008, FromHalf(ScRgb[i * 4 + 1]) * 0.008, FromHalf(ScRgb[i * 4 + 2]) * 0.008, &ScRgbExpected[i * 4]);
+
+			double R = PqDecode((Hdr10[i] & 1023) / 1023.0);
+			double G = PqDecode((Hdr10[i] >> 10 & 1023) / 1023.0);
+			double B = PqDecode((Hdr10[i] >> 20 & 1023) / 1023.0);
+			const float* M = Bt2020To709;
+			Reference(M[0] * R + M[1] * G + M[2] * B, M[3] * R + M[4] * G + M[5] * B, M[6] * R + M[7] * G + M[8] * B, &Hdr10Expected[i * 4]);
+		}
+
+		ToneMapper Mapper((float)Peak, (float)White);
+		std::vector<uint8_t> ScRgbScalar;
+		std::vector<uint8_t> Hdr10Scalar;
+		for (auto Isa : Isas)
+		{
+			if (!PixelConvertSetIsa(Isa))
+			{
+				printf("%s not supported, skipped\n", Names[Isa]);
+				continue;
+			}
+
+			std::vector<uint8_t> ScRgbOut(Width * Height * 4);
+			std::vector<uint8_t> Hdr10Out(Width * Height * 4);
+			Mapper.Map(SUVDA_FRAME_FORMAT_RGBA16F, (const uint8_t*)ScRgb.data(), Width * 8, ScRgbOut.data(), Width * 4, 0, 0, Width, Height);
+			Mapper.Map(SUVDA_FRAME_FORMAT_RGB10A2, (const uint8_t*)Hdr10.data(), Width * 4, Hdr10Out.data(), Width * 4, 0, 0, Width, Height);
+			if (Isa == PIXEL_CONVERT_ISA_SCALAR)
+			{
+				ScRgbScalar = ScRgbOut;
+				Hdr10Scalar = Hdr10Out;
+			}
+
+			int ModelDifference = 0;
+			int ScalarDifference = 0;
+			for (size_t i = 0; i < ScRgbOut.size(); i++)
+			{
+				ModelDifference = std::max(ModelDifference, abs(ScRgbOut[i] - ScRgbExpected[i]));
+				ModelDifference = std::max(ModelDifference, abs(Hdr10Out[i] - Hdr10Expected[i]));
+				ScalarDifference = std::max(ScalarDifference, abs(ScRgbOut[i] - ScRgbScalar[i]));
+				ScalarDifference = std::max(ScalarDifference, abs(Hdr10Out[i] - Hdr10Scalar[i]));
+			}
+			printf("%s: %d from the model, %d from scalar\n", Names[Isa], ModelDifference, ScalarDifference);
+			CHECK(ModelDifference <= 1);
+			CHECK(ScalarDifference <= 1);
+		}
+
+		CHECK(PixelConvertSetIsa(PixelConvertBestIsa()));
+	}
+
+	uint8_t MapGray(const ToneMapper& Mapper, double Nits)
+	{
+		float Value = (float)(Nits / 80.0);
+		uint16_t Pixel[4] = { ToHalf(Value), ToHalf(Value), ToHalf(Value), ToHalf(1.0f) };
+		uint8_t Out[4] = {};
+		Mapper.Map(SUVDA_FRAME_FORMAT_RGBA16F, (const uint8_t*)Pixel, 8, Out, 4, 0, 0, 1, 1);
+		CHECK(Out[0] == Out[1] && Out[1] == Out[2]);
+		CHECK_EQ(Out[3], 255);
+		return Out[0];
+	}
+
+	// Black stays black, levels well below SDR white pass unchanged, the source peak and anything above it end up at
+	// SDR white, and brighter input is never darker, give or take the code value the float math may be off by
+	void TestCurve()
+	{
+		ToneMapper Mapper((float)Peak, (float)White);
+		CHECK_EQ(MapGray(Mapper, 0.0), 0);
+		CHECK_EQ(MapGray(Mapper, -10.0), 0);
+		CHECK(abs(MapGray(Mapper, 80.0) - Srgb(80.0 / White)) <= 1);
+		CHECK(abs(MapGray(Mapper, 40.0) - Srgb(40.0 / White)) <= 1);
+		CHECK(MapGray(Mapper, White) < 255);
+		CHECK_EQ(MapGray(Mapper, Peak), 255);
+		CHECK_EQ(MapGray(Mapper, 10000.0), 255);
+
+		bool Monotonic = true;
+		uint8_t Brightest = 0;
+		for (double Nits = 0.01; Nits < 20000.0; Nits *= 1.01)
+		{
+			uint8_t Value = MapGray(Mapper, Nits);
+			Monotonic &= Value + 1 >= Brightest;
+			Brightest = std::max(Brightest, Value);
+		}
+		CHECK(Monotonic);
+
+		// Hue is kept: a saturated color above the knee keeps its channel ratios
+		uint16_t Orange[4] = { ToHalf(20.0f), ToHalf(10.0f), ToHalf(0.0f), ToHalf(1.0f) };
+		uint8_t Out[4];
+		Mapper.Map(SUVDA_FRAME_FORMAT_RGBA16F, (const uint8_t*)Orange, 8, Out, 4, 0, 0, 1, 1);
+		CHECK_EQ(Out[0], 0);
+		CHECK(Out[2] > Out[1] && Out[1] > 0);
+	}
+
+	// Only the requested rectangle of the destination is written
+	void TestRect()
+	{
+		const uint32_t Width = 40;
+		const uint32_t Height = 10;
+		std::vector<uint16_t> Src(Width * Height * 4, ToHalf(1.0f));
+		std::vector<uint8_t> Dst(Width * Height * 4, 7);
+		ToneMapper Mapper((float)Peak, (float)White);
+		Mapper.Map(SUVDA_FRAME_FORMAT_RGBA16F, (const uint8_t*)Src.data(), Width * 8, Dst.data(), Width * 4, 3, 2, 37, 9);
+
+		bool Contained = true;
+		for (uint32_t y = 0; y < Height; y++)
+		{
+			for (uint32_t x = 0; x < Width; x++)
+			{
+				bool Inside = x >= 3 && x < 37 && y >= 2 && y < 9;
+				Contained &= (Dst[(y * Width + x) * 4 + 3] == 255) == Inside;
+			}
+		}
+		CHECK(Contained);
+	}
+}
+
+int main()
+{
+	TestFormats();
+	TestAgainstReference();
+	TestCurve();
+	TestRect();
+	return TEST_RESULT();
+}
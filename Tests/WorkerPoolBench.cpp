@@ -0,0 +1,125 @@
+// Swap-chain processing for 1 to 64 simulated monitors, each frame hashing a quarter of a 1080p BGRA frame: a thread
+// per monitor as the driver does by default, against a strand per monitor on the shared pool (sharedWorkerPool). The
+// numbers depend on the machine and are only reported, what is checked is that every frame is processed, in order per
+// monitor, with the hash the frame should have.
+
+#include "TestHarness.h"
+#include "WorkerPool.h"
+#include "FrameHash.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	constexpr uint32_t Width = 1920;
+	constexpr uint32_t Height = 1080;
+	constexpr uint32_t Pitch = Width * 4;
+	constexpr uint32_t Quarters = 4;
+	constexpr uint32_t TotalFrames = 1024;
+
+	struct MONITOR
+	{
+		uint32_t Processed = 0;
+		bool InOrder = true;
+		uint64_t HashSum = 0;
+	};
+
+	void ProcessFrame(const std::vector<uint8_t>& Frame, MONITOR& Monitor, uint32_t Number)
+	{
+		uint32_t Rows = Height / Quarters;
+		Monitor.HashSum += HashRegion(Frame.data() + (size_t)(Number % Quarters) * Rows * Pitch, Pitch, Pitch, Rows);
+		Monitor.InOrder &= Monitor.Processed == Number;
+		Monitor.Processed++;
+	}
+
+	bool Verify(const std::vector<MONITOR>& Monitors, uint32_t FramesPerMonitor, uint64_t ExpectedSum)
+	{
+		bool Valid = true;
+		for (const auto& Monitor : Monitors)
+		{
+			Valid &= Monitor.Processed == FramesPerMonitor && Monitor.InOrder && Monitor.HashSum == ExpectedSum;
+		}
+		return Valid;
+	}
+
+	void Run(const std::vector<uint8_t>& Frame, WorkerPool& Pool, uint32_t MonitorCount)
+	{
+		uint32_t FramesPerMonitor = TotalFrames / MonitorCount;
+		uint64_t ExpectedSum = 0;
+		for (uint32_t i = 0; i < FramesPerMonitor; i++)
+		{
+			uint32_t Rows = Height / Quarters;
+			ExpectedSum += HashRegion(Frame.data() + (size_t)(i % Quarters) * Rows * Pitch, Pitch, Pitch, Rows);
+		}
+
+		std::vector<MONITOR> Monitors(MonitorCount);
+		uint64_t Start = SudoVdaTest::NowNs();
+		std::vector<std::thread> Threads;
+		for (auto& Monitor : Monitors)
+		{
+			Threads.emplace_back([&] {
+				for (uint32_t i = 0; i < FramesPerMonitor; i++)
+				{
+					ProcessFrame(Frame, Monitor, i);
+				}
+			});
+		}
+		for (auto& Thread : Threads)
+		{
+			Thread.join();
+		}
+		uint64_t ThreadNs = SudoVdaTest::NowNs() - Start;
+		CHECK(Verify(Monitors, FramesPerMonitor, ExpectedSum));
+
+		Monitors.assign(MonitorCount, MONITOR{});
+		WORKER_POOL_STATS Before = Pool.Stats();
+		Start = SudoVdaTest::NowNs();
+		{
+			std::vector<std::unique_ptr<WorkerStrand>> Strands;
+			for (uint32_t m = 0; m < MonitorCount; m++)
+			{
+				Strands.push_back(std::make_unique<WorkerStrand>(Pool));
+			}
+			for (uint32_t i = 0; i < FramesPerMonitor; i++)
+			{
+				for (uint32_t m = 0; m < MonitorCount; m++)
+				{
+					MONITOR* pMonitor = &Monitors[m];
+					Strands[m]->Post([&Frame, pMonitor, i] { ProcessFrame(Frame, *pMonitor, i); });
+				}
+			}
+			for (auto& Strand : Strands)
+			{
+				Strand->WaitIdle();
+			}
+		}
+		uint64_t PoolNs = SudoVdaTest::NowNs() - Start;
+		WORKER_POOL_STATS After = Pool.Stats();
+		CHECK(Verify(Monitors, FramesPerMonitor, ExpectedSum));
+
+		printf("%2u monitors: thread per monitor %7.0f frames/s, %u workers %7.0f frames/s, "
+			"%llu of %llu strand runs stolen\n", MonitorCount, TotalFrames * 1e9 / ThreadNs, Pool.ThreadCount(),
+			TotalFrames * 1e9 / PoolNs, (unsigned long long)(After.Stolen - Before.Stolen),
+			(unsigned long long)(After.Executed - Before.Executed));
+	}
+}
+
+int main()
+{
+	std::vector<uint8_t> Frame((size_t)Pitch * Height);
+	for (size_t i = 0; i < Frame.size(); i++)
+	{
+		Frame[i] = (uint8_t)(i * 31);
+	}
+
+	WorkerPool Pool;
+	for (uint32_t MonitorCount : { 1, 4, 16, 64 })
+	{
+		Run(Frame, Pool, MonitorCount);
+	}
+	return TEST_RESULT();
+}
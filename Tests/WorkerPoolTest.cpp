@@ -0,0 +1,162 @@
+// WorkerPool and WorkerStrand: strands run their jobs in order and one at a time, ParallelFor covers every index once
+// (also from inside a job), and the pool drains its queue on destruction.
+
+#include "TestHarness.h"
+#include "WorkerPool.h"
+
+#include <set>
+
+using namespace Microsoft::IndirectDisp;
+
+namespace
+{
+	void TestThreads()
+	{
+		std::mutex Lock;
+		std::set<uint32_t> Started;
+		{
+			WorkerPool Pool(3, [&](uint32_t Index) {
+				std::lock_guard<std::mutex> Guard(Lock);
+				Started.insert(Index);
+			});
+			CHECK_EQ(Pool.ThreadCount(), 3u);
+		}
+		CHECK(Started == std::set<uint32_t>({ 0, 1, 2 }));
+
+		WorkerPool Default;
+		CHECK(Default.ThreadCount() >= 1);
+	}
+
+	void TestStrands()
+	{
+		constexpr int Strands = 16;
+		constexpr int Jobs = 2000;
+		WorkerPool Pool(4);
+		std::vector<std::unique_ptr<WorkerStrand>> Strand;
+		std::vector<std::vector<int>> Seen(Strands);
+		std::vector<std::atomic<int>> Running(Strands);
+		std::atomic<int> Overlaps{0};
+
+		for (int s = 0; s < Strands; s++)
+		{
+			Strand.emplace_back(new WorkerStrand(Pool));
+		}
+
+		// Posting from several threads at once, like the swap-chains of different monitors
+		std::vector<std::thread> Producers;
+		for (int p = 0; p < 4; p++)
+		{
+			Producers.emplace_back([&, p] {
+				for (int i = 0; i < Jobs; i++)
+				{
+					for (int s = p; s < Strands; s += 4)
+					{
+						Strand[s]->Post([&, s, i] {
+							Overlaps += Running[s].fetch_add(1) != 0;
+							Seen[s].push_back(i);
+							Running[s].fetch_sub(1);
+						});
+					}
+				}
+			});
+		}
+		for (auto& Producer : Producers)
+		{
+			Producer.join();
+		}
+		for (auto& s : Strand)
+		{
+			s->WaitIdle();
+		}
+
+		CHECK_EQ(Overlaps.load(), 0);
+		bool InOrder = true;
+		for (auto& Sequence : Seen)
+		{
+			InOrder &= Sequence.size() == Jobs;
+			for (int i = 0; InOrder && i < Jobs; i++)
+			{
+				InOrder &= Sequence[i] == i;
+			}
+		}
+		CHECK(InOrder);
+		CHECK(Pool.Stats().Executed >= (uint64_t)Strands);
+
+		// A strand can be reused after going idle, and a job may post to its own strand
+		std::vector<int> Chain;
+		Strand[0]->Post([&] {
+			Chain.push_back(1);
+			Strand[0]->Post([&] { Chain.push_back(2); });
+		});
+		Strand[0]->WaitIdle();
+		CHECK(Chain == std::vector<int>({ 1, 2 }));
+
+		// Destroying a strand waits for its jobs
+		std::atomic<int> Done{0};
+		{
+			WorkerStrand Temporary(Pool);
+			for (int i = 0; i < 100; i++)
+			{
+				Temporary.Post([&] { Done++; });
+			}
+		}
+		CHECK_EQ(Done.load(), 100);
+	}
+
+	void TestParallelFor()
+	{
+		WorkerPool Pool(4);
+
+		for (uint32_t Count : { 0u, 1u, 7u, 1000u })
+		{
+			std::vector<std::atomic<int>> Hits(Count);
+			Pool.ParallelFor(Count, [&](uint32_t i) { Hits[i]++; });
+			bool Once = true;
+			for (auto& Hit : Hits)
+			{
+				Once &= Hit.load() == 1;
+			}
+			CHECK(Once);
+		}
+
+		// From inside jobs of several strands at once, every worker busy: the callers still make progress
+		std::vector<std::unique_ptr<WorkerStrand>> Strands;
+		std::atomic<uint64_t> Sum{0};
+		for (int s = 0; s < 8; s++)
+		{
+			Strands.emplace_back(new WorkerStrand(Pool));
+			Strands.back()->Post([&] {
+				Pool.ParallelFor(64, [&](uint32_t i) {
+					Pool.ParallelFor(4, [&](uint32_t j) { Sum += i * 4 + j; });
+				});
+			});
+		}
+		for (auto& Strand : Strands)
+		{
+			Strand->WaitIdle();
+		}
+		CHECK_EQ(Sum.load(), 8u * (256 * 255 / 2));
+	}
+
+	void TestDrainOnDestruction()
+	{
+		std::atomic<int> Ran{0};
+		{
+			WorkerPool Pool(2);
+			for (int i = 0; i < 10000; i++)
+			{
+				Pool.Submit([&] { Ran++; });
+			}
+		}
+		CHECK_EQ(Ran.load(), 10000);
+	}
+}
+
+int main()
+{
+	TestThreads();
+	TestStrands();
+	TestParallelFor();
+	TestDrainOnDestruction();
+	return TEST_RESULT();
+}
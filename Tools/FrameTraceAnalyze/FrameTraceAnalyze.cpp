@@ -0,0 +1,239 @@
+// Latency breakdown of frame traces written by IOCTL_START_FRAME_TRACE, see sudovda-trace.h.
+//
+//   FrameTraceAnalyze <driver trace> [consumer trace...]
+//
+// Consumer traces are joined to the driver's records by FrameNumber and add the publish to pickup stage. Consumers
+// have to stamp pickups with the same clock as the driver (QueryPerformanceCounter on the same machine).
+//
+// Only needs a C++17 compiler and the Common/Include headers, so it builds on any platform with CMake:
+//   cmake -S Tools/FrameTraceAnalyze -B build && cmake --build build
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <sudovda-trace.h>
+
+using namespace SUDOVDA;
+
+namespace
+{
+	struct Stage
+	{
+		const char* Name;
+		std::vector<uint64_t> Samples;  // Ticks
+	};
+
+	bool ReadTrace(const char* pPath, SUVDA_TRACE_HEADER& Header, std::vector<SUVDA_TRACE_RECORD>& Records)
+	{
+		FILE* pFile = fopen(pPath, "rb");
+		if (!pFile)
+		{
+			fprintf(stderr, "%s: can't open\n", pPath);
+			return false;
+		}
+
+		bool Valid = fread(&Header, sizeof(Header), 1, pFile) == 1 &&
+			Header.Magic == SUVDA_TRACE_MAGIC &&
+			Header.Version == SUVDA_TRACE_VERSION &&
+			Header.HeaderSize >= sizeof(SUVDA_TRACE_HEADER) &&
+			Header.RecordSize >= sizeof(SUVDA_TRACE_RECORD) &&
+			Header.QpcFrequency;
+		if (!Valid)
+		{
+			fprintf(stderr, "%s: not a frame trace\n", pPath);
+			fclose(pFile);
+			return false;
+		}
+
+		// Newer versions may only append to the header and records
+		fseek(pFile, Header.HeaderSize, SEEK_SET);
+		std::vector<uint8_t> Buffer(Header.RecordSize);
+		while (fread(Buffer.data(), Buffer.size(), 1, pFile) == 1)
+		{
+			SUVDA_TRACE_RECORD Record;
+			memcpy(&Record, Buffer.data(), sizeof(Record));
+			Records.push_back(Record);
+		}
+
+		fclose(pFile);
+		return true;
+	}
+
+	void AddSample(Stage& Target, uint64_t From, uint64_t To)
+	{
+		// Missing stamps and clock mismatches between processes are left out rather than counted as zero
+		if (From && To >= From)
+		{
+			Target.Samples.push_back(To - From);
+		}
+	}
+
+	// Exact nearest-rank percentile of sorted samples
+	uint64_t Percentile(const std::vector<uint64_t>& Sorted, double Fraction)
+	{
+		size_t Rank = (size_t)(Fraction * Sorted.size() + 0.999999);
+		return Sorted[Rank ? Rank - 1 : 0];
+	}
+
+	void PrintStage(Stage& Target, uint64_t Frequency)
+	{
+		if (Target.Samples.empty())
+		{
+			printf("%-18s %10s\n", Target.Name, "-");
+			return;
+		}
+
+		std::sort(Target.Samples.begin(), Target.Samples.end());
+
+		double Sum = 0;
+		for (uint64_t Sample : Target.Samples)
+		{
+			Sum += (double)Sample;
+		}
+
+		auto Us = [Frequency](double Ticks)
+		{
+			return Ticks * 1000000.0 / (double)Frequency;
+		};
+
+		printf("%-18s %10zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", Target.Name, Target.Samples.size(),
+			Us(Sum / Target.Samples.size()),
+			Us((double)Percentile(Target.Samples, 0.5)),
+			Us((double)Percentile(Target.Samples, 0.9)),
+			Us((double)Percentile(Target.Samples, 0.99)),
+			Us((double)Percentile(Target.Samples, 0.999)),
+			Us((double)Target.Samples.back()));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <driver trace> [consumer trace...]\n", argv[0]);
+		return 2;
+	}
+
+	SUVDA_TRACE_HEADER Header;
+	std::vector<SUVDA_TRACE_RECORD> Records;
+	if (!ReadTrace(argv[1], Header, Records))
+	{
+		return 1;
+	}
+
+	std::map<uint64_t, uint64_t> Pickups;  // FrameNumber to first pickup
+	for (int i = 2; i < argc; i++)
+	{
+		SUVDA_TRACE_HEADER ConsumerHeader;
+		std::vector<SUVDA_TRACE_RECORD> ConsumerRecords;
+		if (!ReadTrace(argv[i], ConsumerHeader, ConsumerRecords))
+		{
+			return 1;
+		}
+
+		if (ConsumerHeader.QpcFrequency != Header.QpcFrequency)
+		{
+			fprintf(stderr, "%s: recorded with a different clock\n", argv[i]);
+			return 1;
+		}
+
+		for (auto& Record : ConsumerRecords)
+		{
+			if (Record.Source != SUVDA_TRACE_SOURCE_CONSUMER || !Record.PickupQpc)
+			{
+				continue;
+			}
+
+			auto It = Pickups.find(Record.FrameNumber);
+			if (It == Pickups.end() || Record.PickupQpc < It->second)
+			{
+				Pickups[Record.FrameNumber] = Record.PickupQpc;
+			}
+		}
+	}
+
+	Stage Stages[] = {
+		{ "present-acquire", {} },
+		{ "acquire-process", {} },
+		{ "process-finish", {} },
+		{ "acquire-publish", {} },
+		{ "publish-pickup", {} },
+		{ "present-publish", {} },
+		{ "present-pickup", {} },
+	};
+
+	uint64_t DriverRecords = 0, Refinements = 0, Unchanged = 0, RingGaps = 0, OsGaps = 0, Joined = 0;
+	uint64_t LastFrameNumber = 0, LastPresentation = 0;
+	bool First = true;
+
+	for (auto& Record : Records)
+	{
+		if (Record.Source != SUVDA_TRACE_SOURCE_DRIVER)
+		{
+			continue;
+		}
+
+		DriverRecords++;
+		if (!First && Record.FrameNumber > LastFrameNumber + 1)
+		{
+			// Records the writer had to drop, or frames published while the trace was being restarted
+			RingGaps += Record.FrameNumber - LastFrameNumber - 1;
+		}
+		LastFrameNumber = Record.FrameNumber;
+		First = false;
+
+		if (Record.Flags & SUVDA_FRAME_FLAG_UNCHANGED)
+		{
+			Unchanged++;
+		}
+
+		auto Pickup = Pickups.find(Record.FrameNumber);
+		uint64_t PickupQpc = Pickup != Pickups.end() ? Pickup->second : 0;
+		if (PickupQpc)
+		{
+			Joined++;
+			AddSample(Stages[4], Record.PublishQpc, PickupQpc);
+		}
+
+		// Refinement passes republish an old frame, only their publish to pickup time is meaningful
+		if (Record.Flags & SUVDA_FRAME_FLAG_REFINEMENT)
+		{
+			Refinements++;
+			continue;
+		}
+
+		if (LastPresentation && Record.PresentationFrameNumber > LastPresentation + 1)
+		{
+			OsGaps += Record.PresentationFrameNumber - LastPresentation - 1;
+		}
+		LastPresentation = Record.PresentationFrameNumber;
+
+		AddSample(Stages[0], Record.PresentQpc, Record.AcquireQpc);
+		AddSample(Stages[1], Record.AcquireQpc, Record.ProcessQpc);
+		AddSample(Stages[2], Record.ProcessQpc, Record.FinishQpc);
+		AddSample(Stages[3], Record.AcquireQpc, Record.PublishQpc);
+		AddSample(Stages[5], Record.PresentQpc, Record.PublishQpc);
+		if (PickupQpc)
+		{
+			AddSample(Stages[6], Record.PresentQpc, PickupQpc);
+		}
+	}
+
+	printf("%llu frames, %llu refinements, %llu unchanged, %llu picked up\n", (unsigned long long)DriverRecords,
+		(unsigned long long)Refinements, (unsigned long long)Unchanged, (unsigned long long)Joined);
+	printf("%llu frames missing from the trace, %llu presented frames never acquired\n\n",
+		(unsigned long long)RingGaps, (unsigned long long)OsGaps);
+
+	printf("%-18s %10s %10s %10s %10s %10s %10s %10s\n", "stage (us)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (auto& Target : Stages)
+	{
+		PrintStage(Target, Header.QpcFrequency);
+	}
+
+	return 0;
+}